@@ -0,0 +1,994 @@
+/*
+Copyright(c) 2016 Cedric Jimenez
+
+This file is part of lw-mqtt.
+
+lw-mqtt is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+lw-mqtt is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <chrono>
+#include <new>
+#include <string>
+#include <vector>
+#include <iomanip>
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+using namespace std;
+
+#include "mqtt.h"
+#include "mqtt_errno.h"
+#include "buffer_stream.h"
+#include "mqtt_packet_serialize.h"
+#include "mqtt_packet_deserialize.h"
+
+/** \brief Program version */
+#define LW_MQTT_BENCH_VERSION "1.0"
+
+/** \brief Size of the packet buffers */
+#define LW_MQTT_BENCH_BUFFER_SIZE   8192u
+
+/** \brief Size of the string buffers used for deserialization */
+#define LW_MQTT_BENCH_STRING_SIZE   1024u
+
+/** \brief Packet id used in the benchmarks */
+#define LW_MQTT_BENCH_PACKET_ID     0x1234u
+
+
+/** \brief Output format */
+enum lw_mqtt_bench_format_t
+{
+    /** \brief Human readable table */
+    LW_MQTT_BENCH_FORMAT_TEXT,
+    /** \brief Comma separated values */
+    LW_MQTT_BENCH_FORMAT_CSV,
+    /** \brief One JSON object per line */
+    LW_MQTT_BENCH_FORMAT_JSON
+};
+
+/** Program parameters */
+struct lw_mqtt_bench_params_t
+{
+
+    /** \brief Construtor to set the default values */
+    lw_mqtt_bench_params_t()
+        : iterations(100000u)
+        , format(LW_MQTT_BENCH_FORMAT_TEXT)
+        , filter("")
+    {}
+
+    /** \brief Number of iterations per benchmark */
+    uint32_t iterations;
+
+    /** \brief Output format */
+    lw_mqtt_bench_format_t format;
+
+    /** \brief Only run the benchmarks whose name contains this string */
+    string filter;
+};
+
+/** \brief Benchmark context shared by all the serialize/deserialize functions */
+struct lw_mqtt_bench_context_t
+{
+    /** \brief Protocol level */
+    uint8_t protocol_level;
+    /** \brief Topic */
+    mqtt_const_string_t topic;
+    /** \brief Payload size in bytes */
+    uint32_t payload_size;
+    /** \brief QoS */
+    uint8_t qos;
+    /** \brief MQTT 5.0 properties, NULL for MQTT 3.1.1 */
+    mqtt_properties_t* properties;
+    /** \brief Pre-encoded PUBLISH template */
+    mqtt_publish_template_t publish_template;
+
+    /** \brief Output stream */
+    output_stream_t outstream;
+    /** \brief Input stream */
+    input_stream_t instream;
+
+    /** \brief Encoded packet */
+    uint8_t packet[LW_MQTT_BENCH_BUFFER_SIZE];
+    /** \brief Size in bytes of the encoded packet */
+    uint32_t packet_size;
+    /** \brief Payload */
+    uint8_t payload[LW_MQTT_BENCH_BUFFER_SIZE];
+    /** \brief Topic characters */
+    char topic_buffer[LW_MQTT_BENCH_STRING_SIZE];
+
+    /** \brief Deserialization buffers */
+    char string_buffers[4u][LW_MQTT_BENCH_STRING_SIZE];
+    /** \brief Deserialization payload buffer */
+    uint8_t data_buffer[LW_MQTT_BENCH_BUFFER_SIZE];
+};
+
+/** \brief Serialize a packet from the benchmark context */
+typedef bool (*lw_mqtt_bench_serialize_t)(lw_mqtt_bench_context_t& context);
+
+/** \brief Deserialize a packet body from the benchmark context */
+typedef bool (*lw_mqtt_bench_deserialize_t)(lw_mqtt_bench_context_t& context, const uint8_t packet_flags, const uint32_t packet_length);
+
+/** \brief Packet type under benchmark */
+struct lw_mqtt_bench_packet_t
+{
+    /** \brief Name */
+    const char* name;
+    /** \brief Packet type */
+    mqtt_control_packet_type_t type;
+    /** \brief Serialize function */
+    lw_mqtt_bench_serialize_t serialize;
+    /** \brief Deserialize function, NULL if the packet is only serialized */
+    lw_mqtt_bench_deserialize_t deserialize;
+    /** \brief Indicate if the packet depends on the topic length */
+    bool use_topic;
+    /** \brief Indicate if the packet depends on the payload size */
+    bool use_payload;
+    /** \brief Indicate if the packet depends on the QoS */
+    bool use_qos;
+};
+
+/** \brief Result of a benchmark */
+struct lw_mqtt_bench_result_t
+{
+    /** \brief Name */
+    string name;
+    /** \brief Operation : serialize or deserialize */
+    const char* operation;
+    /** \brief Protocol level */
+    uint8_t protocol_level;
+    /** \brief Topic length */
+    uint32_t topic_length;
+    /** \brief Payload size */
+    uint32_t payload_size;
+    /** \brief QoS */
+    uint8_t qos;
+    /** \brief Packet size in bytes */
+    uint32_t packet_size;
+    /** \brief Number of iterations */
+    uint32_t iterations;
+    /** \brief Nanoseconds per operation */
+    double ns_per_op;
+    /** \brief Bytes per second */
+    double bytes_per_sec;
+    /** \brief Allocations per operation */
+    double allocs_per_op;
+};
+
+
+
+/** \brief Number of heap allocations since the start of the program */
+static volatile uint64_t lw_mqtt_bench_alloc_count = 0u;
+
+/** \brief Topic lengths of the benchmark matrix */
+static const uint32_t lw_mqtt_bench_topic_lengths[] = { 8u, 64u, 256u };
+
+/** \brief Payload sizes of the benchmark matrix */
+static const uint32_t lw_mqtt_bench_payload_sizes[] = { 0u, 16u, 256u, 4096u };
+
+/** \brief QoS levels of the benchmark matrix */
+static const uint8_t lw_mqtt_bench_qos_levels[] = { 0u, 1u, 2u };
+
+/** \brief Protocol levels of the benchmark matrix */
+static const uint8_t lw_mqtt_bench_protocol_levels[] = { MQTT_PROTOCOL_LEVEL_V311, MQTT_PROTOCOL_LEVEL_V5 };
+
+
+
+/** \brief Print the version message */
+static void lw_mqtt_bench_print_version();
+
+/** \brief Print the usage message */
+static void lw_mqtt_bench_print_usage();
+
+/** \brief Parse the command line parameters */
+static bool lw_mqtt_bench_parse_parameters(lw_mqtt_bench_params_t& params, int argc, char* argv[]);
+
+/** \brief Prepare the benchmark context for a point of the matrix */
+static void lw_mqtt_bench_prepare(lw_mqtt_bench_context_t& context, mqtt_properties_t& properties, const uint8_t protocol_level,
+                                  const uint32_t topic_length, const uint32_t payload_size, const uint8_t qos);
+
+/** \brief Run the benchmarks of a packet type for a point of the matrix */
+static bool lw_mqtt_bench_run(lw_mqtt_bench_context_t& context, const lw_mqtt_bench_packet_t& packet, const uint32_t iterations,
+                              vector<lw_mqtt_bench_result_t>& results);
+
+/** \brief Print the benchmark results */
+static void lw_mqtt_bench_print_results(const vector<lw_mqtt_bench_result_t>& results, const lw_mqtt_bench_format_t format);
+
+/** \brief Serialize a CONNECT packet */
+static bool lw_mqtt_bench_serialize_connect(lw_mqtt_bench_context_t& context);
+/** \brief Serialize a CONNACK packet */
+static bool lw_mqtt_bench_serialize_connack(lw_mqtt_bench_context_t& context);
+/** \brief Serialize a PUBLISH packet */
+static bool lw_mqtt_bench_serialize_publish(lw_mqtt_bench_context_t& context);
+/** \brief Serialize a PUBLISH packet from a pre-encoded template */
+static bool lw_mqtt_bench_serialize_publish_template(lw_mqtt_bench_context_t& context);
+/** \brief Serialize a PUBACK packet */
+static bool lw_mqtt_bench_serialize_puback(lw_mqtt_bench_context_t& context);
+/** \brief Serialize a PUBREC packet */
+static bool lw_mqtt_bench_serialize_pubrec(lw_mqtt_bench_context_t& context);
+/** \brief Serialize a PUBREL packet */
+static bool lw_mqtt_bench_serialize_pubrel(lw_mqtt_bench_context_t& context);
+/** \brief Serialize a PUBCOMP packet */
+static bool lw_mqtt_bench_serialize_pubcomp(lw_mqtt_bench_context_t& context);
+/** \brief Serialize a SUBSCRIBE packet */
+static bool lw_mqtt_bench_serialize_subscribe(lw_mqtt_bench_context_t& context);
+/** \brief Serialize a SUBACK packet */
+static bool lw_mqtt_bench_serialize_suback(lw_mqtt_bench_context_t& context);
+/** \brief Serialize an UNSUBSCRIBE packet */
+static bool lw_mqtt_bench_serialize_unsubscribe(lw_mqtt_bench_context_t& context);
+/** \brief Serialize an UNSUBACK packet */
+static bool lw_mqtt_bench_serialize_unsuback(lw_mqtt_bench_context_t& context);
+/** \brief Serialize a PINGREQ packet */
+static bool lw_mqtt_bench_serialize_pingreq(lw_mqtt_bench_context_t& context);
+/** \brief Serialize a PINGRESP packet */
+static bool lw_mqtt_bench_serialize_pingresp(lw_mqtt_bench_context_t& context);
+/** \brief Serialize a DISCONNECT packet */
+static bool lw_mqtt_bench_serialize_disconnect(lw_mqtt_bench_context_t& context);
+
+/** \brief Deserialize a CONNECT packet */
+static bool lw_mqtt_bench_deserialize_connect(lw_mqtt_bench_context_t& context, const uint8_t packet_flags, const uint32_t packet_length);
+/** \brief Deserialize a CONNACK packet */
+static bool lw_mqtt_bench_deserialize_connack(lw_mqtt_bench_context_t& context, const uint8_t packet_flags, const uint32_t packet_length);
+/** \brief Deserialize a PUBLISH packet */
+static bool lw_mqtt_bench_deserialize_publish(lw_mqtt_bench_context_t& context, const uint8_t packet_flags, const uint32_t packet_length);
+/** \brief Deserialize a PUBACK packet */
+static bool lw_mqtt_bench_deserialize_puback(lw_mqtt_bench_context_t& context, const uint8_t packet_flags, const uint32_t packet_length);
+/** \brief Deserialize a PUBREC packet */
+static bool lw_mqtt_bench_deserialize_pubrec(lw_mqtt_bench_context_t& context, const uint8_t packet_flags, const uint32_t packet_length);
+/** \brief Deserialize a PUBREL packet */
+static bool lw_mqtt_bench_deserialize_pubrel(lw_mqtt_bench_context_t& context, const uint8_t packet_flags, const uint32_t packet_length);
+/** \brief Deserialize a PUBCOMP packet */
+static bool lw_mqtt_bench_deserialize_pubcomp(lw_mqtt_bench_context_t& context, const uint8_t packet_flags, const uint32_t packet_length);
+/** \brief Deserialize a SUBSCRIBE packet */
+static bool lw_mqtt_bench_deserialize_subscribe(lw_mqtt_bench_context_t& context, const uint8_t packet_flags, const uint32_t packet_length);
+/** \brief Deserialize a SUBACK packet */
+static bool lw_mqtt_bench_deserialize_suback(lw_mqtt_bench_context_t& context, const uint8_t packet_flags, const uint32_t packet_length);
+/** \brief Deserialize an UNSUBSCRIBE packet */
+static bool lw_mqtt_bench_deserialize_unsubscribe(lw_mqtt_bench_context_t& context, const uint8_t packet_flags, const uint32_t packet_length);
+/** \brief Deserialize an UNSUBACK packet */
+static bool lw_mqtt_bench_deserialize_unsuback(lw_mqtt_bench_context_t& context, const uint8_t packet_flags, const uint32_t packet_length);
+/** \brief Deserialize a PINGREQ packet */
+static bool lw_mqtt_bench_deserialize_pingreq(lw_mqtt_bench_context_t& context, const uint8_t packet_flags, const uint32_t packet_length);
+/** \brief Deserialize a PINGRESP packet */
+static bool lw_mqtt_bench_deserialize_pingresp(lw_mqtt_bench_context_t& context, const uint8_t packet_flags, const uint32_t packet_length);
+/** \brief Deserialize a DISCONNECT packet */
+static bool lw_mqtt_bench_deserialize_disconnect(lw_mqtt_bench_context_t& context, const uint8_t packet_flags, const uint32_t packet_length);
+
+
+/** \brief Packet types under benchmark */
+static const lw_mqtt_bench_packet_t lw_mqtt_bench_packets[] =
+{
+    { "connect", MQTT_PKT_CONNECT, lw_mqtt_bench_serialize_connect, lw_mqtt_bench_deserialize_connect, true, true, true },
+    { "connack", MQTT_PKT_CONNACK, lw_mqtt_bench_serialize_connack, lw_mqtt_bench_deserialize_connack, false, false, false },
+    { "publish", MQTT_PKT_PUBLISH, lw_mqtt_bench_serialize_publish, lw_mqtt_bench_deserialize_publish, true, true, true },
+    { "publish_template", MQTT_PKT_PUBLISH, lw_mqtt_bench_serialize_publish_template, NULL, true, true, true },
+    { "puback", MQTT_PKT_PUBACK, lw_mqtt_bench_serialize_puback, lw_mqtt_bench_deserialize_puback, false, false, false },
+    { "pubrec", MQTT_PKT_PUBREC, lw_mqtt_bench_serialize_pubrec, lw_mqtt_bench_deserialize_pubrec, false, false, false },
+    { "pubrel", MQTT_PKT_PUBREL, lw_mqtt_bench_serialize_pubrel, lw_mqtt_bench_deserialize_pubrel, false, false, false },
+    { "pubcomp", MQTT_PKT_PUBCOMP, lw_mqtt_bench_serialize_pubcomp, lw_mqtt_bench_deserialize_pubcomp, false, false, false },
+    { "subscribe", MQTT_PKT_SUBSCRIBE, lw_mqtt_bench_serialize_subscribe, lw_mqtt_bench_deserialize_subscribe, true, false, true },
+    { "suback", MQTT_PKT_SUBACK, lw_mqtt_bench_serialize_suback, lw_mqtt_bench_deserialize_suback, false, false, true },
+    { "unsubscribe", MQTT_PKT_UNSUBSCRIBE, lw_mqtt_bench_serialize_unsubscribe, lw_mqtt_bench_deserialize_unsubscribe, true, false, false },
+    { "unsuback", MQTT_PKT_UNSUBACK, lw_mqtt_bench_serialize_unsuback, lw_mqtt_bench_deserialize_unsuback, false, false, false },
+    { "pingreq", MQTT_PKT_PINGREQ, lw_mqtt_bench_serialize_pingreq, lw_mqtt_bench_deserialize_pingreq, false, false, false },
+    { "pingresp", MQTT_PKT_PINGRESP, lw_mqtt_bench_serialize_pingresp, lw_mqtt_bench_deserialize_pingresp, false, false, false },
+    { "disconnect", MQTT_PKT_DISCONNECT, lw_mqtt_bench_serialize_disconnect, lw_mqtt_bench_deserialize_disconnect, false, false, false }
+};
+
+
+
+/** \brief Allocation counting wrappers : the library and the standard C library heap functions are redirected
+           here at link time (see the makefile), the C++ allocations are counted by the global operator new */
+extern "C"
+{
+    void* __real_malloc(size_t size);
+    void* __real_calloc(size_t count, size_t size);
+    void* __real_realloc(void* ptr, size_t size);
+
+    void* __wrap_malloc(size_t size)
+    {
+        lw_mqtt_bench_alloc_count++;
+        return __real_malloc(size);
+    }
+
+    void* __wrap_calloc(size_t count, size_t size)
+    {
+        lw_mqtt_bench_alloc_count++;
+        return __real_calloc(count, size);
+    }
+
+    void* __wrap_realloc(void* ptr, size_t size)
+    {
+        lw_mqtt_bench_alloc_count++;
+        return __real_realloc(ptr, size);
+    }
+}
+
+/** \brief Global operator new counting the allocations */
+void* operator new(size_t size)
+{
+    void* ptr;
+    lw_mqtt_bench_alloc_count++;
+    ptr = __real_malloc((size != 0u) ? size : 1u);
+    if (ptr == NULL)
+    {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+/** \brief Global operator delete matching the counting operator new */
+void operator delete(void* ptr) noexcept
+{
+    free(ptr);
+}
+
+
+/** \brief Program entry point */
+int main(int argc, char* argv[])
+{
+    bool ret;
+    lw_mqtt_bench_params_t params;
+
+    /* Parse command line parameters */
+    ret = lw_mqtt_bench_parse_parameters(params, argc, argv);
+    if (ret)
+    {
+        mqtt_properties_t properties;
+        vector<lw_mqtt_bench_result_t> results;
+        lw_mqtt_bench_context_t* const context = new lw_mqtt_bench_context_t;
+
+        /* Run the whole matrix */
+        for (size_t i = 0u; ret && (i < (sizeof(lw_mqtt_bench_packets) / sizeof(lw_mqtt_bench_packets[0u]))); i++)
+        {
+            const lw_mqtt_bench_packet_t& packet = lw_mqtt_bench_packets[i];
+            if (strstr(packet.name, params.filter.c_str()) != NULL)
+            {
+                const size_t topic_count = (packet.use_topic ? (sizeof(lw_mqtt_bench_topic_lengths) / sizeof(uint32_t)) : 1u);
+                const size_t payload_count = (packet.use_payload ? (sizeof(lw_mqtt_bench_payload_sizes) / sizeof(uint32_t)) : 1u);
+                const size_t qos_count = (packet.use_qos ? sizeof(lw_mqtt_bench_qos_levels) : 1u);
+                for (size_t p = 0u; ret && (p < sizeof(lw_mqtt_bench_protocol_levels)); p++)
+                {
+                    for (size_t t = 0u; ret && (t < topic_count); t++)
+                    {
+                        for (size_t s = 0u; ret && (s < payload_count); s++)
+                        {
+                            for (size_t q = 0u; ret && (q < qos_count); q++)
+                            {
+                                lw_mqtt_bench_prepare(*context, properties, lw_mqtt_bench_protocol_levels[p],
+                                                      (packet.use_topic ? lw_mqtt_bench_topic_lengths[t] : 0u),
+                                                      (packet.use_payload ? lw_mqtt_bench_payload_sizes[s] : 0u),
+                                                      (packet.use_qos ? lw_mqtt_bench_qos_levels[q] : 0u));
+
+                                /* Templates are limited in topic length */
+                                if ((packet.serialize != lw_mqtt_bench_serialize_publish_template) ||
+                                    (context->topic.size <= MQTT_PUBLISH_TEMPLATE_MAX_TOPIC_LENGTH))
+                                {
+                                    ret = lw_mqtt_bench_run(*context, packet, params.iterations, results);
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        delete context;
+
+        /* Display results */
+        if (ret)
+        {
+            lw_mqtt_bench_print_results(results, params.format);
+        }
+    }
+
+    return ((ret) ? 0 : 1);
+}
+
+
+/** \brief Print the version message */
+static void lw_mqtt_bench_print_version()
+{
+    cout << "lw-mqtt-bench version " << LW_MQTT_BENCH_VERSION << " compiled with liblw-mqtt version " << lw_mqtt_lib_version() << endl;
+}
+
+/** \brief Print the usage message */
+static void lw_mqtt_bench_print_usage()
+{
+    cout << "usage: lw-mqtt-bench [--version] [--help] [-n <iterations>] [-f <text|csv|json>] [-p <packet>]" << endl;
+}
+
+/** \brief Parse the command line parameters */
+static bool lw_mqtt_bench_parse_parameters(lw_mqtt_bench_params_t& params, int argc, char* argv[])
+{
+    bool ret = false;
+    bool unique_option = false;
+    bool invalid_arg = false;
+
+    /* Skip first parameter */
+    argc--;
+    argv++;
+
+    /* Check parameters */
+    while ((argc != 0) && !invalid_arg && !unique_option)
+    {
+        argc--;
+
+        if (strcmp(*argv, "--help") == 0)
+        {
+            unique_option = true;
+            lw_mqtt_bench_print_usage();
+        }
+        else if (strcmp(*argv, "--version") == 0)
+        {
+            unique_option = true;
+            lw_mqtt_bench_print_version();
+        }
+        else if (strcmp(*argv, "-n") == 0)
+        {
+            if (argc != 0)
+            {
+                argv++;
+                argc--;
+                params.iterations = (uint32_t)atoi(*argv);
+                if (params.iterations == 0u)
+                {
+                    cout << "The number of iterations must be greater than 0.";
+                    invalid_arg = true;
+                }
+            }
+            else
+            {
+                cout << "The -n option must be followed by the number of iterations.";
+                invalid_arg = true;
+            }
+        }
+        else if (strcmp(*argv, "-f") == 0)
+        {
+            if (argc != 0)
+            {
+                argv++;
+                argc--;
+                if (strcmp(*argv, "text") == 0)
+                {
+                    params.format = LW_MQTT_BENCH_FORMAT_TEXT;
+                }
+                else if (strcmp(*argv, "csv") == 0)
+                {
+                    params.format = LW_MQTT_BENCH_FORMAT_CSV;
+                }
+                else if (strcmp(*argv, "json") == 0)
+                {
+                    params.format = LW_MQTT_BENCH_FORMAT_JSON;
+                }
+                else
+                {
+                    cout << "Invalid output format : '" << *argv << "'.";
+                    invalid_arg = true;
+                }
+            }
+            else
+            {
+                cout << "The -f option must be followed by the output format.";
+                invalid_arg = true;
+            }
+        }
+        else if (strcmp(*argv, "-p") == 0)
+        {
+            if (argc != 0)
+            {
+                argv++;
+                argc--;
+                params.filter = *argv;
+            }
+            else
+            {
+                cout << "The -p option must be followed by the name of the packet to benchmark.";
+                invalid_arg = true;
+            }
+        }
+        else
+        {
+            cout << "Invalid parameter : '" << *argv << "'.";
+            invalid_arg = true;
+        }
+
+        /* Next param */
+        argv++;
+    }
+
+    if (invalid_arg)
+    {
+        cout << endl << "See 'lw-mqtt-bench --help'." << endl;
+    }
+    else
+    {
+        if (!unique_option)
+        {
+            ret = true;
+        }
+    }
+
+    return ret;
+}
+
+/** \brief Prepare the benchmark context for a point of the matrix */
+static void lw_mqtt_bench_prepare(lw_mqtt_bench_context_t& context, mqtt_properties_t& properties, const uint8_t protocol_level,
+                                  const uint32_t topic_length, const uint32_t payload_size, const uint8_t qos)
+{
+    /* Topic made of 8 characters levels */
+    for (uint32_t i = 0u; i < topic_length; i++)
+    {
+        context.topic_buffer[i] = (((i % 8u) == 7u) ? '/' : (char)('a' + (i % 8u)));
+    }
+    if (topic_length == 0u)
+    {
+        (void)strcpy(context.topic_buffer, "lw-mqtt/bench");
+    }
+    context.topic.str = context.topic_buffer;
+    context.topic.size = (uint16_t)((topic_length == 0u) ? strlen(context.topic_buffer) : topic_length);
+
+    /* Payload */
+    for (uint32_t i = 0u; i < payload_size; i++)
+    {
+        context.payload[i] = (uint8_t)i;
+    }
+    context.payload_size = payload_size;
+    context.qos = qos;
+
+    /* Protocol version */
+    context.protocol_level = protocol_level;
+    (void)memset(&properties, 0, sizeof(properties));
+    context.properties = ((protocol_level == MQTT_PROTOCOL_LEVEL_V5) ? &properties : NULL);
+
+    /* Publish template */
+    if (context.topic.size <= MQTT_PUBLISH_TEMPLATE_MAX_TOPIC_LENGTH)
+    {
+        (void)mqtt_packet_serialize_publish_template(&context.publish_template, &context.topic, qos, false, context.properties);
+    }
+}
+
+/** \brief Run the benchmarks of a packet type for a point of the matrix */
+static bool lw_mqtt_bench_run(lw_mqtt_bench_context_t& context, const lw_mqtt_bench_packet_t& packet, const uint32_t iterations,
+                              vector<lw_mqtt_bench_result_t>& results)
+{
+    bool ret = true;
+    lw_mqtt_bench_result_t result;
+
+    result.name = packet.name;
+    result.protocol_level = context.protocol_level;
+    result.topic_length = (packet.use_topic ? context.topic.size : 0u);
+    result.payload_size = context.payload_size;
+    result.qos = context.qos;
+    result.iterations = iterations;
+
+    /* Serialize */
+    (void)buffer_stream_output_from_buffer(&context.outstream, context.packet, sizeof(context.packet));
+    ret = packet.serialize(context);
+    if (ret)
+    {
+        uint64_t allocs;
+        chrono::steady_clock::time_point start;
+        chrono::steady_clock::duration elapsed;
+
+        context.packet_size = (uint32_t)context.outstream.written;
+        for (uint32_t i = 0u; ret && (i < iterations); i++)
+        {
+            (void)context.outstream.reset(&context.outstream);
+            ret = packet.serialize(context);
+        }
+        allocs = lw_mqtt_bench_alloc_count;
+        start = chrono::steady_clock::now();
+        for (uint32_t i = 0u; ret && (i < iterations); i++)
+        {
+            (void)context.outstream.reset(&context.outstream);
+            ret = packet.serialize(context);
+        }
+        elapsed = chrono::steady_clock::now() - start;
+        allocs = lw_mqtt_bench_alloc_count - allocs;
+
+        result.operation = "serialize";
+        result.packet_size = context.packet_size;
+        result.ns_per_op = (double)chrono::duration_cast<chrono::nanoseconds>(elapsed).count() / (double)iterations;
+        result.bytes_per_sec = (((double)context.packet_size) * 1000000000.0) / result.ns_per_op;
+        result.allocs_per_op = (double)allocs / (double)iterations;
+        results.push_back(result);
+    }
+
+    /* Deserialize */
+    if (ret && (packet.deserialize != NULL))
+    {
+        uint64_t allocs = 0u;
+        chrono::steady_clock::time_point start;
+        chrono::steady_clock::duration elapsed(0);
+
+        (void)buffer_stream_input_from_buffer(&context.instream, context.packet, context.packet_size);
+        for (uint32_t pass = 0u; ret && (pass < 2u); pass++)
+        {
+            /* First pass is a warm-up */
+            allocs = lw_mqtt_bench_alloc_count;
+            start = chrono::steady_clock::now();
+            for (uint32_t i = 0u; ret && (i < iterations); i++)
+            {
+                mqtt_control_packet_type_t packet_type;
+                uint8_t packet_flags;
+                uint32_t packet_length;
+
+                (void)context.instream.reset(&context.instream, context.packet_size);
+                ret = mqtt_packet_deserialize_packet_header(&context.instream, &packet_type, &packet_flags, &packet_length);
+                if (ret)
+                {
+                    ret = ((packet_type == packet.type) &&
+                           packet.deserialize(context, packet_flags, packet_length) &&
+                           (context.instream.read == context.packet_size));
+                }
+            }
+            elapsed = chrono::steady_clock::now() - start;
+            allocs = lw_mqtt_bench_alloc_count - allocs;
+        }
+        if (ret)
+        {
+            result.operation = "deserialize";
+            result.packet_size = context.packet_size;
+            result.ns_per_op = (double)chrono::duration_cast<chrono::nanoseconds>(elapsed).count() / (double)iterations;
+            result.bytes_per_sec = (((double)context.packet_size) * 1000000000.0) / result.ns_per_op;
+            result.allocs_per_op = (double)allocs / (double)iterations;
+            results.push_back(result);
+        }
+    }
+
+    if (!ret)
+    {
+        cout << "Benchmark '" << packet.name << "' failed (protocol level " << (int)context.protocol_level
+             << ", topic " << context.topic.size << " bytes, payload " << context.payload_size << " bytes, QoS "
+             << (int)context.qos << ") : error " << mqtt_errno_get() << endl;
+    }
+
+    return ret;
+}
+
+/** \brief Print the benchmark results */
+static void lw_mqtt_bench_print_results(const vector<lw_mqtt_bench_result_t>& results, const lw_mqtt_bench_format_t format)
+{
+    switch (format)
+    {
+        case LW_MQTT_BENCH_FORMAT_CSV:
+        {
+            cout << "packet,operation,protocol_level,topic_length,payload_size,qos,packet_size,iterations,ns_per_op,bytes_per_sec,allocs_per_op" << endl;
+            for (size_t i = 0u; i < results.size(); i++)
+            {
+                const lw_mqtt_bench_result_t& result = results[i];
+                cout << result.name << "," << result.operation << "," << (int)result.protocol_level << "," << result.topic_length << ","
+                     << result.payload_size << "," << (int)result.qos << "," << result.packet_size << "," << result.iterations << ","
+                     << fixed << setprecision(2) << result.ns_per_op << "," << setprecision(0) << result.bytes_per_sec << ","
+                     << setprecision(3) << result.allocs_per_op << endl;
+            }
+            break;
+        }
+
+        case LW_MQTT_BENCH_FORMAT_JSON:
+        {
+            for (size_t i = 0u; i < results.size(); i++)
+            {
+                const lw_mqtt_bench_result_t& result = results[i];
+                cout << "{\"packet\":\"" << result.name << "\",\"operation\":\"" << result.operation << "\",\"protocol_level\":"
+                     << (int)result.protocol_level << ",\"topic_length\":" << result.topic_length << ",\"payload_size\":"
+                     << result.payload_size << ",\"qos\":" << (int)result.qos << ",\"packet_size\":" << result.packet_size
+                     << ",\"iterations\":" << result.iterations << ",\"ns_per_op\":" << fixed << setprecision(2) << result.ns_per_op
+                     << ",\"bytes_per_sec\":" << setprecision(0) << result.bytes_per_sec << ",\"allocs_per_op\":"
+                     << setprecision(3) << result.allocs_per_op << "}" << endl;
+            }
+            break;
+        }
+
+        case LW_MQTT_BENCH_FORMAT_TEXT:
+        default:
+        {
+            cout << left << setw(18) << "packet" << setw(13) << "operation" << right << setw(6) << "proto" << setw(7) << "topic"
+                 << setw(9) << "payload" << setw(5) << "qos" << setw(9) << "size" << setw(12) << "ns/op" << setw(14) << "MB/s"
+                 << setw(12) << "allocs/op" << endl;
+            for (size_t i = 0u; i < results.size(); i++)
+            {
+                const lw_mqtt_bench_result_t& result = results[i];
+                cout << left << setw(18) << result.name << setw(13) << result.operation << right << setw(6) << (int)result.protocol_level
+                     << setw(7) << result.topic_length << setw(9) << result.payload_size << setw(5) << (int)result.qos
+                     << setw(9) << result.packet_size << fixed << setprecision(1) << setw(12) << result.ns_per_op
+                     << setprecision(1) << setw(14) << (result.bytes_per_sec / 1000000.0) << setprecision(3) << setw(12)
+                     << result.allocs_per_op << endl;
+            }
+            break;
+        }
+    }
+}
+
+
+/** \brief Serialize a CONNECT packet */
+static bool lw_mqtt_bench_serialize_connect(lw_mqtt_bench_context_t& context)
+{
+    mqtt_const_string_t client_id;
+    mqtt_const_credentials_t credentials;
+    mqtt_const_will_t will;
+
+    client_id.str = "lw-mqtt-bench";
+    client_id.size = (uint16_t)strlen(client_id.str);
+    credentials.username.str = "user";
+    credentials.username.size = 4u;
+    credentials.password.str = "password";
+    credentials.password.size = 8u;
+    will.topic = context.topic;
+    will.message.str = (const char*)context.payload;
+    will.message.size = (uint16_t)context.payload_size;
+    will.qos = context.qos;
+    will.retain = false;
+
+    return mqtt_packet_serialize_connect(&context.outstream, &client_id, &credentials, &will, true, 60u, context.properties);
+}
+
+/** \brief Serialize a CONNACK packet */
+static bool lw_mqtt_bench_serialize_connack(lw_mqtt_bench_context_t& context)
+{
+    return mqtt_packet_serialize_connack(&context.outstream, false, MQTT_CONNACK_RET_ACCEPTED, context.properties);
+}
+
+/** \brief Serialize a PUBLISH packet */
+static bool lw_mqtt_bench_serialize_publish(lw_mqtt_bench_context_t& context)
+{
+    return mqtt_packet_serialize_publish(&context.outstream, &context.topic, context.payload, context.payload_size, context.qos,
+                                         false, false, LW_MQTT_BENCH_PACKET_ID, context.properties);
+}
+
+/** \brief Serialize a PUBLISH packet from a pre-encoded template */
+static bool lw_mqtt_bench_serialize_publish_template(lw_mqtt_bench_context_t& context)
+{
+    return mqtt_packet_serialize_publish_from_template(&context.outstream, &context.publish_template, context.payload,
+                                                       context.payload_size, LW_MQTT_BENCH_PACKET_ID);
+}
+
+/** \brief Serialize a PUBACK packet */
+static bool lw_mqtt_bench_serialize_puback(lw_mqtt_bench_context_t& context)
+{
+    return mqtt_packet_serialize_puback(&context.outstream, LW_MQTT_BENCH_PACKET_ID);
+}
+
+/** \brief Serialize a PUBREC packet */
+static bool lw_mqtt_bench_serialize_pubrec(lw_mqtt_bench_context_t& context)
+{
+    return mqtt_packet_serialize_pubrec(&context.outstream, LW_MQTT_BENCH_PACKET_ID);
+}
+
+/** \brief Serialize a PUBREL packet */
+static bool lw_mqtt_bench_serialize_pubrel(lw_mqtt_bench_context_t& context)
+{
+    return mqtt_packet_serialize_pubrel(&context.outstream, LW_MQTT_BENCH_PACKET_ID);
+}
+
+/** \brief Serialize a PUBCOMP packet */
+static bool lw_mqtt_bench_serialize_pubcomp(lw_mqtt_bench_context_t& context)
+{
+    return mqtt_packet_serialize_pubcomp(&context.outstream, LW_MQTT_BENCH_PACKET_ID);
+}
+
+/** \brief Serialize a SUBSCRIBE packet */
+static bool lw_mqtt_bench_serialize_subscribe(lw_mqtt_bench_context_t& context)
+{
+    return mqtt_packet_serialize_subscribe(&context.outstream, &context.topic, context.qos, LW_MQTT_BENCH_PACKET_ID, context.properties);
+}
+
+/** \brief Serialize a SUBACK packet */
+static bool lw_mqtt_bench_serialize_suback(lw_mqtt_bench_context_t& context)
+{
+    return mqtt_packet_serialize_suback(&context.outstream, context.qos, LW_MQTT_BENCH_PACKET_ID, context.properties);
+}
+
+/** \brief Serialize an UNSUBSCRIBE packet */
+static bool lw_mqtt_bench_serialize_unsubscribe(lw_mqtt_bench_context_t& context)
+{
+    return mqtt_packet_serialize_unsubscribe(&context.outstream, &context.topic, LW_MQTT_BENCH_PACKET_ID, context.properties);
+}
+
+/** \brief Serialize an UNSUBACK packet */
+static bool lw_mqtt_bench_serialize_unsuback(lw_mqtt_bench_context_t& context)
+{
+    return mqtt_packet_serialize_unsuback(&context.outstream, LW_MQTT_BENCH_PACKET_ID, MQTT_REASON_SUCCESS, context.properties);
+}
+
+/** \brief Serialize a PINGREQ packet */
+static bool lw_mqtt_bench_serialize_pingreq(lw_mqtt_bench_context_t& context)
+{
+    return mqtt_packet_serialize_pingreq(&context.outstream);
+}
+
+/** \brief Serialize a PINGRESP packet */
+static bool lw_mqtt_bench_serialize_pingresp(lw_mqtt_bench_context_t& context)
+{
+    return mqtt_packet_serialize_pingresp(&context.outstream);
+}
+
+/** \brief Serialize a DISCONNECT packet */
+static bool lw_mqtt_bench_serialize_disconnect(lw_mqtt_bench_context_t& context)
+{
+    return mqtt_packet_serialize_disconnect(&context.outstream);
+}
+
+
+/** \brief Deserialize a CONNECT packet */
+static bool lw_mqtt_bench_deserialize_connect(lw_mqtt_bench_context_t& context, const uint8_t packet_flags, const uint32_t packet_length)
+{
+    mqtt_string_t client_id;
+    mqtt_string_t protocol_name;
+    uint8_t protocol_level;
+    mqtt_credentials_t credentials;
+    mqtt_will_t will;
+    bool clean_session;
+    uint16_t keepalive;
+    mqtt_properties_t properties;
+    char protocol_name_buffer[8u];
+
+    MQTT_UNUSED_PARAM(packet_flags);
+    MQTT_UNUSED_PARAM(packet_length);
+
+    client_id.str = context.string_buffers[0u];
+    client_id.size = LW_MQTT_BENCH_STRING_SIZE;
+    protocol_name.str = protocol_name_buffer;
+    protocol_name.size = sizeof(protocol_name_buffer);
+    credentials.username.str = context.string_buffers[1u];
+    credentials.username.size = LW_MQTT_BENCH_STRING_SIZE;
+    credentials.password.str = context.string_buffers[2u];
+    credentials.password.size = LW_MQTT_BENCH_STRING_SIZE;
+    will.topic.str = context.string_buffers[3u];
+    will.topic.size = LW_MQTT_BENCH_STRING_SIZE;
+    will.message.str = (char*)context.data_buffer;
+    will.message.size = LW_MQTT_BENCH_BUFFER_SIZE;
+
+    return mqtt_packet_deserialize_connect(&context.instream, &client_id, &protocol_name, &protocol_level, &credentials, &will,
+                                           &clean_session, &keepalive, &properties);
+}
+
+/** \brief Deserialize a CONNACK packet */
+static bool lw_mqtt_bench_deserialize_connack(lw_mqtt_bench_context_t& context, const uint8_t packet_flags, const uint32_t packet_length)
+{
+    bool session_present;
+    mqtt_connack_retcode_t retcode;
+    mqtt_properties_t properties;
+
+    MQTT_UNUSED_PARAM(packet_flags);
+
+    return mqtt_packet_deserialize_connack(&context.instream, packet_length, &session_present, &retcode,
+                                           ((context.properties != NULL) ? &properties : NULL));
+}
+
+/** \brief Deserialize a PUBLISH packet */
+static bool lw_mqtt_bench_deserialize_publish(lw_mqtt_bench_context_t& context, const uint8_t packet_flags, const uint32_t packet_length)
+{
+    mqtt_string_t topic;
+    uint32_t length = LW_MQTT_BENCH_BUFFER_SIZE;
+    uint8_t qos;
+    bool retain;
+    bool duplicate;
+    uint16_t packet_id;
+    mqtt_properties_t properties;
+
+    topic.str = context.string_buffers[0u];
+    topic.size = LW_MQTT_BENCH_STRING_SIZE;
+
+    return mqtt_packet_deserialize_publish(&context.instream, packet_flags, packet_length, &topic, context.data_buffer, &length,
+                                           &qos, &retain, &duplicate, &packet_id, ((context.properties != NULL) ? &properties : NULL));
+}
+
+/** \brief Deserialize a PUBACK packet */
+static bool lw_mqtt_bench_deserialize_puback(lw_mqtt_bench_context_t& context, const uint8_t packet_flags, const uint32_t packet_length)
+{
+    uint16_t packet_id;
+    MQTT_UNUSED_PARAM(packet_flags);
+    return mqtt_packet_deserialize_puback(&context.instream, packet_length, &packet_id);
+}
+
+/** \brief Deserialize a PUBREC packet */
+static bool lw_mqtt_bench_deserialize_pubrec(lw_mqtt_bench_context_t& context, const uint8_t packet_flags, const uint32_t packet_length)
+{
+    uint16_t packet_id;
+    MQTT_UNUSED_PARAM(packet_flags);
+    return mqtt_packet_deserialize_pubrec(&context.instream, packet_length, &packet_id);
+}
+
+/** \brief Deserialize a PUBREL packet */
+static bool lw_mqtt_bench_deserialize_pubrel(lw_mqtt_bench_context_t& context, const uint8_t packet_flags, const uint32_t packet_length)
+{
+    uint16_t packet_id;
+    MQTT_UNUSED_PARAM(packet_flags);
+    return mqtt_packet_deserialize_pubrel(&context.instream, packet_length, &packet_id);
+}
+
+/** \brief Deserialize a PUBCOMP packet */
+static bool lw_mqtt_bench_deserialize_pubcomp(lw_mqtt_bench_context_t& context, const uint8_t packet_flags, const uint32_t packet_length)
+{
+    uint16_t packet_id;
+    MQTT_UNUSED_PARAM(packet_flags);
+    return mqtt_packet_deserialize_pubcomp(&context.instream, packet_length, &packet_id);
+}
+
+/** \brief Deserialize a SUBSCRIBE packet */
+static bool lw_mqtt_bench_deserialize_subscribe(lw_mqtt_bench_context_t& context, const uint8_t packet_flags, const uint32_t packet_length)
+{
+    mqtt_string_t topic;
+    uint8_t qos;
+    uint16_t packet_id;
+    mqtt_properties_t properties;
+
+    MQTT_UNUSED_PARAM(packet_flags);
+
+    topic.str = context.string_buffers[0u];
+    topic.size = LW_MQTT_BENCH_STRING_SIZE;
+
+    return mqtt_packet_deserialize_subscribe(&context.instream, packet_length, &topic, &qos, NULL, &packet_id,
+                                             ((context.properties != NULL) ? &properties : NULL));
+}
+
+/** \brief Deserialize a SUBACK packet */
+static bool lw_mqtt_bench_deserialize_suback(lw_mqtt_bench_context_t& context, const uint8_t packet_flags, const uint32_t packet_length)
+{
+    uint8_t qos;
+    uint16_t packet_id;
+    mqtt_properties_t properties;
+
+    MQTT_UNUSED_PARAM(packet_flags);
+
+    return mqtt_packet_deserialize_suback(&context.instream, packet_length, &qos, &packet_id,
+                                          ((context.properties != NULL) ? &properties : NULL));
+}
+
+/** \brief Deserialize an UNSUBSCRIBE packet */
+static bool lw_mqtt_bench_deserialize_unsubscribe(lw_mqtt_bench_context_t& context, const uint8_t packet_flags, const uint32_t packet_length)
+{
+    mqtt_string_t topic;
+    uint16_t packet_id;
+    mqtt_properties_t properties;
+
+    MQTT_UNUSED_PARAM(packet_flags);
+
+    topic.str = context.string_buffers[0u];
+    topic.size = LW_MQTT_BENCH_STRING_SIZE;
+
+    return mqtt_packet_deserialize_unsubscribe(&context.instream, packet_length, &topic, &packet_id,
+                                               ((context.properties != NULL) ? &properties : NULL));
+}
+
+/** \brief Deserialize an UNSUBACK packet */
+static bool lw_mqtt_bench_deserialize_unsuback(lw_mqtt_bench_context_t& context, const uint8_t packet_flags, const uint32_t packet_length)
+{
+    uint16_t packet_id;
+    MQTT_UNUSED_PARAM(packet_flags);
+    return mqtt_packet_deserialize_unsuback(&context.instream, packet_length, &packet_id);
+}
+
+/** \brief Deserialize a PINGREQ packet */
+static bool lw_mqtt_bench_deserialize_pingreq(lw_mqtt_bench_context_t& context, const uint8_t packet_flags, const uint32_t packet_length)
+{
+    MQTT_UNUSED_PARAM(packet_flags);
+    return mqtt_packet_deserialize_pingreq(&context.instream, packet_length);
+}
+
+/** \brief Deserialize a PINGRESP packet */
+static bool lw_mqtt_bench_deserialize_pingresp(lw_mqtt_bench_context_t& context, const uint8_t packet_flags, const uint32_t packet_length)
+{
+    MQTT_UNUSED_PARAM(packet_flags);
+    return mqtt_packet_deserialize_pingresp(&context.instream, packet_length);
+}
+
+/** \brief Deserialize a DISCONNECT packet */
+static bool lw_mqtt_bench_deserialize_disconnect(lw_mqtt_bench_context_t& context, const uint8_t packet_flags, const uint32_t packet_length)
+{
+    MQTT_UNUSED_PARAM(packet_flags);
+    return mqtt_packet_deserialize_disconnect(&context.instream, packet_length);
+}
@@ -22,6 +22,8 @@ along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
 #include <ctime>
 #include <sstream>
 #include <iostream>
+#include <csignal>
+#include <vector>
 using namespace std;
 
 #include "mqtt_broker.h"
@@ -31,6 +33,19 @@ using namespace std;
 #define LW_MQTT_BROKER_VERSION "1.0"
 
 
+/** Topic rule of the bridge */
+struct lw_mqtt_broker_bridge_rule_t
+{
+    /** \brief Topic filter */
+    string filter;
+
+    /** \brief Direction : 1 = out, 2 = in, 3 = both */
+    uint8_t direction;
+
+    /** \brief Maximum QoS */
+    uint8_t qos;
+};
+
 /** Program parameters */
 struct lw_mqtt_broker_params_t
 {
@@ -40,6 +55,16 @@ struct lw_mqtt_broker_params_t
         : broker_ip("127.0.0.1")
         , broker_port(1883u)
         , verbose(false)
+        , trace_file("")
+        , store_file("")
+        , retain_file("")
+        , spill_file("")
+        , bridge_ip("")
+        , bridge_port(1883u)
+        , bridge_client_id("lw-mqtt-bridge")
+        , bridge_rules()
+        , sys_interval(MQTT_BROKER_SYS_INTERVAL)
+        , max_clients(MQTT_BROKER_MAX_CLIENT)
     {}
 
     /** \brief Broker IP address */
@@ -50,9 +75,43 @@ struct lw_mqtt_broker_params_t
 
     /** \brief Verbose mode */
     bool verbose;
+
+    /** \brief File to record the connections to (empty if not recorded) */
+    string trace_file;
+
+    /** \brief Path of the persistent store of the sessions (empty if not persistent) */
+    string store_file;
+
+    /** \brief Path of the retained store (empty if the retained messages are not kept) */
+    string retain_file;
+
+    /** \brief Path of the spill segments of the session queues (empty if the messages which don't fit in a queue are dropped) */
+    string spill_file;
+
+    /** \brief IP address of the remote broker of the bridge (empty if not bridged) */
+    string bridge_ip;
+
+    /** \brief Port of the remote broker of the bridge */
+    uint16_t bridge_port;
+
+    /** \brief Client id of the bridge on the remote broker */
+    string bridge_client_id;
+
+    /** \brief Topic rules of the bridge */
+    vector<lw_mqtt_broker_bridge_rule_t> bridge_rules;
+
+    /** \brief Period in seconds of the publication of the $SYS topics (0 = disabled) */
+    uint32_t sys_interval;
+
+    /** \brief Maximum number of simultaneous clients */
+    uint32_t max_clients;
 };
 
 
+/** \brief Indicate if the program must stop */
+static volatile sig_atomic_t s_stop_requested = 0;
+
+
 
 /** \brief Print the version message */
 static void lw_mqtt_broker_print_version();
@@ -63,6 +122,9 @@ static void lw_mqtt_broker_print_usage();
 /** \brief Parse the command line parameters */
 static bool lw_mqtt_broker_parse_parameters(lw_mqtt_broker_params_t& params, int argc, char* argv[]);
 
+/** \brief Handler of the stop signal */
+static void lw_mqtt_broker_stop_handler(int signal_number);
+
 
 
 
@@ -77,6 +139,8 @@ int main(int argc, char* argv[])
     if (ret)
     {
         mqtt_broker_t broker;
+        mqtt_broker_config_t config;
+        vector<uint64_t> arena;
 
         /* Initialize low level layers */
         mqtt_mutex_init();
@@ -93,20 +157,158 @@ int main(int argc, char* argv[])
             mqtt_log_set_filter(MQTT_LOG_LVL_ERROR);
         }
 
-        /* Initialize broker */
-        mqtt_broker_init(&broker);
+        /* Size the tables and the buffers of the broker */
+        mqtt_broker_config_init(&config);
+        config.max_clients = params.max_clients;
+        config.max_subscriptions = ((config.max_clients > config.max_subscriptions) ? config.max_clients : config.max_subscriptions);
+        ret = mqtt_broker_get_arena_size(&config, &config.arena_size);
+        if (ret)
+        {
+            arena.resize((config.arena_size + sizeof(uint64_t) - 1u) / sizeof(uint64_t));
+            config.arena = &arena[0];
+
+            /* Initialize broker */
+            ret = mqtt_broker_init(&broker, &config);
+        }
+        if (ret)
+        {
+            mqtt_broker_set_poll_period(&broker, 50u);
+            #ifdef MQTT_BROKER_SYS_ENABLED
+            mqtt_broker_set_sys_interval(&broker, params.sys_interval);
+            #endif /* MQTT_BROKER_SYS_ENABLED */
+        }
+        else
+        {
+            cout << "Unable to initialize the broker for " << params.max_clients << " clients" << endl;
+        }
+
+        /* Record the connections */
+        #ifdef MQTT_TRACE_ENABLED
+        trace_stream_recorder_t recorder;
+        recorder.file = NULL;
+        if (ret && !params.trace_file.empty())
+        {
+            ret = trace_stream_recorder_open(&recorder, params.trace_file.c_str());
+            if (ret)
+            {
+                mqtt_broker_set_trace_recorder(&broker, &recorder);
+            }
+            else
+            {
+                cout << "Unable to create the trace file '" << params.trace_file << "'" << endl;
+            }
+        }
+        #endif /* MQTT_TRACE_ENABLED */
+
+        /* Restore the persistent sessions */
+        #ifdef MQTT_BROKER_STORE_ENABLED
+        if (ret && !params.store_file.empty())
+        {
+            ret = mqtt_broker_open_store(&broker, params.store_file.c_str());
+            if (!ret)
+            {
+                cout << "Unable to open the store '" << params.store_file << "'" << endl;
+            }
+        }
+        #endif /* MQTT_BROKER_STORE_ENABLED */
+
+        /* Map the retained messages */
+        #ifdef MQTT_BROKER_RETAIN_ENABLED
+        if (ret && !params.retain_file.empty())
+        {
+            ret = mqtt_broker_open_retain_store(&broker, params.retain_file.c_str(), MQTT_BROKER_RETAIN_MAX_MESSAGES, MQTT_BROKER_RETAIN_HEAP_SIZE);
+            if (!ret)
+            {
+                cout << "Unable to open the retained store '" << params.retain_file << "'" << endl;
+            }
+        }
+        #endif /* MQTT_BROKER_RETAIN_ENABLED */
+
+        /* Spill the overflowing queues to the disk */
+        #ifdef MQTT_BROKER_SPILL_ENABLED
+        if (ret && !params.spill_file.empty())
+        {
+            ret = mqtt_broker_open_spill(&broker, params.spill_file.c_str());
+            if (!ret)
+            {
+                cout << "Unable to open the spill '" << params.spill_file << "' (it can't be used with the -d option)" << endl;
+            }
+        }
+        #endif /* MQTT_BROKER_SPILL_ENABLED */
 
         /* Start broker */
-        ret = mqtt_broker_start(&broker, params.broker_ip.c_str(), params.broker_port);
+        if (ret)
+        {
+            ret = mqtt_broker_start(&broker, params.broker_ip.c_str(), params.broker_port);
+        }
+
+        /* Bridge to the remote broker */
+        #ifdef MQTT_BROKER_BRIDGE_ENABLED
+        if (ret && !params.bridge_ip.empty())
+        {
+            for (size_t i = 0u; ret && (i < params.bridge_rules.size()); i++)
+            {
+                const lw_mqtt_broker_bridge_rule_t& rule = params.bridge_rules[i];
+                ret = mqtt_broker_add_bridge_rule(&broker, rule.filter.c_str(), static_cast<mqtt_broker_bridge_direction_t>(rule.direction), rule.qos);
+                if (!ret)
+                {
+                    cout << "Invalid bridge rule '" << rule.filter << "'" << endl;
+                }
+            }
+            if (ret)
+            {
+                ret = mqtt_broker_open_bridge(&broker, params.bridge_ip.c_str(), params.bridge_port, params.bridge_client_id.c_str());
+                if (!ret)
+                {
+                    cout << "Unable to open the bridge to " << params.bridge_ip << ":" << params.bridge_port << endl;
+                }
+            }
+            if (!ret)
+            {
+                mqtt_broker_stop(&broker);
+            }
+        }
+        #endif /* MQTT_BROKER_BRIDGE_ENABLED */
 
         /* Main loop */
         if (ret)
         {
-            while (true)
+            signal(SIGINT, lw_mqtt_broker_stop_handler);
+            signal(SIGTERM, lw_mqtt_broker_stop_handler);
+            while (s_stop_requested == 0)
             {
                 mqtt_broker_task(&broker);
             }
+            mqtt_broker_stop(&broker);
+        }
+
+        /* Write the persistent sessions and the retained messages */
+        #ifdef MQTT_BROKER_STORE_ENABLED
+        if (!params.store_file.empty())
+        {
+            mqtt_broker_close_store(&broker);
+        }
+        #endif /* MQTT_BROKER_STORE_ENABLED */
+        #ifdef MQTT_BROKER_RETAIN_ENABLED
+        if (!params.retain_file.empty())
+        {
+            mqtt_broker_close_retain_store(&broker);
+        }
+        #endif /* MQTT_BROKER_RETAIN_ENABLED */
+        #ifdef MQTT_BROKER_SPILL_ENABLED
+        if (!params.spill_file.empty())
+        {
+            mqtt_broker_close_spill(&broker);
+        }
+        #endif /* MQTT_BROKER_SPILL_ENABLED */
+
+        /* Write the end of the recording */
+        #ifdef MQTT_TRACE_ENABLED
+        if (!params.trace_file.empty() && (recorder.file != NULL))
+        {
+            trace_stream_recorder_close(&recorder);
         }
+        #endif /* MQTT_TRACE_ENABLED */
     }    
 
 	return ((ret)?0:1);
@@ -122,7 +324,10 @@ static void lw_mqtt_broker_print_version()
 /** \brief Print the usage message */
 static void lw_mqtt_broker_print_usage()
 {
-    cout << "usage: lw-mqtt-broker [--version] [--help] [-h <broker-ip>] [-p <broker-port>] [-v]" << endl;
+    cout << "usage: lw-mqtt-broker [--version] [--help] [-h <broker-ip>] [-p <broker-port>] [-t <trace-file>]" << endl;
+    cout << "                      [-d <store-path>] [-r <retain-path>] [-q <spill-path>] [-s <sys-interval>]" << endl;
+    cout << "                      [-c <max-clients>] [-b <bridge-ip>:<bridge-port>[:<client-id>]]" << endl;
+    cout << "                      [-B <in|out|both>:<qos>:<topic-filter>]... [-v]" << endl;
 }
 
 
@@ -162,7 +367,7 @@ static bool lw_mqtt_broker_parse_parameters(lw_mqtt_broker_params_t& params, int
             }
             else
             {
-                cout << "The -h option must be followed by the IP address of the broker.";
+                cout << "The -h option must be followed by the IP address of the broker or by unix:<path> for a local socket.";
                 invalid_arg = true;
             }
         }
@@ -180,6 +385,165 @@ static bool lw_mqtt_broker_parse_parameters(lw_mqtt_broker_params_t& params, int
                 invalid_arg = true;
             }
         }
+        else if (strcmp(*argv, "-t") == 0)
+        {
+            if (argc != 0)
+            {
+                argv++;
+                argc--;
+                params.trace_file = *argv;
+            }
+            else
+            {
+                cout << "The -t option must be followed by the file to record the connections to.";
+                invalid_arg = true;
+            }
+        }
+        else if (strcmp(*argv, "-d") == 0)
+        {
+            if (argc != 0)
+            {
+                argv++;
+                argc--;
+                params.store_file = *argv;
+            }
+            else
+            {
+                cout << "The -d option must be followed by the path of the persistent store of the sessions.";
+                invalid_arg = true;
+            }
+        }
+        else if (strcmp(*argv, "-r") == 0)
+        {
+            if (argc != 0)
+            {
+                argv++;
+                argc--;
+                params.retain_file = *argv;
+            }
+            else
+            {
+                cout << "The -r option must be followed by the path of the retained store.";
+                invalid_arg = true;
+            }
+        }
+        else if (strcmp(*argv, "-q") == 0)
+        {
+            if (argc != 0)
+            {
+                argv++;
+                argc--;
+                params.spill_file = *argv;
+            }
+            else
+            {
+                cout << "The -q option must be followed by the path of the spill segments.";
+                invalid_arg = true;
+            }
+        }
+        else if (strcmp(*argv, "-b") == 0)
+        {
+            if (argc != 0)
+            {
+                argv++;
+                argc--;
+                const string bridge = *argv;
+                const size_t port_separator = bridge.find(':');
+                const size_t id_separator = bridge.find(':', port_separator + 1u);
+                if ((port_separator != string::npos) && (port_separator != 0u))
+                {
+                    params.bridge_ip = bridge.substr(0u, port_separator);
+                    params.bridge_port = (uint16_t)atoi(bridge.substr(port_separator + 1u, id_separator - port_separator - 1u).c_str());
+                    if (id_separator != string::npos)
+                    {
+                        params.bridge_client_id = bridge.substr(id_separator + 1u);
+                    }
+                }
+                else
+                {
+                    cout << "The -b option must be followed by <bridge-ip>:<bridge-port>[:<client-id>].";
+                    invalid_arg = true;
+                }
+            }
+            else
+            {
+                cout << "The -b option must be followed by the address of the remote broker of the bridge.";
+                invalid_arg = true;
+            }
+        }
+        else if (strcmp(*argv, "-B") == 0)
+        {
+            if (argc != 0)
+            {
+                argv++;
+                argc--;
+                const string rule_string = *argv;
+                const size_t qos_separator = rule_string.find(':');
+                const size_t filter_separator = rule_string.find(':', qos_separator + 1u);
+                lw_mqtt_broker_bridge_rule_t rule;
+                rule.direction = 0u;
+                if ((qos_separator != string::npos) && (filter_separator != string::npos))
+                {
+                    const string direction = rule_string.substr(0u, qos_separator);
+                    if (direction == "out")
+                    {
+                        rule.direction = 1u;
+                    }
+                    else if (direction == "in")
+                    {
+                        rule.direction = 2u;
+                    }
+                    else if (direction == "both")
+                    {
+                        rule.direction = 3u;
+                    }
+                    rule.qos = (uint8_t)atoi(rule_string.substr(qos_separator + 1u, filter_separator - qos_separator - 1u).c_str());
+                    rule.filter = rule_string.substr(filter_separator + 1u);
+                }
+                if (rule.direction != 0u)
+                {
+                    params.bridge_rules.push_back(rule);
+                }
+                else
+                {
+                    cout << "The -B option must be followed by <in|out|both>:<qos>:<topic-filter>.";
+                    invalid_arg = true;
+                }
+            }
+            else
+            {
+                cout << "The -B option must be followed by a topic rule of the bridge.";
+                invalid_arg = true;
+            }
+        }
+        else if (strcmp(*argv, "-s") == 0)
+        {
+            if (argc != 0)
+            {
+                argv++;
+                argc--;
+                params.sys_interval = (uint32_t)atoi(*argv);
+            }
+            else
+            {
+                cout << "The -s option must be followed by the period in seconds of the $SYS topics (0 to disable).";
+                invalid_arg = true;
+            }
+        }
+        else if (strcmp(*argv, "-c") == 0)
+        {
+            if (argc != 0)
+            {
+                argv++;
+                argc--;
+                params.max_clients = (uint32_t)atoi(*argv);
+            }
+            else
+            {
+                cout << "The -c option must be followed by the maximum number of simultaneous clients.";
+                invalid_arg = true;
+            }
+        }
         else if (strcmp(*argv, "-v") == 0)
         {
             params.verbose = true;
@@ -209,3 +573,10 @@ static bool lw_mqtt_broker_parse_parameters(lw_mqtt_broker_params_t& params, int
     return ret;
 }
 
+/** \brief Handler of the stop signal */
+static void lw_mqtt_broker_stop_handler(int signal_number)
+{
+    (void)signal_number;
+    s_stop_requested = 1;
+}
+
@@ -22,6 +22,7 @@ along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
 #include <ctime>
 #include <sstream>
 #include <iostream>
+#include <vector>
 using namespace std;
 
 #include "mqtt_client.h"
@@ -48,6 +49,7 @@ struct lw_mqtt_pub_params_t
         , topic("")
         , message("")
         , verbose(false)
+        , v5(false)
     {}
 
     /** \brief Broker IP address */
@@ -79,6 +81,9 @@ struct lw_mqtt_pub_params_t
 
     /** \brief Verbose mode */
     bool verbose;
+
+    /** \brief Use MQTT 5.0 */
+    bool v5;
 };
 
 
@@ -129,6 +134,8 @@ int main(int argc, char* argv[])
         string client_id;
         stringstream sstream;
         mqtt_client_t client;
+        mqtt_client_config_t config;
+        vector<uint64_t> arena;
         mqtt_client_callbacks_t callbacks = {
                                                 mqtt_client_connect_callback,
                                                 mqtt_client_subscribe_callback,
@@ -158,13 +165,21 @@ int main(int argc, char* argv[])
         sstream << "lw-mqtt-pub-" << std::rand();
         client_id = sstream.str();
 
-        /* Initialize client */
-        mqtt_client_init(&client);
+        /* Initialize client with the default limits */
+        mqtt_client_config_init(&config);
+        mqtt_client_get_arena_size(&config, &config.arena_size);
+        arena.resize((config.arena_size + sizeof(uint64_t) - 1u) / sizeof(uint64_t));
+        config.arena = &arena[0];
+        mqtt_client_init(&client, &config);
         mqtt_client_set_client_id(&client, client_id.c_str());
         mqtt_client_set_callbacks(&client, &callbacks);
         mqtt_client_set_keepalive(&client, params.keepalive);
         mqtt_client_set_user_data(&client, &params);
         mqtt_client_set_poll_period(&client, 50u);
+        if (params.v5)
+        {
+            mqtt_client_set_protocol_version(&client, MQTT_PROTOCOL_LEVEL_V5);
+        }
         mqtt_client_set_broker_response_timeout(&client, 250u);
 
         /* Connect to broker */
@@ -195,7 +210,7 @@ static void lw_mqtt_pub_print_usage()
 {
     cout << "usage: lw-mqtt-pub [--version] [--help] [-h <broker-ip>] [-p <broker-port>]" << endl;
     cout << "                   [-k <keepalive>] [--user <username>] [--passwd <password>]" << endl;
-    cout << "                   [-q <QoS>] [-r] [-t <topic>] [-m <message>] [-v]" << endl;
+    cout << "                   [-q <QoS>] [-r] [-t <topic>] [-m <message>] [-v] [--v5]" << endl;
 }
 
 
@@ -236,7 +251,7 @@ static bool lw_mqtt_pub_parse_parameters(lw_mqtt_pub_params_t& params, int argc,
             }
             else
             {
-                cout << "The -h option must be followed by the IP address of the broker.";
+                cout << "The -h option must be followed by the IP address of the broker or by unix:<path> for a local socket.";
                 invalid_arg = true;
             }
         }
@@ -347,6 +362,10 @@ static bool lw_mqtt_pub_parse_parameters(lw_mqtt_pub_params_t& params, int argc,
         {
             params.verbose = true;
         }
+        else if (strcmp(*argv, "--v5") == 0)
+        {
+            params.v5 = true;
+        }
         else
         {
             cout << "Invalid parameter : '" << *argv << "'.";
@@ -0,0 +1,672 @@
+/*
+Copyright(c) 2016 Cedric Jimenez
+
+This file is part of lw-mqtt.
+
+lw-mqtt is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+lw-mqtt is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <chrono>
+#include <vector>
+#include <iomanip>
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+using namespace std;
+
+#include "mqtt_broker.h"
+#include "mqtt_error.h"
+#include "mqtt_log.h"
+#include "mqtt_thread.h"
+#include "trace_stream.h"
+
+/* The replay needs the packet trace recorder, only a stub is built if it is not enabled */
+#ifdef MQTT_TRACE_ENABLED
+
+/** \brief Program version */
+#define LW_MQTT_REPLAY_VERSION "1.0"
+
+/** \brief Maximum size in bytes of the data of a record */
+#define LW_MQTT_REPLAY_MAX_RECORD_SIZE  (1024u * 1024u)
+
+/** \brief Number of in-process links, the broker is configured with the default limit of MQTT_BROKER_MAX_CLIENT connections */
+#define LW_MQTT_REPLAY_LINK_COUNT       MQTT_BROKER_MAX_CLIENT
+
+/** \brief Time in ms without data from the broker after which the replay is considered as finished */
+#define LW_MQTT_REPLAY_IDLE_TIMEOUT     200u
+
+/** \brief Marks a link which is not used by a recorded connection */
+#define LW_MQTT_REPLAY_NO_CONNECTION    0xFFFFFFFFu
+
+
+/** Program parameters */
+struct lw_mqtt_replay_params_t
+{
+
+    /** \brief Construtor to set the default values */
+    lw_mqtt_replay_params_t()
+        : trace_file("")
+        , speed(1.0)
+        , broker_ip("127.0.0.1")
+        , broker_port(0u)
+        , verbose(false)
+    {}
+
+    /** \brief File to replay */
+    string trace_file;
+
+    /** \brief Replay speed factor, 0 = as fast as possible */
+    double speed;
+
+    /** \brief IP address to bind the listen socket of the broker to */
+    string broker_ip;
+
+    /** \brief Port of the listen socket of the broker, 0 = any free port */
+    uint16_t broker_port;
+
+    /** \brief Verbose mode */
+    bool verbose;
+};
+
+/** \brief Record loaded from the trace file */
+struct lw_mqtt_replay_record_t
+{
+    /** \brief Header */
+    trace_stream_record_t header;
+    /** \brief Offset of the data in the data buffer */
+    size_t offset;
+};
+
+/** \brief In-process link used to replay a recorded connection */
+struct lw_mqtt_replay_link_t
+{
+    /** \brief Link */
+    ring_stream_link_t link;
+    /** \brief Output stream of the client side */
+    output_stream_t outstream;
+    /** \brief Input stream of the client side */
+    input_stream_t instream;
+    /** \brief Recorded connection replayed on the link, LW_MQTT_REPLAY_NO_CONNECTION if none */
+    uint32_t connection;
+    /** \brief Indicate if the client side is closed and the link waits for the broker to close its side */
+    bool closing;
+};
+
+/** \brief Replay statistics */
+struct lw_mqtt_replay_stats_t
+{
+    /** \brief Construtor to set the default values */
+    lw_mqtt_replay_stats_t()
+        : connections(0u)
+        , refused_connections(0u)
+        , sent_bytes(0u)
+        , dropped_bytes(0u)
+        , recorded_received_bytes(0u)
+        , received_bytes(0u)
+    {}
+
+    /** \brief Number of replayed connections */
+    uint32_t connections;
+    /** \brief Number of connections which could not be replayed because all the links were in use */
+    uint32_t refused_connections;
+    /** \brief Number of bytes sent to the broker */
+    uint64_t sent_bytes;
+    /** \brief Number of bytes not sent because the broker closed the connection */
+    uint64_t dropped_bytes;
+    /** \brief Number of bytes sent by the broker during the recording */
+    uint64_t recorded_received_bytes;
+    /** \brief Number of bytes received from the broker */
+    uint64_t received_bytes;
+};
+
+/** \brief Broker thread context */
+struct lw_mqtt_replay_broker_t
+{
+    /** \brief Broker */
+    mqtt_broker_t broker;
+    /** \brief Indicate if the broker thread must stop */
+    volatile bool stop;
+};
+
+
+
+/** \brief Print the version message */
+static void lw_mqtt_replay_print_version();
+
+/** \brief Print the usage message */
+static void lw_mqtt_replay_print_usage();
+
+/** \brief Parse the command line parameters */
+static bool lw_mqtt_replay_parse_parameters(lw_mqtt_replay_params_t& params, int argc, char* argv[]);
+
+/** \brief Load all the records of a trace file in memory so that the file accesses don't disturb the replay */
+static bool lw_mqtt_replay_load(const string& trace_file, vector<lw_mqtt_replay_record_t>& records, vector<uint8_t>& data);
+
+/** \brief Replay the records, returns the time of the last data received from the broker */
+static chrono::steady_clock::time_point lw_mqtt_replay_run(const lw_mqtt_replay_params_t& params, const vector<lw_mqtt_replay_record_t>& records,
+                                                           const vector<uint8_t>& data, lw_mqtt_replay_link_t links[], lw_mqtt_replay_stats_t& stats);
+
+/** \brief Receive and discard the data sent by the broker on all the links, releases the links closed on both sides */
+static bool lw_mqtt_replay_drain(lw_mqtt_replay_link_t links[], lw_mqtt_replay_stats_t& stats);
+
+/** \brief Wait until the broker has accepted a connection and received all the data sent on it */
+static void lw_mqtt_replay_flush(lw_mqtt_replay_link_t& link, lw_mqtt_replay_link_t links[], lw_mqtt_replay_stats_t& stats);
+
+/** \brief Get the link which replays a recorded connection, NULL if the connection is not replayed */
+static lw_mqtt_replay_link_t* lw_mqtt_replay_find_link(lw_mqtt_replay_link_t links[], const uint32_t connection);
+
+/** \brief Broker thread */
+static void lw_mqtt_replay_broker_thread(void* const param);
+
+
+
+
+/** \brief Program entry point */
+int main(int argc, char* argv[])
+{
+    bool ret;
+    lw_mqtt_replay_params_t params;
+
+    /* Parse command line parameters */
+    ret = lw_mqtt_replay_parse_parameters(params, argc, argv);
+    if (ret)
+    {
+        vector<lw_mqtt_replay_record_t> records;
+        vector<uint8_t> data;
+
+        /* Initialize low level layers */
+        mqtt_mutex_init();
+        mqtt_socket_init();
+        mqtt_log_init();
+
+        /* Set log verbosity */
+        if (params.verbose)
+        {
+            mqtt_log_set_filter(MQTT_LOG_LVL_INFO | MQTT_LOG_LVL_ERROR);
+        }
+        else
+        {
+            mqtt_log_set_filter(MQTT_LOG_LVL_ERROR);
+        }
+
+        /* Load the trace file */
+        ret = lw_mqtt_replay_load(params.trace_file, records, data);
+        if (ret)
+        {
+            lw_mqtt_replay_broker_t* const context = new lw_mqtt_replay_broker_t();
+            lw_mqtt_replay_link_t* const links = new lw_mqtt_replay_link_t[LW_MQTT_REPLAY_LINK_COUNT];
+            mqtt_broker_config_t config;
+            vector<uint64_t> arena;
+            mqtt_thread_t broker_thread;
+
+            /* Start the broker with the default limits, the replayed connections go through in-process
+               links so that the measures only depend on the broker */
+            mqtt_broker_config_init(&config);
+            mqtt_broker_get_arena_size(&config, &config.arena_size);
+            arena.resize((config.arena_size + sizeof(uint64_t) - 1u) / sizeof(uint64_t));
+            config.arena = &arena[0];
+            mqtt_broker_init(&context->broker, &config);
+            ret = mqtt_broker_start(&context->broker, params.broker_ip.c_str(), params.broker_port);
+            if (ret)
+            {
+                for (uint32_t i = 0u; i < LW_MQTT_REPLAY_LINK_COUNT; i++)
+                {
+                    ring_stream_link_init(&links[i].link);
+                    ring_stream_output_from_endpoint(&links[i].outstream, &links[i].link.client_endpoint);
+                    ring_stream_input_from_endpoint(&links[i].instream, &links[i].link.client_endpoint);
+                    links[i].connection = LW_MQTT_REPLAY_NO_CONNECTION;
+                    links[i].closing = false;
+                    mqtt_broker_add_local_link(&context->broker, &links[i].link);
+                }
+                context->stop = false;
+                ret = mqtt_thread_create(&broker_thread, lw_mqtt_replay_broker_thread, context);
+                if (!ret)
+                {
+                    cout << "Unable to create the broker thread" << endl;
+                }
+            }
+            else
+            {
+                cout << "Unable to start the broker (error " << mqtt_errno_get() << ")" << endl;
+            }
+
+            /* Replay */
+            if (ret)
+            {
+                lw_mqtt_replay_stats_t stats;
+                const auto start = chrono::steady_clock::now();
+                const auto end = lw_mqtt_replay_run(params, records, data, links, stats);
+                const double elapsed = chrono::duration<double>(end - start).count();
+                const double recorded = ((records.empty()) ? 0.0 : (static_cast<double>(records.back().header.timestamp - records.front().header.timestamp) / 1000.0));
+
+                context->stop = true;
+                mqtt_thread_join(&broker_thread);
+                for (uint32_t i = 0u; i < LW_MQTT_REPLAY_LINK_COUNT; i++)
+                {
+                    mqtt_broker_remove_local_link(&context->broker, &links[i].link);
+                }
+                mqtt_broker_stop(&context->broker);
+
+                /* Results */
+                cout << fixed << setprecision(3);
+                cout << "Records          : " << records.size() << endl;
+                cout << "Connections      : " << stats.connections << " replayed, " << stats.refused_connections << " refused" << endl;
+                cout << "Sent             : " << stats.sent_bytes << " bytes (" << stats.dropped_bytes << " dropped)" << endl;
+                cout << "Received         : " << stats.received_bytes << " bytes (" << stats.recorded_received_bytes << " recorded)" << endl;
+                cout << "Recorded duration: " << recorded << " s" << endl;
+                cout << "Replay duration  : " << elapsed << " s" << endl;
+                if (elapsed > 0.0)
+                {
+                    cout << "Throughput       : " << (static_cast<double>(stats.sent_bytes + stats.received_bytes) / elapsed / 1000000.0) << " MB/s" << endl;
+                }
+            }
+
+            delete[] links;
+            delete context;
+        }
+    }
+
+    return ((ret)?0:1);
+}
+
+
+/** \brief Print the version message */
+static void lw_mqtt_replay_print_version()
+{
+    cout << "lw-mqtt-replay version " << LW_MQTT_REPLAY_VERSION << " compiled with liblw-mqtt version " << lw_mqtt_lib_version() << endl;
+}
+
+/** \brief Print the usage message */
+static void lw_mqtt_replay_print_usage()
+{
+    cout << "usage: lw-mqtt-replay [--version] [--help] -f <trace-file> [-s <speed>] [-h <broker-ip>] [-p <broker-port>] [-v]" << endl;
+    cout << "       -s 1 replays at the recorded speed (default), -s N replays N times faster, -s 0 replays as fast as possible" << endl;
+}
+
+
+/** \brief Parse the command line parameters */
+static bool lw_mqtt_replay_parse_parameters(lw_mqtt_replay_params_t& params, int argc, char* argv[])
+{
+    bool ret = false;
+    bool unique_option = false;
+    bool invalid_arg = false;
+
+    /* Skip first parameter */
+    argc--;
+    argv++;
+
+    /* Check parameters */
+    while ((argc != 0) && !invalid_arg && !unique_option)
+    {
+        argc--;
+
+        if (strcmp(*argv, "--help") == 0)
+        {
+            unique_option = true;
+            lw_mqtt_replay_print_usage();
+        }
+        else if (strcmp(*argv, "--version") == 0)
+        {
+            unique_option = true;
+            lw_mqtt_replay_print_version();
+        }
+        else if (strcmp(*argv, "-f") == 0)
+        {
+            if (argc != 0)
+            {
+                argv++;
+                argc--;
+                params.trace_file = *argv;
+            }
+            else
+            {
+                cout << "The -f option must be followed by the trace file to replay.";
+                invalid_arg = true;
+            }
+        }
+        else if (strcmp(*argv, "-s") == 0)
+        {
+            if (argc != 0)
+            {
+                argv++;
+                argc--;
+                params.speed = atof(*argv);
+                if (params.speed < 0.0)
+                {
+                    cout << "The replay speed must be positive.";
+                    invalid_arg = true;
+                }
+            }
+            else
+            {
+                cout << "The -s option must be followed by the replay speed.";
+                invalid_arg = true;
+            }
+        }
+        else if (strcmp(*argv, "-h") == 0)
+        {
+            if (argc != 0)
+            {
+                argv++;
+                argc--;
+                params.broker_ip = *argv;
+            }
+            else
+            {
+                cout << "The -h option must be followed by the IP address of the broker.";
+                invalid_arg = true;
+            }
+        }
+        else if (strcmp(*argv, "-p") == 0)
+        {
+            if (argc != 0)
+            {
+                argv++;
+                argc--;
+                params.broker_port = (uint16_t)atoi(*argv);
+            }
+            else
+            {
+                cout << "The -p option must be followed by the TCP port of the broker.";
+                invalid_arg = true;
+            }
+        }
+        else if (strcmp(*argv, "-v") == 0)
+        {
+            params.verbose = true;
+        }
+        else
+        {
+            cout << "Invalid parameter : '" << *argv << "'.";
+            invalid_arg = true;
+        }
+
+        /* Next param */
+        argv++;
+    }
+
+    if (!invalid_arg && !unique_option && params.trace_file.empty())
+    {
+        cout << "The trace file must be specified with the -f option.";
+        invalid_arg = true;
+    }
+
+    if (invalid_arg)
+    {
+        cout << endl << "See 'lw-mqtt-replay --help'." << endl;
+    }
+    else
+    {
+        if (!unique_option)
+        {
+            ret = true;
+        }
+    }
+
+    return ret;
+}
+
+/** \brief Load all the records of a trace file in memory */
+static bool lw_mqtt_replay_load(const string& trace_file, vector<lw_mqtt_replay_record_t>& records, vector<uint8_t>& data)
+{
+    bool ret;
+    trace_stream_reader_t reader;
+
+    ret = trace_stream_reader_open(&reader, trace_file.c_str());
+    if (ret)
+    {
+        vector<uint8_t> buffer(LW_MQTT_REPLAY_MAX_RECORD_SIZE);
+        lw_mqtt_replay_record_t record;
+        while (trace_stream_reader_next(&reader, &record.header, &buffer[0], buffer.size()))
+        {
+            record.offset = data.size();
+            data.insert(data.end(), buffer.begin(), buffer.begin() + record.header.size);
+            records.push_back(record);
+        }
+        if (mqtt_errno_get() != MQTT_ERR_INPUT_STREAM_EMPTY)
+        {
+            cout << "Invalid record " << records.size() << " in trace file '" << trace_file << "' (error " << mqtt_errno_get() << ")" << endl;
+            ret = false;
+        }
+        trace_stream_reader_close(&reader);
+    }
+    else
+    {
+        cout << "Unable to open the trace file '" << trace_file << "'" << endl;
+    }
+
+    return ret;
+}
+
+/** \brief Replay the records, returns the time of the last data received from the broker */
+static chrono::steady_clock::time_point lw_mqtt_replay_run(const lw_mqtt_replay_params_t& params, const vector<lw_mqtt_replay_record_t>& records,
+                                                           const vector<uint8_t>& data, lw_mqtt_replay_link_t links[], lw_mqtt_replay_stats_t& stats)
+{
+    const auto start = chrono::steady_clock::now();
+    const uint32_t first_timestamp = ((records.empty()) ? 0u : records.front().header.timestamp);
+
+    for (size_t i = 0u; i < records.size(); i++)
+    {
+        const trace_stream_record_t& record = records[i].header;
+        lw_mqtt_replay_link_t* link;
+
+        /* Wait for the time of the record while receiving the data sent by the broker */
+        if (params.speed > 0.0)
+        {
+            const auto due = start + chrono::duration_cast<chrono::steady_clock::duration>(
+                                        chrono::duration<double, milli>(static_cast<double>(record.timestamp - first_timestamp) / params.speed));
+            while (chrono::steady_clock::now() < due)
+            {
+                if (!lw_mqtt_replay_drain(links, stats))
+                {
+                    mqtt_thread_sleep(0u);
+                }
+            }
+        }
+
+        switch (record.type)
+        {
+            case TRACE_STREAM_RECORD_OPEN:
+            {
+                /* Use a link which has been closed on both sides */
+                link = NULL;
+                for (uint32_t j = 0u; (j < LW_MQTT_REPLAY_LINK_COUNT) && (link == NULL); j++)
+                {
+                    if ((links[j].connection == LW_MQTT_REPLAY_NO_CONNECTION) && ring_stream_link_connect(&links[j].link))
+                    {
+                        link = &links[j];
+                    }
+                }
+                if (link != NULL)
+                {
+                    link->connection = record.connection;
+                    stats.connections++;
+                }
+                else
+                {
+                    stats.refused_connections++;
+                }
+                break;
+            }
+
+            case TRACE_STREAM_RECORD_INPUT:
+            {
+                /* Send the data without blocking so that the data sent by the broker can be received meanwhile */
+                size_t offset = 0u;
+                link = lw_mqtt_replay_find_link(links, record.connection);
+                while ((link != NULL) && (offset < record.size))
+                {
+                    size_t size = 0u;
+                    ring_stream_get_writable_size(&link->link.client_endpoint, &size);
+                    if (size > (record.size - offset))
+                    {
+                        size = record.size - offset;
+                    }
+                    if (size != 0u)
+                    {
+                        if (link->outstream.writer(&link->outstream, &data[records[i].offset + offset], size))
+                        {
+                            offset += size;
+                            stats.sent_bytes += size;
+                        }
+                        else
+                        {
+                            /* Connection closed by the broker */
+                            link = NULL;
+                        }
+                    }
+                    else
+                    {
+                        lw_mqtt_replay_drain(links, stats);
+                    }
+                }
+                stats.dropped_bytes += (record.size - offset);
+                break;
+            }
+
+            case TRACE_STREAM_RECORD_OUTPUT:
+            {
+                stats.recorded_received_bytes += record.size;
+                break;
+            }
+
+            case TRACE_STREAM_RECORD_CLOSE:
+            {
+                /* Like a TCP connection, the data sent before the closing must still be processed by the broker,
+                   the link is released once the broker has closed its side */
+                link = lw_mqtt_replay_find_link(links, record.connection);
+                if ((link != NULL) && !link->closing)
+                {
+                    lw_mqtt_replay_flush(*link, links, stats);
+                    ring_stream_link_close(&link->link.client_endpoint);
+                    link->closing = true;
+                }
+                break;
+            }
+
+            default:
+            {
+                /* Unknown record */
+                break;
+            }
+        }
+    }
+
+    /* Receive the last data sent by the broker */
+    for (uint32_t i = 0u; i < LW_MQTT_REPLAY_LINK_COUNT; i++)
+    {
+        if ((links[i].connection != LW_MQTT_REPLAY_NO_CONNECTION) && !links[i].closing)
+        {
+            lw_mqtt_replay_flush(links[i], links, stats);
+        }
+    }
+    auto last_activity = chrono::steady_clock::now();
+    while ((chrono::steady_clock::now() - last_activity) < chrono::milliseconds(LW_MQTT_REPLAY_IDLE_TIMEOUT))
+    {
+        if (lw_mqtt_replay_drain(links, stats))
+        {
+            last_activity = chrono::steady_clock::now();
+        }
+        else
+        {
+            mqtt_thread_sleep(1u);
+        }
+    }
+
+    return last_activity;
+}
+
+/** \brief Receive and discard the data sent by the broker on all the links, releases the links closed on both sides */
+static bool lw_mqtt_replay_drain(lw_mqtt_replay_link_t links[], lw_mqtt_replay_stats_t& stats)
+{
+    bool activity = false;
+    uint8_t buffer[MQTT_RING_STREAM_SIZE];
+
+    for (uint32_t i = 0u; i < LW_MQTT_REPLAY_LINK_COUNT; i++)
+    {
+        if (links[i].connection != LW_MQTT_REPLAY_NO_CONNECTION)
+        {
+            /* The state is read first : the broker doesn't send anything after closing its side */
+            const bool closed = (links[i].closing && (links[i].link.state == RING_STREAM_LINK_IDLE));
+            size_t size = 0u;
+            if (ring_stream_get_readable_size(&links[i].link.client_endpoint, &size) && (size != 0u))
+            {
+                links[i].instream.reader(&links[i].instream, buffer, size);
+                stats.received_bytes += size;
+                activity = true;
+            }
+            if (closed)
+            {
+                links[i].connection = LW_MQTT_REPLAY_NO_CONNECTION;
+                links[i].closing = false;
+            }
+        }
+    }
+
+    return activity;
+}
+
+/** \brief Wait until the broker has accepted a connection and received all the data sent on it */
+static void lw_mqtt_replay_flush(lw_mqtt_replay_link_t& link, lw_mqtt_replay_link_t links[], lw_mqtt_replay_stats_t& stats)
+{
+    size_t size = 0u;
+    ring_stream_get_writable_size(&link.link.client_endpoint, &size);
+    while ((link.link.state == RING_STREAM_LINK_CONNECTING) ||
+           ((link.link.state == RING_STREAM_LINK_CONNECTED) && (size != MQTT_RING_STREAM_SIZE)))
+    {
+        if (!lw_mqtt_replay_drain(links, stats))
+        {
+            mqtt_thread_sleep(0u);
+        }
+        ring_stream_get_writable_size(&link.link.client_endpoint, &size);
+    }
+}
+
+/** \brief Get the link which replays a recorded connection, NULL if the connection is not replayed */
+static lw_mqtt_replay_link_t* lw_mqtt_replay_find_link(lw_mqtt_replay_link_t links[], const uint32_t connection)
+{
+    lw_mqtt_replay_link_t* link = NULL;
+
+    for (uint32_t i = 0u; (i < LW_MQTT_REPLAY_LINK_COUNT) && (link == NULL); i++)
+    {
+        if (links[i].connection == connection)
+        {
+            link = &links[i];
+        }
+    }
+
+    return link;
+}
+
+/** \brief Broker thread */
+static void lw_mqtt_replay_broker_thread(void* const param)
+{
+    lw_mqtt_replay_broker_t* const context = static_cast<lw_mqtt_replay_broker_t*>(param);
+
+    while (!context->stop)
+    {
+        mqtt_broker_task(&context->broker);
+    }
+}
+
+#else /* MQTT_TRACE_ENABLED */
+
+/** \brief Program entry point */
+int main()
+{
+    cout << "lw-mqtt-replay requires MQTT_TRACE_ENABLED in mqtt_config.h" << endl;
+    return 1;
+}
+
+#endif /* MQTT_TRACE_ENABLED */
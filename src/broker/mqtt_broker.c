@@ -22,23 +22,416 @@ along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
 #include "mqtt_time.h"
 #include "mqtt_packet_serialize.h"
 #include "mqtt_packet_deserialize.h"
+#include "mqtt_log.h"
+#include "buffer_stream.h"
+#include "mqtt_packet_varint.h"
 
+#ifdef MQTT_BROKER_SYS_ENABLED
+#include <stdio.h>
+#endif /* MQTT_BROKER_SYS_ENABLED */
 
 
-/** \brief Initialize a MQTT broker */
-bool mqtt_broker_init(mqtt_broker_t* const mqtt_broker)
+/** \brief Tag of the listen socket in the poller events, the session sockets are tagged with their index */
+#define MQTT_BROKER_LISTEN_TAG  0xFFFFFFFFu
+
+/** \brief Tag of the bridge socket in the poller events, the bridge is processed on each loop of the broker task */
+#define MQTT_BROKER_BRIDGE_TAG  0xFFFFFFFEu
+
+
+#if defined(__GNUC__) || defined(__clang__)
+
+/** \brief Load a pointer of the subscription index published by the broker task */
+#define MQTT_BROKER_LOAD_ACQUIRE(ptr)           __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+
+/** \brief Publish a pointer of the subscription index to the lock-free readers */
+#define MQTT_BROKER_STORE_RELEASE(ptr, value)   __atomic_store_n((ptr), (value), __ATOMIC_RELEASE)
+
+/** \brief Take a reader slot if it has the expected value */
+#define MQTT_BROKER_COMPARE_EXCHANGE(ptr, expected, desired) \
+    __atomic_compare_exchange_n((ptr), &(expected), (desired), false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)
+
+/** \brief Order the previous stores before the next loads */
+#define MQTT_BROKER_FULL_FENCE()                __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+#else
+
+#include <intrin.h>
+
+/** \brief Load a pointer of the subscription index published by the broker task (volatile accesses have acquire semantics with MSVC) */
+#define MQTT_BROKER_LOAD_ACQUIRE(ptr)           (*(ptr))
+
+/** \brief Publish a pointer of the subscription index to the lock-free readers (volatile accesses have release semantics with MSVC) */
+#define MQTT_BROKER_STORE_RELEASE(ptr, value)   ((*(ptr)) = (value))
+
+/** \brief Take a reader slot if it has the expected value */
+#define MQTT_BROKER_COMPARE_EXCHANGE(ptr, expected, desired) \
+    (_InterlockedCompareExchange((volatile long*)(ptr), (long)(desired), (long)(expected)) == (long)(expected))
+
+/** \brief Order the previous stores before the next loads */
+#define MQTT_BROKER_FULL_FENCE()                MemoryBarrier()
+
+#endif /* defined(__GNUC__) || defined(__clang__) */
+
+
+/** \brief Check the limits of a broker configuration */
+static bool mqtt_broker_check_config(const mqtt_broker_config_t* const config);
+
+/** \brief Carve the tables and the buffers of a broker from an arena, only the arena is updated if the broker is NULL */
+static bool mqtt_broker_carve(mqtt_broker_t* const mqtt_broker, const mqtt_broker_config_t* const config, mqtt_arena_t* const arena);
+
+/** \brief Accept the incoming connections */
+static void mqtt_broker_accept(mqtt_broker_t* const mqtt_broker);
+
+/** \brief Open a session for an accepted connection */
+static void mqtt_broker_open_session(mqtt_broker_t* const mqtt_broker, const mqtt_socket_t client_socket);
+
+/** \brief Allocate and initialize a session for a new connection */
+static mqtt_broker_session_t* mqtt_broker_new_session(mqtt_broker_t* const mqtt_broker);
+
+#ifdef MQTT_TRACE_ENABLED
+
+/** \brief Start the trace of a new connection if the connections are recorded, its transport streams must be initialized */
+static void mqtt_broker_trace_session(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session, const bool trace_input);
+
+#endif /* MQTT_TRACE_ENABLED */
+
+/** \brief Process the packets received on a session */
+static void mqtt_broker_process_session(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session);
+
+/** \brief Process a packet received on a session once its header has been read */
+static void mqtt_broker_process_packet(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session,
+                                       const mqtt_control_packet_type_t packet_type, const uint8_t packet_flags, const uint32_t packet_length);
+
+/** \brief Process a CONNECT packet */
+static bool mqtt_broker_process_connect(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session, const uint32_t packet_length);
+
+/** \brief Process a PUBLISH packet */
+static bool mqtt_broker_process_publish(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session, 
+                                        const uint8_t packet_flags, const uint32_t packet_length);
+
+/** \brief Process a SUBSCRIBE packet */
+static bool mqtt_broker_process_subscribe(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session, const uint32_t packet_length);
+
+/** \brief Process an UNSUBSCRIBE packet */
+static bool mqtt_broker_process_unsubscribe(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session, const uint32_t packet_length);
+
+/** \brief Resolve the topic alias of a received PUBLISH packet */
+static bool mqtt_broker_resolve_topic_alias(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session, 
+                                            const mqtt_properties_t* const properties);
+
+/** \brief Take over the existing session of the client id of a new connection, returns true if its state has been resumed */
+static bool mqtt_broker_take_over_session(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session, 
+                                          const bool resume, const bool persistent);
+
+/** \brief Discard the state of a session and release it if its client is disconnected */
+static void mqtt_broker_discard_session(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session);
+
+/** \brief Start the expiration of a persistent session whose client is disconnected */
+static void mqtt_broker_start_expiry(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session);
+
+/** \brief Release the expired sessions whose client is disconnected and wait for the next expiration */
+static void mqtt_broker_expiry_timer_expired(mqtt_timer_wheel_timer_t* const timer, void* const param);
+
+/** \brief Release the persistent session whose client has been disconnected for the longest time to make room for a new connection */
+static void mqtt_broker_evict_session(mqtt_broker_t* const mqtt_broker);
+
+/** \brief Compute the hash of a client id or of a topic filter */
+static uint32_t mqtt_broker_hash(const char* const str, const uint16_t size);
+
+/** \brief Get the number of buckets of an index for a number of items */
+static uint32_t mqtt_broker_hash_size(const uint32_t count);
+
+/** \brief Find the session of a client id (NULL if not found) */
+static mqtt_broker_session_t* mqtt_broker_find_session(mqtt_broker_t* const mqtt_broker, const char* const client_id, const uint16_t size);
+
+/** \brief Add a session to the client id index */
+static void mqtt_broker_hash_session(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session);
+
+/** \brief Remove a session from the client id index if it is indexed */
+static void mqtt_broker_unhash_session(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session);
+
+/** \brief Route a message to the matching subscriptions, the publisher is NULL for the messages published by the broker */
+static void mqtt_broker_route(mqtt_broker_t* const mqtt_broker, const mqtt_broker_session_t* const publisher, const mqtt_string_t* const topic, 
+                              const void* const data, const uint32_t length, const uint8_t qos);
+
+/** \brief Send a message to a subscriber or queue it if the subscriber can't receive it now */
+static void mqtt_broker_deliver(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session, const mqtt_string_t* const topic, 
+                                const void* const data, const uint32_t length, const uint8_t qos);
+
+/** \brief Send the queued messages of a session while its client accepts them */
+static void mqtt_broker_drain_queue(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session);
+
+/** \brief Send the next queued message of a session which stays queued until it is acknowledged, returns false if the connection is lost */
+static bool mqtt_broker_send_queued(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session, const mqtt_string_t* const topic, 
+                                    const void* const data, const uint32_t length, const uint8_t qos, const bool dup, const uint16_t packet_id);
+
+/** \brief Remove the queued messages of a session, including its spilled messages */
+static void mqtt_broker_clear_queue(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session);
+
+/** \brief Send a message to a subscriber, returns false if the message has been discarded or the connection is lost */
+static bool mqtt_broker_forward(mqtt_broker_session_t* const session, const mqtt_string_t* const topic, const void* const data, 
+                                const uint32_t length, const uint8_t qos, const bool retain, const bool dup, const uint16_t packet_id);
+
+/** \brief Get the next packet id to send a QoS 1 or QoS 2 message to a subscriber */
+static uint16_t mqtt_broker_next_packet_id(mqtt_broker_session_t* const session);
+
+/** \brief Check if a message can be sent to a subscriber without waiting, only the in-process links can be full */
+static bool mqtt_broker_can_send(mqtt_broker_session_t* const session, const mqtt_string_t* const topic, const uint32_t length, const uint8_t qos);
+
+/** \brief Find an opened topic filter (NULL if not found) */
+static mqtt_broker_topic_t* mqtt_broker_find_topic(mqtt_broker_t* const mqtt_broker, const char* const topic_filter, const uint16_t size);
+
+/** \brief Open a new topic filter (NULL if there are no more topics) */
+static mqtt_broker_topic_t* mqtt_broker_open_topic(mqtt_broker_t* const mqtt_broker, const char* const topic_filter, const uint16_t size);
+
+/** \brief Remove a topic filter without subscriptions from the opened topics */
+static void mqtt_broker_close_topic(mqtt_broker_t* const mqtt_broker, mqtt_broker_topic_t* const topic);
+
+/** \brief Add a subscription to a topic filter with its MQTT 5.0 options (MQTT_SUBSCRIBE_OPTION_*), the existing subscriptions
+           of the session are not looked for if check_existing is false */
+static uint8_t mqtt_broker_add_subscription(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session, 
+                                            const mqtt_string_t* const topic_filter, const uint8_t qos, const uint8_t options, 
+                                            const bool check_existing);
+
+/** \brief Remove a subscription from a topic filter */
+static bool mqtt_broker_remove_subscription(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session, 
+                                            const mqtt_string_t* const topic_filter);
+
+/** \brief Remove all the subscriptions of a session */
+static void mqtt_broker_remove_all_subscriptions(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session);
+
+/** \brief Remove a subscription from its topic filter and from its session */
+static void mqtt_broker_release_subscription(mqtt_broker_t* const mqtt_broker, mqtt_broker_subscription_t* const subscription);
+
+/** \brief Check if a topic name matches a topic filter */
+static bool mqtt_broker_topic_match(const mqtt_string_t* const topic_filter, const mqtt_string_t* const topic);
+
+/** \brief Get the topic filter of a subscription without its $share/<group>/ prefix, returns false if the shared subscription is invalid */
+static bool mqtt_broker_get_filter(const mqtt_string_t* const topic_filter, mqtt_string_t* const filter, bool* const shared);
+
+/** \brief Select the member of a shared subscription which receives the next message */
+static const mqtt_broker_subscription_t* mqtt_broker_select_shared(mqtt_broker_topic_t* const topic);
+
+/** \brief Retire a topic removed from the opened topics until no lock-free reader can reach it */
+static void mqtt_broker_retire_topic(mqtt_broker_t* const mqtt_broker, mqtt_broker_topic_t* const topic);
+
+/** \brief Retire a subscription removed from its topic until no lock-free reader can reach it */
+static void mqtt_broker_retire_subscription(mqtt_broker_t* const mqtt_broker, mqtt_broker_subscription_t* const subscription);
+
+/** \brief Move the retired topics and subscriptions which can't be reached anymore to the free lists */
+static void mqtt_broker_reclaim_index(mqtt_broker_t* const mqtt_broker);
+
+/** \brief Take a reader slot to read the subscription index without lock */
+static uint32_t mqtt_broker_index_read_lock(mqtt_broker_t* const mqtt_broker);
+
+/** \brief Release a reader slot */
+static void mqtt_broker_index_read_unlock(mqtt_broker_t* const mqtt_broker, const uint32_t slot);
+
+/** \brief Close a session */
+static void mqtt_broker_close_session(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session);
+
+/** \brief Get the properties to use in the packets sent to a client */
+static mqtt_properties_t* mqtt_broker_get_properties(const mqtt_broker_session_t* const session, mqtt_properties_t* const properties);
+
+/** \brief Close a session whose keepalive or CONNECT timeout has expired */
+static void mqtt_broker_session_timeout(mqtt_timer_wheel_timer_t* const timer, void* const param);
+
+/** \brief Wait for the events of the poller and process them */
+static void mqtt_broker_poller_process_events(mqtt_broker_t* const mqtt_broker, const uint32_t ms_timeout);
+
+/** \brief Accept the connections and process the packets of the in-process links, returns true if something happened */
+static bool mqtt_broker_local_process_events(mqtt_broker_t* const mqtt_broker);
+
+#ifdef MQTT_SOCKET_IO_URING_ENABLED
+
+/** \brief Process the events of the io_uring instance, returns true if something happened */
+static bool mqtt_broker_uring_process_events(mqtt_broker_t* const mqtt_broker);
+
+/** \brief Get the session corresponding to the tag of an io_uring event */
+static mqtt_broker_session_t* mqtt_broker_uring_get_session(mqtt_broker_t* const mqtt_broker, const uint32_t tag);
+
+/** \brief Process the data received on a session through the io_uring instance */
+static void mqtt_broker_uring_receive(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session,
+                                      const uint8_t* const data, const size_t size);
+
+#endif /* MQTT_SOCKET_IO_URING_ENABLED */
+
+#ifdef MQTT_BROKER_SYS_ENABLED
+
+/** \brief Sum the counters of the broker and of its sessions */
+static void mqtt_broker_collect_stats(mqtt_broker_t* const mqtt_broker, mqtt_broker_stats_t* const stats);
+
+/** \brief Add the traffic counters of a session to the statistics */
+static void mqtt_broker_add_session_stats(mqtt_broker_stats_t* const stats, const mqtt_broker_session_t* const session);
+
+/** \brief Publish the statistics under the $SYS/broker/ topics */
+static void mqtt_broker_publish_sys(mqtt_broker_t* const mqtt_broker);
+
+/** \brief Publish a number under a $SYS/broker/ topic */
+static void mqtt_broker_publish_sys_number(mqtt_broker_t* const mqtt_broker, const char* const name, const uint64_t value);
+
+/** \brief Publish a string under a $SYS/broker/ topic */
+static void mqtt_broker_publish_sys_string(mqtt_broker_t* const mqtt_broker, const char* const name, const char* const value);
+
+#endif /* MQTT_BROKER_SYS_ENABLED */
+
+#ifdef MQTT_BROKER_STORE_ENABLED
+
+/** \brief Append a change of a persistent session to the log of the store */
+static void mqtt_broker_log_change(mqtt_broker_t* const mqtt_broker, const mqtt_broker_session_t* const session, 
+                                   const mqtt_broker_store_record_type_t type, const mqtt_string_t* const topic, 
+                                   const void* const data, const uint32_t length, const uint8_t qos);
+
+/** \brief Apply a record loaded from the store */
+static bool mqtt_broker_load_record(void* const param, const mqtt_broker_store_record_t* const record, const bool snapshot);
+
+/** \brief Create a persistent session loaded from the store */
+static mqtt_broker_session_t* mqtt_broker_new_offline_session(mqtt_broker_t* const mqtt_broker, const mqtt_const_string_t* const client_id);
+
+/** \brief Write the persistent sessions to a new snapshot of the store */
+static bool mqtt_broker_write_snapshot(mqtt_broker_t* const mqtt_broker);
+
+/** \brief Sync the log of the store and replace it by a snapshot once it has grown enough */
+static void mqtt_broker_sync_store(mqtt_broker_t* const mqtt_broker);
+
+/** \brief Group commit of the store */
+static void mqtt_broker_store_timer_expired(mqtt_timer_wheel_timer_t* const timer, void* const param);
+
+#endif /* MQTT_BROKER_STORE_ENABLED */
+
+#ifdef MQTT_BROKER_RETAIN_ENABLED
+
+/** \brief Update the retained message of a topic */
+static void mqtt_broker_retain_message(mqtt_broker_t* const mqtt_broker, const mqtt_string_t* const topic, const void* const data, 
+                                       const uint32_t length, const uint8_t qos);
+
+/** \brief Send the retained messages matching a new subscription, the retained store is scanned by batches for a wildcard subscription */
+static void mqtt_broker_send_retained(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session, 
+                                      const mqtt_string_t* const topic_filter, const uint8_t granted_qos);
+
+/** \brief Send the retained messages matching the wildcard subscription of a session from a batch of retained messages */
+static void mqtt_broker_scan_retained(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session, const uint32_t batch_size);
+
+/** \brief Sync of the retained store */
+static void mqtt_broker_retain_timer_expired(mqtt_timer_wheel_timer_t* const timer, void* const param);
+
+#endif /* MQTT_BROKER_RETAIN_ENABLED */
+
+#ifdef MQTT_BROKER_SPILL_ENABLED
+
+/** \brief Queue the messages read back from the disk spill */
+static void mqtt_broker_refill_queues(mqtt_broker_t* const mqtt_broker);
+
+#endif /* MQTT_BROKER_SPILL_ENABLED */
+
+#ifdef MQTT_BROKER_BRIDGE_ENABLED
+
+/** \brief Forward a local message to the remote broker if it matches an outbound rule of the bridge */
+static void mqtt_broker_bridge_message(mqtt_broker_t* const mqtt_broker, const mqtt_string_t* const topic, const void* const data, 
+                                       const uint32_t length, const uint8_t qos);
+
+/** \brief Route the messages received from the remote broker */
+static bool mqtt_broker_process_bridge(mqtt_broker_t* const mqtt_broker);
+
+#endif /* MQTT_BROKER_BRIDGE_ENABLED */
+
+
+
+/** \brief Fill a broker configuration with the default limits of the configuration file, without arena */
+bool mqtt_broker_config_init(mqtt_broker_config_t* const config)
 {
     bool ret = false;
 
     /* Check params */
-    if (mqtt_broker != NULL)
+    if (config != NULL)
+    {
+        config->max_clients = MQTT_BROKER_MAX_CLIENT;
+        config->max_topics = MQTT_BROKER_MAX_TOPIC_COUNT;
+        config->max_subscriptions = MQTT_BROKER_MAX_SUBSCRIPTION_COUNT;
+        config->max_topic_length = MQTT_BROKER_MAX_TOPIC_LENGTH;
+        config->max_payload_size = MQTT_BROKER_MAX_PAYLOAD_SIZE;
+        config->max_client_id_length = MQTT_BROKER_MAX_CLIENT_ID_LENGTH;
+        config->max_will_topic_length = MQTT_BROKER_MAX_WILL_TOPIC_LENGTH;
+        config->max_will_message_size = MQTT_BROKER_MAX_WILL_MESSAGE_SIZE;
+        config->max_topic_aliases = MQTT_BROKER_MAX_TOPIC_ALIAS;
+        config->receive_maximum = MQTT_BROKER_RECEIVE_MAXIMUM;
+        config->max_queue_size = MQTT_BROKER_MAX_QUEUE_SIZE;
+        config->local_output_size = MQTT_BROKER_LOCAL_OUTPUT_SIZE;
+        config->max_session_expiry = MQTT_BROKER_MAX_SESSION_EXPIRY;
+        #ifdef MQTT_BROKER_SPILL_ENABLED
+        config->spill_ring_size = MQTT_BROKER_SPILL_RING_SIZE;
+        #endif /* MQTT_BROKER_SPILL_ENABLED */
+        #ifdef MQTT_BROKER_BRIDGE_ENABLED
+        config->bridge_batch_size = MQTT_BROKER_BRIDGE_BATCH_SIZE;
+        config->bridge_queue_size = MQTT_BROKER_BRIDGE_QUEUE_SIZE;
+        #endif /* MQTT_BROKER_BRIDGE_ENABLED */
+        config->arena = NULL;
+        config->arena_size = 0u;
+        ret = true;
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Get the size in bytes of the arena needed by a broker configuration */
+bool mqtt_broker_get_arena_size(const mqtt_broker_config_t* const config, size_t* const size)
+{
+    bool ret = false;
+
+    /* Check params */
+    if (mqtt_broker_check_config(config) &&
+        (size != NULL))
+    {
+        /* Replay the allocations without memory area */
+        mqtt_arena_t arena;
+        (void)mqtt_arena_init(&arena, NULL, 0u);
+        (void)mqtt_broker_carve(NULL, config, &arena);
+        ret = mqtt_arena_get_used(&arena, size);
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Initialize a MQTT broker, the arena of the configuration must outlive the broker */
+bool mqtt_broker_init(mqtt_broker_t* const mqtt_broker, const mqtt_broker_config_t* const config)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((mqtt_broker != NULL) &&
+        mqtt_broker_check_config(config) &&
+        (config->arena != NULL))
     {
+        uint32_t i;
+        mqtt_arena_t arena;
+
         /* Re-init data structure */
         memset(mqtt_broker, 0, sizeof(mqtt_broker_t));
+        mqtt_broker->config = (*config);
+        mqtt_broker->max_packet_size = config->max_topic_length + config->max_payload_size + 16u;
 
-        /* Create listen socket */
-        ret = mqtt_socket_open(&mqtt_broker->listen_socket, false);
+        /* Carve the tables and the buffers from the arena */
+        ret = mqtt_arena_init(&arena, config->arena, config->arena_size);
+        if (ret)
+        {
+            ret = mqtt_broker_carve(mqtt_broker, config, &arena);
+        }
 
+        /* Create listen socket */
+        if (ret)
+        {
+            ret = mqtt_socket_open(&mqtt_broker->listen_socket, false);
+        }
 
         /* Create the mutex */
         #ifdef MQTT_MULTITASKING_ENABLED
@@ -48,6 +441,53 @@ bool mqtt_broker_init(mqtt_broker_t* const mqtt_broker)
         }
         #endif /* MQTT_MULTITASKING_ENABLED */
 
+        /* Initialize the timers */
+        if (ret)
+        {
+            ret = mqtt_timer_wheel_init(&mqtt_broker->timer_wheel);
+        }
+        #ifdef MQTT_BROKER_SYS_ENABLED
+        (void)mqtt_timer_wheel_timer_init(&mqtt_broker->sys_timer, NULL, NULL);
+        mqtt_broker->sys_interval = MQTT_BROKER_SYS_INTERVAL;
+        #endif /* MQTT_BROKER_SYS_ENABLED */
+        #ifdef MQTT_BROKER_STORE_ENABLED
+        (void)mqtt_timer_wheel_timer_init(&mqtt_broker->store_timer, mqtt_broker_store_timer_expired, mqtt_broker);
+        #endif /* MQTT_BROKER_STORE_ENABLED */
+        #ifdef MQTT_BROKER_RETAIN_ENABLED
+        (void)mqtt_timer_wheel_timer_init(&mqtt_broker->retain_timer, mqtt_broker_retain_timer_expired, mqtt_broker);
+        #endif /* MQTT_BROKER_RETAIN_ENABLED */
+        (void)mqtt_timer_wheel_timer_init(&mqtt_broker->expiry_timer, mqtt_broker_expiry_timer_expired, mqtt_broker);
+        mqtt_broker->next_expiry_time = UINT64_MAX;
+
+        /* Initialize free lists */
+        if (ret)
+        {
+            for (i = 0u; i < config->max_clients; i++)
+            {
+                (void)mqtt_timer_wheel_timer_init(&mqtt_broker->sessions[i].keepalive_timer, mqtt_broker_session_timeout, &mqtt_broker->sessions[i]);
+                mqtt_broker->sessions[i].next = mqtt_broker->first_free_session;
+                mqtt_broker->first_free_session = &mqtt_broker->sessions[i];
+            }
+            for (i = 0u; i < config->max_topics; i++)
+            {
+                mqtt_broker->topics[i].next = mqtt_broker->first_free_topic;
+                mqtt_broker->first_free_topic = &mqtt_broker->topics[i];
+            }
+            for (i = 0u; i < config->max_subscriptions; i++)
+            {
+                mqtt_broker->subscriptions[i].next = mqtt_broker->first_free_subscription;
+                mqtt_broker->first_free_subscription = &mqtt_broker->subscriptions[i];
+            }
+        }
+
+        /* Epoch 0 marks the free reader slots */
+        mqtt_broker->index_epoch = 1u;
+
+        /* Initialize temp vars for reception */
+        mqtt_broker->protocol_name.str = mqtt_broker->protocol_name_buffer;
+        mqtt_broker->received_credentials.username.str = mqtt_broker->username_buffer;
+        mqtt_broker->received_credentials.password.str = mqtt_broker->password_buffer;
+
         /* MQTT broker ready */
         if (ret)
         {
@@ -86,9 +526,51 @@ bool mqtt_broker_start(mqtt_broker_t* const mqtt_broker, const char* const ip_ad
                 ret = mqtt_socket_listen(&mqtt_broker->listen_socket);
             }
 
+            #ifdef MQTT_SOCKET_IO_URING_ENABLED
+            /* Use io_uring if the kernel supports it, otherwise fall back to the poller */
+            if (ret)
+            {
+                mqtt_broker->uring_enabled = mqtt_socket_uring_init(&mqtt_broker->uring);
+                if (mqtt_broker->uring_enabled)
+                {
+                    mqtt_broker->uring_enabled = mqtt_socket_uring_accept(&mqtt_broker->uring, mqtt_broker->listen_socket);
+                    if (!mqtt_broker->uring_enabled)
+                    {
+                        (void)mqtt_socket_uring_deinit(&mqtt_broker->uring);
+                    }
+                }
+                if (!mqtt_broker->uring_enabled)
+                {
+                    MQTT_LOG_INFO("io_uring not available (error %d), using the socket poller", mqtt_errno_get());
+                }
+            }
+            if (ret && !mqtt_broker->uring_enabled)
+            #else
+            if (ret)
+            #endif /* MQTT_SOCKET_IO_URING_ENABLED */
+            {
+                /* Wait for the listen socket and the sessions sockets with a single poller */
+                ret = mqtt_socket_poller_init(&mqtt_broker->poller);
+                if (ret)
+                {
+                    ret = mqtt_socket_poller_add(&mqtt_broker->poller, &mqtt_broker->listen_socket, MQTT_BROKER_LISTEN_TAG);
+                    if (!ret)
+                    {
+                        (void)mqtt_socket_poller_deinit(&mqtt_broker->poller);
+                    }
+                }
+            }
+
             /* MQTT broker running */
             if (ret)
             {
+                #ifdef MQTT_BROKER_SYS_ENABLED
+                (void)mqtt_time_get_current_64(&mqtt_broker->start_time);
+                if (mqtt_broker->sys_interval != 0u)
+                {
+                    (void)mqtt_timer_wheel_start(&mqtt_broker->timer_wheel, &mqtt_broker->sys_timer, mqtt_broker->sys_interval * 1000u, true);
+                }
+                #endif /* MQTT_BROKER_SYS_ENABLED */
                 mqtt_broker->state = MQTT_BROKER_STATE_RUNNING;
             }
         }
@@ -128,9 +610,35 @@ bool mqtt_broker_stop(mqtt_broker_t* const mqtt_broker)
             ret = mqtt_socket_close(&mqtt_broker->listen_socket);
 
             /* Close the connections with the clients */
-            if (ret)
+            while (mqtt_broker->first_connected_session != NULL)
+            {
+                mqtt_broker->first_connected_session->has_will = false;
+                mqtt_broker_close_session(mqtt_broker, mqtt_broker->first_connected_session);
+            }
+            #ifdef MQTT_BROKER_SYS_ENABLED
+            (void)mqtt_timer_wheel_cancel(&mqtt_broker->timer_wheel, &mqtt_broker->sys_timer);
+            #endif /* MQTT_BROKER_SYS_ENABLED */
+
+            #ifdef MQTT_BROKER_BRIDGE_ENABLED
+            /* Close the connection with the remote broker */
+            if (mqtt_broker->bridge.state != MQTT_BROKER_BRIDGE_STATE_CLOSED)
+            {
+                (void)mqtt_broker_bridge_close(&mqtt_broker->bridge);
+            }
+            #endif /* MQTT_BROKER_BRIDGE_ENABLED */
+
+            #ifdef MQTT_SOCKET_IO_URING_ENABLED
+            /* Release the io_uring instance */
+            if (mqtt_broker->uring_enabled)
             {
-                /* TODO */
+                (void)mqtt_socket_uring_deinit(&mqtt_broker->uring);
+                mqtt_broker->uring_enabled = false;
+            }
+            else
+            #endif /* MQTT_SOCKET_IO_URING_ENABLED */
+            {
+                /* Release the poller */
+                (void)mqtt_socket_poller_deinit(&mqtt_broker->poller);
             }
 
             /* MQTT broker stopped */
@@ -156,76 +664,3877 @@ bool mqtt_broker_stop(mqtt_broker_t* const mqtt_broker)
     return ret;
 }
 
-
-/** \brief Broker periodic task */
-bool mqtt_broker_task(mqtt_broker_t* const mqtt_broker)
+/** \brief Set the socket tuning options */
+bool mqtt_broker_set_socket_options(mqtt_broker_t* const mqtt_broker, const mqtt_socket_options_t* const options)
 {
     bool ret = false;
 
     /* Check params */
-    if (mqtt_broker != NULL)
+    if ((mqtt_broker != NULL) &&
+        (options != NULL))
     {
-
         #ifdef MQTT_MULTITASKING_ENABLED
         (void)mqtt_mutex_lock(&mqtt_broker->mutex);
         #endif /* MQTT_MULTITASKING_ENABLED */
 
-        /* Check current state */
-        switch (mqtt_broker->state)
+        /* Check state */
+        if (mqtt_broker->state == MQTT_BROKER_STATE_STOPPED)
         {
-            case MQTT_BROKER_STATE_STOPPED:
-            {
-                /* Nothing to do */
-                break;
-            }
+            /* Save and apply options, the buffer sizes are inherited by the accepted sockets */
+            (void)memcpy(&mqtt_broker->socket_options, options, sizeof(mqtt_socket_options_t));
+            ret = mqtt_socket_set_options(&mqtt_broker->listen_socket, options);
+        }
+        else
+        {
+            mqtt_errno_set(MQTT_ERR_BROKER_INVALID_STATE);
+        }
 
-            case MQTT_BROKER_STATE_RUNNING:
-            {
-                bool callret;
-                mqtt_socket_t temp_socket;
-                mqtt_socket_t* client_mqtt_socket;
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_unlock(&mqtt_broker->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
 
-                /* Check for new connected clients */
-                if (mqtt_broker->first_connected_session != NULL)
-                {
-                    client_mqtt_socket = mqtt_broker->first_connected_session->socket;
-                }
-                else
-                {
-                    client_mqtt_socket = temp_socket;
-                }
-                callret = mqtt_socket_accept(&mqtt_broker->listen_socket, client_mqtt_socket);
-                if (callret)
-                {
-                    /* New client connected, check if the connection shall be accepted */
-                    if (mqtt_broker->first_connected_session == NULL)
-                    {
-                        /* No more clients allowed, close connection */
-                        (void)mqtt_socket_close(client_mqtt_socket);
-                    }
-                    else
-                    {
-                        /* Initialize session */
-                    }
-                }
+    return ret;
+}
 
+/** \brief Set the polling period */
+bool mqtt_broker_set_poll_period(mqtt_broker_t* const mqtt_broker, const uint32_t ms_poll_period)
+{
+    bool ret = false;
 
-                break;
-            }
+    /* Check params */
+    if (mqtt_broker != NULL)
+    {
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_lock(&mqtt_broker->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
 
-            default:
-            {
-                /* Invalid state */
-                mqtt_errno_set(MQTT_ERR_BROKER_INVALID_STATE);
-                ret = false;
-                break;
-            }
-        }
+        /* Save poll period */
+        mqtt_broker->poll_period = ms_poll_period;
+        ret = true;
 
         #ifdef MQTT_MULTITASKING_ENABLED
         (void)mqtt_mutex_unlock(&mqtt_broker->mutex);
         #endif /* MQTT_MULTITASKING_ENABLED */
     }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
 
     return ret;
 }
+
+/** \brief Attach an in-process link on which a local client can connect without socket */
+bool mqtt_broker_add_local_link(mqtt_broker_t* const mqtt_broker, ring_stream_link_t* const link)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((mqtt_broker != NULL) &&
+        (link != NULL))
+    {
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_lock(&mqtt_broker->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+
+        /* Add to the list of links */
+        link->next = mqtt_broker->first_local_link;
+        mqtt_broker->first_local_link = link;
+        ret = true;
+
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_unlock(&mqtt_broker->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Detach an in-process link */
+bool mqtt_broker_remove_local_link(mqtt_broker_t* const mqtt_broker, ring_stream_link_t* const link)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((mqtt_broker != NULL) &&
+        (link != NULL))
+    {
+        ring_stream_link_t* previous_link = NULL;
+        ring_stream_link_t* current_link;
+        mqtt_broker_session_t* session;
+
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_lock(&mqtt_broker->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+
+        /* Remove from the list of links */
+        current_link = mqtt_broker->first_local_link;
+        while ((current_link != NULL) && (current_link != link))
+        {
+            previous_link = current_link;
+            current_link = current_link->next;
+        }
+        if (current_link != NULL)
+        {
+            if (previous_link == NULL)
+            {
+                mqtt_broker->first_local_link = link->next;
+            }
+            else
+            {
+                previous_link->next = link->next;
+            }
+            link->next = NULL;
+
+            /* Close the connection of the client */
+            session = mqtt_broker->first_connected_session;
+            while ((session != NULL) && (session->local_link != link))
+            {
+                session = session->next;
+            }
+            if (session != NULL)
+            {
+                mqtt_broker_close_session(mqtt_broker, session);
+            }
+            ret = true;
+        }
+        else
+        {
+            mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+        }
+
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_unlock(&mqtt_broker->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+#ifdef MQTT_TRACE_ENABLED
+
+/** \brief Record the connections opened from now on to a trace file */
+bool mqtt_broker_set_trace_recorder(mqtt_broker_t* const mqtt_broker, trace_stream_recorder_t* const recorder)
+{
+    bool ret = false;
+
+    /* Check params */
+    if (mqtt_broker != NULL)
+    {
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_lock(&mqtt_broker->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+
+        /* Save recorder */
+        mqtt_broker->trace_recorder = recorder;
+        ret = true;
+
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_unlock(&mqtt_broker->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+#endif /* MQTT_TRACE_ENABLED */
+
+#ifdef MQTT_BROKER_SYS_ENABLED
+
+/** \brief Set the period in seconds of the publication of the statistics under the $SYS/broker/ topics (0 to disable) */
+bool mqtt_broker_set_sys_interval(mqtt_broker_t* const mqtt_broker, const uint32_t sec_interval)
+{
+    bool ret = false;
+
+    /* Check params */
+    if (mqtt_broker != NULL)
+    {
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_lock(&mqtt_broker->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+
+        /* Save interval and restart the publication if the broker is running */
+        mqtt_broker->sys_interval = sec_interval;
+        if (mqtt_broker->state == MQTT_BROKER_STATE_RUNNING)
+        {
+            (void)mqtt_timer_wheel_cancel(&mqtt_broker->timer_wheel, &mqtt_broker->sys_timer);
+            if (sec_interval != 0u)
+            {
+                (void)mqtt_timer_wheel_start(&mqtt_broker->timer_wheel, &mqtt_broker->sys_timer, sec_interval * 1000u, true);
+            }
+        }
+        ret = true;
+
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_unlock(&mqtt_broker->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Get the statistics of the broker */
+bool mqtt_broker_get_stats(mqtt_broker_t* const mqtt_broker, mqtt_broker_stats_t* const stats)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((mqtt_broker != NULL) &&
+        (stats != NULL))
+    {
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_lock(&mqtt_broker->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+
+        mqtt_broker_collect_stats(mqtt_broker, stats);
+        ret = true;
+
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_unlock(&mqtt_broker->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+#endif /* MQTT_BROKER_SYS_ENABLED */
+
+#ifdef MQTT_BROKER_STORE_ENABLED
+
+/** \brief Open the persistent store of the broker and restore the persistent sessions it holds, must be called before
+           starting the broker and without an opened disk spill (the files are named <path>.snap and <path>.log) */
+bool mqtt_broker_open_store(mqtt_broker_t* const mqtt_broker, const char* const path)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((mqtt_broker != NULL) &&
+        (path != NULL))
+    {
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_lock(&mqtt_broker->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+
+        /* Check state */
+        #ifdef MQTT_BROKER_SPILL_ENABLED
+        /* The spilled messages are not kept after a restart : they can't be part of the stored sessions */
+        if ((mqtt_broker->state == MQTT_BROKER_STATE_STOPPED) &&
+            (mqtt_broker->store.log == NULL) &&
+            (mqtt_broker->first_offline_session == NULL) &&
+            !mqtt_broker->spill.opened)
+        #else
+        if ((mqtt_broker->state == MQTT_BROKER_STATE_STOPPED) &&
+            (mqtt_broker->store.log == NULL) &&
+            (mqtt_broker->first_offline_session == NULL))
+        #endif /* MQTT_BROKER_SPILL_ENABLED */
+        {
+            /* Replay the snapshot and the log */
+            const uint32_t buffer_size = (uint32_t)mqtt_broker->config.max_client_id_length + mqtt_broker->config.max_topic_length + 
+                                         mqtt_broker->config.max_payload_size;
+            ret = mqtt_broker_store_open(&mqtt_broker->store, path, mqtt_broker->store_buffer, buffer_size, 
+                                         mqtt_broker_load_record, mqtt_broker);
+            if (ret)
+            {
+                bool needed = false;
+                MQTT_LOG_INFO("Store '%s' opened (generation %d)", path, mqtt_broker->store.generation);
+
+                /* Compact a long log right away */
+                (void)mqtt_broker_store_needs_snapshot(&mqtt_broker->store, &needed);
+                if (needed)
+                {
+                    (void)mqtt_broker_write_snapshot(mqtt_broker);
+                }
+            }
+        }
+        else
+        {
+            mqtt_errno_set(MQTT_ERR_BROKER_INVALID_STATE);
+        }
+
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_unlock(&mqtt_broker->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Write a last snapshot and close the persistent store, the persistent sessions are kept in memory */
+bool mqtt_broker_close_store(mqtt_broker_t* const mqtt_broker)
+{
+    bool ret = false;
+
+    /* Check params */
+    if (mqtt_broker != NULL)
+    {
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_lock(&mqtt_broker->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+
+        /* Check state */
+        if (mqtt_broker->store.log != NULL)
+        {
+            /* The snapshot makes the log useless for the next opening */
+            (void)mqtt_timer_wheel_cancel(&mqtt_broker->timer_wheel, &mqtt_broker->store_timer);
+            ret = mqtt_broker_write_snapshot(mqtt_broker);
+            ret = mqtt_broker_store_close(&mqtt_broker->store) && ret;
+        }
+        else
+        {
+            mqtt_errno_set(MQTT_ERR_BROKER_INVALID_STATE);
+        }
+
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_unlock(&mqtt_broker->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+#endif /* MQTT_BROKER_STORE_ENABLED */
+
+#ifdef MQTT_BROKER_RETAIN_ENABLED
+
+/** \brief Open the retained store of the broker, its messages are available right away without being loaded
+           (max_messages and heap_size are only used to create a new file) */
+bool mqtt_broker_open_retain_store(mqtt_broker_t* const mqtt_broker, const char* const path, const uint32_t max_messages, const size_t heap_size)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((mqtt_broker != NULL) &&
+        (path != NULL))
+    {
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_lock(&mqtt_broker->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+
+        /* Check state */
+        if ((mqtt_broker->state != MQTT_BROKER_STATE_NOT_INITIALIZED) &&
+            (mqtt_broker->retain.map.data == NULL))
+        {
+            /* Map the file, nothing is read until a client subscribes */
+            ret = mqtt_broker_retain_open(&mqtt_broker->retain, path, max_messages, heap_size);
+            if (ret)
+            {
+                mqtt_broker->retain_dirty = false;
+                MQTT_LOG_INFO("Retained store '%s' opened (%d messages)", path, mqtt_broker->retain.header->count);
+            }
+        }
+        else
+        {
+            mqtt_errno_set(MQTT_ERR_BROKER_INVALID_STATE);
+        }
+
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_unlock(&mqtt_broker->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Sync and close the retained store, the retained messages are not kept anymore */
+bool mqtt_broker_close_retain_store(mqtt_broker_t* const mqtt_broker)
+{
+    bool ret = false;
+
+    /* Check params */
+    if (mqtt_broker != NULL)
+    {
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_lock(&mqtt_broker->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+
+        /* Check state */
+        if (mqtt_broker->retain.map.data != NULL)
+        {
+            (void)mqtt_timer_wheel_cancel(&mqtt_broker->timer_wheel, &mqtt_broker->retain_timer);
+            mqtt_broker->retain_dirty = false;
+            ret = mqtt_broker_retain_close(&mqtt_broker->retain);
+        }
+        else
+        {
+            mqtt_errno_set(MQTT_ERR_BROKER_INVALID_STATE);
+        }
+
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_unlock(&mqtt_broker->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+#endif /* MQTT_BROKER_RETAIN_ENABLED */
+
+#ifdef MQTT_BROKER_SPILL_ENABLED
+
+/** \brief Open the disk spill of the session queues, the messages which don't fit in a queue are written to segment
+           files named <path>.<number> and read back in order when the queue has room (they are not kept after a restart :
+           the segments are deleted when the spill is closed, so the spill can't be opened while the store is opened) */
+bool mqtt_broker_open_spill(mqtt_broker_t* const mqtt_broker, const char* const path)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((mqtt_broker != NULL) &&
+        (path != NULL))
+    {
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_lock(&mqtt_broker->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+
+        /* Check state */
+        #ifdef MQTT_BROKER_STORE_ENABLED
+        /* The spilled messages are not kept after a restart : they can't be part of the stored sessions */
+        if ((mqtt_broker->state != MQTT_BROKER_STATE_NOT_INITIALIZED) &&
+            !mqtt_broker->spill.opened &&
+            (mqtt_broker->store.log == NULL))
+        #else
+        if ((mqtt_broker->state != MQTT_BROKER_STATE_NOT_INITIALIZED) &&
+            !mqtt_broker->spill.opened)
+        #endif /* MQTT_BROKER_STORE_ENABLED */
+        {
+            /* Start the I/O thread */
+            ret = mqtt_broker_spill_open(&mqtt_broker->spill, path);
+            if (ret)
+            {
+                MQTT_LOG_INFO("Spill '%s' opened", path);
+            }
+        }
+        else
+        {
+            mqtt_errno_set(MQTT_ERR_BROKER_INVALID_STATE);
+        }
+
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_unlock(&mqtt_broker->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Close the disk spill, the spilled messages are discarded */
+bool mqtt_broker_close_spill(mqtt_broker_t* const mqtt_broker)
+{
+    bool ret = false;
+
+    /* Check params */
+    if (mqtt_broker != NULL)
+    {
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_lock(&mqtt_broker->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+
+        /* Check state */
+        if (mqtt_broker->spill.opened)
+        {
+            ret = mqtt_broker_spill_close(&mqtt_broker->spill);
+        }
+        else
+        {
+            mqtt_errno_set(MQTT_ERR_BROKER_INVALID_STATE);
+        }
+
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_unlock(&mqtt_broker->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+#endif /* MQTT_BROKER_SPILL_ENABLED */
+
+#ifdef MQTT_BROKER_BRIDGE_ENABLED
+
+/** \brief Add a topic rule to the bridge of the broker, must be called before opening the bridge (the messages are bridged with QoS 1 at most) */
+bool mqtt_broker_add_bridge_rule(mqtt_broker_t* const mqtt_broker, const char* const filter, const mqtt_broker_bridge_direction_t direction,
+                                 const uint8_t qos)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((mqtt_broker != NULL) &&
+        (filter != NULL))
+    {
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_lock(&mqtt_broker->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+
+        /* Check state */
+        if ((mqtt_broker->state != MQTT_BROKER_STATE_NOT_INITIALIZED) &&
+            (mqtt_broker->bridge.state == MQTT_BROKER_BRIDGE_STATE_CLOSED))
+        {
+            ret = mqtt_broker_bridge_add_rule(&mqtt_broker->bridge, filter, direction, qos);
+        }
+        else
+        {
+            mqtt_errno_set(MQTT_ERR_BROKER_INVALID_STATE);
+        }
+
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_unlock(&mqtt_broker->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Open the bridge of a running broker to a remote broker, the messages matching the rules are forwarded in both
+           directions by the broker task which keeps the connection */
+bool mqtt_broker_open_bridge(mqtt_broker_t* const mqtt_broker, const char* const address, const uint16_t port, const char* const client_id)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((mqtt_broker != NULL) &&
+        (address != NULL) &&
+        (client_id != NULL))
+    {
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_lock(&mqtt_broker->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+
+        /* Check state */
+        if ((mqtt_broker->state == MQTT_BROKER_STATE_RUNNING) &&
+            (mqtt_broker->bridge.state == MQTT_BROKER_BRIDGE_STATE_CLOSED))
+        {
+            /* With io_uring, the bridge socket is not polled and is read once per loop */
+            mqtt_socket_poller_t* poller = &mqtt_broker->poller;
+            #ifdef MQTT_SOCKET_IO_URING_ENABLED
+            if (mqtt_broker->uring_enabled)
+            {
+                poller = NULL;
+            }
+            #endif /* MQTT_SOCKET_IO_URING_ENABLED */
+            ret = mqtt_broker_bridge_open(&mqtt_broker->bridge, address, port, client_id, poller, MQTT_BROKER_BRIDGE_TAG);
+            if (ret)
+            {
+                MQTT_LOG_INFO("Bridge to %s:%u opened", address, (unsigned int)port);
+            }
+        }
+        else
+        {
+            mqtt_errno_set(MQTT_ERR_BROKER_INVALID_STATE);
+        }
+
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_unlock(&mqtt_broker->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Close the bridge, the messages not acknowledged by the remote broker are discarded */
+bool mqtt_broker_close_bridge(mqtt_broker_t* const mqtt_broker)
+{
+    bool ret = false;
+
+    /* Check params */
+    if (mqtt_broker != NULL)
+    {
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_lock(&mqtt_broker->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+
+        /* Check state */
+        if (mqtt_broker->bridge.state != MQTT_BROKER_BRIDGE_STATE_CLOSED)
+        {
+            ret = mqtt_broker_bridge_close(&mqtt_broker->bridge);
+        }
+        else
+        {
+            mqtt_errno_set(MQTT_ERR_BROKER_INVALID_STATE);
+        }
+
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_unlock(&mqtt_broker->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+#endif /* MQTT_BROKER_BRIDGE_ENABLED */
+
+/** \brief Check if a topic has subscribers, can be called from any thread without blocking the broker task */
+bool mqtt_broker_has_subscribers(mqtt_broker_t* const mqtt_broker, const char* const topic, bool* const has_subscribers)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((mqtt_broker != NULL) &&
+        (topic != NULL) &&
+        (has_subscribers != NULL))
+    {
+        const size_t topic_length = strlen(topic);
+        if (topic_length <= mqtt_broker->config.max_topic_length)
+        {
+            /* The broker mutex is not taken : the topics and subscriptions reached from
+               the index stay valid until the reader slot is released */
+            mqtt_string_t topic_name;
+            const mqtt_broker_topic_t* topic_filter;
+            const uint32_t slot = mqtt_broker_index_read_lock(mqtt_broker);
+
+            topic_name.str = (char*)topic;
+            topic_name.size = (uint16_t)topic_length;
+            (*has_subscribers) = false;
+            topic_filter = MQTT_BROKER_LOAD_ACQUIRE(&mqtt_broker->first_opened_topic);
+            while ((topic_filter != NULL) && !(*has_subscribers))
+            {
+                if ((MQTT_BROKER_LOAD_ACQUIRE(&topic_filter->subscription) != NULL) &&
+                    mqtt_broker_topic_match(&topic_filter->filter, &topic_name))
+                {
+                    (*has_subscribers) = true;
+                }
+                topic_filter = MQTT_BROKER_LOAD_ACQUIRE(&topic_filter->next);
+            }
+
+            mqtt_broker_index_read_unlock(mqtt_broker, slot);
+            ret = true;
+        }
+        else
+        {
+            mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+        }
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Broker periodic task */
+bool mqtt_broker_task(mqtt_broker_t* const mqtt_broker)
+{
+    bool ret = false;
+
+    /* Check params */
+    if (mqtt_broker != NULL)
+    {
+
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_lock(&mqtt_broker->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+
+        /* Check current state */
+        switch (mqtt_broker->state)
+        {
+            case MQTT_BROKER_STATE_STOPPED:
+            {
+                /* Nothing to do */
+                ret = true;
+                break;
+            }
+
+            case MQTT_BROKER_STATE_RUNNING:
+            {
+                mqtt_broker_session_t* session;
+                bool activity;
+
+                /* Expire the deadlines of the sessions, the clock is read once per loop */
+                (void)mqtt_timer_wheel_advance(&mqtt_broker->timer_wheel);
+
+                #ifdef MQTT_BROKER_SYS_ENABLED
+                /* Publish the statistics periodically */
+                bool publish_sys = false;
+                (void)mqtt_timer_wheel_has_expired(&mqtt_broker->sys_timer, &publish_sys);
+                if (publish_sys)
+                {
+                    mqtt_broker_publish_sys(mqtt_broker);
+                }
+                #endif /* MQTT_BROKER_SYS_ENABLED */
+
+                /* Process the in-process links, the sockets are polled without waiting while links are attached */
+                activity = mqtt_broker_local_process_events(mqtt_broker);
+                if (mqtt_broker->first_local_link != NULL)
+                {
+                    activity = true;
+                }
+
+                #ifdef MQTT_BROKER_SPILL_ENABLED
+                /* Queue the messages read back from the disk, the sockets are polled without waiting while refills are pending */
+                if (mqtt_broker->spill.opened)
+                {
+                    mqtt_broker_refill_queues(mqtt_broker);
+                    if (mqtt_broker->spill.refilling_count != 0u)
+                    {
+                        activity = true;
+                    }
+                }
+                #endif /* MQTT_BROKER_SPILL_ENABLED */
+
+                #ifdef MQTT_SOCKET_IO_URING_ENABLED
+                if (mqtt_broker->uring_enabled)
+                {
+                    /* Process the accepted connections and the received data */
+                    if (mqtt_broker_uring_process_events(mqtt_broker))
+                    {
+                        activity = true;
+                    }
+                }
+                else
+                #endif /* MQTT_SOCKET_IO_URING_ENABLED */
+                {
+                    /* Process the accepted connections and the received packets */
+                    mqtt_broker_poller_process_events(mqtt_broker, (activity ? 0u : mqtt_broker->poll_period));
+                }
+
+                #ifdef MQTT_BROKER_BRIDGE_ENABLED
+                /* Route the messages received from the remote broker */
+                if (mqtt_broker->bridge.state != MQTT_BROKER_BRIDGE_STATE_CLOSED)
+                {
+                    if (mqtt_broker_process_bridge(mqtt_broker))
+                    {
+                        activity = true;
+                    }
+                }
+                #endif /* MQTT_BROKER_BRIDGE_ENABLED */
+
+                /* Send the queued messages and release the closed sessions */
+                session = mqtt_broker->first_connected_session;
+                while (session != NULL)
+                {
+                    mqtt_broker_session_t* const next_session = session->next;
+                    if ((session->state == MQTT_BROKER_SESSION_STATE_MQTT_CONNECTED) && (session->queue.sent != session->queue.count))
+                    {
+                        mqtt_broker_drain_queue(mqtt_broker, session);
+                    }
+                    #ifdef MQTT_BROKER_RETAIN_ENABLED
+                    if ((session->state == MQTT_BROKER_SESSION_STATE_MQTT_CONNECTED) && (session->retained_subscription != NULL))
+                    {
+                        /* The sockets are polled without waiting until the retained messages have been checked */
+                        mqtt_broker_scan_retained(mqtt_broker, session, MQTT_BROKER_RETAIN_SCAN_BATCH);
+                        activity = true;
+                    }
+                    #endif /* MQTT_BROKER_RETAIN_ENABLED */
+                    #ifdef MQTT_BROKER_SPILL_ENABLED
+                    if ((session->state == MQTT_BROKER_SESSION_STATE_MQTT_CONNECTED) && (session->spill->count != 0u) && !session->spill->refilling)
+                    {
+                        /* Read back the spilled messages once the queue is half empty */
+                        const uint32_t room = session->queue.size - session->queue.used;
+                        if ((session->queue.count == 0u) || (room >= (session->queue.size / 2u)))
+                        {
+                            (void)mqtt_broker_spill_refill(&mqtt_broker->spill, session->spill, room);
+                        }
+                    }
+                    #endif /* MQTT_BROKER_SPILL_ENABLED */
+                    if (session->state == MQTT_BROKER_SESSION_STATE_CLOSED)
+                    {
+                        mqtt_broker_close_session(mqtt_broker, session);
+                    }
+                    session = next_session;
+                }
+
+                #ifdef MQTT_BROKER_BRIDGE_ENABLED
+                /* Single write of the packets batched for the remote broker during the loop */
+                if (mqtt_broker->bridge.state != MQTT_BROKER_BRIDGE_STATE_CLOSED)
+                {
+                    mqtt_broker_queue_message_t scratch;
+                    scratch.topic.str = mqtt_broker->topic_buffer;
+                    scratch.topic.size = mqtt_broker->config.max_topic_length;
+                    scratch.payload = mqtt_broker->payload_buffer;
+                    scratch.length = mqtt_broker->config.max_payload_size;
+                    (void)mqtt_broker_bridge_send(&mqtt_broker->bridge, &scratch);
+                }
+                #endif /* MQTT_BROKER_BRIDGE_ENABLED */
+
+                /* Recycle the removed topics and subscriptions once the lock-free readers are done with them */
+                if ((mqtt_broker->first_retired_topic != NULL) || (mqtt_broker->first_retired_subscription != NULL))
+                {
+                    mqtt_broker_reclaim_index(mqtt_broker);
+                }
+
+                #ifdef MQTT_SOCKET_IO_URING_ENABLED
+                if (mqtt_broker->uring_enabled)
+                {
+                    /* Send the queued data and wait for the next events if nothing happened */
+                    #ifdef MQTT_MULTITASKING_ENABLED
+                    (void)mqtt_mutex_unlock(&mqtt_broker->mutex);
+                    #endif /* MQTT_MULTITASKING_ENABLED */
+                    (void)mqtt_socket_uring_submit(&mqtt_broker->uring, (activity ? 0u : mqtt_broker->poll_period));
+                    #ifdef MQTT_MULTITASKING_ENABLED
+                    (void)mqtt_mutex_lock(&mqtt_broker->mutex);
+                    #endif /* MQTT_MULTITASKING_ENABLED */
+                }
+                #endif /* MQTT_SOCKET_IO_URING_ENABLED */
+
+                ret = true;
+                break;
+            }
+
+            default:
+            {
+                /* Invalid state */
+                mqtt_errno_set(MQTT_ERR_BROKER_INVALID_STATE);
+                ret = false;
+                break;
+            }
+        }
+
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_unlock(&mqtt_broker->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+
+
+
+/** \brief Check the limits of a broker configuration */
+static bool mqtt_broker_check_config(const mqtt_broker_config_t* const config)
+{
+    return ((config != NULL) &&
+            (config->max_clients != 0u) &&
+            (config->max_clients < MQTT_BROKER_MAX_CLIENT_LIMIT) &&
+            (config->max_topics != 0u) &&
+            (config->max_subscriptions != 0u) &&
+            (config->max_topic_length != 0u) &&
+            (config->max_payload_size <= MQTT_MAXIMUM_VARIABLE_INTEGER) &&
+            (config->max_client_id_length >= MQTT_BROKER_MIN_CLIENT_ID_LENGTH) &&
+            #ifdef MQTT_BROKER_SPILL_ENABLED
+            ((config->spill_ring_size & (config->spill_ring_size - 1u)) == 0u) &&
+            #endif /* MQTT_BROKER_SPILL_ENABLED */
+            (config->receive_maximum != 0u));
+}
+
+/** \brief Carve the tables and the buffers of a broker from an arena, only the arena is updated if the broker is NULL */
+static bool mqtt_broker_carve(mqtt_broker_t* const mqtt_broker, const mqtt_broker_config_t* const config, mqtt_arena_t* const arena)
+{
+    /* No null-pointer test for the parameters because this function
+       is meant to be called from the inside of the library where the
+       parameters are already checked (the broker can be NULL to compute the arena size) */
+
+    bool ret;
+    const size_t max_packet_size = (size_t)config->max_topic_length + config->max_payload_size + 16u;
+    const size_t alias_topics_size = (size_t)config->max_topic_aliases * config->max_topic_length;
+
+    /* The arena size is computed by replaying the same allocations */
+    mqtt_broker_session_t* const sessions = (mqtt_broker_session_t*)mqtt_arena_alloc(arena, config->max_clients, sizeof(mqtt_broker_session_t));
+    mqtt_broker_topic_t* const topics = (mqtt_broker_topic_t*)mqtt_arena_alloc(arena, config->max_topics, sizeof(mqtt_broker_topic_t));
+    mqtt_broker_subscription_t* const subscriptions = (mqtt_broker_subscription_t*)mqtt_arena_alloc(arena, config->max_subscriptions, 
+                                                                                                     sizeof(mqtt_broker_subscription_t));
+    mqtt_socket_poller_event_t* const poller_events = (mqtt_socket_poller_event_t*)mqtt_arena_alloc(arena, config->max_clients + 2u, 
+                                                                                                     sizeof(mqtt_socket_poller_event_t));
+    mqtt_broker_topic_alias_t* const topic_aliases = (mqtt_broker_topic_alias_t*)mqtt_arena_alloc(arena, config->max_clients, 
+                                                                                                   config->max_topic_aliases * sizeof(mqtt_broker_topic_alias_t));
+    char* const alias_topics = (char*)mqtt_arena_alloc(arena, config->max_clients, alias_topics_size);
+    char* const client_ids = (char*)mqtt_arena_alloc(arena, config->max_clients, config->max_client_id_length);
+    char* const will_topics = (char*)mqtt_arena_alloc(arena, config->max_clients, config->max_will_topic_length);
+    uint8_t* const will_messages = (uint8_t*)mqtt_arena_alloc(arena, config->max_clients, config->max_will_message_size);
+    #ifdef MQTT_SOCKET_IO_URING_ENABLED
+    uint8_t* const packet_buffers = (uint8_t*)mqtt_arena_alloc(arena, config->max_clients, max_packet_size);
+    #else
+    (void)max_packet_size;
+    #endif /* MQTT_SOCKET_IO_URING_ENABLED */
+    char* const topic_names = (char*)mqtt_arena_alloc(arena, config->max_topics, config->max_topic_length);
+    char* const topic_buffer = (char*)mqtt_arena_alloc(arena, 1u, config->max_topic_length);
+    uint8_t* const payload_buffer = (uint8_t*)mqtt_arena_alloc(arena, 1u, config->max_payload_size);
+    uint8_t* const queue_buffers = (uint8_t*)mqtt_arena_alloc(arena, config->max_clients, config->max_queue_size);
+    uint8_t* const local_outputs = (uint8_t*)mqtt_arena_alloc(arena, config->max_clients, config->local_output_size);
+    const uint32_t session_hash_size = mqtt_broker_hash_size(config->max_clients);
+    const uint32_t topic_hash_size = mqtt_broker_hash_size(config->max_topics);
+    mqtt_broker_session_t** const session_hash = (mqtt_broker_session_t**)mqtt_arena_alloc(arena, session_hash_size, sizeof(mqtt_broker_session_t*));
+    mqtt_broker_topic_t** const topic_hash = (mqtt_broker_topic_t**)mqtt_arena_alloc(arena, topic_hash_size, sizeof(mqtt_broker_topic_t*));
+    #ifdef MQTT_BROKER_STORE_ENABLED
+    uint8_t* const store_buffer = (uint8_t*)mqtt_arena_alloc(arena, 1u, (size_t)config->max_client_id_length + config->max_topic_length + 
+                                                                         config->max_payload_size);
+    #endif /* MQTT_BROKER_STORE_ENABLED */
+    #ifdef MQTT_BROKER_SPILL_ENABLED
+    const uint32_t spill_record_size = (uint32_t)config->max_topic_length + config->max_payload_size;
+    mqtt_broker_spill_stream_t* const spill_streams = (mqtt_broker_spill_stream_t*)mqtt_arena_alloc(arena, config->max_clients, 
+                                                                                                     sizeof(mqtt_broker_spill_stream_t));
+    uint8_t* const spill_buffers = (uint8_t*)mqtt_arena_alloc(arena, 1u, mqtt_broker_spill_get_buffers_size(config->spill_ring_size, 
+                                                                                                             spill_record_size));
+    #endif /* MQTT_BROKER_SPILL_ENABLED */
+    #ifdef MQTT_BROKER_BRIDGE_ENABLED
+    uint8_t* const bridge_buffers = (uint8_t*)mqtt_arena_alloc(arena, 1u, mqtt_broker_bridge_get_buffers_size(config->bridge_batch_size, 
+                                                                                                               config->bridge_queue_size,
+                                                                                                               (uint32_t)max_packet_size));
+    #endif /* MQTT_BROKER_BRIDGE_ENABLED */
+
+    ret = !arena->overflow;
+    if (ret && (mqtt_broker != NULL))
+    {
+        uint32_t i;
+        uint16_t j;
+
+        /* The arena is not cleared by the caller */
+        (void)memset(sessions, 0, config->max_clients * sizeof(mqtt_broker_session_t));
+        (void)memset(topics, 0, config->max_topics * sizeof(mqtt_broker_topic_t));
+        (void)memset(subscriptions, 0, config->max_subscriptions * sizeof(mqtt_broker_subscription_t));
+        (void)memset(session_hash, 0, session_hash_size * sizeof(mqtt_broker_session_t*));
+        (void)memset(topic_hash, 0, topic_hash_size * sizeof(mqtt_broker_topic_t*));
+        #ifdef MQTT_BROKER_SPILL_ENABLED
+        ret = mqtt_broker_spill_init(&mqtt_broker->spill, spill_streams, config->max_clients, spill_buffers, config->spill_ring_size, 
+                                     spill_record_size);
+        #endif /* MQTT_BROKER_SPILL_ENABLED */
+        #ifdef MQTT_BROKER_BRIDGE_ENABLED
+        if (ret)
+        {
+            ret = mqtt_broker_bridge_init(&mqtt_broker->bridge, &mqtt_broker->timer_wheel, bridge_buffers, config->bridge_batch_size, 
+                                          config->bridge_queue_size, (uint32_t)max_packet_size);
+        }
+        #endif /* MQTT_BROKER_BRIDGE_ENABLED */
+
+        /* Dispatch the buffers */
+        for (i = 0u; i < config->max_clients; i++)
+        {
+            mqtt_broker_session_t* const session = &sessions[i];
+            session->client_id_topic_buffer = &client_ids[(size_t)i * config->max_client_id_length];
+            session->will_topic_buffer = &will_topics[(size_t)i * config->max_will_topic_length];
+            session->will_message_buffer = &will_messages[(size_t)i * config->max_will_message_size];
+            session->topic_aliases = &topic_aliases[(size_t)i * config->max_topic_aliases];
+            for (j = 0u; j < config->max_topic_aliases; j++)
+            {
+                session->topic_aliases[j].topic = &alias_topics[((size_t)i * alias_topics_size) + ((size_t)j * config->max_topic_length)];
+            }
+            #ifdef MQTT_SOCKET_IO_URING_ENABLED
+            session->packet_buffer = &packet_buffers[(size_t)i * max_packet_size];
+            #endif /* MQTT_SOCKET_IO_URING_ENABLED */
+            (void)mqtt_broker_queue_init(&session->queue, ((config->max_queue_size != 0u) ? &queue_buffers[(size_t)i * config->max_queue_size] : NULL), 
+                                         config->max_queue_size);
+            session->local_output = ((config->local_output_size != 0u) ? &local_outputs[(size_t)i * config->local_output_size] : NULL);
+            #ifdef MQTT_BROKER_SPILL_ENABLED
+            session->spill = &spill_streams[i];
+            spill_streams[i].owner = session;
+            #endif /* MQTT_BROKER_SPILL_ENABLED */
+        }
+        for (i = 0u; i < config->max_topics; i++)
+        {
+            topics[i].topic_buffer = &topic_names[(size_t)i * config->max_topic_length];
+        }
+        mqtt_broker->sessions = sessions;
+        mqtt_broker->topics = topics;
+        mqtt_broker->subscriptions = subscriptions;
+        mqtt_broker->poller_events = poller_events;
+        mqtt_broker->topic_buffer = topic_buffer;
+        mqtt_broker->payload_buffer = payload_buffer;
+        mqtt_broker->session_hash = session_hash;
+        mqtt_broker->session_hash_mask = session_hash_size - 1u;
+        mqtt_broker->topic_hash = topic_hash;
+        mqtt_broker->topic_hash_mask = topic_hash_size - 1u;
+        #ifdef MQTT_BROKER_STORE_ENABLED
+        mqtt_broker->store_buffer = store_buffer;
+        #endif /* MQTT_BROKER_STORE_ENABLED */
+    }
+
+    return ret;
+}
+
+/** \brief Accept the incoming connections */
+static void mqtt_broker_accept(mqtt_broker_t* const mqtt_broker)
+{
+    mqtt_socket_t client_socket;
+
+    if (mqtt_socket_accept(&mqtt_broker->listen_socket, &client_socket))
+    {
+        /* New client connected */
+        mqtt_broker_open_session(mqtt_broker, client_socket);
+    }
+}
+
+/** \brief Open a session for an accepted connection */
+static void mqtt_broker_open_session(mqtt_broker_t* const mqtt_broker, const mqtt_socket_t client_socket)
+{
+    mqtt_broker_session_t* const session = mqtt_broker_new_session(mqtt_broker);
+
+    /* Check if the connection shall be accepted */
+    if (session == NULL)
+    {
+        /* No more clients allowed, close connection */
+        mqtt_socket_t temp_socket = client_socket;
+        (void)mqtt_socket_close(&temp_socket);
+    }
+    else
+    {
+        /* Initialize the transport */
+        session->socket = client_socket;
+        (void)mqtt_socket_set_options(&session->socket, &mqtt_broker->socket_options);
+        #ifdef MQTT_SOCKET_IO_URING_ENABLED
+        if (mqtt_broker->uring_enabled)
+        {
+            /* The tag identifies the session and its connection in the io_uring events */
+            const uint32_t index = (uint32_t)(session - mqtt_broker->sessions);
+            session->generation++;
+            (void)mqtt_socket_uring_endpoint_init(&mqtt_broker->uring, &session->endpoint, session->socket,
+                                                  index | (((uint32_t)session->generation) << 24u));
+            (void)uring_stream_output_from_endpoint(&session->outstream, &session->endpoint);
+            (void)buffer_stream_output_from_buffer(&session->packet_stream, session->packet_buffer, mqtt_broker->max_packet_size);
+            (void)mqtt_packet_deserialize_init_whole_packet(&session->whole_data);
+            #ifdef MQTT_TRACE_ENABLED
+            mqtt_broker_trace_session(mqtt_broker, session, false);
+            #endif /* MQTT_TRACE_ENABLED */
+            if (!mqtt_socket_uring_receive(&session->endpoint))
+            {
+                session->state = MQTT_BROKER_SESSION_STATE_CLOSED;
+            }
+        }
+        else
+        #endif /* MQTT_SOCKET_IO_URING_ENABLED */
+        {
+            (void)socket_stream_output_from_socket(&session->outstream, &session->socket);
+            (void)socket_stream_input_from_socket(&session->instream, &session->socket);
+            #ifdef MQTT_TRACE_ENABLED
+            mqtt_broker_trace_session(mqtt_broker, session, true);
+            #endif /* MQTT_TRACE_ENABLED */
+            if (!mqtt_socket_poller_add(&mqtt_broker->poller, &session->socket, (uint32_t)(session - mqtt_broker->sessions)))
+            {
+                session->state = MQTT_BROKER_SESSION_STATE_CLOSED;
+            }
+        }
+    }
+}
+
+/** \brief Allocate and initialize a session for a new connection */
+static mqtt_broker_session_t* mqtt_broker_new_session(mqtt_broker_t* const mqtt_broker)
+{
+    mqtt_broker_session_t* session;
+
+    /* The connected clients have priority over the disconnected ones */
+    if ((mqtt_broker->first_free_session == NULL) && (mqtt_broker->first_offline_session != NULL))
+    {
+        mqtt_broker_evict_session(mqtt_broker);
+    }
+
+    /* Check if the connection shall be accepted */
+    session = mqtt_broker->first_free_session;
+    if (session == NULL)
+    {
+        MQTT_LOG_ERROR("Connection refused : too many clients (%d)", mqtt_broker->config.max_clients);
+    }
+    else
+    {
+        uint32_t i;
+
+        /* Initialize session */
+        mqtt_broker->first_free_session = session->next;
+        session->state = MQTT_BROKER_SESSION_STATE_TCP_CONNECTED;
+        session->local_link = NULL;
+        #ifdef MQTT_TRACE_ENABLED
+        session->trace.recorder = NULL;
+        #endif /* MQTT_TRACE_ENABLED */
+        session->client_id.str = session->client_id_topic_buffer;
+        session->client_id.size = 0u;
+        session->will.topic.str = session->will_topic_buffer;
+        session->will.message.str = (char*)session->will_message_buffer;
+        session->has_will = false;
+        session->keepalive = 0u;
+        #ifdef MQTT_BROKER_SYS_ENABLED
+        (void)memset(&session->stats, 0, sizeof(mqtt_broker_session_stats_t));
+        #endif /* MQTT_BROKER_SYS_ENABLED */
+        session->protocol_level = MQTT_PROTOCOL_LEVEL_V311;
+        session->packet_id = 1u;
+        session->inflight_count = 0u;
+        session->receive_maximum = UINT16_MAX;
+        session->maximum_packet_size = MQTT_MAXIMUM_PACKET_SIZE;
+        session->persistent = false;
+        session->session_expiry_interval = 0u;
+        session->first_subscription = NULL;
+        #ifdef MQTT_BROKER_RETAIN_ENABLED
+        session->retained_subscription = NULL;
+        #endif /* MQTT_BROKER_RETAIN_ENABLED */
+        session->next_hash = NULL;
+        mqtt_broker_clear_queue(mqtt_broker, session);
+        for (i = 0u; i < mqtt_broker->config.max_topic_aliases; i++)
+        {
+            session->topic_aliases[i].length = 0u;
+        }
+
+        /* The client must send its CONNECT packet in time */
+        (void)mqtt_timer_wheel_start(&mqtt_broker->timer_wheel, &session->keepalive_timer, MQTT_BROKER_CONNECT_TIMEOUT, false);
+
+        /* Add to the connected sessions */
+        session->next = mqtt_broker->first_connected_session;
+        mqtt_broker->first_connected_session = session;
+    }
+
+    return session;
+}
+
+#ifdef MQTT_TRACE_ENABLED
+
+/** \brief Start the trace of a new connection if the connections are recorded, its transport streams must be initialized */
+static void mqtt_broker_trace_session(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session, const bool trace_input)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    /* The transport streams are moved behind the traced streams, the io_uring transport
+       has no input stream and records the received data itself */
+    if ((mqtt_broker->trace_recorder != NULL) &&
+        trace_stream_open(&session->trace, mqtt_broker->trace_recorder))
+    {
+        session->traced_outstream = session->outstream;
+        (void)trace_stream_output_from_stream(&session->outstream, &session->trace, &session->traced_outstream);
+        if (trace_input)
+        {
+            session->traced_instream = session->instream;
+            (void)trace_stream_input_from_stream(&session->instream, &session->trace, &session->traced_instream);
+        }
+    }
+}
+
+#endif /* MQTT_TRACE_ENABLED */
+
+/** \brief Process the packets received on a session */
+static void mqtt_broker_process_session(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session)
+{
+    bool callret;
+    uint8_t packet_flags;
+    uint32_t packet_length;
+    mqtt_control_packet_type_t packet_type;
+
+    callret = mqtt_packet_deserialize_packet_header(&session->instream, &packet_type, &packet_flags, &packet_length);
+    if (callret)
+    {
+        mqtt_broker_process_packet(mqtt_broker, session, packet_type, packet_flags, packet_length);
+    }
+    else
+    {
+        /* Close the session */
+        session->state = MQTT_BROKER_SESSION_STATE_CLOSED;
+    }
+}
+
+/** \brief Process a packet received on a session once its header has been read */
+static void mqtt_broker_process_packet(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session,
+                                       const mqtt_control_packet_type_t packet_type, const uint8_t packet_flags, const uint32_t packet_length)
+{
+    bool callret = true;
+
+    MQTT_LOG_DEBUG("Packet %d received (%u bytes)", (int)packet_type, (unsigned int)packet_length);
+    #ifdef MQTT_BROKER_SYS_ENABLED
+    session->stats.bytes_received += 1u + mqtt_packet_variable_integer_size(packet_length) + packet_length;
+    #endif /* MQTT_BROKER_SYS_ENABLED */
+
+    if (session->state == MQTT_BROKER_SESSION_STATE_TCP_CONNECTED)
+    {
+        /* First packet must be a CONNECT packet */
+        if (packet_type == MQTT_PKT_CONNECT)
+        {
+            callret = mqtt_broker_process_connect(mqtt_broker, session, packet_length);
+        }
+        else
+        {
+            callret = false;
+        }
+    }
+    else
+    {
+        switch (packet_type)
+        {
+            case MQTT_PKT_PUBLISH:
+            {
+                callret = mqtt_broker_process_publish(mqtt_broker, session, packet_flags, packet_length);
+                break;
+            }
+
+            case MQTT_PKT_PUBACK:
+                /* Fall throught */
+            case MQTT_PKT_PUBCOMP:
+            {
+                uint16_t packet_id;
+                callret = mqtt_packet_deserialize_puback(&session->instream, packet_length, &packet_id);
+                if (callret)
+                {
+                    /* The queued messages are only removed once they have been acknowledged */
+                    uint32_t removed = 0u;
+                    if (session->inflight_count != 0u)
+                    {
+                        session->inflight_count--;
+                    }
+                    (void)mqtt_broker_queue_acknowledge(&session->queue, packet_id, &removed);
+                    #ifdef MQTT_BROKER_STORE_ENABLED
+                    while (removed != 0u)
+                    {
+                        mqtt_broker_log_change(mqtt_broker, session, MQTT_BROKER_STORE_RECORD_DEQUEUE, NULL, NULL, 0u, 0u);
+                        removed--;
+                    }
+                    #endif /* MQTT_BROKER_STORE_ENABLED */
+                }
+                break;
+            }
+
+            case MQTT_PKT_PUBREC:
+            {
+                uint16_t packet_id;
+                callret = mqtt_packet_deserialize_pubrec(&session->instream, packet_length, &packet_id);
+                if (callret)
+                {
+                    callret = mqtt_packet_serialize_pubrel(&session->outstream, packet_id);
+                }
+                break;
+            }
+
+            case MQTT_PKT_PUBREL:
+            {
+                uint16_t packet_id;
+                callret = mqtt_packet_deserialize_pubrel(&session->instream, packet_length, &packet_id);
+                if (callret)
+                {
+                    callret = mqtt_packet_serialize_pubcomp(&session->outstream, packet_id);
+                }
+                break;
+            }
+
+            case MQTT_PKT_SUBSCRIBE:
+            {
+                callret = mqtt_broker_process_subscribe(mqtt_broker, session, packet_length);
+                break;
+            }
+
+            case MQTT_PKT_UNSUBSCRIBE:
+            {
+                callret = mqtt_broker_process_unsubscribe(mqtt_broker, session, packet_length);
+                break;
+            }
+
+            case MQTT_PKT_PINGREQ:
+            {
+                callret = mqtt_packet_deserialize_pingreq(&session->instream, packet_length);
+                if (callret)
+                {
+                    callret = mqtt_packet_serialize_pingresp(&session->outstream);
+                }
+                break;
+            }
+
+            case MQTT_PKT_DISCONNECT:
+            {
+                /* Normal disconnection : no will message */
+                (void)mqtt_packet_deserialize_disconnect(&session->instream, packet_length);
+                session->has_will = false;
+                callret = false;
+                break;
+            }
+
+            default:
+            {
+                /* Invalid packet */
+                mqtt_errno_set(MQTT_ERR_INVALID_PACKET_TYPE);
+                callret = false;
+                break;
+            }
+        }
+    }
+
+    if (callret)
+    {
+        /* Any packet resets the keepalive timer */
+        (void)mqtt_timer_wheel_reset(&mqtt_broker->timer_wheel, &session->keepalive_timer);
+    }
+    else
+    {
+        /* Close the session */
+        session->state = MQTT_BROKER_SESSION_STATE_CLOSED;
+    }
+}
+
+/** \brief Process a CONNECT packet */
+static bool mqtt_broker_process_connect(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session, const uint32_t packet_length)
+{
+    bool ret;
+    bool clean_session;
+    bool persistent = false;
+    bool session_present = false;
+    uint8_t protocol_level = 0u;
+    uint32_t session_expiry_interval = MQTT_BROKER_SESSION_NEVER_EXPIRES;
+    mqtt_properties_t properties;
+    mqtt_connack_retcode_t retcode = MQTT_CONNACK_RET_ACCEPTED;
+
+    /* Deserialize packet */
+    (void)packet_length;
+    mqtt_broker->protocol_name.size = sizeof(mqtt_broker->protocol_name_buffer);
+    mqtt_broker->received_credentials.username.size = sizeof(mqtt_broker->username_buffer);
+    mqtt_broker->received_credentials.password.size = sizeof(mqtt_broker->password_buffer);
+    session->client_id.size = mqtt_broker->config.max_client_id_length;
+    session->will.topic.size = mqtt_broker->config.max_will_topic_length;
+    session->will.message.size = mqtt_broker->config.max_will_message_size;
+    ret = mqtt_packet_deserialize_connect(&session->instream, &session->client_id, &mqtt_broker->protocol_name, &protocol_level,
+                                          &mqtt_broker->received_credentials, &session->will, &clean_session, &session->keepalive,
+                                          &properties);
+    if (ret)
+    {
+        /* Check protocol */
+        if ((mqtt_broker->protocol_name.size != 4u) || 
+            (memcmp(mqtt_broker->protocol_name.str, "MQTT", 4u) != 0) ||
+            ((protocol_level != MQTT_PROTOCOL_LEVEL_V311) && (protocol_level != MQTT_PROTOCOL_LEVEL_V5)))
+        {
+            retcode = MQTT_CONNACK_RET_REFUSED_PROTOCOL;
+            protocol_level = MQTT_PROTOCOL_LEVEL_V311;
+        }
+        session->protocol_level = protocol_level;
+
+        /* Check credentials */
+        if ((retcode == MQTT_CONNACK_RET_ACCEPTED) && (mqtt_broker->credentials.username.str != NULL))
+        {
+            const mqtt_credentials_t* const credentials = &mqtt_broker->received_credentials;
+            if ((credentials->username.size != mqtt_broker->credentials.username.size) ||
+                (memcmp(credentials->username.str, mqtt_broker->credentials.username.str, credentials->username.size) != 0) ||
+                (credentials->password.size != mqtt_broker->credentials.password.size) ||
+                (memcmp(credentials->password.str, mqtt_broker->credentials.password.str, credentials->password.size) != 0))
+            {
+                retcode = MQTT_CONNACK_RET_REFUSED_BAD_CREDENTIALS;
+            }
+        }
+
+        /* A session can only be kept for an identified client, with MQTT 5.0 the session
+           is only kept after the disconnection if it has an expiry interval, even with a clean start */
+        if ((retcode == MQTT_CONNACK_RET_ACCEPTED) && !clean_session && (session->client_id.size == 0u))
+        {
+            retcode = MQTT_CONNACK_RET_REFUSED_CLIENT_ID;
+        }
+        if (protocol_level == MQTT_PROTOCOL_LEVEL_V5)
+        {
+            session_expiry_interval = (((properties.present & MQTT_PROP_FLAG_SESSION_EXPIRY_INTERVAL) != 0u) ? 
+                                       properties.session_expiry_interval : 0u);
+            persistent = ((session_expiry_interval != 0u) && (session->client_id.size != 0u));
+        }
+        else
+        {
+            persistent = !clean_session;
+        }
+
+        /* Client limits */
+        if (protocol_level == MQTT_PROTOCOL_LEVEL_V5)
+        {
+            if (((properties.present & MQTT_PROP_FLAG_RECEIVE_MAXIMUM) != 0u) && (properties.receive_maximum != 0u))
+            {
+                session->receive_maximum = properties.receive_maximum;
+            }
+            if (((properties.present & MQTT_PROP_FLAG_MAXIMUM_PACKET_SIZE) != 0u) && (properties.maximum_packet_size != 0u))
+            {
+                session->maximum_packet_size = properties.maximum_packet_size;
+            }
+        }
+
+        /* Broker limits */
+        properties.present = (MQTT_PROP_FLAG_RECEIVE_MAXIMUM | MQTT_PROP_FLAG_MAXIMUM_PACKET_SIZE | MQTT_PROP_FLAG_TOPIC_ALIAS_MAXIMUM |
+                              MQTT_PROP_FLAG_RETAIN_AVAILABLE | MQTT_PROP_FLAG_WILDCARD_SUBSCRIPTION_AVAILABLE | 
+                              MQTT_PROP_FLAG_SUBSCRIPTION_IDENTIFIER_AVAILABLE | MQTT_PROP_FLAG_SHARED_SUBSCRIPTION_AVAILABLE);
+        properties.receive_maximum = mqtt_broker->config.receive_maximum;
+        properties.maximum_packet_size = mqtt_broker->max_packet_size;
+        properties.topic_alias_maximum = mqtt_broker->config.max_topic_aliases;
+        properties.retain_available = 0u;
+        #ifdef MQTT_BROKER_RETAIN_ENABLED
+        properties.retain_available = ((mqtt_broker->retain.map.data != NULL) ? 1u : 0u);
+        #endif /* MQTT_BROKER_RETAIN_ENABLED */
+        properties.wildcard_subscription_available = 1u;
+        properties.subscription_identifier_available = 0u;
+        properties.shared_subscription_available = 1u;
+        if (persistent && (session_expiry_interval > mqtt_broker->config.max_session_expiry))
+        {
+            session_expiry_interval = mqtt_broker->config.max_session_expiry;
+            properties.present |= MQTT_PROP_FLAG_SESSION_EXPIRY_INTERVAL;
+            properties.session_expiry_interval = session_expiry_interval;
+        }
+        #if (MQTT_CFG_MAX_QOS_LEVEL < 2u)
+        properties.present |= MQTT_PROP_FLAG_MAXIMUM_QOS;
+        properties.maximum_qos = MQTT_CFG_MAX_QOS_LEVEL;
+        #endif /* (MQTT_CFG_MAX_QOS_LEVEL < 2u) */
+
+        /* Resume or replace the existing session of the client */
+        if (retcode == MQTT_CONNACK_RET_ACCEPTED)
+        {
+            session->session_expiry_interval = (persistent ? session_expiry_interval : 0u);
+            session_present = mqtt_broker_take_over_session(mqtt_broker, session, !clean_session, persistent);
+        }
+
+        /* Send CONNACK packet */
+        ret = mqtt_packet_serialize_connack(&session->outstream, session_present, retcode, 
+                                            ((protocol_level == MQTT_PROTOCOL_LEVEL_V5) ? &properties : NULL));
+        if (ret && (retcode == MQTT_CONNACK_RET_ACCEPTED))
+        {
+            session->state = MQTT_BROKER_SESSION_STATE_MQTT_CONNECTED;
+            session->has_will = (session->will.topic.size != 0u);
+            #ifdef MQTT_BROKER_SYS_ENABLED
+            session->stats.connected = true;
+            mqtt_broker->clients_connected++;
+            if (mqtt_broker->clients_connected > mqtt_broker->clients_maximum)
+            {
+                mqtt_broker->clients_maximum = mqtt_broker->clients_connected;
+            }
+            #endif /* MQTT_BROKER_SYS_ENABLED */
+            if (session->keepalive != 0u)
+            {
+                (void)mqtt_timer_wheel_start(&mqtt_broker->timer_wheel, &session->keepalive_timer, (session->keepalive * 1500u), false);
+            }
+            else
+            {
+                (void)mqtt_timer_wheel_cancel(&mqtt_broker->timer_wheel, &session->keepalive_timer);
+            }
+            MQTT_LOG_INFO("Client '%.*s' connected (protocol level %d, session present %d)", session->client_id.size, session->client_id.str, 
+                          protocol_level, session_present);
+        }
+        else
+        {
+            ret = false;
+        }
+    }
+
+    return ret;
+}
+
+/** \brief Process a PUBLISH packet */
+static bool mqtt_broker_process_publish(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session, 
+                                        const uint8_t packet_flags, const uint32_t packet_length)
+{
+    bool ret;
+    uint32_t length = mqtt_broker->config.max_payload_size;
+    uint8_t qos;
+    bool retain;
+    bool duplicate;
+    uint16_t packet_id;
+    mqtt_properties_t properties;
+    mqtt_properties_t* const publish_properties = mqtt_broker_get_properties(session, &properties);
+
+    /* Deserialize packet */
+    mqtt_broker->topic.str = mqtt_broker->topic_buffer;
+    mqtt_broker->topic.size = mqtt_broker->config.max_topic_length;
+    ret = mqtt_packet_deserialize_publish(&session->instream, packet_flags, packet_length, &mqtt_broker->topic, mqtt_broker->payload_buffer,
+                                          &length, &qos, &retain, &duplicate, &packet_id, publish_properties);
+    if (ret && (publish_properties != NULL))
+    {
+        ret = mqtt_broker_resolve_topic_alias(mqtt_broker, session, publish_properties);
+    }
+    if (ret && (mqtt_broker->topic.size == 0u))
+    {
+        /* No topic */
+        mqtt_errno_set(MQTT_ERR_INVALID_PACKET_PAYLOAD);
+        ret = false;
+    }
+    if (ret)
+    {
+        #ifdef MQTT_BROKER_SYS_ENABLED
+        session->stats.publish_received++;
+        #endif /* MQTT_BROKER_SYS_ENABLED */
+
+        /* Acknowledge */
+        if (qos == 1u)
+        {
+            ret = mqtt_packet_serialize_puback(&session->outstream, packet_id);
+        }
+        else if (qos == 2u)
+        {
+            ret = mqtt_packet_serialize_pubrec(&session->outstream, packet_id);
+        }
+        else
+        {
+            /* No acknowledgement */
+        }
+
+        /* Keep the retained message for the future subscribers */
+        #ifdef MQTT_BROKER_RETAIN_ENABLED
+        if (retain)
+        {
+            mqtt_broker_retain_message(mqtt_broker, &mqtt_broker->topic, mqtt_broker->payload_buffer, length, qos);
+        }
+        #endif /* MQTT_BROKER_RETAIN_ENABLED */
+
+        /* Route to the subscribers */
+        mqtt_broker_route(mqtt_broker, session, &mqtt_broker->topic, mqtt_broker->payload_buffer, length, qos);
+        #ifdef MQTT_BROKER_BRIDGE_ENABLED
+        mqtt_broker_bridge_message(mqtt_broker, &mqtt_broker->topic, mqtt_broker->payload_buffer, length, qos);
+        #endif /* MQTT_BROKER_BRIDGE_ENABLED */
+    }
+
+    return ret;
+}
+
+/** \brief Process a SUBSCRIBE packet */
+static bool mqtt_broker_process_subscribe(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session, const uint32_t packet_length)
+{
+    bool ret;
+    uint8_t qos;
+    uint8_t options = 0u;
+    uint16_t packet_id;
+    mqtt_properties_t properties;
+    mqtt_string_t filter;
+    bool shared = false;
+
+    /* Deserialize packet */
+    mqtt_broker->topic.str = mqtt_broker->topic_buffer;
+    mqtt_broker->topic.size = mqtt_broker->config.max_topic_length;
+    ret = mqtt_packet_deserialize_subscribe(&session->instream, packet_length, &mqtt_broker->topic, &qos, &options, &packet_id, 
+                                            mqtt_broker_get_properties(session, &properties));
+    if (ret)
+    {
+        /* The No Local option is a protocol error on a shared subscription */
+        (void)mqtt_broker_get_filter(&mqtt_broker->topic, &filter, &shared);
+        if (shared && ((options & MQTT_SUBSCRIBE_OPTION_NO_LOCAL) != 0u))
+        {
+            mqtt_errno_set(MQTT_ERR_INVALID_PACKET_PAYLOAD);
+            ret = false;
+        }
+    }
+    if (ret)
+    {
+        /* Add subscription, only the No Local option is supported */
+        const uint8_t granted_qos = mqtt_broker_add_subscription(mqtt_broker, session, &mqtt_broker->topic, qos, options, true);
+        #ifdef MQTT_BROKER_STORE_ENABLED
+        if (granted_qos != MQTT_FAILURE_QOS)
+        {
+            mqtt_broker_log_change(mqtt_broker, session, MQTT_BROKER_STORE_RECORD_SUBSCRIBE, &mqtt_broker->topic, NULL, 0u, 
+                                   granted_qos | (options & MQTT_SUBSCRIBE_OPTION_NO_LOCAL));
+        }
+        #endif /* MQTT_BROKER_STORE_ENABLED */
+
+        /* Send SUBACK packet */
+        ret = mqtt_packet_serialize_suback(&session->outstream, granted_qos, packet_id, mqtt_broker_get_properties(session, &properties));
+
+        /* Then the matching retained messages, they are not sent for a shared subscription */
+        #ifdef MQTT_BROKER_RETAIN_ENABLED
+        if (ret && (granted_qos != MQTT_FAILURE_QOS) && !shared)
+        {
+            mqtt_broker_send_retained(mqtt_broker, session, &mqtt_broker->topic, granted_qos);
+        }
+        #endif /* MQTT_BROKER_RETAIN_ENABLED */
+    }
+
+    return ret;
+}
+
+/** \brief Process an UNSUBSCRIBE packet */
+static bool mqtt_broker_process_unsubscribe(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session, const uint32_t packet_length)
+{
+    bool ret;
+    uint16_t packet_id;
+    mqtt_properties_t properties;
+
+    /* Deserialize packet */
+    mqtt_broker->topic.str = mqtt_broker->topic_buffer;
+    mqtt_broker->topic.size = mqtt_broker->config.max_topic_length;
+    ret = mqtt_packet_deserialize_unsubscribe(&session->instream, packet_length, &mqtt_broker->topic, &packet_id, 
+                                              mqtt_broker_get_properties(session, &properties));
+    if (ret)
+    {
+        /* Remove subscription */
+        uint8_t reason_code = MQTT_REASON_SUCCESS;
+        if (!mqtt_broker_remove_subscription(mqtt_broker, session, &mqtt_broker->topic))
+        {
+            reason_code = MQTT_REASON_NO_SUBSCRIPTION_EXISTED;
+        }
+        #ifdef MQTT_BROKER_STORE_ENABLED
+        else
+        {
+            mqtt_broker_log_change(mqtt_broker, session, MQTT_BROKER_STORE_RECORD_UNSUBSCRIBE, &mqtt_broker->topic, NULL, 0u, 0u);
+        }
+        #endif /* MQTT_BROKER_STORE_ENABLED */
+
+        /* Send UNSUBACK packet */
+        ret = mqtt_packet_serialize_unsuback(&session->outstream, packet_id, reason_code, mqtt_broker_get_properties(session, &properties));
+    }
+
+    return ret;
+}
+
+/** \brief Resolve the topic alias of a received PUBLISH packet */
+static bool mqtt_broker_resolve_topic_alias(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session, 
+                                            const mqtt_properties_t* const properties)
+{
+    bool ret = true;
+
+    if ((properties->present & MQTT_PROP_FLAG_TOPIC_ALIAS) != 0u)
+    {
+        const uint16_t alias = properties->topic_alias;
+        if ((alias != 0u) && (alias <= mqtt_broker->config.max_topic_aliases))
+        {
+            mqtt_broker_topic_alias_t* const topic_alias = &session->topic_aliases[alias - 1u];
+            if (mqtt_broker->topic.size != 0u)
+            {
+                /* New alias, the slots are sized for the longest topic accepted */
+                (void)memcpy(topic_alias->topic, mqtt_broker->topic.str, mqtt_broker->topic.size);
+                topic_alias->length = mqtt_broker->topic.size;
+            }
+            else if (topic_alias->length != 0u)
+            {
+                /* Known alias */
+                (void)memcpy(mqtt_broker->topic.str, topic_alias->topic, topic_alias->length);
+                mqtt_broker->topic.size = topic_alias->length;
+            }
+            else
+            {
+                ret = false;
+            }
+        }
+        else
+        {
+            ret = false;
+        }
+        if (!ret)
+        {
+            mqtt_errno_set(MQTT_ERR_INVALID_PROPERTY);
+        }
+    }
+
+    return ret;
+}
+
+/** \brief Take over the existing session of the client id of a new connection, returns true if its state has been resumed */
+static bool mqtt_broker_take_over_session(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session, 
+                                          const bool resume, const bool persistent)
+{
+    bool session_present = false;
+    mqtt_broker_session_t* const existing = ((session->client_id.size != 0u) ? 
+                                             mqtt_broker_find_session(mqtt_broker, session->client_id.str, session->client_id.size) : NULL);
+
+    if (existing != NULL)
+    {
+        /* Only one connection per client id : the existing connection is closed by the task */
+        if (existing->state != MQTT_BROKER_SESSION_STATE_OFFLINE)
+        {
+            MQTT_LOG_INFO("Client '%.*s' taken over by a new connection", existing->client_id.size, existing->client_id.str);
+            existing->state = MQTT_BROKER_SESSION_STATE_CLOSED;
+        }
+        if (resume && existing->persistent)
+        {
+            /* Move the subscriptions and the queued messages to the new connection */
+            mqtt_broker_subscription_t* subscription = existing->first_subscription;
+            const mqtt_broker_queue_t queue = session->queue;
+            #ifdef MQTT_BROKER_SPILL_ENABLED
+            mqtt_broker_spill_stream_t* const spill = session->spill;
+            #endif /* MQTT_BROKER_SPILL_ENABLED */
+            while (subscription != NULL)
+            {
+                subscription->session = session;
+                subscription = subscription->next_session;
+            }
+            session->first_subscription = existing->first_subscription;
+            existing->first_subscription = NULL;
+            #ifdef MQTT_BROKER_RETAIN_ENABLED
+            existing->retained_subscription = NULL;
+            #endif /* MQTT_BROKER_RETAIN_ENABLED */
+            session->queue = existing->queue;
+            existing->queue = queue;
+            (void)mqtt_broker_queue_rewind(&session->queue);
+            session->packet_id = existing->packet_id;
+            #ifdef MQTT_BROKER_SPILL_ENABLED
+            session->spill = existing->spill;
+            session->spill->owner = session;
+            existing->spill = spill;
+            existing->spill->owner = existing;
+            #endif /* MQTT_BROKER_SPILL_ENABLED */
+            session_present = true;
+
+            /* The stored session goes on with the new connection unless it isn't persistent anymore */
+            #ifdef MQTT_BROKER_STORE_ENABLED
+            if (!persistent)
+            {
+                mqtt_broker_log_change(mqtt_broker, existing, MQTT_BROKER_STORE_RECORD_SESSION_END, NULL, NULL, 0u, 0u);
+            }
+            #endif /* MQTT_BROKER_STORE_ENABLED */
+            existing->persistent = false;
+        }
+        mqtt_broker_discard_session(mqtt_broker, existing);
+    }
+
+    /* Index the new session */
+    session->persistent = persistent;
+    if (session->client_id.size != 0u)
+    {
+        mqtt_broker_hash_session(mqtt_broker, session);
+    }
+    #ifdef MQTT_BROKER_STORE_ENABLED
+    if (persistent)
+    {
+        /* Also logged for a resumed session since its expiry interval may have changed */
+        uint8_t expiry[4u];
+        uint32_t i;
+        for (i = 0u; i < sizeof(expiry); i++)
+        {
+            expiry[i] = (uint8_t)((session->session_expiry_interval >> (8u * i)) & 0xFFu);
+        }
+        mqtt_broker_log_change(mqtt_broker, session, MQTT_BROKER_STORE_RECORD_SESSION, NULL, expiry, sizeof(expiry), 0u);
+    }
+    #endif /* MQTT_BROKER_STORE_ENABLED */
+
+    return session_present;
+}
+
+/** \brief Discard the state of a session and release it if its client is disconnected */
+static void mqtt_broker_discard_session(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    #ifdef MQTT_BROKER_STORE_ENABLED
+    if (session->persistent)
+    {
+        mqtt_broker_log_change(mqtt_broker, session, MQTT_BROKER_STORE_RECORD_SESSION_END, NULL, NULL, 0u, 0u);
+    }
+    #endif /* MQTT_BROKER_STORE_ENABLED */
+    mqtt_broker_remove_all_subscriptions(mqtt_broker, session);
+    mqtt_broker_clear_queue(mqtt_broker, session);
+    mqtt_broker_unhash_session(mqtt_broker, session);
+    session->persistent = false;
+
+    /* A disconnected session is not referenced anymore */
+    if (session->state == MQTT_BROKER_SESSION_STATE_OFFLINE)
+    {
+        mqtt_broker_session_t* previous_session = NULL;
+        mqtt_broker_session_t* current_session = mqtt_broker->first_offline_session;
+        while ((current_session != NULL) && (current_session != session))
+        {
+            previous_session = current_session;
+            current_session = current_session->next;
+        }
+        if (current_session != NULL)
+        {
+            if (previous_session == NULL)
+            {
+                mqtt_broker->first_offline_session = session->next;
+            }
+            else
+            {
+                previous_session->next = session->next;
+            }
+        }
+        session->state = MQTT_BROKER_SESSION_STATE_NOT_INITIALIZED;
+        session->next = mqtt_broker->first_free_session;
+        mqtt_broker->first_free_session = session;
+    }
+}
+
+/** \brief Start the expiration of a persistent session whose client is disconnected */
+static void mqtt_broker_start_expiry(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    session->expiry_time = UINT64_MAX;
+    if (session->session_expiry_interval != MQTT_BROKER_SESSION_NEVER_EXPIRES)
+    {
+        uint64_t now = 0u;
+        (void)mqtt_timer_wheel_get_time(&mqtt_broker->timer_wheel, &now);
+        session->expiry_time = now + ((uint64_t)session->session_expiry_interval * 1000u);
+
+        /* A single timer for the earliest expiration, the longer timeouts are truncated by the wheel
+           and the timer is started again until the expiration time is reached */
+        if (session->expiry_time < mqtt_broker->next_expiry_time)
+        {
+            const uint64_t delay = session->expiry_time - now;
+            mqtt_broker->next_expiry_time = session->expiry_time;
+            (void)mqtt_timer_wheel_start(&mqtt_broker->timer_wheel, &mqtt_broker->expiry_timer, 
+                                         ((delay < UINT32_MAX) ? (uint32_t)delay : UINT32_MAX), false);
+        }
+    }
+}
+
+/** \brief Release the expired sessions whose client is disconnected and wait for the next expiration */
+static void mqtt_broker_expiry_timer_expired(mqtt_timer_wheel_timer_t* const timer, void* const param)
+{
+    mqtt_broker_t* const mqtt_broker = (mqtt_broker_t*)param;
+    mqtt_broker_session_t* session = mqtt_broker->first_offline_session;
+    uint64_t now = 0u;
+    (void)timer;
+
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    (void)mqtt_timer_wheel_get_time(&mqtt_broker->timer_wheel, &now);
+    mqtt_broker->next_expiry_time = UINT64_MAX;
+    while (session != NULL)
+    {
+        mqtt_broker_session_t* const next_session = session->next;
+        if (session->expiry_time <= now)
+        {
+            /* The end of the session is logged in the store */
+            MQTT_LOG_INFO("Session of client '%.*s' expired", session->client_id.size, session->client_id.str);
+            mqtt_broker_discard_session(mqtt_broker, session);
+        }
+        else if (session->expiry_time < mqtt_broker->next_expiry_time)
+        {
+            mqtt_broker->next_expiry_time = session->expiry_time;
+        }
+        else
+        {
+            /* Expires later */
+        }
+        session = next_session;
+    }
+    if (mqtt_broker->next_expiry_time != UINT64_MAX)
+    {
+        const uint64_t delay = mqtt_broker->next_expiry_time - now;
+        (void)mqtt_timer_wheel_start(&mqtt_broker->timer_wheel, &mqtt_broker->expiry_timer, 
+                                     ((delay < UINT32_MAX) ? (uint32_t)delay : UINT32_MAX), false);
+    }
+}
+
+/** \brief Release the persistent session whose client has been disconnected for the longest time to make room for a new connection */
+static void mqtt_broker_evict_session(mqtt_broker_t* const mqtt_broker)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    /* The most recently disconnected sessions are at the beginning of the list */
+    mqtt_broker_session_t* session = mqtt_broker->first_offline_session;
+    while (session->next != NULL)
+    {
+        session = session->next;
+    }
+    MQTT_LOG_INFO("Session of client '%.*s' evicted : too many clients", session->client_id.size, session->client_id.str);
+    mqtt_broker_discard_session(mqtt_broker, session);
+}
+
+/** \brief Compute the hash of a client id or of a topic filter */
+static uint32_t mqtt_broker_hash(const char* const str, const uint16_t size)
+{
+    /* FNV-1a */
+    uint32_t hash = 2166136261u;
+    uint16_t i;
+    for (i = 0u; i < size; i++)
+    {
+        hash ^= (uint8_t)str[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+/** \brief Get the number of buckets of an index for a number of items */
+static uint32_t mqtt_broker_hash_size(const uint32_t count)
+{
+    /* Power of 2 to select the bucket with a mask */
+    uint32_t size = 1u;
+    while ((size < count) && (size < 0x80000000u))
+    {
+        size <<= 1u;
+    }
+
+    return size;
+}
+
+/** \brief Find the session of a client id (NULL if not found) */
+static mqtt_broker_session_t* mqtt_broker_find_session(mqtt_broker_t* const mqtt_broker, const char* const client_id, const uint16_t size)
+{
+    mqtt_broker_session_t* session = mqtt_broker->session_hash[mqtt_broker_hash(client_id, size) & mqtt_broker->session_hash_mask];
+    while ((session != NULL) && 
+           ((session->client_id.size != size) || (memcmp(session->client_id.str, client_id, size) != 0)))
+    {
+        session = session->next_hash;
+    }
+
+    return session;
+}
+
+/** \brief Add a session to the client id index */
+static void mqtt_broker_hash_session(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session)
+{
+    mqtt_broker_session_t** const bucket = &mqtt_broker->session_hash[mqtt_broker_hash(session->client_id.str, session->client_id.size) & 
+                                                                      mqtt_broker->session_hash_mask];
+    session->next_hash = (*bucket);
+    (*bucket) = session;
+}
+
+/** \brief Remove a session from the client id index if it is indexed */
+static void mqtt_broker_unhash_session(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session)
+{
+    mqtt_broker_session_t** link = &mqtt_broker->session_hash[mqtt_broker_hash(session->client_id.str, session->client_id.size) & 
+                                                              mqtt_broker->session_hash_mask];
+    while (((*link) != NULL) && ((*link) != session))
+    {
+        link = &(*link)->next_hash;
+    }
+    if ((*link) != NULL)
+    {
+        (*link) = session->next_hash;
+    }
+    session->next_hash = NULL;
+}
+
+/** \brief Route a message to the matching subscriptions, the publisher is NULL for the messages published by the broker */
+static void mqtt_broker_route(mqtt_broker_t* const mqtt_broker, const mqtt_broker_session_t* const publisher, const mqtt_string_t* const topic, 
+                              const void* const data, const uint32_t length, const uint8_t qos)
+{
+    mqtt_broker_topic_t* topic_filter = mqtt_broker->first_opened_topic;
+    while (topic_filter != NULL)
+    {
+        if (mqtt_broker_topic_match(&topic_filter->filter, topic))
+        {
+            if (topic_filter->shared)
+            {
+                /* A single member of the group receives the message */
+                const mqtt_broker_subscription_t* const subscription = mqtt_broker_select_shared(topic_filter);
+                const uint8_t forward_qos = ((qos < subscription->qos) ? qos : subscription->qos);
+                mqtt_broker_deliver(mqtt_broker, subscription->session, topic, data, length, forward_qos);
+            }
+            else
+            {
+                const mqtt_broker_subscription_t* subscription = topic_filter->subscription;
+                while (subscription != NULL)
+                {
+                    if (!subscription->no_local || (subscription->session != publisher))
+                    {
+                        const uint8_t forward_qos = ((qos < subscription->qos) ? qos : subscription->qos);
+                        mqtt_broker_deliver(mqtt_broker, subscription->session, topic, data, length, forward_qos);
+                    }
+                    subscription = subscription->next;
+                }
+            }
+        }
+        topic_filter = topic_filter->next;
+    }
+}
+
+/** \brief Send a message to a subscriber or queue it if the subscriber can't receive it now */
+static void mqtt_broker_deliver(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session, const mqtt_string_t* const topic, 
+                                const void* const data, const uint32_t length, const uint8_t qos)
+{
+    const bool connected = (session->state == MQTT_BROKER_SESSION_STATE_MQTT_CONNECTED);
+    #ifdef MQTT_BROKER_SPILL_ENABLED
+    const bool spilling = (session->spill->count != 0u);
+    #else
+    const bool spilling = false;
+    #endif /* MQTT_BROKER_SPILL_ENABLED */
+    const bool ready = (connected && !spilling && (session->queue.sent == session->queue.count) && 
+                        (session->inflight_count < session->receive_maximum) && mqtt_broker_can_send(session, topic, length, qos));
+
+    /* The QoS 1 and QoS 2 messages of the persistent sessions are queued until they are acknowledged so that they are sent 
+       again on the next connection, the other ones are queued in order while the client has reached its receive maximum
+       or doesn't read its in-process link, the QoS 0 messages are only sent to the connected clients */
+    if ((qos > 0u) && (session->persistent || (connected && !ready)))
+    {
+        /* Once a message has been spilled, the next ones are spilled too until they have all been read back */
+        if (!spilling && mqtt_broker_queue_push(&session->queue, topic, data, length, qos))
+        {
+            #ifdef MQTT_BROKER_STORE_ENABLED
+            mqtt_broker_log_change(mqtt_broker, session, MQTT_BROKER_STORE_RECORD_QUEUE, topic, data, length, qos);
+            #endif /* MQTT_BROKER_STORE_ENABLED */
+            if (ready)
+            {
+                (void)mqtt_broker_send_queued(mqtt_broker, session, topic, data, length, qos, false, 0u);
+            }
+        }
+        #ifdef MQTT_BROKER_SPILL_ENABLED
+        else if (mqtt_broker->spill.opened &&
+                 ((MQTT_BROKER_QUEUE_HEADER_SIZE + (uint32_t)topic->size + length) <= session->queue.size) &&
+                 mqtt_broker_spill_push(&mqtt_broker->spill, session->spill, topic, data, length, qos))
+        {
+            /* Read back when the queue has room */
+        }
+        #endif /* MQTT_BROKER_SPILL_ENABLED */
+        else if (ready)
+        {
+            /* No room to keep it until it is acknowledged */
+            (void)mqtt_broker_forward(session, topic, data, length, qos, false, false, mqtt_broker_next_packet_id(session));
+        }
+        else
+        {
+            #ifdef MQTT_BROKER_SYS_ENABLED
+            session->stats.publish_dropped++;
+            #endif /* MQTT_BROKER_SYS_ENABLED */
+        }
+    }
+    else if (connected)
+    {
+        (void)mqtt_broker_forward(session, topic, data, length, qos, false, false, 
+                                  ((qos > 0u) ? mqtt_broker_next_packet_id(session) : 0u));
+    }
+    else
+    {
+        /* Not delivered */
+    }
+}
+
+/** \brief Send the queued messages of a session while its client accepts them */
+static void mqtt_broker_drain_queue(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    bool done = false;
+    while (!done && (session->queue.sent != session->queue.count) && (session->inflight_count < session->receive_maximum))
+    {
+        uint32_t position = session->queue.sent_used;
+        mqtt_broker_queue_message_t message;
+        message.topic.str = mqtt_broker->topic_buffer;
+        message.topic.size = mqtt_broker->config.max_topic_length;
+        message.payload = mqtt_broker->payload_buffer;
+        message.length = mqtt_broker->config.max_payload_size;
+        if (!mqtt_broker_queue_peek(&session->queue, &position, &message))
+        {
+            /* Invalid message : drop it */
+            done = !mqtt_broker_send_queued(mqtt_broker, session, &message.topic, NULL, 0u, 0u, false, 0u);
+        }
+        else if (message.acknowledged)
+        {
+            /* Acknowledged before the connection was lost, removed once the older messages are acknowledged */
+            (void)mqtt_broker_queue_set_sent(&session->queue, message.packet_id);
+        }
+        else if (!mqtt_broker_can_send(session, &message.topic, message.length, message.qos))
+        {
+            /* The message stays queued until the client reads its in-process link */
+            done = true;
+        }
+        else
+        {
+            done = !mqtt_broker_send_queued(mqtt_broker, session, &message.topic, message.payload, message.length, message.qos,
+                                            message.dup, message.packet_id);
+        }
+    }
+}
+
+/** \brief Send the next queued message of a session which stays queued until it is acknowledged, returns false if the connection is lost */
+static bool mqtt_broker_send_queued(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session, const mqtt_string_t* const topic, 
+                                    const void* const data, const uint32_t length, const uint8_t qos, const bool dup, const uint16_t packet_id)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    /* A message sent on a previous connection is sent again with the same packet id */
+    const uint16_t send_packet_id = (dup ? packet_id : mqtt_broker_next_packet_id(session));
+    const bool sent = ((qos > 0u) && mqtt_broker_forward(session, topic, data, length, qos, false, dup, send_packet_id));
+    (void)mqtt_broker_queue_set_sent(&session->queue, send_packet_id);
+    if (!sent && (session->state != MQTT_BROKER_SESSION_STATE_CLOSED))
+    {
+        /* Discarded because of the client limits : no acknowledgement will come */
+        uint32_t removed = 0u;
+        (void)mqtt_broker_queue_acknowledge(&session->queue, send_packet_id, &removed);
+        #ifdef MQTT_BROKER_STORE_ENABLED
+        while (removed != 0u)
+        {
+            mqtt_broker_log_change(mqtt_broker, session, MQTT_BROKER_STORE_RECORD_DEQUEUE, NULL, NULL, 0u, 0u);
+            removed--;
+        }
+        #else
+        (void)mqtt_broker;
+        #endif /* MQTT_BROKER_STORE_ENABLED */
+    }
+
+    return (session->state != MQTT_BROKER_SESSION_STATE_CLOSED);
+}
+
+/** \brief Remove the queued messages of a session, including its spilled messages */
+static void mqtt_broker_clear_queue(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    (void)mqtt_broker_queue_clear(&session->queue);
+    #ifdef MQTT_BROKER_SPILL_ENABLED
+    (void)mqtt_broker_spill_reset(&mqtt_broker->spill, session->spill);
+    #else
+    (void)mqtt_broker;
+    #endif /* MQTT_BROKER_SPILL_ENABLED */
+}
+
+/** \brief Send a message to a subscriber, returns false if the message has been discarded or the connection is lost */
+static bool mqtt_broker_forward(mqtt_broker_session_t* const session, const mqtt_string_t* const topic, const void* const data, 
+                                const uint32_t length, const uint8_t qos, const bool retain, const bool dup, const uint16_t packet_id)
+{
+    bool send = true;
+    mqtt_properties_t properties;
+    mqtt_properties_t* const publish_properties = mqtt_broker_get_properties(session, &properties);
+    mqtt_const_string_t const_topic;
+    const_topic.str = topic->str;
+    const_topic.size = topic->size;
+
+    /* Check client limits */
+    if (publish_properties != NULL)
+    {
+        if (mqtt_packet_serialize_publish_size(&const_topic, length, qos, publish_properties) > session->maximum_packet_size)
+        {
+            /* Too large for the client : discard */
+            send = false;
+        }
+        if ((qos > 0u) && (session->inflight_count >= session->receive_maximum))
+        {
+            /* Client's receive maximum reached : discard */
+            send = false;
+        }
+    }
+    if (send && !mqtt_broker_can_send(session, topic, length, qos))
+    {
+        /* Client not reading its in-process link : discard */
+        send = false;
+    }
+
+    /* Send PUBLISH packet */
+    if (send)
+    {
+        const bool callret = mqtt_packet_serialize_publish(&session->outstream, &const_topic, data, length, qos, retain, dup,
+                                                           packet_id, publish_properties);
+        if (callret)
+        {
+            #ifdef MQTT_BROKER_SYS_ENABLED
+            session->stats.publish_sent++;
+            #endif /* MQTT_BROKER_SYS_ENABLED */
+            if (qos > 0u)
+            {
+                session->inflight_count++;
+            }
+        }
+        else
+        {
+            session->state = MQTT_BROKER_SESSION_STATE_CLOSED;
+            send = false;
+        }
+    }
+    #ifdef MQTT_BROKER_SYS_ENABLED
+    if (!send)
+    {
+        session->stats.publish_dropped++;
+    }
+    #endif /* MQTT_BROKER_SYS_ENABLED */
+
+    return send;
+}
+
+/** \brief Get the next packet id to send a QoS 1 or QoS 2 message to a subscriber */
+static uint16_t mqtt_broker_next_packet_id(mqtt_broker_session_t* const session)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    const uint16_t packet_id = session->packet_id;
+    session->packet_id++;
+    if (session->packet_id == 0u)
+    {
+        session->packet_id = 1u;
+    }
+
+    return packet_id;
+}
+
+/** \brief Check if a message can be sent to a subscriber without waiting, only the in-process links can be full */
+static bool mqtt_broker_can_send(mqtt_broker_session_t* const session, const mqtt_string_t* const topic, const uint32_t length, const uint8_t qos)
+{
+    bool ret = true;
+
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    /* Some room is left for the acknowledgements so that a PUBLISH packet never waits in the middle of the ring buffer */
+    if (session->local_link != NULL)
+    {
+        size_t room = 0u;
+        mqtt_properties_t properties;
+        mqtt_const_string_t const_topic;
+        const_topic.str = topic->str;
+        const_topic.size = topic->size;
+        (void)ring_stream_get_writable_size(&session->local_link->broker_endpoint, &room);
+        ret = (room >= ((size_t)mqtt_packet_serialize_publish_size(&const_topic, length, qos, mqtt_broker_get_properties(session, &properties)) + 
+                        RING_STREAM_CONTROL_ROOM));
+    }
+
+    return ret;
+}
+
+/** \brief Find an opened topic filter (NULL if not found) */
+static mqtt_broker_topic_t* mqtt_broker_find_topic(mqtt_broker_t* const mqtt_broker, const char* const topic_filter, const uint16_t size)
+{
+    mqtt_broker_topic_t* topic = mqtt_broker->topic_hash[mqtt_broker_hash(topic_filter, size) & mqtt_broker->topic_hash_mask];
+    while ((topic != NULL) && 
+           ((topic->topic.size != size) || (memcmp(topic->topic.str, topic_filter, size) != 0)))
+    {
+        topic = topic->next_hash;
+    }
+
+    return topic;
+}
+
+/** \brief Open a new topic filter (NULL if there are no more topics) */
+static mqtt_broker_topic_t* mqtt_broker_open_topic(mqtt_broker_t* const mqtt_broker, const char* const topic_filter, const uint16_t size)
+{
+    mqtt_broker_topic_t* topic = NULL;
+
+    if (mqtt_broker->first_free_topic == NULL)
+    {
+        mqtt_broker_reclaim_index(mqtt_broker);
+    }
+    if ((mqtt_broker->first_free_topic != NULL) && (size <= mqtt_broker->config.max_topic_length))
+    {
+        mqtt_broker_topic_t** const bucket = &mqtt_broker->topic_hash[mqtt_broker_hash(topic_filter, size) & mqtt_broker->topic_hash_mask];
+
+        /* Fill the topic before publishing it to the lock-free readers */
+        topic = mqtt_broker->first_free_topic;
+        mqtt_broker->first_free_topic = topic->next;
+        (void)memcpy(topic->topic_buffer, topic_filter, size);
+        topic->topic.str = topic->topic_buffer;
+        topic->topic.size = size;
+        (void)mqtt_broker_get_filter(&topic->topic, &topic->filter, &topic->shared);
+        topic->subscription = NULL;
+        topic->next_shared = NULL;
+        topic->previous = NULL;
+        topic->next = mqtt_broker->first_opened_topic;
+        if (topic->next != NULL)
+        {
+            topic->next->previous = topic;
+        }
+        topic->next_hash = (*bucket);
+        (*bucket) = topic;
+        MQTT_BROKER_STORE_RELEASE(&mqtt_broker->first_opened_topic, topic);
+    }
+
+    return topic;
+}
+
+/** \brief Remove a topic filter without subscriptions from the opened topics */
+static void mqtt_broker_close_topic(mqtt_broker_t* const mqtt_broker, mqtt_broker_topic_t* const topic)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    mqtt_broker_topic_t** link = &mqtt_broker->topic_hash[mqtt_broker_hash(topic->topic.str, topic->topic.size) & mqtt_broker->topic_hash_mask];
+    while ((*link) != topic)
+    {
+        link = &(*link)->next_hash;
+    }
+    (*link) = topic->next_hash;
+
+    /* The next pointer of the topic is kept for the lock-free readers */
+    if (topic->previous == NULL)
+    {
+        MQTT_BROKER_STORE_RELEASE(&mqtt_broker->first_opened_topic, topic->next);
+    }
+    else
+    {
+        MQTT_BROKER_STORE_RELEASE(&topic->previous->next, topic->next);
+    }
+    if (topic->next != NULL)
+    {
+        topic->next->previous = topic->previous;
+    }
+    mqtt_broker_retire_topic(mqtt_broker, topic);
+}
+
+/** \brief Add a subscription to a topic filter with its MQTT 5.0 options (MQTT_SUBSCRIBE_OPTION_*), the existing subscriptions
+           of the session are not looked for if check_existing is false */
+static uint8_t mqtt_broker_add_subscription(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session, 
+                                            const mqtt_string_t* const topic_filter, const uint8_t qos, const uint8_t options, 
+                                            const bool check_existing)
+{
+    uint8_t granted_qos = MQTT_FAILURE_QOS;
+    mqtt_string_t filter;
+    bool shared = false;
+    mqtt_broker_topic_t* topic = NULL;
+
+    /* Look for the topic filter, the shared subscriptions must have a group name and a filter */
+    if (mqtt_broker_get_filter(topic_filter, &filter, &shared))
+    {
+        topic = mqtt_broker_find_topic(mqtt_broker, topic_filter->str, topic_filter->size);
+        if (topic == NULL)
+        {
+            topic = mqtt_broker_open_topic(mqtt_broker, topic_filter->str, topic_filter->size);
+        }
+    }
+    if (topic != NULL)
+    {
+        /* Look for an existing subscription of the session */
+        mqtt_broker_subscription_t* subscription = NULL;
+        if (check_existing)
+        {
+            subscription = topic->subscription;
+            while ((subscription != NULL) && (subscription->session != session))
+            {
+                subscription = subscription->next;
+            }
+        }
+        if ((subscription == NULL) && (mqtt_broker->first_free_subscription == NULL))
+        {
+            mqtt_broker_reclaim_index(mqtt_broker);
+        }
+        if ((subscription == NULL) && (mqtt_broker->first_free_subscription != NULL))
+        {
+            /* New subscription */
+            subscription = mqtt_broker->first_free_subscription;
+            mqtt_broker->first_free_subscription = subscription->next;
+            subscription->session = session;
+            subscription->topic = topic;
+            subscription->previous_session = NULL;
+            subscription->next_session = session->first_subscription;
+            if (subscription->next_session != NULL)
+            {
+                subscription->next_session->previous_session = subscription;
+            }
+            session->first_subscription = subscription;
+            subscription->next = topic->subscription;
+            MQTT_BROKER_STORE_RELEASE(&topic->subscription, subscription);
+        }
+        if (subscription != NULL)
+        {
+            subscription->qos = ((qos < MQTT_CFG_MAX_QOS_LEVEL) ? qos : MQTT_CFG_MAX_QOS_LEVEL);
+            subscription->no_local = (!shared && ((options & MQTT_SUBSCRIBE_OPTION_NO_LOCAL) != 0u));
+            granted_qos = subscription->qos;
+        }
+        else if (topic->subscription == NULL)
+        {
+            /* Topic filter opened for nothing */
+            mqtt_broker_close_topic(mqtt_broker, topic);
+        }
+        else
+        {
+            /* Topic filter used by the other sessions */
+        }
+    }
+
+    return granted_qos;
+}
+
+/** \brief Remove a subscription from a topic filter */
+static bool mqtt_broker_remove_subscription(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session, 
+                                            const mqtt_string_t* const topic_filter)
+{
+    bool ret = false;
+    const mqtt_broker_topic_t* const topic = mqtt_broker_find_topic(mqtt_broker, topic_filter->str, topic_filter->size);
+
+    if (topic != NULL)
+    {
+        /* Look for the subscription of the session */
+        mqtt_broker_subscription_t* subscription = topic->subscription;
+        while ((subscription != NULL) && (subscription->session != session))
+        {
+            subscription = subscription->next;
+        }
+        if (subscription != NULL)
+        {
+            mqtt_broker_release_subscription(mqtt_broker, subscription);
+            ret = true;
+        }
+    }
+
+    return ret;
+}
+
+/** \brief Remove all the subscriptions of a session */
+static void mqtt_broker_remove_all_subscriptions(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session)
+{
+    while (session->first_subscription != NULL)
+    {
+        mqtt_broker_release_subscription(mqtt_broker, session->first_subscription);
+    }
+}
+
+/** \brief Remove a subscription from its topic filter and from its session */
+static void mqtt_broker_release_subscription(mqtt_broker_t* const mqtt_broker, mqtt_broker_subscription_t* const subscription)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    mqtt_broker_topic_t* const topic = subscription->topic;
+    mqtt_broker_session_t* const session = subscription->session;
+    mqtt_broker_subscription_t* previous_subscription = NULL;
+    mqtt_broker_subscription_t* current_subscription = topic->subscription;
+
+    /* Unlink from the topic filter, the next pointer is kept for the lock-free readers */
+    while (current_subscription != subscription)
+    {
+        previous_subscription = current_subscription;
+        current_subscription = current_subscription->next;
+    }
+    if (topic->next_shared == subscription)
+    {
+        topic->next_shared = subscription->next;
+    }
+    if (previous_subscription == NULL)
+    {
+        MQTT_BROKER_STORE_RELEASE(&topic->subscription, subscription->next);
+    }
+    else
+    {
+        MQTT_BROKER_STORE_RELEASE(&previous_subscription->next, subscription->next);
+    }
+
+    /* Unlink from the session */
+    if (subscription->previous_session == NULL)
+    {
+        session->first_subscription = subscription->next_session;
+    }
+    else
+    {
+        subscription->previous_session->next_session = subscription->next_session;
+    }
+    if (subscription->next_session != NULL)
+    {
+        subscription->next_session->previous_session = subscription->previous_session;
+    }
+    #ifdef MQTT_BROKER_RETAIN_ENABLED
+    if (session->retained_subscription == subscription)
+    {
+        /* Its remaining retained messages are not sent */
+        session->retained_subscription = NULL;
+    }
+    #endif /* MQTT_BROKER_RETAIN_ENABLED */
+    mqtt_broker_retire_subscription(mqtt_broker, subscription);
+
+    /* Release the topic filter if not used anymore */
+    if (topic->subscription == NULL)
+    {
+        mqtt_broker_close_topic(mqtt_broker, topic);
+    }
+}
+
+/** \brief Check if a topic name matches a topic filter */
+static bool mqtt_broker_topic_match(const mqtt_string_t* const topic_filter, const mqtt_string_t* const topic)
+{
+    bool match = false;
+    bool done = false;
+    uint16_t f = 0u;
+    uint16_t t = 0u;
+    const char* const filter = topic_filter->str;
+    const char* const name = topic->str;
+
+    /* Topics beginning with a '$' are not matched by a wildcard at the first level */
+    if ((topic->size != 0u) && (name[0u] == '$') && 
+        (topic_filter->size != 0u) && ((filter[0u] == '+') || (filter[0u] == '#')))
+    {
+        done = true;
+    }
+    while (!done)
+    {
+        if (f == topic_filter->size)
+        {
+            /* End of filter */
+            match = (t == topic->size);
+            done = true;
+        }
+        else if (filter[f] == '#')
+        {
+            /* Multi-level wildcard matches all the remaining levels */
+            match = true;
+            done = true;
+        }
+        else if (filter[f] == '+')
+        {
+            /* Single level wildcard */
+            while ((t < topic->size) && (name[t] != '/'))
+            {
+                t++;
+            }
+            f++;
+        }
+        else if (t == topic->size)
+        {
+            /* 'a/#' also matches the parent level 'a' */
+            match = (((topic_filter->size - f) == 2u) && (filter[f] == '/') && (filter[f + 1u] == '#'));
+            done = true;
+        }
+        else if (filter[f] == name[t])
+        {
+            f++;
+            t++;
+        }
+        else
+        {
+            done = true;
+        }
+    }
+
+    return match;
+}
+
+/** \brief Get the topic filter of a subscription without its $share/<group>/ prefix, returns false if the shared subscription is invalid */
+static bool mqtt_broker_get_filter(const mqtt_string_t* const topic_filter, mqtt_string_t* const filter, bool* const shared)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    static const char share_prefix[] = "$share/";
+    const uint16_t prefix_size = (uint16_t)(sizeof(share_prefix) - 1u);
+    bool valid = true;
+
+    filter->str = topic_filter->str;
+    filter->size = topic_filter->size;
+    (*shared) = false;
+    if ((topic_filter->size >= prefix_size) && (memcmp(topic_filter->str, share_prefix, prefix_size) == 0))
+    {
+        /* The group name can't contain wildcards and is followed by a non empty filter */
+        uint16_t i = prefix_size;
+        while ((i < topic_filter->size) && (topic_filter->str[i] != '/') && (topic_filter->str[i] != '+') && (topic_filter->str[i] != '#'))
+        {
+            i++;
+        }
+        valid = ((i != prefix_size) && ((i + 1u) < topic_filter->size) && (topic_filter->str[i] == '/'));
+        if (valid)
+        {
+            filter->str = &topic_filter->str[i + 1u];
+            filter->size = (uint16_t)(topic_filter->size - i - 1u);
+            (*shared) = true;
+        }
+    }
+
+    return valid;
+}
+
+/** \brief Select the member of a shared subscription which receives the next message */
+static const mqtt_broker_subscription_t* mqtt_broker_select_shared(mqtt_broker_topic_t* const topic)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    /* The connected members are preferred, the first one found from the rotating start wins the ties, an offline
+       member is only selected if none is connected so that its persistent session queues the message */
+    mqtt_broker_subscription_t* const first = ((topic->next_shared != NULL) ? topic->next_shared : topic->subscription);
+    mqtt_broker_subscription_t* subscription = first;
+    mqtt_broker_subscription_t* selected = NULL;
+    bool selected_connected = false;
+    #ifdef MQTT_BROKER_SHARED_LEAST_INFLIGHT_ENABLED
+    uint32_t selected_load = 0u;
+    #endif /* MQTT_BROKER_SHARED_LEAST_INFLIGHT_ENABLED */
+    bool done = false;
+    while (!done)
+    {
+        const mqtt_broker_session_t* const session = subscription->session;
+        const bool connected = (session->state == MQTT_BROKER_SESSION_STATE_MQTT_CONNECTED);
+        bool better = ((selected == NULL) || (connected && !selected_connected));
+        #ifdef MQTT_BROKER_SHARED_LEAST_INFLIGHT_ENABLED
+        const uint32_t load = (uint32_t)session->inflight_count + (session->queue.count - session->queue.sent);
+        better = (better || ((connected == selected_connected) && (load < selected_load)));
+        #endif /* MQTT_BROKER_SHARED_LEAST_INFLIGHT_ENABLED */
+        if (better)
+        {
+            selected = subscription;
+            selected_connected = connected;
+            #ifdef MQTT_BROKER_SHARED_LEAST_INFLIGHT_ENABLED
+            selected_load = load;
+            done = (connected && (load == 0u));
+            #else
+            done = connected;
+            #endif /* MQTT_BROKER_SHARED_LEAST_INFLIGHT_ENABLED */
+        }
+
+        /* Next member, back to the first subscription after the last one */
+        subscription = ((subscription->next != NULL) ? subscription->next : topic->subscription);
+        done = (done || (subscription == first));
+    }
+    topic->next_shared = selected->next;
+
+    return selected;
+}
+
+/** \brief Retire a topic removed from the opened topics until no lock-free reader can reach it */
+static void mqtt_broker_retire_topic(mqtt_broker_t* const mqtt_broker, mqtt_broker_topic_t* const topic)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    /* The next pointer is kept so that a reader standing on the topic can continue its walk,
+       the readers which start after the epoch change can't reach the topic anymore */
+    uint32_t next_epoch = mqtt_broker->index_epoch + 1u;
+    if (next_epoch == 0u)
+    {
+        next_epoch = 1u;
+    }
+    topic->retire_epoch = mqtt_broker->index_epoch;
+    topic->next_retired = mqtt_broker->first_retired_topic;
+    mqtt_broker->first_retired_topic = topic;
+    MQTT_BROKER_STORE_RELEASE(&mqtt_broker->index_epoch, next_epoch);
+}
+
+/** \brief Retire a subscription removed from its topic until no lock-free reader can reach it */
+static void mqtt_broker_retire_subscription(mqtt_broker_t* const mqtt_broker, mqtt_broker_subscription_t* const subscription)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    uint32_t next_epoch = mqtt_broker->index_epoch + 1u;
+    if (next_epoch == 0u)
+    {
+        next_epoch = 1u;
+    }
+    subscription->retire_epoch = mqtt_broker->index_epoch;
+    subscription->next_retired = mqtt_broker->first_retired_subscription;
+    mqtt_broker->first_retired_subscription = subscription;
+    MQTT_BROKER_STORE_RELEASE(&mqtt_broker->index_epoch, next_epoch);
+}
+
+/** \brief Move the retired topics and subscriptions which can't be reached anymore to the free lists */
+static void mqtt_broker_reclaim_index(mqtt_broker_t* const mqtt_broker)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    uint32_t i;
+    uint32_t oldest_epoch = mqtt_broker->index_epoch;
+    mqtt_broker_topic_t* topic = mqtt_broker->first_retired_topic;
+    mqtt_broker_subscription_t* subscription = mqtt_broker->first_retired_subscription;
+
+    /* Oldest epoch still observed by a reader, the removals must be visible before the reader slots are checked */
+    MQTT_BROKER_FULL_FENCE();
+    for (i = 0u; i < MQTT_BROKER_MAX_INDEX_READERS; i++)
+    {
+        const uint32_t reader_epoch = MQTT_BROKER_LOAD_ACQUIRE(&mqtt_broker->index_readers[i]);
+        if ((reader_epoch != 0u) && (((int32_t)(reader_epoch - oldest_epoch)) < 0))
+        {
+            oldest_epoch = reader_epoch;
+        }
+    }
+
+    /* A reader may still stand on the items retired during or after its epoch */
+    mqtt_broker->first_retired_topic = NULL;
+    while (topic != NULL)
+    {
+        mqtt_broker_topic_t* const next_topic = topic->next_retired;
+        if (((int32_t)(oldest_epoch - topic->retire_epoch)) > 0)
+        {
+            topic->next = mqtt_broker->first_free_topic;
+            mqtt_broker->first_free_topic = topic;
+        }
+        else
+        {
+            topic->next_retired = mqtt_broker->first_retired_topic;
+            mqtt_broker->first_retired_topic = topic;
+        }
+        topic = next_topic;
+    }
+    mqtt_broker->first_retired_subscription = NULL;
+    while (subscription != NULL)
+    {
+        mqtt_broker_subscription_t* const next_subscription = subscription->next_retired;
+        if (((int32_t)(oldest_epoch - subscription->retire_epoch)) > 0)
+        {
+            subscription->session = NULL;
+            subscription->next = mqtt_broker->first_free_subscription;
+            mqtt_broker->first_free_subscription = subscription;
+        }
+        else
+        {
+            subscription->next_retired = mqtt_broker->first_retired_subscription;
+            mqtt_broker->first_retired_subscription = subscription;
+        }
+        subscription = next_subscription;
+    }
+}
+
+/** \brief Take a reader slot to read the subscription index without lock */
+static uint32_t mqtt_broker_index_read_lock(mqtt_broker_t* const mqtt_broker)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    /* The readers only wait for each other when more than MQTT_BROKER_MAX_INDEX_READERS read at the same time */
+    uint32_t slot = 0u;
+    bool locked = false;
+    while (!locked)
+    {
+        uint32_t expected = 0u;
+        const uint32_t epoch = MQTT_BROKER_LOAD_ACQUIRE(&mqtt_broker->index_epoch);
+        locked = MQTT_BROKER_COMPARE_EXCHANGE(&mqtt_broker->index_readers[slot], expected, epoch);
+        if (!locked)
+        {
+            slot = ((slot + 1u) % MQTT_BROKER_MAX_INDEX_READERS);
+        }
+    }
+
+    /* The slot must be visible to the broker task before the index is read */
+    MQTT_BROKER_FULL_FENCE();
+
+    return slot;
+}
+
+/** \brief Release a reader slot */
+static void mqtt_broker_index_read_unlock(mqtt_broker_t* const mqtt_broker, const uint32_t slot)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    MQTT_BROKER_STORE_RELEASE(&mqtt_broker->index_readers[slot], 0u);
+}
+
+/** \brief Close a session */
+static void mqtt_broker_close_session(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session)
+{
+    mqtt_broker_session_t* previous_session = NULL;
+    mqtt_broker_session_t* current_session = mqtt_broker->first_connected_session;
+
+    /* Unexpected disconnection : publish the will message */
+    session->state = MQTT_BROKER_SESSION_STATE_CLOSED;
+    if (session->has_will)
+    {
+        #ifdef MQTT_BROKER_RETAIN_ENABLED
+        if (session->will.retain)
+        {
+            mqtt_broker_retain_message(mqtt_broker, &session->will.topic, session->will.message.str, session->will.message.size, session->will.qos);
+        }
+        #endif /* MQTT_BROKER_RETAIN_ENABLED */
+        mqtt_broker_route(mqtt_broker, NULL, &session->will.topic, session->will.message.str, session->will.message.size, session->will.qos);
+        #ifdef MQTT_BROKER_BRIDGE_ENABLED
+        mqtt_broker_bridge_message(mqtt_broker, &session->will.topic, session->will.message.str, session->will.message.size, session->will.qos);
+        #endif /* MQTT_BROKER_BRIDGE_ENABLED */
+    }
+    MQTT_LOG_INFO("Client '%.*s' disconnected", session->client_id.size, session->client_id.str);
+    #ifdef MQTT_BROKER_SYS_ENABLED
+    mqtt_broker_add_session_stats(&mqtt_broker->closed_stats, session);
+    if (session->stats.connected)
+    {
+        mqtt_broker->clients_connected--;
+    }
+    #endif /* MQTT_BROKER_SYS_ENABLED */
+
+    /* Release resources */
+    (void)mqtt_timer_wheel_cancel(&mqtt_broker->timer_wheel, &session->keepalive_timer);
+    #ifdef MQTT_TRACE_ENABLED
+    if (session->trace.recorder != NULL)
+    {
+        (void)trace_stream_close(&session->trace);
+    }
+    #endif /* MQTT_TRACE_ENABLED */
+    if (!session->persistent)
+    {
+        mqtt_broker_remove_all_subscriptions(mqtt_broker, session);
+        mqtt_broker_clear_queue(mqtt_broker, session);
+        mqtt_broker_unhash_session(mqtt_broker, session);
+    }
+    if (session->local_link != NULL)
+    {
+        (void)ring_stream_link_close(&session->local_link->broker_endpoint);
+        session->local_link = NULL;
+    }
+    else
+    {
+        #ifdef MQTT_SOCKET_IO_URING_ENABLED
+        if (mqtt_broker->uring_enabled)
+        {
+            (void)mqtt_socket_uring_cancel(&session->endpoint);
+        }
+        else
+        #endif /* MQTT_SOCKET_IO_URING_ENABLED */
+        {
+            (void)mqtt_socket_poller_remove(&mqtt_broker->poller, &session->socket);
+        }
+        (void)mqtt_socket_close(&session->socket);
+    }
+
+    /* Move session to the offline list if persistent, to the free list otherwise */
+    while ((current_session != NULL) && (current_session != session))
+    {
+        previous_session = current_session;
+        current_session = current_session->next;
+    }
+    if (current_session != NULL)
+    {
+        if (previous_session == NULL)
+        {
+            mqtt_broker->first_connected_session = session->next;
+        }
+        else
+        {
+            previous_session->next = session->next;
+        }
+        if (session->persistent)
+        {
+            session->state = MQTT_BROKER_SESSION_STATE_OFFLINE;
+            session->next = mqtt_broker->first_offline_session;
+            mqtt_broker->first_offline_session = session;
+            mqtt_broker_start_expiry(mqtt_broker, session);
+        }
+        else
+        {
+            session->state = MQTT_BROKER_SESSION_STATE_NOT_INITIALIZED;
+            session->next = mqtt_broker->first_free_session;
+            mqtt_broker->first_free_session = session;
+        }
+    }
+}
+
+/** \brief Get the properties to use in the packets sent to a client */
+static mqtt_properties_t* mqtt_broker_get_properties(const mqtt_broker_session_t* const session, mqtt_properties_t* const properties)
+{
+    mqtt_properties_t* ret = NULL;
+
+    /* Properties are only used with MQTT 5.0 */
+    if (session->protocol_level == MQTT_PROTOCOL_LEVEL_V5)
+    {
+        properties->present = 0u;
+        ret = properties;
+    }
+
+    return ret;
+}
+
+/** \brief Close a session whose keepalive or CONNECT timeout has expired */
+static void mqtt_broker_session_timeout(mqtt_timer_wheel_timer_t* const timer, void* const param)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    /* The client must send a packet within 1.5 times the keepalive period */
+    mqtt_broker_session_t* const session = (mqtt_broker_session_t*)param;
+    (void)timer;
+    session->state = MQTT_BROKER_SESSION_STATE_CLOSED;
+}
+
+/** \brief Wait for the events of the poller and process them */
+static void mqtt_broker_poller_process_events(mqtt_broker_t* const mqtt_broker, const uint32_t ms_timeout)
+{
+    uint32_t i;
+    uint32_t count = 0u;
+    mqtt_broker_session_t* session;
+
+    /* Wait for the ready sockets */
+    #ifdef MQTT_MULTITASKING_ENABLED
+    (void)mqtt_mutex_unlock(&mqtt_broker->mutex);
+    #endif /* MQTT_MULTITASKING_ENABLED */
+    (void)mqtt_socket_poller_wait(&mqtt_broker->poller, mqtt_broker->poller_events, mqtt_broker->config.max_clients + 2u,
+                                  ms_timeout, &count);
+    #ifdef MQTT_MULTITASKING_ENABLED
+    (void)mqtt_mutex_lock(&mqtt_broker->mutex);
+    #endif /* MQTT_MULTITASKING_ENABLED */
+
+    /* Process the ready sockets only : the closed sessions are removed from the poller
+       before being released so an event can't refer to a reused session */
+    for (i = 0u; i < count; i++)
+    {
+        const mqtt_socket_poller_event_t* const event = &mqtt_broker->poller_events[i];
+        if (event->tag == MQTT_BROKER_LISTEN_TAG)
+        {
+            /* New client connected */
+            mqtt_broker_accept(mqtt_broker);
+        }
+        else if (event->tag < mqtt_broker->config.max_clients)
+        {
+            session = &mqtt_broker->sessions[event->tag];
+            if ((session->state != MQTT_BROKER_SESSION_STATE_NOT_INITIALIZED) &&
+                (session->state != MQTT_BROKER_SESSION_STATE_CLOSED) &&
+                (session->state != MQTT_BROKER_SESSION_STATE_OFFLINE))
+            {
+                if (event->readable)
+                {
+                    mqtt_broker_process_session(mqtt_broker, session);
+                }
+                else if (event->error)
+                {
+                    session->state = MQTT_BROKER_SESSION_STATE_CLOSED;
+                }
+                else
+                {
+                    /* Nothing to do */
+                }
+            }
+        }
+        else
+        {
+            /* Unknown tag */
+        }
+    }
+}
+
+/** \brief Accept the connections and process the packets of the in-process links */
+static bool mqtt_broker_local_process_events(mqtt_broker_t* const mqtt_broker)
+{
+    bool activity = false;
+    ring_stream_link_t* link = mqtt_broker->first_local_link;
+    mqtt_broker_session_t* session;
+
+    /* Accept the new connections */
+    while (link != NULL)
+    {
+        if (ring_stream_link_accept(link))
+        {
+            session = mqtt_broker_new_session(mqtt_broker);
+            if (session != NULL)
+            {
+                session->local_link = link;
+                (void)ring_stream_set_backlog(&link->broker_endpoint, session->local_output, mqtt_broker->config.local_output_size);
+                (void)ring_stream_output_from_endpoint(&session->outstream, &link->broker_endpoint);
+                (void)ring_stream_input_from_endpoint(&session->instream, &link->broker_endpoint);
+                #ifdef MQTT_TRACE_ENABLED
+                mqtt_broker_trace_session(mqtt_broker, session, true);
+                #endif /* MQTT_TRACE_ENABLED */
+            }
+            else
+            {
+                (void)ring_stream_link_close(&link->broker_endpoint);
+            }
+            activity = true;
+        }
+        link = link->next;
+    }
+
+    /* Process the received packets without any system call */
+    session = mqtt_broker->first_connected_session;
+    while (session != NULL)
+    {
+        if ((session->local_link != NULL) && (session->state != MQTT_BROKER_SESSION_STATE_CLOSED))
+        {
+            /* Send the output kept while the client was not reading, then the messages queued meanwhile */
+            if (ring_stream_flush(&session->local_link->broker_endpoint) && 
+                (session->state == MQTT_BROKER_SESSION_STATE_MQTT_CONNECTED) && (session->queue.sent != session->queue.count))
+            {
+                mqtt_broker_drain_queue(mqtt_broker, session);
+            }
+            if (session->state == MQTT_BROKER_SESSION_STATE_CLOSED)
+            {
+                /* Connection lost while draining the queue */
+            }
+            else if (ring_stream_is_readable(&session->local_link->broker_endpoint))
+            {
+                mqtt_broker_process_session(mqtt_broker, session);
+                activity = true;
+            }
+            else if (mqtt_errno_get() == MQTT_ERR_SOCKET_FAILED)
+            {
+                /* Connection closed by the client */
+                session->state = MQTT_BROKER_SESSION_STATE_CLOSED;
+            }
+            else
+            {
+                /* Nothing to do */
+            }
+        }
+        session = session->next;
+    }
+
+    return activity;
+}
+
+#ifdef MQTT_SOCKET_IO_URING_ENABLED
+
+/** \brief Process the events of the io_uring instance, returns true if something happened */
+static bool mqtt_broker_uring_process_events(mqtt_broker_t* const mqtt_broker)
+{
+    bool activity = false;
+    mqtt_broker_session_t* session;
+    mqtt_socket_uring_event_t event;
+
+    /* Process all the completed operations */
+    while (mqtt_socket_uring_get_event(&mqtt_broker->uring, &event))
+    {
+        activity = true;
+        switch (event.type)
+        {
+            case MQTT_SOCKET_URING_EVT_ACCEPT:
+            {
+                /* New client connected */
+                if (event.success)
+                {
+                    mqtt_broker_open_session(mqtt_broker, event.socket);
+                }
+                if (!event.more)
+                {
+                    (void)mqtt_socket_uring_accept(&mqtt_broker->uring, mqtt_broker->listen_socket);
+                }
+                break;
+            }
+
+            case MQTT_SOCKET_URING_EVT_RECEIVE:
+            {
+                /* Events of a closed connection are discarded but their buffer must be given back */
+                session = mqtt_broker_uring_get_session(mqtt_broker, event.tag);
+                if (session != NULL)
+                {
+                    if (event.success)
+                    {
+                        mqtt_broker_uring_receive(mqtt_broker, session, event.data, event.size);
+                        if (!event.more && (session->state != MQTT_BROKER_SESSION_STATE_CLOSED))
+                        {
+                            if (!mqtt_socket_uring_receive(&session->endpoint))
+                            {
+                                session->state = MQTT_BROKER_SESSION_STATE_CLOSED;
+                            }
+                        }
+                    }
+                    else
+                    {
+                        session->state = MQTT_BROKER_SESSION_STATE_CLOSED;
+                    }
+                }
+                (void)mqtt_socket_uring_release_buffer(&mqtt_broker->uring, &event);
+                break;
+            }
+
+            case MQTT_SOCKET_URING_EVT_SEND:
+            {
+                /* Send failure */
+                session = mqtt_broker_uring_get_session(mqtt_broker, event.tag);
+                if (session != NULL)
+                {
+                    session->state = MQTT_BROKER_SESSION_STATE_CLOSED;
+                }
+                break;
+            }
+
+            default:
+            {
+                /* Nothing to do */
+                break;
+            }
+        }
+    }
+
+    return activity;
+}
+
+/** \brief Get the session corresponding to the tag of an io_uring event */
+static mqtt_broker_session_t* mqtt_broker_uring_get_session(mqtt_broker_t* const mqtt_broker, const uint32_t tag)
+{
+    mqtt_broker_session_t* session = NULL;
+    const uint32_t index = (tag & MQTT_BROKER_MAX_CLIENT_LIMIT);
+
+    if (index < mqtt_broker->config.max_clients)
+    {
+        mqtt_broker_session_t* const tagged_session = &mqtt_broker->sessions[index];
+        if ((tagged_session->state != MQTT_BROKER_SESSION_STATE_NOT_INITIALIZED) && 
+            (tagged_session->state != MQTT_BROKER_SESSION_STATE_OFFLINE) && (tagged_session->local_link == NULL) &&
+            (tagged_session->endpoint.tag == tag))
+        {
+            session = tagged_session;
+        }
+    }
+
+    return session;
+}
+
+/** \brief Process the data received on a session through the io_uring instance */
+static void mqtt_broker_uring_receive(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session,
+                                      const uint8_t* const data, const size_t size)
+{
+    input_stream_t data_stream;
+
+    /* Rebuild the packets from the received data, a packet may span several receptions */
+    #ifdef MQTT_TRACE_ENABLED
+    if (session->trace.recorder != NULL)
+    {
+        (void)trace_stream_record(&session->trace, TRACE_STREAM_RECORD_INPUT, data, size);
+    }
+    #endif /* MQTT_TRACE_ENABLED */
+    (void)buffer_stream_input_from_buffer(&data_stream, (uint8_t*)data, size);
+    while ((data_stream.read < data_stream.size) && (session->state != MQTT_BROKER_SESSION_STATE_CLOSED))
+    {
+        const bool callret = mqtt_packet_deserialize_whole_packet(&session->whole_data, &data_stream, &session->packet_stream,
+                                                                  &session->packet_type, &session->packet_flags);
+        if (callret)
+        {
+            /* Process the complete packet */
+            (void)buffer_stream_input_from_buffer(&session->instream, session->packet_buffer, session->packet_stream.written);
+            mqtt_broker_process_packet(mqtt_broker, session, session->packet_type, session->packet_flags, (uint32_t)session->packet_stream.written);
+
+            /* Wait for the next packet */
+            (void)mqtt_packet_deserialize_init_whole_packet(&session->whole_data);
+            (void)session->packet_stream.reset(&session->packet_stream);
+        }
+        else if (mqtt_errno_get() != MQTT_ERR_IN_PROGRESS)
+        {
+            /* Invalid or too large packet */
+            session->state = MQTT_BROKER_SESSION_STATE_CLOSED;
+        }
+        else
+        {
+            /* Incomplete packet, wait for more data */
+        }
+    }
+}
+
+#endif /* MQTT_SOCKET_IO_URING_ENABLED */
+
+#ifdef MQTT_BROKER_SYS_ENABLED
+
+/** \brief Sum the counters of the broker and of its sessions */
+static void mqtt_broker_collect_stats(mqtt_broker_t* const mqtt_broker, mqtt_broker_stats_t* const stats)
+{
+    uint64_t now = 0u;
+    const mqtt_broker_session_t* session = mqtt_broker->first_connected_session;
+    const mqtt_broker_topic_t* topic = mqtt_broker->first_opened_topic;
+
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    /* Counters of the closed sessions */
+    (void)memcpy(stats, &mqtt_broker->closed_stats, sizeof(mqtt_broker_stats_t));
+    if (mqtt_broker->state == MQTT_BROKER_STATE_RUNNING)
+    {
+        (void)mqtt_time_get_current_64(&now);
+        stats->uptime = (now - mqtt_broker->start_time) / 1000u;
+    }
+    stats->clients_connected = mqtt_broker->clients_connected;
+    stats->clients_maximum = mqtt_broker->clients_maximum;
+
+    /* Counters of the opened sessions */
+    while (session != NULL)
+    {
+        mqtt_broker_add_session_stats(stats, session);
+        stats->inflight_messages += session->inflight_count;
+        stats->queued_messages += session->queue.count;
+        #ifdef MQTT_BROKER_SPILL_ENABLED
+        stats->queued_messages += session->spill->count;
+        #endif /* MQTT_BROKER_SPILL_ENABLED */
+        session = session->next;
+    }
+    session = mqtt_broker->first_offline_session;
+    while (session != NULL)
+    {
+        stats->queued_messages += session->queue.count;
+        #ifdef MQTT_BROKER_SPILL_ENABLED
+        stats->queued_messages += session->spill->count;
+        #endif /* MQTT_BROKER_SPILL_ENABLED */
+        session = session->next;
+    }
+
+    /* Subscriptions */
+    while (topic != NULL)
+    {
+        const mqtt_broker_subscription_t* subscription = topic->subscription;
+        while (subscription != NULL)
+        {
+            stats->subscriptions++;
+            subscription = subscription->next;
+        }
+        topic = topic->next;
+    }
+
+    /* Retained messages */
+    stats->retained_messages = 0u;
+    #ifdef MQTT_BROKER_RETAIN_ENABLED
+    if (mqtt_broker->retain.map.data != NULL)
+    {
+        stats->retained_messages = mqtt_broker->retain.header->count;
+    }
+    #endif /* MQTT_BROKER_RETAIN_ENABLED */
+}
+
+/** \brief Add the traffic counters of a session to the statistics */
+static void mqtt_broker_add_session_stats(mqtt_broker_stats_t* const stats, const mqtt_broker_session_t* const session)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    stats->publish_received += session->stats.publish_received;
+    stats->publish_sent += session->stats.publish_sent;
+    stats->publish_dropped += session->stats.publish_dropped;
+    stats->bytes_received += session->stats.bytes_received;
+
+    /* The output streams count the bytes written since the opening of the connection */
+    stats->bytes_sent += session->outstream.written;
+}
+
+/** \brief Publish the statistics under the $SYS/broker/ topics */
+static void mqtt_broker_publish_sys(mqtt_broker_t* const mqtt_broker)
+{
+    mqtt_broker_stats_t stats;
+    char value[64u];
+
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    /* Same layout as the other brokers so that the existing monitoring tools can be used */
+    mqtt_broker_collect_stats(mqtt_broker, &stats);
+    (void)snprintf(value, sizeof(value), "lw-mqtt version %s", lw_mqtt_lib_version());
+    mqtt_broker_publish_sys_string(mqtt_broker, "version", value);
+    (void)snprintf(value, sizeof(value), "%llu seconds", (unsigned long long)stats.uptime);
+    mqtt_broker_publish_sys_string(mqtt_broker, "uptime", value);
+    mqtt_broker_publish_sys_number(mqtt_broker, "clients/connected", stats.clients_connected);
+    mqtt_broker_publish_sys_number(mqtt_broker, "clients/maximum", stats.clients_maximum);
+    mqtt_broker_publish_sys_number(mqtt_broker, "publish/messages/received", stats.publish_received);
+    mqtt_broker_publish_sys_number(mqtt_broker, "publish/messages/sent", stats.publish_sent);
+    mqtt_broker_publish_sys_number(mqtt_broker, "publish/messages/dropped", stats.publish_dropped);
+    mqtt_broker_publish_sys_number(mqtt_broker, "bytes/received", stats.bytes_received);
+    mqtt_broker_publish_sys_number(mqtt_broker, "bytes/sent", stats.bytes_sent);
+    mqtt_broker_publish_sys_number(mqtt_broker, "subscriptions/count", stats.subscriptions);
+    mqtt_broker_publish_sys_number(mqtt_broker, "retained messages/count", stats.retained_messages);
+    mqtt_broker_publish_sys_number(mqtt_broker, "messages/inflight", stats.inflight_messages);
+    mqtt_broker_publish_sys_number(mqtt_broker, "store/messages/count", stats.queued_messages);
+}
+
+/** \brief Publish a number under a $SYS/broker/ topic */
+static void mqtt_broker_publish_sys_number(mqtt_broker_t* const mqtt_broker, const char* const name, const uint64_t value)
+{
+    char string_value[24u];
+
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    (void)snprintf(string_value, sizeof(string_value), "%llu", (unsigned long long)value);
+    mqtt_broker_publish_sys_string(mqtt_broker, name, string_value);
+}
+
+/** \brief Publish a string under a $SYS/broker/ topic */
+static void mqtt_broker_publish_sys_string(mqtt_broker_t* const mqtt_broker, const char* const name, const char* const value)
+{
+    char topic_buffer[64u];
+    mqtt_string_t topic;
+
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    /* QoS 0 : the values are published again at the next interval */
+    topic.str = topic_buffer;
+    topic.size = (uint16_t)snprintf(topic_buffer, sizeof(topic_buffer), "$SYS/broker/%s", name);
+    mqtt_broker_route(mqtt_broker, NULL, &topic, value, (uint32_t)strlen(value), 0u);
+}
+
+#endif /* MQTT_BROKER_SYS_ENABLED */
+
+#ifdef MQTT_BROKER_STORE_ENABLED
+
+/** \brief Append a change of a persistent session to the log of the store */
+static void mqtt_broker_log_change(mqtt_broker_t* const mqtt_broker, const mqtt_broker_session_t* const session, 
+                                   const mqtt_broker_store_record_type_t type, const mqtt_string_t* const topic, 
+                                   const void* const data, const uint32_t length, const uint8_t qos)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    if ((mqtt_broker->store.log != NULL) && session->persistent)
+    {
+        mqtt_broker_store_record_t record;
+        record.type = type;
+        record.qos = qos;
+        record.client_id.str = session->client_id.str;
+        record.client_id.size = session->client_id.size;
+        record.topic.str = ((topic != NULL) ? topic->str : NULL);
+        record.topic.size = ((topic != NULL) ? topic->size : 0u);
+        record.payload = (const uint8_t*)data;
+        record.length = length;
+        if (!mqtt_broker_store_append(&mqtt_broker->store, &record))
+        {
+            MQTT_LOG_ERROR("Unable to log a change of the session '%.*s' (error %d)", session->client_id.size, session->client_id.str, 
+                           mqtt_errno_get());
+        }
+
+        /* The first unsynced change starts the group commit delay */
+        if (mqtt_broker->store.unsynced == 1u)
+        {
+            (void)mqtt_timer_wheel_start(&mqtt_broker->timer_wheel, &mqtt_broker->store_timer, MQTT_BROKER_STORE_COMMIT_DELAY, false);
+        }
+    }
+}
+
+/** \brief Apply a record loaded from the store */
+static bool mqtt_broker_load_record(void* const param, const mqtt_broker_store_record_t* const record, const bool snapshot)
+{
+    bool ret = true;
+    mqtt_broker_t* const mqtt_broker = (mqtt_broker_t*)param;
+    mqtt_broker_session_t* session = NULL;
+    mqtt_string_t topic;
+
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    /* The sessions of the snapshot are unique */
+    if (!snapshot || (record->type != MQTT_BROKER_STORE_RECORD_SESSION))
+    {
+        session = mqtt_broker_find_session(mqtt_broker, record->client_id.str, record->client_id.size);
+    }
+    topic.str = (char*)record->topic.str;
+    topic.size = record->topic.size;
+    switch (record->type)
+    {
+        case MQTT_BROKER_STORE_RECORD_SESSION:
+        {
+            if (session == NULL)
+            {
+                session = mqtt_broker_new_offline_session(mqtt_broker, &record->client_id);
+                if (session == NULL)
+                {
+                    MQTT_LOG_ERROR("Unable to restore the session '%.*s' : too many clients or client id too long", 
+                                   record->client_id.size, record->client_id.str);
+                    ret = false;
+                }
+            }
+            if (session != NULL)
+            {
+                /* The expiration restarts when the store is loaded */
+                uint32_t i;
+                session->session_expiry_interval = ((record->length == 4u) ? 0u : MQTT_BROKER_SESSION_NEVER_EXPIRES);
+                for (i = 0u; (record->length == 4u) && (i < 4u); i++)
+                {
+                    session->session_expiry_interval |= (((uint32_t)record->payload[i]) << (8u * i));
+                }
+                mqtt_broker_start_expiry(mqtt_broker, session);
+            }
+            break;
+        }
+
+        case MQTT_BROKER_STORE_RECORD_SESSION_END:
+        {
+            if (session != NULL)
+            {
+                mqtt_broker_discard_session(mqtt_broker, session);
+            }
+            break;
+        }
+
+        case MQTT_BROKER_STORE_RECORD_SUBSCRIBE:
+        {
+            if ((session != NULL) && 
+                (mqtt_broker_add_subscription(mqtt_broker, session, &topic, record->qos & MQTT_SUBSCRIBE_OPTION_QOS, 
+                                              record->qos & (uint8_t)(~MQTT_SUBSCRIBE_OPTION_QOS), !snapshot) == MQTT_FAILURE_QOS))
+            {
+                MQTT_LOG_ERROR("Unable to restore the subscription '%.*s' of the session '%.*s'", topic.size, topic.str, 
+                               session->client_id.size, session->client_id.str);
+                ret = false;
+            }
+            break;
+        }
+
+        case MQTT_BROKER_STORE_RECORD_UNSUBSCRIBE:
+        {
+            if (session != NULL)
+            {
+                (void)mqtt_broker_remove_subscription(mqtt_broker, session, &topic);
+            }
+            break;
+        }
+
+        case MQTT_BROKER_STORE_RECORD_QUEUE:
+        {
+            /* A message which doesn't fit anymore in a smaller queue is dropped as it would have been */
+            if (session != NULL)
+            {
+                (void)mqtt_broker_queue_push(&session->queue, &topic, record->payload, record->length, record->qos);
+            }
+            break;
+        }
+
+        case MQTT_BROKER_STORE_RECORD_DEQUEUE:
+        {
+            if (session != NULL)
+            {
+                (void)mqtt_broker_queue_pop(&session->queue);
+            }
+            break;
+        }
+
+        default:
+        {
+            /* Ignore record */
+            break;
+        }
+    }
+
+    return ret;
+}
+
+/** \brief Create a persistent session loaded from the store */
+static mqtt_broker_session_t* mqtt_broker_new_offline_session(mqtt_broker_t* const mqtt_broker, const mqtt_const_string_t* const client_id)
+{
+    mqtt_broker_session_t* session = NULL;
+
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    if ((mqtt_broker->first_free_session != NULL) && 
+        (client_id->size != 0u) && (client_id->size <= mqtt_broker->config.max_client_id_length))
+    {
+        /* Initialize session, it stays disconnected until its client connects again */
+        session = mqtt_broker->first_free_session;
+        mqtt_broker->first_free_session = session->next;
+        session->state = MQTT_BROKER_SESSION_STATE_OFFLINE;
+        session->local_link = NULL;
+        #ifdef MQTT_TRACE_ENABLED
+        session->trace.recorder = NULL;
+        #endif /* MQTT_TRACE_ENABLED */
+        (void)memcpy(session->client_id_topic_buffer, client_id->str, client_id->size);
+        session->client_id.str = session->client_id_topic_buffer;
+        session->client_id.size = client_id->size;
+        session->has_will = false;
+        #ifdef MQTT_BROKER_SYS_ENABLED
+        (void)memset(&session->stats, 0, sizeof(mqtt_broker_session_stats_t));
+        #endif /* MQTT_BROKER_SYS_ENABLED */
+        session->packet_id = 1u;
+        session->inflight_count = 0u;
+        session->persistent = true;
+        session->first_subscription = NULL;
+        #ifdef MQTT_BROKER_RETAIN_ENABLED
+        session->retained_subscription = NULL;
+        #endif /* MQTT_BROKER_RETAIN_ENABLED */
+        session->next_hash = NULL;
+        mqtt_broker_clear_queue(mqtt_broker, session);
+        mqtt_broker_hash_session(mqtt_broker, session);
+
+        /* Add to the offline sessions */
+        session->next = mqtt_broker->first_offline_session;
+        mqtt_broker->first_offline_session = session;
+    }
+
+    return session;
+}
+
+/** \brief Write the persistent sessions to a new snapshot of the store */
+static bool mqtt_broker_write_snapshot(mqtt_broker_t* const mqtt_broker)
+{
+    bool ret;
+
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    ret = mqtt_broker_store_begin_snapshot(&mqtt_broker->store);
+    if (ret)
+    {
+        uint32_t i;
+        mqtt_broker_session_t* const lists[2u] = { mqtt_broker->first_connected_session, mqtt_broker->first_offline_session };
+        for (i = 0u; ret && (i < 2u); i++)
+        {
+            const mqtt_broker_session_t* session = lists[i];
+            while (ret && (session != NULL))
+            {
+                if (session->persistent)
+                {
+                    const mqtt_broker_subscription_t* subscription = session->first_subscription;
+                    uint32_t position = 0u;
+                    mqtt_broker_queue_message_t message;
+                    mqtt_broker_store_record_t record;
+                    uint8_t expiry[4u];
+                    uint32_t j;
+
+                    /* Session */
+                    for (j = 0u; j < sizeof(expiry); j++)
+                    {
+                        expiry[j] = (uint8_t)((session->session_expiry_interval >> (8u * j)) & 0xFFu);
+                    }
+                    (void)memset(&record, 0, sizeof(record));
+                    record.type = MQTT_BROKER_STORE_RECORD_SESSION;
+                    record.client_id.str = session->client_id.str;
+                    record.client_id.size = session->client_id.size;
+                    record.payload = expiry;
+                    record.length = sizeof(expiry);
+                    ret = mqtt_broker_store_write_snapshot(&mqtt_broker->store, &record);
+                    record.payload = NULL;
+                    record.length = 0u;
+
+                    /* Subscriptions */
+                    record.type = MQTT_BROKER_STORE_RECORD_SUBSCRIBE;
+                    while (ret && (subscription != NULL))
+                    {
+                        record.qos = subscription->qos | (subscription->no_local ? MQTT_SUBSCRIBE_OPTION_NO_LOCAL : 0u);
+                        record.topic.str = subscription->topic->topic.str;
+                        record.topic.size = subscription->topic->topic.size;
+                        ret = mqtt_broker_store_write_snapshot(&mqtt_broker->store, &record);
+                        subscription = subscription->next_session;
+                    }
+
+                    /* Queued messages, oldest first */
+                    record.type = MQTT_BROKER_STORE_RECORD_QUEUE;
+                    message.topic.str = mqtt_broker->topic_buffer;
+                    message.topic.size = mqtt_broker->config.max_topic_length;
+                    message.payload = mqtt_broker->payload_buffer;
+                    message.length = mqtt_broker->config.max_payload_size;
+                    while (ret && mqtt_broker_queue_peek(&session->queue, &position, &message))
+                    {
+                        record.qos = message.qos;
+                        record.topic.str = message.topic.str;
+                        record.topic.size = message.topic.size;
+                        record.payload = message.payload;
+                        record.length = message.length;
+                        ret = mqtt_broker_store_write_snapshot(&mqtt_broker->store, &record);
+                        message.topic.size = mqtt_broker->config.max_topic_length;
+                        message.length = mqtt_broker->config.max_payload_size;
+                    }
+                }
+                session = session->next;
+            }
+        }
+        ret = mqtt_broker_store_end_snapshot(&mqtt_broker->store, ret) && ret;
+    }
+    if (!ret)
+    {
+        MQTT_LOG_ERROR("Unable to write a snapshot of the store (error %d)", mqtt_errno_get());
+    }
+
+    return ret;
+}
+
+/** \brief Sync the log of the store and replace it by a snapshot once it has grown enough */
+static void mqtt_broker_sync_store(mqtt_broker_t* const mqtt_broker)
+{
+    bool needed = false;
+
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    if (mqtt_broker->store.log != NULL)
+    {
+        if (!mqtt_broker_store_sync(&mqtt_broker->store))
+        {
+            MQTT_LOG_ERROR("Unable to sync the log of the store (error %d)", mqtt_errno_get());
+        }
+        (void)mqtt_broker_store_needs_snapshot(&mqtt_broker->store, &needed);
+        if (needed)
+        {
+            (void)mqtt_broker_write_snapshot(mqtt_broker);
+        }
+    }
+}
+
+/** \brief Group commit of the store */
+static void mqtt_broker_store_timer_expired(mqtt_timer_wheel_timer_t* const timer, void* const param)
+{
+    (void)timer;
+    mqtt_broker_sync_store((mqtt_broker_t*)param);
+}
+
+#endif /* MQTT_BROKER_STORE_ENABLED */
+
+#ifdef MQTT_BROKER_RETAIN_ENABLED
+
+/** \brief Update the retained message of a topic */
+static void mqtt_broker_retain_message(mqtt_broker_t* const mqtt_broker, const mqtt_string_t* const topic, const void* const data, 
+                                       const uint32_t length, const uint8_t qos)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    if (mqtt_broker->retain.map.data != NULL)
+    {
+        if (mqtt_broker_retain_set(&mqtt_broker->retain, topic, data, length, qos))
+        {
+            /* The first change starts the sync delay */
+            if (!mqtt_broker->retain_dirty)
+            {
+                mqtt_broker->retain_dirty = true;
+                (void)mqtt_timer_wheel_start(&mqtt_broker->timer_wheel, &mqtt_broker->retain_timer, MQTT_BROKER_RETAIN_SYNC_DELAY, false);
+            }
+        }
+        else
+        {
+            MQTT_LOG_ERROR("Unable to retain the message of the topic '%.*s' (error %d)", topic->size, topic->str, mqtt_errno_get());
+        }
+    }
+}
+
+/** \brief Send the retained messages matching a new subscription, the retained store is scanned by batches for a wildcard subscription */
+static void mqtt_broker_send_retained(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session, 
+                                      const mqtt_string_t* const topic_filter, const uint8_t granted_qos)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    if (mqtt_broker->retain.map.data == NULL)
+    {
+        /* No retained messages */
+    }
+    else if ((memchr(topic_filter->str, '+', topic_filter->size) == NULL) && (memchr(topic_filter->str, '#', topic_filter->size) == NULL))
+    {
+        /* A single topic matches : direct lookup in the index, the message is sent from the mapped file without copy */
+        mqtt_broker_retain_message_t message;
+        if (mqtt_broker_retain_get(&mqtt_broker->retain, topic_filter, &message))
+        {
+            const uint8_t qos = ((message.qos < granted_qos) ? message.qos : granted_qos);
+            (void)mqtt_broker_forward(session, topic_filter, message.payload, message.length, qos, true, false, 
+                                      ((qos > 0u) ? mqtt_broker_next_packet_id(session) : 0u));
+        }
+    }
+    else
+    {
+        const mqtt_broker_topic_t* const topic = mqtt_broker_find_topic(mqtt_broker, topic_filter->str, topic_filter->size);
+        mqtt_broker_subscription_t* subscription = ((topic != NULL) ? topic->subscription : NULL);
+        while ((subscription != NULL) && (subscription->session != session))
+        {
+            subscription = subscription->next;
+        }
+
+        /* Only one wildcard subscription is scanned at a time : the scan of the previous one is completed
+           first, without the messages which the client doesn't accept now */
+        if (session->retained_subscription != NULL)
+        {
+            mqtt_broker_scan_retained(mqtt_broker, session, UINT32_MAX);
+        }
+
+        /* The task sends the matching messages by batches */
+        session->retained_subscription = subscription;
+        session->retained_position = 0u;
+    }
+}
+
+/** \brief Send the retained messages matching the wildcard subscription of a session from a batch of retained messages */
+static void mqtt_broker_scan_retained(mqtt_broker_t* const mqtt_broker, mqtt_broker_session_t* const session, const uint32_t batch_size)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    const mqtt_broker_subscription_t* const subscription = session->retained_subscription;
+    mqtt_string_t topic_filter;
+    uint32_t count = 0u;
+    bool done = (mqtt_broker->retain.map.data == NULL);
+    bool wait = false;
+    topic_filter.str = subscription->topic->filter.str;
+    topic_filter.size = subscription->topic->filter.size;
+
+    /* The messages are sent from the mapped file without copy, the scan waits while the client doesn't accept more messages */
+    while (!done && !wait && (count < batch_size))
+    {
+        uint32_t position = session->retained_position;
+        mqtt_broker_retain_message_t message;
+        if (!mqtt_broker_retain_next(&mqtt_broker->retain, &position, &message))
+        {
+            done = true;
+        }
+        else
+        {
+            mqtt_string_t topic;
+            topic.str = (char*)message.topic.str;
+            topic.size = message.topic.size;
+            if (mqtt_broker_topic_match(&topic_filter, &topic))
+            {
+                const uint8_t qos = ((message.qos < subscription->qos) ? message.qos : subscription->qos);
+                wait = (((qos > 0u) && (session->inflight_count >= session->receive_maximum)) ||
+                        !mqtt_broker_can_send(session, &topic, message.length, qos));
+                if (!wait)
+                {
+                    (void)mqtt_broker_forward(session, &topic, message.payload, message.length, qos, true, false, 
+                                              ((qos > 0u) ? mqtt_broker_next_packet_id(session) : 0u));
+                    done = (session->state == MQTT_BROKER_SESSION_STATE_CLOSED);
+                }
+            }
+            if (!wait)
+            {
+                session->retained_position = position;
+            }
+        }
+        count++;
+    }
+    if (done)
+    {
+        session->retained_subscription = NULL;
+    }
+}
+
+/** \brief Sync of the retained store */
+static void mqtt_broker_retain_timer_expired(mqtt_timer_wheel_timer_t* const timer, void* const param)
+{
+    mqtt_broker_t* const mqtt_broker = (mqtt_broker_t*)param;
+    (void)timer;
+
+    mqtt_broker->retain_dirty = false;
+    if (!mqtt_broker_retain_sync(&mqtt_broker->retain))
+    {
+        MQTT_LOG_ERROR("Unable to sync the retained store (error %d)", mqtt_errno_get());
+    }
+}
+
+#endif /* MQTT_BROKER_RETAIN_ENABLED */
+
+#ifdef MQTT_BROKER_SPILL_ENABLED
+
+/** \brief Queue the messages read back from the disk spill */
+static void mqtt_broker_refill_queues(mqtt_broker_t* const mqtt_broker)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    bool received = true;
+    while (received)
+    {
+        mqtt_broker_spill_stream_t* stream = NULL;
+        mqtt_broker_queue_message_t message;
+        message.topic.str = mqtt_broker->topic_buffer;
+        message.topic.size = mqtt_broker->config.max_topic_length;
+        message.payload = mqtt_broker->payload_buffer;
+        message.length = mqtt_broker->config.max_payload_size;
+        received = mqtt_broker_spill_receive(&mqtt_broker->spill, &stream, &message);
+        if (received)
+        {
+            /* The refill requests only ask for the messages which fit in the queue */
+            mqtt_broker_session_t* const session = (mqtt_broker_session_t*)stream->owner;
+            if (mqtt_broker_queue_push(&session->queue, &message.topic, message.payload, message.length, message.qos))
+            {
+                #ifdef MQTT_BROKER_STORE_ENABLED
+                mqtt_broker_log_change(mqtt_broker, session, MQTT_BROKER_STORE_RECORD_QUEUE, &message.topic, message.payload, 
+                                       message.length, message.qos);
+                #endif /* MQTT_BROKER_STORE_ENABLED */
+            }
+            else
+            {
+                #ifdef MQTT_BROKER_SYS_ENABLED
+                session->stats.publish_dropped++;
+                #endif /* MQTT_BROKER_SYS_ENABLED */
+            }
+        }
+    }
+}
+
+#endif /* MQTT_BROKER_SPILL_ENABLED */
+
+#ifdef MQTT_BROKER_BRIDGE_ENABLED
+
+/** \brief Forward a local message to the remote broker if it matches an outbound rule of the bridge */
+static void mqtt_broker_bridge_message(mqtt_broker_t* const mqtt_broker, const mqtt_string_t* const topic, const void* const data, 
+                                       const uint32_t length, const uint8_t qos)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    /* The message is forwarded once with the QoS of the first matching rule */
+    uint32_t i;
+    bool forwarded = false;
+    mqtt_broker_bridge_t* const bridge = &mqtt_broker->bridge;
+    if (bridge->state != MQTT_BROKER_BRIDGE_STATE_CLOSED)
+    {
+        for (i = 0u; (i < bridge->rule_count) && !forwarded; i++)
+        {
+            const mqtt_broker_bridge_rule_t* const rule = &bridge->rules[i];
+            if (((rule->direction & MQTT_BROKER_BRIDGE_OUT) != 0u) && mqtt_broker_topic_match(&rule->filter, topic))
+            {
+                const uint8_t forward_qos = ((qos < rule->qos) ? qos : rule->qos);
+                (void)mqtt_broker_bridge_forward(bridge, topic, data, length, forward_qos);
+                forwarded = true;
+            }
+        }
+    }
+}
+
+/** \brief Route the messages received from the remote broker */
+static bool mqtt_broker_process_bridge(mqtt_broker_t* const mqtt_broker)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    /* The remote messages are only routed to the local subscribers and never forwarded back */
+    bool activity = false;
+    bool received = true;
+    while (received)
+    {
+        mqtt_broker_queue_message_t message;
+        message.topic.str = mqtt_broker->topic_buffer;
+        message.topic.size = mqtt_broker->config.max_topic_length;
+        message.payload = mqtt_broker->payload_buffer;
+        message.length = mqtt_broker->config.max_payload_size;
+        received = mqtt_broker_bridge_receive(&mqtt_broker->bridge, &message);
+        if (received)
+        {
+            mqtt_broker_route(mqtt_broker, NULL, &message.topic, message.payload, message.length, message.qos);
+            activity = true;
+        }
+    }
+
+    return activity;
+}
+
+#endif /* MQTT_BROKER_BRIDGE_ENABLED */
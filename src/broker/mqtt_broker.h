@@ -23,9 +23,19 @@ along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
 #include "stdheaders.h"
 #include "mqtt.h"
 #include "mqtt_socket.h"
-#include "mqtt_timer.h"
+#include "mqtt_timer_wheel.h"
 #include "mqtt_mutex.h"
 #include "socket_stream.h"
+#include "uring_stream.h"
+#include "ring_stream.h"
+#include "trace_stream.h"
+#include "mqtt_packet_deserialize.h"
+#include "mqtt_arena.h"
+#include "mqtt_broker_queue.h"
+#include "mqtt_broker_store.h"
+#include "mqtt_broker_retain.h"
+#include "mqtt_broker_spill.h"
+#include "mqtt_broker_bridge.h"
 
 #ifdef __cplusplus
 extern "C"
@@ -33,6 +43,13 @@ extern "C"
 #endif /* __cplusplus */
 
 
+/** \brief Upper bound for the maximum number of clients of the MQTT broker (the session index is stored on 24 bits in the io_uring tags) */
+#define MQTT_BROKER_MAX_CLIENT_LIMIT    0x00FFFFFFu
+
+/** \brief Session expiry interval of the sessions which never expire */
+#define MQTT_BROKER_SESSION_NEVER_EXPIRES   0xFFFFFFFFu
+
+
 /** \brief Pre-declaration of mqtt_broker_t structure which represents a MQTT broker */
 typedef struct _mqtt_broker_t mqtt_broker_t;
 
@@ -51,9 +68,109 @@ typedef enum _mqtt_broker_session_state_t
     MQTT_BROKER_SESSION_STATE_NOT_INITIALIZED = 0u,
     MQTT_BROKER_SESSION_STATE_TCP_CONNECTED = 1u,
     MQTT_BROKER_SESSION_STATE_MQTT_CONNECTED = 2u,
-    MQTT_BROKER_SESSION_STATE_CLOSED = 3u
+    MQTT_BROKER_SESSION_STATE_CLOSED = 3u,
+    MQTT_BROKER_SESSION_STATE_OFFLINE = 4u
 } mqtt_broker_session_state_t;
 
+/** \brief Topic alias received from a client (MQTT 5.0 only) */
+typedef struct _mqtt_broker_topic_alias_t
+{
+    /** \brief Length of the aliased topic, 0 if the alias is not used */
+    uint16_t length;
+    /** \brief Aliased topic */
+    char* topic;
+} mqtt_broker_topic_alias_t;
+
+/** \brief Runtime limits of the MQTT broker, the tables and the buffers are carved from the arena */
+typedef struct _mqtt_broker_config_t
+{
+    /** \brief Maximum number of simultaneous clients */
+    uint32_t max_clients;
+    /** \brief Maximum number of topics */
+    uint32_t max_topics;
+    /** \brief Maximum number of subscriptions on topics */
+    uint32_t max_subscriptions;
+    /** \brief Maximum length in bytes of a topic string */
+    uint16_t max_topic_length;
+    /** \brief Maximum length in byte of the payload of a PUBLISH message */
+    uint32_t max_payload_size;
+    /** \brief Maximum length in bytes of a client id string, at least MQTT_BROKER_MIN_CLIENT_ID_LENGTH */
+    uint16_t max_client_id_length;
+    /** \brief Maximum length in bytes of a will topic string */
+    uint16_t max_will_topic_length;
+    /** \brief Maximum length in byte of a will message */
+    uint16_t max_will_message_size;
+    /** \brief Maximum number of topic aliases per client (MQTT 5.0 only), each alias keeps a topic of max_topic_length bytes */
+    uint16_t max_topic_aliases;
+    /** \brief Maximum number of unacknowledged QoS 1 and QoS 2 PUBLISH packets per client (MQTT 5.0 only) */
+    uint16_t receive_maximum;
+    /** \brief Size in bytes of the queue of the QoS 1 and QoS 2 messages waiting to be sent to each client, 0 to disable the queues */
+    uint32_t max_queue_size;
+    /** \brief Size in bytes of the output kept for each client of an in-process link while the client doesn't read its ring buffer */
+    uint32_t local_output_size;
+    /** \brief Maximum session expiry interval in seconds granted to the clients, also used for the MQTT 3.1.1 persistent sessions
+               (MQTT_BROKER_SESSION_NEVER_EXPIRES : no limit) */
+    uint32_t max_session_expiry;
+    #ifdef MQTT_BROKER_SPILL_ENABLED
+    /** \brief Size in bytes of each of the two rings between the broker task and the spill thread (power of 2), 0 to disable the spill */
+    uint32_t spill_ring_size;
+    #endif /* MQTT_BROKER_SPILL_ENABLED */
+    #ifdef MQTT_BROKER_BRIDGE_ENABLED
+    /** \brief Size in bytes of the batch of the packets sent to the remote broker in a single write */
+    uint32_t bridge_batch_size;
+    /** \brief Size in bytes of the queue of the QoS 1 messages forwarded to the remote broker, 0 to disable the bridge */
+    uint32_t bridge_queue_size;
+    #endif /* MQTT_BROKER_BRIDGE_ENABLED */
+    /** \brief Memory area aligned on MQTT_ARENA_ALIGNMENT bytes, its size is given by mqtt_broker_get_arena_size() */
+    void* arena;
+    /** \brief Size in bytes of the memory area */
+    size_t arena_size;
+} mqtt_broker_config_t;
+
+/** \brief Traffic counters of a session, only updated by the broker task and summed when the statistics are read */
+typedef struct _mqtt_broker_session_stats_t
+{
+    /** \brief Number of PUBLISH packets received from the client */
+    uint64_t publish_received;
+    /** \brief Number of PUBLISH packets sent to the client */
+    uint64_t publish_sent;
+    /** \brief Number of PUBLISH packets which couldn't be sent to the client */
+    uint64_t publish_dropped;
+    /** \brief Number of bytes received from the client */
+    uint64_t bytes_received;
+    /** \brief Indicate if the client is counted in the connected clients */
+    bool connected;
+} mqtt_broker_session_stats_t;
+
+/** \brief Statistics of the MQTT broker */
+typedef struct _mqtt_broker_stats_t
+{
+    /** \brief Time in s since the broker has been started */
+    uint64_t uptime;
+    /** \brief Number of connected clients */
+    uint32_t clients_connected;
+    /** \brief Maximum number of clients connected at the same time */
+    uint32_t clients_maximum;
+    /** \brief Number of PUBLISH packets received from the clients */
+    uint64_t publish_received;
+    /** \brief Number of PUBLISH packets sent to the clients */
+    uint64_t publish_sent;
+    /** \brief Number of PUBLISH packets which couldn't be sent to a subscriber (client limits or connection lost) */
+    uint64_t publish_dropped;
+    /** \brief Number of bytes received from the clients */
+    uint64_t bytes_received;
+    /** \brief Number of bytes sent to the clients */
+    uint64_t bytes_sent;
+    /** \brief Number of subscriptions */
+    uint32_t subscriptions;
+    /** \brief Number of retained messages */
+    uint32_t retained_messages;
+    /** \brief Number of QoS 1 and QoS 2 PUBLISH packets waiting for an acknowledgement from the clients */
+    uint32_t inflight_messages;
+    /** \brief Number of QoS 1 and QoS 2 messages queued for the clients */
+    uint32_t queued_messages;
+} mqtt_broker_stats_t;
+
 /** \brief MQTT broker session */
 typedef struct _mqtt_broker_session_t
 {
@@ -63,6 +180,12 @@ typedef struct _mqtt_broker_session_t
     /** \brief Socket */
     mqtt_socket_t socket;
 
+    /** \brief In-process link used instead of the socket (NULL if not used) */
+    ring_stream_link_t* local_link;
+
+    /** \brief Output kept while the client of the in-process link doesn't read its ring buffer */
+    uint8_t* local_output;
+
     /** \brief Output stream */
     output_stream_t outstream;
 
@@ -73,19 +196,123 @@ typedef struct _mqtt_broker_session_t
     mqtt_string_t client_id;
 
     /** \brief Buffer for the client id string */
-    char client_id_topic_buffer[MQTT_BROKER_MAX_CLIENT_ID_LENGTH];
+    char* client_id_topic_buffer;
 
     /** \brief Will */
     mqtt_will_t will;
 
     /** \brief Buffer for the will topic name string */
-    char will_topic_buffer[MQTT_BROKER_MAX_WILL_TOPIC_LENGTH];
+    char* will_topic_buffer;
 
     /** \brief Buffer for the will message */
-    uint8_t will_message_buffer[MQTT_BROKER_MAX_WILL_MESSAGE_SIZE];
+    uint8_t* will_message_buffer;
+
+    /** \brief Indicate if the will message must be sent when the session is closed */
+    bool has_will;
+
+    /** \brief Keep alive in sec */
+    uint16_t keepalive;
+
+    /** \brief Keepalive timer, also used for the CONNECT timeout */
+    mqtt_timer_wheel_timer_t keepalive_timer;
+
+    /** \brief Protocol level : MQTT_PROTOCOL_LEVEL_V311 or MQTT_PROTOCOL_LEVEL_V5 */
+    uint8_t protocol_level;
+
+    /** \brief Packet id for the PUBLISH packets sent to the client */
+    uint16_t packet_id;
+
+    /** \brief Number of QoS 1 and QoS 2 PUBLISH packets waiting for an acknowledgement from the client */
+    uint16_t inflight_count;
+
+    /** \brief Client's receive maximum (MQTT 5.0 only) */
+    uint16_t receive_maximum;
+
+    /** \brief Client's maximum packet size (MQTT 5.0 only) */
+    uint32_t maximum_packet_size;
+
+    /** \brief Topic aliases defined by the client (MQTT 5.0 only) */
+    mqtt_broker_topic_alias_t* topic_aliases;
+
+    /** \brief Indicate if the session is kept when the client disconnects (clean session flag not set) */
+    bool persistent;
+
+    /** \brief Session expiry interval in seconds once the client is disconnected (MQTT_BROKER_SESSION_NEVER_EXPIRES : never) */
+    uint32_t session_expiry_interval;
+
+    /** \brief Time in ms at which the session expires while its client is disconnected */
+    uint64_t expiry_time;
+
+    /** \brief Messages waiting to be sent to the client */
+    mqtt_broker_queue_t queue;
+
+    #ifdef MQTT_BROKER_SPILL_ENABLED
+
+    /** \brief Messages spilled to the disk when the queue is full, moved with the queue */
+    mqtt_broker_spill_stream_t* spill;
+
+    #endif /* MQTT_BROKER_SPILL_ENABLED */
+
+    /** \brief First subscription of the session */
+    struct _mqtt_broker_subscription_t* first_subscription;
+
+    #ifdef MQTT_BROKER_RETAIN_ENABLED
+
+    /** \brief Wildcard subscription whose retained messages are being sent by batches (NULL if none) */
+    struct _mqtt_broker_subscription_t* retained_subscription;
+
+    /** \brief Position in the retained store of the next message to check for the wildcard subscription */
+    uint32_t retained_position;
+
+    #endif /* MQTT_BROKER_RETAIN_ENABLED */
+
+    /** \brief Next session in the same bucket of the client id index */
+    struct _mqtt_broker_session_t* next_hash;
+
+    #ifdef MQTT_SOCKET_IO_URING_ENABLED
+
+    /** \brief Socket managed by the io_uring instance of the broker */
+    mqtt_socket_uring_endpoint_t endpoint;
+
+    /** \brief Incremented each time the session is reused to discard the events of the previous connection */
+    uint8_t generation;
+
+    /** \brief State of the packet being received */
+    mqtt_deserialize_whole_data_t whole_data;
+
+    /** \brief Type of the packet being received */
+    mqtt_control_packet_type_t packet_type;
+
+    /** \brief Flags of the packet being received */
+    uint8_t packet_flags;
 
-    /** \brief Keepalive timer */
-    mqtt_timer_t keepalive_timer;
+    /** \brief Output stream to store the packet being received */
+    output_stream_t packet_stream;
+
+    /** \brief Buffer for the packet being received */
+    uint8_t* packet_buffer;
+
+    #endif /* MQTT_SOCKET_IO_URING_ENABLED */
+
+    #ifdef MQTT_TRACE_ENABLED
+
+    /** \brief Trace of the connection */
+    trace_stream_t trace;
+
+    /** \brief Output stream of the transport while the connection is traced */
+    output_stream_t traced_outstream;
+
+    /** \brief Input stream of the transport while the connection is traced */
+    input_stream_t traced_instream;
+
+    #endif /* MQTT_TRACE_ENABLED */
+
+    #ifdef MQTT_BROKER_SYS_ENABLED
+
+    /** \brief Traffic counters */
+    mqtt_broker_session_stats_t stats;
+
+    #endif /* MQTT_BROKER_SYS_ENABLED */
 
     /** \brief Next session in the list */
     struct _mqtt_broker_session_t* next;
@@ -98,9 +325,30 @@ typedef struct _mqtt_broker_subscription_t
     /** \brief QoS */
     uint8_t qos;
 
+    /** \brief Indicate if the messages published by the session are not sent back to it (MQTT 5.0 No Local option) */
+    bool no_local;
+
     /** \brief Session */
     mqtt_broker_session_t* session;
 
+    /** \brief Topic filter */
+    struct _mqtt_broker_topic_t* topic;
+
+    /** \brief Previous subscription of the session */
+    struct _mqtt_broker_subscription_t* previous_session;
+
+    /** \brief Next subscription of the session */
+    struct _mqtt_broker_subscription_t* next_session;
+
+    /** \brief Next subscription in the list, kept while the subscription is retired for the lock-free readers */
+    struct _mqtt_broker_subscription_t* volatile next;
+
+    /** \brief Epoch at which the subscription has been removed from its topic */
+    uint32_t retire_epoch;
+
+    /** \brief Next retired subscription */
+    struct _mqtt_broker_subscription_t* next_retired;
+
 } mqtt_broker_subscription_t;
 
 /** \brief Topic on the broker */
@@ -110,19 +358,46 @@ typedef struct _mqtt_broker_topic_t
     mqtt_string_t topic;
 
     /** \brief Buffer for the topic name string */
-    char topic_buffer[MQTT_BROKER_MAX_TOPIC_LENGTH];
+    char* topic_buffer;
 
     /** \brief First subscription on this topic */
-    mqtt_broker_subscription_t* subscription;
+    mqtt_broker_subscription_t* volatile subscription;
+
+    /** \brief Topic filter matched against the published topics, without the $share/<group>/ prefix of a shared subscription */
+    mqtt_string_t filter;
+
+    /** \brief Indicate if the topic is a shared subscription : each message goes to a single member of the group */
+    bool shared;
 
-    /** \brief Next topic in the list */
-    struct _mqtt_broker_topic_t* next;
+    /** \brief Member of the shared subscription to look at first for the next message (NULL = first subscription) */
+    mqtt_broker_subscription_t* next_shared;
+
+    /** \brief Next topic in the list, kept while the topic is retired for the lock-free readers */
+    struct _mqtt_broker_topic_t* volatile next;
+
+    /** \brief Previous topic in the list (only used by the broker task) */
+    struct _mqtt_broker_topic_t* previous;
+
+    /** \brief Next topic in the same bucket of the topic filter index */
+    struct _mqtt_broker_topic_t* next_hash;
+
+    /** \brief Epoch at which the topic has been removed from the opened topics */
+    uint32_t retire_epoch;
+
+    /** \brief Next retired topic */
+    struct _mqtt_broker_topic_t* next_retired;
 
 } mqtt_broker_topic_t;
 
 /** \brief MQTT broker */
 typedef struct _mqtt_broker_t
 {
+    /** \brief Runtime limits */
+    mqtt_broker_config_t config;
+
+    /** \brief Maximum size in bytes of a packet received by the broker */
+    uint32_t max_packet_size;
+
     /** \brief Credentials */
     mqtt_const_credentials_t credentials;
 
@@ -132,8 +407,11 @@ typedef struct _mqtt_broker_t
     /** \brief Socket to listen to incomming connections */
     mqtt_socket_t listen_socket;
 
+    /** \brief Tuning options applied to the listen socket and to the accepted sockets */
+    mqtt_socket_options_t socket_options;
+
     /** \brief Session data for the connected clients */
-    mqtt_broker_session_t sessions[MQTT_BROKER_MAX_CLIENT];
+    mqtt_broker_session_t* sessions;
 
     /** \brief First free session */
     mqtt_broker_session_t* first_free_session;
@@ -141,26 +419,77 @@ typedef struct _mqtt_broker_t
     /** \brief First connected session */
     mqtt_broker_session_t* first_connected_session;
 
+    /** \brief First persistent session whose client is disconnected, the most recently disconnected first */
+    mqtt_broker_session_t* first_offline_session;
+
+    /** \brief Timer of the next expiration of a persistent session whose client is disconnected */
+    mqtt_timer_wheel_timer_t expiry_timer;
+
+    /** \brief Time in ms of the next expiration of a persistent session whose client is disconnected (UINT64_MAX if none) */
+    uint64_t next_expiry_time;
+
+    /** \brief Index of the sessions by client id */
+    mqtt_broker_session_t** session_hash;
+
+    /** \brief Mask of the number of buckets of the client id index */
+    uint32_t session_hash_mask;
+
     /** \brief MQTT topics */
-    mqtt_broker_topic_t topics[MQTT_BROKER_MAX_TOPIC_COUNT];
+    mqtt_broker_topic_t* topics;
 
     /** \brief First free topic */
     mqtt_broker_topic_t* first_free_topic;
 
     /** \brief First opened */
-    mqtt_broker_topic_t* first_opened_topic;
+    mqtt_broker_topic_t* volatile first_opened_topic;
+
+    /** \brief First topic removed but still visible to the lock-free readers */
+    mqtt_broker_topic_t* first_retired_topic;
+
+    /** \brief Index of the opened topics by topic filter */
+    mqtt_broker_topic_t** topic_hash;
+
+    /** \brief Mask of the number of buckets of the topic filter index */
+    uint32_t topic_hash_mask;
 
     /** \brief Subscriptions */
-    mqtt_broker_subscription_t subscriptions[MQTT_BROKER_MAX_SUBSCRIPTION_COUNT];
+    mqtt_broker_subscription_t* subscriptions;
+
+    /** \brief First free subscription */
+    mqtt_broker_subscription_t* first_free_subscription;
+
+    /** \brief First subscription removed but still visible to the lock-free readers */
+    mqtt_broker_subscription_t* first_retired_subscription;
+
+    /** \brief Current epoch of the topics and subscriptions, incremented each time one of them is removed */
+    volatile uint32_t index_epoch;
+
+    /** \brief Epoch observed by each lock-free reader when it started reading, 0 if the slot is free */
+    volatile uint32_t index_readers[MQTT_BROKER_MAX_INDEX_READERS];
+
+    /** \brief Temp var for the reception of a protocol name */
+    mqtt_string_t protocol_name;
+
+    /** \brief Buffer for the protocol name string */
+    char protocol_name_buffer[MQTT_PROTOCOL_NAME_SIZE];
+
+    /** \brief Temp var for the reception of credentials */
+    mqtt_credentials_t received_credentials;
+
+    /** \brief Buffer for the username string */
+    char username_buffer[MQTT_BROKER_MAX_CREDENTIALS_LENGTH];
+
+    /** \brief Buffer for the password */
+    char password_buffer[MQTT_BROKER_MAX_CREDENTIALS_LENGTH];
 
     /** \brief Temp var for the reception of a topic */
     mqtt_string_t topic;
 
     /** \brief Buffer for the topic string */
-    char topic_buffer[MQTT_BROKER_MAX_TOPIC_LENGTH];
+    char* topic_buffer;
 
     /** \brief Buffer for the payload reception */
-    uint8_t payload_buffer[MQTT_BROKER_MAX_PAYLOAD_SIZE];
+    uint8_t* payload_buffer;
 
     /** \brief User data */
     void* user_data;
@@ -168,6 +497,97 @@ typedef struct _mqtt_broker_t
     /** \brief Polling period in ms for the task */
     uint32_t poll_period;
 
+    /** \brief Poller for the listen socket and the sessions sockets when io_uring is not used */
+    mqtt_socket_poller_t poller;
+
+    /** \brief Events reported by the poller */
+    mqtt_socket_poller_event_t* poller_events;
+
+    /** \brief First in-process link on which the local clients can connect */
+    ring_stream_link_t* first_local_link;
+
+    /** \brief Timer wheel for the deadlines of the sessions */
+    mqtt_timer_wheel_t timer_wheel;
+
+    #ifdef MQTT_SOCKET_IO_URING_ENABLED
+
+    /** \brief io_uring instance to batch the socket operations */
+    mqtt_socket_uring_t uring;
+
+    /** \brief Indicate if the io_uring instance is used, otherwise the sockets are polled with the poller */
+    bool uring_enabled;
+
+    #endif /* MQTT_SOCKET_IO_URING_ENABLED */
+
+    #ifdef MQTT_TRACE_ENABLED
+
+    /** \brief Recorder of the new connections (NULL if not recorded) */
+    trace_stream_recorder_t* trace_recorder;
+
+    #endif /* MQTT_TRACE_ENABLED */
+
+    #ifdef MQTT_BROKER_SYS_ENABLED
+
+    /** \brief Traffic counters of the closed sessions */
+    mqtt_broker_stats_t closed_stats;
+
+    /** \brief Number of connected clients */
+    uint32_t clients_connected;
+
+    /** \brief Maximum number of clients connected at the same time */
+    uint32_t clients_maximum;
+
+    /** \brief Time in ms at which the broker has been started */
+    uint64_t start_time;
+
+    /** \brief Period in s of the publication of the $SYS/broker/ topics, 0 if disabled */
+    uint32_t sys_interval;
+
+    /** \brief Timer of the publication of the $SYS/broker/ topics */
+    mqtt_timer_wheel_timer_t sys_timer;
+
+    #endif /* MQTT_BROKER_SYS_ENABLED */
+
+    #ifdef MQTT_BROKER_STORE_ENABLED
+
+    /** \brief Persistent store, its log file is NULL if the store is not opened */
+    mqtt_broker_store_t store;
+
+    /** \brief Timer of the group commit of the store */
+    mqtt_timer_wheel_timer_t store_timer;
+
+    /** \brief Buffer for the records loaded from the store */
+    uint8_t* store_buffer;
+
+    #endif /* MQTT_BROKER_STORE_ENABLED */
+
+    #ifdef MQTT_BROKER_RETAIN_ENABLED
+
+    /** \brief Retained messages, the retained flag of the published messages is ignored if the store is not opened */
+    mqtt_broker_retain_t retain;
+
+    /** \brief Timer of the sync of the retained store */
+    mqtt_timer_wheel_timer_t retain_timer;
+
+    /** \brief Indicate if the retained store has changes which are not synced */
+    bool retain_dirty;
+
+    #endif /* MQTT_BROKER_RETAIN_ENABLED */
+
+    #ifdef MQTT_BROKER_SPILL_ENABLED
+
+    /** \brief Disk spill of the session queues */
+    mqtt_broker_spill_t spill;
+
+    #endif /* MQTT_BROKER_SPILL_ENABLED */
+
+    #ifdef MQTT_BROKER_BRIDGE_ENABLED
+
+    /** \brief Bridge to a remote broker */
+    mqtt_broker_bridge_t bridge;
+
+    #endif /* MQTT_BROKER_BRIDGE_ENABLED */
+
     #ifdef MQTT_MULTITASKING_ENABLED
 
     /** \brief Mutex for the MQTT client */
@@ -182,12 +602,105 @@ typedef struct _mqtt_broker_t
 
 
 
-/** \brief Initialize a MQTT broker */
-bool mqtt_broker_init(mqtt_broker_t* const mqtt_broker);
+/** \brief Fill a broker configuration with the default limits of the configuration file, without arena */
+bool mqtt_broker_config_init(mqtt_broker_config_t* const config);
+
+/** \brief Get the size in bytes of the arena needed by a broker configuration */
+bool mqtt_broker_get_arena_size(const mqtt_broker_config_t* const config, size_t* const size);
+
+/** \brief Initialize a MQTT broker, the arena of the configuration must outlive the broker */
+bool mqtt_broker_init(mqtt_broker_t* const mqtt_broker, const mqtt_broker_config_t* const config);
 
 /** \brief Start the MQTT broker */
 bool mqtt_broker_start(mqtt_broker_t* const mqtt_broker, const char* const ip_address, const uint16_t port);
 
+/** \brief Stop the MQTT broker */
+bool mqtt_broker_stop(mqtt_broker_t* const mqtt_broker);
+
+/** \brief Set the socket tuning options, must be called before starting the broker */
+bool mqtt_broker_set_socket_options(mqtt_broker_t* const mqtt_broker, const mqtt_socket_options_t* const options);
+
+/** \brief Set the polling period */
+bool mqtt_broker_set_poll_period(mqtt_broker_t* const mqtt_broker, const uint32_t ms_poll_period);
+
+/** \brief Attach an in-process link on which a local client can connect without socket
+           => the broker task doesn't wait for the sockets anymore while links are attached so that
+              the local packets are processed without delay */
+bool mqtt_broker_add_local_link(mqtt_broker_t* const mqtt_broker, ring_stream_link_t* const link);
+
+/** \brief Detach an in-process link, the connection of its client is closed */
+bool mqtt_broker_remove_local_link(mqtt_broker_t* const mqtt_broker, ring_stream_link_t* const link);
+
+#ifdef MQTT_TRACE_ENABLED
+
+/** \brief Record the connections opened from now on to a trace file (NULL to stop recording the new connections)
+           => the recorder must stay open until all the recorded connections are closed or the broker is stopped */
+bool mqtt_broker_set_trace_recorder(mqtt_broker_t* const mqtt_broker, trace_stream_recorder_t* const recorder);
+
+#endif /* MQTT_TRACE_ENABLED */
+
+#ifdef MQTT_BROKER_SYS_ENABLED
+
+/** \brief Set the period in seconds of the publication of the statistics under the $SYS/broker/ topics (0 to disable) */
+bool mqtt_broker_set_sys_interval(mqtt_broker_t* const mqtt_broker, const uint32_t sec_interval);
+
+/** \brief Get the statistics of the broker */
+bool mqtt_broker_get_stats(mqtt_broker_t* const mqtt_broker, mqtt_broker_stats_t* const stats);
+
+#endif /* MQTT_BROKER_SYS_ENABLED */
+
+#ifdef MQTT_BROKER_STORE_ENABLED
+
+/** \brief Open the persistent store of the broker and restore the persistent sessions it holds, must be called before
+           starting the broker and without an opened disk spill (the files are named <path>.snap and <path>.log) */
+bool mqtt_broker_open_store(mqtt_broker_t* const mqtt_broker, const char* const path);
+
+/** \brief Write a last snapshot and close the persistent store, the persistent sessions are kept in memory */
+bool mqtt_broker_close_store(mqtt_broker_t* const mqtt_broker);
+
+#endif /* MQTT_BROKER_STORE_ENABLED */
+
+#ifdef MQTT_BROKER_RETAIN_ENABLED
+
+/** \brief Open the retained store of the broker, its messages are available right away without being loaded
+           (max_messages and heap_size are only used to create a new file) */
+bool mqtt_broker_open_retain_store(mqtt_broker_t* const mqtt_broker, const char* const path, const uint32_t max_messages, const size_t heap_size);
+
+/** \brief Sync and close the retained store, the retained messages are not kept anymore */
+bool mqtt_broker_close_retain_store(mqtt_broker_t* const mqtt_broker);
+
+#endif /* MQTT_BROKER_RETAIN_ENABLED */
+
+#ifdef MQTT_BROKER_SPILL_ENABLED
+
+/** \brief Open the disk spill of the session queues, the messages which don't fit in a queue are written to segment
+           files named <path>.<number> and read back in order when the queue has room (they are not kept after a restart :
+           the segments are deleted when the spill is closed, so the spill can't be opened while the store is opened) */
+bool mqtt_broker_open_spill(mqtt_broker_t* const mqtt_broker, const char* const path);
+
+/** \brief Close the disk spill, the spilled messages are discarded */
+bool mqtt_broker_close_spill(mqtt_broker_t* const mqtt_broker);
+
+#endif /* MQTT_BROKER_SPILL_ENABLED */
+
+#ifdef MQTT_BROKER_BRIDGE_ENABLED
+
+/** \brief Add a topic rule to the bridge of the broker, must be called before opening the bridge (the messages are bridged with QoS 1 at most) */
+bool mqtt_broker_add_bridge_rule(mqtt_broker_t* const mqtt_broker, const char* const filter, const mqtt_broker_bridge_direction_t direction,
+                                 const uint8_t qos);
+
+/** \brief Open the bridge of a running broker to a remote broker, the messages matching the rules are forwarded in both
+           directions by the broker task which keeps the connection */
+bool mqtt_broker_open_bridge(mqtt_broker_t* const mqtt_broker, const char* const address, const uint16_t port, const char* const client_id);
+
+/** \brief Close the bridge, the messages not acknowledged by the remote broker are discarded */
+bool mqtt_broker_close_bridge(mqtt_broker_t* const mqtt_broker);
+
+#endif /* MQTT_BROKER_BRIDGE_ENABLED */
+
+/** \brief Check if a topic has subscribers, can be called from any thread without blocking the broker task */
+bool mqtt_broker_has_subscribers(mqtt_broker_t* const mqtt_broker, const char* const topic, bool* const has_subscribers);
+
 /** \brief Broker periodic task */
 bool mqtt_broker_task(mqtt_broker_t* const mqtt_broker);
 
@@ -0,0 +1,897 @@
+/*
+Copyright(c) 2016 Cedric Jimenez
+
+This file is part of lw-mqtt.
+
+lw-mqtt is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+lw-mqtt is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "mqtt_broker_bridge.h"
+
+#ifdef MQTT_BROKER_BRIDGE_ENABLED
+
+#include "mqtt_error.h"
+#include "mqtt_log.h"
+#include "buffer_stream.h"
+#include "mqtt_packet_serialize.h"
+
+
+/** \brief Size in bytes of a PUBACK packet */
+#define MQTT_BROKER_BRIDGE_ACK_SIZE     (2u + MQTT_PACKET_ID_ONLY_PACKET_SIZE)
+
+/** \brief Room in bytes of the batch kept for the acknowledgements of the received messages and for the PINGREQ packets */
+#define MQTT_BROKER_BRIDGE_ACK_ROOM     (16u * MQTT_BROKER_BRIDGE_ACK_SIZE)
+
+/** \brief Session expiry interval in seconds requested by the bridge : the session never expires */
+#define MQTT_BROKER_BRIDGE_SESSION_EXPIRY   0xFFFFFFFFu
+
+
+/** \brief Start a connection to the remote broker */
+static void mqtt_broker_bridge_connect(mqtt_broker_bridge_t* const bridge);
+
+/** \brief Close the connection to the remote broker and wait before connecting again */
+static void mqtt_broker_bridge_disconnect(mqtt_broker_bridge_t* const bridge);
+
+/** \brief Batch the CONNECT packet once the TCP connection is established */
+static bool mqtt_broker_bridge_send_connect(mqtt_broker_bridge_t* const bridge);
+
+/** \brief Process a complete packet received from the remote broker, returns true if it is a message to route */
+static bool mqtt_broker_bridge_process_packet(mqtt_broker_bridge_t* const bridge, mqtt_broker_queue_message_t* const message);
+
+/** \brief Process a CONNACK packet */
+static void mqtt_broker_bridge_process_connack(mqtt_broker_bridge_t* const bridge, input_stream_t* const instream, const uint32_t packet_length);
+
+/** \brief Process a PUBACK packet */
+static void mqtt_broker_bridge_process_puback(mqtt_broker_bridge_t* const bridge, input_stream_t* const instream, const uint32_t packet_length);
+
+/** \brief Batch the queued messages which have not been sent yet while the remote broker accepts them */
+static void mqtt_broker_bridge_send_queued(mqtt_broker_bridge_t* const bridge, mqtt_broker_queue_message_t* const scratch);
+
+/** \brief Remove the oldest queued message */
+static void mqtt_broker_bridge_pop(mqtt_broker_bridge_t* const bridge);
+
+/** \brief Write the batched packets to the socket */
+static bool mqtt_broker_bridge_write_batch(mqtt_broker_bridge_t* const bridge);
+
+/** \brief Room in bytes left in the batch */
+static size_t mqtt_broker_bridge_batch_room(const mqtt_broker_bridge_t* const bridge);
+
+/** \brief Get the packet id following a packet id */
+static uint16_t mqtt_broker_bridge_next_id(const uint16_t packet_id);
+
+
+
+
+/** \brief Get the size in bytes of the buffers of a bridge (0 if the queue size is 0) */
+size_t mqtt_broker_bridge_get_buffers_size(const uint32_t batch_size, const uint32_t queue_size, const uint32_t packet_size)
+{
+    size_t size = 0u;
+
+    /* Batch, queue, received data and received packet */
+    if (queue_size != 0u)
+    {
+        size = (size_t)batch_size + queue_size + MQTT_BROKER_BRIDGE_RECEIVE_SIZE + packet_size;
+    }
+
+    return size;
+}
+
+/** \brief Initialize a bridge on its buffers (a queue size of 0 disables the bridge), the packet size is the maximum size
+           of a packet received from the remote broker */
+bool mqtt_broker_bridge_init(mqtt_broker_bridge_t* const bridge, mqtt_timer_wheel_t* const timer_wheel, uint8_t* const buffers, 
+                             const uint32_t batch_size, const uint32_t queue_size, const uint32_t packet_size)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((bridge != NULL) &&
+        (timer_wheel != NULL) &&
+        ((queue_size == 0u) || ((buffers != NULL) && (batch_size > MQTT_BROKER_BRIDGE_ACK_ROOM) && (packet_size != 0u))))
+    {
+        (void)memset(bridge, 0, sizeof(mqtt_broker_bridge_t));
+        bridge->timer_wheel = timer_wheel;
+        (void)mqtt_timer_wheel_timer_init(&bridge->timer, NULL, NULL);
+        if (queue_size != 0u)
+        {
+            bridge->batch = buffers;
+            (void)buffer_stream_output_from_buffer(&bridge->batch_stream, bridge->batch, batch_size);
+            (void)mqtt_broker_queue_init(&bridge->queue, &buffers[batch_size], queue_size);
+            bridge->receive_buffer = &buffers[(size_t)batch_size + queue_size];
+            (void)buffer_stream_input_from_buffer(&bridge->receive_stream, bridge->receive_buffer, 0u);
+            bridge->packet_buffer = &buffers[(size_t)batch_size + queue_size + MQTT_BROKER_BRIDGE_RECEIVE_SIZE];
+            bridge->packet_size = packet_size;
+            (void)buffer_stream_output_from_buffer(&bridge->packet_stream, bridge->packet_buffer, packet_size);
+        }
+        ret = true;
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Add a topic rule to a bridge which is not opened */
+bool mqtt_broker_bridge_add_rule(mqtt_broker_bridge_t* const bridge, const char* const filter, const mqtt_broker_bridge_direction_t direction, 
+                                 const uint8_t qos)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((bridge != NULL) &&
+        (bridge->state == MQTT_BROKER_BRIDGE_STATE_CLOSED) &&
+        (filter != NULL) &&
+        (filter[0u] != 0) &&
+        (strlen(filter) <= MQTT_BROKER_BRIDGE_MAX_FILTER_LENGTH) &&
+        ((direction & MQTT_BROKER_BRIDGE_BOTH) != 0u) &&
+        ((direction & (uint32_t)(~MQTT_BROKER_BRIDGE_BOTH)) == 0u) &&
+        (qos <= MQTT_MAX_QOS_LEVEL))
+    {
+        if (bridge->rule_count < MQTT_BROKER_BRIDGE_MAX_RULES)
+        {
+            /* The messages are bridged with QoS 1 at most */
+            mqtt_broker_bridge_rule_t* const rule = &bridge->rules[bridge->rule_count];
+            rule->filter.size = (uint16_t)strlen(filter);
+            (void)memcpy(rule->filter_buffer, filter, rule->filter.size);
+            rule->filter.str = rule->filter_buffer;
+            rule->direction = (uint8_t)direction;
+            rule->qos = ((qos < 1u) ? qos : 1u);
+            bridge->rule_count++;
+            ret = true;
+        }
+        else
+        {
+            mqtt_errno_set(MQTT_ERR_BUFFER_TOO_SMALL);
+        }
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Open a bridge, the connection to the remote broker is opened and kept by the broker task (the socket is added to
+           the poller of the broker task if it is not NULL) */
+bool mqtt_broker_bridge_open(mqtt_broker_bridge_t* const bridge, const char* const address, const uint16_t port, const char* const client_id,
+                             mqtt_socket_poller_t* const poller, const uint32_t poller_tag)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((bridge != NULL) &&
+        (bridge->batch != NULL) &&
+        (bridge->state == MQTT_BROKER_BRIDGE_STATE_CLOSED) &&
+        (address != NULL) &&
+        (strlen(address) < MQTT_BROKER_BRIDGE_MAX_ADDRESS_LENGTH) &&
+        (client_id != NULL) &&
+        (client_id[0u] != 0) &&
+        (strlen(client_id) <= MQTT_BROKER_BRIDGE_MAX_CLIENT_ID_LENGTH))
+    {
+        (void)strcpy(bridge->address, address);
+        bridge->port = port;
+        bridge->client_id_length = (uint16_t)strlen(client_id);
+        (void)memcpy(bridge->client_id, client_id, bridge->client_id_length);
+        bridge->poller = poller;
+        bridge->poller_tag = poller_tag;
+        bridge->send_position = 0u;
+        bridge->inflight_count = 0u;
+        bridge->packet_id = 1u;
+        (void)mqtt_broker_queue_clear(&bridge->queue);
+
+        /* The connection is established by the broker task */
+        mqtt_broker_bridge_connect(bridge);
+        ret = true;
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Close a bridge, the messages which have not been acknowledged by the remote broker are discarded */
+bool mqtt_broker_bridge_close(mqtt_broker_bridge_t* const bridge)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((bridge != NULL) &&
+        (bridge->state != MQTT_BROKER_BRIDGE_STATE_CLOSED))
+    {
+        if (bridge->state != MQTT_BROKER_BRIDGE_STATE_DISCONNECTED)
+        {
+            /* Graceful disconnection so that the remote broker keeps the session */
+            if (bridge->state == MQTT_BROKER_BRIDGE_STATE_CONNECTED)
+            {
+                (void)mqtt_packet_serialize_disconnect(&bridge->batch_stream);
+                (void)mqtt_broker_bridge_write_batch(bridge);
+            }
+            if (bridge->poller != NULL)
+            {
+                (void)mqtt_socket_poller_remove(bridge->poller, &bridge->socket);
+            }
+            (void)mqtt_socket_close(&bridge->socket);
+        }
+        (void)mqtt_timer_wheel_cancel(bridge->timer_wheel, &bridge->timer);
+        (void)mqtt_broker_queue_clear(&bridge->queue);
+        bridge->state = MQTT_BROKER_BRIDGE_STATE_CLOSED;
+        ret = true;
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Forward a local message to the remote broker, the QoS 0 messages are only forwarded while the bridge is connected
+           and the QoS 1 messages are queued until they are acknowledged (the QoS 2 messages are forwarded with QoS 1) */
+bool mqtt_broker_bridge_forward(mqtt_broker_bridge_t* const bridge, const mqtt_string_t* const topic, const void* const data, 
+                                const uint32_t length, const uint8_t qos)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((bridge != NULL) &&
+        (topic != NULL) &&
+        (!((data == NULL) && (length != 0u))))
+    {
+        if (qos == 0u)
+        {
+            /* Batched right away, the room for the acknowledgements is kept */
+            mqtt_properties_t properties;
+            mqtt_const_string_t const_topic;
+            const_topic.str = topic->str;
+            const_topic.size = topic->size;
+            properties.present = 0u;
+            if ((bridge->state == MQTT_BROKER_BRIDGE_STATE_CONNECTED) &&
+                ((mqtt_packet_serialize_publish_size(&const_topic, length, 0u, &properties) + MQTT_BROKER_BRIDGE_ACK_ROOM) <= 
+                 mqtt_broker_bridge_batch_room(bridge)))
+            {
+                ret = mqtt_packet_serialize_publish(&bridge->batch_stream, &const_topic, data, length, 0u, false, false, 0u, &properties);
+            }
+            else
+            {
+                mqtt_errno_set(MQTT_ERR_BUFFER_TOO_SMALL);
+            }
+            if (ret)
+            {
+                bridge->forwarded++;
+            }
+        }
+        else
+        {
+            /* Sent by the broker task in the window of the remote broker */
+            ret = mqtt_broker_queue_push(&bridge->queue, topic, data, length, 1u);
+        }
+        if (!ret)
+        {
+            bridge->dropped++;
+        }
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Get the next message received from the remote broker, its topic and payload buffers are given by the caller
+           => fails with MQTT_ERR_INPUT_STREAM_EMPTY if there is none */
+bool mqtt_broker_bridge_receive(mqtt_broker_bridge_t* const bridge, mqtt_broker_queue_message_t* const message)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((bridge != NULL) &&
+        (message != NULL) &&
+        (message->topic.str != NULL) &&
+        (message->payload != NULL))
+    {
+        bool done = false;
+        while (!ret && !done)
+        {
+            if ((bridge->state != MQTT_BROKER_BRIDGE_STATE_MQTT_CONNECTING) && (bridge->state != MQTT_BROKER_BRIDGE_STATE_CONNECTED))
+            {
+                /* Not connected */
+                done = true;
+            }
+            else if (mqtt_broker_bridge_batch_room(bridge) < MQTT_BROKER_BRIDGE_ACK_SIZE)
+            {
+                /* The next packet may need an acknowledgement, wait for the batch to be sent */
+                done = true;
+            }
+            else if (bridge->receive_stream.read == bridge->receive_stream.size)
+            {
+                /* All the received data has been processed, receive more without waiting */
+                size_t received = 0u;
+                if (mqtt_socket_receive(&bridge->socket, bridge->receive_buffer, MQTT_BROKER_BRIDGE_RECEIVE_SIZE, &received))
+                {
+                    (void)buffer_stream_input_from_buffer(&bridge->receive_stream, bridge->receive_buffer, received);
+                }
+                else if (mqtt_errno_get() == MQTT_ERR_SOCKET_PENDING)
+                {
+                    done = true;
+                }
+                else
+                {
+                    MQTT_LOG_ERROR("Bridge connection to %s:%u lost", bridge->address, (unsigned int)bridge->port);
+                    mqtt_broker_bridge_disconnect(bridge);
+                    done = true;
+                }
+            }
+            else if (mqtt_packet_deserialize_whole_packet(&bridge->whole_data, &bridge->receive_stream, &bridge->packet_stream,
+                                                          &bridge->packet_type, &bridge->packet_flags))
+            {
+                /* Any packet shows that the connection is alive */
+                bridge->ping_pending = false;
+                ret = mqtt_broker_bridge_process_packet(bridge, message);
+
+                /* Wait for the next packet */
+                (void)mqtt_packet_deserialize_init_whole_packet(&bridge->whole_data);
+                (void)bridge->packet_stream.reset(&bridge->packet_stream);
+            }
+            else if (mqtt_errno_get() != MQTT_ERR_IN_PROGRESS)
+            {
+                MQTT_LOG_ERROR("Bridge received an invalid or too large packet from %s:%u", bridge->address, (unsigned int)bridge->port);
+                mqtt_broker_bridge_disconnect(bridge);
+                done = true;
+            }
+            else
+            {
+                /* Incomplete packet, wait for more data */
+            }
+        }
+        if (!ret)
+        {
+            mqtt_errno_set(MQTT_ERR_INPUT_STREAM_EMPTY);
+        }
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Keep the connection with the remote broker and send the batched packets with a single write, must be called once
+           per loop of the broker task (the topic and payload buffers of the message are used to read the queued messages) */
+bool mqtt_broker_bridge_send(mqtt_broker_bridge_t* const bridge, mqtt_broker_queue_message_t* const scratch)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((bridge != NULL) &&
+        (scratch != NULL) &&
+        (scratch->topic.str != NULL) &&
+        (scratch->payload != NULL))
+    {
+        bool expired = false;
+        (void)mqtt_timer_wheel_has_expired(&bridge->timer, &expired);
+        switch (bridge->state)
+        {
+            case MQTT_BROKER_BRIDGE_STATE_DISCONNECTED:
+            {
+                /* Retry delay elapsed */
+                if (expired)
+                {
+                    mqtt_broker_bridge_connect(bridge);
+                }
+                break;
+            }
+
+            case MQTT_BROKER_BRIDGE_STATE_TCP_CONNECTING:
+            {
+                if (expired)
+                {
+                    MQTT_LOG_ERROR("Bridge connection to %s:%u timed out", bridge->address, (unsigned int)bridge->port);
+                    mqtt_broker_bridge_disconnect(bridge);
+                }
+                else if (mqtt_socket_is_connected(&bridge->socket))
+                {
+                    /* The connection timeout also covers the CONNACK packet */
+                    if (mqtt_broker_bridge_send_connect(bridge))
+                    {
+                        bridge->state = MQTT_BROKER_BRIDGE_STATE_MQTT_CONNECTING;
+                    }
+                    else
+                    {
+                        mqtt_broker_bridge_disconnect(bridge);
+                    }
+                }
+                else
+                {
+                    /* Connection in progress */
+                }
+                break;
+            }
+
+            case MQTT_BROKER_BRIDGE_STATE_MQTT_CONNECTING:
+            {
+                if (expired)
+                {
+                    MQTT_LOG_ERROR("Bridge connection to %s:%u timed out", bridge->address, (unsigned int)bridge->port);
+                    mqtt_broker_bridge_disconnect(bridge);
+                }
+                break;
+            }
+
+            case MQTT_BROKER_BRIDGE_STATE_CONNECTED:
+            {
+                /* Keepalive, a ping is sent every half keepalive period */
+                if (expired)
+                {
+                    if (bridge->ping_pending)
+                    {
+                        MQTT_LOG_ERROR("Bridge connection to %s:%u lost (no ping response)", bridge->address, (unsigned int)bridge->port);
+                        mqtt_broker_bridge_disconnect(bridge);
+                    }
+                    else
+                    {
+                        (void)mqtt_packet_serialize_pingreq(&bridge->batch_stream);
+                        bridge->ping_pending = true;
+                    }
+                }
+                if (bridge->state == MQTT_BROKER_BRIDGE_STATE_CONNECTED)
+                {
+                    mqtt_broker_bridge_send_queued(bridge, scratch);
+                }
+                break;
+            }
+
+            default:
+            {
+                /* Not opened */
+                break;
+            }
+        }
+
+        /* Single write for all the packets of the loop */
+        if (((bridge->state == MQTT_BROKER_BRIDGE_STATE_MQTT_CONNECTING) || (bridge->state == MQTT_BROKER_BRIDGE_STATE_CONNECTED)) &&
+            !mqtt_broker_bridge_write_batch(bridge))
+        {
+            MQTT_LOG_ERROR("Bridge connection to %s:%u %s", bridge->address, (unsigned int)bridge->port,
+                           ((bridge->state == MQTT_BROKER_BRIDGE_STATE_CONNECTED) ? "lost" : "refused"));
+            mqtt_broker_bridge_disconnect(bridge);
+        }
+        ret = true;
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+
+
+
+/** \brief Start a connection to the remote broker */
+static void mqtt_broker_bridge_connect(mqtt_broker_bridge_t* const bridge)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    bool connecting = false;
+    if (mqtt_socket_open(&bridge->socket, true))
+    {
+        if (mqtt_socket_connect(&bridge->socket, bridge->address, bridge->port) || (mqtt_errno_get() == MQTT_ERR_SOCKET_PENDING))
+        {
+            connecting = ((bridge->poller == NULL) || mqtt_socket_poller_add(bridge->poller, &bridge->socket, bridge->poller_tag));
+        }
+        if (!connecting)
+        {
+            (void)mqtt_socket_close(&bridge->socket);
+        }
+    }
+    if (connecting)
+    {
+        /* Nothing is kept from the previous connection */
+        bridge->state = MQTT_BROKER_BRIDGE_STATE_TCP_CONNECTING;
+        bridge->ping_pending = false;
+        bridge->batch_sent = 0u;
+        (void)bridge->batch_stream.reset(&bridge->batch_stream);
+        (void)buffer_stream_input_from_buffer(&bridge->receive_stream, bridge->receive_buffer, 0u);
+        (void)mqtt_packet_deserialize_init_whole_packet(&bridge->whole_data);
+        (void)bridge->packet_stream.reset(&bridge->packet_stream);
+        (void)mqtt_timer_wheel_start(bridge->timer_wheel, &bridge->timer, MQTT_BROKER_BRIDGE_CONNECT_TIMEOUT, false);
+    }
+    else
+    {
+        MQTT_LOG_ERROR("Unable to connect the bridge to %s:%u (error %d)", bridge->address, (unsigned int)bridge->port, mqtt_errno_get());
+        bridge->state = MQTT_BROKER_BRIDGE_STATE_DISCONNECTED;
+        (void)mqtt_timer_wheel_start(bridge->timer_wheel, &bridge->timer, MQTT_BROKER_BRIDGE_RETRY_DELAY, false);
+    }
+}
+
+/** \brief Close the connection to the remote broker and wait before connecting again */
+static void mqtt_broker_bridge_disconnect(mqtt_broker_bridge_t* const bridge)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    if (bridge->poller != NULL)
+    {
+        (void)mqtt_socket_poller_remove(bridge->poller, &bridge->socket);
+    }
+    (void)mqtt_socket_close(&bridge->socket);
+
+    /* The unacknowledged messages are sent again with the same packet ids */
+    (void)mqtt_broker_queue_rewind(&bridge->queue);
+    bridge->inflight_count = 0u;
+    bridge->send_position = 0u;
+    bridge->state = MQTT_BROKER_BRIDGE_STATE_DISCONNECTED;
+    (void)mqtt_timer_wheel_start(bridge->timer_wheel, &bridge->timer, MQTT_BROKER_BRIDGE_RETRY_DELAY, false);
+}
+
+/** \brief Batch the CONNECT packet once the TCP connection is established */
+static bool mqtt_broker_bridge_send_connect(mqtt_broker_bridge_t* const bridge)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    /* Persistent session so that the remote broker keeps the messages of the bridge while it is disconnected */
+    mqtt_properties_t properties;
+    mqtt_const_string_t client_id;
+    client_id.str = bridge->client_id;
+    client_id.size = bridge->client_id_length;
+    properties.present = (uint32_t)MQTT_PROP_FLAG_SESSION_EXPIRY_INTERVAL | (uint32_t)MQTT_PROP_FLAG_MAXIMUM_PACKET_SIZE;
+    properties.session_expiry_interval = MQTT_BROKER_BRIDGE_SESSION_EXPIRY;
+    properties.maximum_packet_size = bridge->packet_size;
+
+    return mqtt_packet_serialize_connect(&bridge->batch_stream, &client_id, NULL, NULL, false, MQTT_BROKER_BRIDGE_KEEPALIVE, &properties);
+}
+
+/** \brief Process a complete packet received from the remote broker, returns true if it is a message to route */
+static bool mqtt_broker_bridge_process_packet(mqtt_broker_bridge_t* const bridge, mqtt_broker_queue_message_t* const message)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    bool has_message = false;
+    input_stream_t instream;
+    const uint32_t packet_length = (uint32_t)bridge->packet_stream.written;
+    (void)buffer_stream_input_from_buffer(&instream, bridge->packet_buffer, packet_length);
+
+    switch (bridge->packet_type)
+    {
+        case MQTT_PKT_CONNACK:
+        {
+            mqtt_broker_bridge_process_connack(bridge, &instream, packet_length);
+            break;
+        }
+
+        case MQTT_PKT_PUBLISH:
+        {
+            /* The capacity of the buffers is given by the message */
+            bool retain;
+            bool duplicate;
+            uint16_t packet_id = 0u;
+            mqtt_properties_t properties;
+            const uint16_t topic_size = message->topic.size;
+            const uint32_t payload_size = message->length;
+            has_message = mqtt_packet_deserialize_publish(&instream, bridge->packet_flags, packet_length, &message->topic, message->payload,
+                                                          &message->length, &message->qos, &retain, &duplicate, &packet_id, &properties);
+            if (has_message && (message->qos > 1u))
+            {
+                /* The bridge only subscribes with QoS 1 at most */
+                MQTT_LOG_ERROR("Bridge received a QoS 2 message from %s:%u", bridge->address, (unsigned int)bridge->port);
+                mqtt_broker_bridge_disconnect(bridge);
+                has_message = false;
+            }
+            else if (has_message)
+            {
+                /* Pipelined acknowledgement, sent with the next batch */
+                if (message->qos == 1u)
+                {
+                    (void)mqtt_packet_serialize_puback(&bridge->batch_stream, packet_id);
+                }
+                bridge->received++;
+            }
+            else
+            {
+                /* Not acknowledged, the remote broker sends it again on the next connection */
+                MQTT_LOG_ERROR("Bridge dropped a message from %s:%u (error %d)", bridge->address, (unsigned int)bridge->port, mqtt_errno_get());
+                message->topic.size = topic_size;
+                message->length = payload_size;
+            }
+            break;
+        }
+
+        case MQTT_PKT_PUBACK:
+        {
+            mqtt_broker_bridge_process_puback(bridge, &instream, packet_length);
+            break;
+        }
+
+        case MQTT_PKT_SUBACK:
+        {
+            uint8_t qos = MQTT_FAILURE_QOS;
+            uint16_t packet_id = 0u;
+            mqtt_properties_t properties;
+            if (!mqtt_packet_deserialize_suback(&instream, packet_length, &qos, &packet_id, &properties) || (qos >= MQTT_FAILURE_QOS))
+            {
+                MQTT_LOG_ERROR("Bridge subscription %u refused by %s:%u", (unsigned int)packet_id, bridge->address, (unsigned int)bridge->port);
+            }
+            break;
+        }
+
+        case MQTT_PKT_DISCONNECT:
+        {
+            MQTT_LOG_ERROR("Bridge disconnected by %s:%u", bridge->address, (unsigned int)bridge->port);
+            mqtt_broker_bridge_disconnect(bridge);
+            break;
+        }
+
+        default:
+        {
+            /* PINGRESP or unexpected packet */
+            break;
+        }
+    }
+
+    return has_message;
+}
+
+/** \brief Process a CONNACK packet */
+static void mqtt_broker_bridge_process_connack(mqtt_broker_bridge_t* const bridge, input_stream_t* const instream, const uint32_t packet_length)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    bool session_present = false;
+    mqtt_connack_retcode_t retcode = MQTT_CONNACK_RET_REFUSED_SERVER_UNAVAILABLE;
+    mqtt_properties_t properties;
+    properties.present = 0u;
+    if ((bridge->state == MQTT_BROKER_BRIDGE_STATE_MQTT_CONNECTING) &&
+        mqtt_packet_deserialize_connack(instream, packet_length, &session_present, &retcode, &properties) &&
+        (retcode == MQTT_CONNACK_RET_ACCEPTED))
+    {
+        uint32_t i;
+
+        /* Limits of the remote broker */
+        bridge->receive_maximum = UINT16_MAX;
+        if (((properties.present & MQTT_PROP_FLAG_RECEIVE_MAXIMUM) != 0u) && (properties.receive_maximum != 0u))
+        {
+            bridge->receive_maximum = properties.receive_maximum;
+        }
+        bridge->maximum_packet_size = MQTT_MAXIMUM_PACKET_SIZE;
+        if (((properties.present & MQTT_PROP_FLAG_MAXIMUM_PACKET_SIZE) != 0u) && (properties.maximum_packet_size != 0u))
+        {
+            bridge->maximum_packet_size = properties.maximum_packet_size;
+        }
+        bridge->state = MQTT_BROKER_BRIDGE_STATE_CONNECTED;
+        (void)mqtt_timer_wheel_start(bridge->timer_wheel, &bridge->timer, (MQTT_BROKER_BRIDGE_KEEPALIVE * 1000u) / 2u, true);
+        MQTT_LOG_INFO("Bridge connected to %s:%u (session %s)", bridge->address, (unsigned int)bridge->port, 
+                      (session_present ? "resumed" : "created"));
+
+        /* Subscribe again to the remote topics in case the session has been lost, without receiving back the forwarded messages */
+        for (i = 0u; i < bridge->rule_count; i++)
+        {
+            const mqtt_broker_bridge_rule_t* const rule = &bridge->rules[i];
+            if ((rule->direction & MQTT_BROKER_BRIDGE_IN) != 0u)
+            {
+                mqtt_const_string_t filter;
+                filter.str = rule->filter.str;
+                filter.size = rule->filter.size;
+                properties.present = 0u;
+                (void)mqtt_packet_serialize_subscribe(&bridge->batch_stream, &filter, rule->qos | MQTT_SUBSCRIBE_OPTION_NO_LOCAL, 
+                                                      bridge->packet_id, &properties);
+                bridge->packet_id = mqtt_broker_bridge_next_id(bridge->packet_id);
+            }
+        }
+    }
+    else
+    {
+        MQTT_LOG_ERROR("Bridge connection refused by %s:%u (return code %d)", bridge->address, (unsigned int)bridge->port, (int)retcode);
+        mqtt_broker_bridge_disconnect(bridge);
+    }
+}
+
+/** \brief Process a PUBACK packet */
+static void mqtt_broker_bridge_process_puback(mqtt_broker_bridge_t* const bridge, input_stream_t* const instream, const uint32_t packet_length)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    /* The MQTT 5.0 reason code follows the packet id, a failure reason code means that the remote broker has refused the message */
+    uint16_t packet_id = 0u;
+    const uint8_t reason_code = ((packet_length > MQTT_PACKET_ID_ONLY_PACKET_SIZE) ? bridge->packet_buffer[MQTT_PACKET_ID_ONLY_PACKET_SIZE] : 
+                                                                                    (uint8_t)MQTT_REASON_SUCCESS);
+    if (mqtt_packet_deserialize_puback(instream, packet_length, &packet_id))
+    {
+        /* The acknowledged messages are removed in the order they have been sent */
+        const uint32_t used = bridge->queue.used;
+        uint32_t removed = 0u;
+        (void)mqtt_broker_queue_acknowledge(&bridge->queue, packet_id, &removed);
+        bridge->send_position -= (used - bridge->queue.used);
+        bridge->inflight_count -= removed;
+        if (reason_code >= (uint8_t)MQTT_REASON_UNSPECIFIED_ERROR)
+        {
+            bridge->dropped += removed;
+        }
+        else
+        {
+            bridge->forwarded += removed;
+        }
+    }
+}
+
+/** \brief Batch the queued messages which have not been sent yet while the remote broker accepts them */
+static void mqtt_broker_bridge_send_queued(mqtt_broker_bridge_t* const bridge, mqtt_broker_queue_message_t* const scratch)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    bool done = false;
+    const uint16_t topic_size = scratch->topic.size;
+    const uint32_t payload_size = scratch->length;
+    const uint32_t window = ((bridge->receive_maximum < MQTT_BROKER_BRIDGE_MAX_INFLIGHT) ? bridge->receive_maximum : MQTT_BROKER_BRIDGE_MAX_INFLIGHT);
+    while (!done && (bridge->inflight_count < window) && (bridge->send_position < bridge->queue.used))
+    {
+        uint32_t position = bridge->send_position;
+        scratch->topic.size = topic_size;
+        scratch->length = payload_size;
+        if (mqtt_broker_queue_peek(&bridge->queue, &position, scratch))
+        {
+            mqtt_properties_t properties;
+            mqtt_const_string_t topic;
+            uint32_t size;
+            topic.str = scratch->topic.str;
+            topic.size = scratch->topic.size;
+            properties.present = 0u;
+            size = mqtt_packet_serialize_publish_size(&topic, scratch->length, 1u, &properties);
+            if (size > bridge->maximum_packet_size)
+            {
+                /* Too large for the remote broker : dropped once it is the oldest message */
+                if (bridge->inflight_count == 0u)
+                {
+                    mqtt_broker_bridge_pop(bridge);
+                    bridge->dropped++;
+                }
+                else
+                {
+                    done = true;
+                }
+            }
+            else if ((size + MQTT_BROKER_BRIDGE_ACK_ROOM) > mqtt_broker_bridge_batch_room(bridge))
+            {
+                /* Batch full, wait for it to be sent */
+                done = true;
+            }
+            else
+            {
+                /* The messages sent before the reconnection keep their packet id and are flagged as duplicates */
+                uint16_t packet_id = scratch->packet_id;
+                if (!scratch->dup)
+                {
+                    packet_id = bridge->packet_id;
+                    bridge->packet_id = mqtt_broker_bridge_next_id(bridge->packet_id);
+                }
+                (void)mqtt_packet_serialize_publish(&bridge->batch_stream, &topic, scratch->payload, scratch->length, 1u, false, scratch->dup,
+                                                    packet_id, &properties);
+                (void)mqtt_broker_queue_set_sent(&bridge->queue, packet_id);
+                bridge->send_position = position;
+                bridge->inflight_count++;
+            }
+        }
+        else
+        {
+            done = true;
+        }
+    }
+    scratch->topic.size = topic_size;
+    scratch->length = payload_size;
+}
+
+/** \brief Remove the oldest queued message */
+static void mqtt_broker_bridge_pop(mqtt_broker_bridge_t* const bridge)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    /* The position of the next message to send is relative to the oldest message */
+    const uint32_t used = bridge->queue.used;
+    (void)mqtt_broker_queue_pop(&bridge->queue);
+    bridge->send_position -= (used - bridge->queue.used);
+}
+
+/** \brief Write the batched packets to the socket */
+static bool mqtt_broker_bridge_write_batch(mqtt_broker_bridge_t* const bridge)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    bool ret = true;
+    const size_t pending = bridge->batch_stream.written - bridge->batch_sent;
+    if (pending != 0u)
+    {
+        size_t sent = 0u;
+        if (mqtt_socket_send(&bridge->socket, &bridge->batch[bridge->batch_sent], pending, &sent))
+        {
+            /* The rest of a partial write is sent with the next batch */
+            bridge->batch_sent += sent;
+            if (bridge->batch_sent == bridge->batch_stream.written)
+            {
+                bridge->batch_sent = 0u;
+                (void)bridge->batch_stream.reset(&bridge->batch_stream);
+            }
+        }
+        else
+        {
+            ret = (mqtt_errno_get() == MQTT_ERR_SOCKET_PENDING);
+        }
+    }
+
+    return ret;
+}
+
+/** \brief Room in bytes left in the batch */
+static size_t mqtt_broker_bridge_batch_room(const mqtt_broker_bridge_t* const bridge)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    return (bridge->batch_stream.size - bridge->batch_stream.written);
+}
+
+/** \brief Get the packet id following a packet id */
+static uint16_t mqtt_broker_bridge_next_id(const uint16_t packet_id)
+{
+    /* Packet id 0 is not allowed */
+    uint16_t next_id = (uint16_t)(packet_id + 1u);
+    if (next_id == 0u)
+    {
+        next_id = 1u;
+    }
+
+    return next_id;
+}
+
+#endif /* MQTT_BROKER_BRIDGE_ENABLED */
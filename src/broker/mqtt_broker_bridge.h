@@ -0,0 +1,199 @@
+/*
+Copyright(c) 2016 Cedric Jimenez
+
+This file is part of lw-mqtt.
+
+lw-mqtt is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+lw-mqtt is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MQTT_BROKER_BRIDGE_H
+#define MQTT_BROKER_BRIDGE_H
+
+#include "stdheaders.h"
+#include "mqtt_config.h"
+
+#ifdef MQTT_BROKER_BRIDGE_ENABLED
+
+#include "mqtt.h"
+#include "mqtt_socket.h"
+#include "mqtt_timer_wheel.h"
+#include "mqtt_packet_deserialize.h"
+#include "mqtt_broker_queue.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+
+/** \brief Direction of the messages matching a rule of the bridge */
+typedef enum _mqtt_broker_bridge_direction_t
+{
+    /** \brief Local messages forwarded to the remote broker */
+    MQTT_BROKER_BRIDGE_OUT = 1u,
+    /** \brief Remote messages routed to the local subscribers */
+    MQTT_BROKER_BRIDGE_IN = 2u,
+    /** \brief Both directions */
+    MQTT_BROKER_BRIDGE_BOTH = 3u
+} mqtt_broker_bridge_direction_t;
+
+/** \brief State of the connection of the bridge */
+typedef enum _mqtt_broker_bridge_state_t
+{
+    /** \brief Bridge not opened */
+    MQTT_BROKER_BRIDGE_STATE_CLOSED = 0u,
+    /** \brief Waiting before connecting again */
+    MQTT_BROKER_BRIDGE_STATE_DISCONNECTED = 1u,
+    /** \brief TCP connection in progress */
+    MQTT_BROKER_BRIDGE_STATE_TCP_CONNECTING = 2u,
+    /** \brief CONNECT packet sent, waiting for the CONNACK packet */
+    MQTT_BROKER_BRIDGE_STATE_MQTT_CONNECTING = 3u,
+    /** \brief Connected to the remote broker */
+    MQTT_BROKER_BRIDGE_STATE_CONNECTED = 4u
+} mqtt_broker_bridge_state_t;
+
+/** \brief Topic rule of the bridge */
+typedef struct _mqtt_broker_bridge_rule_t
+{
+    /** \brief Topic filter */
+    mqtt_string_t filter;
+    /** \brief Buffer for the topic filter string */
+    char filter_buffer[MQTT_BROKER_BRIDGE_MAX_FILTER_LENGTH];
+    /** \brief Direction (see mqtt_broker_bridge_direction_t) */
+    uint8_t direction;
+    /** \brief Maximum QoS of the forwarded messages (0 or 1) */
+    uint8_t qos;
+} mqtt_broker_bridge_rule_t;
+
+/** \brief Bridge of a MQTT broker to a remote broker : the bridge is a MQTT 5.0 client with a persistent session which is
+           run by the broker task without blocking it. The packets to send are batched during a loop of the broker task
+           and written with a single system call, the QoS 1 messages are sent without waiting for the acknowledgement
+           of the previous ones (the remote broker acknowledges them in order) and are sent again after a reconnection.
+           The remote messages are never forwarded back and the bridge subscribes with the No Local option so that the
+           remote broker doesn't send back the forwarded messages. */
+typedef struct _mqtt_broker_bridge_t
+{
+    /** \brief State */
+    mqtt_broker_bridge_state_t state;
+    /** \brief Socket connected to the remote broker */
+    mqtt_socket_t socket;
+    /** \brief Poller of the broker task to which the socket is added (NULL if not used) */
+    mqtt_socket_poller_t* poller;
+    /** \brief Tag of the socket in the events of the poller */
+    uint32_t poller_tag;
+    /** \brief Address of the remote broker */
+    char address[MQTT_BROKER_BRIDGE_MAX_ADDRESS_LENGTH];
+    /** \brief Port of the remote broker */
+    uint16_t port;
+    /** \brief Client id */
+    char client_id[MQTT_BROKER_BRIDGE_MAX_CLIENT_ID_LENGTH];
+    /** \brief Length in bytes of the client id */
+    uint16_t client_id_length;
+    /** \brief Topic rules */
+    mqtt_broker_bridge_rule_t rules[MQTT_BROKER_BRIDGE_MAX_RULES];
+    /** \brief Number of topic rules */
+    uint32_t rule_count;
+    /** \brief Timer wheel of the broker task */
+    mqtt_timer_wheel_t* timer_wheel;
+    /** \brief Timer of the retry delay, of the connection timeout and of the keepalive */
+    mqtt_timer_wheel_timer_t timer;
+    /** \brief Indicate if a PINGREQ packet has been sent and no packet has been received since */
+    bool ping_pending;
+
+    /** \brief Buffer of the packets to send */
+    uint8_t* batch;
+    /** \brief Output stream to batch the packets to send */
+    output_stream_t batch_stream;
+    /** \brief Number of bytes of the batch already sent */
+    size_t batch_sent;
+    /** \brief QoS 1 messages waiting to be sent or acknowledged */
+    mqtt_broker_queue_t queue;
+    /** \brief Position in the queue of the next message to send */
+    uint32_t send_position;
+    /** \brief Number of queued messages sent and not acknowledged */
+    uint32_t inflight_count;
+    /** \brief Packet id of the next message or subscription sent */
+    uint16_t packet_id;
+    /** \brief Remote broker's receive maximum */
+    uint16_t receive_maximum;
+    /** \brief Remote broker's maximum packet size */
+    uint32_t maximum_packet_size;
+
+    /** \brief Buffer of the received data */
+    uint8_t* receive_buffer;
+    /** \brief Input stream on the received data which has not been processed yet */
+    input_stream_t receive_stream;
+    /** \brief State of the packet being received */
+    mqtt_deserialize_whole_data_t whole_data;
+    /** \brief Type of the packet being received */
+    mqtt_control_packet_type_t packet_type;
+    /** \brief Flags of the packet being received */
+    uint8_t packet_flags;
+    /** \brief Output stream to store the packet being received */
+    output_stream_t packet_stream;
+    /** \brief Buffer for the packet being received */
+    uint8_t* packet_buffer;
+    /** \brief Size in bytes of the buffer for the packet being received */
+    uint32_t packet_size;
+
+    /** \brief Number of messages forwarded to the remote broker */
+    uint64_t forwarded;
+    /** \brief Number of messages received from the remote broker */
+    uint64_t received;
+    /** \brief Number of messages which couldn't be forwarded to the remote broker */
+    uint64_t dropped;
+} mqtt_broker_bridge_t;
+
+
+/** \brief Get the size in bytes of the buffers of a bridge (0 if the queue size is 0) */
+size_t mqtt_broker_bridge_get_buffers_size(const uint32_t batch_size, const uint32_t queue_size, const uint32_t packet_size);
+
+/** \brief Initialize a bridge on its buffers (a queue size of 0 disables the bridge), the packet size is the maximum size
+           of a packet received from the remote broker */
+bool mqtt_broker_bridge_init(mqtt_broker_bridge_t* const bridge, mqtt_timer_wheel_t* const timer_wheel, uint8_t* const buffers, 
+                             const uint32_t batch_size, const uint32_t queue_size, const uint32_t packet_size);
+
+/** \brief Add a topic rule to a bridge which is not opened */
+bool mqtt_broker_bridge_add_rule(mqtt_broker_bridge_t* const bridge, const char* const filter, const mqtt_broker_bridge_direction_t direction, 
+                                 const uint8_t qos);
+
+/** \brief Open a bridge, the connection to the remote broker is opened and kept by the broker task (the socket is added to
+           the poller of the broker task if it is not NULL) */
+bool mqtt_broker_bridge_open(mqtt_broker_bridge_t* const bridge, const char* const address, const uint16_t port, const char* const client_id,
+                             mqtt_socket_poller_t* const poller, const uint32_t poller_tag);
+
+/** \brief Close a bridge, the messages which have not been acknowledged by the remote broker are discarded */
+bool mqtt_broker_bridge_close(mqtt_broker_bridge_t* const bridge);
+
+/** \brief Forward a local message to the remote broker, the QoS 0 messages are only forwarded while the bridge is connected
+           and the QoS 1 messages are queued until they are acknowledged (the QoS 2 messages are forwarded with QoS 1) */
+bool mqtt_broker_bridge_forward(mqtt_broker_bridge_t* const bridge, const mqtt_string_t* const topic, const void* const data, 
+                                const uint32_t length, const uint8_t qos);
+
+/** \brief Get the next message received from the remote broker, its topic and payload buffers are given by the caller
+           => fails with MQTT_ERR_INPUT_STREAM_EMPTY if there is none */
+bool mqtt_broker_bridge_receive(mqtt_broker_bridge_t* const bridge, mqtt_broker_queue_message_t* const message);
+
+/** \brief Keep the connection with the remote broker and send the batched packets with a single write, must be called once
+           per loop of the broker task (the topic and payload buffers of the message are used to read the queued messages) */
+bool mqtt_broker_bridge_send(mqtt_broker_bridge_t* const bridge, mqtt_broker_queue_message_t* const scratch);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* MQTT_BROKER_BRIDGE_ENABLED */
+
+#endif /* MQTT_BROKER_BRIDGE_H */
@@ -0,0 +1,417 @@
+/*
+Copyright(c) 2016 Cedric Jimenez
+
+This file is part of lw-mqtt.
+
+lw-mqtt is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+lw-mqtt is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "mqtt_broker_queue.h"
+#include "mqtt_error.h"
+
+
+/** \brief Bits of the QoS in the first byte of the header of a queued message */
+#define MQTT_BROKER_QUEUE_QOS_MASK          0x03u
+
+/** \brief Flag set in the first byte of the header of a queued message once it has been sent */
+#define MQTT_BROKER_QUEUE_FLAG_SENT         0x80u
+
+/** \brief Flag set in the first byte of the header of a queued message once it has been acknowledged */
+#define MQTT_BROKER_QUEUE_FLAG_ACKNOWLEDGED 0x40u
+
+
+/** \brief Copy data to the ring buffer of a queue */
+static void mqtt_broker_queue_write(mqtt_broker_queue_t* const queue, const uint32_t offset, const void* const data, const uint32_t size);
+
+/** \brief Copy data from the ring buffer of a queue */
+static void mqtt_broker_queue_read(const mqtt_broker_queue_t* const queue, const uint32_t offset, void* const data, const uint32_t size);
+
+/** \brief Read the header of the message at a position of a queue, returns the size in bytes of the message */
+static uint32_t mqtt_broker_queue_read_header(const mqtt_broker_queue_t* const queue, const uint32_t position, uint8_t* const flags, 
+                                              uint16_t* const topic_length, uint32_t* const length, uint16_t* const packet_id);
+
+/** \brief Write the state and the packet id of the message at a position of a queue */
+static void mqtt_broker_queue_write_state(mqtt_broker_queue_t* const queue, const uint32_t position, const uint8_t flags, 
+                                          const uint16_t packet_id);
+
+
+
+/** \brief Initialize a queue on a ring buffer (a size of 0 disables the queue) */
+bool mqtt_broker_queue_init(mqtt_broker_queue_t* const queue, uint8_t* const buffer, const uint32_t size)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((queue != NULL) &&
+        ((buffer != NULL) || (size == 0u)))
+    {
+        queue->buffer = buffer;
+        queue->size = size;
+        queue->head = 0u;
+        queue->used = 0u;
+        queue->count = 0u;
+        queue->sent = 0u;
+        queue->sent_used = 0u;
+        ret = true;
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Append a message to a queue, fails with MQTT_ERR_BUFFER_TOO_SMALL if it is full */
+bool mqtt_broker_queue_push(mqtt_broker_queue_t* const queue, const mqtt_string_t* const topic, const void* const data, 
+                            const uint32_t length, const uint8_t qos)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((queue != NULL) &&
+        (topic != NULL) &&
+        (!((data == NULL) && (length != 0u))))
+    {
+        const uint32_t free_size = queue->size - queue->used;
+        if ((length <= free_size) && ((MQTT_BROKER_QUEUE_HEADER_SIZE + (uint32_t)topic->size) <= (free_size - length)))
+        {
+            uint8_t header[MQTT_BROKER_QUEUE_HEADER_SIZE];
+            uint32_t offset = ((queue->head + queue->used) % queue->size);
+
+            /* Header, topic and payload are stored back to back, wrapping at the end of the ring */
+            header[0u] = qos;
+            header[1u] = (uint8_t)(topic->size & 0xFFu);
+            header[2u] = (uint8_t)(topic->size >> 8u);
+            header[3u] = (uint8_t)(length & 0xFFu);
+            header[4u] = (uint8_t)((length >> 8u) & 0xFFu);
+            header[5u] = (uint8_t)((length >> 16u) & 0xFFu);
+            header[6u] = (uint8_t)(length >> 24u);
+            header[7u] = 0u;
+            header[8u] = 0u;
+            mqtt_broker_queue_write(queue, offset, header, sizeof(header));
+            offset = ((offset + MQTT_BROKER_QUEUE_HEADER_SIZE) % queue->size);
+            mqtt_broker_queue_write(queue, offset, topic->str, topic->size);
+            offset = ((offset + topic->size) % queue->size);
+            mqtt_broker_queue_write(queue, offset, data, length);
+            queue->used += MQTT_BROKER_QUEUE_HEADER_SIZE + topic->size + length;
+            queue->count++;
+            ret = true;
+        }
+        else
+        {
+            mqtt_errno_set(MQTT_ERR_BUFFER_TOO_SMALL);
+        }
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Read a message without removing it, the position starts at 0 for the oldest message and is moved to the next message */
+bool mqtt_broker_queue_peek(const mqtt_broker_queue_t* const queue, uint32_t* const position, mqtt_broker_queue_message_t* const message)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((queue != NULL) &&
+        (position != NULL) &&
+        (message != NULL) &&
+        (message->topic.str != NULL))
+    {
+        if ((*position) < queue->used)
+        {
+            uint8_t flags = 0u;
+            uint16_t topic_length = 0u;
+            uint32_t length = 0u;
+            (void)mqtt_broker_queue_read_header(queue, (*position), &flags, &topic_length, &length, &message->packet_id);
+            message->qos = (flags & MQTT_BROKER_QUEUE_QOS_MASK);
+            message->dup = ((flags & MQTT_BROKER_QUEUE_FLAG_SENT) != 0u);
+            message->acknowledged = ((flags & MQTT_BROKER_QUEUE_FLAG_ACKNOWLEDGED) != 0u);
+            if ((topic_length <= message->topic.size) && (length <= message->length) && 
+                ((length == 0u) || (message->payload != NULL)))
+            {
+                uint32_t offset = ((queue->head + (*position) + MQTT_BROKER_QUEUE_HEADER_SIZE) % queue->size);
+                mqtt_broker_queue_read(queue, offset, message->topic.str, topic_length);
+                offset = ((offset + topic_length) % queue->size);
+                mqtt_broker_queue_read(queue, offset, message->payload, length);
+                message->topic.size = topic_length;
+                message->length = length;
+                (*position) += MQTT_BROKER_QUEUE_HEADER_SIZE + topic_length + length;
+                ret = true;
+            }
+            else
+            {
+                mqtt_errno_set(MQTT_ERR_BUFFER_TOO_SMALL);
+            }
+        }
+        else
+        {
+            mqtt_errno_set(MQTT_ERR_INPUT_STREAM_EMPTY);
+        }
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Remove the oldest message of a queue */
+bool mqtt_broker_queue_pop(mqtt_broker_queue_t* const queue)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((queue != NULL) &&
+        (queue->count != 0u))
+    {
+        uint8_t flags = 0u;
+        uint16_t topic_length = 0u;
+        uint32_t length = 0u;
+        uint16_t packet_id = 0u;
+        const uint32_t size = mqtt_broker_queue_read_header(queue, 0u, &flags, &topic_length, &length, &packet_id);
+        queue->head = ((queue->head + size) % queue->size);
+        queue->used -= size;
+        queue->count--;
+        if (queue->sent != 0u)
+        {
+            queue->sent--;
+            queue->sent_used -= size;
+        }
+        if (queue->count == 0u)
+        {
+            /* Restart at the beginning of the buffer to avoid the wrapping copies */
+            queue->head = 0u;
+        }
+        ret = true;
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Mark the next message to send of a queue as sent with a packet id */
+bool mqtt_broker_queue_set_sent(mqtt_broker_queue_t* const queue, const uint16_t packet_id)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((queue != NULL) &&
+        (queue->sent < queue->count))
+    {
+        /* The acknowledged flag is kept when a message already acknowledged is skipped after a rewind */
+        uint8_t flags = 0u;
+        uint16_t topic_length = 0u;
+        uint32_t length = 0u;
+        uint16_t previous_packet_id = 0u;
+        const uint32_t size = mqtt_broker_queue_read_header(queue, queue->sent_used, &flags, &topic_length, &length, &previous_packet_id);
+        mqtt_broker_queue_write_state(queue, queue->sent_used, (flags | MQTT_BROKER_QUEUE_FLAG_SENT), packet_id);
+        queue->sent++;
+        queue->sent_used += size;
+        ret = true;
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Mark the sent message of a queue which has a packet id as acknowledged and remove the acknowledged messages
+           at the beginning of the queue */
+bool mqtt_broker_queue_acknowledge(mqtt_broker_queue_t* const queue, const uint16_t packet_id, uint32_t* const removed)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((queue != NULL) &&
+        (removed != NULL))
+    {
+        /* The QoS 1 and QoS 2 acknowledgements may arrive out of order, only the sent messages can match */
+        uint32_t i;
+        uint32_t position = 0u;
+        bool found = false;
+        for (i = 0u; (i < queue->sent) && !found; i++)
+        {
+            uint8_t flags = 0u;
+            uint16_t topic_length = 0u;
+            uint32_t length = 0u;
+            uint16_t sent_packet_id = 0u;
+            const uint32_t size = mqtt_broker_queue_read_header(queue, position, &flags, &topic_length, &length, &sent_packet_id);
+            if ((sent_packet_id == packet_id) && ((flags & MQTT_BROKER_QUEUE_FLAG_ACKNOWLEDGED) == 0u))
+            {
+                mqtt_broker_queue_write_state(queue, position, (flags | MQTT_BROKER_QUEUE_FLAG_ACKNOWLEDGED), sent_packet_id);
+                found = true;
+            }
+            position += size;
+        }
+
+        /* Remove the acknowledged messages in order */
+        (*removed) = 0u;
+        if (found)
+        {
+            bool acknowledged = true;
+            while (acknowledged && (queue->sent != 0u))
+            {
+                uint8_t flags = 0u;
+                uint16_t topic_length = 0u;
+                uint32_t length = 0u;
+                uint16_t sent_packet_id = 0u;
+                (void)mqtt_broker_queue_read_header(queue, 0u, &flags, &topic_length, &length, &sent_packet_id);
+                acknowledged = ((flags & MQTT_BROKER_QUEUE_FLAG_ACKNOWLEDGED) != 0u);
+                if (acknowledged)
+                {
+                    (void)mqtt_broker_queue_pop(queue);
+                    (*removed)++;
+                }
+            }
+        }
+        ret = true;
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Mark all the messages of a queue as not sent so that they are sent again */
+bool mqtt_broker_queue_rewind(mqtt_broker_queue_t* const queue)
+{
+    bool ret = false;
+
+    /* Check params */
+    if (queue != NULL)
+    {
+        queue->sent = 0u;
+        queue->sent_used = 0u;
+        ret = true;
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Remove all the messages of a queue */
+bool mqtt_broker_queue_clear(mqtt_broker_queue_t* const queue)
+{
+    bool ret = false;
+
+    /* Check params */
+    if (queue != NULL)
+    {
+        queue->head = 0u;
+        queue->used = 0u;
+        queue->count = 0u;
+        queue->sent = 0u;
+        queue->sent_used = 0u;
+        ret = true;
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+
+
+
+/** \brief Copy data to the ring buffer of a queue */
+static void mqtt_broker_queue_write(mqtt_broker_queue_t* const queue, const uint32_t offset, const void* const data, const uint32_t size)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    const uint32_t first_size = (((queue->size - offset) < size) ? (queue->size - offset) : size);
+    if (size != 0u)
+    {
+        (void)memcpy(&queue->buffer[offset], data, first_size);
+        (void)memcpy(queue->buffer, &((const uint8_t*)data)[first_size], size - first_size);
+    }
+}
+
+/** \brief Copy data from the ring buffer of a queue */
+static void mqtt_broker_queue_read(const mqtt_broker_queue_t* const queue, const uint32_t offset, void* const data, const uint32_t size)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    const uint32_t first_size = (((queue->size - offset) < size) ? (queue->size - offset) : size);
+    if (size != 0u)
+    {
+        (void)memcpy(data, &queue->buffer[offset], first_size);
+        (void)memcpy(&((uint8_t*)data)[first_size], queue->buffer, size - first_size);
+    }
+}
+
+/** \brief Read the header of the message at a position of a queue, returns the size in bytes of the message */
+static uint32_t mqtt_broker_queue_read_header(const mqtt_broker_queue_t* const queue, const uint32_t position, uint8_t* const flags, 
+                                              uint16_t* const topic_length, uint32_t* const length, uint16_t* const packet_id)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    uint8_t header[MQTT_BROKER_QUEUE_HEADER_SIZE];
+    mqtt_broker_queue_read(queue, ((queue->head + position) % queue->size), header, sizeof(header));
+    (*flags) = header[0u];
+    (*topic_length) = (uint16_t)(header[1u] | (header[2u] << 8u));
+    (*length) = (uint32_t)header[3u] | ((uint32_t)header[4u] << 8u) | ((uint32_t)header[5u] << 16u) | ((uint32_t)header[6u] << 24u);
+    (*packet_id) = (uint16_t)(header[7u] | (header[8u] << 8u));
+
+    return (MQTT_BROKER_QUEUE_HEADER_SIZE + (*topic_length) + (*length));
+}
+
+/** \brief Write the state and the packet id of the message at a position of a queue */
+static void mqtt_broker_queue_write_state(mqtt_broker_queue_t* const queue, const uint32_t position, const uint8_t flags, 
+                                          const uint16_t packet_id)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    const uint32_t offset = ((queue->head + position) % queue->size);
+    const uint8_t packet_id_bytes[2u] = { (uint8_t)(packet_id & 0xFFu), (uint8_t)(packet_id >> 8u) };
+    mqtt_broker_queue_write(queue, offset, &flags, 1u);
+    mqtt_broker_queue_write(queue, ((offset + 7u) % queue->size), packet_id_bytes, sizeof(packet_id_bytes));
+}
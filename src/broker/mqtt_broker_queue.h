@@ -0,0 +1,108 @@
+/*
+Copyright(c) 2016 Cedric Jimenez
+
+This file is part of lw-mqtt.
+
+lw-mqtt is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+lw-mqtt is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MQTT_BROKER_QUEUE_H
+#define MQTT_BROKER_QUEUE_H
+
+#include "stdheaders.h"
+#include "mqtt.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+
+/** \brief Size in bytes of the header of a queued message : QoS and state (1), topic length (2), payload length (4), packet id (2) */
+#define MQTT_BROKER_QUEUE_HEADER_SIZE   9u
+
+
+/** \brief Queue of the QoS 1/2 messages waiting to be sent to a client, stored back to back in a ring buffer */
+typedef struct _mqtt_broker_queue_t
+{
+    /** \brief Ring buffer */
+    uint8_t* buffer;
+    /** \brief Size in bytes of the ring buffer */
+    uint32_t size;
+    /** \brief Offset of the oldest message */
+    uint32_t head;
+    /** \brief Number of bytes used by the messages */
+    uint32_t used;
+    /** \brief Number of messages */
+    uint32_t count;
+    /** \brief Number of oldest messages which have been sent and are waiting for their acknowledgement */
+    uint32_t sent;
+    /** \brief Number of bytes used by the sent messages, which is the position of the next message to send */
+    uint32_t sent_used;
+} mqtt_broker_queue_t;
+
+/** \brief Message read from a queue */
+typedef struct _mqtt_broker_queue_message_t
+{
+    /** \brief Topic, its buffer and its size are given by the caller */
+    mqtt_string_t topic;
+    /** \brief Payload buffer given by the caller */
+    uint8_t* payload;
+    /** \brief Size in bytes of the payload buffer, then of the payload */
+    uint32_t length;
+    /** \brief QoS */
+    uint8_t qos;
+    /** \brief Packet id used the last time the message was sent */
+    uint16_t packet_id;
+    /** \brief Indicate if the message has already been sent on a previous connection */
+    bool dup;
+    /** \brief Indicate if the message has been acknowledged while an older message has not */
+    bool acknowledged;
+} mqtt_broker_queue_message_t;
+
+
+/** \brief Initialize a queue on a ring buffer (a size of 0 disables the queue) */
+bool mqtt_broker_queue_init(mqtt_broker_queue_t* const queue, uint8_t* const buffer, const uint32_t size);
+
+/** \brief Append a message to a queue, fails with MQTT_ERR_BUFFER_TOO_SMALL if it is full */
+bool mqtt_broker_queue_push(mqtt_broker_queue_t* const queue, const mqtt_string_t* const topic, const void* const data, 
+                            const uint32_t length, const uint8_t qos);
+
+/** \brief Read a message without removing it, the position starts at 0 for the oldest message and is moved to the next message
+           => fails with MQTT_ERR_INPUT_STREAM_EMPTY after the last message */
+bool mqtt_broker_queue_peek(const mqtt_broker_queue_t* const queue, uint32_t* const position, mqtt_broker_queue_message_t* const message);
+
+/** \brief Remove the oldest message of a queue */
+bool mqtt_broker_queue_pop(mqtt_broker_queue_t* const queue);
+
+/** \brief Mark the next message to send of a queue as sent with a packet id */
+bool mqtt_broker_queue_set_sent(mqtt_broker_queue_t* const queue, const uint16_t packet_id);
+
+/** \brief Mark the sent message of a queue which has a packet id as acknowledged and remove the acknowledged messages
+           at the beginning of the queue => removed is 0 if the packet id doesn't match any sent message */
+bool mqtt_broker_queue_acknowledge(mqtt_broker_queue_t* const queue, const uint16_t packet_id, uint32_t* const removed);
+
+/** \brief Mark all the messages of a queue as not sent so that they are sent again, the acknowledged messages
+           are kept until the older ones are acknowledged */
+bool mqtt_broker_queue_rewind(mqtt_broker_queue_t* const queue);
+
+/** \brief Remove all the messages of a queue */
+bool mqtt_broker_queue_clear(mqtt_broker_queue_t* const queue);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* MQTT_BROKER_QUEUE_H */
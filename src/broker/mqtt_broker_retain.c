@@ -0,0 +1,582 @@
+/*
+Copyright(c) 2016 Cedric Jimenez
+
+This file is part of lw-mqtt.
+
+lw-mqtt is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+lw-mqtt is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "mqtt_broker_retain.h"
+
+#ifdef MQTT_BROKER_RETAIN_ENABLED
+
+#include "mqtt_error.h"
+#include "mqtt_crc32.h"
+
+
+/** \brief Extension of the file written by a compaction */
+#define MQTT_BROKER_RETAIN_TMP_EXTENSION    ".tmp"
+
+/** \brief Alignment in bytes of the heap and of its records */
+#define MQTT_BROKER_RETAIN_ALIGNMENT        8u
+
+
+/** \brief Magic of the retained store files */
+static const uint8_t s_mqtt_broker_retain_magic[8u] = { 'L', 'W', 'M', 'Q', 'R', 'E', 'T', 1u };
+
+
+/** \brief Map a retained store file and check its geometry */
+static bool mqtt_broker_retain_map(mqtt_broker_retain_t* const retain, const char* const path, const uint32_t entry_count, 
+                                   const uint64_t heap_size);
+
+/** \brief Compute the hash of a topic */
+static uint32_t mqtt_broker_retain_hash(const char* const str, const uint16_t size);
+
+/** \brief Size in bytes of a record in the heap */
+static uint64_t mqtt_broker_retain_record_size(const uint16_t topic_length, const uint32_t length);
+
+/** \brief Read the record of an index entry in place, an entry whose record is torn is marked as deleted */
+static bool mqtt_broker_retain_read(mqtt_broker_retain_t* const retain, const uint32_t index, mqtt_broker_retain_message_t* const message);
+
+/** \brief Look for the index entry of a topic, or for the entry to use for a new topic if not found */
+static bool mqtt_broker_retain_find(mqtt_broker_retain_t* const retain, const mqtt_const_string_t* const topic, const uint32_t hash, 
+                                    uint32_t* const index, bool* const found);
+
+/** \brief Write a record at the end of the allocated part of the heap and reference it from an index entry */
+static void mqtt_broker_retain_write(mqtt_broker_retain_t* const retain, const uint32_t index, const uint32_t hash, 
+                                     const mqtt_const_string_t* const topic, const void* const data, const uint32_t length, const uint8_t qos);
+
+/** \brief Copy the retained messages to a new file without the deleted ones and replace the store file by it */
+static bool mqtt_broker_retain_compact(mqtt_broker_retain_t* const retain);
+
+
+
+/** \brief Open or create a retained store, the geometry of a new file is computed from the maximum
+           number of messages and the size of the heap, an existing file keeps its own geometry */
+bool mqtt_broker_retain_open(mqtt_broker_retain_t* const retain, const char* const path, const uint32_t max_messages, const size_t heap_size)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((retain != NULL) &&
+        (path != NULL) &&
+        (strlen(path) + sizeof(MQTT_BROKER_RETAIN_TMP_EXTENSION) <= MQTT_BROKER_RETAIN_MAX_PATH_LENGTH) &&
+        (max_messages != 0u) &&
+        (max_messages <= (UINT32_MAX / 4u)) &&
+        (heap_size != 0u))
+    {
+        /* The index is kept at most 3/4 full to keep the probe sequences short */
+        uint32_t entry_count = 16u;
+        while (((entry_count / 4u) * 3u) < max_messages)
+        {
+            entry_count *= 2u;
+        }
+        (void)strcpy(retain->path, path);
+        ret = mqtt_broker_retain_map(retain, path, entry_count, heap_size);
+        if (ret)
+        {
+            /* The records written from now are only trusted after a clean close */
+            retain->check = (retain->header->clean == 0u);
+            retain->header->clean = 0u;
+            ret = mqtt_file_map_sync(&retain->map);
+            if (!ret)
+            {
+                (void)mqtt_file_map_close(&retain->map);
+            }
+        }
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Sync and close a retained store */
+bool mqtt_broker_retain_close(mqtt_broker_retain_t* const retain)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((retain != NULL) &&
+        (retain->map.data != NULL))
+    {
+        /* The clean flag is written once all the records are on the disk */
+        ret = mqtt_file_map_sync(&retain->map);
+        if (ret && !retain->check)
+        {
+            retain->header->clean = 1u;
+            ret = mqtt_file_map_sync(&retain->map);
+        }
+        ret = mqtt_file_map_close(&retain->map) && ret;
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Retain a message for a topic or delete the retained message of the topic if the payload is empty */
+bool mqtt_broker_retain_set(mqtt_broker_retain_t* const retain, const mqtt_string_t* const topic, const void* const data,
+                            const uint32_t length, const uint8_t qos)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((retain != NULL) &&
+        (retain->map.data != NULL) &&
+        (topic != NULL) &&
+        (topic->str != NULL) &&
+        (topic->size != 0u) &&
+        ((data != NULL) || (length == 0u)))
+    {
+        uint32_t index = 0u;
+        bool found = false;
+        mqtt_const_string_t const_topic;
+        const uint32_t hash = mqtt_broker_retain_hash(topic->str, topic->size);
+        const uint64_t size = mqtt_broker_retain_record_size(topic->size, length);
+        const_topic.str = topic->str;
+        const_topic.size = topic->size;
+
+        ret = mqtt_broker_retain_find(retain, &const_topic, hash, &index, &found);
+        if (ret && (length == 0u))
+        {
+            /* Delete */
+            if (found)
+            {
+                const mqtt_broker_retain_record_t* const record = (const mqtt_broker_retain_record_t*)&retain->map.data[retain->entries[index].offset];
+                retain->header->garbage += mqtt_broker_retain_record_size(record->topic_length, record->length);
+                retain->entries[index].offset = MQTT_BROKER_RETAIN_ENTRY_DELETED;
+                retain->header->count--;
+            }
+        }
+        else if (ret)
+        {
+            /* Make room by dropping the replaced and deleted records, only if it frees enough room */
+            const bool new_entry = (!found && (retain->entries[index].offset == MQTT_BROKER_RETAIN_ENTRY_EMPTY));
+            const uint32_t max_used = ((retain->header->entry_count / 4u) * 3u);
+            const bool heap_full = ((retain->header->heap_top + size) > retain->header->heap_size);
+            const bool index_full = (new_entry && (retain->header->used >= max_used));
+            if (heap_full || index_full)
+            {
+                if ((heap_full && ((retain->header->heap_top - retain->header->garbage + size) > retain->header->heap_size)) ||
+                    (index_full && (retain->header->count >= max_used)))
+                {
+                    mqtt_errno_set(MQTT_ERR_BUFFER_TOO_SMALL);
+                    ret = false;
+                }
+                else
+                {
+                    ret = mqtt_broker_retain_compact(retain);
+                    if (ret)
+                    {
+                        ret = mqtt_broker_retain_find(retain, &const_topic, hash, &index, &found);
+                    }
+                    if (ret && ((retain->header->heap_top + size) > retain->header->heap_size))
+                    {
+                        mqtt_errno_set(MQTT_ERR_BUFFER_TOO_SMALL);
+                        ret = false;
+                    }
+                }
+            }
+            if (ret)
+            {
+                mqtt_broker_retain_write(retain, index, hash, &const_topic, data, length, qos);
+            }
+        }
+        else
+        {
+            /* Error */
+        }
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Get the retained message of a topic in place */
+bool mqtt_broker_retain_get(mqtt_broker_retain_t* const retain, const mqtt_string_t* const topic, mqtt_broker_retain_message_t* const message)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((retain != NULL) &&
+        (retain->map.data != NULL) &&
+        (topic != NULL) &&
+        (topic->str != NULL) &&
+        (message != NULL))
+    {
+        uint32_t index = 0u;
+        bool found = false;
+        mqtt_const_string_t const_topic;
+        const_topic.str = topic->str;
+        const_topic.size = topic->size;
+        if (mqtt_broker_retain_find(retain, &const_topic, mqtt_broker_retain_hash(topic->str, topic->size), &index, &found) && found)
+        {
+            ret = mqtt_broker_retain_read(retain, index, message);
+        }
+        if (!ret)
+        {
+            mqtt_errno_set(MQTT_ERR_INPUT_STREAM_EMPTY);
+        }
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Get the next retained message in place, the position starts at 0 and is moved after the message */
+bool mqtt_broker_retain_next(mqtt_broker_retain_t* const retain, uint32_t* const position, mqtt_broker_retain_message_t* const message)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((retain != NULL) &&
+        (retain->map.data != NULL) &&
+        (position != NULL) &&
+        (message != NULL))
+    {
+        while (!ret && ((*position) < retain->header->entry_count))
+        {
+            ret = mqtt_broker_retain_read(retain, (*position), message);
+            (*position)++;
+        }
+        if (!ret)
+        {
+            mqtt_errno_set(MQTT_ERR_INPUT_STREAM_EMPTY);
+        }
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Wait until the changes of a retained store are stored on the disk */
+bool mqtt_broker_retain_sync(mqtt_broker_retain_t* const retain)
+{
+    bool ret = false;
+
+    /* Check params */
+    if (retain != NULL)
+    {
+        ret = mqtt_file_map_sync(&retain->map);
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+
+
+
+/** \brief Map a retained store file and check its geometry */
+static bool mqtt_broker_retain_map(mqtt_broker_retain_t* const retain, const char* const path, const uint32_t entry_count, 
+                                   const uint64_t heap_size)
+{
+    bool ret;
+    bool created = false;
+    const uint64_t index_size = (uint64_t)sizeof(mqtt_broker_retain_header_t) + ((uint64_t)entry_count * sizeof(mqtt_broker_retain_entry_t));
+    const uint64_t heap_offset = ((index_size + MQTT_BROKER_RETAIN_ALIGNMENT - 1u) & ~((uint64_t)MQTT_BROKER_RETAIN_ALIGNMENT - 1u));
+
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    ret = mqtt_file_map_open(&retain->map, path, (size_t)(heap_offset + heap_size), &created);
+    if (ret)
+    {
+        retain->header = (mqtt_broker_retain_header_t*)retain->map.data;
+        retain->entries = (mqtt_broker_retain_entry_t*)&retain->map.data[sizeof(mqtt_broker_retain_header_t)];
+        if (created)
+        {
+            /* The file is filled with zeros : all the entries are empty */
+            retain->header->entry_count = entry_count;
+            retain->header->clean = 1u;
+            retain->header->heap_offset = heap_offset;
+            retain->header->heap_size = heap_size;
+            (void)memcpy(retain->header->magic, s_mqtt_broker_retain_magic, sizeof(s_mqtt_broker_retain_magic));
+        }
+        else if ((retain->map.size < sizeof(mqtt_broker_retain_header_t)) ||
+                 (memcmp(retain->header->magic, s_mqtt_broker_retain_magic, sizeof(s_mqtt_broker_retain_magic)) != 0) ||
+                 (retain->header->entry_count == 0u) ||
+                 ((retain->header->entry_count & (retain->header->entry_count - 1u)) != 0u) ||
+                 (retain->header->heap_offset < ((uint64_t)sizeof(mqtt_broker_retain_header_t) + 
+                                                 ((uint64_t)retain->header->entry_count * sizeof(mqtt_broker_retain_entry_t)))) ||
+                 ((retain->header->heap_offset % MQTT_BROKER_RETAIN_ALIGNMENT) != 0u) ||
+                 ((retain->header->heap_offset + retain->header->heap_size) > retain->map.size) ||
+                 (retain->header->heap_top > retain->header->heap_size))
+        {
+            /* Not a retained store */
+            (void)mqtt_file_map_close(&retain->map);
+            mqtt_errno_set(MQTT_ERR_FILE_FAILED);
+            ret = false;
+        }
+        else
+        {
+            /* Used in place */
+        }
+    }
+
+    return ret;
+}
+
+/** \brief Compute the hash of a topic */
+static uint32_t mqtt_broker_retain_hash(const char* const str, const uint16_t size)
+{
+    /* FNV-1a */
+    uint16_t i;
+    uint32_t hash = 2166136261u;
+    for (i = 0u; i < size; i++)
+    {
+        hash ^= (uint8_t)str[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+/** \brief Size in bytes of a record in the heap */
+static uint64_t mqtt_broker_retain_record_size(const uint16_t topic_length, const uint32_t length)
+{
+    const uint64_t size = (uint64_t)sizeof(mqtt_broker_retain_record_t) + topic_length + length;
+    return ((size + MQTT_BROKER_RETAIN_ALIGNMENT - 1u) & ~((uint64_t)MQTT_BROKER_RETAIN_ALIGNMENT - 1u));
+}
+
+/** \brief Read the record of an index entry in place, an entry whose record is torn is marked as deleted */
+static bool mqtt_broker_retain_read(mqtt_broker_retain_t* const retain, const uint32_t index, mqtt_broker_retain_message_t* const message)
+{
+    bool ret = false;
+    mqtt_broker_retain_entry_t* const entry = &retain->entries[index];
+    const uint64_t offset = entry->offset;
+    const uint64_t heap_end = retain->header->heap_offset + retain->header->heap_top;
+
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    if (offset > MQTT_BROKER_RETAIN_ENTRY_DELETED)
+    {
+        /* The record must be in the allocated part of the heap and belong to the entry */
+        const mqtt_broker_retain_record_t* const record = (const mqtt_broker_retain_record_t*)&retain->map.data[offset];
+        ret = ((offset >= retain->header->heap_offset) && 
+               ((offset % MQTT_BROKER_RETAIN_ALIGNMENT) == 0u) &&
+               ((offset + sizeof(mqtt_broker_retain_record_t)) <= heap_end) &&
+               ((offset + mqtt_broker_retain_record_size(record->topic_length, record->length)) <= heap_end) &&
+               (record->entry == index) &&
+               (record->topic_length != 0u));
+        if (ret && retain->check)
+        {
+            const uint32_t crc = mqtt_crc32_update(MQTT_CRC32_INIT, &record->entry, 
+                                                   sizeof(mqtt_broker_retain_record_t) - sizeof(uint32_t) + record->topic_length + record->length);
+            ret = ((crc ^ MQTT_CRC32_INIT) == record->crc);
+        }
+        if (ret)
+        {
+            message->topic.str = (const char*)&record[1u];
+            message->topic.size = record->topic_length;
+            message->payload = &((const uint8_t*)&record[1u])[record->topic_length];
+            message->length = record->length;
+            message->qos = record->qos;
+        }
+        else
+        {
+            /* Torn by a crash */
+            entry->offset = MQTT_BROKER_RETAIN_ENTRY_DELETED;
+            if (retain->header->count != 0u)
+            {
+                retain->header->count--;
+            }
+        }
+    }
+
+    return ret;
+}
+
+/** \brief Look for the index entry of a topic, or for the entry to use for a new topic if not found */
+static bool mqtt_broker_retain_find(mqtt_broker_retain_t* const retain, const mqtt_const_string_t* const topic, const uint32_t hash, 
+                                    uint32_t* const index, bool* const found)
+{
+    bool ret = false;
+    bool end = false;
+    uint32_t probe;
+    const uint32_t mask = retain->header->entry_count - 1u;
+
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    /* Linear probing until an empty entry, the first deleted entry is reused for a new topic */
+    (*found) = false;
+    for (probe = 0u; !end && (probe <= mask); probe++)
+    {
+        const uint32_t current = ((hash + probe) & mask);
+        const mqtt_broker_retain_entry_t* const entry = &retain->entries[current];
+        mqtt_broker_retain_message_t message;
+
+        if (entry->offset == MQTT_BROKER_RETAIN_ENTRY_EMPTY)
+        {
+            if (!ret)
+            {
+                (*index) = current;
+                ret = true;
+            }
+            end = true;
+        }
+        else if ((entry->hash == hash) && mqtt_broker_retain_read(retain, current, &message) &&
+                 (message.topic.size == topic->size) && (memcmp(message.topic.str, topic->str, topic->size) == 0))
+        {
+            (*index) = current;
+            (*found) = true;
+            ret = true;
+            end = true;
+        }
+        else if (!ret && (entry->offset == MQTT_BROKER_RETAIN_ENTRY_DELETED))
+        {
+            (*index) = current;
+            ret = true;
+        }
+        else
+        {
+            /* Next entry */
+        }
+    }
+    if (!ret)
+    {
+        mqtt_errno_set(MQTT_ERR_BUFFER_TOO_SMALL);
+    }
+
+    return ret;
+}
+
+/** \brief Write a record at the end of the allocated part of the heap and reference it from an index entry */
+static void mqtt_broker_retain_write(mqtt_broker_retain_t* const retain, const uint32_t index, const uint32_t hash, 
+                                     const mqtt_const_string_t* const topic, const void* const data, const uint32_t length, const uint8_t qos)
+{
+    mqtt_broker_retain_entry_t* const entry = &retain->entries[index];
+    const uint64_t offset = retain->header->heap_offset + retain->header->heap_top;
+    mqtt_broker_retain_record_t* const record = (mqtt_broker_retain_record_t*)&retain->map.data[offset];
+    uint8_t* const record_data = (uint8_t*)&record[1u];
+
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    /* Record, outside of the allocated part of the heap until it is complete */
+    record->entry = index;
+    record->length = length;
+    record->topic_length = topic->size;
+    record->qos = qos;
+    record->reserved = 0u;
+    (void)memcpy(record_data, topic->str, topic->size);
+    (void)memcpy(&record_data[topic->size], data, length);
+    record->crc = (mqtt_crc32_update(MQTT_CRC32_INIT, &record->entry, 
+                                     sizeof(mqtt_broker_retain_record_t) - sizeof(uint32_t) + topic->size + length) ^ MQTT_CRC32_INIT);
+    retain->header->heap_top += mqtt_broker_retain_record_size(topic->size, length);
+
+    /* Entry */
+    if (entry->offset > MQTT_BROKER_RETAIN_ENTRY_DELETED)
+    {
+        const mqtt_broker_retain_record_t* const replaced = (const mqtt_broker_retain_record_t*)&retain->map.data[entry->offset];
+        retain->header->garbage += mqtt_broker_retain_record_size(replaced->topic_length, replaced->length);
+    }
+    else
+    {
+        if (entry->offset == MQTT_BROKER_RETAIN_ENTRY_EMPTY)
+        {
+            retain->header->used++;
+        }
+        retain->header->count++;
+    }
+    entry->hash = hash;
+    entry->offset = offset;
+}
+
+/** \brief Copy the retained messages to a new file without the deleted ones and replace the store file by it */
+static bool mqtt_broker_retain_compact(mqtt_broker_retain_t* const retain)
+{
+    bool ret;
+    char tmp_path[MQTT_BROKER_RETAIN_MAX_PATH_LENGTH];
+    mqtt_broker_retain_t compacted;
+    const uint32_t entry_count = retain->header->entry_count;
+    const uint64_t heap_size = retain->header->heap_size;
+
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    /* New file with the same geometry */
+    (void)strcpy(tmp_path, retain->path);
+    (void)strcat(tmp_path, MQTT_BROKER_RETAIN_TMP_EXTENSION);
+    (void)remove(tmp_path);
+    ret = mqtt_broker_retain_map(&compacted, tmp_path, entry_count, heap_size);
+    if (ret)
+    {
+        uint32_t position = 0u;
+        mqtt_broker_retain_message_t message;
+
+        /* Copy the valid records, the torn ones are left behind */
+        compacted.check = false;
+        while (mqtt_broker_retain_next(retain, &position, &message))
+        {
+            uint32_t index = 0u;
+            bool found = false;
+            const uint32_t hash = retain->entries[position - 1u].hash;
+            (void)mqtt_broker_retain_find(&compacted, &message.topic, hash, &index, &found);
+            mqtt_broker_retain_write(&compacted, index, hash, &message.topic, message.payload, message.length, message.qos);
+        }
+
+        /* The new file is complete on the disk before it replaces the store file */
+        compacted.header->clean = 0u;
+        ret = mqtt_file_map_sync(&compacted.map);
+        ret = mqtt_file_map_close(&compacted.map) && ret;
+        if (ret)
+        {
+            (void)mqtt_file_map_close(&retain->map);
+            ret = mqtt_file_replace(tmp_path, retain->path);
+            ret = mqtt_broker_retain_map(retain, retain->path, entry_count, heap_size) && ret;
+            if (ret)
+            {
+                retain->check = false;
+            }
+        }
+        else
+        {
+            (void)remove(tmp_path);
+        }
+    }
+
+    return ret;
+}
+
+#endif /* MQTT_BROKER_RETAIN_ENABLED */
@@ -0,0 +1,158 @@
+/*
+Copyright(c) 2016 Cedric Jimenez
+
+This file is part of lw-mqtt.
+
+lw-mqtt is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+lw-mqtt is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MQTT_BROKER_RETAIN_H
+#define MQTT_BROKER_RETAIN_H
+
+#include "stdheaders.h"
+#include "mqtt_config.h"
+
+#ifdef MQTT_BROKER_RETAIN_ENABLED
+
+#include "mqtt.h"
+#include "mqtt_file.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+
+/** \brief Offset of an index entry which has never been used */
+#define MQTT_BROKER_RETAIN_ENTRY_EMPTY      0u
+
+/** \brief Offset of an index entry whose message has been deleted */
+#define MQTT_BROKER_RETAIN_ENTRY_DELETED    1u
+
+
+/** \brief Header of a retained store file */
+typedef struct _mqtt_broker_retain_header_t
+{
+    /** \brief Magic */
+    uint8_t magic[8u];
+    /** \brief Number of entries of the index (power of 2) */
+    uint32_t entry_count;
+    /** \brief 1 if the file has been closed without any unchecked record, 0 while it is opened */
+    uint32_t clean;
+    /** \brief Offset in bytes of the heap in the file */
+    uint64_t heap_offset;
+    /** \brief Size in bytes of the heap */
+    uint64_t heap_size;
+    /** \brief Size in bytes of the allocated part of the heap */
+    uint64_t heap_top;
+    /** \brief Size in bytes of the records of the heap which are not referenced anymore */
+    uint64_t garbage;
+    /** \brief Number of retained messages */
+    uint32_t count;
+    /** \brief Number of index entries which are not empty (retained and deleted messages) */
+    uint32_t used;
+} mqtt_broker_retain_header_t;
+
+/** \brief Entry of the index of a retained store file, the index is an open addressing hash table of the topics */
+typedef struct _mqtt_broker_retain_entry_t
+{
+    /** \brief Offset in bytes of the record in the file, MQTT_BROKER_RETAIN_ENTRY_EMPTY or MQTT_BROKER_RETAIN_ENTRY_DELETED */
+    uint64_t offset;
+    /** \brief Hash of the topic */
+    uint32_t hash;
+    /** \brief Reserved */
+    uint32_t reserved;
+} mqtt_broker_retain_entry_t;
+
+/** \brief Header of a record of the heap, followed by the topic and by the payload */
+typedef struct _mqtt_broker_retain_record_t
+{
+    /** \brief CRC-32 of the rest of the record */
+    uint32_t crc;
+    /** \brief Index of the entry which references the record */
+    uint32_t entry;
+    /** \brief Size in bytes of the payload */
+    uint32_t length;
+    /** \brief Size in bytes of the topic */
+    uint16_t topic_length;
+    /** \brief QoS */
+    uint8_t qos;
+    /** \brief Reserved */
+    uint8_t reserved;
+} mqtt_broker_retain_record_t;
+
+/** \brief Retained message read in place from the store */
+typedef struct _mqtt_broker_retain_message_t
+{
+    /** \brief Topic */
+    mqtt_const_string_t topic;
+    /** \brief Payload */
+    const uint8_t* payload;
+    /** \brief Size in bytes of the payload */
+    uint32_t length;
+    /** \brief QoS */
+    uint8_t qos;
+} mqtt_broker_retain_message_t;
+
+/** \brief Retained messages of a MQTT broker stored in a memory-mapped file : an index of the topics and a heap
+           of records, used in place when the file is opened. A record is written to the free part of the heap before
+           its index entry is updated and it is bound to its entry and protected by a CRC-32, so that the records
+           torn by a crash are detected when they are read, they are only checked if the file has not been
+           closed cleanly. The heap is compacted in a new file when it is full. */
+typedef struct _mqtt_broker_retain_t
+{
+    /** \brief Mapped file, its data is NULL if the store is not opened */
+    mqtt_file_map_t map;
+    /** \brief Header of the file */
+    mqtt_broker_retain_header_t* header;
+    /** \brief Index of the file */
+    mqtt_broker_retain_entry_t* entries;
+    /** \brief Indicate if the records must be checked because the file has not been closed cleanly */
+    bool check;
+    /** \brief Path of the file */
+    char path[MQTT_BROKER_RETAIN_MAX_PATH_LENGTH];
+} mqtt_broker_retain_t;
+
+
+/** \brief Open or create a retained store, the geometry of a new file is computed from the maximum
+           number of messages and the size of the heap, an existing file keeps its own geometry */
+bool mqtt_broker_retain_open(mqtt_broker_retain_t* const retain, const char* const path, const uint32_t max_messages, const size_t heap_size);
+
+/** \brief Sync and close a retained store */
+bool mqtt_broker_retain_close(mqtt_broker_retain_t* const retain);
+
+/** \brief Retain a message for a topic or delete the retained message of the topic if the payload is empty
+           => fails with MQTT_ERR_BUFFER_TOO_SMALL if the store is full even after a compaction */
+bool mqtt_broker_retain_set(mqtt_broker_retain_t* const retain, const mqtt_string_t* const topic, const void* const data,
+                            const uint32_t length, const uint8_t qos);
+
+/** \brief Get the retained message of a topic in place
+           => fails with MQTT_ERR_INPUT_STREAM_EMPTY if the topic has no retained message */
+bool mqtt_broker_retain_get(mqtt_broker_retain_t* const retain, const mqtt_string_t* const topic, mqtt_broker_retain_message_t* const message);
+
+/** \brief Get the next retained message in place, the position starts at 0 and is moved after the message
+           => fails with MQTT_ERR_INPUT_STREAM_EMPTY after the last message */
+bool mqtt_broker_retain_next(mqtt_broker_retain_t* const retain, uint32_t* const position, mqtt_broker_retain_message_t* const message);
+
+/** \brief Wait until the changes of a retained store are stored on the disk */
+bool mqtt_broker_retain_sync(mqtt_broker_retain_t* const retain);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* MQTT_BROKER_RETAIN_ENABLED */
+
+#endif /* MQTT_BROKER_RETAIN_H */
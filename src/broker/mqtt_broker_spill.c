@@ -0,0 +1,954 @@
+/*
+Copyright(c) 2016 Cedric Jimenez
+
+This file is part of lw-mqtt.
+
+lw-mqtt is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+lw-mqtt is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "mqtt_broker_spill.h"
+
+#ifdef MQTT_BROKER_SPILL_ENABLED
+
+#ifndef MQTT_MULTITASKING_ENABLED
+#error "MQTT_BROKER_SPILL_ENABLED requires MQTT_MULTITASKING_ENABLED"
+#endif /* MQTT_MULTITASKING_ENABLED */
+
+#include "mqtt_error.h"
+
+
+#if defined(__GNUC__) || defined(__clang__)
+
+/** \brief Load a value written by the other thread */
+#define MQTT_BROKER_SPILL_LOAD_ACQUIRE(ptr)             __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+
+/** \brief Store a value read by the other thread */
+#define MQTT_BROKER_SPILL_STORE_RELEASE(ptr, value)     __atomic_store_n((ptr), (value), __ATOMIC_RELEASE)
+
+#else
+
+/** \brief Load a value written by the other thread (volatile accesses have acquire semantics with MSVC) */
+#define MQTT_BROKER_SPILL_LOAD_ACQUIRE(ptr)             (*(ptr))
+
+/** \brief Store a value read by the other thread (volatile accesses have release semantics with MSVC) */
+#define MQTT_BROKER_SPILL_STORE_RELEASE(ptr, value)     ((*(ptr)) = (value))
+
+#endif /* defined(__GNUC__) || defined(__clang__) */
+
+/** \brief Size in bytes of the header of a record */
+#define MQTT_BROKER_SPILL_HEADER_SIZE       ((uint32_t)sizeof(mqtt_broker_spill_record_t))
+
+/** \brief Maximum length in bytes of the path of a segment, its number is appended to the path of the spill ('.' and 10 digits) */
+#define MQTT_BROKER_SPILL_SEGMENT_PATH_LENGTH   (MQTT_BROKER_SPILL_MAX_PATH_LENGTH + 11u)
+
+/** \brief Offset of the next read which forces a seek in the segment being read */
+#define MQTT_BROKER_SPILL_NO_OFFSET         0xFFFFFFFFu
+
+
+/** \brief Size in bytes of the topic and of the payload of a record */
+static uint32_t mqtt_broker_spill_data_size(const mqtt_broker_spill_record_t* const record);
+
+/** \brief Append a record to a ring, returns false if it doesn't have enough room */
+static bool mqtt_broker_spill_ring_push(mqtt_broker_spill_ring_t* const ring, const mqtt_broker_spill_record_t* const record, 
+                                        const void* const topic, const void* const data);
+
+/** \brief Read the header of the oldest record of a ring, returns false if the ring is empty */
+static bool mqtt_broker_spill_ring_peek(const mqtt_broker_spill_ring_t* const ring, mqtt_broker_spill_record_t* const record);
+
+/** \brief Copy data to a ring, wrapping at its end */
+static void mqtt_broker_spill_ring_write(mqtt_broker_spill_ring_t* const ring, const uint32_t position, const void* const data, const uint32_t size);
+
+/** \brief Copy data from a ring, wrapping at its end */
+static void mqtt_broker_spill_ring_read(const mqtt_broker_spill_ring_t* const ring, const uint32_t position, void* const data, const uint32_t size);
+
+/** \brief Build the path of a segment */
+static void mqtt_broker_spill_get_path(const mqtt_broker_spill_t* const spill, const uint32_t segment, char* const path);
+
+/** \brief I/O thread */
+static void mqtt_broker_spill_thread(void* const param);
+
+/** \brief Write the spilled messages to the segments and register the refill requests, returns false if there was none */
+static bool mqtt_broker_spill_write_requests(mqtt_broker_spill_t* const spill);
+
+/** \brief Append a message to the segment being written, a new segment is started when it is full */
+static void mqtt_broker_spill_write_message(mqtt_broker_spill_t* const spill, mqtt_broker_spill_stream_t* const stream, const uint32_t size);
+
+/** \brief Serve the pending refills, returns false if none of them made progress */
+static bool mqtt_broker_spill_serve_refills(mqtt_broker_spill_t* const spill);
+
+/** \brief Read back the messages of a pending refill, returns true once its end has been sent */
+static bool mqtt_broker_spill_serve_refill(mqtt_broker_spill_t* const spill, mqtt_broker_spill_stream_t* const stream, bool* const progress);
+
+/** \brief Read data from a segment */
+static bool mqtt_broker_spill_read(mqtt_broker_spill_t* const spill, const uint32_t segment, const uint32_t offset, void* const data, const uint32_t size);
+
+/** \brief Remove the oldest segments which are not needed by any stream anymore */
+static void mqtt_broker_spill_collect(mqtt_broker_spill_t* const spill);
+
+
+
+/** \brief Get the size in bytes of the buffers of a spill (0 if the ring size is 0) */
+size_t mqtt_broker_spill_get_buffers_size(const uint32_t ring_size, const uint32_t record_size)
+{
+    size_t size = 0u;
+
+    /* Request ring, response ring, record buffer, write buffer and read-ahead buffer */
+    if (ring_size != 0u)
+    {
+        size = (2u * (size_t)ring_size) + MQTT_BROKER_SPILL_HEADER_SIZE + record_size + (2u * (size_t)MQTT_BROKER_SPILL_BUFFER_SIZE);
+    }
+
+    return size;
+}
+
+/** \brief Initialize a spill on its streams and its buffers (the ring size must be a power of 2, 0 to disable the spill),
+           the record size is the maximum size of a topic and of a payload */
+bool mqtt_broker_spill_init(mqtt_broker_spill_t* const spill, mqtt_broker_spill_stream_t* const streams, const uint32_t stream_count,
+                            uint8_t* const buffers, const uint32_t ring_size, const uint32_t record_size)
+{
+    bool ret = false;
+
+    /* Check params, a ring must hold the biggest message and the end of a refill */
+    if ((spill != NULL) &&
+        (streams != NULL) &&
+        (stream_count != 0u) &&
+        ((ring_size == 0u) || 
+         ((buffers != NULL) && ((ring_size & (ring_size - 1u)) == 0u) && (ring_size >= ((2u * MQTT_BROKER_SPILL_HEADER_SIZE) + record_size)))))
+    {
+        (void)memset(spill, 0, sizeof(mqtt_broker_spill_t));
+        (void)memset(streams, 0, (size_t)stream_count * sizeof(mqtt_broker_spill_stream_t));
+        spill->streams = streams;
+        spill->stream_count = stream_count;
+        if (ring_size != 0u)
+        {
+            spill->requests.buffer = buffers;
+            spill->requests.size = ring_size;
+            spill->responses.buffer = &buffers[ring_size];
+            spill->responses.size = ring_size;
+            spill->record_buffer = &buffers[2u * (size_t)ring_size];
+            spill->record_buffer_size = MQTT_BROKER_SPILL_HEADER_SIZE + record_size;
+            spill->write_buffer = &spill->record_buffer[spill->record_buffer_size];
+            spill->read_buffer = &spill->write_buffer[MQTT_BROKER_SPILL_BUFFER_SIZE];
+        }
+        ret = true;
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Open a spill and start its I/O thread, the segments are named <path>.<number> */
+bool mqtt_broker_spill_open(mqtt_broker_spill_t* const spill, const char* const path)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((spill != NULL) &&
+        (path != NULL) &&
+        (strlen(path) < MQTT_BROKER_SPILL_MAX_PATH_LENGTH) &&
+        (spill->requests.buffer != NULL) &&
+        !spill->opened)
+    {
+        uint32_t i;
+        char segment_path[MQTT_BROKER_SPILL_SEGMENT_PATH_LENGTH];
+
+        /* Start from empty rings and an empty first segment */
+        (void)strcpy(spill->path, path);
+        for (i = 0u; i < spill->stream_count; i++)
+        {
+            mqtt_broker_spill_stream_t* const stream = &spill->streams[i];
+            stream->count = 0u;
+            stream->refilling = false;
+            stream->io_generation = stream->generation;
+            stream->io_count = 0u;
+            stream->budget = 0u;
+            stream->lost = 0u;
+            stream->waiting = false;
+            stream->next_waiting = NULL;
+        }
+        spill->requests.write_position = 0u;
+        spill->requests.read_position = 0u;
+        spill->responses.write_position = 0u;
+        spill->responses.read_position = 0u;
+        spill->refilling_count = 0u;
+        spill->write_segment = 0u;
+        spill->write_offset = 0u;
+        spill->read_file = NULL;
+        spill->first_segment = 0u;
+        spill->collect = false;
+        spill->first_waiting = NULL;
+        spill->last_waiting = NULL;
+        mqtt_broker_spill_get_path(spill, 0u, segment_path);
+        spill->write_file = fopen(segment_path, "wb");
+        if (spill->write_file != NULL)
+        {
+            (void)setvbuf(spill->write_file, (char*)spill->write_buffer, _IOFBF, MQTT_BROKER_SPILL_BUFFER_SIZE);
+
+            /* Start the I/O thread */
+            spill->running = 1u;
+            ret = mqtt_thread_create(&spill->thread, mqtt_broker_spill_thread, spill);
+            if (ret)
+            {
+                spill->opened = true;
+            }
+            else
+            {
+                (void)fclose(spill->write_file);
+                spill->write_file = NULL;
+                (void)remove(segment_path);
+            }
+        }
+        else
+        {
+            mqtt_errno_set(MQTT_ERR_FILE_FAILED);
+        }
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Stop the I/O thread and remove the segments, the spilled messages are discarded */
+bool mqtt_broker_spill_close(mqtt_broker_spill_t* const spill)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((spill != NULL) &&
+        spill->opened)
+    {
+        uint32_t i;
+        uint32_t segment;
+        char path[MQTT_BROKER_SPILL_SEGMENT_PATH_LENGTH];
+
+        /* Stop the I/O thread */
+        MQTT_BROKER_SPILL_STORE_RELEASE(&spill->running, 0u);
+        ret = mqtt_thread_join(&spill->thread);
+
+        /* Remove the segments */
+        if (spill->write_file != NULL)
+        {
+            (void)fclose(spill->write_file);
+            spill->write_file = NULL;
+        }
+        if (spill->read_file != NULL)
+        {
+            (void)fclose(spill->read_file);
+            spill->read_file = NULL;
+        }
+        for (segment = spill->first_segment; segment <= spill->write_segment; segment++)
+        {
+            mqtt_broker_spill_get_path(spill, segment, path);
+            (void)remove(path);
+        }
+
+        /* Discard the spilled messages */
+        for (i = 0u; i < spill->stream_count; i++)
+        {
+            spill->streams[i].count = 0u;
+            spill->streams[i].refilling = false;
+        }
+        spill->refilling_count = 0u;
+        spill->opened = false;
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Spill a message of a stream, fails with MQTT_ERR_BUFFER_TOO_SMALL if the I/O thread is late */
+bool mqtt_broker_spill_push(mqtt_broker_spill_t* const spill, mqtt_broker_spill_stream_t* const stream, const mqtt_string_t* const topic,
+                            const void* const data, const uint32_t length, const uint8_t qos)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((spill != NULL) &&
+        spill->opened &&
+        (stream != NULL) &&
+        (topic != NULL) &&
+        (!((data == NULL) && (length != 0u))) &&
+        (((uint32_t)topic->size + length) <= (spill->record_buffer_size - MQTT_BROKER_SPILL_HEADER_SIZE)))
+    {
+        mqtt_broker_spill_record_t record;
+        record.stream = (uint32_t)(stream - spill->streams);
+        record.generation = stream->generation;
+        record.length = length;
+        record.topic_length = topic->size;
+        record.type = MQTT_BROKER_SPILL_RECORD_MESSAGE;
+        record.qos = qos;
+        ret = mqtt_broker_spill_ring_push(&spill->requests, &record, topic->str, data);
+        if (ret)
+        {
+            stream->count++;
+        }
+        else
+        {
+            mqtt_errno_set(MQTT_ERR_BUFFER_TOO_SMALL);
+        }
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Request the oldest spilled messages of a stream which fit in the given number of bytes of its queue */
+bool mqtt_broker_spill_refill(mqtt_broker_spill_t* const spill, mqtt_broker_spill_stream_t* const stream, const uint32_t room)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((spill != NULL) &&
+        spill->opened &&
+        (stream != NULL) &&
+        !stream->refilling &&
+        (room != 0u))
+    {
+        mqtt_broker_spill_record_t record;
+        record.stream = (uint32_t)(stream - spill->streams);
+        record.generation = stream->generation;
+        record.length = room;
+        record.topic_length = 0u;
+        record.type = MQTT_BROKER_SPILL_RECORD_REFILL;
+        record.qos = 0u;
+        ret = mqtt_broker_spill_ring_push(&spill->requests, &record, NULL, NULL);
+        if (ret)
+        {
+            stream->refilling = true;
+            spill->refilling_count++;
+        }
+        else
+        {
+            mqtt_errno_set(MQTT_ERR_BUFFER_TOO_SMALL);
+        }
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Get the next message read back, in the order of each stream */
+bool mqtt_broker_spill_receive(mqtt_broker_spill_t* const spill, mqtt_broker_spill_stream_t** const stream, mqtt_broker_queue_message_t* const message)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((spill != NULL) &&
+        spill->opened &&
+        (stream != NULL) &&
+        (message != NULL) &&
+        (message->topic.str != NULL))
+    {
+        mqtt_broker_spill_record_t record;
+        while (!ret && mqtt_broker_spill_ring_peek(&spill->responses, &record))
+        {
+            mqtt_broker_spill_stream_t* const record_stream = &spill->streams[record.stream];
+            const uint32_t position = spill->responses.read_position + MQTT_BROKER_SPILL_HEADER_SIZE;
+
+            /* The records of a stream which has been reset in the meantime are skipped */
+            if (record.generation == record_stream->generation)
+            {
+                if (record.type == MQTT_BROKER_SPILL_RECORD_END)
+                {
+                    /* The lost messages won't be read back */
+                    record_stream->count -= ((record.length < record_stream->count) ? record.length : record_stream->count);
+                    if (record_stream->refilling)
+                    {
+                        record_stream->refilling = false;
+                        spill->refilling_count--;
+                    }
+                }
+                else
+                {
+                    if ((record.topic_length <= message->topic.size) && (record.length <= message->length) &&
+                        ((record.length == 0u) || (message->payload != NULL)))
+                    {
+                        mqtt_broker_spill_ring_read(&spill->responses, position, message->topic.str, record.topic_length);
+                        mqtt_broker_spill_ring_read(&spill->responses, position + record.topic_length, message->payload, record.length);
+                        message->topic.size = record.topic_length;
+                        message->length = record.length;
+                        message->qos = record.qos;
+                        (*stream) = record_stream;
+                        ret = true;
+                    }
+                    record_stream->count--;
+                }
+            }
+            MQTT_BROKER_SPILL_STORE_RELEASE(&spill->responses.read_position, 
+                                            position + mqtt_broker_spill_data_size(&record));
+        }
+        if (!ret)
+        {
+            mqtt_errno_set(MQTT_ERR_INPUT_STREAM_EMPTY);
+        }
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Discard the spilled messages of a stream */
+bool mqtt_broker_spill_reset(mqtt_broker_spill_t* const spill, mqtt_broker_spill_stream_t* const stream)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((spill != NULL) &&
+        (stream != NULL))
+    {
+        /* The I/O thread skips the messages of the previous generation */
+        if (stream->refilling)
+        {
+            stream->refilling = false;
+            spill->refilling_count--;
+        }
+        stream->count = 0u;
+        MQTT_BROKER_SPILL_STORE_RELEASE(&stream->generation, stream->generation + 1u);
+        ret = true;
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+
+
+
+/** \brief Size in bytes of the topic and of the payload of a record */
+static uint32_t mqtt_broker_spill_data_size(const mqtt_broker_spill_record_t* const record)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    uint32_t size = 0u;
+    if (record->type == MQTT_BROKER_SPILL_RECORD_MESSAGE)
+    {
+        size = (uint32_t)record->topic_length + record->length;
+    }
+
+    return size;
+}
+
+/** \brief Append a record to a ring, returns false if it doesn't have enough room */
+static bool mqtt_broker_spill_ring_push(mqtt_broker_spill_ring_t* const ring, const mqtt_broker_spill_record_t* const record, 
+                                        const void* const topic, const void* const data)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    bool ret = false;
+    const uint32_t position = ring->write_position;
+    const uint32_t used = position - MQTT_BROKER_SPILL_LOAD_ACQUIRE(&ring->read_position);
+    const uint32_t size = MQTT_BROKER_SPILL_HEADER_SIZE + mqtt_broker_spill_data_size(record);
+
+    if (size <= (ring->size - used))
+    {
+        /* The record is handed over to the consumer once it is fully written */
+        mqtt_broker_spill_ring_write(ring, position, record, MQTT_BROKER_SPILL_HEADER_SIZE);
+        if (record->type == MQTT_BROKER_SPILL_RECORD_MESSAGE)
+        {
+            mqtt_broker_spill_ring_write(ring, position + MQTT_BROKER_SPILL_HEADER_SIZE, topic, record->topic_length);
+            mqtt_broker_spill_ring_write(ring, position + MQTT_BROKER_SPILL_HEADER_SIZE + record->topic_length, data, record->length);
+        }
+        MQTT_BROKER_SPILL_STORE_RELEASE(&ring->write_position, position + size);
+        ret = true;
+    }
+
+    return ret;
+}
+
+/** \brief Read the header of the oldest record of a ring, returns false if the ring is empty */
+static bool mqtt_broker_spill_ring_peek(const mqtt_broker_spill_ring_t* const ring, mqtt_broker_spill_record_t* const record)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    bool ret = false;
+    const uint32_t position = ring->read_position;
+
+    /* A record is always fully written when the write position is updated */
+    if (MQTT_BROKER_SPILL_LOAD_ACQUIRE(&ring->write_position) != position)
+    {
+        mqtt_broker_spill_ring_read(ring, position, record, MQTT_BROKER_SPILL_HEADER_SIZE);
+        ret = true;
+    }
+
+    return ret;
+}
+
+/** \brief Copy data to a ring, wrapping at its end */
+static void mqtt_broker_spill_ring_write(mqtt_broker_spill_ring_t* const ring, const uint32_t position, const void* const data, const uint32_t size)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    if (size != 0u)
+    {
+        const uint32_t offset = (position & (ring->size - 1u));
+        const uint32_t first_size = (((ring->size - offset) < size) ? (ring->size - offset) : size);
+        (void)memcpy(&ring->buffer[offset], data, first_size);
+        if (first_size != size)
+        {
+            (void)memcpy(ring->buffer, &((const uint8_t*)data)[first_size], size - first_size);
+        }
+    }
+}
+
+/** \brief Copy data from a ring, wrapping at its end */
+static void mqtt_broker_spill_ring_read(const mqtt_broker_spill_ring_t* const ring, const uint32_t position, void* const data, const uint32_t size)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    if (size != 0u)
+    {
+        const uint32_t offset = (position & (ring->size - 1u));
+        const uint32_t first_size = (((ring->size - offset) < size) ? (ring->size - offset) : size);
+        (void)memcpy(data, &ring->buffer[offset], first_size);
+        if (first_size != size)
+        {
+            (void)memcpy(&((uint8_t*)data)[first_size], ring->buffer, size - first_size);
+        }
+    }
+}
+
+/** \brief Build the path of a segment */
+static void mqtt_broker_spill_get_path(const mqtt_broker_spill_t* const spill, const uint32_t segment, char* const path)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    (void)snprintf(path, MQTT_BROKER_SPILL_SEGMENT_PATH_LENGTH, "%s.%08lu", spill->path, (unsigned long)segment);
+}
+
+/** \brief I/O thread */
+static void mqtt_broker_spill_thread(void* const param)
+{
+    mqtt_broker_spill_t* const spill = (mqtt_broker_spill_t*)param;
+
+    while (MQTT_BROKER_SPILL_LOAD_ACQUIRE(&spill->running) != 0u)
+    {
+        /* The messages are written before the refills are served so that they can be read back right away */
+        bool busy = mqtt_broker_spill_write_requests(spill);
+        if (mqtt_broker_spill_serve_refills(spill))
+        {
+            busy = true;
+        }
+        if (spill->collect)
+        {
+            mqtt_broker_spill_collect(spill);
+        }
+        if (!busy)
+        {
+            (void)mqtt_thread_sleep(MQTT_BROKER_SPILL_PERIOD);
+        }
+    }
+}
+
+/** \brief Write the spilled messages to the segments and register the refill requests, returns false if there was none */
+static bool mqtt_broker_spill_write_requests(mqtt_broker_spill_t* const spill)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    bool ret = false;
+    mqtt_broker_spill_record_t record;
+
+    while (mqtt_broker_spill_ring_peek(&spill->requests, &record))
+    {
+        mqtt_broker_spill_stream_t* const stream = &spill->streams[record.stream];
+        const uint32_t position = spill->requests.read_position + MQTT_BROKER_SPILL_HEADER_SIZE;
+        const uint32_t data_size = mqtt_broker_spill_data_size(&record);
+
+        /* The messages of the previous generation are forgotten when a stream has been reset */
+        if (record.generation != stream->io_generation)
+        {
+            stream->io_generation = record.generation;
+            stream->io_count = 0u;
+            stream->budget = 0u;
+            stream->lost = 0u;
+        }
+        if (record.type == MQTT_BROKER_SPILL_RECORD_MESSAGE)
+        {
+            (void)memcpy(spill->record_buffer, &record, MQTT_BROKER_SPILL_HEADER_SIZE);
+            mqtt_broker_spill_ring_read(&spill->requests, position, &spill->record_buffer[MQTT_BROKER_SPILL_HEADER_SIZE], data_size);
+            mqtt_broker_spill_write_message(spill, stream, MQTT_BROKER_SPILL_HEADER_SIZE + data_size);
+        }
+        else
+        {
+            /* Queue the refill */
+            stream->budget = record.length;
+            if (!stream->waiting)
+            {
+                stream->waiting = true;
+                stream->next_waiting = NULL;
+                if (spill->last_waiting != NULL)
+                {
+                    spill->last_waiting->next_waiting = stream;
+                }
+                else
+                {
+                    spill->first_waiting = stream;
+                }
+                spill->last_waiting = stream;
+            }
+        }
+        MQTT_BROKER_SPILL_STORE_RELEASE(&spill->requests.read_position, position + data_size);
+        ret = true;
+    }
+
+    /* Make the messages readable, they don't need to be synced since they are not kept after a restart */
+    if (ret && (spill->write_file != NULL))
+    {
+        (void)fflush(spill->write_file);
+    }
+
+    return ret;
+}
+
+/** \brief Append a message to the segment being written, a new segment is started when it is full */
+static void mqtt_broker_spill_write_message(mqtt_broker_spill_t* const spill, mqtt_broker_spill_stream_t* const stream, const uint32_t size)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    bool written = false;
+
+    /* A segment which couldn't be written is not written anymore */
+    if ((spill->write_file == NULL) || ((spill->write_offset != 0u) && ((spill->write_offset + size) > MQTT_BROKER_SPILL_SEGMENT_SIZE)))
+    {
+        char path[MQTT_BROKER_SPILL_SEGMENT_PATH_LENGTH];
+        if (spill->write_file != NULL)
+        {
+            (void)fclose(spill->write_file);
+        }
+        spill->write_segment++;
+        spill->write_offset = 0u;
+        mqtt_broker_spill_get_path(spill, spill->write_segment, path);
+        spill->write_file = fopen(path, "wb");
+        if (spill->write_file != NULL)
+        {
+            (void)setvbuf(spill->write_file, (char*)spill->write_buffer, _IOFBF, MQTT_BROKER_SPILL_BUFFER_SIZE);
+        }
+        spill->collect = true;
+    }
+    if (spill->write_file != NULL)
+    {
+        written = (fwrite(spill->record_buffer, 1u, size, spill->write_file) == size);
+        if (!written)
+        {
+            (void)fclose(spill->write_file);
+            spill->write_file = NULL;
+        }
+    }
+
+    if (written)
+    {
+        if (stream->io_count == 0u)
+        {
+            stream->segment = spill->write_segment;
+            stream->offset = spill->write_offset;
+        }
+        stream->io_count++;
+        spill->write_offset += size;
+    }
+    else
+    {
+        stream->lost++;
+    }
+}
+
+/** \brief Serve the pending refills, returns false if none of them made progress */
+static bool mqtt_broker_spill_serve_refills(mqtt_broker_spill_t* const spill)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    bool ret = false;
+    mqtt_broker_spill_stream_t* previous = NULL;
+    mqtt_broker_spill_stream_t* stream = spill->first_waiting;
+
+    while (stream != NULL)
+    {
+        mqtt_broker_spill_stream_t* const next = stream->next_waiting;
+
+        /* The refills of a stream which has been reset are dropped */
+        if ((stream->budget == 0u) || mqtt_broker_spill_serve_refill(spill, stream, &ret))
+        {
+            if (previous != NULL)
+            {
+                previous->next_waiting = next;
+            }
+            else
+            {
+                spill->first_waiting = next;
+            }
+            if (spill->last_waiting == stream)
+            {
+                spill->last_waiting = previous;
+            }
+            stream->waiting = false;
+        }
+        else
+        {
+            previous = stream;
+        }
+        stream = next;
+    }
+
+    return ret;
+}
+
+/** \brief Read back the messages of a pending refill, returns true once its end has been sent */
+static bool mqtt_broker_spill_serve_refill(mqtt_broker_spill_t* const spill, mqtt_broker_spill_stream_t* const stream, bool* const progress)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    bool ret = false;
+    bool full = false;
+    bool done = false;
+    const uint32_t index = (uint32_t)(stream - spill->streams);
+    mqtt_broker_spill_record_t record;
+
+    while (!done && !full && (stream->io_count != 0u))
+    {
+        /* The records of the other streams are skipped, a segment ends with its last valid record */
+        if (mqtt_broker_spill_read(spill, stream->segment, stream->offset, &record, MQTT_BROKER_SPILL_HEADER_SIZE) &&
+            (record.stream < spill->stream_count) &&
+            (record.type == MQTT_BROKER_SPILL_RECORD_MESSAGE) &&
+            (mqtt_broker_spill_data_size(&record) <= (spill->record_buffer_size - MQTT_BROKER_SPILL_HEADER_SIZE)))
+        {
+            const uint32_t data_size = mqtt_broker_spill_data_size(&record);
+            if ((record.stream == index) && (record.generation == stream->io_generation))
+            {
+                const uint32_t queue_size = MQTT_BROKER_QUEUE_HEADER_SIZE + data_size;
+                const uint32_t used = spill->responses.write_position - MQTT_BROKER_SPILL_LOAD_ACQUIRE(&spill->responses.read_position);
+                if (queue_size > stream->budget)
+                {
+                    /* The queue is full */
+                    done = true;
+                }
+                else if (((2u * MQTT_BROKER_SPILL_HEADER_SIZE) + data_size) > (spill->responses.size - used))
+                {
+                    /* Wait for the broker task, the end of the refill must still fit */
+                    full = true;
+                }
+                else if (mqtt_broker_spill_read(spill, stream->segment, stream->offset + MQTT_BROKER_SPILL_HEADER_SIZE, 
+                                                spill->record_buffer, data_size))
+                {
+                    (void)mqtt_broker_spill_ring_push(&spill->responses, &record, spill->record_buffer, 
+                                                      &spill->record_buffer[record.topic_length]);
+                    stream->budget -= queue_size;
+                    stream->io_count--;
+                    (*progress) = true;
+                }
+                else
+                {
+                    /* Truncated record */
+                    stream->lost += stream->io_count;
+                    stream->io_count = 0u;
+                }
+            }
+            if (!done && !full)
+            {
+                stream->offset += MQTT_BROKER_SPILL_HEADER_SIZE + data_size;
+            }
+        }
+        else if (stream->segment < spill->write_segment)
+        {
+            /* Next segment */
+            if (stream->segment == spill->first_segment)
+            {
+                spill->collect = true;
+            }
+            stream->segment++;
+            stream->offset = 0u;
+        }
+        else
+        {
+            /* The remaining messages couldn't be written */
+            stream->lost += stream->io_count;
+            stream->io_count = 0u;
+        }
+    }
+    if ((stream->io_count == 0u) && (stream->segment == spill->first_segment))
+    {
+        spill->collect = true;
+    }
+
+    /* End of the refill with the number of lost messages */
+    if (!full)
+    {
+        record.stream = index;
+        record.generation = stream->io_generation;
+        record.length = stream->lost;
+        record.topic_length = 0u;
+        record.type = MQTT_BROKER_SPILL_RECORD_END;
+        record.qos = 0u;
+        if (mqtt_broker_spill_ring_push(&spill->responses, &record, NULL, NULL))
+        {
+            stream->lost = 0u;
+            stream->budget = 0u;
+            (*progress) = true;
+            ret = true;
+        }
+    }
+
+    return ret;
+}
+
+/** \brief Read data from a segment */
+static bool mqtt_broker_spill_read(mqtt_broker_spill_t* const spill, const uint32_t segment, const uint32_t offset, void* const data, const uint32_t size)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    bool ret = true;
+
+    /* Open the segment with a read-ahead buffer, the consecutive reads don't need any seek */
+    if ((spill->read_file == NULL) || (spill->read_segment != segment))
+    {
+        char path[MQTT_BROKER_SPILL_SEGMENT_PATH_LENGTH];
+        if (spill->read_file != NULL)
+        {
+            (void)fclose(spill->read_file);
+        }
+        mqtt_broker_spill_get_path(spill, segment, path);
+        spill->read_file = fopen(path, "rb");
+        spill->read_segment = segment;
+        spill->read_offset = 0u;
+        if (spill->read_file != NULL)
+        {
+            (void)setvbuf(spill->read_file, (char*)spill->read_buffer, _IOFBF, MQTT_BROKER_SPILL_BUFFER_SIZE);
+        }
+        else
+        {
+            ret = false;
+        }
+    }
+    if (ret && (spill->read_offset != offset))
+    {
+        ret = (fseek(spill->read_file, (long)offset, SEEK_SET) == 0);
+        spill->read_offset = offset;
+    }
+    if (ret)
+    {
+        ret = ((size == 0u) || (fread(data, 1u, size, spill->read_file) == size));
+        if (ret)
+        {
+            spill->read_offset += size;
+        }
+        else
+        {
+            /* The segment may still grow, the end of file indicator is cleared by the next seek */
+            spill->read_offset = MQTT_BROKER_SPILL_NO_OFFSET;
+        }
+    }
+
+    return ret;
+}
+
+/** \brief Remove the oldest segments which are not needed by any stream anymore */
+static void mqtt_broker_spill_collect(mqtt_broker_spill_t* const spill)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    uint32_t i;
+    uint32_t first_segment = spill->write_segment;
+
+    /* Oldest segment still needed, the streams reset by the broker task don't need their segments anymore */
+    spill->collect = false;
+    for (i = 0u; i < spill->stream_count; i++)
+    {
+        mqtt_broker_spill_stream_t* const stream = &spill->streams[i];
+        if (stream->io_count != 0u)
+        {
+            if (stream->io_generation != MQTT_BROKER_SPILL_LOAD_ACQUIRE(&stream->generation))
+            {
+                stream->io_count = 0u;
+            }
+            else if (stream->segment < first_segment)
+            {
+                first_segment = stream->segment;
+            }
+            else
+            {
+                /* Segment still needed */
+            }
+        }
+    }
+
+    /* Remove the older segments */
+    while (spill->first_segment < first_segment)
+    {
+        char path[MQTT_BROKER_SPILL_SEGMENT_PATH_LENGTH];
+        if ((spill->read_file != NULL) && (spill->read_segment == spill->first_segment))
+        {
+            (void)fclose(spill->read_file);
+            spill->read_file = NULL;
+        }
+        mqtt_broker_spill_get_path(spill, spill->first_segment, path);
+        (void)remove(path);
+        spill->first_segment++;
+    }
+}
+
+#endif /* MQTT_BROKER_SPILL_ENABLED */
@@ -0,0 +1,201 @@
+/*
+Copyright(c) 2016 Cedric Jimenez
+
+This file is part of lw-mqtt.
+
+lw-mqtt is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+lw-mqtt is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MQTT_BROKER_SPILL_H
+#define MQTT_BROKER_SPILL_H
+
+#include "stdheaders.h"
+#include "mqtt_config.h"
+
+#ifdef MQTT_BROKER_SPILL_ENABLED
+
+#include <stdio.h>
+#include "mqtt.h"
+#include "mqtt_thread.h"
+#include "mqtt_broker_queue.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+
+/** \brief Type of a record of the spill rings and of the spill segments */
+typedef enum _mqtt_broker_spill_record_type_t
+{
+    /** \brief Message, followed by its topic and its payload */
+    MQTT_BROKER_SPILL_RECORD_MESSAGE = 0u,
+    /** \brief Request to read back the messages of a stream which fit in the given number of bytes of its queue */
+    MQTT_BROKER_SPILL_RECORD_REFILL = 1u,
+    /** \brief End of a refill with the number of messages of the stream lost by the I/O thread */
+    MQTT_BROKER_SPILL_RECORD_END = 2u
+} mqtt_broker_spill_record_type_t;
+
+/** \brief Header of a record of the spill rings and of the spill segments */
+typedef struct _mqtt_broker_spill_record_t
+{
+    /** \brief Index of the stream */
+    uint32_t stream;
+    /** \brief Generation of the stream when the record has been written */
+    uint32_t generation;
+    /** \brief Size in bytes of the payload (message), of the room in the queue (refill) or number of lost messages (end) */
+    uint32_t length;
+    /** \brief Size in bytes of the topic (message only) */
+    uint16_t topic_length;
+    /** \brief Type of the record (see mqtt_broker_spill_record_type_t) */
+    uint8_t type;
+    /** \brief QoS (message only) */
+    uint8_t qos;
+} mqtt_broker_spill_record_t;
+
+/** \brief Single producer, single consumer ring of records */
+typedef struct _mqtt_broker_spill_ring_t
+{
+    /** \brief Buffer */
+    uint8_t* buffer;
+    /** \brief Size in bytes of the buffer (power of 2) */
+    uint32_t size;
+    /** \brief Number of bytes written since the spill has been opened, only written by the producer */
+    volatile uint32_t write_position;
+    /** \brief Number of bytes read since the spill has been opened, only written by the consumer */
+    volatile uint32_t read_position;
+} mqtt_broker_spill_ring_t;
+
+/** \brief Spilled messages of a session queue, streams are moved with their queue from a session to another */
+typedef struct _mqtt_broker_spill_stream_t
+{
+    /** \brief Owner of the stream (broker task) */
+    void* owner;
+    /** \brief Incremented each time the stream is reset to discard its spilled messages (written by the broker task) */
+    volatile uint32_t generation;
+    /** \brief Number of messages spilled and not read back yet (broker task) */
+    uint32_t count;
+    /** \brief Indicate if a refill has been requested and has not ended yet (broker task) */
+    bool refilling;
+
+    /** \brief Generation of the messages written to the segments (I/O thread) */
+    uint32_t io_generation;
+    /** \brief Number of messages written to the segments and not read back yet (I/O thread) */
+    uint32_t io_count;
+    /** \brief Segment of the oldest message which has not been read back (I/O thread) */
+    uint32_t segment;
+    /** \brief Offset in bytes of the oldest message which has not been read back in its segment (I/O thread) */
+    uint32_t offset;
+    /** \brief Room in bytes left in the queue for the pending refill (I/O thread) */
+    uint32_t budget;
+    /** \brief Number of messages which could not be written to the segments since the last refill (I/O thread) */
+    uint32_t lost;
+    /** \brief Indicate if the stream is in the list of the pending refills (I/O thread) */
+    bool waiting;
+    /** \brief Next stream in the list of the pending refills (I/O thread) */
+    struct _mqtt_broker_spill_stream_t* next_waiting;
+} mqtt_broker_spill_stream_t;
+
+/** \brief Disk spill of the session queues of a MQTT broker : the messages which don't fit in the queues are appended
+           by a background thread to a shared log of segment files and read back in order when the queues have room.
+           The broker task only copies the messages to a ring and never waits for the disk. The segments are written
+           sequentially, read ahead through a large buffer and removed once all the streams have read them. */
+typedef struct _mqtt_broker_spill_t
+{
+    /** \brief Streams */
+    mqtt_broker_spill_stream_t* streams;
+    /** \brief Number of streams */
+    uint32_t stream_count;
+    /** \brief Messages and refill requests from the broker task to the I/O thread */
+    mqtt_broker_spill_ring_t requests;
+    /** \brief Messages read back and end of the refills from the I/O thread to the broker task */
+    mqtt_broker_spill_ring_t responses;
+    /** \brief Buffer for a record of the I/O thread */
+    uint8_t* record_buffer;
+    /** \brief Size in bytes of the buffer for a record */
+    uint32_t record_buffer_size;
+    /** \brief Buffer of the segment being written */
+    uint8_t* write_buffer;
+    /** \brief Read-ahead buffer of the segment being read */
+    uint8_t* read_buffer;
+    /** \brief Number of refills which have not ended yet (broker task) */
+    uint32_t refilling_count;
+    /** \brief Indicate if the spill is opened (broker task) */
+    bool opened;
+
+    /** \brief Segment being written (I/O thread) */
+    FILE* write_file;
+    /** \brief Number of the segment being written (I/O thread) */
+    uint32_t write_segment;
+    /** \brief Size in bytes of the segment being written (I/O thread) */
+    uint32_t write_offset;
+    /** \brief Segment being read (I/O thread) */
+    FILE* read_file;
+    /** \brief Number of the segment being read (I/O thread) */
+    uint32_t read_segment;
+    /** \brief Offset in bytes of the next read in the segment being read (I/O thread) */
+    uint32_t read_offset;
+    /** \brief Number of the oldest segment which has not been removed (I/O thread) */
+    uint32_t first_segment;
+    /** \brief Indicate if the oldest segment may not be needed anymore (I/O thread) */
+    bool collect;
+    /** \brief First stream in the list of the pending refills (I/O thread) */
+    mqtt_broker_spill_stream_t* first_waiting;
+    /** \brief Last stream in the list of the pending refills (I/O thread) */
+    mqtt_broker_spill_stream_t* last_waiting;
+
+    /** \brief Indicate if the I/O thread must keep running */
+    volatile uint32_t running;
+    /** \brief I/O thread */
+    mqtt_thread_t thread;
+    /** \brief Path of the segments without their number */
+    char path[MQTT_BROKER_SPILL_MAX_PATH_LENGTH];
+} mqtt_broker_spill_t;
+
+
+/** \brief Get the size in bytes of the buffers of a spill (0 if the ring size is 0) */
+size_t mqtt_broker_spill_get_buffers_size(const uint32_t ring_size, const uint32_t record_size);
+
+/** \brief Initialize a spill on its streams and its buffers (the ring size must be a power of 2, 0 to disable the spill),
+           the record size is the maximum size of a topic and of a payload */
+bool mqtt_broker_spill_init(mqtt_broker_spill_t* const spill, mqtt_broker_spill_stream_t* const streams, const uint32_t stream_count,
+                            uint8_t* const buffers, const uint32_t ring_size, const uint32_t record_size);
+
+/** \brief Open a spill and start its I/O thread, the segments are named <path>.<number> */
+bool mqtt_broker_spill_open(mqtt_broker_spill_t* const spill, const char* const path);
+
+/** \brief Stop the I/O thread and remove the segments, the spilled messages are discarded */
+bool mqtt_broker_spill_close(mqtt_broker_spill_t* const spill);
+
+/** \brief Spill a message of a stream, fails with MQTT_ERR_BUFFER_TOO_SMALL if the I/O thread is late */
+bool mqtt_broker_spill_push(mqtt_broker_spill_t* const spill, mqtt_broker_spill_stream_t* const stream, const mqtt_string_t* const topic,
+                            const void* const data, const uint32_t length, const uint8_t qos);
+
+/** \brief Request the oldest spilled messages of a stream which fit in the given number of bytes of its queue */
+bool mqtt_broker_spill_refill(mqtt_broker_spill_t* const spill, mqtt_broker_spill_stream_t* const stream, const uint32_t room);
+
+/** \brief Get the next message read back, in the order of each stream => fails with MQTT_ERR_INPUT_STREAM_EMPTY if there is none */
+bool mqtt_broker_spill_receive(mqtt_broker_spill_t* const spill, mqtt_broker_spill_stream_t** const stream, mqtt_broker_queue_message_t* const message);
+
+/** \brief Discard the spilled messages of a stream */
+bool mqtt_broker_spill_reset(mqtt_broker_spill_t* const spill, mqtt_broker_spill_stream_t* const stream);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* MQTT_BROKER_SPILL_ENABLED */
+
+#endif /* MQTT_BROKER_SPILL_H */
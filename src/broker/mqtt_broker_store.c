@@ -0,0 +1,708 @@
+/*
+Copyright(c) 2016 Cedric Jimenez
+
+This file is part of lw-mqtt.
+
+lw-mqtt is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+lw-mqtt is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "mqtt_broker_store.h"
+
+#ifdef MQTT_BROKER_STORE_ENABLED
+
+#include "mqtt_error.h"
+#include "mqtt_file.h"
+#include "mqtt_crc32.h"
+
+
+/** \brief Extension of the snapshot file */
+#define MQTT_BROKER_STORE_SNAPSHOT_EXTENSION    ".snap"
+
+/** \brief Extension of the snapshot file while it is written */
+#define MQTT_BROKER_STORE_TMP_EXTENSION         ".snap.tmp"
+
+/** \brief Extension of the log file */
+#define MQTT_BROKER_STORE_LOG_EXTENSION         ".log"
+
+
+/** \brief Magic of the snapshot files */
+static const uint8_t s_mqtt_broker_store_snapshot_magic[8u] = { 'L', 'W', 'M', 'Q', 'S', 'N', 'P', 1u };
+
+/** \brief Magic of the log files */
+static const uint8_t s_mqtt_broker_store_log_magic[8u] = { 'L', 'W', 'M', 'Q', 'L', 'O', 'G', 1u };
+
+
+/** \brief Build the path of a store file */
+static void mqtt_broker_store_get_path(const mqtt_broker_store_t* const store, const char* const extension, char* const path);
+
+/** \brief Write the header of a store file */
+static bool mqtt_broker_store_write_header(FILE* const file, const uint8_t* const magic, const uint32_t generation);
+
+/** \brief Read the header of a store file */
+static bool mqtt_broker_store_read_header(FILE* const file, const uint8_t* const magic, uint32_t* const generation);
+
+/** \brief Write a record to a store file */
+static bool mqtt_broker_store_write_record(FILE* const file, const mqtt_broker_store_record_t* const record, uint32_t* const size);
+
+/** \brief Read a record from a store file, its data is stored in the buffer
+           => fails with MQTT_ERR_BUFFER_TOO_SMALL if the record doesn't fit in the buffer */
+static bool mqtt_broker_store_read_record(FILE* const file, uint8_t* const buffer, const uint32_t buffer_size,
+                                          mqtt_broker_store_record_t* const record, uint32_t* const size);
+
+/** \brief Load the current snapshot */
+static bool mqtt_broker_store_load_snapshot(mqtt_broker_store_t* const store, uint8_t* const buffer, const uint32_t buffer_size,
+                                            const mqtt_broker_store_load_callback_t callback, void* const param);
+
+/** \brief Load the log of the current snapshot and discard the torn record at its end */
+static bool mqtt_broker_store_load_log(mqtt_broker_store_t* const store, uint8_t* const buffer, const uint32_t buffer_size,
+                                       const mqtt_broker_store_load_callback_t callback, void* const param);
+
+/** \brief Empty the log and bind it to the current snapshot */
+static bool mqtt_broker_store_reset_log(mqtt_broker_store_t* const store);
+
+
+
+/** \brief Open or create a store and replay its snapshot then its log through a callback */
+bool mqtt_broker_store_open(mqtt_broker_store_t* const store, const char* const path, uint8_t* const buffer, const uint32_t buffer_size,
+                            const mqtt_broker_store_load_callback_t callback, void* const param)
+{
+    bool ret = false;
+
+    /* Check params, the path of the temporary snapshot file must fit */
+    if ((store != NULL) &&
+        (path != NULL) &&
+        ((strlen(path) + sizeof(MQTT_BROKER_STORE_TMP_EXTENSION)) <= MQTT_BROKER_STORE_MAX_PATH_LENGTH) &&
+        (buffer != NULL) &&
+        (callback != NULL))
+    {
+        store->log = NULL;
+        store->snapshot = NULL;
+        (void)strcpy(store->path, path);
+        store->generation = 0u;
+        store->log_size = 0;
+        store->snapshot_size = 0;
+        store->unsynced = 0u;
+
+        /* The log only holds the changes made since its snapshot */
+        ret = mqtt_broker_store_load_snapshot(store, buffer, buffer_size, callback, param);
+        if (ret)
+        {
+            ret = mqtt_broker_store_load_log(store, buffer, buffer_size, callback, param);
+        }
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Sync and close a store */
+bool mqtt_broker_store_close(mqtt_broker_store_t* const store)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((store != NULL) &&
+        (store->log != NULL))
+    {
+        if (store->snapshot != NULL)
+        {
+            (void)mqtt_broker_store_end_snapshot(store, false);
+        }
+        ret = mqtt_file_sync(store->log);
+        if (fclose(store->log) != 0)
+        {
+            mqtt_errno_set(MQTT_ERR_FILE_FAILED);
+            ret = false;
+        }
+        store->log = NULL;
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Append a change to the log of a store, it is durable after the next sync */
+bool mqtt_broker_store_append(mqtt_broker_store_t* const store, const mqtt_broker_store_record_t* const record)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((store != NULL) &&
+        (store->log != NULL) &&
+        (record != NULL))
+    {
+        uint32_t size = 0u;
+        ret = mqtt_broker_store_write_record(store->log, record, &size);
+        if (ret)
+        {
+            store->log_size += (long)size;
+            store->unsynced++;
+        }
+        else
+        {
+            /* The next record overwrites the partial one */
+            (void)fseek(store->log, store->log_size, SEEK_SET);
+            mqtt_errno_set(MQTT_ERR_FILE_FAILED);
+        }
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Write the appended changes to the disk in a single sync */
+bool mqtt_broker_store_sync(mqtt_broker_store_t* const store)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((store != NULL) &&
+        (store->log != NULL))
+    {
+        ret = true;
+        if (store->unsynced != 0u)
+        {
+            ret = mqtt_file_sync(store->log);
+            if (ret)
+            {
+                store->unsynced = 0u;
+            }
+        }
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Indicate if the log has grown enough to be replaced by a new snapshot */
+bool mqtt_broker_store_needs_snapshot(const mqtt_broker_store_t* const store, bool* const needed)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((store != NULL) &&
+        (store->log != NULL) &&
+        (needed != NULL))
+    {
+        /* The snapshot is rewritten once the log is as big as it so that the
+           writing cost is amortized over the appended records */
+        const long log_records_size = store->log_size - (long)MQTT_BROKER_STORE_FILE_HEADER_SIZE;
+        (*needed) = ((log_records_size >= (long)MQTT_BROKER_STORE_MIN_SNAPSHOT_SIZE) && (log_records_size >= store->snapshot_size));
+        ret = true;
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Start writing a new snapshot */
+bool mqtt_broker_store_begin_snapshot(mqtt_broker_store_t* const store)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((store != NULL) &&
+        (store->log != NULL) &&
+        (store->snapshot == NULL))
+    {
+        char path[MQTT_BROKER_STORE_MAX_PATH_LENGTH];
+        mqtt_broker_store_get_path(store, MQTT_BROKER_STORE_TMP_EXTENSION, path);
+        store->snapshot = fopen(path, "wb");
+        if (store->snapshot != NULL)
+        {
+            (void)setvbuf(store->snapshot, store->snapshot_buffer, _IOFBF, sizeof(store->snapshot_buffer));
+            ret = mqtt_broker_store_write_header(store->snapshot, s_mqtt_broker_store_snapshot_magic, store->generation + 1u);
+            if (!ret)
+            {
+                (void)mqtt_broker_store_end_snapshot(store, false);
+            }
+        }
+        if (!ret)
+        {
+            mqtt_errno_set(MQTT_ERR_FILE_FAILED);
+        }
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Write a record of the state to the new snapshot */
+bool mqtt_broker_store_write_snapshot(mqtt_broker_store_t* const store, const mqtt_broker_store_record_t* const record)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((store != NULL) &&
+        (store->snapshot != NULL) &&
+        (record != NULL))
+    {
+        uint32_t size = 0u;
+        ret = mqtt_broker_store_write_record(store->snapshot, record, &size);
+        if (!ret)
+        {
+            mqtt_errno_set(MQTT_ERR_FILE_FAILED);
+        }
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Install the new snapshot and empty the log, or discard the new snapshot if it is incomplete */
+bool mqtt_broker_store_end_snapshot(mqtt_broker_store_t* const store, const bool complete)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((store != NULL) &&
+        (store->snapshot != NULL))
+    {
+        char tmp_path[MQTT_BROKER_STORE_MAX_PATH_LENGTH];
+        char path[MQTT_BROKER_STORE_MAX_PATH_LENGTH];
+        long snapshot_size = 0;
+
+        /* The snapshot must be on the disk before it replaces the previous one */
+        ret = complete;
+        if (ret)
+        {
+            mqtt_broker_store_record_t end;
+            uint32_t size = 0u;
+            (void)memset(&end, 0, sizeof(end));
+            end.type = MQTT_BROKER_STORE_RECORD_END;
+            ret = (mqtt_broker_store_write_record(store->snapshot, &end, &size) && mqtt_file_sync(store->snapshot));
+            snapshot_size = ftell(store->snapshot);
+        }
+        mqtt_broker_store_get_path(store, MQTT_BROKER_STORE_TMP_EXTENSION, tmp_path);
+        if ((fclose(store->snapshot) != 0) || !ret)
+        {
+            (void)remove(tmp_path);
+            ret = false;
+        }
+        store->snapshot = NULL;
+
+        /* A crash from now on loads the new snapshot and ignores the log of the previous generation */
+        if (ret)
+        {
+            mqtt_broker_store_get_path(store, MQTT_BROKER_STORE_SNAPSHOT_EXTENSION, path);
+            ret = mqtt_file_replace(tmp_path, path);
+        }
+        if (ret)
+        {
+            store->generation++;
+            store->snapshot_size = snapshot_size;
+            ret = mqtt_broker_store_reset_log(store);
+        }
+        if (!ret && complete)
+        {
+            mqtt_errno_set(MQTT_ERR_FILE_FAILED);
+        }
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+
+
+
+/** \brief Build the path of a store file */
+static void mqtt_broker_store_get_path(const mqtt_broker_store_t* const store, const char* const extension, char* const path)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    (void)strcpy(path, store->path);
+    (void)strcat(path, extension);
+}
+
+/** \brief Write the header of a store file */
+static bool mqtt_broker_store_write_header(FILE* const file, const uint8_t* const magic, const uint32_t generation)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    uint8_t header[MQTT_BROKER_STORE_FILE_HEADER_SIZE];
+    uint32_t i;
+
+    /* Little endian generation */
+    (void)memcpy(header, magic, 8u);
+    for (i = 0u; i < 4u; i++)
+    {
+        header[8u + i] = (uint8_t)((generation >> (8u * i)) & 0xFFu);
+    }
+
+    return (fwrite(header, 1u, sizeof(header), file) == sizeof(header));
+}
+
+/** \brief Read the header of a store file */
+static bool mqtt_broker_store_read_header(FILE* const file, const uint8_t* const magic, uint32_t* const generation)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    uint8_t header[MQTT_BROKER_STORE_FILE_HEADER_SIZE];
+    bool ret = ((fread(header, 1u, sizeof(header), file) == sizeof(header)) && (memcmp(header, magic, 8u) == 0));
+    if (ret)
+    {
+        uint32_t i;
+        (*generation) = 0u;
+        for (i = 0u; i < 4u; i++)
+        {
+            (*generation) |= (((uint32_t)header[8u + i]) << (8u * i));
+        }
+    }
+
+    return ret;
+}
+
+/** \brief Write a record to a store file */
+static bool mqtt_broker_store_write_record(FILE* const file, const mqtt_broker_store_record_t* const record, uint32_t* const size)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    bool ret;
+    uint8_t header[MQTT_BROKER_STORE_RECORD_HEADER_SIZE];
+    uint8_t trailer[MQTT_BROKER_STORE_RECORD_CRC_SIZE];
+    uint32_t crc;
+    uint32_t i;
+
+    /* Little endian fields */
+    header[0u] = (uint8_t)record->type;
+    header[1u] = record->qos;
+    header[2u] = (uint8_t)(record->client_id.size & 0xFFu);
+    header[3u] = (uint8_t)(record->client_id.size >> 8u);
+    header[4u] = (uint8_t)(record->topic.size & 0xFFu);
+    header[5u] = (uint8_t)(record->topic.size >> 8u);
+    for (i = 0u; i < 4u; i++)
+    {
+        header[6u + i] = (uint8_t)((record->length >> (8u * i)) & 0xFFu);
+    }
+    crc = mqtt_crc32_update(MQTT_CRC32_INIT, header, sizeof(header));
+    crc = mqtt_crc32_update(crc, record->client_id.str, record->client_id.size);
+    crc = mqtt_crc32_update(crc, record->topic.str, record->topic.size);
+    crc = ~mqtt_crc32_update(crc, record->payload, record->length);
+    trailer[0u] = (uint8_t)(crc & 0xFFu);
+    trailer[1u] = (uint8_t)((crc >> 8u) & 0xFFu);
+    trailer[2u] = (uint8_t)((crc >> 16u) & 0xFFu);
+    trailer[3u] = (uint8_t)(crc >> 24u);
+
+    /* The file buffer gathers the small records */
+    ret = (fwrite(header, 1u, sizeof(header), file) == sizeof(header));
+    if (ret && (record->client_id.size != 0u))
+    {
+        ret = (fwrite(record->client_id.str, 1u, record->client_id.size, file) == record->client_id.size);
+    }
+    if (ret && (record->topic.size != 0u))
+    {
+        ret = (fwrite(record->topic.str, 1u, record->topic.size, file) == record->topic.size);
+    }
+    if (ret && (record->length != 0u))
+    {
+        ret = (fwrite(record->payload, 1u, record->length, file) == record->length);
+    }
+    if (ret)
+    {
+        ret = (fwrite(trailer, 1u, sizeof(trailer), file) == sizeof(trailer));
+    }
+    (*size) = MQTT_BROKER_STORE_RECORD_HEADER_SIZE + record->client_id.size + record->topic.size + record->length + MQTT_BROKER_STORE_RECORD_CRC_SIZE;
+
+    return ret;
+}
+
+/** \brief Read a record from a store file, its data is stored in the buffer */
+static bool mqtt_broker_store_read_record(FILE* const file, uint8_t* const buffer, const uint32_t buffer_size,
+                                          mqtt_broker_store_record_t* const record, uint32_t* const size)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    uint8_t header[MQTT_BROKER_STORE_RECORD_HEADER_SIZE];
+    uint8_t trailer[MQTT_BROKER_STORE_RECORD_CRC_SIZE];
+    uint32_t data_size = 0u;
+    uint32_t i;
+    bool ret = (fread(header, 1u, sizeof(header), file) == sizeof(header));
+    if (ret)
+    {
+        record->type = (mqtt_broker_store_record_type_t)header[0u];
+        record->qos = header[1u];
+        record->client_id.size = (uint16_t)(header[2u] | (header[3u] << 8u));
+        record->topic.size = (uint16_t)(header[4u] | (header[5u] << 8u));
+        record->length = 0u;
+        for (i = 0u; i < 4u; i++)
+        {
+            record->length |= (((uint32_t)header[6u + i]) << (8u * i));
+        }
+        ret = ((header[0u] >= (uint8_t)MQTT_BROKER_STORE_RECORD_SESSION) && (header[0u] <= (uint8_t)MQTT_BROKER_STORE_RECORD_END) &&
+               (record->qos <= 2u) && (record->length <= MQTT_MAXIMUM_VARIABLE_INTEGER));
+        if (!ret)
+        {
+            mqtt_errno_set(MQTT_ERR_FILE_FAILED);
+        }
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INPUT_STREAM_EMPTY);
+    }
+    if (ret)
+    {
+        data_size = (uint32_t)record->client_id.size + record->topic.size + record->length;
+        ret = (data_size <= buffer_size);
+        if (!ret)
+        {
+            /* Written with bigger limits */
+            mqtt_errno_set(MQTT_ERR_BUFFER_TOO_SMALL);
+        }
+    }
+    if (ret)
+    {
+        ret = ((fread(buffer, 1u, data_size, file) == data_size) && (fread(trailer, 1u, sizeof(trailer), file) == sizeof(trailer)));
+        if (ret)
+        {
+            const uint32_t crc = ~mqtt_crc32_update(mqtt_crc32_update(MQTT_CRC32_INIT, header, sizeof(header)), buffer, data_size);
+            ret = ((trailer[0u] == (uint8_t)(crc & 0xFFu)) && (trailer[1u] == (uint8_t)((crc >> 8u) & 0xFFu)) &&
+                   (trailer[2u] == (uint8_t)((crc >> 16u) & 0xFFu)) && (trailer[3u] == (uint8_t)(crc >> 24u)));
+        }
+        if (ret)
+        {
+            record->client_id.str = (const char*)buffer;
+            record->topic.str = (const char*)&buffer[record->client_id.size];
+            record->payload = &buffer[record->client_id.size + record->topic.size];
+            (*size) = MQTT_BROKER_STORE_RECORD_HEADER_SIZE + data_size + MQTT_BROKER_STORE_RECORD_CRC_SIZE;
+        }
+        else
+        {
+            mqtt_errno_set(MQTT_ERR_FILE_FAILED);
+        }
+    }
+
+    return ret;
+}
+
+/** \brief Load the current snapshot */
+static bool mqtt_broker_store_load_snapshot(mqtt_broker_store_t* const store, uint8_t* const buffer, const uint32_t buffer_size,
+                                            const mqtt_broker_store_load_callback_t callback, void* const param)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    bool ret = true;
+    char path[MQTT_BROKER_STORE_MAX_PATH_LENGTH];
+    FILE* file;
+
+    /* No snapshot yet : generation 0 */
+    mqtt_broker_store_get_path(store, MQTT_BROKER_STORE_SNAPSHOT_EXTENSION, path);
+    file = fopen(path, "rb");
+    if (file != NULL)
+    {
+        /* The snapshot has been synced before being installed : it must be complete */
+        bool end = false;
+        (void)setvbuf(file, store->snapshot_buffer, _IOFBF, sizeof(store->snapshot_buffer));
+        ret = mqtt_broker_store_read_header(file, s_mqtt_broker_store_snapshot_magic, &store->generation);
+        store->snapshot_size = (long)MQTT_BROKER_STORE_FILE_HEADER_SIZE;
+        while (ret && !end)
+        {
+            mqtt_broker_store_record_t record;
+            uint32_t size = 0u;
+            ret = mqtt_broker_store_read_record(file, buffer, buffer_size, &record, &size);
+            if (ret)
+            {
+                store->snapshot_size += (long)size;
+                if (record.type == MQTT_BROKER_STORE_RECORD_END)
+                {
+                    end = true;
+                }
+                else
+                {
+                    ret = callback(param, &record, true);
+                }
+            }
+        }
+        (void)fclose(file);
+        if (!ret && (mqtt_errno_get() != MQTT_ERR_BUFFER_TOO_SMALL))
+        {
+            mqtt_errno_set(MQTT_ERR_FILE_FAILED);
+        }
+    }
+
+    return ret;
+}
+
+/** \brief Load the log of the current snapshot and discard the torn record at its end */
+static bool mqtt_broker_store_load_log(mqtt_broker_store_t* const store, uint8_t* const buffer, const uint32_t buffer_size,
+                                       const mqtt_broker_store_load_callback_t callback, void* const param)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    bool ret = true;
+    char path[MQTT_BROKER_STORE_MAX_PATH_LENGTH];
+    uint32_t generation = 0u;
+
+    /* Open the existing log or create it */
+    mqtt_broker_store_get_path(store, MQTT_BROKER_STORE_LOG_EXTENSION, path);
+    store->log = fopen(path, "r+b");
+    if (store->log == NULL)
+    {
+        store->log = fopen(path, "w+b");
+    }
+    if (store->log != NULL)
+    {
+        (void)setvbuf(store->log, store->log_buffer, _IOFBF, sizeof(store->log_buffer));
+
+        /* The log of another generation has been replaced by the snapshot */
+        if (mqtt_broker_store_read_header(store->log, s_mqtt_broker_store_log_magic, &generation) &&
+            (generation == store->generation))
+        {
+            bool valid = true;
+            store->log_size = (long)MQTT_BROKER_STORE_FILE_HEADER_SIZE;
+            while (ret && valid)
+            {
+                mqtt_broker_store_record_t record;
+                uint32_t size = 0u;
+                valid = mqtt_broker_store_read_record(store->log, buffer, buffer_size, &record, &size);
+                if (valid)
+                {
+                    ret = callback(param, &record, false);
+                    store->log_size += (long)size;
+                }
+                else if (mqtt_errno_get() == MQTT_ERR_BUFFER_TOO_SMALL)
+                {
+                    ret = false;
+                }
+                else
+                {
+                    /* End of the log or torn record */
+                }
+            }
+        }
+        else
+        {
+            store->log_size = 0;
+        }
+
+        /* Write the header of a new log or discard the torn record */
+        if (ret)
+        {
+            long file_size;
+            ret = (fseek(store->log, 0, SEEK_END) == 0);
+            file_size = ftell(store->log);
+            if (ret && (store->log_size == 0))
+            {
+                ret = mqtt_broker_store_reset_log(store);
+            }
+            else if (ret && (file_size > store->log_size))
+            {
+                ret = (mqtt_file_truncate(store->log, store->log_size) && mqtt_file_sync(store->log) &&
+                       (fseek(store->log, store->log_size, SEEK_SET) == 0));
+            }
+            else
+            {
+                /* Nothing to repair */
+            }
+            if (!ret)
+            {
+                mqtt_errno_set(MQTT_ERR_FILE_FAILED);
+            }
+        }
+        if (!ret)
+        {
+            (void)fclose(store->log);
+            store->log = NULL;
+        }
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_FILE_FAILED);
+        ret = false;
+    }
+
+    return ret;
+}
+
+/** \brief Empty the log and bind it to the current snapshot */
+static bool mqtt_broker_store_reset_log(mqtt_broker_store_t* const store)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    /* The old records must be gone before the new generation is written, otherwise
+       a crash could bind them to the new snapshot */
+    bool ret = ((fflush(store->log) == 0) && mqtt_file_truncate(store->log, 0) && mqtt_file_sync(store->log) &&
+                (fseek(store->log, 0, SEEK_SET) == 0) &&
+                mqtt_broker_store_write_header(store->log, s_mqtt_broker_store_log_magic, store->generation) &&
+                mqtt_file_sync(store->log));
+    if (ret)
+    {
+        store->log_size = (long)MQTT_BROKER_STORE_FILE_HEADER_SIZE;
+        store->unsynced = 0u;
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_FILE_FAILED);
+    }
+
+    return ret;
+}
+
+#endif /* MQTT_BROKER_STORE_ENABLED */
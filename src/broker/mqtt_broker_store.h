@@ -0,0 +1,147 @@
+/*
+Copyright(c) 2016 Cedric Jimenez
+
+This file is part of lw-mqtt.
+
+lw-mqtt is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+lw-mqtt is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MQTT_BROKER_STORE_H
+#define MQTT_BROKER_STORE_H
+
+#include "stdheaders.h"
+#include "mqtt_config.h"
+
+#ifdef MQTT_BROKER_STORE_ENABLED
+
+#include <stdio.h>
+#include "mqtt.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+
+/** \brief Size in bytes of the header of a store file : magic (8), generation (4) */
+#define MQTT_BROKER_STORE_FILE_HEADER_SIZE      12u
+
+/** \brief Size in bytes of the header of a record : type (1), QoS (1), client id length (2), topic length (2), payload length (4) */
+#define MQTT_BROKER_STORE_RECORD_HEADER_SIZE    10u
+
+/** \brief Size in bytes of the CRC-32 which ends a record */
+#define MQTT_BROKER_STORE_RECORD_CRC_SIZE       4u
+
+
+/** \brief Types of the records of the broker store */
+typedef enum _mqtt_broker_store_record_type_t
+{
+    /** \brief Creation of a persistent session or update of its session expiry interval (payload : 4 bytes, little endian) */
+    MQTT_BROKER_STORE_RECORD_SESSION = 1u,
+    /** \brief End of a persistent session */
+    MQTT_BROKER_STORE_RECORD_SESSION_END = 2u,
+    /** \brief Subscription of a persistent session to a topic filter */
+    MQTT_BROKER_STORE_RECORD_SUBSCRIBE = 3u,
+    /** \brief Removal of a subscription of a persistent session */
+    MQTT_BROKER_STORE_RECORD_UNSUBSCRIBE = 4u,
+    /** \brief Message appended to the queue of a persistent session */
+    MQTT_BROKER_STORE_RECORD_QUEUE = 5u,
+    /** \brief Oldest message removed from the queue of a persistent session */
+    MQTT_BROKER_STORE_RECORD_DEQUEUE = 6u,
+    /** \brief End of a snapshot (internal use only) */
+    MQTT_BROKER_STORE_RECORD_END = 7u
+} mqtt_broker_store_record_type_t;
+
+/** \brief Record of the broker store */
+typedef struct _mqtt_broker_store_record_t
+{
+    /** \brief Type */
+    mqtt_broker_store_record_type_t type;
+    /** \brief QoS of the queued message or QoS and MQTT 5.0 options of the subscription (MQTT_SUBSCRIBE_OPTION_*) */
+    uint8_t qos;
+    /** \brief Client id of the session */
+    mqtt_const_string_t client_id;
+    /** \brief Topic filter of the subscription or topic of the queued message */
+    mqtt_const_string_t topic;
+    /** \brief Payload of the queued message or session expiry interval of the session */
+    const uint8_t* payload;
+    /** \brief Size in bytes of the payload */
+    uint32_t length;
+} mqtt_broker_store_record_t;
+
+/** \brief Function called for each record loaded from the store, snapshot is true for the records of the snapshot
+           which don't need to be checked against the existing state, returns false to abort the loading */
+typedef bool (*mqtt_broker_store_load_callback_t)(void* const param, const mqtt_broker_store_record_t* const record, const bool snapshot);
+
+/** \brief Durable state of a MQTT broker : a compact snapshot of the persistent sessions and an append-only log of the
+           changes made since the snapshot, both are replayed when the store is opened and the log is synced to the disk
+           by groups. The log is only valid with the snapshot of the same generation so that a crash while a new snapshot
+           is installed never replays a change twice. */
+typedef struct _mqtt_broker_store_t
+{
+    /** \brief Log file, NULL if the store is not opened */
+    FILE* log;
+    /** \brief Snapshot file being written, NULL otherwise */
+    FILE* snapshot;
+    /** \brief Path of the store files without their extension */
+    char path[MQTT_BROKER_STORE_MAX_PATH_LENGTH];
+    /** \brief Generation of the current snapshot */
+    uint32_t generation;
+    /** \brief Size in bytes of the valid records of the log */
+    long log_size;
+    /** \brief Size in bytes of the current snapshot */
+    long snapshot_size;
+    /** \brief Number of records written to the log since the last sync */
+    uint32_t unsynced;
+    /** \brief Buffer of the log file, the records of a group are written in a single system call */
+    char log_buffer[MQTT_BROKER_STORE_BUFFER_SIZE];
+    /** \brief Buffer of the snapshot file */
+    char snapshot_buffer[MQTT_BROKER_STORE_BUFFER_SIZE];
+} mqtt_broker_store_t;
+
+
+/** \brief Open or create a store and replay its snapshot then its log through a callback, a torn record at the
+           end of the log is discarded and the buffer must hold the largest record data (client id + topic + payload) */
+bool mqtt_broker_store_open(mqtt_broker_store_t* const store, const char* const path, uint8_t* const buffer, const uint32_t buffer_size,
+                            const mqtt_broker_store_load_callback_t callback, void* const param);
+
+/** \brief Sync and close a store */
+bool mqtt_broker_store_close(mqtt_broker_store_t* const store);
+
+/** \brief Append a change to the log of a store, it is durable after the next sync */
+bool mqtt_broker_store_append(mqtt_broker_store_t* const store, const mqtt_broker_store_record_t* const record);
+
+/** \brief Write the appended changes to the disk in a single sync */
+bool mqtt_broker_store_sync(mqtt_broker_store_t* const store);
+
+/** \brief Indicate if the log has grown enough to be replaced by a new snapshot */
+bool mqtt_broker_store_needs_snapshot(const mqtt_broker_store_t* const store, bool* const needed);
+
+/** \brief Start writing a new snapshot, the whole state must then be written with mqtt_broker_store_write_snapshot() */
+bool mqtt_broker_store_begin_snapshot(mqtt_broker_store_t* const store);
+
+/** \brief Write a record of the state to the new snapshot (no SESSION_END, UNSUBSCRIBE or DEQUEUE records) */
+bool mqtt_broker_store_write_snapshot(mqtt_broker_store_t* const store, const mqtt_broker_store_record_t* const record);
+
+/** \brief Install the new snapshot and empty the log, or discard the new snapshot if it is incomplete */
+bool mqtt_broker_store_end_snapshot(mqtt_broker_store_t* const store, const bool complete);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* MQTT_BROKER_STORE_ENABLED */
+
+#endif /* MQTT_BROKER_STORE_H */
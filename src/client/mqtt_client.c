@@ -23,19 +23,152 @@ along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
 #include "mqtt_packet_serialize.h"
 #include "mqtt_packet_deserialize.h"
 
-/** \brief Initialize a MQTT client */
-bool mqtt_client_init(mqtt_client_t* const mqtt_client)
+
+/** \brief Update the metrics of the client : MQTT_CLIENT_METRICS(event(&mqtt_client->metrics, ...)) calls
+           mqtt_client_metrics_event(&mqtt_client->metrics, ...) and is removed if the metrics are disabled */
+#ifdef MQTT_CLIENT_METRICS_ENABLED
+#define MQTT_CLIENT_METRICS(call)   (void)mqtt_client_metrics_##call
+#else
+#define MQTT_CLIENT_METRICS(call)
+#endif /* MQTT_CLIENT_METRICS_ENABLED */
+
+
+/** \brief Check the limits of a client configuration */
+static bool mqtt_client_check_config(const mqtt_client_config_t* const config);
+
+/** \brief Carve the buffers of a client from an arena, only the arena is updated if the client is NULL */
+static bool mqtt_client_carve(mqtt_client_t* const mqtt_client, const mqtt_client_config_t* const config, mqtt_arena_t* const arena);
+
+/** \brief Reset the MQTT 5.0 session limits before a new connection */
+static void mqtt_client_reset_session_limits(mqtt_client_t* const mqtt_client);
+
+/** \brief Store the MQTT 5.0 limits received from the broker in the CONNACK packet */
+static void mqtt_client_apply_connack_properties(mqtt_client_t* const mqtt_client, const mqtt_properties_t* const properties);
+
+/** \brief Look for the topic alias to use for a topic */
+static bool mqtt_client_find_topic_alias(const mqtt_client_t* const mqtt_client, const mqtt_const_string_t* const topic, 
+                                         uint16_t* const alias, bool* const known);
+
+/** \brief Assign a topic alias to a topic */
+static void mqtt_client_assign_topic_alias(mqtt_client_t* const mqtt_client, const mqtt_const_string_t* const topic, const uint16_t alias);
+
+/** \brief Get the properties to use in the packets sent to the broker */
+static mqtt_properties_t* mqtt_client_get_properties(const mqtt_client_t* const mqtt_client, mqtt_properties_t* const properties);
+
+/** \brief Wait for data ready to receive on the socket */
+static bool mqtt_client_select(mqtt_client_t* const mqtt_client);
+
+/** \brief Close the connection with the broker */
+static bool mqtt_client_close_connection(mqtt_client_t* const mqtt_client);
+
+/** \brief Check if a packet can be sent without waiting, only the in-process links can be full */
+static bool mqtt_client_can_send(mqtt_client_t* const mqtt_client, const uint32_t size);
+
+/** \brief Count a packet sent successfully in the metrics */
+static void mqtt_client_count_sent(mqtt_client_t* const mqtt_client, const mqtt_control_packet_type_t packet_type);
+
+/** \brief Count a packet received successfully in the metrics */
+static void mqtt_client_count_received(mqtt_client_t* const mqtt_client, const mqtt_control_packet_type_t packet_type, const size_t read_before);
+
+#ifdef MQTT_CLIENT_WAL_ENABLED
+
+/** \brief Append a QoS 1/2 message to the write-ahead log before sending it (entry is NULL if the message is not logged) */
+static bool mqtt_client_log_publish(mqtt_client_t* const mqtt_client, const mqtt_const_string_t* const topic, const void* const message,
+                                    const uint32_t length, const uint8_t qos, const bool retain, mqtt_client_wal_entry_t** const entry);
+
+/** \brief Bind a logged message to its packet id once sent, or release it if the send failed */
+static void mqtt_client_log_sent(mqtt_client_t* const mqtt_client, mqtt_client_wal_entry_t* const entry, const bool sent);
+
+/** \brief Send the logged messages which have not been sent on the current connection */
+static void mqtt_client_replay_wal(mqtt_client_t* const mqtt_client);
+
+/** \brief Sync the write-ahead log and stop the group commit timer */
+static bool mqtt_client_sync_wal(mqtt_client_t* const mqtt_client);
+
+/** \brief Group commit timer expiration */
+static void mqtt_client_wal_timer_expired(mqtt_timer_wheel_timer_t* const timer, void* const param);
+
+#endif /* MQTT_CLIENT_WAL_ENABLED */
+
+
+/** \brief Fill a client configuration with the default limits of the configuration file, without arena */
+bool mqtt_client_config_init(mqtt_client_config_t* const config)
 {
     bool ret = false;
 
     /* Check params */
-    if (mqtt_client != NULL)
+    if (config != NULL)
+    {
+        config->max_topic_length = MQTT_CLIENT_MAX_TOPIC_LENGTH;
+        config->max_payload_size = MQTT_CLIENT_MAX_PAYLOAD_SIZE;
+        config->max_topic_aliases = MQTT_CLIENT_MAX_TOPIC_ALIAS;
+        config->max_topic_alias_length = MQTT_CLIENT_MAX_TOPIC_ALIAS_LENGTH;
+        config->arena = NULL;
+        config->arena_size = 0u;
+        ret = true;
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Get the size in bytes of the arena needed by a client configuration */
+bool mqtt_client_get_arena_size(const mqtt_client_config_t* const config, size_t* const size)
+{
+    bool ret = false;
+
+    /* Check params */
+    if (mqtt_client_check_config(config) &&
+        (size != NULL))
+    {
+        /* Replay the allocations without memory area */
+        mqtt_arena_t arena;
+        (void)mqtt_arena_init(&arena, NULL, 0u);
+        (void)mqtt_client_carve(NULL, config, &arena);
+        ret = mqtt_arena_get_used(&arena, size);
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Initialize a MQTT client, the arena of the configuration must outlive the client */
+bool mqtt_client_init(mqtt_client_t* const mqtt_client, const mqtt_client_config_t* const config)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((mqtt_client != NULL) &&
+        mqtt_client_check_config(config) &&
+        (config->arena != NULL))
     {
+        mqtt_arena_t arena;
+
         /* Re-init data structure */
         memset(mqtt_client, 0, sizeof(mqtt_client_t));
+        mqtt_client->config = (*config);
+
+        /* Carve the buffers from the arena */
+        ret = mqtt_arena_init(&arena, config->arena, config->arena_size);
+        if (ret)
+        {
+            ret = mqtt_client_carve(mqtt_client, config, &arena);
+        }
 
         /* Create socket */
-        ret = mqtt_socket_open(&mqtt_client->socket, false);
+        if (ret)
+        {
+            ret = mqtt_socket_open(&mqtt_client->socket, false);
+        }
+        MQTT_CLIENT_METRICS(init(&mqtt_client->metrics));
 
         /* Initialize input and output streams */
         if (ret)
@@ -55,13 +188,28 @@ bool mqtt_client_init(mqtt_client_t* const mqtt_client)
         }
         #endif /* MQTT_MULTITASKING_ENABLED */
 
+        /* Initialize the timers */
+        if (ret)
+        {
+            ret = mqtt_timer_wheel_init(&mqtt_client->timer_wheel);
+        }
+        (void)mqtt_timer_wheel_timer_init(&mqtt_client->keepalive_timer, NULL, NULL);
+        (void)mqtt_timer_wheel_timer_init(&mqtt_client->broker_response_timer, NULL, NULL);
+        #ifdef MQTT_CLIENT_WAL_ENABLED
+        (void)mqtt_timer_wheel_timer_init(&mqtt_client->wal_timer, mqtt_client_wal_timer_expired, mqtt_client);
+        #endif /* MQTT_CLIENT_WAL_ENABLED */
+
         /* Initialize temp vars for reception */
         mqtt_client->topic.str = mqtt_client->topic_buffer;
-        mqtt_client->topic.size = sizeof(mqtt_client->topic_buffer);
+        mqtt_client->topic.size = config->max_topic_length;
+
+        /* MQTT 3.1.1 by default */
+        mqtt_client->protocol_level = MQTT_PROTOCOL_LEVEL_V311;
 
         /* MQTT client ready */
         if (ret)
         {
+            mqtt_client_reset_session_limits(mqtt_client);
             mqtt_client->state = MQTT_CLIENT_STATE_DISCONNECTED;
         }
     }
@@ -201,6 +349,43 @@ bool mqtt_client_set_callbacks(mqtt_client_t* const mqtt_client, const mqtt_clie
     return ret;
 }
 
+/** \brief Set the protocol version : MQTT_PROTOCOL_LEVEL_V311 or MQTT_PROTOCOL_LEVEL_V5 */
+bool mqtt_client_set_protocol_version(mqtt_client_t* const mqtt_client, const uint8_t protocol_level)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((mqtt_client != NULL) &&
+        ((protocol_level == MQTT_PROTOCOL_LEVEL_V311) || (protocol_level == MQTT_PROTOCOL_LEVEL_V5)))
+    {
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_lock(&mqtt_client->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+
+        /* Protocol version can only be changed while disconnected */
+        if (mqtt_client->state == MQTT_CLIENT_STATE_DISCONNECTED)
+        {
+            mqtt_client->protocol_level = protocol_level;
+            ret = true;
+        }
+        else
+        {
+            mqtt_errno_set(MQTT_ERR_CLIENT_INVALID_STATE);
+        }
+
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_unlock(&mqtt_client->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
 /** \brief Set the keepalive in sec */
 bool mqtt_client_set_keepalive(mqtt_client_t* const mqtt_client, const uint16_t sec_keepalive)
 {
@@ -317,6 +502,36 @@ bool mqtt_client_set_poll_period(mqtt_client_t* const mqtt_client, const uint32_
     return ret;
 }
 
+/** \brief Set the socket tuning options */
+bool mqtt_client_set_socket_options(mqtt_client_t* const mqtt_client, const mqtt_socket_options_t* const options)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((mqtt_client != NULL) &&
+        (options != NULL))
+    {
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_lock(&mqtt_client->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+
+        /* Save and apply options, the buffer sizes must be set before connecting */
+        (void)memcpy(&mqtt_client->socket_options, options, sizeof(mqtt_socket_options_t));
+        ret = mqtt_socket_set_options(&mqtt_client->socket, options);
+
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_unlock(&mqtt_client->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
 /** \brief Connect to a broker */
 bool mqtt_client_connect(mqtt_client_t* const mqtt_client, const char* const broker_ip, const uint16_t broker_port)
 {
@@ -333,6 +548,9 @@ bool mqtt_client_connect(mqtt_client_t* const mqtt_client, const char* const bro
         /* Check disconnected state */
         if (mqtt_client->state == MQTT_CLIENT_STATE_DISCONNECTED)
         {
+            /* Reset the limits of the previous session */
+            mqtt_client_reset_session_limits(mqtt_client);
+
             /* Connect to broker */
             ret = mqtt_socket_connect(&mqtt_client->socket, broker_ip, broker_port);
             if (ret)
@@ -348,6 +566,59 @@ bool mqtt_client_connect(mqtt_client_t* const mqtt_client, const char* const bro
                     ret = true;
                 }
             }
+
+            /* Apply the socket options again : the socket may have been replaced to reach a Unix domain socket */
+            if (ret)
+            {
+                (void)mqtt_socket_set_options(&mqtt_client->socket, &mqtt_client->socket_options);
+            }
+        }
+        else
+        {
+            mqtt_errno_set(MQTT_ERR_CLIENT_INVALID_STATE);
+        }
+
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_unlock(&mqtt_client->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Connect to a broker running in the same process through an in-process link */
+bool mqtt_client_connect_local(mqtt_client_t* const mqtt_client, ring_stream_link_t* const link)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((mqtt_client != NULL) &&
+        (link != NULL))
+    {
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_lock(&mqtt_client->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+
+        /* Check disconnected state */
+        if (mqtt_client->state == MQTT_CLIENT_STATE_DISCONNECTED)
+        {
+            /* Reset the limits of the previous session */
+            mqtt_client_reset_session_limits(mqtt_client);
+
+            /* Connect to the link, the data can be sent before the broker accepts the connection */
+            ret = ring_stream_link_connect(link);
+            if (ret)
+            {
+                mqtt_client->local_link = link;
+                (void)ring_stream_output_from_endpoint(&mqtt_client->outstream, &link->client_endpoint);
+                (void)ring_stream_input_from_endpoint(&mqtt_client->instream, &link->client_endpoint);
+                mqtt_client->state = MQTT_CLIENT_STATE_TCP_CONNECTING;
+            }
         }
         else
         {
@@ -384,10 +655,14 @@ bool mqtt_client_disconnect(mqtt_client_t* const mqtt_client)
         {
             /* Disconnect from broker */
             ret = mqtt_packet_serialize_disconnect(&mqtt_client->outstream);
+            if (ret)
+            {
+                mqtt_client_count_sent(mqtt_client, MQTT_PKT_DISCONNECT);
+            }
             mqtt_client->state = MQTT_CLIENT_STATE_MQTT_DISCONNECTING;
 
             /* Close TCP connection */
-            ret = mqtt_socket_close(&mqtt_client->socket);
+            ret = mqtt_client_close_connection(mqtt_client);
         }
         else
         {
@@ -426,16 +701,23 @@ bool mqtt_client_subscribe(mqtt_client_t* const mqtt_client, const char* const t
         {
             /* Send SUBSCRIBE packet */
             mqtt_const_string_t const_topic;
+            mqtt_properties_t properties;
             const_topic.str = topic;
             const_topic.size = (uint16_t)strnlen(topic, MQTT_MAXIMUM_STRING_SIZE);
-            ret = mqtt_packet_serialize_subscribe(&mqtt_client->outstream, &const_topic, qos, mqtt_client->packet_id);
+            ret = mqtt_client_can_send(mqtt_client, const_topic.size);
+            if (ret)
+            {
+                ret = mqtt_packet_serialize_subscribe(&mqtt_client->outstream, &const_topic, qos, mqtt_client->packet_id, 
+                                                      mqtt_client_get_properties(mqtt_client, &properties));
+            }
             if (!ret)
             {
                 const int32_t err = mqtt_errno_get();
                 if (err == MQTT_ERR_SOCKET_FAILED)
                 {
                     /* Connection lost : close socket and notify application */
-                    (void)mqtt_socket_close(&mqtt_client->socket);
+                    MQTT_CLIENT_METRICS(event(&mqtt_client->metrics, MQTT_CLIENT_METRICS_EVT_CONNECTION_LOSS));
+                    (void)mqtt_client_close_connection(mqtt_client);
                     if (mqtt_client->callbacks.disconnect != NULL)
                     {
                         mqtt_client->callbacks.disconnect(mqtt_client, false);
@@ -446,11 +728,14 @@ bool mqtt_client_subscribe(mqtt_client_t* const mqtt_client, const char* const t
             else
             {
                 /* Reset keepalive timer */
-                (void)mqtt_timer_reset(&mqtt_client->keepalive_timer);
+                (void)mqtt_timer_wheel_reset(&mqtt_client->timer_wheel, &mqtt_client->keepalive_timer);
 
                 /* Reset broker response timer */
-                (void)mqtt_timer_reset(&mqtt_client->broker_response_timer);
+                (void)mqtt_timer_wheel_reset(&mqtt_client->timer_wheel, &mqtt_client->broker_response_timer);
                 mqtt_client->is_waiting_response = true;
+
+                mqtt_client_count_sent(mqtt_client, MQTT_PKT_SUBSCRIBE);
+                MQTT_CLIENT_METRICS(request_start(&mqtt_client->metrics, mqtt_client->packet_id, true));
             }
 
             /* Next packet id */
@@ -490,18 +775,25 @@ bool mqtt_client_unsubscribe(mqtt_client_t* const mqtt_client, const char* const
         /* Check connected state */
         if (mqtt_client->state == MQTT_CLIENT_STATE_MQTT_CONNECTED)
         {
-            /* Send SUBSCRIBE packet */
+            /* Send UNSUBSCRIBE packet */
             mqtt_const_string_t const_topic;
+            mqtt_properties_t properties;
             const_topic.str = topic;
             const_topic.size = (uint16_t)strnlen(topic, MQTT_MAXIMUM_STRING_SIZE);
-            ret = mqtt_packet_serialize_unsubscribe(&mqtt_client->outstream, &const_topic, mqtt_client->packet_id);
+            ret = mqtt_client_can_send(mqtt_client, const_topic.size);
+            if (ret)
+            {
+                ret = mqtt_packet_serialize_unsubscribe(&mqtt_client->outstream, &const_topic, mqtt_client->packet_id, 
+                                                        mqtt_client_get_properties(mqtt_client, &properties));
+            }
             if (!ret)
             {
                 const int32_t err = mqtt_errno_get();
                 if (err == MQTT_ERR_SOCKET_FAILED)
                 {
                     /* Connection lost : close socket and notify application */
-                    (void)mqtt_socket_close(&mqtt_client->socket);
+                    MQTT_CLIENT_METRICS(event(&mqtt_client->metrics, MQTT_CLIENT_METRICS_EVT_CONNECTION_LOSS));
+                    (void)mqtt_client_close_connection(mqtt_client);
                     if (mqtt_client->callbacks.disconnect != NULL)
                     {
                         mqtt_client->callbacks.disconnect(mqtt_client, false);
@@ -512,11 +804,13 @@ bool mqtt_client_unsubscribe(mqtt_client_t* const mqtt_client, const char* const
             else
             {
                 /* Reset keepalive timer */
-                (void)mqtt_timer_reset(&mqtt_client->keepalive_timer);
+                (void)mqtt_timer_wheel_reset(&mqtt_client->timer_wheel, &mqtt_client->keepalive_timer);
 
                 /* Reset broker response timer */
-                (void)mqtt_timer_reset(&mqtt_client->broker_response_timer);
+                (void)mqtt_timer_wheel_reset(&mqtt_client->timer_wheel, &mqtt_client->broker_response_timer);
                 mqtt_client->is_waiting_response = true;
+
+                mqtt_client_count_sent(mqtt_client, MQTT_PKT_UNSUBSCRIBE);
             }
 
             /* Next packet id */
@@ -560,17 +854,82 @@ bool mqtt_client_publish(mqtt_client_t* const mqtt_client, const char* const top
         if (mqtt_client->state == MQTT_CLIENT_STATE_MQTT_CONNECTED)
         {
             /* Send PUBLISH packet */
+            uint16_t alias = 0u;
+            bool alias_known = false;
+            bool alias_found = false;
+            mqtt_properties_t properties;
+            mqtt_properties_t* const publish_properties = mqtt_client_get_properties(mqtt_client, &properties);
             mqtt_const_string_t const_topic;
+            #ifdef MQTT_CLIENT_WAL_ENABLED
+            mqtt_client_wal_entry_t* wal_entry = NULL;
+            mqtt_const_string_t wal_topic;
+            #endif /* MQTT_CLIENT_WAL_ENABLED */
             const_topic.str = topic;
             const_topic.size = (uint16_t)strnlen(topic, MQTT_MAXIMUM_STRING_SIZE);
-            ret = mqtt_packet_serialize_publish(&mqtt_client->outstream, &const_topic, message, length, qos, retain, false, mqtt_client->packet_id);
+            #ifdef MQTT_CLIENT_WAL_ENABLED
+            wal_topic = const_topic;
+            #endif /* MQTT_CLIENT_WAL_ENABLED */
+            ret = true;
+            if (publish_properties != NULL)
+            {
+                /* Flow control */
+                if ((qos > 0u) && (mqtt_client->inflight_count >= mqtt_client->broker_receive_maximum))
+                {
+                    mqtt_errno_set(MQTT_ERR_FLOW_CONTROL);
+                    ret = false;
+                }
+
+                /* Topic alias */
+                if (ret)
+                {
+                    alias_found = mqtt_client_find_topic_alias(mqtt_client, &const_topic, &alias, &alias_known);
+                    if (alias_found)
+                    {
+                        publish_properties->present |= MQTT_PROP_FLAG_TOPIC_ALIAS;
+                        publish_properties->topic_alias = alias;
+                        if (alias_known)
+                        {
+                            const_topic.str = "";
+                            const_topic.size = 0u;
+                        }
+                    }
+                }
+
+                /* Maximum packet size */
+                if (ret && 
+                    (mqtt_packet_serialize_publish_size(&const_topic, length, qos, publish_properties) > mqtt_client->broker_maximum_packet_size))
+                {
+                    mqtt_errno_set(MQTT_ERR_PACKET_TOO_LARGE);
+                    ret = false;
+                }
+            }
+            if (ret)
+            {
+                ret = mqtt_client_can_send(mqtt_client, mqtt_packet_serialize_publish_size(&const_topic, length, qos, publish_properties));
+            }
+            #ifdef MQTT_CLIENT_WAL_ENABLED
+            if (ret)
+            {
+                /* The full topic is logged even if an alias is sent */
+                ret = mqtt_client_log_publish(mqtt_client, &wal_topic, message, length, qos, retain, &wal_entry);
+            }
+            #endif /* MQTT_CLIENT_WAL_ENABLED */
+            if (ret)
+            {
+                ret = mqtt_packet_serialize_publish(&mqtt_client->outstream, &const_topic, message, length, qos, retain, false, 
+                                                    mqtt_client->packet_id, publish_properties);
+                #ifdef MQTT_CLIENT_WAL_ENABLED
+                mqtt_client_log_sent(mqtt_client, wal_entry, ret);
+                #endif /* MQTT_CLIENT_WAL_ENABLED */
+            }
             if (!ret)
             {
                 const int32_t err = mqtt_errno_get();
                 if (err == MQTT_ERR_SOCKET_FAILED)
                 {
                     /* Connection lost : close socket and notify application */
-                    (void)mqtt_socket_close(&mqtt_client->socket);
+                    MQTT_CLIENT_METRICS(event(&mqtt_client->metrics, MQTT_CLIENT_METRICS_EVT_CONNECTION_LOSS));
+                    (void)mqtt_client_close_connection(mqtt_client);
                     if (mqtt_client->callbacks.disconnect != NULL)
                     {
                         mqtt_client->callbacks.disconnect(mqtt_client, false);
@@ -580,8 +939,22 @@ bool mqtt_client_publish(mqtt_client_t* const mqtt_client, const char* const top
             }
             else
             {
+                /* The broker only knows the new alias once the packet has been sent */
+                if (alias_found && !alias_known)
+                {
+                    mqtt_client_assign_topic_alias(mqtt_client, &const_topic, alias);
+                }
+
                 /* Reset keepalive timer */
-                (void)mqtt_timer_reset(&mqtt_client->keepalive_timer);
+                (void)mqtt_timer_wheel_reset(&mqtt_client->timer_wheel, &mqtt_client->keepalive_timer);
+                mqtt_client_count_sent(mqtt_client, MQTT_PKT_PUBLISH);
+
+                /* Wait for acknowledgement */
+                if (qos > 0u)
+                {
+                    mqtt_client->inflight_count++;
+                    MQTT_CLIENT_METRICS(request_start(&mqtt_client->metrics, mqtt_client->packet_id, false));
+                }
             }
 
             /* Next packet id */
@@ -605,44 +978,432 @@ bool mqtt_client_publish(mqtt_client_t* const mqtt_client, const char* const top
     return ret;
 }
 
-/** \brief Client periodic task */
-bool mqtt_client_task(mqtt_client_t* const mqtt_client)
+/** \brief Pre-encode a PUBLISH template for a topic which is published frequently */
+bool mqtt_client_init_publish_template(mqtt_client_t* const mqtt_client, mqtt_publish_template_t* const publish_template, 
+                                       const char* const topic, const uint8_t qos, const bool retain)
 {
     bool ret = false;
 
     /* Check params */
-    if (mqtt_client != NULL)
+    if ((mqtt_client != NULL) && 
+        (publish_template != NULL) &&
+        (topic != NULL) &&
+        (qos <= MQTT_CFG_MAX_QOS_LEVEL))
     {
-        bool disconnected = false;
+        mqtt_properties_t properties;
+        mqtt_const_string_t const_topic;
 
         #ifdef MQTT_MULTITASKING_ENABLED
         (void)mqtt_mutex_lock(&mqtt_client->mutex);
         #endif /* MQTT_MULTITASKING_ENABLED */
 
-        /* Check current state */
-        switch (mqtt_client->state)
+        /* Encode the template for the current protocol version */
+        const_topic.str = topic;
+        const_topic.size = (uint16_t)strnlen(topic, MQTT_MAXIMUM_STRING_SIZE);
+        ret = mqtt_packet_serialize_publish_template(publish_template, &const_topic, qos, retain, 
+                                                     mqtt_client_get_properties(mqtt_client, &properties));
+
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_unlock(&mqtt_client->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Publish a message on the broker using a pre-encoded PUBLISH template */
+bool mqtt_client_publish_template(mqtt_client_t* const mqtt_client, mqtt_publish_template_t* const publish_template, 
+                                  const void* const message, const uint32_t length)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((mqtt_client != NULL) && 
+        (publish_template != NULL) &&
+        (!((message == NULL) && (length != 0u))))
+    {
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_lock(&mqtt_client->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+
+        /* Check connected state */
+        if (mqtt_client->state == MQTT_CLIENT_STATE_MQTT_CONNECTED)
         {
-            case MQTT_CLIENT_STATE_DISCONNECTED:
-            {
-                /* Nothing to do */
-                break;
-            }
+            #ifdef MQTT_CLIENT_WAL_ENABLED
+            mqtt_client_wal_entry_t* wal_entry = NULL;
+            #endif /* MQTT_CLIENT_WAL_ENABLED */
 
-            case MQTT_CLIENT_STATE_MQTT_DISCONNECTING:
+            /* Check that the template matches the protocol version */
+            ret = (publish_template->has_properties == (mqtt_client->protocol_level == MQTT_PROTOCOL_LEVEL_V5));
+            if (!ret)
             {
-                /* Transit to disconnected state */
-                mqtt_client->state = MQTT_CLIENT_STATE_DISCONNECTED;
-                break;
+                mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
             }
-
-            case MQTT_CLIENT_STATE_TCP_CONNECTING:
+            else if (publish_template->has_properties)
             {
-                /* Check tcp connection state */
-                bool callret = mqtt_socket_is_connected(&mqtt_client->socket);
-                if (callret)
+                /* Flow control */
+                if ((publish_template->qos > 0u) && (mqtt_client->inflight_count >= mqtt_client->broker_receive_maximum))
                 {
-                    /* Send a CONNECT message to the broker */
-                    mqtt_const_will_t* will = NULL;
+                    mqtt_errno_set(MQTT_ERR_FLOW_CONTROL);
+                    ret = false;
+                }
+
+                /* Maximum packet size */
+                if (ret && 
+                    (mqtt_packet_serialize_publish_template_size(publish_template, length) > mqtt_client->broker_maximum_packet_size))
+                {
+                    mqtt_errno_set(MQTT_ERR_PACKET_TOO_LARGE);
+                    ret = false;
+                }
+            }
+            if (ret)
+            {
+                ret = mqtt_client_can_send(mqtt_client, mqtt_packet_serialize_publish_template_size(publish_template, length));
+            }
+
+            #ifdef MQTT_CLIENT_WAL_ENABLED
+            if (ret)
+            {
+                /* The topic string follows its length at the beginning of the variable header */
+                const uint8_t* const variable_header = &publish_template->buffer[MQTT_PUBLISH_TEMPLATE_FIXED_HEADER_SIZE];
+                mqtt_const_string_t wal_topic;
+                wal_topic.str = (const char*)&variable_header[2u];
+                wal_topic.size = (uint16_t)((variable_header[0u] << 8u) | variable_header[1u]);
+                ret = mqtt_client_log_publish(mqtt_client, &wal_topic, message, length, publish_template->qos, 
+                                              ((publish_template->packet_type & MQTT_PUBLISH_FLAG_RETAIN) != 0u), &wal_entry);
+            }
+            #endif /* MQTT_CLIENT_WAL_ENABLED */
+
+            /* Send PUBLISH packet */
+            if (ret)
+            {
+                ret = mqtt_packet_serialize_publish_from_template(&mqtt_client->outstream, publish_template, message, length, 
+                                                                  mqtt_client->packet_id);
+                #ifdef MQTT_CLIENT_WAL_ENABLED
+                mqtt_client_log_sent(mqtt_client, wal_entry, ret);
+                #endif /* MQTT_CLIENT_WAL_ENABLED */
+            }
+            if (!ret)
+            {
+                const int32_t err = mqtt_errno_get();
+                if (err == MQTT_ERR_SOCKET_FAILED)
+                {
+                    /* Connection lost : close socket and notify application */
+                    MQTT_CLIENT_METRICS(event(&mqtt_client->metrics, MQTT_CLIENT_METRICS_EVT_CONNECTION_LOSS));
+                    (void)mqtt_client_close_connection(mqtt_client);
+                    if (mqtt_client->callbacks.disconnect != NULL)
+                    {
+                        mqtt_client->callbacks.disconnect(mqtt_client, false);
+                    }
+                    mqtt_client->state = MQTT_CLIENT_STATE_DISCONNECTED;
+                }
+            }
+            else
+            {
+                /* Reset keepalive timer */
+                (void)mqtt_timer_wheel_reset(&mqtt_client->timer_wheel, &mqtt_client->keepalive_timer);
+                mqtt_client_count_sent(mqtt_client, MQTT_PKT_PUBLISH);
+
+                /* Wait for acknowledgement */
+                if (publish_template->qos > 0u)
+                {
+                    mqtt_client->inflight_count++;
+                    MQTT_CLIENT_METRICS(request_start(&mqtt_client->metrics, mqtt_client->packet_id, false));
+                }
+            }
+
+            /* Next packet id */
+            mqtt_client->packet_id++;
+        }
+        else
+        {
+            mqtt_errno_set(MQTT_ERR_CLIENT_INVALID_STATE);
+        }
+
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_unlock(&mqtt_client->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Enable or disable the zero-copy transmit mode for the payloads larger than MQTT_CLIENT_ZEROCOPY_THRESHOLD */
+bool mqtt_client_set_zerocopy(mqtt_client_t* const mqtt_client, const bool enable)
+{
+    bool ret = false;
+
+    /* Check params */
+    if (mqtt_client != NULL)
+    {
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_lock(&mqtt_client->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+
+        /* Configure the socket, the sends already issued will still be reported */
+        ret = mqtt_socket_set_zerocopy(&mqtt_client->socket, enable);
+        if (ret)
+        {
+            if (enable)
+            {
+                mqtt_client->zerocopy.socket = &mqtt_client->socket;
+                mqtt_client->zerocopy.threshold = MQTT_CLIENT_ZEROCOPY_THRESHOLD;
+            }
+            else
+            {
+                mqtt_client->zerocopy.socket = NULL;
+            }
+
+            /* The output stream of an in-process link is restored when the link is closed */
+            if (mqtt_client->local_link == NULL)
+            {
+                if (enable)
+                {
+                    ret = socket_stream_output_from_socket_zerocopy(&mqtt_client->outstream, &mqtt_client->zerocopy);
+                }
+                else
+                {
+                    ret = socket_stream_output_from_socket(&mqtt_client->outstream, &mqtt_client->socket);
+                }
+            }
+        }
+
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_unlock(&mqtt_client->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Get the number of sends without copy issued and completed */
+bool mqtt_client_get_zerocopy_status(mqtt_client_t* const mqtt_client, uint32_t* const sent, uint32_t* const completed)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((mqtt_client != NULL) &&
+        (sent != NULL) &&
+        (completed != NULL))
+    {
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_lock(&mqtt_client->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+
+        /* Read the pending completions */
+        ret = true;
+        if (mqtt_client->zerocopy.sent != mqtt_client->zerocopy_completed)
+        {
+            ret = mqtt_socket_get_zerocopy_completions(&mqtt_client->socket, &mqtt_client->zerocopy_completed);
+        }
+        (*sent) = mqtt_client->zerocopy.sent;
+        (*completed) = mqtt_client->zerocopy_completed;
+
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_unlock(&mqtt_client->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+#ifdef MQTT_CLIENT_METRICS_ENABLED
+
+/** \brief Get a snapshot of the metrics of the client, can be called from any thread without blocking the client */
+bool mqtt_client_get_metrics(mqtt_client_t* const mqtt_client, mqtt_client_metrics_snapshot_t* const snapshot)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((mqtt_client != NULL) &&
+        (snapshot != NULL))
+    {
+        /* No mutex : the metrics are read without lock */
+        ret = mqtt_client_metrics_get_snapshot(&mqtt_client->metrics, snapshot);
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+#endif /* MQTT_CLIENT_METRICS_ENABLED */
+
+#ifdef MQTT_CLIENT_WAL_ENABLED
+
+/** \brief Open the write-ahead log of the QoS 1/2 published messages while disconnected, its unacknowledged 
+           messages are published again after the next connection */
+bool mqtt_client_open_wal(mqtt_client_t* const mqtt_client, const char* const path)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((mqtt_client != NULL) &&
+        (path != NULL))
+    {
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_lock(&mqtt_client->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+
+        /* The pending messages must not be mixed with the packet ids of a running connection */
+        if ((mqtt_client->state == MQTT_CLIENT_STATE_DISCONNECTED) &&
+            (mqtt_client->wal.file == NULL))
+        {
+            ret = mqtt_client_wal_open(&mqtt_client->wal, path);
+        }
+        else
+        {
+            mqtt_errno_set(MQTT_ERR_CLIENT_INVALID_STATE);
+        }
+
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_unlock(&mqtt_client->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Sync and close the write-ahead log */
+bool mqtt_client_close_wal(mqtt_client_t* const mqtt_client)
+{
+    bool ret = false;
+
+    /* Check params */
+    if (mqtt_client != NULL)
+    {
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_lock(&mqtt_client->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+
+        if (mqtt_client->wal.file != NULL)
+        {
+            (void)mqtt_timer_wheel_cancel(&mqtt_client->timer_wheel, &mqtt_client->wal_timer);
+            ret = mqtt_client_wal_close(&mqtt_client->wal);
+        }
+        else
+        {
+            mqtt_errno_set(MQTT_ERR_CLIENT_INVALID_STATE);
+        }
+
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_unlock(&mqtt_client->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Make the messages published so far durable without waiting for the next group commit */
+bool mqtt_client_commit_wal(mqtt_client_t* const mqtt_client)
+{
+    bool ret = false;
+
+    /* Check params */
+    if (mqtt_client != NULL)
+    {
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_lock(&mqtt_client->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+
+        if (mqtt_client->wal.file != NULL)
+        {
+            ret = mqtt_client_sync_wal(mqtt_client);
+        }
+        else
+        {
+            mqtt_errno_set(MQTT_ERR_CLIENT_INVALID_STATE);
+        }
+
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_unlock(&mqtt_client->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+#endif /* MQTT_CLIENT_WAL_ENABLED */
+
+/** \brief Client periodic task */
+bool mqtt_client_task(mqtt_client_t* const mqtt_client)
+{
+    bool ret = false;
+
+    /* Check params */
+    if (mqtt_client != NULL)
+    {
+        bool disconnected = false;
+
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_lock(&mqtt_client->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+
+        /* Expire the timers, the clock is read once per task */
+        (void)mqtt_timer_wheel_advance(&mqtt_client->timer_wheel);
+
+        /* Check current state */
+        switch (mqtt_client->state)
+        {
+            case MQTT_CLIENT_STATE_DISCONNECTED:
+            {
+                /* Nothing to do */
+                break;
+            }
+
+            case MQTT_CLIENT_STATE_MQTT_DISCONNECTING:
+            {
+                /* Transit to disconnected state */
+                mqtt_client->state = MQTT_CLIENT_STATE_DISCONNECTED;
+                break;
+            }
+
+            case MQTT_CLIENT_STATE_TCP_CONNECTING:
+            {
+                /* Check tcp connection state, an in-process link is always connected */
+                bool callret = ((mqtt_client->local_link != NULL) || mqtt_socket_is_connected(&mqtt_client->socket));
+                if (callret)
+                {
+                    /* Send a CONNECT message to the broker */
+                    mqtt_const_will_t* will = NULL;
                     mqtt_const_credentials_t* credentials = NULL;
                     if (mqtt_client->will.topic.str != NULL)
                     {
@@ -652,17 +1413,32 @@ bool mqtt_client_task(mqtt_client_t* const mqtt_client)
                     {
                         credentials = &mqtt_client->credentials;
                     }
+                    mqtt_properties_t properties;
+                    mqtt_properties_t* const connect_properties = mqtt_client_get_properties(mqtt_client, &properties);
+                    if (connect_properties != NULL)
+                    {
+                        /* Don't receive packets which can't be stored */
+                        connect_properties->present |= MQTT_PROP_FLAG_MAXIMUM_PACKET_SIZE;
+                        connect_properties->maximum_packet_size = mqtt_client->config.max_topic_length + mqtt_client->config.max_payload_size + 16u;
+                    }
+                    #ifdef MQTT_CLIENT_METRICS_ENABLED
+                    mqtt_client->metrics_written = mqtt_client->outstream.written;
+                    #endif /* MQTT_CLIENT_METRICS_ENABLED */
                     callret = mqtt_packet_serialize_connect(&mqtt_client->outstream, &mqtt_client->client_id, credentials,
-                                                            will, true, mqtt_client->keepalive);
+                                                            will, true, mqtt_client->keepalive, connect_properties);
                     if (callret)
                     {
+                        mqtt_client_count_sent(mqtt_client, MQTT_PKT_CONNECT);
                         mqtt_client->state = MQTT_CLIENT_STATE_MQTT_CONNECTING;
 
                         /* Start keepalive timer */
-                        (void)mqtt_timer_start(&mqtt_client->keepalive_timer, mqtt_client->keepalive * 1000U, true);
+                        if (mqtt_client->keepalive != 0u)
+                        {
+                            (void)mqtt_timer_wheel_start(&mqtt_client->timer_wheel, &mqtt_client->keepalive_timer, mqtt_client->keepalive * 1000U, true);
+                        }
 
                         /* Start broker response timer */
-                        (void)mqtt_timer_start(&mqtt_client->broker_response_timer, mqtt_client->broker_response_timeout, false);
+                        (void)mqtt_timer_wheel_start(&mqtt_client->timer_wheel, &mqtt_client->broker_response_timer, mqtt_client->broker_response_timeout, false);
                     }
                     else
                     {
@@ -691,25 +1467,41 @@ bool mqtt_client_task(mqtt_client_t* const mqtt_client)
                 mqtt_control_packet_type_t packet_type;
 
                 /* Check if data is available */
-                #ifdef MQTT_MULTITASKING_ENABLED
-                (void)mqtt_mutex_unlock(&mqtt_client->mutex);
-                #endif /* MQTT_MULTITASKING_ENABLED */
-                callret = mqtt_socket_select(&mqtt_client->socket, mqtt_client->poll_period);
-                #ifdef MQTT_MULTITASKING_ENABLED
-                (void)mqtt_mutex_lock(&mqtt_client->mutex);
-                #endif /* MQTT_MULTITASKING_ENABLED */
+                callret = mqtt_client_select(mqtt_client);
                 if (callret)
                 {
+                    const size_t read_before = mqtt_client->instream.read;
                     callret = mqtt_packet_deserialize_packet_header(&mqtt_client->instream, &packet_type, &packet_flags, &packet_length);
                     if (callret)
                     {
                         /* Deserialize packet */
                         bool session_present;
+                        mqtt_properties_t properties;
                         mqtt_connack_retcode_t retcode = MQTT_CONNACK_RET_DISCONNECTED;
 
-                        callret = mqtt_packet_deserialize_connack(&mqtt_client->instream, &session_present, &retcode);
+                        if (packet_type == MQTT_PKT_CONNACK)
+                        {
+                            callret = mqtt_packet_deserialize_connack(&mqtt_client->instream, packet_length, &session_present, &retcode, &properties);
+                        }
+                        else
+                        {
+                            mqtt_errno_set(MQTT_ERR_INVALID_PACKET_TYPE);
+                            callret = false;
+                        }
+                        if (callret)
+                        {
+                            mqtt_client_count_received(mqtt_client, packet_type, read_before);
+                        }
                         if (callret && (retcode == MQTT_CONNACK_RET_ACCEPTED))
                         {
+                            MQTT_CLIENT_METRICS(event(&mqtt_client->metrics, MQTT_CLIENT_METRICS_EVT_CONNECTION));
+
+                            /* Broker limits */
+                            if (mqtt_client->protocol_level == MQTT_PROTOCOL_LEVEL_V5)
+                            {
+                                mqtt_client_apply_connack_properties(mqtt_client, &properties);
+                            }
+
                             /* Connected */
                             mqtt_client->state = MQTT_CLIENT_STATE_MQTT_CONNECTED;
                             if (mqtt_client->callbacks.connect != NULL)
@@ -738,10 +1530,11 @@ bool mqtt_client_task(mqtt_client_t* const mqtt_client)
                 {
                     /* Check response timeout */
                     bool has_expired;
-                    (void)mqtt_timer_has_expired(&mqtt_client->broker_response_timer, &has_expired);
+                    (void)mqtt_timer_wheel_has_expired(&mqtt_client->broker_response_timer, &has_expired);
                     if (has_expired)
                     {
                         /* Disconnect */
+                        MQTT_CLIENT_METRICS(event(&mqtt_client->metrics, MQTT_CLIENT_METRICS_EVT_RESPONSE_TIMEOUT));
                         disconnected = true;
                     }
                     else
@@ -770,25 +1563,27 @@ bool mqtt_client_task(mqtt_client_t* const mqtt_client)
                 if (mqtt_client->keepalive != 0u)
                 {
                     bool has_expired;
-                    (void)mqtt_timer_has_expired(&mqtt_client->keepalive_timer, &has_expired);
+                    (void)mqtt_timer_wheel_has_expired(&mqtt_client->keepalive_timer, &has_expired);
                     if (has_expired)
                     {
                         /* Send ping request */
-                        (void)mqtt_packet_serialize_pingreq(&mqtt_client->outstream);
+                        if (mqtt_packet_serialize_pingreq(&mqtt_client->outstream))
+                        {
+                            mqtt_client_count_sent(mqtt_client, MQTT_PKT_PINGREQ);
+                        }
                     }
                 }
-                
+
+                #ifdef MQTT_CLIENT_WAL_ENABLED
+                /* Publish again the logged messages within the flow control of the broker */
+                mqtt_client_replay_wal(mqtt_client);
+                #endif /* MQTT_CLIENT_WAL_ENABLED */
 
                 /* Check if data is available */
-                #ifdef MQTT_MULTITASKING_ENABLED
-                (void)mqtt_mutex_unlock(&mqtt_client->mutex);
-                #endif /* MQTT_MULTITASKING_ENABLED */
-                callret = mqtt_socket_select(&mqtt_client->socket, mqtt_client->poll_period);
-                #ifdef MQTT_MULTITASKING_ENABLED
-                (void)mqtt_mutex_lock(&mqtt_client->mutex);
-                #endif /* MQTT_MULTITASKING_ENABLED */
+                callret = mqtt_client_select(mqtt_client);
                 if (callret)
                 {
+                    const size_t read_before = mqtt_client->instream.read;
                     callret = mqtt_packet_deserialize_packet_header(&mqtt_client->instream, &packet_type, &packet_flags, &packet_length);
                     if (callret)
                     {
@@ -796,20 +1591,106 @@ bool mqtt_client_task(mqtt_client_t* const mqtt_client)
                         {
                             case MQTT_PKT_PUBLISH:
                             {
-                                uint32_t length;
+                                uint32_t length = mqtt_client->config.max_payload_size;
                                 uint8_t qos;
                                 bool retain;
                                 bool duplicate;
                                 uint16_t packet_id;
+                                mqtt_properties_t properties;
+                                mqtt_client->topic.size = mqtt_client->config.max_topic_length;
                                 callret = mqtt_packet_deserialize_publish(&mqtt_client->instream, packet_flags, packet_length, &mqtt_client->topic, 
-                                                                          mqtt_client->payload_buffer, &length, &qos, &retain, &duplicate, &packet_id);
+                                                                          mqtt_client->payload_buffer, &length, &qos, &retain, &duplicate, &packet_id,
+                                                                          mqtt_client_get_properties(mqtt_client, &properties));
                                 if (callret)
                                 {
+                                    if (duplicate)
+                                    {
+                                        MQTT_CLIENT_METRICS(event(&mqtt_client->metrics, MQTT_CLIENT_METRICS_EVT_RETRANSMIT_RECEIVED));
+                                    }
                                     if (mqtt_client->callbacks.publish_received != NULL)
                                     {
                                         mqtt_client->callbacks.publish_received(mqtt_client, &mqtt_client->topic, mqtt_client->payload_buffer, length, 
                                                                                 qos, retain, duplicate);
                                     }
+
+                                    /* Acknowledge */
+                                    if (qos == 1u)
+                                    {
+                                        callret = mqtt_packet_serialize_puback(&mqtt_client->outstream, packet_id);
+                                        if (callret)
+                                        {
+                                            mqtt_client_count_sent(mqtt_client, MQTT_PKT_PUBACK);
+                                        }
+                                    }
+                                    else if (qos == 2u)
+                                    {
+                                        callret = mqtt_packet_serialize_pubrec(&mqtt_client->outstream, packet_id);
+                                        if (callret)
+                                        {
+                                            mqtt_client_count_sent(mqtt_client, MQTT_PKT_PUBREC);
+                                        }
+                                    }
+                                    else
+                                    {
+                                        /* No acknowledgement */
+                                    }
+                                }
+                                break;
+                            }
+
+                            case MQTT_PKT_PUBACK:
+                                /* Fall throught */
+                            case MQTT_PKT_PUBCOMP:
+                            {
+                                uint16_t packet_id;
+                                callret = mqtt_packet_deserialize_puback(&mqtt_client->instream, packet_length, &packet_id);
+                                if (callret)
+                                {
+                                    if (mqtt_client->inflight_count != 0u)
+                                    {
+                                        mqtt_client->inflight_count--;
+                                    }
+                                    MQTT_CLIENT_METRICS(request_end(&mqtt_client->metrics, packet_id, false));
+                                    #ifdef MQTT_CLIENT_WAL_ENABLED
+                                    if (mqtt_client->wal.file != NULL)
+                                    {
+                                        (void)mqtt_client_wal_acknowledge(&mqtt_client->wal, packet_id);
+                                    }
+                                    #endif /* MQTT_CLIENT_WAL_ENABLED */
+                                    if (mqtt_client->callbacks.publish != NULL)
+                                    {
+                                        mqtt_client->callbacks.publish(mqtt_client, true);
+                                    }
+                                }
+                                break;
+                            }
+
+                            case MQTT_PKT_PUBREC:
+                            {
+                                uint16_t packet_id;
+                                callret = mqtt_packet_deserialize_pubrec(&mqtt_client->instream, packet_length, &packet_id);
+                                if (callret)
+                                {
+                                    callret = mqtt_packet_serialize_pubrel(&mqtt_client->outstream, packet_id);
+                                    if (callret)
+                                    {
+                                        mqtt_client_count_sent(mqtt_client, MQTT_PKT_PUBREL);
+                                    }
+                                }
+                                break;
+                            }
+
+                            case MQTT_PKT_PUBREL:
+                            {
+                                uint16_t packet_id;
+                                callret = mqtt_packet_deserialize_pubrel(&mqtt_client->instream, packet_length, &packet_id);
+                                if (callret)
+                                {
+                                    callret = mqtt_packet_serialize_pubcomp(&mqtt_client->outstream, packet_id);
+                                    if (callret)
+                                    {
+                                        mqtt_client_count_sent(mqtt_client, MQTT_PKT_PUBCOMP);
+                                    }
                                 }
                                 break;
                             }
@@ -818,12 +1699,15 @@ bool mqtt_client_task(mqtt_client_t* const mqtt_client)
                             {
                                 uint8_t qos;
                                 uint16_t packet_id;
-                                callret = mqtt_packet_deserialize_suback(&mqtt_client->instream, &qos, &packet_id);
+                                mqtt_properties_t properties;
+                                callret = mqtt_packet_deserialize_suback(&mqtt_client->instream, packet_length, &qos, &packet_id,
+                                                                         mqtt_client_get_properties(mqtt_client, &properties));
                                 if (callret)
                                 {
+                                    MQTT_CLIENT_METRICS(request_end(&mqtt_client->metrics, packet_id, true));
                                     if (mqtt_client->callbacks.subscribe != NULL)
                                     {
-                                        mqtt_client->callbacks.subscribe(mqtt_client, qos, true);
+                                        mqtt_client->callbacks.subscribe(mqtt_client, qos, (qos <= MQTT_CFG_MAX_QOS_LEVEL));
                                     }
                                 }
                                 mqtt_client->is_waiting_response = false;
@@ -833,7 +1717,14 @@ bool mqtt_client_task(mqtt_client_t* const mqtt_client)
                             case MQTT_PKT_UNSUBACK:
                             { 
                                 uint16_t packet_id;
-                                callret = mqtt_packet_deserialize_unsuback(&mqtt_client->instream, &packet_id);
+                                callret = mqtt_packet_deserialize_unsuback(&mqtt_client->instream, packet_length, &packet_id);
+                                if (callret)
+                                {
+                                    if (mqtt_client->callbacks.unsubscribe != NULL)
+                                    {
+                                        mqtt_client->callbacks.unsubscribe(mqtt_client, true);
+                                    }
+                                }
                                 mqtt_client->is_waiting_response = false;
                                 break;
                             }
@@ -848,12 +1739,16 @@ bool mqtt_client_task(mqtt_client_t* const mqtt_client)
                             default:
                             {
                                 /* Invalid packet */
-                                mqtt_client->state = MQTT_ERR_INVALID_PACKET_TYPE;
+                                mqtt_errno_set(MQTT_ERR_INVALID_PACKET_TYPE);
                                 disconnected = true;
                                 break;
                             }
                         }
-                        if (!callret)
+                        if (callret)
+                        {
+                            mqtt_client_count_received(mqtt_client, packet_type, read_before);
+                        }
+                        else
                         {
                             /* Disconnect */
                             disconnected = true;
@@ -872,10 +1767,11 @@ bool mqtt_client_task(mqtt_client_t* const mqtt_client)
                     if (mqtt_client->is_waiting_response)
                     {
                         bool has_expired = false;
-                        (void)mqtt_timer_has_expired(&mqtt_client->broker_response_timer, &has_expired);
+                        (void)mqtt_timer_wheel_has_expired(&mqtt_client->broker_response_timer, &has_expired);
                         if (has_expired)
                         {
                             /* Disconnect */
+                            MQTT_CLIENT_METRICS(event(&mqtt_client->metrics, MQTT_CLIENT_METRICS_EVT_RESPONSE_TIMEOUT));
                             disconnected = true;
                         }
                     }
@@ -903,10 +1799,14 @@ bool mqtt_client_task(mqtt_client_t* const mqtt_client)
         if (disconnected)
         {
             /* Close socket and notify application */
-            (void)mqtt_socket_close(&mqtt_client->socket);
+            (void)mqtt_client_close_connection(mqtt_client);
             if ((mqtt_client->state == MQTT_CLIENT_STATE_MQTT_CONNECTED) ||
                 (mqtt_client->state == MQTT_CLIENT_STATE_MQTT_DISCONNECTING))
             {
+                if (mqtt_client->state == MQTT_CLIENT_STATE_MQTT_CONNECTED)
+                {
+                    MQTT_CLIENT_METRICS(event(&mqtt_client->metrics, MQTT_CLIENT_METRICS_EVT_CONNECTION_LOSS));
+                }
                 if (mqtt_client->callbacks.disconnect != NULL)
                 {
                     const bool expected_disconnection = (mqtt_client->state == MQTT_CLIENT_STATE_MQTT_DISCONNECTING);
@@ -915,6 +1815,7 @@ bool mqtt_client_task(mqtt_client_t* const mqtt_client)
             }
             else
             {
+                MQTT_CLIENT_METRICS(event(&mqtt_client->metrics, MQTT_CLIENT_METRICS_EVT_CONNECTION_FAILURE));
                 if (mqtt_client->callbacks.connect != NULL)
                 {
                     mqtt_client->callbacks.connect(mqtt_client, false, MQTT_CONNACK_RET_DISCONNECTED);
@@ -932,3 +1833,460 @@ bool mqtt_client_task(mqtt_client_t* const mqtt_client)
 
     return ret;
 }
+
+
+
+/** \brief Check the limits of a client configuration */
+static bool mqtt_client_check_config(const mqtt_client_config_t* const config)
+{
+    return ((config != NULL) &&
+            (config->max_topic_length != 0u) &&
+            (config->max_payload_size <= MQTT_MAXIMUM_VARIABLE_INTEGER));
+}
+
+/** \brief Carve the buffers of a client from an arena, only the arena is updated if the client is NULL */
+static bool mqtt_client_carve(mqtt_client_t* const mqtt_client, const mqtt_client_config_t* const config, mqtt_arena_t* const arena)
+{
+    /* No null-pointer test for the parameters because this function
+       is meant to be called from the inside of the library where the
+       parameters are already checked (the client can be NULL to compute the arena size) */
+
+    bool ret;
+
+    /* The arena size is computed by replaying the same allocations */
+    mqtt_client_topic_alias_t* const topic_aliases = (mqtt_client_topic_alias_t*)mqtt_arena_alloc(arena, config->max_topic_aliases, 
+                                                                                                   sizeof(mqtt_client_topic_alias_t));
+    char* const alias_topics = (char*)mqtt_arena_alloc(arena, config->max_topic_aliases, config->max_topic_alias_length);
+    char* const topic_buffer = (char*)mqtt_arena_alloc(arena, 1u, config->max_topic_length);
+    uint8_t* const payload_buffer = (uint8_t*)mqtt_arena_alloc(arena, 1u, config->max_payload_size);
+
+    ret = !arena->overflow;
+    if (ret && (mqtt_client != NULL))
+    {
+        uint16_t i;
+
+        /* Dispatch the buffers */
+        for (i = 0u; i < config->max_topic_aliases; i++)
+        {
+            topic_aliases[i].topic = &alias_topics[(size_t)i * config->max_topic_alias_length];
+        }
+        mqtt_client->topic_aliases = topic_aliases;
+        mqtt_client->topic_buffer = topic_buffer;
+        mqtt_client->payload_buffer = payload_buffer;
+    }
+
+    return ret;
+}
+
+/** \brief Reset the MQTT 5.0 session limits before a new connection */
+static void mqtt_client_reset_session_limits(mqtt_client_t* const mqtt_client)
+{
+    uint16_t i;
+
+    /* Default values when the broker doesn't specify them */
+    mqtt_client->broker_receive_maximum = UINT16_MAX;
+    mqtt_client->broker_maximum_packet_size = MQTT_MAXIMUM_PACKET_SIZE;
+    mqtt_client->broker_topic_alias_maximum = 0u;
+    mqtt_client->inflight_count = 0u;
+
+    /* Topic aliases are only valid during a network connection */
+    mqtt_client->next_topic_alias = 0u;
+    for (i = 0u; i < mqtt_client->config.max_topic_aliases; i++)
+    {
+        mqtt_client->topic_aliases[i].length = 0u;
+    }
+
+    #ifdef MQTT_CLIENT_WAL_ENABLED
+    /* The unacknowledged messages are sent again on the new connection */
+    (void)mqtt_client_wal_reset(&mqtt_client->wal);
+    #endif /* MQTT_CLIENT_WAL_ENABLED */
+}
+
+/** \brief Store the MQTT 5.0 limits received from the broker in the CONNACK packet */
+static void mqtt_client_apply_connack_properties(mqtt_client_t* const mqtt_client, const mqtt_properties_t* const properties)
+{
+    if (((properties->present & MQTT_PROP_FLAG_RECEIVE_MAXIMUM) != 0u) && (properties->receive_maximum != 0u))
+    {
+        mqtt_client->broker_receive_maximum = properties->receive_maximum;
+    }
+    if (((properties->present & MQTT_PROP_FLAG_MAXIMUM_PACKET_SIZE) != 0u) && (properties->maximum_packet_size != 0u))
+    {
+        mqtt_client->broker_maximum_packet_size = properties->maximum_packet_size;
+    }
+    if ((properties->present & MQTT_PROP_FLAG_TOPIC_ALIAS_MAXIMUM) != 0u)
+    {
+        mqtt_client->broker_topic_alias_maximum = properties->topic_alias_maximum;
+    }
+}
+
+/** \brief Look for the topic alias to use for a topic */
+static bool mqtt_client_find_topic_alias(const mqtt_client_t* const mqtt_client, const mqtt_const_string_t* const topic, 
+                                         uint16_t* const alias, bool* const known)
+{
+    bool ret = false;
+    uint16_t alias_count = mqtt_client->broker_topic_alias_maximum;
+
+    if (alias_count > mqtt_client->config.max_topic_aliases)
+    {
+        alias_count = mqtt_client->config.max_topic_aliases;
+    }
+    if ((alias_count != 0u) && (topic->size != 0u) && (topic->size <= mqtt_client->config.max_topic_alias_length))
+    {
+        uint16_t i;
+
+        /* Look for an already assigned alias */
+        for (i = 0u; (i < alias_count) && !ret; i++)
+        {
+            const mqtt_client_topic_alias_t* const topic_alias = &mqtt_client->topic_aliases[i];
+            if ((topic_alias->length == topic->size) && 
+                (memcmp(topic_alias->topic, topic->str, topic->size) == 0))
+            {
+                (*alias) = i + 1u;
+                (*known) = true;
+                ret = true;
+            }
+        }
+
+        /* Use the next slot, older aliases are reassigned in a round-robin way */
+        if (!ret)
+        {
+            (*alias) = (mqtt_client->next_topic_alias % alias_count) + 1u;
+            (*known) = false;
+            ret = true;
+        }
+    }
+
+    return ret;
+}
+
+/** \brief Assign a topic alias to a topic */
+static void mqtt_client_assign_topic_alias(mqtt_client_t* const mqtt_client, const mqtt_const_string_t* const topic, const uint16_t alias)
+{
+    mqtt_client_topic_alias_t* const topic_alias = &mqtt_client->topic_aliases[alias - 1u];
+
+    (void)memcpy(topic_alias->topic, topic->str, topic->size);
+    topic_alias->length = topic->size;
+    mqtt_client->next_topic_alias = alias;
+}
+
+/** \brief Get the properties to use in the packets sent to the broker */
+static mqtt_properties_t* mqtt_client_get_properties(const mqtt_client_t* const mqtt_client, mqtt_properties_t* const properties)
+{
+    mqtt_properties_t* ret = NULL;
+
+    /* Properties are only used with MQTT 5.0 */
+    if (mqtt_client->protocol_level == MQTT_PROTOCOL_LEVEL_V5)
+    {
+        properties->present = 0u;
+        ret = properties;
+    }
+
+    return ret;
+}
+
+/** \brief Wait for data ready to receive on the socket */
+static bool mqtt_client_select(mqtt_client_t* const mqtt_client)
+{
+    bool ret;
+
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    if (mqtt_client->local_link != NULL)
+    {
+        /* In-process link : no wait to deliver the packets as fast as possible */
+        ret = ring_stream_is_readable(&mqtt_client->local_link->client_endpoint);
+    }
+    else
+    {
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_unlock(&mqtt_client->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+        ret = mqtt_socket_select(&mqtt_client->socket, mqtt_client->poll_period);
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_lock(&mqtt_client->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+
+        /* The zero-copy completions are queued on the socket error queue which also wakes up select :
+           read them before checking again if some data is really available */
+        if (ret && (mqtt_client->zerocopy.sent != mqtt_client->zerocopy_completed))
+        {
+            (void)mqtt_socket_get_zerocopy_completions(&mqtt_client->socket, &mqtt_client->zerocopy_completed);
+            ret = mqtt_socket_select(&mqtt_client->socket, 0u);
+        }
+    }
+
+    return ret;
+}
+
+/** \brief Close the connection with the broker */
+static bool mqtt_client_close_connection(mqtt_client_t* const mqtt_client)
+{
+    bool ret;
+
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    /* Stop the timers of the connection */
+    (void)mqtt_timer_wheel_cancel(&mqtt_client->timer_wheel, &mqtt_client->keepalive_timer);
+    (void)mqtt_timer_wheel_cancel(&mqtt_client->timer_wheel, &mqtt_client->broker_response_timer);
+
+    /* The pending requests won't be acknowledged */
+    MQTT_CLIENT_METRICS(clear_requests(&mqtt_client->metrics));
+
+    if (mqtt_client->local_link != NULL)
+    {
+        /* Close the in-process link and restore the socket streams */
+        ret = ring_stream_link_close(&mqtt_client->local_link->client_endpoint);
+        mqtt_client->local_link = NULL;
+        if (mqtt_client->zerocopy.socket != NULL)
+        {
+            (void)socket_stream_output_from_socket_zerocopy(&mqtt_client->outstream, &mqtt_client->zerocopy);
+        }
+        else
+        {
+            (void)socket_stream_output_from_socket(&mqtt_client->outstream, &mqtt_client->socket);
+        }
+        (void)socket_stream_input_from_socket(&mqtt_client->instream, &mqtt_client->socket);
+    }
+    else
+    {
+        ret = mqtt_socket_close(&mqtt_client->socket);
+    }
+
+    return ret;
+}
+
+/** \brief Check if a packet can be sent without waiting, only the in-process links can be full */
+static bool mqtt_client_can_send(mqtt_client_t* const mqtt_client, const uint32_t size)
+{
+    bool ret = true;
+
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    /* Some room is left for the acknowledgements so that a packet is never cut in the middle of the ring buffer,
+       the application retries once the broker has read the link */
+    if (mqtt_client->local_link != NULL)
+    {
+        size_t room = 0u;
+        (void)ring_stream_get_writable_size(&mqtt_client->local_link->client_endpoint, &room);
+        ret = (room >= ((size_t)size + RING_STREAM_CONTROL_ROOM));
+        if (!ret)
+        {
+            mqtt_errno_set(MQTT_ERR_SOCKET_PENDING);
+        }
+    }
+
+    return ret;
+}
+
+/** \brief Count a packet sent successfully in the metrics */
+static void mqtt_client_count_sent(mqtt_client_t* const mqtt_client, const mqtt_control_packet_type_t packet_type)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    #ifdef MQTT_CLIENT_METRICS_ENABLED
+    (void)mqtt_client_metrics_packet_sent(&mqtt_client->metrics, (uint8_t)packet_type, 
+                                          mqtt_client->outstream.written - mqtt_client->metrics_written);
+    mqtt_client->metrics_written = mqtt_client->outstream.written;
+    #else
+    (void)mqtt_client;
+    (void)packet_type;
+    #endif /* MQTT_CLIENT_METRICS_ENABLED */
+}
+
+/** \brief Count a packet received successfully in the metrics */
+static void mqtt_client_count_received(mqtt_client_t* const mqtt_client, const mqtt_control_packet_type_t packet_type, const size_t read_before)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    #ifdef MQTT_CLIENT_METRICS_ENABLED
+    (void)mqtt_client_metrics_packet_received(&mqtt_client->metrics, (uint8_t)packet_type, 
+                                              mqtt_client->instream.read - read_before);
+    #else
+    (void)mqtt_client;
+    (void)packet_type;
+    (void)read_before;
+    #endif /* MQTT_CLIENT_METRICS_ENABLED */
+}
+
+#ifdef MQTT_CLIENT_WAL_ENABLED
+
+/** \brief Append a QoS 1/2 message to the write-ahead log before sending it (entry is NULL if the message is not logged) */
+static bool mqtt_client_log_publish(mqtt_client_t* const mqtt_client, const mqtt_const_string_t* const topic, const void* const message,
+                                    const uint32_t length, const uint8_t qos, const bool retain, mqtt_client_wal_entry_t** const entry)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    bool ret = true;
+
+    (*entry) = NULL;
+    if ((mqtt_client->wal.file != NULL) && (qos > 0u))
+    {
+        /* The replayed messages are read back in the reception buffers */
+        if ((topic->size > mqtt_client->config.max_topic_length) || (length > mqtt_client->config.max_payload_size))
+        {
+            mqtt_errno_set(MQTT_ERR_PACKET_TOO_LARGE);
+            ret = false;
+        }
+        if (ret)
+        {
+            ret = mqtt_client_wal_append(&mqtt_client->wal, topic, message, length, qos, retain, entry);
+        }
+        if (ret)
+        {
+            /* Group commit : sync after a batch of records or after a delay since the first unsynced one */
+            if (mqtt_client->wal.unsynced >= MQTT_CLIENT_WAL_COMMIT_COUNT)
+            {
+                (void)mqtt_client_sync_wal(mqtt_client);
+            }
+            else if (mqtt_client->wal.unsynced == 1u)
+            {
+                (void)mqtt_timer_wheel_start(&mqtt_client->timer_wheel, &mqtt_client->wal_timer, MQTT_CLIENT_WAL_COMMIT_DELAY, false);
+            }
+            else
+            {
+                /* Commit already scheduled */
+            }
+        }
+    }
+
+    return ret;
+}
+
+/** \brief Bind a logged message to its packet id once sent, or release it if the send failed */
+static void mqtt_client_log_sent(mqtt_client_t* const mqtt_client, mqtt_client_wal_entry_t* const entry, const bool sent)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    if (entry != NULL)
+    {
+        if (sent)
+        {
+            entry->packet_id = mqtt_client->packet_id;
+            entry->state = MQTT_CLIENT_WAL_STATE_SENT;
+        }
+        else
+        {
+            /* The application gets the error and decides to publish again */
+            const int32_t err = mqtt_errno_get();
+            (void)mqtt_client_wal_release(&mqtt_client->wal, entry);
+            mqtt_errno_set(err);
+        }
+    }
+}
+
+/** \brief Send the logged messages which have not been sent on the current connection */
+static void mqtt_client_replay_wal(mqtt_client_t* const mqtt_client)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    bool callret = (mqtt_client->wal.file != NULL);
+    while (callret && (mqtt_client->inflight_count < mqtt_client->broker_receive_maximum))
+    {
+        mqtt_client_wal_entry_t* entry = NULL;
+        mqtt_client_wal_message_t message;
+        mqtt_properties_t properties;
+        mqtt_properties_t* publish_properties = NULL;
+        mqtt_const_string_t const_topic;
+
+        /* Read the oldest pending message back in the reception buffers */
+        callret = (mqtt_client_wal_get_pending(&mqtt_client->wal, &entry) && (entry != NULL));
+        if (callret)
+        {
+            message.topic.str = mqtt_client->topic_buffer;
+            message.topic.size = mqtt_client->config.max_topic_length;
+            message.payload = mqtt_client->payload_buffer;
+            message.length = mqtt_client->config.max_payload_size;
+            callret = mqtt_client_wal_read(&mqtt_client->wal, entry, &message);
+            if (callret)
+            {
+                const_topic.str = message.topic.str;
+                const_topic.size = message.topic.size;
+                publish_properties = mqtt_client_get_properties(mqtt_client, &properties);
+                if ((publish_properties != NULL) &&
+                    (mqtt_packet_serialize_publish_size(&const_topic, message.length, message.qos, publish_properties) > mqtt_client->broker_maximum_packet_size))
+                {
+                    callret = false;
+                }
+            }
+            if (!callret)
+            {
+                /* The message can't be sent anymore, it must not block the next ones */
+                (void)mqtt_client_wal_release(&mqtt_client->wal, entry);
+                callret = true;
+                entry = NULL;
+            }
+        }
+
+        /* Send it again with a new packet id since the session is not kept, the next messages
+           are sent at the next call if the in-process link is full */
+        if (callret && (entry != NULL))
+        {
+            callret = mqtt_client_can_send(mqtt_client, mqtt_packet_serialize_publish_size(&const_topic, message.length, message.qos, publish_properties));
+            if (callret)
+            {
+                callret = mqtt_packet_serialize_publish(&mqtt_client->outstream, &const_topic, message.payload, message.length, message.qos, 
+                                                        message.retain, true, mqtt_client->packet_id, publish_properties);
+            }
+            if (callret)
+            {
+                (void)mqtt_timer_wheel_reset(&mqtt_client->timer_wheel, &mqtt_client->keepalive_timer);
+                mqtt_client_count_sent(mqtt_client, MQTT_PKT_PUBLISH);
+                mqtt_client->inflight_count++;
+                MQTT_CLIENT_METRICS(request_start(&mqtt_client->metrics, mqtt_client->packet_id, false));
+                entry->packet_id = mqtt_client->packet_id;
+                entry->state = MQTT_CLIENT_WAL_STATE_SENT;
+                mqtt_client->packet_id++;
+            }
+        }
+    }
+}
+
+/** \brief Sync the write-ahead log and stop the group commit timer */
+static bool mqtt_client_sync_wal(mqtt_client_t* const mqtt_client)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    (void)mqtt_timer_wheel_cancel(&mqtt_client->timer_wheel, &mqtt_client->wal_timer);
+    return mqtt_client_wal_sync(&mqtt_client->wal);
+}
+
+/** \brief Group commit timer expiration */
+static void mqtt_client_wal_timer_expired(mqtt_timer_wheel_timer_t* const timer, void* const param)
+{
+    /* Called from the periodic task with the mutex locked */
+    mqtt_client_t* const mqtt_client = (mqtt_client_t*)param;
+    (void)timer;
+    if (mqtt_client->wal.file != NULL)
+    {
+        (void)mqtt_client_sync_wal(mqtt_client);
+    }
+}
+
+#endif /* MQTT_CLIENT_WAL_ENABLED */
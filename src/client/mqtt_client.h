@@ -23,9 +23,14 @@ along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
 #include "stdheaders.h"
 #include "mqtt.h"
 #include "mqtt_socket.h"
-#include "mqtt_timer.h"
+#include "mqtt_timer_wheel.h"
 #include "mqtt_mutex.h"
 #include "socket_stream.h"
+#include "ring_stream.h"
+#include "mqtt_packet_serialize.h"
+#include "mqtt_client_metrics.h"
+#include "mqtt_arena.h"
+#include "mqtt_client_wal.h"
 
 #ifdef __cplusplus
 extern "C"
@@ -88,9 +93,38 @@ typedef enum _mqtt_client_state_t
     MQTT_CLIENT_STATE_MQTT_DISCONNECTING = 5u
 } mqtt_client_state_t;
 
+/** \brief MQTT client topic alias (MQTT 5.0 only) */
+typedef struct _mqtt_client_topic_alias_t
+{
+    /** \brief Length of the aliased topic, 0 if the alias is not used */
+    uint16_t length;
+    /** \brief Aliased topic */
+    char* topic;
+} mqtt_client_topic_alias_t;
+
+/** \brief Runtime limits of the MQTT client, the buffers are carved from the arena */
+typedef struct _mqtt_client_config_t
+{
+    /** \brief Maximum length in bytes of a received topic string */
+    uint16_t max_topic_length;
+    /** \brief Maximum length in byte of the payload of a received PUBLISH message */
+    uint32_t max_payload_size;
+    /** \brief Maximum number of topic aliases (MQTT 5.0 only) */
+    uint16_t max_topic_aliases;
+    /** \brief Maximum length in bytes of an aliased topic string */
+    uint16_t max_topic_alias_length;
+    /** \brief Memory area aligned on MQTT_ARENA_ALIGNMENT bytes, its size is given by mqtt_client_get_arena_size() */
+    void* arena;
+    /** \brief Size in bytes of the memory area */
+    size_t arena_size;
+} mqtt_client_config_t;
+
 /** \brief MQTT client */
 typedef struct _mqtt_client_t
 {
+    /** \brief Runtime limits */
+    mqtt_client_config_t config;
+
     /** \brief Client id */
     mqtt_const_string_t client_id;
 
@@ -106,6 +140,27 @@ typedef struct _mqtt_client_t
     /** \brief Keep alive */
     uint16_t keepalive;
 
+    /** \brief Protocol level : MQTT_PROTOCOL_LEVEL_V311 or MQTT_PROTOCOL_LEVEL_V5 */
+    uint8_t protocol_level;
+
+    /** \brief Broker's receive maximum (MQTT 5.0 only) */
+    uint16_t broker_receive_maximum;
+
+    /** \brief Broker's maximum packet size (MQTT 5.0 only) */
+    uint32_t broker_maximum_packet_size;
+
+    /** \brief Broker's topic alias maximum (MQTT 5.0 only) */
+    uint16_t broker_topic_alias_maximum;
+
+    /** \brief Number of QoS 1 and QoS 2 PUBLISH packets waiting for an acknowledgement */
+    uint16_t inflight_count;
+
+    /** \brief Next topic alias slot to (re)assign */
+    uint16_t next_topic_alias;
+
+    /** \brief Topic aliases */
+    mqtt_client_topic_alias_t* topic_aliases;
+
     /** \brief State */
     mqtt_client_state_t state;
 
@@ -115,20 +170,32 @@ typedef struct _mqtt_client_t
     /** \brief Socket */
     mqtt_socket_t socket;
 
+    /** \brief Socket tuning options */
+    mqtt_socket_options_t socket_options;
+
+    /** \brief In-process link used instead of the socket (NULL if not used) */
+    ring_stream_link_t* local_link;
+
     /** \brief Output stream */
     output_stream_t outstream;
 
     /** \brief Input stream */
     input_stream_t instream;
 
+    /** \brief State of the output stream in zero-copy transmit mode */
+    socket_stream_zerocopy_t zerocopy;
+
+    /** \brief Number of sends without copy reported as completed by the socket */
+    uint32_t zerocopy_completed;
+
     /** \brief Temp var for the reception of a topic */
     mqtt_string_t topic;
 
     /** \brief Buffer for the topic string */
-    char topic_buffer[MQTT_CLIENT_MAX_TOPIC_LENGTH];
+    char* topic_buffer;
 
     /** \brief Buffer for the payload reception */
-    uint8_t payload_buffer[MQTT_CLIENT_MAX_PAYLOAD_SIZE];
+    uint8_t* payload_buffer;
 
     /** \brief User data */
     void* user_data;
@@ -136,11 +203,14 @@ typedef struct _mqtt_client_t
     /** \brief Polling period in ms for the task */
     uint32_t poll_period;
 
+    /** \brief Timer wheel for the deadlines of the connection */
+    mqtt_timer_wheel_t timer_wheel;
+
     /** \brief Keepalive timer */
-    mqtt_timer_t keepalive_timer;
+    mqtt_timer_wheel_timer_t keepalive_timer;
 
-    /** \brief Broker response timer */
-    mqtt_timer_t broker_response_timer;
+    /** \brief Broker response timer, also used for the CONNACK timeout */
+    mqtt_timer_wheel_timer_t broker_response_timer;
 
     /** \brief Broker response timeout in ms */
     uint32_t broker_response_timeout;
@@ -148,6 +218,26 @@ typedef struct _mqtt_client_t
     /** \brief Indicate if the client is waiting for a response from the broker */
     bool is_waiting_response;
 
+    #ifdef MQTT_CLIENT_METRICS_ENABLED
+
+    /** \brief Metrics */
+    mqtt_client_metrics_t metrics;
+
+    /** \brief Number of bytes written on the output stream when the last sent packet has been counted */
+    size_t metrics_written;
+
+    #endif /* MQTT_CLIENT_METRICS_ENABLED */
+
+    #ifdef MQTT_CLIENT_WAL_ENABLED
+
+    /** \brief Write-ahead log of the QoS 1/2 published messages */
+    mqtt_client_wal_t wal;
+
+    /** \brief Group commit timer of the write-ahead log, started by the first unsynced record */
+    mqtt_timer_wheel_timer_t wal_timer;
+
+    #endif /* MQTT_CLIENT_WAL_ENABLED */
+
     #ifdef MQTT_MULTITASKING_ENABLED
 
     /** \brief Mutex for the MQTT client */
@@ -160,8 +250,14 @@ typedef struct _mqtt_client_t
 
 
 
-/** \brief Initialize a MQTT client */
-bool mqtt_client_init(mqtt_client_t* const mqtt_client);
+/** \brief Fill a client configuration with the default limits of the configuration file, without arena */
+bool mqtt_client_config_init(mqtt_client_config_t* const config);
+
+/** \brief Get the size in bytes of the arena needed by a client configuration */
+bool mqtt_client_get_arena_size(const mqtt_client_config_t* const config, size_t* const size);
+
+/** \brief Initialize a MQTT client, the arena of the configuration must outlive the client */
+bool mqtt_client_init(mqtt_client_t* const mqtt_client, const mqtt_client_config_t* const config);
 
 /** \brief Set the client id */
 bool mqtt_client_set_client_id(mqtt_client_t* const mqtt_client, const char* const client_id);
@@ -177,6 +273,9 @@ bool mqtt_client_set_will(mqtt_client_t* const mqtt_client, const char* const to
 /** \brief Set the callbacks */
 bool mqtt_client_set_callbacks(mqtt_client_t* const mqtt_client, const mqtt_client_callbacks_t* const callbacks);
 
+/** \brief Set the protocol version : MQTT_PROTOCOL_LEVEL_V311 or MQTT_PROTOCOL_LEVEL_V5 */
+bool mqtt_client_set_protocol_version(mqtt_client_t* const mqtt_client, const uint8_t protocol_level);
+
 /** \brief Set the keepalive in sec */
 bool mqtt_client_set_keepalive(mqtt_client_t* const mqtt_client, const uint16_t sec_keepalive);
 
@@ -189,12 +288,19 @@ bool mqtt_client_set_user_data(mqtt_client_t* const mqtt_client, void* user_data
 /** \brief Get the user data field */
 bool mqtt_client_get_user_data(mqtt_client_t* const mqtt_client, void** user_data);
 
+/** \brief Set the socket tuning options, they are applied immediately and each time the client connects */
+bool mqtt_client_set_socket_options(mqtt_client_t* const mqtt_client, const mqtt_socket_options_t* const options);
+
 /** \brief Set the polling period */
 bool mqtt_client_set_poll_period(mqtt_client_t* const mqtt_client, const uint32_t ms_poll_period);
 
 /** \brief Connect to a broker */
 bool mqtt_client_connect(mqtt_client_t* const mqtt_client, const char* const broker_ip, const uint16_t broker_port);
 
+/** \brief Connect to a broker running in the same process through an in-process link attached to this broker
+           => no socket and no system call are used, the task doesn't wait for the incoming data */
+bool mqtt_client_connect_local(mqtt_client_t* const mqtt_client, ring_stream_link_t* const link);
+
 /** \brief Disconnect from the broker */
 bool mqtt_client_disconnect(mqtt_client_t* const mqtt_client);
 
@@ -208,6 +314,43 @@ bool mqtt_client_unsubscribe(mqtt_client_t* const mqtt_client, const char* const
 bool mqtt_client_publish(mqtt_client_t* const mqtt_client, const char* const topic, const void* const message,
                          const uint32_t length, const uint8_t qos, const bool retain);
 
+/** \brief Pre-encode a PUBLISH template for a topic which is published frequently */
+bool mqtt_client_init_publish_template(mqtt_client_t* const mqtt_client, mqtt_publish_template_t* const publish_template, 
+                                       const char* const topic, const uint8_t qos, const bool retain);
+
+/** \brief Publish a message on the broker using a pre-encoded PUBLISH template */
+bool mqtt_client_publish_template(mqtt_client_t* const mqtt_client, mqtt_publish_template_t* const publish_template, 
+                                  const void* const message, const uint32_t length);
+
+/** \brief Enable or disable the zero-copy transmit mode for the payloads larger than MQTT_CLIENT_ZEROCOPY_THRESHOLD
+           => when enabled, a published payload must not be modified until its send has been reported as completed */
+bool mqtt_client_set_zerocopy(mqtt_client_t* const mqtt_client, const bool enable);
+
+/** \brief Get the number of sends without copy issued and completed : a payload published when the number
+           of issued sends was N can be released once the number of completed sends has reached N */
+bool mqtt_client_get_zerocopy_status(mqtt_client_t* const mqtt_client, uint32_t* const sent, uint32_t* const completed);
+
+#ifdef MQTT_CLIENT_METRICS_ENABLED
+
+/** \brief Get a snapshot of the metrics of the client, can be called from any thread without blocking the client */
+bool mqtt_client_get_metrics(mqtt_client_t* const mqtt_client, mqtt_client_metrics_snapshot_t* const snapshot);
+
+#endif /* MQTT_CLIENT_METRICS_ENABLED */
+
+#ifdef MQTT_CLIENT_WAL_ENABLED
+
+/** \brief Open the write-ahead log of the QoS 1/2 published messages while disconnected, its unacknowledged 
+           messages are published again after the next connection */
+bool mqtt_client_open_wal(mqtt_client_t* const mqtt_client, const char* const path);
+
+/** \brief Sync and close the write-ahead log */
+bool mqtt_client_close_wal(mqtt_client_t* const mqtt_client);
+
+/** \brief Make the messages published so far durable without waiting for the next group commit */
+bool mqtt_client_commit_wal(mqtt_client_t* const mqtt_client);
+
+#endif /* MQTT_CLIENT_WAL_ENABLED */
+
 /** \brief Client periodic task */
 bool mqtt_client_task(mqtt_client_t* const mqtt_client);
 
@@ -0,0 +1,513 @@
+/*
+Copyright(c) 2016 Cedric Jimenez
+
+This file is part of lw-mqtt.
+
+lw-mqtt is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+lw-mqtt is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "mqtt_client_metrics.h"
+#include "mqtt_error.h"
+#include "mqtt_time.h"
+
+#ifdef MQTT_CLIENT_METRICS_ENABLED
+
+
+#if defined(__GNUC__) || defined(__clang__)
+
+/** \brief Load the sequence number before reading the values */
+#define MQTT_CLIENT_METRICS_LOAD_ACQUIRE(ptr)           __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+
+/** \brief Load the sequence number after reading the values */
+#define MQTT_CLIENT_METRICS_LOAD_RELAXED(ptr)           __atomic_load_n((ptr), __ATOMIC_RELAXED)
+
+/** \brief Store the sequence number before updating the values */
+#define MQTT_CLIENT_METRICS_STORE_RELAXED(ptr, value)   __atomic_store_n((ptr), (value), __ATOMIC_RELAXED)
+
+/** \brief Store the sequence number after updating the values */
+#define MQTT_CLIENT_METRICS_STORE_RELEASE(ptr, value)   __atomic_store_n((ptr), (value), __ATOMIC_RELEASE)
+
+/** \brief Keep the updates of the values after the store of the sequence number */
+#define MQTT_CLIENT_METRICS_FENCE_RELEASE()             __atomic_thread_fence(__ATOMIC_RELEASE)
+
+/** \brief Keep the reads of the values before the load of the sequence number */
+#define MQTT_CLIENT_METRICS_FENCE_ACQUIRE()             __atomic_thread_fence(__ATOMIC_ACQUIRE)
+
+#else
+
+#include <intrin.h>
+
+/** \brief Load the sequence number before reading the values (volatile accesses have acquire semantics with MSVC) */
+#define MQTT_CLIENT_METRICS_LOAD_ACQUIRE(ptr)           (*(ptr))
+
+/** \brief Load the sequence number after reading the values */
+#define MQTT_CLIENT_METRICS_LOAD_RELAXED(ptr)           (*(ptr))
+
+/** \brief Store the sequence number before updating the values */
+#define MQTT_CLIENT_METRICS_STORE_RELAXED(ptr, value)   ((*(ptr)) = (value))
+
+/** \brief Store the sequence number after updating the values (volatile accesses have release semantics with MSVC) */
+#define MQTT_CLIENT_METRICS_STORE_RELEASE(ptr, value)   ((*(ptr)) = (value))
+
+/** \brief Keep the updates of the values after the store of the sequence number */
+#define MQTT_CLIENT_METRICS_FENCE_RELEASE()             _ReadWriteBarrier()
+
+/** \brief Keep the reads of the values before the load of the sequence number */
+#define MQTT_CLIENT_METRICS_FENCE_ACQUIRE()             _ReadWriteBarrier()
+
+#endif /* defined(__GNUC__) || defined(__clang__) */
+
+
+/** \brief Start an update of the values, the readers retry until it ends */
+static void mqtt_client_metrics_begin_update(mqtt_client_metrics_t* const metrics);
+
+/** \brief End an update of the values */
+static void mqtt_client_metrics_end_update(mqtt_client_metrics_t* const metrics);
+
+/** \brief Record a latency in an histogram */
+static void mqtt_client_metrics_record(mqtt_client_metrics_histogram_t* const histogram, const uint64_t value);
+
+/** \brief Get the bucket of an histogram which stores a latency */
+static uint32_t mqtt_client_metrics_get_bucket(const uint64_t value);
+
+/** \brief Get the highest latency stored in a bucket of an histogram */
+static uint64_t mqtt_client_metrics_get_bucket_max(const uint32_t bucket);
+
+
+/** \brief Initialize the metrics */
+bool mqtt_client_metrics_init(mqtt_client_metrics_t* const metrics)
+{
+    bool ret = false;
+
+    /* Check params */
+    if (metrics != NULL)
+    {
+        memset(metrics, 0, sizeof(mqtt_client_metrics_t));
+        ret = true;
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Count a sent packet */
+bool mqtt_client_metrics_packet_sent(mqtt_client_metrics_t* const metrics, const uint8_t packet_type, const size_t size)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((metrics != NULL) &&
+        (packet_type < MQTT_CLIENT_METRICS_PACKET_TYPES))
+    {
+        mqtt_client_metrics_begin_update(metrics);
+        metrics->values.sent_packets[packet_type]++;
+        metrics->values.sent_bytes[packet_type] += size;
+        mqtt_client_metrics_end_update(metrics);
+        ret = true;
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Count a received packet */
+bool mqtt_client_metrics_packet_received(mqtt_client_metrics_t* const metrics, const uint8_t packet_type, const size_t size)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((metrics != NULL) &&
+        (packet_type < MQTT_CLIENT_METRICS_PACKET_TYPES))
+    {
+        mqtt_client_metrics_begin_update(metrics);
+        metrics->values.received_packets[packet_type]++;
+        metrics->values.received_bytes[packet_type] += size;
+        mqtt_client_metrics_end_update(metrics);
+        ret = true;
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Count an event */
+bool mqtt_client_metrics_event(mqtt_client_metrics_t* const metrics, const mqtt_client_metrics_event_t event)
+{
+    bool ret = false;
+
+    /* Check params */
+    if (metrics != NULL)
+    {
+        ret = true;
+        mqtt_client_metrics_begin_update(metrics);
+        switch (event)
+        {
+            case MQTT_CLIENT_METRICS_EVT_CONNECTION:
+            {
+                if (metrics->values.connections != 0u)
+                {
+                    metrics->values.reconnects++;
+                }
+                metrics->values.connections++;
+                break;
+            }
+
+            case MQTT_CLIENT_METRICS_EVT_CONNECTION_FAILURE:
+            {
+                metrics->values.connection_failures++;
+                break;
+            }
+
+            case MQTT_CLIENT_METRICS_EVT_CONNECTION_LOSS:
+            {
+                metrics->values.connection_losses++;
+                break;
+            }
+
+            case MQTT_CLIENT_METRICS_EVT_RESPONSE_TIMEOUT:
+            {
+                metrics->values.response_timeouts++;
+                break;
+            }
+
+            case MQTT_CLIENT_METRICS_EVT_RETRANSMIT_RECEIVED:
+            {
+                metrics->values.retransmits_received++;
+                break;
+            }
+
+            default:
+            {
+                /* Unknown event */
+                mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+                ret = false;
+                break;
+            }
+        }
+        mqtt_client_metrics_end_update(metrics);
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Start measuring the latency of a request */
+bool mqtt_client_metrics_request_start(mqtt_client_metrics_t* const metrics, const uint16_t packet_id, const bool subscribe)
+{
+    bool ret = false;
+
+    /* Check params */
+    if (metrics != NULL)
+    {
+        uint32_t i;
+
+        /* Look for a free slot */
+        for (i = 0u; (i < MQTT_CLIENT_METRICS_MAX_REQUESTS) && (metrics->requests[i].used); i++)
+        {}
+        if (i < MQTT_CLIENT_METRICS_MAX_REQUESTS)
+        {
+            mqtt_client_metrics_request_t* const request = &metrics->requests[i];
+            ret = mqtt_time_get_current_us(&request->start_time);
+            if (ret)
+            {
+                request->packet_id = packet_id;
+                request->subscribe = subscribe;
+                request->used = true;
+            }
+        }
+        else
+        {
+            /* Too many pending requests, the latency of this one is not measured */
+            mqtt_client_metrics_begin_update(metrics);
+            metrics->values.untracked_requests++;
+            mqtt_client_metrics_end_update(metrics);
+            ret = true;
+        }
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Stop measuring the latency of a request on its acknowledgement and record it */
+bool mqtt_client_metrics_request_end(mqtt_client_metrics_t* const metrics, const uint16_t packet_id, const bool subscribe)
+{
+    bool ret = false;
+
+    /* Check params */
+    if (metrics != NULL)
+    {
+        uint32_t i;
+
+        /* Look for the request, an untracked request is silently ignored */
+        ret = true;
+        for (i = 0u; i < MQTT_CLIENT_METRICS_MAX_REQUESTS; i++)
+        {
+            mqtt_client_metrics_request_t* const request = &metrics->requests[i];
+            if (request->used && (request->packet_id == packet_id) && (request->subscribe == subscribe))
+            {
+                uint64_t now;
+                ret = mqtt_time_get_current_us(&now);
+                if (ret)
+                {
+                    const uint64_t latency = now - request->start_time;
+                    mqtt_client_metrics_begin_update(metrics);
+                    if (subscribe)
+                    {
+                        mqtt_client_metrics_record(&metrics->values.subscribe_latency, latency);
+                    }
+                    else
+                    {
+                        mqtt_client_metrics_record(&metrics->values.publish_latency, latency);
+                    }
+                    mqtt_client_metrics_end_update(metrics);
+                }
+                request->used = false;
+                break;
+            }
+        }
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Forget the pending requests when the connection is closed */
+bool mqtt_client_metrics_clear_requests(mqtt_client_metrics_t* const metrics)
+{
+    bool ret = false;
+
+    /* Check params */
+    if (metrics != NULL)
+    {
+        uint32_t i;
+        for (i = 0u; i < MQTT_CLIENT_METRICS_MAX_REQUESTS; i++)
+        {
+            metrics->requests[i].used = false;
+        }
+        ret = true;
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Get a consistent copy of the metrics, can be called from any thread */
+bool mqtt_client_metrics_get_snapshot(const mqtt_client_metrics_t* const metrics, mqtt_client_metrics_snapshot_t* const snapshot)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((metrics != NULL) &&
+        (snapshot != NULL))
+    {
+        /* Copy again if the values have been updated during the copy */
+        do
+        {
+            const uint32_t sequence = MQTT_CLIENT_METRICS_LOAD_ACQUIRE(&metrics->sequence);
+            if ((sequence & 1u) == 0u)
+            {
+                memcpy(snapshot, &metrics->values, sizeof(mqtt_client_metrics_snapshot_t));
+                MQTT_CLIENT_METRICS_FENCE_ACQUIRE();
+                ret = (MQTT_CLIENT_METRICS_LOAD_RELAXED(&metrics->sequence) == sequence);
+            }
+        }
+        while (!ret);
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Get the value in us below which a percentage (0 to 100) of the latencies of an histogram falls */
+bool mqtt_client_metrics_get_percentile(const mqtt_client_metrics_histogram_t* const histogram, const double percentile, uint64_t* const value)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((histogram != NULL) &&
+        (percentile >= 0.0) &&
+        (percentile <= 100.0) &&
+        (value != NULL))
+    {
+        (*value) = 0u;
+        if (histogram->count != 0u)
+        {
+            uint32_t i;
+            uint32_t total = 0u;
+            uint32_t target = (uint32_t)(((double)histogram->count * percentile) / 100.0);
+            if (target == 0u)
+            {
+                target = 1u;
+            }
+
+            /* The reported value is the highest one of the bucket, never above the maximum latency */
+            (*value) = histogram->max;
+            for (i = 0u; i < MQTT_CLIENT_METRICS_BUCKET_COUNT; i++)
+            {
+                total += histogram->buckets[i];
+                if (total >= target)
+                {
+                    const uint64_t bucket_max = mqtt_client_metrics_get_bucket_max(i);
+                    if (bucket_max < histogram->max)
+                    {
+                        (*value) = bucket_max;
+                    }
+                    break;
+                }
+            }
+        }
+        ret = true;
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+
+
+
+/** \brief Start an update of the values, the readers retry until it ends */
+static void mqtt_client_metrics_begin_update(mqtt_client_metrics_t* const metrics)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    /* Single writer : the owner of the client */
+    MQTT_CLIENT_METRICS_STORE_RELAXED(&metrics->sequence, metrics->sequence + 1u);
+    MQTT_CLIENT_METRICS_FENCE_RELEASE();
+}
+
+/** \brief End an update of the values */
+static void mqtt_client_metrics_end_update(mqtt_client_metrics_t* const metrics)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    MQTT_CLIENT_METRICS_STORE_RELEASE(&metrics->sequence, metrics->sequence + 1u);
+}
+
+/** \brief Record a latency in an histogram */
+static void mqtt_client_metrics_record(mqtt_client_metrics_histogram_t* const histogram, const uint64_t value)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    if ((histogram->count == 0u) || (value < histogram->min))
+    {
+        histogram->min = value;
+    }
+    if (value > histogram->max)
+    {
+        histogram->max = value;
+    }
+    histogram->sum += value;
+    histogram->count++;
+    histogram->buckets[mqtt_client_metrics_get_bucket(value)]++;
+}
+
+/** \brief Get the bucket of an histogram which stores a latency */
+static uint32_t mqtt_client_metrics_get_bucket(const uint64_t value)
+{
+    uint32_t bucket;
+
+    if (value < (2u * MQTT_CLIENT_METRICS_SUB_BUCKET_COUNT))
+    {
+        /* Exact value */
+        bucket = (uint32_t)value;
+    }
+    else
+    {
+        /* Keep the MQTT_CLIENT_METRICS_SUB_BUCKET_BITS bits following the most significant bit */
+        uint32_t shift = 0u;
+        uint64_t mantissa = value;
+        while (mantissa >= (2u * MQTT_CLIENT_METRICS_SUB_BUCKET_COUNT))
+        {
+            mantissa >>= 1u;
+            shift++;
+        }
+        bucket = ((shift + 1u) * MQTT_CLIENT_METRICS_SUB_BUCKET_COUNT) + ((uint32_t)mantissa - MQTT_CLIENT_METRICS_SUB_BUCKET_COUNT);
+        if (bucket >= MQTT_CLIENT_METRICS_BUCKET_COUNT)
+        {
+            /* Out of range */
+            bucket = MQTT_CLIENT_METRICS_BUCKET_COUNT - 1u;
+        }
+    }
+
+    return bucket;
+}
+
+/** \brief Get the highest latency stored in a bucket of an histogram */
+static uint64_t mqtt_client_metrics_get_bucket_max(const uint32_t bucket)
+{
+    uint64_t value;
+
+    if (bucket < (2u * MQTT_CLIENT_METRICS_SUB_BUCKET_COUNT))
+    {
+        /* Exact value */
+        value = bucket;
+    }
+    else
+    {
+        const uint32_t shift = (bucket / MQTT_CLIENT_METRICS_SUB_BUCKET_COUNT) - 1u;
+        const uint64_t mantissa = MQTT_CLIENT_METRICS_SUB_BUCKET_COUNT + (bucket % MQTT_CLIENT_METRICS_SUB_BUCKET_COUNT);
+        value = ((mantissa + 1u) << shift) - 1u;
+    }
+
+    return value;
+}
+
+#endif /* MQTT_CLIENT_METRICS_ENABLED */
@@ -0,0 +1,168 @@
+/*
+Copyright(c) 2016 Cedric Jimenez
+
+This file is part of lw-mqtt.
+
+lw-mqtt is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+lw-mqtt is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MQTT_CLIENT_METRICS_H
+#define MQTT_CLIENT_METRICS_H
+
+#include "stdheaders.h"
+#include "mqtt_config.h"
+
+#ifdef MQTT_CLIENT_METRICS_ENABLED
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+
+/** \brief Number of packet types counted by the metrics (indexed by the MQTT_PKT_xxx values) */
+#define MQTT_CLIENT_METRICS_PACKET_TYPES    16u
+
+/** \brief Number of linear sub-buckets in each power of 2 range of a latency histogram */
+#define MQTT_CLIENT_METRICS_SUB_BUCKET_COUNT    (1u << MQTT_CLIENT_METRICS_SUB_BUCKET_BITS)
+
+/** \brief Number of buckets of a latency histogram */
+#define MQTT_CLIENT_METRICS_BUCKET_COUNT    \
+    (((MQTT_CLIENT_METRICS_LATENCY_BITS - MQTT_CLIENT_METRICS_SUB_BUCKET_BITS) + 1u) * MQTT_CLIENT_METRICS_SUB_BUCKET_COUNT)
+
+
+/** \brief Events counted by the metrics */
+typedef enum _mqtt_client_metrics_event_t
+{
+    /** \brief Connection accepted by the broker */
+    MQTT_CLIENT_METRICS_EVT_CONNECTION = 0u,
+    /** \brief Connection refused by the broker or failed */
+    MQTT_CLIENT_METRICS_EVT_CONNECTION_FAILURE = 1u,
+    /** \brief Established connection lost without a disconnect request from the application */
+    MQTT_CLIENT_METRICS_EVT_CONNECTION_LOSS = 2u,
+    /** \brief Broker didn't reply in time */
+    MQTT_CLIENT_METRICS_EVT_RESPONSE_TIMEOUT = 3u,
+    /** \brief PUBLISH packet retransmitted by the broker (DUP flag set) */
+    MQTT_CLIENT_METRICS_EVT_RETRANSMIT_RECEIVED = 4u
+} mqtt_client_metrics_event_t;
+
+/** \brief Latency histogram with a constant relative precision : the latencies below 2 * MQTT_CLIENT_METRICS_SUB_BUCKET_COUNT
+           are stored exactly, each following power of 2 range is split in MQTT_CLIENT_METRICS_SUB_BUCKET_COUNT buckets */
+typedef struct _mqtt_client_metrics_histogram_t
+{
+    /** \brief Number of recorded latencies */
+    uint32_t count;
+    /** \brief Minimum latency in us */
+    uint64_t min;
+    /** \brief Maximum latency in us */
+    uint64_t max;
+    /** \brief Sum of the latencies in us */
+    uint64_t sum;
+    /** \brief Number of latencies in each bucket */
+    uint32_t buckets[MQTT_CLIENT_METRICS_BUCKET_COUNT];
+} mqtt_client_metrics_histogram_t;
+
+/** \brief Snapshot of the metrics of a MQTT client */
+typedef struct _mqtt_client_metrics_snapshot_t
+{
+    /** \brief Number of packets sent per packet type */
+    uint32_t sent_packets[MQTT_CLIENT_METRICS_PACKET_TYPES];
+    /** \brief Number of bytes sent per packet type */
+    uint64_t sent_bytes[MQTT_CLIENT_METRICS_PACKET_TYPES];
+    /** \brief Number of packets received per packet type */
+    uint32_t received_packets[MQTT_CLIENT_METRICS_PACKET_TYPES];
+    /** \brief Number of bytes received per packet type */
+    uint64_t received_bytes[MQTT_CLIENT_METRICS_PACKET_TYPES];
+
+    /** \brief Number of connections accepted by the broker */
+    uint32_t connections;
+    /** \brief Number of connections accepted by the broker after the first one */
+    uint32_t reconnects;
+    /** \brief Number of connections refused by the broker or failed */
+    uint32_t connection_failures;
+    /** \brief Number of established connections lost */
+    uint32_t connection_losses;
+    /** \brief Number of broker response timeouts */
+    uint32_t response_timeouts;
+    /** \brief Number of PUBLISH packets retransmitted by the broker */
+    uint32_t retransmits_received;
+    /** \brief Number of requests whose latency couldn't be measured because too many were pending */
+    uint32_t untracked_requests;
+
+    /** \brief Latency in us between a QoS 1/2 PUBLISH packet and its PUBACK/PUBCOMP acknowledgement */
+    mqtt_client_metrics_histogram_t publish_latency;
+    /** \brief Latency in us between a SUBSCRIBE packet and its SUBACK acknowledgement */
+    mqtt_client_metrics_histogram_t subscribe_latency;
+} mqtt_client_metrics_snapshot_t;
+
+/** \brief Request waiting for an acknowledgement */
+typedef struct _mqtt_client_metrics_request_t
+{
+    /** \brief Timestamp in us of the request */
+    uint64_t start_time;
+    /** \brief Packet id of the request */
+    uint16_t packet_id;
+    /** \brief Indicate if the request is a SUBSCRIBE packet, a PUBLISH packet otherwise */
+    bool subscribe;
+    /** \brief Indicate if the slot is used */
+    bool used;
+} mqtt_client_metrics_request_t;
+
+/** \brief Metrics of a MQTT client : updated by the thread owning the client and read by any thread without lock */
+typedef struct _mqtt_client_metrics_t
+{
+    /** \brief Sequence number, odd while the values are being updated */
+    volatile uint32_t sequence;
+    /** \brief Values */
+    mqtt_client_metrics_snapshot_t values;
+    /** \brief Requests waiting for an acknowledgement (only accessed by the writer) */
+    mqtt_client_metrics_request_t requests[MQTT_CLIENT_METRICS_MAX_REQUESTS];
+} mqtt_client_metrics_t;
+
+
+/** \brief Initialize the metrics */
+bool mqtt_client_metrics_init(mqtt_client_metrics_t* const metrics);
+
+/** \brief Count a sent packet */
+bool mqtt_client_metrics_packet_sent(mqtt_client_metrics_t* const metrics, const uint8_t packet_type, const size_t size);
+
+/** \brief Count a received packet */
+bool mqtt_client_metrics_packet_received(mqtt_client_metrics_t* const metrics, const uint8_t packet_type, const size_t size);
+
+/** \brief Count an event */
+bool mqtt_client_metrics_event(mqtt_client_metrics_t* const metrics, const mqtt_client_metrics_event_t event);
+
+/** \brief Start measuring the latency of a request */
+bool mqtt_client_metrics_request_start(mqtt_client_metrics_t* const metrics, const uint16_t packet_id, const bool subscribe);
+
+/** \brief Stop measuring the latency of a request on its acknowledgement and record it */
+bool mqtt_client_metrics_request_end(mqtt_client_metrics_t* const metrics, const uint16_t packet_id, const bool subscribe);
+
+/** \brief Forget the pending requests when the connection is closed */
+bool mqtt_client_metrics_clear_requests(mqtt_client_metrics_t* const metrics);
+
+/** \brief Get a consistent copy of the metrics, can be called from any thread */
+bool mqtt_client_metrics_get_snapshot(const mqtt_client_metrics_t* const metrics, mqtt_client_metrics_snapshot_t* const snapshot);
+
+/** \brief Get the value in us below which a percentage (0 to 100) of the latencies of an histogram falls */
+bool mqtt_client_metrics_get_percentile(const mqtt_client_metrics_histogram_t* const histogram, const double percentile, uint64_t* const value);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* MQTT_CLIENT_METRICS_ENABLED */
+
+#endif /* MQTT_CLIENT_METRICS_H */
@@ -0,0 +1,871 @@
+/*
+Copyright(c) 2016 Cedric Jimenez
+
+This file is part of lw-mqtt.
+
+lw-mqtt is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+lw-mqtt is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "mqtt_client_wal.h"
+
+#ifdef MQTT_CLIENT_WAL_ENABLED
+
+#include "mqtt_error.h"
+#include "mqtt_file.h"
+#include "mqtt_crc32.h"
+
+
+/** \brief Record of a published message */
+#define MQTT_CLIENT_WAL_RECORD_PUBLISH      1u
+
+/** \brief Record of an acknowledged message */
+#define MQTT_CLIENT_WAL_RECORD_ACK          2u
+
+/** \brief Size in bytes of the chunks used to read and copy the records */
+#define MQTT_CLIENT_WAL_CHUNK_SIZE          256u
+
+
+/** \brief Header of the write-ahead log files : magic + version */
+static const uint8_t s_mqtt_client_wal_file_header[MQTT_CLIENT_WAL_FILE_HEADER_SIZE] = { 'L', 'W', 'M', 'Q', 'W', 'A', 'L', 1u };
+
+
+/** \brief Encode the header of a record */
+static void mqtt_client_wal_encode_header(uint8_t* const header, const uint8_t type, const uint8_t flags, const uint16_t topic_length, 
+                                          const uint32_t length, const uint64_t sequence);
+
+/** \brief Get the size in bytes of a record from its header, 0 if the header is invalid */
+static uint32_t mqtt_client_wal_decode_header(const uint8_t* const header, uint8_t* const type, uint8_t* const flags, uint16_t* const topic_length, 
+                                              uint32_t* const length, uint64_t* const sequence);
+
+/** \brief Write a record at the end of the valid records */
+static bool mqtt_client_wal_write_record(mqtt_client_wal_t* const wal, const uint8_t type, const uint8_t flags, const mqtt_const_string_t* const topic, 
+                                         const void* const message, const uint32_t length, const uint64_t sequence);
+
+/** \brief Write data at the end of the valid records and update the CRC-32 of the record */
+static bool mqtt_client_wal_write(mqtt_client_wal_t* const wal, const void* const data, const size_t size, uint32_t* const crc);
+
+/** \brief Read data at an offset of the file */
+static bool mqtt_client_wal_read_at(mqtt_client_wal_t* const wal, const long offset, void* const data, const size_t size);
+
+/** \brief Load the records of the file and discard the torn record at its end */
+static bool mqtt_client_wal_load(mqtt_client_wal_t* const wal);
+
+/** \brief Release the acknowledged entries at the head of the log */
+static void mqtt_client_wal_pop(mqtt_client_wal_t* const wal);
+
+/** \brief Compact the log if the acknowledged records take too much space */
+static bool mqtt_client_wal_compact(mqtt_client_wal_t* const wal);
+
+/** \brief Rewrite the records of the unacknowledged messages in a new file which replaces the log */
+static bool mqtt_client_wal_rewrite(mqtt_client_wal_t* const wal);
+
+
+
+/** \brief Open or create a write-ahead log and load its unacknowledged messages as pending */
+bool mqtt_client_wal_open(mqtt_client_wal_t* const wal, const char* const path)
+{
+    bool ret = false;
+
+    /* Check params, the path of the temporary file used by the compaction must fit */
+    if ((wal != NULL) &&
+        (path != NULL) &&
+        ((strlen(path) + 5u) <= MQTT_CLIENT_WAL_MAX_PATH_LENGTH))
+    {
+        (void)memset(wal, 0, sizeof(mqtt_client_wal_t));
+        (void)strcpy(wal->path, path);
+
+        /* Open the existing file or create it */
+        wal->file = fopen(path, "r+b");
+        if (wal->file == NULL)
+        {
+            wal->file = fopen(path, "w+b");
+        }
+        if (wal->file != NULL)
+        {
+            (void)setvbuf(wal->file, wal->buffer, _IOFBF, sizeof(wal->buffer));
+            ret = mqtt_client_wal_load(wal);
+            if (!ret)
+            {
+                (void)fclose(wal->file);
+                wal->file = NULL;
+            }
+        }
+        else
+        {
+            mqtt_errno_set(MQTT_ERR_FILE_FAILED);
+        }
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Sync and close a write-ahead log */
+bool mqtt_client_wal_close(mqtt_client_wal_t* const wal)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((wal != NULL) &&
+        (wal->file != NULL))
+    {
+        ret = mqtt_file_sync(wal->file);
+        if (fclose(wal->file) != 0)
+        {
+            mqtt_errno_set(MQTT_ERR_FILE_FAILED);
+            ret = false;
+        }
+        wal->file = NULL;
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Append a message to a write-ahead log, it survives a crash of the process once appended and a power loss after the next sync */
+bool mqtt_client_wal_append(mqtt_client_wal_t* const wal, const mqtt_const_string_t* const topic, const void* const message,
+                            const uint32_t length, const uint8_t qos, const bool retain, mqtt_client_wal_entry_t** const entry)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((wal != NULL) &&
+        (wal->file != NULL) &&
+        (topic != NULL) &&
+        (!((message == NULL) && (length != 0u))) &&
+        (qos != 0u) &&
+        (entry != NULL))
+    {
+        if (wal->count < MQTT_CLIENT_WAL_MAX_ENTRIES)
+        {
+            const uint8_t flags = (uint8_t)(qos | (retain ? 0x04u : 0x00u));
+            const long offset = wal->size;
+
+            ret = mqtt_client_wal_write_record(wal, MQTT_CLIENT_WAL_RECORD_PUBLISH, flags, topic, message, length, wal->next_sequence);
+            if (ret)
+            {
+                mqtt_client_wal_entry_t* const new_entry = &wal->entries[(wal->first + wal->count) % MQTT_CLIENT_WAL_MAX_ENTRIES];
+                new_entry->sequence = wal->next_sequence;
+                new_entry->offset = offset;
+                new_entry->size = (uint32_t)(wal->size - offset);
+                new_entry->packet_id = 0u;
+                new_entry->state = MQTT_CLIENT_WAL_STATE_PENDING;
+                wal->next_sequence++;
+                wal->count++;
+                (*entry) = new_entry;
+            }
+        }
+        else
+        {
+            /* Too many unacknowledged messages */
+            mqtt_errno_set(MQTT_ERR_FLOW_CONTROL);
+        }
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Release an entry of a write-ahead log once its message has been acknowledged or abandoned */
+bool mqtt_client_wal_release(mqtt_client_wal_t* const wal, mqtt_client_wal_entry_t* const entry)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((wal != NULL) &&
+        (wal->file != NULL) &&
+        (entry != NULL) &&
+        (entry->state != MQTT_CLIENT_WAL_STATE_ACKNOWLEDGED))
+    {
+        mqtt_const_string_t no_topic;
+        no_topic.str = "";
+        no_topic.size = 0u;
+
+        /* The message is not replayed anymore even if the record is lost */
+        entry->state = MQTT_CLIENT_WAL_STATE_ACKNOWLEDGED;
+        ret = mqtt_client_wal_write_record(wal, MQTT_CLIENT_WAL_RECORD_ACK, 0u, &no_topic, NULL, 0u, entry->sequence);
+        mqtt_client_wal_pop(wal);
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Release the entry of the message sent with a packet id */
+bool mqtt_client_wal_acknowledge(mqtt_client_wal_t* const wal, const uint16_t packet_id)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((wal != NULL) &&
+        (wal->file != NULL))
+    {
+        /* The acknowledgements mostly come in order, the oldest entries are checked first */
+        uint32_t i;
+        mqtt_client_wal_entry_t* entry = NULL;
+        for (i = 0u; (i < wal->count) && (entry == NULL); i++)
+        {
+            mqtt_client_wal_entry_t* const current = &wal->entries[(wal->first + i) % MQTT_CLIENT_WAL_MAX_ENTRIES];
+            if ((current->state == MQTT_CLIENT_WAL_STATE_SENT) && (current->packet_id == packet_id))
+            {
+                entry = current;
+            }
+        }
+        if (entry != NULL)
+        {
+            ret = mqtt_client_wal_release(wal, entry);
+        }
+        else
+        {
+            mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+        }
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Mark the sent entries as pending, must be called when a new connection starts */
+bool mqtt_client_wal_reset(mqtt_client_wal_t* const wal)
+{
+    bool ret = false;
+
+    /* Check params */
+    if (wal != NULL)
+    {
+        uint32_t i;
+        for (i = 0u; i < wal->count; i++)
+        {
+            mqtt_client_wal_entry_t* const entry = &wal->entries[(wal->first + i) % MQTT_CLIENT_WAL_MAX_ENTRIES];
+            if (entry->state == MQTT_CLIENT_WAL_STATE_SENT)
+            {
+                entry->state = MQTT_CLIENT_WAL_STATE_PENDING;
+            }
+        }
+        ret = true;
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Get the oldest pending entry (NULL if none) */
+bool mqtt_client_wal_get_pending(mqtt_client_wal_t* const wal, mqtt_client_wal_entry_t** const entry)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((wal != NULL) &&
+        (entry != NULL))
+    {
+        uint32_t i;
+        (*entry) = NULL;
+        for (i = 0u; (i < wal->count) && ((*entry) == NULL); i++)
+        {
+            mqtt_client_wal_entry_t* const current = &wal->entries[(wal->first + i) % MQTT_CLIENT_WAL_MAX_ENTRIES];
+            if (current->state == MQTT_CLIENT_WAL_STATE_PENDING)
+            {
+                (*entry) = current;
+            }
+        }
+        ret = true;
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Read back the message of an entry, the topic string and the payload buffer must be sized by the caller */
+bool mqtt_client_wal_read(mqtt_client_wal_t* const wal, const mqtt_client_wal_entry_t* const entry, mqtt_client_wal_message_t* const message)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((wal != NULL) &&
+        (wal->file != NULL) &&
+        (entry != NULL) &&
+        (message != NULL) &&
+        (message->topic.str != NULL))
+    {
+        uint8_t header[MQTT_CLIENT_WAL_RECORD_HEADER_SIZE];
+        uint8_t type = 0u;
+        uint8_t flags = 0u;
+        uint16_t topic_length = 0u;
+        uint32_t length = 0u;
+        uint64_t sequence = 0u;
+
+        ret = mqtt_client_wal_read_at(wal, entry->offset, header, sizeof(header));
+        if (ret)
+        {
+            ret = ((mqtt_client_wal_decode_header(header, &type, &flags, &topic_length, &length, &sequence) != 0u) &&
+                   (type == MQTT_CLIENT_WAL_RECORD_PUBLISH) && (sequence == entry->sequence));
+            if (!ret)
+            {
+                mqtt_errno_set(MQTT_ERR_FILE_FAILED);
+            }
+        }
+        if (ret)
+        {
+            ret = ((topic_length <= message->topic.size) && (length <= message->length) &&
+                   ((length == 0u) || (message->payload != NULL)));
+            if (!ret)
+            {
+                mqtt_errno_set(MQTT_ERR_BUFFER_TOO_SMALL);
+            }
+        }
+        if (ret)
+        {
+            /* The topic and the payload follow the header */
+            ret = ((fread(message->topic.str, 1u, topic_length, wal->file) == topic_length) &&
+                   (fread(message->payload, 1u, length, wal->file) == length));
+            if (ret)
+            {
+                message->topic.size = topic_length;
+                message->length = length;
+                message->qos = (flags & 0x03u);
+                message->retain = ((flags & 0x04u) != 0u);
+            }
+            else
+            {
+                mqtt_errno_set(MQTT_ERR_FILE_FAILED);
+            }
+        }
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Write the appended records to the disk in a single sync and compact the log if needed */
+bool mqtt_client_wal_sync(mqtt_client_wal_t* const wal)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((wal != NULL) &&
+        (wal->file != NULL))
+    {
+        ret = true;
+        if (wal->unsynced != 0u)
+        {
+            ret = mqtt_file_sync(wal->file);
+            if (ret)
+            {
+                wal->unsynced = 0u;
+            }
+        }
+        if (ret)
+        {
+            ret = mqtt_client_wal_compact(wal);
+        }
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+
+
+
+/** \brief Encode the header of a record */
+static void mqtt_client_wal_encode_header(uint8_t* const header, const uint8_t type, const uint8_t flags, const uint16_t topic_length, 
+                                          const uint32_t length, const uint64_t sequence)
+{
+    uint32_t i;
+
+    /* Little endian fields */
+    header[0u] = type;
+    header[1u] = flags;
+    header[2u] = (uint8_t)(topic_length & 0xFFu);
+    header[3u] = (uint8_t)(topic_length >> 8u);
+    for (i = 0u; i < 4u; i++)
+    {
+        header[4u + i] = (uint8_t)((length >> (8u * i)) & 0xFFu);
+    }
+    for (i = 0u; i < 8u; i++)
+    {
+        header[8u + i] = (uint8_t)((sequence >> (8u * i)) & 0xFFu);
+    }
+}
+
+/** \brief Get the size in bytes of a record from its header, 0 if the header is invalid */
+static uint32_t mqtt_client_wal_decode_header(const uint8_t* const header, uint8_t* const type, uint8_t* const flags, uint16_t* const topic_length, 
+                                              uint32_t* const length, uint64_t* const sequence)
+{
+    uint32_t size = 0u;
+    uint32_t i;
+
+    (*type) = header[0u];
+    (*flags) = header[1u];
+    (*topic_length) = (uint16_t)(header[2u] | (header[3u] << 8u));
+    (*length) = 0u;
+    for (i = 0u; i < 4u; i++)
+    {
+        (*length) |= (((uint32_t)header[4u + i]) << (8u * i));
+    }
+    (*sequence) = 0u;
+    for (i = 0u; i < 8u; i++)
+    {
+        (*sequence) |= (((uint64_t)header[8u + i]) << (8u * i));
+    }
+
+    if (((*type) == MQTT_CLIENT_WAL_RECORD_PUBLISH) && 
+        (((*flags) & 0x03u) != 0u) && (((*flags) & 0x03u) <= 2u) && 
+        ((*length) <= MQTT_MAXIMUM_VARIABLE_INTEGER))
+    {
+        size = MQTT_CLIENT_WAL_RECORD_HEADER_SIZE + (*topic_length) + (*length) + MQTT_CLIENT_WAL_RECORD_CRC_SIZE;
+    }
+    else if (((*type) == MQTT_CLIENT_WAL_RECORD_ACK) && ((*topic_length) == 0u) && ((*length) == 0u))
+    {
+        size = MQTT_CLIENT_WAL_RECORD_HEADER_SIZE + MQTT_CLIENT_WAL_RECORD_CRC_SIZE;
+    }
+    else
+    {
+        /* Invalid record */
+    }
+
+    return size;
+}
+
+/** \brief Write a record at the end of the valid records */
+static bool mqtt_client_wal_write_record(mqtt_client_wal_t* const wal, const uint8_t type, const uint8_t flags, const mqtt_const_string_t* const topic, 
+                                         const void* const message, const uint32_t length, const uint64_t sequence)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    bool ret;
+    uint8_t header[MQTT_CLIENT_WAL_RECORD_HEADER_SIZE];
+    uint8_t trailer[MQTT_CLIENT_WAL_RECORD_CRC_SIZE];
+    uint32_t crc = MQTT_CRC32_INIT;
+    const long offset = wal->size;
+
+    mqtt_client_wal_encode_header(header, type, flags, topic->size, length, sequence);
+    ret = mqtt_client_wal_write(wal, header, sizeof(header), &crc);
+    if (ret)
+    {
+        ret = mqtt_client_wal_write(wal, topic->str, topic->size, &crc);
+    }
+    if (ret)
+    {
+        ret = mqtt_client_wal_write(wal, message, length, &crc);
+    }
+    if (ret)
+    {
+        crc = ~crc;
+        trailer[0u] = (uint8_t)(crc & 0xFFu);
+        trailer[1u] = (uint8_t)((crc >> 8u) & 0xFFu);
+        trailer[2u] = (uint8_t)((crc >> 16u) & 0xFFu);
+        trailer[3u] = (uint8_t)(crc >> 24u);
+        ret = mqtt_client_wal_write(wal, trailer, sizeof(trailer), NULL);
+    }
+    if (ret && (type == MQTT_CLIENT_WAL_RECORD_PUBLISH))
+    {
+        /* The message is handed to the kernel before it is published so that it survives a crash of the process,
+           only the sync to the disk is left to the group commit */
+        ret = (fflush(wal->file) == 0);
+    }
+    if (ret)
+    {
+        wal->unsynced++;
+    }
+    else
+    {
+        /* The next record overwrites the partial one */
+        wal->size = offset;
+        wal->reading = true;
+        mqtt_errno_set(MQTT_ERR_FILE_FAILED);
+    }
+
+    return ret;
+}
+
+/** \brief Write data at the end of the valid records and update the CRC-32 of the record */
+static bool mqtt_client_wal_write(mqtt_client_wal_t* const wal, const void* const data, const size_t size, uint32_t* const crc)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    bool ret = true;
+
+    /* Positionning the file flushes its buffer, it is only done after a read */
+    if (wal->reading)
+    {
+        ret = (fseek(wal->file, wal->size, SEEK_SET) == 0);
+        wal->reading = !ret;
+    }
+    if (ret && (size != 0u))
+    {
+        ret = (fwrite(data, 1u, size, wal->file) == size);
+        if (ret)
+        {
+            wal->size += (long)size;
+            if (crc != NULL)
+            {
+                (*crc) = mqtt_crc32_update((*crc), data, size);
+            }
+        }
+    }
+
+    return ret;
+}
+
+/** \brief Read data at an offset of the file */
+static bool mqtt_client_wal_read_at(mqtt_client_wal_t* const wal, const long offset, void* const data, const size_t size)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    bool ret;
+
+    /* Positionning the file writes the buffered records first */
+    wal->reading = true;
+    ret = ((fseek(wal->file, offset, SEEK_SET) == 0) && (fread(data, 1u, size, wal->file) == size));
+    if (!ret)
+    {
+        mqtt_errno_set(MQTT_ERR_FILE_FAILED);
+    }
+
+    return ret;
+}
+
+/** \brief Load the records of the file and discard the torn record at its end */
+static bool mqtt_client_wal_load(mqtt_client_wal_t* const wal)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    bool ret;
+    bool valid;
+    long file_size;
+    uint8_t header[MQTT_CLIENT_WAL_FILE_HEADER_SIZE];
+
+    /* Check the file header, an empty file is a new log */
+    wal->reading = true;
+    valid = (fread(header, 1u, sizeof(header), wal->file) == sizeof(header));
+    if (valid)
+    {
+        ret = (memcmp(header, s_mqtt_client_wal_file_header, sizeof(header)) == 0);
+        wal->size = (long)sizeof(header);
+    }
+    else
+    {
+        ret = true;
+        wal->size = 0;
+    }
+
+    /* Read the records sequentially until the end of the file or the first invalid record */
+    while (ret && valid)
+    {
+        uint8_t record_header[MQTT_CLIENT_WAL_RECORD_HEADER_SIZE];
+        uint8_t type = 0u;
+        uint8_t flags = 0u;
+        uint16_t topic_length = 0u;
+        uint32_t length = 0u;
+        uint64_t sequence = 0u;
+        uint32_t size = 0u;
+
+        valid = (fread(record_header, 1u, sizeof(record_header), wal->file) == sizeof(record_header));
+        if (valid)
+        {
+            size = mqtt_client_wal_decode_header(record_header, &type, &flags, &topic_length, &length, &sequence);
+            valid = (size != 0u);
+        }
+        if (valid)
+        {
+            /* Check the CRC-32 of the record */
+            uint8_t chunk[MQTT_CLIENT_WAL_CHUNK_SIZE];
+            uint32_t left = size - MQTT_CLIENT_WAL_RECORD_HEADER_SIZE - MQTT_CLIENT_WAL_RECORD_CRC_SIZE;
+            uint32_t crc = mqtt_crc32_update(MQTT_CRC32_INIT, record_header, sizeof(record_header));
+            while (valid && (left != 0u))
+            {
+                const size_t chunk_size = ((left < sizeof(chunk)) ? left : sizeof(chunk));
+                valid = (fread(chunk, 1u, chunk_size, wal->file) == chunk_size);
+                crc = mqtt_crc32_update(crc, chunk, chunk_size);
+                left -= (uint32_t)chunk_size;
+            }
+            if (valid)
+            {
+                valid = (fread(chunk, 1u, MQTT_CLIENT_WAL_RECORD_CRC_SIZE, wal->file) == MQTT_CLIENT_WAL_RECORD_CRC_SIZE);
+                crc = ~crc;
+                valid = (valid && (chunk[0u] == (uint8_t)(crc & 0xFFu)) && (chunk[1u] == (uint8_t)((crc >> 8u) & 0xFFu)) &&
+                         (chunk[2u] == (uint8_t)((crc >> 16u) & 0xFFu)) && (chunk[3u] == (uint8_t)(crc >> 24u)));
+            }
+        }
+        if (valid)
+        {
+            if (type == MQTT_CLIENT_WAL_RECORD_PUBLISH)
+            {
+                if (wal->count < MQTT_CLIENT_WAL_MAX_ENTRIES)
+                {
+                    mqtt_client_wal_entry_t* const entry = &wal->entries[(wal->first + wal->count) % MQTT_CLIENT_WAL_MAX_ENTRIES];
+                    entry->sequence = sequence;
+                    entry->offset = wal->size;
+                    entry->size = size;
+                    entry->packet_id = 0u;
+                    entry->state = MQTT_CLIENT_WAL_STATE_PENDING;
+                    wal->count++;
+                }
+                else
+                {
+                    /* The log has been written with a bigger configuration */
+                    mqtt_errno_set(MQTT_ERR_BUFFER_TOO_SMALL);
+                    ret = false;
+                }
+            }
+            else
+            {
+                uint32_t i;
+                for (i = 0u; i < wal->count; i++)
+                {
+                    mqtt_client_wal_entry_t* const entry = &wal->entries[(wal->first + i) % MQTT_CLIENT_WAL_MAX_ENTRIES];
+                    if (entry->sequence == sequence)
+                    {
+                        entry->state = MQTT_CLIENT_WAL_STATE_ACKNOWLEDGED;
+                    }
+                }
+                mqtt_client_wal_pop(wal);
+            }
+            if (sequence >= wal->next_sequence)
+            {
+                wal->next_sequence = sequence + 1u;
+            }
+            wal->size += (long)size;
+        }
+    }
+    if (ret)
+    {
+        /* Write the header of a new log or discard the torn record */
+        ret = (fseek(wal->file, 0, SEEK_END) == 0);
+        file_size = ftell(wal->file);
+        if (ret && (wal->size == 0))
+        {
+            ret = ((fwrite(s_mqtt_client_wal_file_header, 1u, sizeof(s_mqtt_client_wal_file_header), wal->file) == sizeof(s_mqtt_client_wal_file_header)) &&
+                   mqtt_file_sync(wal->file));
+            wal->size = (long)sizeof(s_mqtt_client_wal_file_header);
+        }
+        else if (ret && (file_size > wal->size))
+        {
+            ret = (mqtt_file_truncate(wal->file, wal->size) && mqtt_file_sync(wal->file));
+        }
+        else
+        {
+            /* Nothing to repair */
+        }
+        if (!ret)
+        {
+            mqtt_errno_set(MQTT_ERR_FILE_FAILED);
+        }
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_FILE_FAILED);
+    }
+
+    return ret;
+}
+
+/** \brief Release the acknowledged entries at the head of the log */
+static void mqtt_client_wal_pop(mqtt_client_wal_t* const wal)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    while ((wal->count != 0u) && (wal->entries[wal->first].state == MQTT_CLIENT_WAL_STATE_ACKNOWLEDGED))
+    {
+        wal->first = ((wal->first + 1u) % MQTT_CLIENT_WAL_MAX_ENTRIES);
+        wal->count--;
+    }
+}
+
+/** \brief Compact the log if the acknowledged records take too much space */
+static bool mqtt_client_wal_compact(mqtt_client_wal_t* const wal)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    bool ret = true;
+
+    if (wal->size >= (long)MQTT_CLIENT_WAL_COMPACT_SIZE)
+    {
+        if (wal->count == 0u)
+        {
+            /* Every message has been acknowledged : the records are dropped in place */
+            ret = (mqtt_file_truncate(wal->file, (long)MQTT_CLIENT_WAL_FILE_HEADER_SIZE) && mqtt_file_sync(wal->file));
+            if (ret)
+            {
+                wal->size = (long)MQTT_CLIENT_WAL_FILE_HEADER_SIZE;
+                wal->reading = true;
+            }
+        }
+        else
+        {
+            /* Rewrite the log once the unacknowledged records take less than half of it */
+            uint32_t i;
+            long live_size = 0;
+            for (i = 0u; i < wal->count; i++)
+            {
+                const mqtt_client_wal_entry_t* const entry = &wal->entries[(wal->first + i) % MQTT_CLIENT_WAL_MAX_ENTRIES];
+                if (entry->state != MQTT_CLIENT_WAL_STATE_ACKNOWLEDGED)
+                {
+                    live_size += (long)entry->size;
+                }
+            }
+            if ((live_size * 2) < wal->size)
+            {
+                ret = mqtt_client_wal_rewrite(wal);
+            }
+        }
+    }
+
+    return ret;
+}
+
+/** \brief Rewrite the records of the unacknowledged messages in a new file which replaces the log */
+static bool mqtt_client_wal_rewrite(mqtt_client_wal_t* const wal)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    bool ret;
+    char tmp_path[MQTT_CLIENT_WAL_MAX_PATH_LENGTH];
+    long new_size = (long)MQTT_CLIENT_WAL_FILE_HEADER_SIZE;
+    FILE* tmp_file;
+
+    /* Copy the live records to a temporary file */
+    (void)strcpy(tmp_path, wal->path);
+    (void)strcat(tmp_path, ".tmp");
+    tmp_file = fopen(tmp_path, "wb");
+    ret = (tmp_file != NULL);
+    if (ret)
+    {
+        uint32_t i;
+        ret = (fwrite(s_mqtt_client_wal_file_header, 1u, sizeof(s_mqtt_client_wal_file_header), tmp_file) == sizeof(s_mqtt_client_wal_file_header));
+        for (i = 0u; (i < wal->count) && ret; i++)
+        {
+            const mqtt_client_wal_entry_t* const entry = &wal->entries[(wal->first + i) % MQTT_CLIENT_WAL_MAX_ENTRIES];
+            if (entry->state != MQTT_CLIENT_WAL_STATE_ACKNOWLEDGED)
+            {
+                uint8_t chunk[MQTT_CLIENT_WAL_CHUNK_SIZE];
+                uint32_t left = entry->size;
+                ret = (fseek(wal->file, entry->offset, SEEK_SET) == 0);
+                while (ret && (left != 0u))
+                {
+                    const size_t chunk_size = ((left < sizeof(chunk)) ? left : sizeof(chunk));
+                    ret = ((fread(chunk, 1u, chunk_size, wal->file) == chunk_size) &&
+                           (fwrite(chunk, 1u, chunk_size, tmp_file) == chunk_size));
+                    left -= (uint32_t)chunk_size;
+                }
+                new_size += (long)entry->size;
+            }
+        }
+        wal->reading = true;
+        ret = (ret && mqtt_file_sync(tmp_file));
+        if ((fclose(tmp_file) != 0) || !ret)
+        {
+            (void)remove(tmp_path);
+            ret = false;
+        }
+    }
+
+    /* Replace the log */
+    if (ret)
+    {
+        (void)fclose(wal->file);
+        ret = mqtt_file_replace(tmp_path, wal->path);
+        wal->file = fopen(wal->path, "r+b");
+        if (wal->file != NULL)
+        {
+            (void)setvbuf(wal->file, wal->buffer, _IOFBF, sizeof(wal->buffer));
+        }
+        else
+        {
+            ret = false;
+        }
+    }
+    if (ret)
+    {
+        /* Same order of the records in the new file */
+        uint32_t i;
+        long offset = (long)MQTT_CLIENT_WAL_FILE_HEADER_SIZE;
+        for (i = 0u; i < wal->count; i++)
+        {
+            mqtt_client_wal_entry_t* const entry = &wal->entries[(wal->first + i) % MQTT_CLIENT_WAL_MAX_ENTRIES];
+            if (entry->state != MQTT_CLIENT_WAL_STATE_ACKNOWLEDGED)
+            {
+                entry->offset = offset;
+                offset += (long)entry->size;
+            }
+        }
+        wal->size = new_size;
+    }
+    if (!ret)
+    {
+        mqtt_errno_set(MQTT_ERR_FILE_FAILED);
+    }
+
+    return ret;
+}
+
+#endif /* MQTT_CLIENT_WAL_ENABLED */
@@ -0,0 +1,153 @@
+/*
+Copyright(c) 2016 Cedric Jimenez
+
+This file is part of lw-mqtt.
+
+lw-mqtt is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+lw-mqtt is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MQTT_CLIENT_WAL_H
+#define MQTT_CLIENT_WAL_H
+
+#include "stdheaders.h"
+#include "mqtt_config.h"
+
+#ifdef MQTT_CLIENT_WAL_ENABLED
+
+#include <stdio.h>
+#include "mqtt.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+
+/** \brief Size in bytes of the header of a write-ahead log file */
+#define MQTT_CLIENT_WAL_FILE_HEADER_SIZE    8u
+
+/** \brief Size in bytes of the header of a record : type (1), flags (1), topic length (2), payload length (4), sequence (8) */
+#define MQTT_CLIENT_WAL_RECORD_HEADER_SIZE  16u
+
+/** \brief Size in bytes of the CRC-32 which ends a record */
+#define MQTT_CLIENT_WAL_RECORD_CRC_SIZE     4u
+
+
+/** \brief State of a message in the write-ahead log */
+typedef enum _mqtt_client_wal_state_t
+{
+    /** \brief Acknowledged, the entry is released once the older entries are released */
+    MQTT_CLIENT_WAL_STATE_ACKNOWLEDGED = 0u,
+    /** \brief Not sent on the current connection */
+    MQTT_CLIENT_WAL_STATE_PENDING = 1u,
+    /** \brief Sent on the current connection, waiting for its acknowledgement */
+    MQTT_CLIENT_WAL_STATE_SENT = 2u
+} mqtt_client_wal_state_t;
+
+/** \brief Message of the write-ahead log waiting for its acknowledgement */
+typedef struct _mqtt_client_wal_entry_t
+{
+    /** \brief Sequence number of the record */
+    uint64_t sequence;
+    /** \brief Offset of the record in the file */
+    long offset;
+    /** \brief Size in bytes of the record */
+    uint32_t size;
+    /** \brief Packet id used to send the message on the current connection */
+    uint16_t packet_id;
+    /** \brief State */
+    mqtt_client_wal_state_t state;
+} mqtt_client_wal_entry_t;
+
+/** \brief Message read back from the write-ahead log */
+typedef struct _mqtt_client_wal_message_t
+{
+    /** \brief Topic */
+    mqtt_string_t topic;
+    /** \brief Payload */
+    uint8_t* payload;
+    /** \brief Size in bytes of the payload */
+    uint32_t length;
+    /** \brief QoS */
+    uint8_t qos;
+    /** \brief Retain flag */
+    bool retain;
+} mqtt_client_wal_message_t;
+
+/** \brief Append-only write-ahead log of the QoS 1 and QoS 2 messages published by a MQTT client :
+           the message records are flushed to the kernel when they are appended, all the records are synced
+           to the disk by groups and the log is compacted once all its messages
+           are acknowledged or when the acknowledged records take more than half of it */
+typedef struct _mqtt_client_wal_t
+{
+    /** \brief File, NULL if the log is not opened */
+    FILE* file;
+    /** \brief Path of the file */
+    char path[MQTT_CLIENT_WAL_MAX_PATH_LENGTH];
+    /** \brief Size in bytes of the valid records of the file */
+    long size;
+    /** \brief Indicate if the last access to the file was a read, the file must be positioned again before writing */
+    bool reading;
+    /** \brief Sequence number of the next record */
+    uint64_t next_sequence;
+    /** \brief Number of records written since the last sync */
+    uint32_t unsynced;
+    /** \brief Messages waiting for their acknowledgement, in sequence order */
+    mqtt_client_wal_entry_t entries[MQTT_CLIENT_WAL_MAX_ENTRIES];
+    /** \brief Index of the oldest entry */
+    uint32_t first;
+    /** \brief Number of entries */
+    uint32_t count;
+    /** \brief Buffer of the file, the acknowledgement records are written by groups in a single system call */
+    char buffer[MQTT_CLIENT_WAL_BUFFER_SIZE];
+} mqtt_client_wal_t;
+
+
+/** \brief Open or create a write-ahead log and load its unacknowledged messages as pending,
+           a torn record at the end of the file is discarded */
+bool mqtt_client_wal_open(mqtt_client_wal_t* const wal, const char* const path);
+
+/** \brief Sync and close a write-ahead log */
+bool mqtt_client_wal_close(mqtt_client_wal_t* const wal);
+
+/** \brief Append a message to a write-ahead log, it survives a crash of the process once appended and a power loss after the next sync */
+bool mqtt_client_wal_append(mqtt_client_wal_t* const wal, const mqtt_const_string_t* const topic, const void* const message,
+                            const uint32_t length, const uint8_t qos, const bool retain, mqtt_client_wal_entry_t** const entry);
+
+/** \brief Release an entry of a write-ahead log once its message has been acknowledged or abandoned */
+bool mqtt_client_wal_release(mqtt_client_wal_t* const wal, mqtt_client_wal_entry_t* const entry);
+
+/** \brief Release the entry of the message sent with a packet id */
+bool mqtt_client_wal_acknowledge(mqtt_client_wal_t* const wal, const uint16_t packet_id);
+
+/** \brief Mark the sent entries as pending, must be called when a new connection starts */
+bool mqtt_client_wal_reset(mqtt_client_wal_t* const wal);
+
+/** \brief Get the oldest pending entry (NULL if none) */
+bool mqtt_client_wal_get_pending(mqtt_client_wal_t* const wal, mqtt_client_wal_entry_t** const entry);
+
+/** \brief Read back the message of an entry, the topic string and the payload buffer must be sized by the caller */
+bool mqtt_client_wal_read(mqtt_client_wal_t* const wal, const mqtt_client_wal_entry_t* const entry, mqtt_client_wal_message_t* const message);
+
+/** \brief Write the appended records to the disk in a single sync and compact the log if needed */
+bool mqtt_client_wal_sync(mqtt_client_wal_t* const wal);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* MQTT_CLIENT_WAL_ENABLED */
+
+#endif /* MQTT_CLIENT_WAL_H */
@@ -36,40 +36,307 @@ along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
 /** \brief Enable logs */
 #define MQTT_LOG_ENABLED
 
-
-
-/** \brief Maximum length in bytes of a topic string for the MQTT client */
+/** \brief Minimum level of the logs compiled in (MQTT_LOG_LEVEL_DEBUG, MQTT_LOG_LEVEL_INFO or MQTT_LOG_LEVEL_ERROR),
+           the log calls below this level are removed along with the evaluation of their arguments */
+#define MQTT_LOG_MIN_LEVEL  MQTT_LOG_LEVEL_DEBUG
+
+/** \brief Enable the asynchronous logs : the messages are formatted by the calling thread into a lock-free ring
+           and written by a background thread (requires MQTT_MULTITASKING_ENABLED, mqtt_log_deinit() writes the
+           pending messages) */
+/* #define MQTT_LOG_ASYNC_ENABLED */
+
+/** \brief Enable the packet trace recorder : the raw data of the broker connections can be recorded
+           to a file (see mqtt_broker_set_trace_recorder()) and replayed with the lw-mqtt-replay tool */
+/* #define MQTT_TRACE_ENABLED */
+
+/** \brief Enable the metrics of the MQTT client : packet and byte counters, connection events and
+           latency histograms which can be read without lock from any thread (see mqtt_client_get_metrics()) */
+/* #define MQTT_CLIENT_METRICS_ENABLED */
+
+/** \brief Enable the statistics of the MQTT broker : they are published periodically under the $SYS/broker/
+           topics (see mqtt_broker_set_sys_interval()) and can be read with mqtt_broker_get_stats() */
+/* #define MQTT_BROKER_SYS_ENABLED */
+
+/** \brief Enable the write-ahead log of the MQTT client : the QoS 1/2 published messages are appended to a file
+           before being sent and published again after a restart until they are acknowledged (see mqtt_client_open_wal()),
+           a message survives a crash of the process as soon as it is published but a power loss only once the file
+           has been synced by the group commit (see MQTT_CLIENT_WAL_COMMIT_DELAY and mqtt_client_commit_wal()) */
+/* #define MQTT_CLIENT_WAL_ENABLED */
+
+/** \brief Enable the persistent store of the MQTT broker : the persistent sessions, their subscriptions and their
+           queued messages are saved to a snapshot and to a log of changes made durable by group commit, and are
+           restored when the broker is restarted (see mqtt_broker_open_store(), it can't be opened together with
+           the disk spill) */
+/* #define MQTT_BROKER_STORE_ENABLED */
+
+/** \brief Enable the retained messages of the MQTT broker : they are kept in a memory-mapped file which is used
+           in place after a restart without being loaded (see mqtt_broker_open_retain_store()) */
+/* #define MQTT_BROKER_RETAIN_ENABLED */
+
+/** \brief Enable the disk spill of the MQTT broker : the QoS 1/2 messages which don't fit in the queue of a session
+           are written by a background thread to segment files and read back when the queue has room again
+           (requires MQTT_MULTITASKING_ENABLED, see mqtt_broker_open_spill()), the spilled messages are not kept
+           after a restart so the spill can't be opened together with the persistent store */
+/* #define MQTT_BROKER_SPILL_ENABLED */
+
+/** \brief Enable the bridge of the MQTT broker : the messages matching the configured topic filters are forwarded
+           to a remote broker and back over a single MQTT 5.0 connection, the PUBLISH packets of a loop are batched
+           in a single write and the QoS 1 messages are pipelined (see mqtt_broker_open_bridge()) */
+/* #define MQTT_BROKER_BRIDGE_ENABLED */
+
+/** \brief Enable the least-inflight selection for the shared subscriptions ($share/<group>/<filter>) of the MQTT broker :
+           each message goes to the connected member with the fewest unacknowledged and queued messages, the ties
+           and the round robin selection (if not enabled) rotate over the members of the group */
+/* #define MQTT_BROKER_SHARED_LEAST_INFLIGHT_ENABLED */
+
+/** \brief Enable the io_uring socket backend for the MQTT broker (Linux only, the broker falls back
+           to the socket poller based loop if io_uring is not available at runtime) */
+/* #define MQTT_SOCKET_IO_URING_ENABLED */
+
+/** \brief Use the coarse monotonic clock which is cheaper to read but only precise to a few ms (Linux only),
+           it is precise enough for the timers since their resolution is MQTT_TIMER_WHEEL_RESOLUTION */
+#ifdef __linux__
+#define MQTT_TIME_COARSE_CLOCK_ENABLED
+#endif /* __linux__ */
+
+
+
+/** \brief Default maximum length in bytes of a topic string for the MQTT client (see mqtt_client_config_t) */
 #define MQTT_CLIENT_MAX_TOPIC_LENGTH    512u
 
-/** \brief Maximum length in byte of the payload of a PUBLISH message for the MQTT client */
+/** \brief Default maximum length in byte of the payload of a PUBLISH message for the MQTT client (see mqtt_client_config_t) */
 #define MQTT_CLIENT_MAX_PAYLOAD_SIZE    1024u
 
+/** \brief Default maximum number of topic aliases used by the MQTT client (MQTT 5.0 only, see mqtt_client_config_t) */
+#define MQTT_CLIENT_MAX_TOPIC_ALIAS     8u
+
+/** \brief Default maximum length in bytes of an aliased topic string for the MQTT client (see mqtt_client_config_t) */
+#define MQTT_CLIENT_MAX_TOPIC_ALIAS_LENGTH  128u
+
+/** \brief Maximum length in bytes of the topic of a pre-encoded PUBLISH template */
+#define MQTT_PUBLISH_TEMPLATE_MAX_TOPIC_LENGTH      128u
+
+/** \brief Maximum size in bytes of a payload appended in place to a pre-encoded PUBLISH template,
+           bigger payloads are sent separately */
+#define MQTT_PUBLISH_TEMPLATE_MAX_INLINE_PAYLOAD    64u
+
+/** \brief Minimum size in bytes of a payload sent without copy when the zero-copy transmit mode
+           is enabled on the MQTT client, smaller payloads are cheaper to copy */
+#define MQTT_CLIENT_ZEROCOPY_THRESHOLD  10240u
+
+/** \brief Maximum number of QoS 1/2 PUBLISH and SUBSCRIBE requests whose latency is measured at the same time,
+           the requests sent while all the slots are used are only counted */
+#define MQTT_CLIENT_METRICS_MAX_REQUESTS    16u
+
+/** \brief Number of bits of the highest latency in us stored in the histograms (above it the latencies are
+           stored in the last bucket) */
+#define MQTT_CLIENT_METRICS_LATENCY_BITS    27u
+
+/** \brief Number of bits of precision of the latency histograms : each power of 2 range is split
+           in 2^bits buckets (relative error below 1 / 2^bits) */
+#define MQTT_CLIENT_METRICS_SUB_BUCKET_BITS 3u
 
+/** \brief Maximum number of unacknowledged messages in the write-ahead log of the MQTT client */
+#define MQTT_CLIENT_WAL_MAX_ENTRIES     1024u
 
-/** \brief Maximum number of topics managed by the MQTT broker */
+/** \brief Number of appended records which triggers a sync of the write-ahead log */
+#define MQTT_CLIENT_WAL_COMMIT_COUNT    256u
+
+/** \brief Maximum delay in ms between the first unsynced record and the sync of the write-ahead log, this is how long
+           the published messages can be lost on a power loss */
+#define MQTT_CLIENT_WAL_COMMIT_DELAY    10u
+
+/** \brief Size in bytes of the write-ahead log above which it is compacted once most of its messages are acknowledged */
+#define MQTT_CLIENT_WAL_COMPACT_SIZE    (1024u * 1024u)
+
+/** \brief Maximum length in bytes of the path of the write-ahead log file (including the null terminator) */
+#define MQTT_CLIENT_WAL_MAX_PATH_LENGTH 256u
+
+/** \brief Size in bytes of the write buffer of the write-ahead log */
+#define MQTT_CLIENT_WAL_BUFFER_SIZE     16384u
+
+
+
+/** \brief Default maximum number of topics managed by the MQTT broker (see mqtt_broker_config_t) */
 #define MQTT_BROKER_MAX_TOPIC_COUNT     128u
 
-/** \brief Maximum length in bytes of a topic string for the MQTT broker */
+/** \brief Default maximum length in bytes of a topic string for the MQTT broker (see mqtt_broker_config_t) */
 #define MQTT_BROKER_MAX_TOPIC_LENGTH    512u
 
-/** \brief Maximum number of subscriptions on topics for the MQTT broker **/
+/** \brief Default maximum number of subscriptions on topics for the MQTT broker (see mqtt_broker_config_t) */
 #define MQTT_BROKER_MAX_SUBSCRIPTION_COUNT  (MQTT_BROKER_MAX_TOPIC_COUNT * 4u)
 
-/** \brief Maximum length in byte of the payload of a PUBLISH message for the MQTT broker */
+/** \brief Default maximum length in byte of the payload of a PUBLISH message for the MQTT broker (see mqtt_broker_config_t) */
 #define MQTT_BROKER_MAX_PAYLOAD_SIZE    2048u
 
-/** \brief Maximum number of simultaneous clients for the MQTT broker */
+/** \brief Default maximum number of simultaneous clients for the MQTT broker (see mqtt_broker_config_t) */
 #define MQTT_BROKER_MAX_CLIENT          10u
 
-/** \brief Maximum length in bytes of a will topic string for the MQTT broker */
+/** \brief Default maximum length in bytes of a will topic string for the MQTT broker (see mqtt_broker_config_t) */
 #define MQTT_BROKER_MAX_WILL_TOPIC_LENGTH    512u
 
-/** \brief Maximum length in byte of a will message for the MQTT broker */
+/** \brief Default maximum length in byte of a will message for the MQTT broker (see mqtt_broker_config_t) */
 #define MQTT_BROKER_MAX_WILL_MESSAGE_SIZE    2048u
 
-/** \brief Maximum length in bytes of a client id string for the MQTT broker */
+/** \brief Default maximum length in bytes of a client id string for the MQTT broker (see mqtt_broker_config_t) */
 #define MQTT_BROKER_MAX_CLIENT_ID_LENGTH     32u
 
+/** \brief Maximum length in bytes of a username or a password for the MQTT broker */
+#define MQTT_BROKER_MAX_CREDENTIALS_LENGTH   64u
+
+/** \brief Default maximum number of topic aliases per client accepted by the MQTT broker (MQTT 5.0 only, see mqtt_broker_config_t) */
+#define MQTT_BROKER_MAX_TOPIC_ALIAS     8u
+
+/** \brief Default maximum number of unacknowledged QoS 1 and QoS 2 PUBLISH packets per client for the MQTT broker (MQTT 5.0 only, see mqtt_broker_config_t) */
+#define MQTT_BROKER_RECEIVE_MAXIMUM     16u
+
+/** \brief Maximum number of threads reading the subscriptions of the MQTT broker at the same time without lock */
+#define MQTT_BROKER_MAX_INDEX_READERS   4u
+
+/** \brief Maximum time in ms between the opening of a connection and the reception of its CONNECT packet for the MQTT broker */
+#define MQTT_BROKER_CONNECT_TIMEOUT     10000u
+
+/** \brief Default period in seconds of the publication of the $SYS/broker/ topics by the MQTT broker, 0 to disable */
+#define MQTT_BROKER_SYS_INTERVAL        10u
+
+/** \brief Default size in bytes of the queue of the QoS 1/2 messages waiting to be sent to each client of the MQTT broker, 0 to disable the queues (see mqtt_broker_config_t) */
+#define MQTT_BROKER_MAX_QUEUE_SIZE      16384u
+
+/** \brief Default size in bytes of the output kept by the MQTT broker for each client of an in-process link while the client
+           doesn't read its ring buffer, 0 to disable it (see mqtt_broker_config_t) */
+#define MQTT_BROKER_LOCAL_OUTPUT_SIZE   8192u
+
+/** \brief Default maximum session expiry interval in seconds granted by the MQTT broker, also used for the MQTT 3.1.1 persistent sessions,
+           0xFFFFFFFF for no limit (see mqtt_broker_config_t) */
+#define MQTT_BROKER_MAX_SESSION_EXPIRY  0xFFFFFFFFu
+
+/** \brief Maximum delay in ms between the first unsynced change and the sync of the log of the MQTT broker store */
+#define MQTT_BROKER_STORE_COMMIT_DELAY  10u
+
+/** \brief Minimum size in bytes of the log of the MQTT broker store before it is replaced by a new snapshot (the log
+           must also be as big as the previous snapshot) */
+#define MQTT_BROKER_STORE_MIN_SNAPSHOT_SIZE (4u * 1024u * 1024u)
+
+/** \brief Maximum length in bytes of the path of the MQTT broker store files without their extension (including the null terminator) */
+#define MQTT_BROKER_STORE_MAX_PATH_LENGTH   256u
+
+/** \brief Size in bytes of the write buffers of the MQTT broker store files */
+#define MQTT_BROKER_STORE_BUFFER_SIZE   32768u
+
+/** \brief Maximum delay in ms between the first retained message change and the sync of the MQTT broker retained store */
+#define MQTT_BROKER_RETAIN_SYNC_DELAY   1000u
+
+/** \brief Default maximum number of retained messages of a new MQTT broker retained store */
+#define MQTT_BROKER_RETAIN_MAX_MESSAGES 4096u
+
+/** \brief Default size in bytes of the heap of a new MQTT broker retained store */
+#define MQTT_BROKER_RETAIN_HEAP_SIZE    (4u * 1024u * 1024u)
+
+/** \brief Maximum number of retained messages checked per loop of the MQTT broker for a new wildcard subscription */
+#define MQTT_BROKER_RETAIN_SCAN_BATCH   64u
+
+/** \brief Maximum length in bytes of the path of the MQTT broker retained store file (including the null terminator) */
+#define MQTT_BROKER_RETAIN_MAX_PATH_LENGTH  256u
+
+/** \brief Default size in bytes of each of the two rings between the MQTT broker task and the spill thread (power of 2),
+           0 to disable the spill (see mqtt_broker_config_t) */
+#define MQTT_BROKER_SPILL_RING_SIZE     131072u
+
+/** \brief Size in bytes from which the MQTT broker spill starts a new segment file */
+#define MQTT_BROKER_SPILL_SEGMENT_SIZE  (16u * 1024u * 1024u)
+
+/** \brief Size in bytes of the write buffer and of the read-ahead buffer of the MQTT broker spill segments */
+#define MQTT_BROKER_SPILL_BUFFER_SIZE   65536u
+
+/** \brief Period in ms at which the MQTT broker spill thread checks for new requests when it is idle */
+#define MQTT_BROKER_SPILL_PERIOD        2u
+
+/** \brief Maximum length in bytes of the path of the MQTT broker spill segments without their number (including the null terminator) */
+#define MQTT_BROKER_SPILL_MAX_PATH_LENGTH   256u
+
+/** \brief Default size in bytes of the buffer in which the packets sent by the MQTT broker bridge in a loop are batched
+           (see mqtt_broker_config_t) */
+#define MQTT_BROKER_BRIDGE_BATCH_SIZE   65536u
+
+/** \brief Default size in bytes of the queue of the QoS 1 messages waiting to be sent or acknowledged by the remote broker
+           of the MQTT broker bridge, 0 to disable the bridge (see mqtt_broker_config_t) */
+#define MQTT_BROKER_BRIDGE_QUEUE_SIZE   262144u
+
+/** \brief Size in bytes of the buffer of the data received by the MQTT broker bridge */
+#define MQTT_BROKER_BRIDGE_RECEIVE_SIZE 16384u
+
+/** \brief Maximum number of QoS 1 messages sent by the MQTT broker bridge and not acknowledged yet, the receive maximum
+           of the remote broker is used if it is lower */
+#define MQTT_BROKER_BRIDGE_MAX_INFLIGHT 256u
+
+/** \brief Maximum number of topic rules of the MQTT broker bridge */
+#define MQTT_BROKER_BRIDGE_MAX_RULES    16u
+
+/** \brief Maximum length in bytes of the topic filter of a rule of the MQTT broker bridge */
+#define MQTT_BROKER_BRIDGE_MAX_FILTER_LENGTH    128u
+
+/** \brief Maximum length in bytes of the address of the remote broker of the MQTT broker bridge (including the null terminator) */
+#define MQTT_BROKER_BRIDGE_MAX_ADDRESS_LENGTH   108u
+
+/** \brief Maximum length in bytes of the client id of the MQTT broker bridge */
+#define MQTT_BROKER_BRIDGE_MAX_CLIENT_ID_LENGTH 64u
+
+/** \brief Keep alive in seconds of the connection of the MQTT broker bridge */
+#define MQTT_BROKER_BRIDGE_KEEPALIVE    30u
+
+/** \brief Timeout in ms of the connection of the MQTT broker bridge until the CONNACK packet is received */
+#define MQTT_BROKER_BRIDGE_CONNECT_TIMEOUT  5000u
+
+/** \brief Delay in ms before the MQTT broker bridge connects again to the remote broker after a failure */
+#define MQTT_BROKER_BRIDGE_RETRY_DELAY  2000u
+
+
+
+/** \brief Number of submission queue entries of the io_uring socket backend */
+#define MQTT_SOCKET_URING_ENTRIES               256u
+
+/** \brief Number of receive buffers registered to the kernel by the io_uring socket backend (power of 2) */
+#define MQTT_SOCKET_URING_RECV_BUFFER_COUNT     64u
+
+/** \brief Size in bytes of a receive buffer of the io_uring socket backend */
+#define MQTT_SOCKET_URING_RECV_BUFFER_SIZE      2048u
+
+/** \brief Number of send buffers of the io_uring socket backend */
+#define MQTT_SOCKET_URING_SEND_BUFFER_COUNT     256u
+
+/** \brief Size in bytes of a send buffer of the io_uring socket backend, consecutive sends
+           on the same socket are gathered in the same buffer */
+#define MQTT_SOCKET_URING_SEND_BUFFER_SIZE      4096u
+
+/** \brief Maximum number of sockets in a socket poller on the systems without epoll */
+#define MQTT_SOCKET_POLLER_MAX_SOCKETS          64u
+
+
+
+/** \brief Size in bytes of each direction of an in-process link between a client and a broker (power of 2),
+           it must be bigger than the biggest packet exchanged on the link */
+#define MQTT_RING_STREAM_SIZE       4096u
+
+
+
+/** \brief Number of messages waiting to be written in asynchronous log mode (power of 2),
+           the messages logged while it is full are dropped and counted */
+#define MQTT_LOG_ASYNC_RECORD_COUNT     256u
+
+/** \brief Maximum length in bytes of a message in asynchronous log mode, longer messages are truncated */
+#define MQTT_LOG_ASYNC_MESSAGE_SIZE     128u
+
+/** \brief Period in ms at which the background thread checks for new messages in asynchronous log mode */
+#define MQTT_LOG_ASYNC_FLUSH_PERIOD     10u
+
+
+
+/** \brief Duration in ms of a tick of the timer wheels */
+#define MQTT_TIMER_WHEEL_RESOLUTION     10u
+
+/** \brief Number of levels of the timer wheels (5 at most), each level multiplies the maximum timeout by 64 */
+#define MQTT_TIMER_WHEEL_LEVELS         4u
+
 
 
 
@@ -22,6 +22,7 @@ along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
 
 
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdarg.h>
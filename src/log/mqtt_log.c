@@ -22,13 +22,106 @@ along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
 #include "mqtt_log_output.h"
 #include "mqtt_mutex.h"
 
-/** \brief Current verbosity filter */
-static uint8_t s_current_verbosity_filter;
+#ifdef MQTT_LOG_ASYNC_ENABLED
 
-#ifdef MQTT_MULTITASKING_ENABLED
-static mqtt_mutex_t s_log_mutex;
+#ifndef MQTT_MULTITASKING_ENABLED
+#error "MQTT_LOG_ASYNC_ENABLED requires MQTT_MULTITASKING_ENABLED"
 #endif /* MQTT_MULTITASKING_ENABLED */
 
+#include <stdio.h>
+#include "mqtt_thread.h"
+
+
+#if defined(__GNUC__) || defined(__clang__)
+
+/** \brief Load a value written by another thread */
+#define MQTT_LOG_LOAD_ACQUIRE(ptr)              __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+
+/** \brief Store a value read by another thread */
+#define MQTT_LOG_STORE_RELEASE(ptr, value)      __atomic_store_n((ptr), (value), __ATOMIC_RELEASE)
+
+/** \brief Change a value if it has the expected value, updates expected with the current value otherwise */
+#define MQTT_LOG_COMPARE_EXCHANGE(ptr, expected, desired) \
+    __atomic_compare_exchange_n((ptr), &(expected), (desired), false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)
+
+/** \brief Increment a counter shared by several threads */
+#define MQTT_LOG_INCREMENT(ptr)                 (void)__atomic_add_fetch((ptr), 1u, __ATOMIC_RELAXED)
+
+#else
+
+#include <intrin.h>
+
+/** \brief Load a value written by another thread (volatile accesses have acquire semantics with MSVC) */
+#define MQTT_LOG_LOAD_ACQUIRE(ptr)              (*(ptr))
+
+/** \brief Store a value read by another thread (volatile accesses have release semantics with MSVC) */
+#define MQTT_LOG_STORE_RELEASE(ptr, value)      ((*(ptr)) = (value))
+
+/** \brief Change a value if it has the expected value, updates expected with the current value otherwise */
+#define MQTT_LOG_COMPARE_EXCHANGE(ptr, expected, desired) \
+    mqtt_log_compare_exchange((ptr), &(expected), (desired))
+
+/** \brief Increment a counter shared by several threads */
+#define MQTT_LOG_INCREMENT(ptr)                 (void)_InterlockedIncrement((volatile long*)(ptr))
+
+/** \brief Change a value if it has the expected value, updates expected with the current value otherwise */
+static bool mqtt_log_compare_exchange(volatile uint32_t* const ptr, uint32_t* const expected, const uint32_t desired);
+
+#endif /* defined(__GNUC__) || defined(__clang__) */
+
+
+/** \brief Message waiting in the asynchronous log ring */
+typedef struct _mqtt_log_record_t
+{
+    /** \brief Position at which the record can be written (position) or read (position + 1) */
+    volatile uint32_t sequence;
+    /** \brief Verbosity */
+    mqtt_log_verbosity verbosity;
+    /** \brief Formatted message */
+    char message[MQTT_LOG_ASYNC_MESSAGE_SIZE];
+} mqtt_log_record_t;
+
+/** \brief Asynchronous log ring, written by any thread and read by the log thread */
+static mqtt_log_record_t s_log_records[MQTT_LOG_ASYNC_RECORD_COUNT];
+
+/** \brief Next position to write in the ring */
+static volatile uint32_t s_log_write_position;
+
+/** \brief Next position to read in the ring, only used by the log thread */
+static uint32_t s_log_read_position;
+
+/** \brief Number of messages dropped because the ring was full */
+static volatile uint32_t s_log_dropped_count;
+
+/** \brief Number of dropped messages already reported by the log thread */
+static uint32_t s_log_reported_dropped_count;
+
+/** \brief Indicate if the log thread must keep running */
+static volatile uint32_t s_log_running;
+
+/** \brief Log thread */
+static mqtt_thread_t s_log_thread;
+
+
+/** \brief Format a message into the asynchronous log ring */
+static void mqtt_log_async_add(const mqtt_log_verbosity verbosity, const char* const message, va_list args);
+
+/** \brief Write the messages waiting in the asynchronous log ring, returns false if there was none */
+static bool mqtt_log_async_flush(void);
+
+/** \brief Log thread */
+static void mqtt_log_async_thread(void* const param);
+
+#endif /* MQTT_LOG_ASYNC_ENABLED */
+
+
+/** \brief Current verbosity filter, read by the log macros before evaluating their arguments */
+uint8_t mqtt_log_verbosity_filter;
+
+#if defined(MQTT_MULTITASKING_ENABLED) && !defined(MQTT_LOG_ASYNC_ENABLED)
+static mqtt_mutex_t s_log_mutex;
+#endif /* defined(MQTT_MULTITASKING_ENABLED) && !defined(MQTT_LOG_ASYNC_ENABLED) */
+
 
 /** \brief Initialize the MQTT log module */
 bool mqtt_log_init(void)
@@ -36,13 +129,28 @@ bool mqtt_log_init(void)
     bool ret = true;
 
     /* Default verbosity filter = INFO + ERROR */
-    s_current_verbosity_filter = (uint8_t)(MQTT_LOG_LVL_INFO) | (uint8_t)(MQTT_LOG_LVL_ERROR);
+    mqtt_log_verbosity_filter = (uint8_t)(MQTT_LOG_LVL_INFO) | (uint8_t)(MQTT_LOG_LVL_ERROR);
 
 
-    #ifdef MQTT_MULTITASKING_ENABLED
+    #ifdef MQTT_LOG_ASYNC_ENABLED
+    {
+        /* Initialize the ring and start the log thread */
+        uint32_t i;
+        for (i = 0u; i < MQTT_LOG_ASYNC_RECORD_COUNT; i++)
+        {
+            s_log_records[i].sequence = i;
+        }
+        s_log_write_position = 0u;
+        s_log_read_position = 0u;
+        s_log_dropped_count = 0u;
+        s_log_reported_dropped_count = 0u;
+        s_log_running = 1u;
+        ret = mqtt_thread_create(&s_log_thread, mqtt_log_async_thread, NULL);
+    }
+    #elif defined(MQTT_MULTITASKING_ENABLED)
     /* Initialize log mutex */
     ret = mqtt_mutex_create(&s_log_mutex);
-    #endif /* MQTT_MULTITASKING_ENABLED */
+    #endif /* MQTT_LOG_ASYNC_ENABLED */
 
     return ret;
 }
@@ -52,10 +160,14 @@ bool mqtt_log_deinit(void)
 {
     bool ret = true;
 
-    #ifdef MQTT_MULTITASKING_ENABLED
+    #ifdef MQTT_LOG_ASYNC_ENABLED
+    /* Stop the log thread once it has written the pending messages */
+    MQTT_LOG_STORE_RELEASE(&s_log_running, 0u);
+    ret = mqtt_thread_join(&s_log_thread);
+    #elif defined(MQTT_MULTITASKING_ENABLED)
     /* Release log mutex */
     ret = mqtt_mutex_delete(&s_log_mutex);
-    #endif /* MQTT_MULTITASKING_ENABLED */
+    #endif /* MQTT_LOG_ASYNC_ENABLED */
 
     return ret;
 }
@@ -77,8 +189,15 @@ void mqtt_log_vadd(const mqtt_log_verbosity verbosity, const char* const message
     if (message != NULL)
     {
         /* Filter message */
-        if (((uint8_t)(verbosity)& s_current_verbosity_filter) != 0u)
+        if (((uint8_t)(verbosity)& mqtt_log_verbosity_filter) != 0u)
         {
+            #ifdef MQTT_LOG_ASYNC_ENABLED
+
+            /* Queue message, it will be output by the log thread */
+            mqtt_log_async_add(verbosity, message, args);
+
+            #else
+
             #ifdef MQTT_MULTITASKING_ENABLED
             (void)mqtt_mutex_lock(&s_log_mutex);
             #endif /* MQTT_MULTITASKING_ENABLED */
@@ -89,6 +208,8 @@ void mqtt_log_vadd(const mqtt_log_verbosity verbosity, const char* const message
             #ifdef MQTT_MULTITASKING_ENABLED
             (void)mqtt_mutex_unlock(&s_log_mutex);
             #endif /* MQTT_MULTITASKING_ENABLED */
+
+            #endif /* MQTT_LOG_ASYNC_ENABLED */
         }
     }
 }
@@ -97,7 +218,26 @@ void mqtt_log_vadd(const mqtt_log_verbosity verbosity, const char* const message
 void mqtt_log_set_filter(const uint8_t filter)
 {
     /* No need for a mutex here because uint8_t access is atomic on all platforms */
-    s_current_verbosity_filter = filter;
+    mqtt_log_verbosity_filter = filter;
+}
+
+/** \brief Get the number of messages dropped because the asynchronous log ring was full */
+bool mqtt_log_get_dropped_count(uint32_t* const dropped_count)
+{
+    bool ret = false;
+
+    /* Check params */
+    if (dropped_count != NULL)
+    {
+        #ifdef MQTT_LOG_ASYNC_ENABLED
+        (*dropped_count) = MQTT_LOG_LOAD_ACQUIRE(&s_log_dropped_count);
+        #else
+        (*dropped_count) = 0u;
+        #endif /* MQTT_LOG_ASYNC_ENABLED */
+        ret = true;
+    }
+
+    return ret;
 }
 
 /** \brief Convert a log verbosity level into a string */
@@ -132,3 +272,135 @@ bool mqtt_log_level_to_string(const mqtt_log_verbosity verbosity, char* const de
 
     return ret;
 }
+
+
+
+#ifdef MQTT_LOG_ASYNC_ENABLED
+
+/** \brief Format a message into the asynchronous log ring */
+static void mqtt_log_async_add(const mqtt_log_verbosity verbosity, const char* const message, va_list args)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    /* Reserve a record : each record has a sequence number telling if it is free for the current
+       lap of the writers, the writers only compete on the write position (bounded MPMC queue) */
+    mqtt_log_record_t* record = NULL;
+    uint32_t position = MQTT_LOG_LOAD_ACQUIRE(&s_log_write_position);
+    bool full = false;
+    while ((record == NULL) && !full)
+    {
+        mqtt_log_record_t* const candidate = &s_log_records[position & (MQTT_LOG_ASYNC_RECORD_COUNT - 1u)];
+        const int32_t lap = (int32_t)(MQTT_LOG_LOAD_ACQUIRE(&candidate->sequence) - position);
+        if (lap == 0)
+        {
+            if (MQTT_LOG_COMPARE_EXCHANGE(&s_log_write_position, position, position + 1u))
+            {
+                record = candidate;
+            }
+        }
+        else if (lap < 0)
+        {
+            /* The record has not been read yet */
+            full = true;
+        }
+        else
+        {
+            /* Another writer took this record */
+            position = MQTT_LOG_LOAD_ACQUIRE(&s_log_write_position);
+        }
+    }
+
+    if (record != NULL)
+    {
+        /* Format message and hand it over to the log thread */
+        record->verbosity = verbosity;
+        (void)vsnprintf(record->message, sizeof(record->message), message, args);
+        MQTT_LOG_STORE_RELEASE(&record->sequence, position + 1u);
+    }
+    else
+    {
+        /* Drop message */
+        MQTT_LOG_INCREMENT(&s_log_dropped_count);
+    }
+}
+
+/** \brief Write the messages waiting in the asynchronous log ring, returns false if there was none */
+static bool mqtt_log_async_flush(void)
+{
+    bool ret = false;
+    bool empty = false;
+    const uint32_t dropped_count = MQTT_LOG_LOAD_ACQUIRE(&s_log_dropped_count);
+
+    /* Report the dropped messages */
+    if (dropped_count != s_log_reported_dropped_count)
+    {
+        char drop_message[64];
+        (void)snprintf(drop_message, sizeof(drop_message), "%u log message(s) dropped",
+                       (unsigned int)(dropped_count - s_log_reported_dropped_count));
+        mqtt_log_output_string(MQTT_LOG_LVL_ERROR, drop_message);
+        s_log_reported_dropped_count = dropped_count;
+        ret = true;
+    }
+
+    /* Output the messages in order */
+    while (!empty)
+    {
+        mqtt_log_record_t* const record = &s_log_records[s_log_read_position & (MQTT_LOG_ASYNC_RECORD_COUNT - 1u)];
+        if (MQTT_LOG_LOAD_ACQUIRE(&record->sequence) == (s_log_read_position + 1u))
+        {
+            mqtt_log_output_string(record->verbosity, record->message);
+            MQTT_LOG_STORE_RELEASE(&record->sequence, s_log_read_position + MQTT_LOG_ASYNC_RECORD_COUNT);
+            s_log_read_position++;
+            ret = true;
+        }
+        else
+        {
+            empty = true;
+        }
+    }
+
+    return ret;
+}
+
+/** \brief Log thread */
+static void mqtt_log_async_thread(void* const param)
+{
+    (void)param;
+
+    while (MQTT_LOG_LOAD_ACQUIRE(&s_log_running) != 0u)
+    {
+        if (!mqtt_log_async_flush())
+        {
+            (void)mqtt_thread_sleep(MQTT_LOG_ASYNC_FLUSH_PERIOD);
+        }
+    }
+
+    /* Last messages */
+    (void)mqtt_log_async_flush();
+}
+
+#if !defined(__GNUC__) && !defined(__clang__)
+
+/** \brief Change a value if it has the expected value, updates expected with the current value otherwise */
+static bool mqtt_log_compare_exchange(volatile uint32_t* const ptr, uint32_t* const expected, const uint32_t desired)
+{
+    bool ret = false;
+    const uint32_t previous = (uint32_t)_InterlockedCompareExchange((volatile long*)ptr, (long)desired, (long)(*expected));
+    if (previous == (*expected))
+    {
+        ret = true;
+    }
+    else
+    {
+        (*expected) = previous;
+    }
+
+    return ret;
+}
+
+#endif /* !defined(__GNUC__) && !defined(__clang__) */
+
+#endif /* MQTT_LOG_ASYNC_ENABLED */
@@ -23,27 +23,56 @@ along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
 #include "stdheaders.h"
 #include "mqtt_config.h"
 
+
+/** \brief Debug log level for MQTT_LOG_MIN_LEVEL */
+#define MQTT_LOG_LEVEL_DEBUG    1u
+
+/** \brief Info log level for MQTT_LOG_MIN_LEVEL */
+#define MQTT_LOG_LEVEL_INFO     2u
+
+/** \brief Error log level for MQTT_LOG_MIN_LEVEL */
+#define MQTT_LOG_LEVEL_ERROR    4u
+
+
 #ifndef MQTT_LOG_ENABLED
 
 /** \brief Macro to log a debug string */
-#define MQTT_LOG_DEBUG(msg, ...)
+#define MQTT_LOG_DEBUG(...)
 
 /** \brief Macro to log an info string */
-#define MQTT_LOG_INFO(msg, ...)
+#define MQTT_LOG_INFO(...)
 
 /** \brief Macro to log an error string */
-#define MQTT_LOG_ERROR(msg, ...)
+#define MQTT_LOG_ERROR(...)
 
 #else /* MQTT_LOG_ENABLED */
 
+/** \brief Check the runtime filter, the arguments of a log call are only evaluated if it passes */
+#define MQTT_LOG_IS_ENABLED(verbosity)  ((((uint8_t)(verbosity)) & mqtt_log_verbosity_filter) != 0u)
+
+#if (MQTT_LOG_MIN_LEVEL <= MQTT_LOG_LEVEL_DEBUG)
 /** \brief Macro to log a debug string */
-#define MQTT_LOG_DEBUG(msg, ...) mqtt_log_add(MQTT_LOG_LVL_DEBUG, (msg), __VA_ARGS__)
+#define MQTT_LOG_DEBUG(...) do { if (MQTT_LOG_IS_ENABLED(MQTT_LOG_LVL_DEBUG)) { mqtt_log_add(MQTT_LOG_LVL_DEBUG, __VA_ARGS__); } } while (false)
+#else
+/** \brief Macro to log a debug string (removed at compile time) */
+#define MQTT_LOG_DEBUG(...)
+#endif /* (MQTT_LOG_MIN_LEVEL <= MQTT_LOG_LEVEL_DEBUG) */
 
+#if (MQTT_LOG_MIN_LEVEL <= MQTT_LOG_LEVEL_INFO)
 /** \brief Macro to log an info string */
-#define MQTT_LOG_INFO(msg, ...) mqtt_log_add(MQTT_LOG_LVL_INFO, (msg), __VA_ARGS__)
+#define MQTT_LOG_INFO(...) do { if (MQTT_LOG_IS_ENABLED(MQTT_LOG_LVL_INFO)) { mqtt_log_add(MQTT_LOG_LVL_INFO, __VA_ARGS__); } } while (false)
+#else
+/** \brief Macro to log an info string (removed at compile time) */
+#define MQTT_LOG_INFO(...)
+#endif /* (MQTT_LOG_MIN_LEVEL <= MQTT_LOG_LEVEL_INFO) */
 
+#if (MQTT_LOG_MIN_LEVEL <= MQTT_LOG_LEVEL_ERROR)
 /** \brief Macro to log an error string */
-#define MQTT_LOG_ERROR(msg, ...) mqtt_log_add(MQTT_LOG_LVL_ERROR, (msg), __VA_ARGS__)
+#define MQTT_LOG_ERROR(...) do { if (MQTT_LOG_IS_ENABLED(MQTT_LOG_LVL_ERROR)) { mqtt_log_add(MQTT_LOG_LVL_ERROR, __VA_ARGS__); } } while (false)
+#else
+/** \brief Macro to log an error string (removed at compile time) */
+#define MQTT_LOG_ERROR(...)
+#endif /* (MQTT_LOG_MIN_LEVEL <= MQTT_LOG_LEVEL_ERROR) */
 
 
 #ifdef __cplusplus
@@ -61,6 +90,10 @@ typedef enum _mqtt_log_verbosity
 } mqtt_log_verbosity;
 
 
+/** \brief Current verbosity filter, read by the log macros before evaluating their arguments */
+extern uint8_t mqtt_log_verbosity_filter;
+
+
 /** \brief Initialize the MQTT log module */
 bool mqtt_log_init(void);
 
@@ -76,6 +109,9 @@ void mqtt_log_vadd(const mqtt_log_verbosity verbosity, const char* const message
 /** \brief Set the current log filter */
 void mqtt_log_set_filter(const uint8_t filter);
 
+/** \brief Get the number of messages dropped because the asynchronous log ring was full */
+bool mqtt_log_get_dropped_count(uint32_t* const dropped_count);
+
 /** \brief Convert a log verbosity level into a string */
 bool mqtt_log_level_to_string(const mqtt_log_verbosity verbosity, char* const dest_string, const size_t dest_string_size);
 
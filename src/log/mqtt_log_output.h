@@ -31,6 +31,9 @@ extern "C"
 /** \brief Output a log message */
 void mqtt_log_output_message(const mqtt_log_verbosity verbosity, const char* const message, va_list args);
 
+/** \brief Output an already formatted log message */
+void mqtt_log_output_string(const mqtt_log_verbosity verbosity, const char* const string);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -37,3 +37,17 @@ void mqtt_log_output_message(const mqtt_log_verbosity verbosity, const char* con
     vprintf(message, args);
     printf("\n");
 }
+
+/** \brief Output an already formatted log message */
+void mqtt_log_output_string(const mqtt_log_verbosity verbosity, const char* const string)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    char verbosity_string[32];
+    (void)mqtt_log_level_to_string(verbosity, verbosity_string, sizeof(verbosity_string));
+
+    printf("[%s]:%s\n", verbosity_string, string);
+}
@@ -41,6 +41,19 @@ along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
 
 #endif /* MQTT_CFG_CPU_TYPE_BE */
 
+#ifdef MQTT_CFG_CPU_TYPE_BE
+
+/** \brief Create a big endian uint32_t from an uint32_t value */
+#define MQTT_BIG_ENDIAN_UINT32(value) (value)
+
+#else /* MQTT_CFG_CPU_TYPE_BE */
+
+/** \brief Create a big endian uint32_t from an uint32_t value */
+#define MQTT_BIG_ENDIAN_UINT32(value) ((uint32_t)((((value) >> 24u) & 0x000000FFu) | (((value) >> 8u) & 0x0000FF00u) | \
+                                                  (((value) << 8u) & 0x00FF0000u) | (((value) << 24u) & 0xFF000000u)))
+
+#endif /* MQTT_CFG_CPU_TYPE_BE */
+
 /* Check config CPU type */
 #ifndef MQTT_CFG_CPU_TYPE_BE
 #ifndef MQTT_CFG_CPU_TYPE_LE
@@ -143,8 +156,26 @@ along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
 /** \brief MQTT Protocol name size */
 #define MQTT_PROTOCOL_NAME_SIZE 6u
 
-/** \brief MQTT Protocol level */
-#define MQTT_PROTOCOL_LEVEL 4u
+/** \brief MQTT Protocol level for the 3.1.1 version */
+#define MQTT_PROTOCOL_LEVEL_V311 4u
+
+/** \brief MQTT Protocol level for the 5.0 version */
+#define MQTT_PROTOCOL_LEVEL_V5 5u
+
+/** \brief Default MQTT Protocol level */
+#define MQTT_PROTOCOL_LEVEL MQTT_PROTOCOL_LEVEL_V311
+
+
+/** \brief Maximum value of a variable byte integer => 4 bytes encoding : 268 435 455 */
+#define MQTT_MAXIMUM_VARIABLE_INTEGER 0x0FFFFFFFu
+
+/** \brief Maximum size in bytes of an encoded variable byte integer */
+#define MQTT_MAXIMUM_VARIABLE_INTEGER_SIZE 4u
+
+/** \brief Maximum size of a packet as defined by the MQTT specification
+           => 1 (packet type) + 4 (remaining length) + 268 435 455 (remaining bytes)
+*/
+#define MQTT_MAXIMUM_PACKET_SIZE (1u + MQTT_MAXIMUM_VARIABLE_INTEGER_SIZE + MQTT_MAXIMUM_VARIABLE_INTEGER)
 
 
 
@@ -247,7 +278,7 @@ typedef enum _mqtt_connect_packet_flags
     MQTT_CONNECT_FLAG_WILL_RETAIN = (1u << 5u),
     MQTT_CONNECT_FLAG_WILL_QOS = (3u << 3u),
     MQTT_CONNECT_FLAG_WILL_QOS_POSITION = 3u,
-    MQTT_CONNECT_FLAG_WILL_FLAG = (3u << 2u),
+    MQTT_CONNECT_FLAG_WILL_FLAG = (1u << 2u),
     MQTT_CONNECT_FLAG_CLEAN_SESSION = (1u << 1u)
 
 } mqtt_connect_packet_flags;
@@ -274,6 +305,142 @@ typedef enum _mqtt_publish_packet_flags
 
 } _mqtt_publish_packet_flags;
 
+/** \brief MQTT 5.0 SUBSCRIBE options */
+typedef enum _mqtt_subscribe_options
+{
+    MQTT_SUBSCRIBE_OPTION_QOS = (3u << 0u),
+    MQTT_SUBSCRIBE_OPTION_NO_LOCAL = (1u << 2u),
+    MQTT_SUBSCRIBE_OPTION_RETAIN_AS_PUBLISHED = (1u << 3u),
+    MQTT_SUBSCRIBE_OPTION_RETAIN_HANDLING = (3u << 4u)
+
+} mqtt_subscribe_options;
+
+
+/** \brief MQTT 5.0 reason codes */
+typedef enum _mqtt_reason_code_t
+{
+    MQTT_REASON_SUCCESS = 0x00u,
+    MQTT_REASON_GRANTED_QOS_1 = 0x01u,
+    MQTT_REASON_GRANTED_QOS_2 = 0x02u,
+    MQTT_REASON_NO_MATCHING_SUBSCRIBERS = 0x10u,
+    MQTT_REASON_NO_SUBSCRIPTION_EXISTED = 0x11u,
+    MQTT_REASON_UNSPECIFIED_ERROR = 0x80u,
+    MQTT_REASON_MALFORMED_PACKET = 0x81u,
+    MQTT_REASON_PROTOCOL_ERROR = 0x82u,
+    MQTT_REASON_IMPLEMENTATION_SPECIFIC_ERROR = 0x83u,
+    MQTT_REASON_UNSUPPORTED_PROTOCOL_VERSION = 0x84u,
+    MQTT_REASON_CLIENT_ID_NOT_VALID = 0x85u,
+    MQTT_REASON_BAD_USERNAME_OR_PASSWORD = 0x86u,
+    MQTT_REASON_NOT_AUTHORIZED = 0x87u,
+    MQTT_REASON_SERVER_UNAVAILABLE = 0x88u,
+    MQTT_REASON_KEEPALIVE_TIMEOUT = 0x8Du,
+    MQTT_REASON_TOPIC_FILTER_INVALID = 0x8Fu,
+    MQTT_REASON_TOPIC_NAME_INVALID = 0x90u,
+    MQTT_REASON_PACKET_ID_IN_USE = 0x91u,
+    MQTT_REASON_RECEIVE_MAXIMUM_EXCEEDED = 0x93u,
+    MQTT_REASON_TOPIC_ALIAS_INVALID = 0x94u,
+    MQTT_REASON_PACKET_TOO_LARGE = 0x95u,
+    MQTT_REASON_QUOTA_EXCEEDED = 0x97u
+} mqtt_reason_code_t;
+
+/** \brief MQTT 5.0 property identifiers */
+typedef enum _mqtt_property_id_t
+{
+    MQTT_PROP_PAYLOAD_FORMAT_INDICATOR = 0x01u,
+    MQTT_PROP_MESSAGE_EXPIRY_INTERVAL = 0x02u,
+    MQTT_PROP_CONTENT_TYPE = 0x03u,
+    MQTT_PROP_RESPONSE_TOPIC = 0x08u,
+    MQTT_PROP_CORRELATION_DATA = 0x09u,
+    MQTT_PROP_SUBSCRIPTION_IDENTIFIER = 0x0Bu,
+    MQTT_PROP_SESSION_EXPIRY_INTERVAL = 0x11u,
+    MQTT_PROP_ASSIGNED_CLIENT_IDENTIFIER = 0x12u,
+    MQTT_PROP_SERVER_KEEP_ALIVE = 0x13u,
+    MQTT_PROP_AUTHENTICATION_METHOD = 0x15u,
+    MQTT_PROP_AUTHENTICATION_DATA = 0x16u,
+    MQTT_PROP_REQUEST_PROBLEM_INFORMATION = 0x17u,
+    MQTT_PROP_WILL_DELAY_INTERVAL = 0x18u,
+    MQTT_PROP_REQUEST_RESPONSE_INFORMATION = 0x19u,
+    MQTT_PROP_RESPONSE_INFORMATION = 0x1Au,
+    MQTT_PROP_SERVER_REFERENCE = 0x1Cu,
+    MQTT_PROP_REASON_STRING = 0x1Fu,
+    MQTT_PROP_RECEIVE_MAXIMUM = 0x21u,
+    MQTT_PROP_TOPIC_ALIAS_MAXIMUM = 0x22u,
+    MQTT_PROP_TOPIC_ALIAS = 0x23u,
+    MQTT_PROP_MAXIMUM_QOS = 0x24u,
+    MQTT_PROP_RETAIN_AVAILABLE = 0x25u,
+    MQTT_PROP_USER_PROPERTY = 0x26u,
+    MQTT_PROP_MAXIMUM_PACKET_SIZE = 0x27u,
+    MQTT_PROP_WILDCARD_SUBSCRIPTION_AVAILABLE = 0x28u,
+    MQTT_PROP_SUBSCRIPTION_IDENTIFIER_AVAILABLE = 0x29u,
+    MQTT_PROP_SHARED_SUBSCRIPTION_AVAILABLE = 0x2Au
+} mqtt_property_id_t;
+
+/** \brief Flags indicating which properties are present in a mqtt_properties_t structure */
+typedef enum _mqtt_property_flags_t
+{
+    MQTT_PROP_FLAG_PAYLOAD_FORMAT_INDICATOR = (1u << 0u),
+    MQTT_PROP_FLAG_MESSAGE_EXPIRY_INTERVAL = (1u << 1u),
+    MQTT_PROP_FLAG_SUBSCRIPTION_IDENTIFIER = (1u << 2u),
+    MQTT_PROP_FLAG_SESSION_EXPIRY_INTERVAL = (1u << 3u),
+    MQTT_PROP_FLAG_SERVER_KEEP_ALIVE = (1u << 4u),
+    MQTT_PROP_FLAG_REQUEST_PROBLEM_INFORMATION = (1u << 5u),
+    MQTT_PROP_FLAG_WILL_DELAY_INTERVAL = (1u << 6u),
+    MQTT_PROP_FLAG_REQUEST_RESPONSE_INFORMATION = (1u << 7u),
+    MQTT_PROP_FLAG_RECEIVE_MAXIMUM = (1u << 8u),
+    MQTT_PROP_FLAG_TOPIC_ALIAS_MAXIMUM = (1u << 9u),
+    MQTT_PROP_FLAG_TOPIC_ALIAS = (1u << 10u),
+    MQTT_PROP_FLAG_MAXIMUM_QOS = (1u << 11u),
+    MQTT_PROP_FLAG_RETAIN_AVAILABLE = (1u << 12u),
+    MQTT_PROP_FLAG_MAXIMUM_PACKET_SIZE = (1u << 13u),
+    MQTT_PROP_FLAG_WILDCARD_SUBSCRIPTION_AVAILABLE = (1u << 14u),
+    MQTT_PROP_FLAG_SUBSCRIPTION_IDENTIFIER_AVAILABLE = (1u << 15u),
+    MQTT_PROP_FLAG_SHARED_SUBSCRIPTION_AVAILABLE = (1u << 16u)
+} mqtt_property_flags_t;
+
+/** \brief MQTT 5.0 properties
+           Only the properties with a scalar value are stored, the string and binary 
+           properties are skipped on reception and never sent
+*/
+typedef struct _mqtt_properties_t
+{
+    /** \brief Present properties (combination of mqtt_property_flags_t values) */
+    uint32_t present;
+    /** \brief Message expiry interval in s */
+    uint32_t message_expiry_interval;
+    /** \brief Subscription identifier */
+    uint32_t subscription_identifier;
+    /** \brief Session expiry interval in s */
+    uint32_t session_expiry_interval;
+    /** \brief Will delay interval in s */
+    uint32_t will_delay_interval;
+    /** \brief Maximum packet size in bytes */
+    uint32_t maximum_packet_size;
+    /** \brief Server keepalive in s */
+    uint16_t server_keep_alive;
+    /** \brief Receive maximum */
+    uint16_t receive_maximum;
+    /** \brief Topic alias maximum */
+    uint16_t topic_alias_maximum;
+    /** \brief Topic alias */
+    uint16_t topic_alias;
+    /** \brief Payload format indicator */
+    uint8_t payload_format_indicator;
+    /** \brief Request problem information */
+    uint8_t request_problem_information;
+    /** \brief Request response information */
+    uint8_t request_response_information;
+    /** \brief Maximum QoS */
+    uint8_t maximum_qos;
+    /** \brief Retain available */
+    uint8_t retain_available;
+    /** \brief Wildcard subscription available */
+    uint8_t wildcard_subscription_available;
+    /** \brief Subscription identifier available */
+    uint8_t subscription_identifier_available;
+    /** \brief Shared subscription available */
+    uint8_t shared_subscription_available;
+} mqtt_properties_t;
+
 
 
 
@@ -0,0 +1,111 @@
+/*
+Copyright(c) 2016 Cedric Jimenez
+
+This file is part of lw-mqtt.
+
+lw-mqtt is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+lw-mqtt is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "mqtt_arena.h"
+#include "mqtt_error.h"
+
+
+/** \brief Initialize an arena on a memory area aligned on MQTT_ARENA_ALIGNMENT bytes */
+bool mqtt_arena_init(mqtt_arena_t* const arena, void* const data, const size_t size)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((arena != NULL) &&
+        (((uintptr_t)data % MQTT_ARENA_ALIGNMENT) == 0u))
+    {
+        arena->data = (uint8_t*)data;
+        arena->size = ((data != NULL) ? size : SIZE_MAX);
+        arena->used = 0u;
+        arena->overflow = false;
+        ret = true;
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Carve a block of count elements of size bytes from an arena, returns NULL if it doesn't fit */
+void* mqtt_arena_alloc(mqtt_arena_t* const arena, const size_t count, const size_t size)
+{
+    void* block = NULL;
+
+    /* Check params */
+    if (arena != NULL)
+    {
+        /* The blocks start on an aligned offset since the memory area is aligned */
+        const size_t padding = ((MQTT_ARENA_ALIGNMENT - (arena->used % MQTT_ARENA_ALIGNMENT)) % MQTT_ARENA_ALIGNMENT);
+        const size_t left = ((arena->size > arena->used) ? (arena->size - arena->used) : 0u);
+
+        if (arena->overflow ||
+            ((size != 0u) && (count > (SIZE_MAX / size))) ||
+            (padding > left) ||
+            ((count * size) > (left - padding)))
+        {
+            arena->overflow = true;
+        }
+        else
+        {
+            if (arena->data != NULL)
+            {
+                block = &arena->data[arena->used + padding];
+            }
+            arena->used += padding + (count * size);
+        }
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return block;
+}
+
+/** \brief Get the number of bytes carved from an arena, fails if one of the allocations didn't fit */
+bool mqtt_arena_get_used(const mqtt_arena_t* const arena, size_t* const used)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((arena != NULL) &&
+        (used != NULL))
+    {
+        if (!arena->overflow)
+        {
+            (*used) = arena->used;
+            ret = true;
+        }
+        else
+        {
+            mqtt_errno_set(MQTT_ERR_BUFFER_TOO_SMALL);
+        }
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
@@ -0,0 +1,64 @@
+/*
+Copyright(c) 2016 Cedric Jimenez
+
+This file is part of lw-mqtt.
+
+lw-mqtt is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+lw-mqtt is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MQTT_ARENA_H
+#define MQTT_ARENA_H
+
+#include "stdheaders.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+
+/** \brief Alignment in bytes of the memory area of an arena and of the blocks carved from it */
+#define MQTT_ARENA_ALIGNMENT    8u
+
+
+/** \brief Memory arena from which the tables and the buffers sized at runtime are carved, the blocks are never released */
+typedef struct _mqtt_arena_t
+{
+    /** \brief Memory area, NULL if the arena is only used to compute the size needed by a sequence of allocations */
+    uint8_t* data;
+    /** \brief Size in bytes of the memory area */
+    size_t size;
+    /** \brief Number of bytes already carved, including the alignment padding */
+    size_t used;
+    /** \brief Indicate if an allocation didn't fit in the memory area or if its size overflowed */
+    bool overflow;
+} mqtt_arena_t;
+
+
+/** \brief Initialize an arena on a memory area aligned on MQTT_ARENA_ALIGNMENT bytes
+           => with a NULL memory area, the allocations always return NULL and only the needed size is computed */
+bool mqtt_arena_init(mqtt_arena_t* const arena, void* const data, const size_t size);
+
+/** \brief Carve a block of count elements of size bytes from an arena, returns NULL if it doesn't fit */
+void* mqtt_arena_alloc(mqtt_arena_t* const arena, const size_t count, const size_t size);
+
+/** \brief Get the number of bytes carved from an arena, fails if one of the allocations didn't fit */
+bool mqtt_arena_get_used(const mqtt_arena_t* const arena, size_t* const used);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* MQTT_ARENA_H */
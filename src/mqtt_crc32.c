@@ -0,0 +1,45 @@
+/*
+Copyright(c) 2016 Cedric Jimenez
+
+This file is part of lw-mqtt.
+
+lw-mqtt is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+lw-mqtt is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "mqtt_crc32.h"
+
+
+/** \brief CRC-32 of each nibble value, a nibble table keeps the footprint small */
+static const uint32_t s_mqtt_crc32_table[16u] = { 0x00000000u, 0x1DB71064u, 0x3B6E20C8u, 0x26D930ACu,
+                                                  0x76DC4190u, 0x6B6B51F4u, 0x4DB26158u, 0x5005713Cu,
+                                                  0xEDB88320u, 0xF00F9344u, 0xD6D6A3E8u, 0xCB61B38Cu,
+                                                  0x9B64C2B0u, 0x86D3D2D4u, 0xA00AE278u, 0xBDBDF21Cu };
+
+
+/** \brief Update a CRC-32 (IEEE 802.3, reflected polynom 0xEDB88320) with data, the final value is the complement of the result */
+uint32_t mqtt_crc32_update(uint32_t crc, const void* const data, const size_t size)
+{
+    size_t i;
+    const uint8_t* const bytes = (const uint8_t*)data;
+
+    /* No null-pointer test : an empty buffer leaves the CRC unchanged */
+    for (i = 0u; i < size; i++)
+    {
+        crc ^= bytes[i];
+        crc = (crc >> 4u) ^ s_mqtt_crc32_table[crc & 0x0Fu];
+        crc = (crc >> 4u) ^ s_mqtt_crc32_table[crc & 0x0Fu];
+    }
+
+    return crc;
+}
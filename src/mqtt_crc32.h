@@ -0,0 +1,43 @@
+/*
+Copyright(c) 2016 Cedric Jimenez
+
+This file is part of lw-mqtt.
+
+lw-mqtt is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+lw-mqtt is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MQTT_CRC32_H
+#define MQTT_CRC32_H
+
+#include "stdheaders.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+
+/** \brief Initial value of a CRC-32 computation */
+#define MQTT_CRC32_INIT     0xFFFFFFFFu
+
+
+/** \brief Update a CRC-32 (IEEE 802.3, reflected polynom 0xEDB88320) with data, the final value is the complement of the result */
+uint32_t mqtt_crc32_update(uint32_t crc, const void* const data, const size_t size);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* MQTT_CRC32_H */
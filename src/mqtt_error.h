@@ -70,4 +70,16 @@ along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
 /** \brief Invalid MQTT broker state */
 #define MQTT_ERR_BROKER_INVALID_STATE       -15
 
+/** \brief Invalid or unsupported MQTT 5.0 property */
+#define MQTT_ERR_INVALID_PROPERTY           -16
+
+/** \brief Peer's receive maximum has been reached */
+#define MQTT_ERR_FLOW_CONTROL               -17
+
+/** \brief Packet exceeds the peer's maximum packet size */
+#define MQTT_ERR_PACKET_TOO_LARGE           -18
+
+/** \brief File operation failed */
+#define MQTT_ERR_FILE_FAILED                -19
+
 #endif /* MQTT_ERROR_H */
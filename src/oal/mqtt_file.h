@@ -0,0 +1,58 @@
+/*
+Copyright(c) 2016 Cedric Jimenez
+
+This file is part of lw-mqtt.
+
+lw-mqtt is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+lw-mqtt is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MQTT_FILE_H
+#define MQTT_FILE_H
+
+#include "stdheaders.h"
+#include "mqtt_file_t.h"
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+
+/** \brief Write the buffered data of a file and wait until it is stored on the disk */
+bool mqtt_file_sync(FILE* const file);
+
+/** \brief Change the size of a file, its buffered data must have been written */
+bool mqtt_file_truncate(FILE* const file, const long size);
+
+/** \brief Replace a file by another one in a single step, the replaced file is either kept or fully replaced after a crash */
+bool mqtt_file_replace(const char* const path, const char* const replaced_path);
+
+/** \brief Map a file in memory for reading and writing, a new file is created with the given size and filled with zeros,
+           an existing file is mapped with its own size */
+bool mqtt_file_map_open(mqtt_file_map_t* const map, const char* const path, const size_t size, bool* const created);
+
+/** \brief Wait until the modified data of a mapped file is stored on the disk */
+bool mqtt_file_map_sync(mqtt_file_map_t* const map);
+
+/** \brief Unmap a file */
+bool mqtt_file_map_close(mqtt_file_map_t* const map);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+
+#endif /* MQTT_FILE_H */
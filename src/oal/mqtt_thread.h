@@ -0,0 +1,47 @@
+/*
+Copyright(c) 2016 Cedric Jimenez
+
+This file is part of lw-mqtt.
+
+lw-mqtt is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+lw-mqtt is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MQTT_THREAD_H
+#define MQTT_THREAD_H
+
+#include "stdheaders.h"
+#include "mqtt_thread_t.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+
+/** \brief Create a MQTT thread which runs the given function */
+bool mqtt_thread_create(mqtt_thread_t* const mqtt_thread, const fp_mqtt_thread_func_t func, void* const param);
+
+/** \brief Wait for the end of a MQTT thread and release it */
+bool mqtt_thread_join(mqtt_thread_t* const mqtt_thread);
+
+/** \brief Suspend the calling thread */
+bool mqtt_thread_sleep(const uint32_t ms_delay);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+
+#endif /* MQTT_THREAD_H */
@@ -0,0 +1,238 @@
+/*
+Copyright(c) 2016 Cedric Jimenez
+
+This file is part of lw-mqtt.
+
+lw-mqtt is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+lw-mqtt is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mqtt_file.h"
+#include "mqtt_error.h"
+
+
+/** \brief Write the buffered data of a file and wait until it is stored on the disk */
+bool mqtt_file_sync(FILE* const file)
+{
+    bool ret = false;
+
+    /* Check params */
+    if (file != NULL)
+    {
+        ret = ((fflush(file) == 0) && (fdatasync(fileno(file)) == 0));
+        if (!ret)
+        {
+            mqtt_errno_set(MQTT_ERR_FILE_FAILED);
+        }
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Change the size of a file, its buffered data must have been written */
+bool mqtt_file_truncate(FILE* const file, const long size)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((file != NULL) &&
+        (size >= 0))
+    {
+        ret = (ftruncate(fileno(file), (off_t)size) == 0);
+        if (!ret)
+        {
+            mqtt_errno_set(MQTT_ERR_FILE_FAILED);
+        }
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Replace a file by another one in a single step, the replaced file is either kept or fully replaced after a crash */
+bool mqtt_file_replace(const char* const path, const char* const replaced_path)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((path != NULL) &&
+        (replaced_path != NULL))
+    {
+        /* The rename is atomic, syncing the directory makes it durable */
+        ret = (rename(path, replaced_path) == 0);
+        if (ret)
+        {
+            char directory[256u];
+            const char* const separator = strrchr(replaced_path, '/');
+            size_t length = 1u;
+            int fd;
+
+            if (separator == NULL)
+            {
+                directory[0u] = '.';
+            }
+            else if (separator == replaced_path)
+            {
+                directory[0u] = '/';
+            }
+            else
+            {
+                length = (size_t)(separator - replaced_path);
+                if (length >= sizeof(directory))
+                {
+                    length = 0u;
+                }
+                (void)memcpy(directory, replaced_path, length);
+            }
+            directory[length] = 0;
+            fd = open(directory, O_RDONLY);
+            if (fd >= 0)
+            {
+                (void)fsync(fd);
+                (void)close(fd);
+            }
+        }
+        else
+        {
+            mqtt_errno_set(MQTT_ERR_FILE_FAILED);
+        }
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Map a file in memory for reading and writing, a new file is created with the given size and filled with zeros,
+           an existing file is mapped with its own size */
+bool mqtt_file_map_open(mqtt_file_map_t* const map, const char* const path, const size_t size, bool* const created)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((map != NULL) &&
+        (path != NULL) &&
+        (size != 0u) &&
+        (created != NULL))
+    {
+        struct stat file_stat;
+
+        /* Open or create the file, a new file is sparse until it is written */
+        map->data = NULL;
+        map->size = 0u;
+        map->fd = open(path, O_RDWR | O_CREAT, 0644);
+        ret = ((map->fd >= 0) && (fstat(map->fd, &file_stat) == 0));
+        if (ret)
+        {
+            (*created) = (file_stat.st_size == 0);
+            if (*created)
+            {
+                ret = (ftruncate(map->fd, (off_t)size) == 0);
+                map->size = size;
+            }
+            else
+            {
+                map->size = (size_t)file_stat.st_size;
+            }
+        }
+        if (ret)
+        {
+            void* const data = mmap(NULL, map->size, PROT_READ | PROT_WRITE, MAP_SHARED, map->fd, 0);
+            ret = (data != MAP_FAILED);
+            if (ret)
+            {
+                map->data = (uint8_t*)data;
+            }
+        }
+        if (!ret)
+        {
+            if (map->fd >= 0)
+            {
+                (void)close(map->fd);
+                map->fd = -1;
+            }
+            mqtt_errno_set(MQTT_ERR_FILE_FAILED);
+        }
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Wait until the modified data of a mapped file is stored on the disk */
+bool mqtt_file_map_sync(mqtt_file_map_t* const map)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((map != NULL) &&
+        (map->data != NULL))
+    {
+        /* Only the dirty pages are written */
+        ret = (msync(map->data, map->size, MS_SYNC) == 0);
+        if (!ret)
+        {
+            mqtt_errno_set(MQTT_ERR_FILE_FAILED);
+        }
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Unmap a file */
+bool mqtt_file_map_close(mqtt_file_map_t* const map)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((map != NULL) &&
+        (map->data != NULL))
+    {
+        ret = (munmap(map->data, map->size) == 0);
+        ret = (close(map->fd) == 0) && ret;
+        map->data = NULL;
+        map->size = 0u;
+        map->fd = -1;
+        if (!ret)
+        {
+            mqtt_errno_set(MQTT_ERR_FILE_FAILED);
+        }
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
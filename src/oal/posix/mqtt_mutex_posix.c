@@ -44,8 +44,19 @@ bool mqtt_mutex_create(mqtt_mutex_t* const mqtt_mutex)
     /* Check params */
     if (mqtt_mutex != NULL)
     {
-        /* Initialise mutex */
-        int callret = pthread_mutex_init(mqtt_mutex, NULL);
+        /* Initialise mutex : recursive like on Windows so that the
+           callbacks can call the API from inside the periodic tasks */
+        pthread_mutexattr_t attr;
+        int callret = pthread_mutexattr_init(&attr);
+        if (callret == 0)
+        {
+            callret = pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+            if (callret == 0)
+            {
+                callret = pthread_mutex_init(mqtt_mutex, &attr);
+            }
+            (void)pthread_mutexattr_destroy(&attr);
+        }
         if (callret == 0)
         {
             ret = true;
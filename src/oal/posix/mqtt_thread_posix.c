@@ -0,0 +1,120 @@
+/*
+Copyright(c) 2016 Cedric Jimenez
+
+This file is part of lw-mqtt.
+
+lw-mqtt is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+lw-mqtt is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <time.h>
+#include <errno.h>
+
+#include "mqtt_thread.h"
+#include "mqtt_error.h"
+
+
+/** \brief Entry point of the MQTT threads */
+static void* mqtt_thread_entry(void* param);
+
+
+
+/** \brief Create a MQTT thread which runs the given function */
+bool mqtt_thread_create(mqtt_thread_t* const mqtt_thread, const fp_mqtt_thread_func_t func, void* const param)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((mqtt_thread != NULL) &&
+        (func != NULL))
+    {
+        /* Create thread */
+        int callret;
+        mqtt_thread->func = func;
+        mqtt_thread->param = param;
+        callret = pthread_create(&mqtt_thread->data, NULL, mqtt_thread_entry, mqtt_thread);
+        if (callret == 0)
+        {
+            ret = true;
+        }
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Wait for the end of a MQTT thread and release it */
+bool mqtt_thread_join(mqtt_thread_t* const mqtt_thread)
+{
+    bool ret = false;
+
+    /* Check params */
+    if (mqtt_thread != NULL)
+    {
+        /* Wait for thread */
+        int callret = pthread_join(mqtt_thread->data, NULL);
+        if (callret == 0)
+        {
+            ret = true;
+        }
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Suspend the calling thread */
+bool mqtt_thread_sleep(const uint32_t ms_delay)
+{
+    bool ret = false;
+    struct timespec delay;
+    int callret;
+
+    /* Sleep, restart after a signal with the remaining delay */
+    delay.tv_sec = (time_t)(ms_delay / 1000u);
+    delay.tv_nsec = (long)((ms_delay % 1000u) * 1000000u);
+    do
+    {
+        callret = nanosleep(&delay, &delay);
+    }
+    while ((callret != 0) && (errno == EINTR));
+    if (callret == 0)
+    {
+        ret = true;
+    }
+
+    return ret;
+}
+
+
+
+
+/** \brief Entry point of the MQTT threads */
+static void* mqtt_thread_entry(void* param)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    mqtt_thread_t* const mqtt_thread = (mqtt_thread_t*)param;
+    mqtt_thread->func(mqtt_thread->param);
+
+    return NULL;
+}
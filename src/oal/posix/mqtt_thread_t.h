@@ -0,0 +1,56 @@
+/*
+Copyright(c) 2016 Cedric Jimenez
+
+This file is part of lw-mqtt.
+
+lw-mqtt is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+lw-mqtt is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MQTT_THREAD_T_H
+#define MQTT_THREAD_T_H
+
+#include "stdheaders.h"
+
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+
+
+/** \brief Function run by a MQTT thread */
+typedef void (*fp_mqtt_thread_func_t)(void* const param);
+
+/** \brief MQTT thread */
+typedef struct _mqtt_thread_t
+{
+    /** \brief Implementation specific data */
+    pthread_t data;
+    /** \brief Function run by the thread */
+    fp_mqtt_thread_func_t func;
+    /** \brief Parameter of the function */
+    void* param;
+
+} mqtt_thread_t;
+
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+
+#endif /* MQTT_THREAD_T_H */
@@ -0,0 +1,52 @@
+/*
+Copyright(c) 2016 Cedric Jimenez
+
+This file is part of lw-mqtt.
+
+lw-mqtt is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+lw-mqtt is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MQTT_FILE_T_H
+#define MQTT_FILE_T_H
+
+#include "stdheaders.h"
+#include <windows.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+
+/** \brief Memory-mapped file */
+typedef struct _mqtt_file_map_t
+{
+    /** \brief Mapped data, NULL if the file is not mapped */
+    uint8_t* data;
+    /** \brief Size in bytes of the mapped data */
+    size_t size;
+    /** \brief File handle */
+    HANDLE file;
+    /** \brief File mapping handle */
+    HANDLE mapping;
+
+} mqtt_file_map_t;
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+
+#endif /* MQTT_FILE_T_H */
@@ -0,0 +1,200 @@
+/*
+Copyright(c) 2016 Cedric Jimenez
+
+This file is part of lw-mqtt.
+
+lw-mqtt is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+lw-mqtt is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <windows.h>
+#include <io.h>
+
+#include "mqtt_file.h"
+#include "mqtt_error.h"
+
+
+/** \brief Write the buffered data of a file and wait until it is stored on the disk */
+bool mqtt_file_sync(FILE* const file)
+{
+    bool ret = false;
+
+    /* Check params */
+    if (file != NULL)
+    {
+        ret = ((fflush(file) == 0) && (_commit(_fileno(file)) == 0));
+        if (!ret)
+        {
+            mqtt_errno_set(MQTT_ERR_FILE_FAILED);
+        }
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Change the size of a file, its buffered data must have been written */
+bool mqtt_file_truncate(FILE* const file, const long size)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((file != NULL) &&
+        (size >= 0))
+    {
+        ret = (_chsize_s(_fileno(file), (__int64)size) == 0);
+        if (!ret)
+        {
+            mqtt_errno_set(MQTT_ERR_FILE_FAILED);
+        }
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Replace a file by another one in a single step, the replaced file is either kept or fully replaced after a crash */
+bool mqtt_file_replace(const char* const path, const char* const replaced_path)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((path != NULL) &&
+        (replaced_path != NULL))
+    {
+        ret = (MoveFileExA(path, replaced_path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != FALSE);
+        if (!ret)
+        {
+            mqtt_errno_set(MQTT_ERR_FILE_FAILED);
+        }
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Map a file in memory for reading and writing, a new file is created with the given size and filled with zeros,
+           an existing file is mapped with its own size */
+bool mqtt_file_map_open(mqtt_file_map_t* const map, const char* const path, const size_t size, bool* const created)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((map != NULL) &&
+        (path != NULL) &&
+        (size != 0u) &&
+        (created != NULL))
+    {
+        LARGE_INTEGER file_size;
+
+        /* Open or create the file */
+        map->data = NULL;
+        map->size = 0u;
+        map->mapping = NULL;
+        map->file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0u, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        ret = ((map->file != INVALID_HANDLE_VALUE) && (GetFileSizeEx(map->file, &file_size) != FALSE));
+        if (ret)
+        {
+            (*created) = (file_size.QuadPart == 0);
+            map->size = ((*created) ? size : (size_t)file_size.QuadPart);
+            file_size.QuadPart = (LONGLONG)map->size;
+
+            /* The mapping extends a new file to its size */
+            map->mapping = CreateFileMappingA(map->file, NULL, PAGE_READWRITE, (DWORD)(file_size.QuadPart >> 32u), 
+                                              (DWORD)(file_size.QuadPart & 0xFFFFFFFFu), NULL);
+            ret = (map->mapping != NULL);
+        }
+        if (ret)
+        {
+            map->data = (uint8_t*)MapViewOfFile(map->mapping, FILE_MAP_ALL_ACCESS, 0u, 0u, map->size);
+            ret = (map->data != NULL);
+        }
+        if (!ret)
+        {
+            if (map->mapping != NULL)
+            {
+                (void)CloseHandle(map->mapping);
+            }
+            if (map->file != INVALID_HANDLE_VALUE)
+            {
+                (void)CloseHandle(map->file);
+            }
+            mqtt_errno_set(MQTT_ERR_FILE_FAILED);
+        }
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Wait until the modified data of a mapped file is stored on the disk */
+bool mqtt_file_map_sync(mqtt_file_map_t* const map)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((map != NULL) &&
+        (map->data != NULL))
+    {
+        ret = ((FlushViewOfFile(map->data, map->size) != FALSE) && (FlushFileBuffers(map->file) != FALSE));
+        if (!ret)
+        {
+            mqtt_errno_set(MQTT_ERR_FILE_FAILED);
+        }
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Unmap a file */
+bool mqtt_file_map_close(mqtt_file_map_t* const map)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((map != NULL) &&
+        (map->data != NULL))
+    {
+        ret = (UnmapViewOfFile(map->data) != FALSE);
+        ret = (CloseHandle(map->mapping) != FALSE) && ret;
+        ret = (CloseHandle(map->file) != FALSE) && ret;
+        map->data = NULL;
+        map->size = 0u;
+        if (!ret)
+        {
+            mqtt_errno_set(MQTT_ERR_FILE_FAILED);
+        }
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
@@ -0,0 +1,101 @@
+/*
+Copyright(c) 2016 Cedric Jimenez
+
+This file is part of lw-mqtt.
+
+lw-mqtt is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+lw-mqtt is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <windows.h>
+
+#include "mqtt_thread.h"
+#include "mqtt_error.h"
+
+
+/** \brief Entry point of the MQTT threads */
+static DWORD WINAPI mqtt_thread_entry(LPVOID param);
+
+
+
+/** \brief Create a MQTT thread which runs the given function */
+bool mqtt_thread_create(mqtt_thread_t* const mqtt_thread, const fp_mqtt_thread_func_t func, void* const param)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((mqtt_thread != NULL) &&
+        (func != NULL))
+    {
+        /* Create thread */
+        mqtt_thread->func = func;
+        mqtt_thread->param = param;
+        mqtt_thread->data = CreateThread(NULL, 0u, mqtt_thread_entry, mqtt_thread, 0u, NULL);
+        if (mqtt_thread->data != NULL)
+        {
+            ret = true;
+        }
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Wait for the end of a MQTT thread and release it */
+bool mqtt_thread_join(mqtt_thread_t* const mqtt_thread)
+{
+    bool ret = false;
+
+    /* Check params */
+    if (mqtt_thread != NULL)
+    {
+        /* Wait for thread */
+        if (WaitForSingleObject(mqtt_thread->data, INFINITE) == WAIT_OBJECT_0)
+        {
+            ret = (CloseHandle(mqtt_thread->data) != FALSE);
+        }
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Suspend the calling thread */
+bool mqtt_thread_sleep(const uint32_t ms_delay)
+{
+    Sleep(ms_delay);
+    return true;
+}
+
+
+
+
+/** \brief Entry point of the MQTT threads */
+static DWORD WINAPI mqtt_thread_entry(LPVOID param)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    mqtt_thread_t* const mqtt_thread = (mqtt_thread_t*)param;
+    mqtt_thread->func(mqtt_thread->param);
+
+    return 0u;
+}
@@ -19,6 +19,8 @@ along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "mqtt_error.h"
 #include "mqtt_packet_deserialize.h"
+#include "mqtt_packet_properties.h"
+#include "mqtt_packet_varint.h"
 
 /** \brief Deserialize the packet type */
 static bool mqtt_packet_deserialize_packet_type(input_stream_t* const stream, mqtt_control_packet_type_t* const packet_type, uint8_t* const packet_flags);
@@ -30,7 +32,16 @@ static bool mqtt_packet_deserialize_lenght(input_stream_t* const stream, uint32_
 static bool mqtt_packet_deserialize_string(input_stream_t* const stream, mqtt_string_t* const mqtt_string);
 
 /** \brief Deserialize a response packet with a packet id only */
-static bool mqtt_packet_deserialize_packet_id_only(input_stream_t* const stream, uint16_t* const packet_id);
+static bool mqtt_packet_deserialize_packet_id_only(input_stream_t* const stream, const uint32_t packet_length, uint16_t* const packet_id);
+
+/** \brief Deserialize the MQTT 5.0 properties */
+static bool mqtt_packet_deserialize_properties(input_stream_t* const stream, mqtt_properties_t* const properties, uint32_t* const remaining_length);
+
+/** \brief Skip the given number of bytes in the input stream */
+static bool mqtt_packet_deserialize_skip(input_stream_t* const stream, const uint32_t count);
+
+/** \brief Convert a MQTT 5.0 CONNACK reason code into a MQTT 3.1.1 return code */
+static mqtt_connack_retcode_t mqtt_packet_deserialize_connack_retcode(const uint8_t reason_code);
 
 /** \brief Deserialize a 0 length packet */
 static bool mqtt_packet_deserialize_zero_length(input_stream_t* const stream, const uint32_t packet_length);
@@ -48,6 +59,13 @@ bool mqtt_packet_deserialize_init_whole_packet(mqtt_deserialize_whole_data_t* co
     {
         whole_data->state = MQTT_DWS_PACKET_TYPE;
         whole_data->bytes_left = 0u;
+        whole_data->length_count = 0u;
+        ret = true;
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
     }
 
     return ret;
@@ -60,7 +78,8 @@ bool mqtt_packet_deserialize_whole_packet(mqtt_deserialize_whole_data_t* const w
     bool ret = false;
 
     /* Check params */
-    if ((instream != NULL) &&
+    if ((whole_data != NULL) &&
+        (instream != NULL) &&
         (outstream != NULL) &&
         (packet_type != NULL) &&
         (packet_flags != NULL))
@@ -76,7 +95,10 @@ bool mqtt_packet_deserialize_whole_packet(mqtt_deserialize_whole_data_t* const w
                     const bool callret = mqtt_packet_deserialize_packet_type(instream, packet_type, packet_flags);
                     if (callret)
                     {
-                        whole_data->state = MQTT_DWS_PACKET_TYPE;
+                        whole_data->state = MQTT_DWS_PACKET_LENGTH;
+                        whole_data->bytes_left = 0u;
+                        whole_data->length_count = 0u;
+                        (void)memset(whole_data->length_bytes, 0, sizeof(whole_data->length_bytes));
                         again = true;
                     }
                     break;
@@ -84,39 +106,73 @@ bool mqtt_packet_deserialize_whole_packet(mqtt_deserialize_whole_data_t* const w
 
                 case MQTT_DWS_PACKET_LENGTH:
                 {
-                    uint8_t len_byte;
                     /* Read one byte */
-                    const bool callret = instream->reader(instream, &len_byte, sizeof(len_byte));
+                    uint8_t* const len_byte = &whole_data->length_bytes[whole_data->length_count];
+                    const bool callret = instream->reader(instream, len_byte, sizeof(uint8_t));
                     if (callret)
                     {
-                        /* Update len */
-                        whole_data->bytes_left = (whole_data->bytes_left << 7u) + (len_byte & 0x7F);
+                        whole_data->length_count++;
 
-                        /* Check end of length field */
-                        if ((len_byte & 0x80u) == 0u)
+                        /* Decode at the end of the length field or when the 4 bytes limit is reached */
+                        if ((((*len_byte) & 0x80u) == 0u) || (whole_data->length_count == MQTT_MAXIMUM_VARIABLE_INTEGER_SIZE))
+                        {
+                            /* Fails if the length field is too long */
+                            const uint8_t size = mqtt_packet_variable_integer_decode(whole_data->length_bytes, &whole_data->bytes_left);
+                            if (size != 0u)
+                            {
+                                if (whole_data->bytes_left == 0u)
+                                {
+                                    whole_data->state = MQTT_DWS_PACKET_END;
+                                    ret = true;
+                                }
+                                else
+                                {
+                                    whole_data->state = MQTT_DWS_PACKET_PAYLOAD;
+                                    again = true;
+                                }
+                            }
+                        }
+                        else
                         {
-                            whole_data->state = MQTT_DWS_PACKET_PAYLOAD;
                             again = true;
                         }
                     }
                     break;
                 }
-                break;
 
                 case MQTT_DWS_PACKET_PAYLOAD:
                 {
-                    uint8_t payload_byte;
+                    uint8_t payload_bytes[64u];
+                    size_t chunk_size = sizeof(uint8_t);
+                    bool callret;
 
-                    /* Read one byte at a time*/
-                    bool callret = instream->reader(instream, &payload_byte, sizeof(payload_byte));
+                    /* Read one byte at a time unless the input stream tells how many bytes are already available */
+                    if (instream->peek != NULL)
+                    {
+                        const uint8_t* available_data;
+                        const size_t available = instream->peek(instream, &available_data);
+                        if (available > chunk_size)
+                        {
+                            chunk_size = available;
+                            if (chunk_size > sizeof(payload_bytes))
+                            {
+                                chunk_size = sizeof(payload_bytes);
+                            }
+                            if (chunk_size > whole_data->bytes_left)
+                            {
+                                chunk_size = whole_data->bytes_left;
+                            }
+                        }
+                    }
+                    callret = instream->reader(instream, payload_bytes, chunk_size);
                     if (callret)
                     {
-                        /* Write byte to output stream */
-                        callret = outstream->writer(outstream, &payload_byte, sizeof(payload_byte));
+                        /* Write bytes to output stream */
+                        callret = outstream->writer(outstream, payload_bytes, chunk_size);
                         if (callret)
                         {
                             /* Check end of frame */
-                            whole_data->bytes_left--;
+                            whole_data->bytes_left -= (uint32_t)chunk_size;
                             if (whole_data->bytes_left == 0u)
                             {
                                 whole_data->state = MQTT_DWS_PACKET_END;
@@ -191,7 +247,7 @@ bool mqtt_packet_deserialize_packet_header(input_stream_t* const stream, mqtt_co
 /** \brief Deserialize a CONNECT packet */
 bool mqtt_packet_deserialize_connect(input_stream_t* const stream, mqtt_string_t* const client_id, mqtt_string_t* const protocol_name,
                                      uint8_t* const protocol_level, mqtt_credentials_t* const credentials, mqtt_will_t* const will,
-                                     bool* const clean_session, uint16_t* const keepalive)
+                                     bool* const clean_session, uint16_t* const keepalive, mqtt_properties_t* const properties)
 {
     bool ret = false;
 
@@ -220,6 +276,9 @@ bool mqtt_packet_deserialize_connect(input_stream_t* const stream, mqtt_string_t
         bool will_flag = false;
         bool username_flag = false;
         bool password_flag = false;
+        mqtt_properties_t ignored_properties;
+        mqtt_properties_t* const connect_properties = ((properties != NULL) ? properties : &ignored_properties);
+        uint32_t properties_length = MQTT_MAXIMUM_VARIABLE_INTEGER;
 
         /* Protocol name */
         ret = mqtt_packet_deserialize_string(stream, protocol_name);
@@ -229,6 +288,7 @@ bool mqtt_packet_deserialize_connect(input_stream_t* const stream, mqtt_string_t
         {
             ret = stream->reader(stream, protocol_level, sizeof(*protocol_level));
         }
+        connect_properties->present = 0u;
 
         /* Flags */
         if (ret)
@@ -258,6 +318,12 @@ bool mqtt_packet_deserialize_connect(input_stream_t* const stream, mqtt_string_t
             }
         }
 
+        /* Properties */
+        if (ret && ((*protocol_level) == MQTT_PROTOCOL_LEVEL_V5))
+        {
+            ret = mqtt_packet_deserialize_properties(stream, connect_properties, &properties_length);
+        }
+
         /* Client id */
         if (ret)
         {
@@ -267,8 +333,19 @@ bool mqtt_packet_deserialize_connect(input_stream_t* const stream, mqtt_string_t
         /* Will */
         if (ret && will_flag)
         {
+            /* Will properties => ignored */
+            if ((*protocol_level) == MQTT_PROTOCOL_LEVEL_V5)
+            {
+                mqtt_properties_t will_properties;
+                properties_length = MQTT_MAXIMUM_VARIABLE_INTEGER;
+                ret = mqtt_packet_deserialize_properties(stream, &will_properties, &properties_length);
+            }
+
             /* Topic */
-            ret = mqtt_packet_deserialize_string(stream, &will->topic);
+            if (ret)
+            {
+                ret = mqtt_packet_deserialize_string(stream, &will->topic);
+            }
             if (ret)
             {
                 /* Message */
@@ -276,15 +353,30 @@ bool mqtt_packet_deserialize_connect(input_stream_t* const stream, mqtt_string_t
             }
         }
 
+        else
+        {
+            will->topic.size = 0u;
+            will->message.size = 0u;
+        }
+        if (!username_flag)
+        {
+            credentials->username.size = 0u;
+        }
+        if (!password_flag)
+        {
+            credentials->password.size = 0u;
+        }
+
         /* Credentials */
         if (ret && username_flag)
         {
             /* Username */
             ret = mqtt_packet_deserialize_string(stream, &credentials->username);
-            if (ret && password_flag)
-            {
-                ret = mqtt_packet_deserialize_string(stream, &credentials->password);
-            }
+        }
+        if (ret && password_flag)
+        {
+            /* Password */
+            ret = mqtt_packet_deserialize_string(stream, &credentials->password);
         }
     }
     else
@@ -297,12 +389,14 @@ bool mqtt_packet_deserialize_connect(input_stream_t* const stream, mqtt_string_t
 }
 
 /** \brief Deserialize a CONNACK packet */
-bool mqtt_packet_deserialize_connack(input_stream_t* const stream, bool* const session_present, mqtt_connack_retcode_t* const retcode)
+bool mqtt_packet_deserialize_connack(input_stream_t* const stream, const uint32_t packet_length, bool* const session_present, 
+                                     mqtt_connack_retcode_t* const retcode, mqtt_properties_t* const properties)
 {
     bool ret = false;
 
     /* Check params */
     if ((stream != NULL) &&
+        (packet_length >= MQTT_CONNACK_PACKET_SIZE) &&
         (session_present != NULL) &&
         (retcode != NULL))
     {
@@ -327,7 +421,32 @@ bool mqtt_packet_deserialize_connack(input_stream_t* const stream, bool* const s
                     mqtt_errno_set(MQTT_ERR_INVALID_PACKET_PAYLOAD);
                     break;
             }
-            (*retcode) = (mqtt_connack_retcode_t)payload[1];
+            if (packet_length == MQTT_CONNACK_PACKET_SIZE)
+            {
+                /* MQTT 3.1.1 */
+                (*retcode) = (mqtt_connack_retcode_t)payload[1];
+                if (properties != NULL)
+                {
+                    properties->present = 0u;
+                }
+            }
+            else
+            {
+                /* MQTT 5.0 */
+                (*retcode) = mqtt_packet_deserialize_connack_retcode(payload[1]);
+            }
+        }
+
+        /* Properties */
+        if (ret && (packet_length > MQTT_CONNACK_PACKET_SIZE))
+        {
+            mqtt_properties_t ignored_properties;
+            uint32_t remaining_length = packet_length - MQTT_CONNACK_PACKET_SIZE;
+            ret = mqtt_packet_deserialize_properties(stream, ((properties != NULL) ? properties : &ignored_properties), &remaining_length);
+            if (ret)
+            {
+                ret = mqtt_packet_deserialize_skip(stream, remaining_length);
+            }
         }
     }
     else
@@ -343,7 +462,7 @@ bool mqtt_packet_deserialize_connack(input_stream_t* const stream, bool* const s
 /** \brief Deserialize a PUBLISH packet */
 bool mqtt_packet_deserialize_publish(input_stream_t* const stream, const uint8_t packet_flags, const uint32_t packet_length, mqtt_string_t* const topic,
                                      void* data, uint32_t* const length, uint8_t* const qos, bool* const retain, bool* const duplicate, 
-                                     uint16_t* const packet_id)
+                                     uint16_t* const packet_id, mqtt_properties_t* const properties)
 {
     bool ret = false;
 
@@ -354,7 +473,7 @@ bool mqtt_packet_deserialize_publish(input_stream_t* const stream, const uint8_t
         (topic->size != 0u) &&
         (data != NULL) &&
         (length != NULL) &&
-        (length != 0u) &&
+        ((*length) != 0u) &&
         (qos != NULL) &&
         (retain != NULL) &&
         (duplicate != NULL) &&
@@ -384,26 +503,52 @@ bool mqtt_packet_deserialize_publish(input_stream_t* const stream, const uint8_t
         if (ret)
         {
             ret = mqtt_packet_deserialize_string(stream, topic);
-            remaining_length -= topic->size + MQTT_MIN_ENCODED_STRING_SIZE;
+            if (ret)
+            {
+                if (remaining_length >= (topic->size + MQTT_MIN_ENCODED_STRING_SIZE))
+                {
+                    remaining_length -= topic->size + MQTT_MIN_ENCODED_STRING_SIZE;
+                }
+                else
+                {
+                    ret = false;
+                    mqtt_errno_set(MQTT_ERR_INVALID_PACKET_SIZE);
+                }
+            }
         }
 
         /* Packet id */
-        if (ret && ((*qos) > 0u) && (remaining_length > sizeof(packet_id)))
+        (*packet_id) = 0u;
+        if (ret && ((*qos) > 0u))
         {
             uint16_t received_id_be;
 
-            ret = stream->reader(stream, &received_id_be, sizeof(received_id_be));
-            if (ret)
+            if (remaining_length >= sizeof(received_id_be))
             {
-                (*packet_id) = MQTT_BIG_ENDIAN_UINT16(received_id_be);
-                remaining_length -= sizeof(packet_id);
+                ret = stream->reader(stream, &received_id_be, sizeof(received_id_be));
+                if (ret)
+                {
+                    (*packet_id) = MQTT_BIG_ENDIAN_UINT16(received_id_be);
+                    remaining_length -= sizeof(received_id_be);
+                }
+            }
+            else
+            {
+                ret = false;
+                mqtt_errno_set(MQTT_ERR_INVALID_PACKET_SIZE);
             }
         }
 
+        /* Properties */
+        if (ret && (properties != NULL))
+        {
+            ret = mqtt_packet_deserialize_properties(stream, properties, &remaining_length);
+        }
+
         /* Payload */
         if (ret)
         {
-            if (remaining_length <= (stream->size - stream->read))
+            if (remaining_length <= (*length))
             {
                 ret = stream->reader(stream, data, remaining_length);
                 (*length) = remaining_length;
@@ -425,36 +570,36 @@ bool mqtt_packet_deserialize_publish(input_stream_t* const stream, const uint8_t
 }
 
 /** \brief Deserialize a PUBACK packet */
-bool mqtt_packet_deserialize_puback(input_stream_t* const stream, uint16_t* const packet_id)
+bool mqtt_packet_deserialize_puback(input_stream_t* const stream, const uint32_t packet_length, uint16_t* const packet_id)
 {
-    const bool ret = mqtt_packet_deserialize_packet_id_only(stream, packet_id);
+    const bool ret = mqtt_packet_deserialize_packet_id_only(stream, packet_length, packet_id);
     return ret;
 }
 
 /** \brief Deserialize a PUBREC packet */
-bool mqtt_packet_deserialize_pubrec(input_stream_t* const stream, uint16_t* const packet_id)
+bool mqtt_packet_deserialize_pubrec(input_stream_t* const stream, const uint32_t packet_length, uint16_t* const packet_id)
 {
-    const bool ret = mqtt_packet_deserialize_packet_id_only(stream, packet_id);
+    const bool ret = mqtt_packet_deserialize_packet_id_only(stream, packet_length, packet_id);
     return ret;
 }
 
 /** \brief Deserialize a PUBREL packet */
-bool mqtt_packet_deserialize_pubrel(input_stream_t* const stream, uint16_t* const packet_id)
+bool mqtt_packet_deserialize_pubrel(input_stream_t* const stream, const uint32_t packet_length, uint16_t* const packet_id)
 {
-    const bool ret = mqtt_packet_deserialize_packet_id_only(stream, packet_id);
+    const bool ret = mqtt_packet_deserialize_packet_id_only(stream, packet_length, packet_id);
     return ret;
 }
 
 /** \brief Deserialize a PUBCOMP packet */
-bool mqtt_packet_deserialize_pubcomp(input_stream_t* const stream, uint16_t* const packet_id)
+bool mqtt_packet_deserialize_pubcomp(input_stream_t* const stream, const uint32_t packet_length, uint16_t* const packet_id)
 {
-    const bool ret = mqtt_packet_deserialize_packet_id_only(stream, packet_id);
+    const bool ret = mqtt_packet_deserialize_packet_id_only(stream, packet_length, packet_id);
     return ret;
 }
 
-/** \brief Deserialize a SUBSCRIBE packet */
-bool mqtt_packet_deserialize_subscribe(input_stream_t* const stream, mqtt_string_t* const topic, uint8_t* const qos,
-                                       uint16_t* const packet_id)
+/** \brief Deserialize a SUBSCRIBE packet, the MQTT 5.0 subscription options other than the QoS are given in options (can be NULL) */
+bool mqtt_packet_deserialize_subscribe(input_stream_t* const stream, const uint32_t packet_length, mqtt_string_t* const topic, uint8_t* const qos,
+                                       uint8_t* const options, uint16_t* const packet_id, mqtt_properties_t* const properties)
 {
     bool ret = false;
 
@@ -468,11 +613,19 @@ bool mqtt_packet_deserialize_subscribe(input_stream_t* const stream, mqtt_string
     {
         /* Packet id */
         uint16_t received_id_be;
+        uint32_t remaining_length = packet_length;
 
         ret = stream->reader(stream, &received_id_be, sizeof(received_id_be));
         if (ret)
         {
             (*packet_id) = MQTT_BIG_ENDIAN_UINT16(received_id_be);
+            remaining_length -= sizeof(received_id_be);
+        }
+
+        /* Properties */
+        if (ret && (properties != NULL))
+        {
+            ret = mqtt_packet_deserialize_properties(stream, properties, &remaining_length);
         }
 
         /* Topic */
@@ -481,18 +634,27 @@ bool mqtt_packet_deserialize_subscribe(input_stream_t* const stream, mqtt_string
             ret = mqtt_packet_deserialize_string(stream, topic);
         }
 
-        /* QoS */
+        /* QoS or subscription options */
         if (ret)
         {
             uint8_t received_qos;
+            uint8_t received_options = 0u;
 
             ret = stream->reader(stream, &received_qos, sizeof(received_qos));
             if (ret)
             {
-                if ((received_qos < MQTT_CFG_MAX_QOS_LEVEL) ||
-                    (received_qos == MQTT_FAILURE_QOS))
+                if (properties != NULL)
+                {
+                    received_options = received_qos & (uint8_t)(~MQTT_SUBSCRIBE_OPTION_QOS);
+                    received_qos &= MQTT_SUBSCRIBE_OPTION_QOS;
+                }
+                if (received_qos <= MQTT_CFG_MAX_QOS_LEVEL)
                 {
                     (*qos) = received_qos;
+                    if (options != NULL)
+                    {
+                        (*options) = received_options;
+                    }
                 }
                 else
                 {
@@ -512,22 +674,32 @@ bool mqtt_packet_deserialize_subscribe(input_stream_t* const stream, mqtt_string
 }
 
 /** \brief Deserialize a SUBACK packet */
-bool mqtt_packet_deserialize_suback(input_stream_t* const stream, uint8_t* const qos, uint16_t* const packet_id)
+bool mqtt_packet_deserialize_suback(input_stream_t* const stream, const uint32_t packet_length, uint8_t* const qos, uint16_t* const packet_id,
+                                    mqtt_properties_t* const properties)
 {
     bool ret = false;
 
     /* Check params */
     if ((stream != NULL) &&
+        (packet_length >= MQTT_SUBACK_PACKET_SIZE) &&
         (qos != NULL) &&
         (packet_id != NULL))
     {
         /* Packet id */
         uint16_t received_id_be;
+        uint32_t remaining_length = packet_length;
 
         ret = stream->reader(stream, &received_id_be, sizeof(received_id_be));
         if (ret)
         {
             (*packet_id) = MQTT_BIG_ENDIAN_UINT16(received_id_be);
+            remaining_length -= sizeof(received_id_be);
+        }
+
+        /* Properties */
+        if (ret && (properties != NULL))
+        {
+            ret = mqtt_packet_deserialize_properties(stream, properties, &remaining_length);
         }
 
         /* QoS */
@@ -538,8 +710,8 @@ bool mqtt_packet_deserialize_suback(input_stream_t* const stream, uint8_t* const
             ret = stream->reader(stream, &received_qos, sizeof(received_qos));
             if (ret)
             {
-                if ((received_qos < MQTT_CFG_MAX_QOS_LEVEL) ||
-                    (received_qos == MQTT_FAILURE_QOS))
+                if ((received_qos <= MQTT_CFG_MAX_QOS_LEVEL) ||
+                    (received_qos >= MQTT_FAILURE_QOS))
                 {
                     (*qos) = received_qos;
                 }
@@ -561,7 +733,8 @@ bool mqtt_packet_deserialize_suback(input_stream_t* const stream, uint8_t* const
 }
 
 /** \brief Deserialize an UNSUBSCRIBE packet */
-bool mqtt_packet_deserialize_unsubscribe(input_stream_t* const stream, mqtt_string_t* const topic, uint16_t* const packet_id)
+bool mqtt_packet_deserialize_unsubscribe(input_stream_t* const stream, const uint32_t packet_length, mqtt_string_t* const topic, uint16_t* const packet_id,
+                                         mqtt_properties_t* const properties)
 {
     bool ret = false;
 
@@ -574,11 +747,19 @@ bool mqtt_packet_deserialize_unsubscribe(input_stream_t* const stream, mqtt_stri
     {
         /* Packet id */
         uint16_t received_id_be;
+        uint32_t remaining_length = packet_length;
 
         ret = stream->reader(stream, &received_id_be, sizeof(received_id_be));
         if (ret)
         {
             (*packet_id) = MQTT_BIG_ENDIAN_UINT16(received_id_be);
+            remaining_length -= sizeof(received_id_be);
+        }
+
+        /* Properties */
+        if (ret && (properties != NULL))
+        {
+            ret = mqtt_packet_deserialize_properties(stream, properties, &remaining_length);
         }
 
         /* Topic */
@@ -597,9 +778,10 @@ bool mqtt_packet_deserialize_unsubscribe(input_stream_t* const stream, mqtt_stri
 }
 
 /** \brief Deserialize an UNSUBACK packet */
-bool mqtt_packet_deserialize_unsuback(input_stream_t* const stream, uint16_t* const packet_id)
+bool mqtt_packet_deserialize_unsuback(input_stream_t* const stream, const uint32_t packet_length, uint16_t* const packet_id)
 {
-    const bool ret = mqtt_packet_deserialize_packet_id_only(stream, packet_id);
+    /* MQTT 5.0 properties and reason codes are skipped */
+    const bool ret = mqtt_packet_deserialize_packet_id_only(stream, packet_length, packet_id);
     return ret;
 }
 
@@ -620,7 +802,23 @@ bool mqtt_packet_deserialize_pingresp(input_stream_t* const stream, const uint32
 /** \brief Deserialize a DISCONNECT packet */
 bool mqtt_packet_deserialize_disconnect(input_stream_t* const stream, const uint32_t packet_length)
 {
-    const bool ret = mqtt_packet_deserialize_zero_length(stream, packet_length);
+    bool ret = false;
+
+    if (packet_length == 0u)
+    {
+        ret = mqtt_packet_deserialize_zero_length(stream, packet_length);
+    }
+    else if (stream != NULL)
+    {
+        /* MQTT 5.0 reason code and properties are skipped */
+        ret = mqtt_packet_deserialize_skip(stream, packet_length);
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
     return ret;
 }
 
@@ -702,20 +900,47 @@ static bool mqtt_packet_deserialize_packet_type(input_stream_t* const stream, mq
 static bool mqtt_packet_deserialize_lenght(input_stream_t* const stream, uint32_t* const length)
 {
     bool ret = false;
-    uint8_t len_byte;
+    uint8_t size;
+    uint8_t encoded_length[MQTT_MAXIMUM_VARIABLE_INTEGER_SIZE] = { 0u, 0u, 0u, 0u };
+
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
 
-    (*length) = 0u;
-    do
+    if (stream->peek != NULL)
+    {
+        /* Decode from a window of up to 4 bytes in one step */
+        const uint8_t* window = NULL;
+        size_t available = stream->peek(stream, &window);
+        if (available > MQTT_MAXIMUM_VARIABLE_INTEGER_SIZE)
+        {
+            available = MQTT_MAXIMUM_VARIABLE_INTEGER_SIZE;
+        }
+        (void)memcpy(encoded_length, window, available);
+        size = mqtt_packet_variable_integer_decode(encoded_length, length);
+        if (size != 0u)
+        {
+            /* Consume the bytes, fails if the window was too short */
+            ret = stream->reader(stream, encoded_length, size);
+        }
+    }
+    else
     {
-        /* Read one byte */
-        ret = stream->reader(stream, &len_byte, sizeof(len_byte));
+        /* Read one byte at a time until the end of the field or the 4 bytes limit */
+        uint8_t index = 0u;
+        do
+        {
+            ret = stream->reader(stream, &encoded_length[index], sizeof(uint8_t));
+            index++;
+        }
+        while (ret && ((encoded_length[index - 1u] & 0x80u) != 0u) && (index < MQTT_MAXIMUM_VARIABLE_INTEGER_SIZE));
         if (ret)
         {
-            /* Update len */
-            (*length) = ((*length) << 7u) + (len_byte & 0x7F);
+            size = mqtt_packet_variable_integer_decode(encoded_length, length);
+            ret = (size != 0u);
         }
     }
-    while( ret && ((len_byte & 0x80u) != 0u));
 
     return ret;
 }
@@ -758,12 +983,13 @@ static bool mqtt_packet_deserialize_string(input_stream_t* const stream, mqtt_st
 }
 
 /** \brief Deserialize a response packet with a packet id only */
-static bool mqtt_packet_deserialize_packet_id_only(input_stream_t* const stream, uint16_t* const packet_id)
+static bool mqtt_packet_deserialize_packet_id_only(input_stream_t* const stream, const uint32_t packet_length, uint16_t* const packet_id)
 {
     bool ret = false;
 
     /* Check params */
     if ((stream != NULL) &&
+        (packet_length >= MQTT_PACKET_ID_ONLY_PACKET_SIZE) &&
         (packet_id != NULL))
     {
         /* Packet id */
@@ -773,6 +999,9 @@ static bool mqtt_packet_deserialize_packet_id_only(input_stream_t* const stream,
         if (ret)
         {
             (*packet_id) = MQTT_BIG_ENDIAN_UINT16(received_id_be);
+
+            /* MQTT 5.0 reason code and properties */
+            ret = mqtt_packet_deserialize_skip(stream, packet_length - MQTT_PACKET_ID_ONLY_PACKET_SIZE);
         }
     }
     else
@@ -805,3 +1034,190 @@ static bool mqtt_packet_deserialize_zero_length(input_stream_t* const stream, co
 
     return ret;
 }
+
+/** \brief Deserialize the MQTT 5.0 properties */
+static bool mqtt_packet_deserialize_properties(input_stream_t* const stream, mqtt_properties_t* const properties, uint32_t* const remaining_length)
+{
+    bool ret = false;
+    uint32_t properties_length = 0u;
+
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    /* Properties length */
+    properties->present = 0u;
+    ret = mqtt_packet_deserialize_lenght(stream, &properties_length);
+    if (ret)
+    {
+        const uint32_t header_size = mqtt_packet_variable_integer_size(properties_length);
+        if ((header_size + properties_length) <= (*remaining_length))
+        {
+            (*remaining_length) -= header_size + properties_length;
+        }
+        else
+        {
+            ret = false;
+            mqtt_errno_set(MQTT_ERR_INVALID_PACKET_SIZE);
+        }
+    }
+
+    /* Properties */
+    while (ret && (properties_length != 0u))
+    {
+        uint8_t id;
+        uint32_t value_size = 0u;
+        const mqtt_property_descriptor_t* descriptor = NULL;
+
+        /* Identifier */
+        ret = stream->reader(stream, &id, sizeof(id));
+        if (ret)
+        {
+            descriptor = mqtt_packet_properties_get_descriptor(id);
+            if (descriptor == NULL)
+            {
+                ret = false;
+                mqtt_errno_set(MQTT_ERR_INVALID_PROPERTY);
+            }
+        }
+
+        /* Value */
+        if (ret)
+        {
+            void* const value = (void*)((uint8_t*)properties + descriptor->offset);
+            switch (descriptor->type)
+            {
+                case MQTT_PROP_TYPE_BYTE:
+                {
+                    value_size = sizeof(uint8_t);
+                    ret = stream->reader(stream, value, value_size);
+                    break;
+                }
+                case MQTT_PROP_TYPE_TWO_BYTE_INTEGER:
+                {
+                    uint16_t value_be;
+                    value_size = sizeof(value_be);
+                    ret = stream->reader(stream, &value_be, value_size);
+                    (*((uint16_t*)value)) = MQTT_BIG_ENDIAN_UINT16(value_be);
+                    break;
+                }
+                case MQTT_PROP_TYPE_FOUR_BYTE_INTEGER:
+                {
+                    uint32_t value_be;
+                    value_size = sizeof(value_be);
+                    ret = stream->reader(stream, &value_be, value_size);
+                    (*((uint32_t*)value)) = MQTT_BIG_ENDIAN_UINT32(value_be);
+                    break;
+                }
+                case MQTT_PROP_TYPE_VARIABLE_INTEGER:
+                {
+                    ret = mqtt_packet_deserialize_lenght(stream, (uint32_t*)value);
+                    value_size = mqtt_packet_variable_integer_size(*((uint32_t*)value));
+                    break;
+                }
+                case MQTT_PROP_TYPE_STRING_PAIR:
+                    /* Fall throught */
+                case MQTT_PROP_TYPE_STRING:
+                    /* Fall throught */
+                case MQTT_PROP_TYPE_BINARY:
+                {
+                    /* Not stored : skip the length prefixed data */
+                    uint8_t i;
+                    const uint8_t count = ((descriptor->type == MQTT_PROP_TYPE_STRING_PAIR) ? 2u : 1u);
+                    for (i = 0u; ret && (i < count); i++)
+                    {
+                        uint16_t len_be;
+                        ret = stream->reader(stream, &len_be, sizeof(len_be));
+                        if (ret)
+                        {
+                            const uint16_t len = MQTT_BIG_ENDIAN_UINT16(len_be);
+                            value_size += sizeof(len_be) + len;
+                            ret = mqtt_packet_deserialize_skip(stream, len);
+                        }
+                    }
+                    break;
+                }
+                default:
+                {
+                    ret = false;
+                    mqtt_errno_set(MQTT_ERR_INVALID_PROPERTY);
+                    break;
+                }
+            }
+            if (ret && (descriptor->flag != 0u))
+            {
+                properties->present |= descriptor->flag;
+            }
+        }
+
+        /* Check properties length */
+        if (ret)
+        {
+            value_size += sizeof(id);
+            if (value_size <= properties_length)
+            {
+                properties_length -= value_size;
+            }
+            else
+            {
+                ret = false;
+                mqtt_errno_set(MQTT_ERR_INVALID_PACKET_SIZE);
+            }
+        }
+    }
+
+    return ret;
+}
+
+/** \brief Skip the given number of bytes in the input stream */
+static bool mqtt_packet_deserialize_skip(input_stream_t* const stream, const uint32_t count)
+{
+    bool ret = true;
+    uint32_t left = count;
+    uint8_t skip_buffer[32u];
+
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    while (ret && (left != 0u))
+    {
+        const uint32_t size = ((left < sizeof(skip_buffer)) ? left : sizeof(skip_buffer));
+        ret = stream->reader(stream, skip_buffer, size);
+        left -= size;
+    }
+
+    return ret;
+}
+
+/** \brief Convert a MQTT 5.0 CONNACK reason code into a MQTT 3.1.1 return code */
+static mqtt_connack_retcode_t mqtt_packet_deserialize_connack_retcode(const uint8_t reason_code)
+{
+    mqtt_connack_retcode_t retcode;
+
+    switch (reason_code)
+    {
+        case MQTT_REASON_SUCCESS:
+            retcode = MQTT_CONNACK_RET_ACCEPTED;
+            break;
+        case MQTT_REASON_UNSUPPORTED_PROTOCOL_VERSION:
+            retcode = MQTT_CONNACK_RET_REFUSED_PROTOCOL;
+            break;
+        case MQTT_REASON_CLIENT_ID_NOT_VALID:
+            retcode = MQTT_CONNACK_RET_REFUSED_CLIENT_ID;
+            break;
+        case MQTT_REASON_BAD_USERNAME_OR_PASSWORD:
+            retcode = MQTT_CONNACK_RET_REFUSED_BAD_CREDENTIALS;
+            break;
+        case MQTT_REASON_NOT_AUTHORIZED:
+            retcode = MQTT_CONNACK_RET_REFUSED_NOT_AUTHORIZED;
+            break;
+        default:
+            retcode = MQTT_CONNACK_RET_REFUSED_SERVER_UNAVAILABLE;
+            break;
+    }
+
+    return retcode;
+}
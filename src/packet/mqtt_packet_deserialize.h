@@ -47,6 +47,10 @@ typedef struct _mqtt_deserialize_whole_data_t
     mqtt_deserialize_whole_state_t state;
     /** \brief Bytes lefts */
     uint32_t bytes_left;
+    /** \brief Remaining length bytes received so far */
+    uint8_t length_bytes[MQTT_MAXIMUM_VARIABLE_INTEGER_SIZE];
+    /** \brief Number of remaining length bytes received so far */
+    uint8_t length_count;
 } mqtt_deserialize_whole_data_t;
 
 
@@ -66,40 +70,43 @@ bool mqtt_packet_deserialize_packet_header(input_stream_t* const stream, mqtt_co
 /** \brief Deserialize a CONNECT packet */
 bool mqtt_packet_deserialize_connect(input_stream_t* const stream, mqtt_string_t* const client_id, mqtt_string_t* const protocol_name,
                                      uint8_t* const protocol_level, mqtt_credentials_t* const credentials, mqtt_will_t* const will,
-                                     bool* const clean_session, uint16_t* const keepalive);
+                                     bool* const clean_session, uint16_t* const keepalive, mqtt_properties_t* const properties);
 
 /** \brief Deserialize a CONNACK packet */
-bool mqtt_packet_deserialize_connack(input_stream_t* const stream, bool* const session_present, mqtt_connack_retcode_t* const retcode);
+bool mqtt_packet_deserialize_connack(input_stream_t* const stream, const uint32_t packet_length, bool* const session_present, 
+                                     mqtt_connack_retcode_t* const retcode, mqtt_properties_t* const properties);
 
 /** \brief Deserialize a PUBLISH packet */
 bool mqtt_packet_deserialize_publish(input_stream_t* const stream, const uint8_t packet_flags, const uint32_t packet_length, mqtt_string_t* const topic,
                                      void* data, uint32_t* const length, uint8_t* const qos, bool* const retain, bool* const duplicate,
-                                     uint16_t* const packet_id);
+                                     uint16_t* const packet_id, mqtt_properties_t* const properties);
 
 /** \brief Deserialize a PUBACK packet */
-bool mqtt_packet_deserialize_puback(input_stream_t* const stream, uint16_t* const packet_id);
+bool mqtt_packet_deserialize_puback(input_stream_t* const stream, const uint32_t packet_length, uint16_t* const packet_id);
 
 /** \brief Deserialize a PUBREC packet */
-bool mqtt_packet_deserialize_pubrec(input_stream_t* const stream, uint16_t* const packet_id);
+bool mqtt_packet_deserialize_pubrec(input_stream_t* const stream, const uint32_t packet_length, uint16_t* const packet_id);
 
 /** \brief Deserialize a PUBREL packet */
-bool mqtt_packet_deserialize_pubrel(input_stream_t* const stream, uint16_t* const packet_id);
+bool mqtt_packet_deserialize_pubrel(input_stream_t* const stream, const uint32_t packet_length, uint16_t* const packet_id);
 
 /** \brief Deserialize a PUBCOMP packet */
-bool mqtt_packet_deserialize_pubcomp(input_stream_t* const stream, uint16_t* const packet_id);
+bool mqtt_packet_deserialize_pubcomp(input_stream_t* const stream, const uint32_t packet_length, uint16_t* const packet_id);
 
-/** \brief Deserialize a SUBSCRIBE packet */
-bool mqtt_packet_deserialize_subscribe(input_stream_t* const stream, mqtt_string_t* const topic, uint8_t* const qos,
-                                       uint16_t* const packet_id);
+/** \brief Deserialize a SUBSCRIBE packet, the MQTT 5.0 subscription options other than the QoS are given in options (can be NULL) */
+bool mqtt_packet_deserialize_subscribe(input_stream_t* const stream, const uint32_t packet_length, mqtt_string_t* const topic, uint8_t* const qos,
+                                       uint8_t* const options, uint16_t* const packet_id, mqtt_properties_t* const properties);
 
 /** \brief Deserialize a SUBACK packet */
-bool mqtt_packet_deserialize_suback(input_stream_t* const stream, uint8_t* const qos, uint16_t* const packet_id);
+bool mqtt_packet_deserialize_suback(input_stream_t* const stream, const uint32_t packet_length, uint8_t* const qos, uint16_t* const packet_id,
+                                    mqtt_properties_t* const properties);
 
 /** \brief Deserialize an UNSUBSCRIBE packet */
-bool mqtt_packet_deserialize_unsubscribe(input_stream_t* const stream, mqtt_string_t* const topic, uint16_t* const packet_id);
+bool mqtt_packet_deserialize_unsubscribe(input_stream_t* const stream, const uint32_t packet_length, mqtt_string_t* const topic, uint16_t* const packet_id,
+                                         mqtt_properties_t* const properties);
 
 /** \brief Deserialize an UNSUBACK packet */
-bool mqtt_packet_deserialize_unsuback(input_stream_t* const stream, uint16_t* const packet_id);
+bool mqtt_packet_deserialize_unsuback(input_stream_t* const stream, const uint32_t packet_length, uint16_t* const packet_id);
 
 /** \brief Deserialize a PINGREQ packet */
 bool mqtt_packet_deserialize_pingreq(input_stream_t* const stream, const uint32_t packet_length);
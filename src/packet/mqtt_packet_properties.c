@@ -0,0 +1,140 @@
+/*
+Copyright(c) 2016 Cedric Jimenez
+
+This file is part of lw-mqtt.
+
+lw-mqtt is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+lw-mqtt is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "mqtt_packet_properties.h"
+
+
+/** \brief Helper macro to declare a property which is stored in the mqtt_properties_t structure */
+#define MQTT_PROPERTY_STORED(id, type, name, flag) { (id), (type), (flag), offsetof(mqtt_properties_t, name) }
+
+/** \brief Helper macro to declare a property which is skipped on reception */
+#define MQTT_PROPERTY_SKIPPED(id, type) { (id), (type), 0u, 0u }
+
+
+/** \brief Property descriptors */
+const mqtt_property_descriptor_t mqtt_property_descriptors[MQTT_PROPERTY_DESCRIPTOR_COUNT] = {
+    MQTT_PROPERTY_STORED(MQTT_PROP_PAYLOAD_FORMAT_INDICATOR, MQTT_PROP_TYPE_BYTE, payload_format_indicator, MQTT_PROP_FLAG_PAYLOAD_FORMAT_INDICATOR),
+    MQTT_PROPERTY_STORED(MQTT_PROP_MESSAGE_EXPIRY_INTERVAL, MQTT_PROP_TYPE_FOUR_BYTE_INTEGER, message_expiry_interval, MQTT_PROP_FLAG_MESSAGE_EXPIRY_INTERVAL),
+    MQTT_PROPERTY_SKIPPED(MQTT_PROP_CONTENT_TYPE, MQTT_PROP_TYPE_STRING),
+    MQTT_PROPERTY_SKIPPED(MQTT_PROP_RESPONSE_TOPIC, MQTT_PROP_TYPE_STRING),
+    MQTT_PROPERTY_SKIPPED(MQTT_PROP_CORRELATION_DATA, MQTT_PROP_TYPE_BINARY),
+    MQTT_PROPERTY_STORED(MQTT_PROP_SUBSCRIPTION_IDENTIFIER, MQTT_PROP_TYPE_VARIABLE_INTEGER, subscription_identifier, MQTT_PROP_FLAG_SUBSCRIPTION_IDENTIFIER),
+    MQTT_PROPERTY_STORED(MQTT_PROP_SESSION_EXPIRY_INTERVAL, MQTT_PROP_TYPE_FOUR_BYTE_INTEGER, session_expiry_interval, MQTT_PROP_FLAG_SESSION_EXPIRY_INTERVAL),
+    MQTT_PROPERTY_SKIPPED(MQTT_PROP_ASSIGNED_CLIENT_IDENTIFIER, MQTT_PROP_TYPE_STRING),
+    MQTT_PROPERTY_STORED(MQTT_PROP_SERVER_KEEP_ALIVE, MQTT_PROP_TYPE_TWO_BYTE_INTEGER, server_keep_alive, MQTT_PROP_FLAG_SERVER_KEEP_ALIVE),
+    MQTT_PROPERTY_SKIPPED(MQTT_PROP_AUTHENTICATION_METHOD, MQTT_PROP_TYPE_STRING),
+    MQTT_PROPERTY_SKIPPED(MQTT_PROP_AUTHENTICATION_DATA, MQTT_PROP_TYPE_BINARY),
+    MQTT_PROPERTY_STORED(MQTT_PROP_REQUEST_PROBLEM_INFORMATION, MQTT_PROP_TYPE_BYTE, request_problem_information, MQTT_PROP_FLAG_REQUEST_PROBLEM_INFORMATION),
+    MQTT_PROPERTY_STORED(MQTT_PROP_WILL_DELAY_INTERVAL, MQTT_PROP_TYPE_FOUR_BYTE_INTEGER, will_delay_interval, MQTT_PROP_FLAG_WILL_DELAY_INTERVAL),
+    MQTT_PROPERTY_STORED(MQTT_PROP_REQUEST_RESPONSE_INFORMATION, MQTT_PROP_TYPE_BYTE, request_response_information, MQTT_PROP_FLAG_REQUEST_RESPONSE_INFORMATION),
+    MQTT_PROPERTY_SKIPPED(MQTT_PROP_RESPONSE_INFORMATION, MQTT_PROP_TYPE_STRING),
+    MQTT_PROPERTY_SKIPPED(MQTT_PROP_SERVER_REFERENCE, MQTT_PROP_TYPE_STRING),
+    MQTT_PROPERTY_SKIPPED(MQTT_PROP_REASON_STRING, MQTT_PROP_TYPE_STRING),
+    MQTT_PROPERTY_STORED(MQTT_PROP_RECEIVE_MAXIMUM, MQTT_PROP_TYPE_TWO_BYTE_INTEGER, receive_maximum, MQTT_PROP_FLAG_RECEIVE_MAXIMUM),
+    MQTT_PROPERTY_STORED(MQTT_PROP_TOPIC_ALIAS_MAXIMUM, MQTT_PROP_TYPE_TWO_BYTE_INTEGER, topic_alias_maximum, MQTT_PROP_FLAG_TOPIC_ALIAS_MAXIMUM),
+    MQTT_PROPERTY_STORED(MQTT_PROP_TOPIC_ALIAS, MQTT_PROP_TYPE_TWO_BYTE_INTEGER, topic_alias, MQTT_PROP_FLAG_TOPIC_ALIAS),
+    MQTT_PROPERTY_STORED(MQTT_PROP_MAXIMUM_QOS, MQTT_PROP_TYPE_BYTE, maximum_qos, MQTT_PROP_FLAG_MAXIMUM_QOS),
+    MQTT_PROPERTY_STORED(MQTT_PROP_RETAIN_AVAILABLE, MQTT_PROP_TYPE_BYTE, retain_available, MQTT_PROP_FLAG_RETAIN_AVAILABLE),
+    MQTT_PROPERTY_SKIPPED(MQTT_PROP_USER_PROPERTY, MQTT_PROP_TYPE_STRING_PAIR),
+    MQTT_PROPERTY_STORED(MQTT_PROP_MAXIMUM_PACKET_SIZE, MQTT_PROP_TYPE_FOUR_BYTE_INTEGER, maximum_packet_size, MQTT_PROP_FLAG_MAXIMUM_PACKET_SIZE),
+    MQTT_PROPERTY_STORED(MQTT_PROP_WILDCARD_SUBSCRIPTION_AVAILABLE, MQTT_PROP_TYPE_BYTE, wildcard_subscription_available, MQTT_PROP_FLAG_WILDCARD_SUBSCRIPTION_AVAILABLE),
+    MQTT_PROPERTY_STORED(MQTT_PROP_SUBSCRIPTION_IDENTIFIER_AVAILABLE, MQTT_PROP_TYPE_BYTE, subscription_identifier_available, MQTT_PROP_FLAG_SUBSCRIPTION_IDENTIFIER_AVAILABLE),
+    MQTT_PROPERTY_STORED(MQTT_PROP_SHARED_SUBSCRIPTION_AVAILABLE, MQTT_PROP_TYPE_BYTE, shared_subscription_available, MQTT_PROP_FLAG_SHARED_SUBSCRIPTION_AVAILABLE)
+};
+
+
+
+/** \brief Get the descriptor of a property from its identifier */
+const mqtt_property_descriptor_t* mqtt_packet_properties_get_descriptor(const uint8_t id)
+{
+    uint32_t i;
+    const mqtt_property_descriptor_t* descriptor = NULL;
+
+    /* Look for the property identifier */
+    for (i = 0u; (i < MQTT_PROPERTY_DESCRIPTOR_COUNT) && (descriptor == NULL); i++)
+    {
+        if ((uint8_t)mqtt_property_descriptors[i].id == id)
+        {
+            descriptor = &mqtt_property_descriptors[i];
+        }
+    }
+
+    return descriptor;
+}
+
+/** \brief Compute the size in bytes of the encoded properties without the property length field */
+uint32_t mqtt_packet_properties_compute_length(const mqtt_properties_t* const properties)
+{
+    uint32_t i;
+    uint32_t length = 0u;
+
+    /* Check params */
+    if (properties != NULL)
+    {
+        for (i = 0u; i < MQTT_PROPERTY_DESCRIPTOR_COUNT; i++)
+        {
+            const mqtt_property_descriptor_t* const descriptor = &mqtt_property_descriptors[i];
+            if ((properties->present & descriptor->flag) != 0u)
+            {
+                /* Identifier */
+                length += 1u;
+
+                /* Value */
+                switch (descriptor->type)
+                {
+                    case MQTT_PROP_TYPE_BYTE:
+                        length += sizeof(uint8_t);
+                        break;
+                    case MQTT_PROP_TYPE_TWO_BYTE_INTEGER:
+                        length += sizeof(uint16_t);
+                        break;
+                    case MQTT_PROP_TYPE_FOUR_BYTE_INTEGER:
+                        length += sizeof(uint32_t);
+                        break;
+                    case MQTT_PROP_TYPE_VARIABLE_INTEGER:
+                    {
+                        const uint32_t* const value = (const uint32_t*)((const uint8_t*)properties + descriptor->offset);
+                        length += mqtt_packet_variable_integer_size(*value);
+                        break;
+                    }
+                    default:
+                        /* Not stored */
+                        break;
+                }
+            }
+        }
+    }
+
+    return length;
+}
+
+/** \brief Compute the size in bytes of the encoded properties including the property length field */
+uint32_t mqtt_packet_properties_compute_encoded_size(const mqtt_properties_t* const properties)
+{
+    uint32_t size = 0u;
+
+    /* Check params */
+    if (properties != NULL)
+    {
+        const uint32_t length = mqtt_packet_properties_compute_length(properties);
+        size = mqtt_packet_variable_integer_size(length) + length;
+    }
+
+    return size;
+}
@@ -0,0 +1,84 @@
+/*
+Copyright(c) 2016 Cedric Jimenez
+
+This file is part of lw-mqtt.
+
+lw-mqtt is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+lw-mqtt is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MQTT_PACKET_PROPERTIES_H
+#define MQTT_PACKET_PROPERTIES_H
+
+#include "mqtt.h"
+#include "mqtt_packet_varint.h"
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/** \brief MQTT 5.0 property value types */
+typedef enum _mqtt_property_type_t
+{
+    MQTT_PROP_TYPE_BYTE = 0u,
+    MQTT_PROP_TYPE_TWO_BYTE_INTEGER = 1u,
+    MQTT_PROP_TYPE_FOUR_BYTE_INTEGER = 2u,
+    MQTT_PROP_TYPE_VARIABLE_INTEGER = 3u,
+    MQTT_PROP_TYPE_STRING = 4u,
+    MQTT_PROP_TYPE_BINARY = 5u,
+    MQTT_PROP_TYPE_STRING_PAIR = 6u
+} mqtt_property_type_t;
+
+/** \brief MQTT 5.0 property descriptor */
+typedef struct _mqtt_property_descriptor_t
+{
+    /** \brief Property identifier */
+    mqtt_property_id_t id;
+    /** \brief Value type */
+    mqtt_property_type_t type;
+    /** \brief Presence flag in the mqtt_properties_t structure (0 = property not stored) */
+    uint32_t flag;
+    /** \brief Offset of the value in the mqtt_properties_t structure */
+    size_t offset;
+} mqtt_property_descriptor_t;
+
+
+/** \brief Number of property descriptors */
+#define MQTT_PROPERTY_DESCRIPTOR_COUNT 27u
+
+/** \brief Property descriptors */
+extern const mqtt_property_descriptor_t mqtt_property_descriptors[MQTT_PROPERTY_DESCRIPTOR_COUNT];
+
+
+/** \brief Get the descriptor of a property from its identifier */
+const mqtt_property_descriptor_t* mqtt_packet_properties_get_descriptor(const uint8_t id);
+
+/** \brief Compute the size in bytes of the encoded properties without the property length field */
+uint32_t mqtt_packet_properties_compute_length(const mqtt_properties_t* const properties);
+
+/** \brief Compute the size in bytes of the encoded properties including the property length field */
+uint32_t mqtt_packet_properties_compute_encoded_size(const mqtt_properties_t* const properties);
+
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+
+
+
+#endif /* MQTT_PACKET_PROPERTIES_H */
@@ -19,10 +19,18 @@ along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "mqtt_error.h"
 #include "mqtt_packet_serialize.h"
+#include "mqtt_packet_properties.h"
+#include "mqtt_packet_varint.h"
+#include "buffer_stream.h"
 
 /** \brief Compute the length of the CONNECT packet */
 static uint32_t mqtt_packet_serialize_compute_connect_length(const mqtt_const_string_t* const client_id,
-                                                             const mqtt_const_credentials_t* const credentials, const mqtt_const_will_t* const will);
+                                                             const mqtt_const_credentials_t* const credentials, const mqtt_const_will_t* const will,
+                                                             const mqtt_properties_t* const properties);
+
+/** \brief Compute the remaining length of a PUBLISH packet */
+static uint32_t mqtt_packet_serialize_compute_publish_length(const mqtt_const_string_t* const topic, const uint32_t length, const uint8_t qos,
+                                                             const mqtt_properties_t* const properties);
 
 /** \brief Serialize a response packet with a packet id only */
 static bool mqtt_packet_serialize_packet_id_only(output_stream_t* const stream, const mqtt_control_packet_type_t type, const uint16_t packet_id);
@@ -36,12 +44,18 @@ static bool mqtt_packet_serialize_lenght(output_stream_t* const stream, const ui
 /** \brief Serialize a string */
 static bool mqtt_packet_serialize_string(output_stream_t* const stream, const mqtt_const_string_t* const mqtt_string);
 
+/** \brief Serialize the MQTT 5.0 properties */
+static bool mqtt_packet_serialize_properties(output_stream_t* const stream, const mqtt_properties_t* const properties);
+
+/** \brief Convert a MQTT 3.1.1 CONNACK return code into a MQTT 5.0 reason code */
+static uint8_t mqtt_packet_serialize_connack_reason_code(const mqtt_connack_retcode_t retcode);
+
 
 
 /** \brief Serialize a CONNECT packet */
 bool mqtt_packet_serialize_connect(output_stream_t* const stream, const mqtt_const_string_t* const client_id, 
                                    const mqtt_const_credentials_t* const credentials, const mqtt_const_will_t* const will, 
-                                   const bool clean_session, const uint16_t keepalive)
+                                   const bool clean_session, const uint16_t keepalive, const mqtt_properties_t* const properties)
 {
     bool ret = false;
 
@@ -55,7 +69,7 @@ bool mqtt_packet_serialize_connect(output_stream_t* const stream, const mqtt_con
     {
         const uint8_t packet_type = ((uint8_t)(MQTT_PKT_CONNECT) << 4u);
         uint8_t protocol_name[MQTT_PROTOCOL_NAME_SIZE + 1u] = MQTT_PROTOCOL_NAME;
-        const uint32_t remaining_length = mqtt_packet_serialize_compute_connect_length(client_id, credentials, will);
+        const uint32_t remaining_length = mqtt_packet_serialize_compute_connect_length(client_id, credentials, will, properties);
         const uint16_t keepalive_be = MQTT_BIG_ENDIAN_UINT16(keepalive);
         uint8_t connect_flags = 0;
 
@@ -71,7 +85,14 @@ bool mqtt_packet_serialize_connect(output_stream_t* const stream, const mqtt_con
         /* Protocol name */
         if (ret)
         {
-            protocol_name[MQTT_PROTOCOL_NAME_SIZE] = MQTT_PROTOCOL_LEVEL;
+            if (properties != NULL)
+            {
+                protocol_name[MQTT_PROTOCOL_NAME_SIZE] = MQTT_PROTOCOL_LEVEL_V5;
+            }
+            else
+            {
+                protocol_name[MQTT_PROTOCOL_NAME_SIZE] = MQTT_PROTOCOL_LEVEL_V311;
+            }
             ret = stream->writer(stream, protocol_name, sizeof(protocol_name));
         }
 
@@ -86,13 +107,13 @@ bool mqtt_packet_serialize_connect(output_stream_t* const stream, const mqtt_con
                     connect_flags |= MQTT_CONNECT_FLAG_PASSWORD;
                 }
             }
-            if (will != NULL)
+        }
+        if (will != NULL)
+        {
+            connect_flags |= (MQTT_CONNECT_FLAG_WILL_FLAG | (will->qos << MQTT_CONNECT_FLAG_WILL_QOS_POSITION));
+            if (will->retain)
             {
-                connect_flags |= (MQTT_CONNECT_FLAG_WILL_FLAG | (will->qos << MQTT_CONNECT_FLAG_WILL_QOS_POSITION));
-                if (will->retain)
-                {
-                    connect_flags |= MQTT_CONNECT_FLAG_WILL_RETAIN;
-                }
+                connect_flags |= MQTT_CONNECT_FLAG_WILL_RETAIN;
             }
         }
         if (clean_session)
@@ -110,6 +131,12 @@ bool mqtt_packet_serialize_connect(output_stream_t* const stream, const mqtt_con
             ret = stream->writer(stream, &keepalive_be, sizeof(keepalive_be));
         }
 
+        /* Properties */
+        if (ret && (properties != NULL))
+        {
+            ret = mqtt_packet_serialize_properties(stream, properties);
+        }
+
         /* Client Id */
         if (ret)
         {
@@ -119,8 +146,18 @@ bool mqtt_packet_serialize_connect(output_stream_t* const stream, const mqtt_con
         /* Will */
         if (ret && (will != NULL))
         {
+            /* Will properties => none */
+            if (properties != NULL)
+            {
+                const uint8_t will_properties_length = 0u;
+                ret = stream->writer(stream, &will_properties_length, sizeof(will_properties_length));
+            }
+
             /* Will topic */
-            ret = mqtt_packet_serialize_string(stream, &will->topic);
+            if (ret)
+            {
+                ret = mqtt_packet_serialize_string(stream, &will->topic);
+            }
 
             /* Will message */
             if (ret)
@@ -155,7 +192,8 @@ bool mqtt_packet_serialize_connect(output_stream_t* const stream, const mqtt_con
 }
 
 /** \brief Serialize a CONNACK packet */
-bool mqtt_packet_serialize_connack(output_stream_t* const stream, const bool session_present, const mqtt_connack_retcode_t retcode)
+bool mqtt_packet_serialize_connack(output_stream_t* const stream, const bool session_present, const mqtt_connack_retcode_t retcode,
+                                   const mqtt_properties_t* const properties)
 {
     bool ret = false;
 
@@ -163,13 +201,18 @@ bool mqtt_packet_serialize_connack(output_stream_t* const stream, const bool ses
     if (stream != NULL)
     {
         uint8_t payload[2u];
-        const uint8_t packet_header[] = { 
-                                            ((uint8_t)(MQTT_PKT_CONNACK) << 4u) ,
-                                            MQTT_CONNACK_PACKET_SIZE
-                                        };
+        const uint8_t packet_type = ((uint8_t)(MQTT_PKT_CONNACK) << 4u);
+        uint32_t remaining_length = MQTT_CONNACK_PACKET_SIZE;
 
-        /* Packet header */
-        ret = stream->writer(stream, &packet_header, sizeof(packet_header));
+        /* Packet type */
+        ret = stream->writer(stream, &packet_type, sizeof(packet_type));
+
+        /* Remaining length */
+        if (ret)
+        {
+            remaining_length += mqtt_packet_properties_compute_encoded_size(properties);
+            ret = mqtt_packet_serialize_lenght(stream, remaining_length);
+        }
 
         /* Payload */
         if (session_present)
@@ -180,11 +223,24 @@ bool mqtt_packet_serialize_connack(output_stream_t* const stream, const bool ses
         {
             payload[0u] = 0u;
         }
-        payload[1u] = (uint8_t)retcode;
+        if (properties != NULL)
+        {
+            payload[1u] = mqtt_packet_serialize_connack_reason_code(retcode);
+        }
+        else
+        {
+            payload[1u] = (uint8_t)retcode;
+        }
         if (ret)
         {
             ret = stream->writer(stream, &payload, sizeof(payload));
         }
+
+        /* Properties */
+        if (ret && (properties != NULL))
+        {
+            ret = mqtt_packet_serialize_properties(stream, properties);
+        }
     }
     else
     {
@@ -198,7 +254,7 @@ bool mqtt_packet_serialize_connack(output_stream_t* const stream, const bool ses
 /** \brief Serialize a PUBLISH packet */
 bool mqtt_packet_serialize_publish(output_stream_t* const stream, const mqtt_const_string_t* const topic, const void* data,
                                    const uint32_t length, const uint8_t qos, const bool retain, const bool duplicate,
-                                   const uint16_t packet_id)
+                                   const uint16_t packet_id, const mqtt_properties_t* const properties)
 {
     bool ret = false;
 
@@ -226,11 +282,7 @@ bool mqtt_packet_serialize_publish(output_stream_t* const stream, const mqtt_con
         /* Remaining length */
         if (ret)
         {
-            remaining_length = topic->size + 2u + length;
-            if (qos > 0u)
-            {
-                remaining_length += sizeof(packet_id);
-            }
+            remaining_length = mqtt_packet_serialize_compute_publish_length(topic, length, qos, properties);
             ret = mqtt_packet_serialize_lenght(stream, remaining_length);
         }
 
@@ -247,6 +299,12 @@ bool mqtt_packet_serialize_publish(output_stream_t* const stream, const mqtt_con
             ret = stream->writer(stream, &packet_id_be, sizeof(packet_id_be));
         }
 
+        /* Properties */
+        if (ret && (properties != NULL))
+        {
+            ret = mqtt_packet_serialize_properties(stream, properties);
+        }
+
         /* Data */
         if ((ret) && (length > 0u))
         {
@@ -290,9 +348,9 @@ bool mqtt_packet_serialize_pubcomp(output_stream_t* const stream, const uint16_t
     return ret;
 }
 
-/** \brief Serialize a SUBSCRIBE packet */
+/** \brief Serialize a SUBSCRIBE packet, with MQTT 5.0 the QoS can be combined with the subscription options (MQTT_SUBSCRIBE_OPTION_*) */
 bool mqtt_packet_serialize_subscribe(output_stream_t* const stream, const mqtt_const_string_t* const topic, const uint8_t qos,
-                                     const uint16_t packet_id)
+                                     const uint16_t packet_id, const mqtt_properties_t* const properties)
 {
     bool ret = false;
 
@@ -300,7 +358,8 @@ bool mqtt_packet_serialize_subscribe(output_stream_t* const stream, const mqtt_c
     if ((stream != NULL) &&
         (topic != NULL) &&
         (topic->str != NULL) &&
-        (qos <= MQTT_CFG_MAX_QOS_LEVEL))
+        ((qos & MQTT_SUBSCRIBE_OPTION_QOS) <= MQTT_CFG_MAX_QOS_LEVEL) &&
+        ((properties != NULL) || (qos <= MQTT_CFG_MAX_QOS_LEVEL)))
     {
         uint32_t remaining_length = MQTT_SUBSCRIBE_PACKET_MIN_SIZE;
         uint8_t packet_type = ((uint8_t)(MQTT_PKT_SUBSCRIBE) << 4u) | MQTT_SUB_UNSUBSCRIBE_HEADER_VALUE;
@@ -311,7 +370,7 @@ bool mqtt_packet_serialize_subscribe(output_stream_t* const stream, const mqtt_c
         /* Remaining length */
         if (ret)
         {
-            remaining_length += topic->size + 2u;
+            remaining_length += topic->size + 2u + mqtt_packet_properties_compute_encoded_size(properties);
             ret = mqtt_packet_serialize_lenght(stream, remaining_length);
         }
 
@@ -322,6 +381,12 @@ bool mqtt_packet_serialize_subscribe(output_stream_t* const stream, const mqtt_c
             ret = stream->writer(stream, &packet_id_be, sizeof(packet_id_be));
         }
 
+        /* Properties */
+        if (ret && (properties != NULL))
+        {
+            ret = mqtt_packet_serialize_properties(stream, properties);
+        }
+
         /* Topic */
         if (ret)
         {
@@ -344,21 +409,25 @@ bool mqtt_packet_serialize_subscribe(output_stream_t* const stream, const mqtt_c
 }
 
 /** \brief Serialize a SUBACK packet */
-bool mqtt_packet_serialize_suback(output_stream_t* const stream, const uint8_t qos, const uint16_t packet_id)
+bool mqtt_packet_serialize_suback(output_stream_t* const stream, const uint8_t qos, const uint16_t packet_id, const mqtt_properties_t* const properties)
 {
     bool ret = false;
 
     /* Check params */
     if ((stream != NULL) &&
-        ((qos <= MQTT_CFG_MAX_QOS_LEVEL) || (qos == MQTT_FAILURE_QOS)) )
+        ((qos <= MQTT_CFG_MAX_QOS_LEVEL) || (qos >= MQTT_FAILURE_QOS)) )
     {
-        const uint8_t packet_header[] = {
-            ((uint8_t)(MQTT_PKT_SUBACK) << 4u) ,
-            MQTT_SUBACK_PACKET_SIZE
-        };
+        const uint8_t packet_type = ((uint8_t)(MQTT_PKT_SUBACK) << 4u);
 
-        /* Packet header */
-        ret = stream->writer(stream, &packet_header, sizeof(packet_header));
+        /* Packet type */
+        ret = stream->writer(stream, &packet_type, sizeof(packet_type));
+
+        /* Remaining length */
+        if (ret)
+        {
+            const uint32_t remaining_length = MQTT_SUBACK_PACKET_SIZE + mqtt_packet_properties_compute_encoded_size(properties);
+            ret = mqtt_packet_serialize_lenght(stream, remaining_length);
+        }
 
         /* Packet id */
         if (ret)
@@ -367,6 +436,12 @@ bool mqtt_packet_serialize_suback(output_stream_t* const stream, const uint8_t q
             ret = stream->writer(stream, &packet_id_be, sizeof(packet_id_be));
         }
 
+        /* Properties */
+        if (ret && (properties != NULL))
+        {
+            ret = mqtt_packet_serialize_properties(stream, properties);
+        }
+
         /* QoS */
         if (ret)
         {
@@ -383,7 +458,8 @@ bool mqtt_packet_serialize_suback(output_stream_t* const stream, const uint8_t q
 }
 
 /** \brief Serialize an UNSUBSCRIBE packet */
-bool mqtt_packet_serialize_unsubscribe(output_stream_t* const stream, const mqtt_const_string_t* const topic, const uint16_t packet_id)
+bool mqtt_packet_serialize_unsubscribe(output_stream_t* const stream, const mqtt_const_string_t* const topic, const uint16_t packet_id,
+                                       const mqtt_properties_t* const properties)
 {
     bool ret = false;
 
@@ -401,7 +477,7 @@ bool mqtt_packet_serialize_unsubscribe(output_stream_t* const stream, const mqtt
         /* Remaining length */
         if (ret)
         {
-            remaining_length += topic->size + 2u;
+            remaining_length += topic->size + 2u + mqtt_packet_properties_compute_encoded_size(properties);
             ret = mqtt_packet_serialize_lenght(stream, remaining_length);
         }
 
@@ -412,6 +488,12 @@ bool mqtt_packet_serialize_unsubscribe(output_stream_t* const stream, const mqtt
             ret = stream->writer(stream, &packet_id_be, sizeof(packet_id_be));
         }
 
+        /* Properties */
+        if (ret && (properties != NULL))
+        {
+            ret = mqtt_packet_serialize_properties(stream, properties);
+        }
+
         /* Topic */
         if (ret)
         {
@@ -428,9 +510,57 @@ bool mqtt_packet_serialize_unsubscribe(output_stream_t* const stream, const mqtt
 }
 
 /** \brief Serialize an UNSUBACK packet */
-bool mqtt_packet_serialize_unsuback(output_stream_t* const stream, const uint16_t packet_id)
+bool mqtt_packet_serialize_unsuback(output_stream_t* const stream, const uint16_t packet_id, const uint8_t reason_code, 
+                                    const mqtt_properties_t* const properties)
 {
-    const bool ret = mqtt_packet_serialize_packet_id_only(stream, MQTT_PKT_UNSUBACK, packet_id);
+    bool ret = false;
+
+    if (properties == NULL)
+    {
+        /* MQTT 3.1.1 : packet id only */
+        ret = mqtt_packet_serialize_packet_id_only(stream, MQTT_PKT_UNSUBACK, packet_id);
+    }
+    else if (stream != NULL)
+    {
+        /* MQTT 5.0 : packet id + properties + reason code */
+        const uint8_t packet_type = ((uint8_t)(MQTT_PKT_UNSUBACK) << 4u);
+
+        /* Packet type */
+        ret = stream->writer(stream, &packet_type, sizeof(packet_type));
+
+        /* Remaining length */
+        if (ret)
+        {
+            const uint32_t remaining_length = MQTT_PACKET_ID_ONLY_PACKET_SIZE + mqtt_packet_properties_compute_encoded_size(properties) + 
+                                              sizeof(reason_code);
+            ret = mqtt_packet_serialize_lenght(stream, remaining_length);
+        }
+
+        /* Packet id */
+        if (ret)
+        {
+            const uint16_t packet_id_be = MQTT_BIG_ENDIAN_UINT16(packet_id);
+            ret = stream->writer(stream, &packet_id_be, sizeof(packet_id_be));
+        }
+
+        /* Properties */
+        if (ret)
+        {
+            ret = mqtt_packet_serialize_properties(stream, properties);
+        }
+
+        /* Reason code */
+        if (ret)
+        {
+            ret = stream->writer(stream, &reason_code, sizeof(reason_code));
+        }
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
     return ret;
 }
 
@@ -455,10 +585,175 @@ bool mqtt_packet_serialize_disconnect(output_stream_t* const stream)
     return ret;
 }
 
+/** \brief Pre-encode a PUBLISH template */
+bool mqtt_packet_serialize_publish_template(mqtt_publish_template_t* const publish_template, const mqtt_const_string_t* const topic, 
+                                            const uint8_t qos, const bool retain, const mqtt_properties_t* const properties)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((publish_template != NULL) &&
+        (topic != NULL) &&
+        (topic->str != NULL) &&
+        (topic->size <= MQTT_PUBLISH_TEMPLATE_MAX_TOPIC_LENGTH) &&
+        (qos <= MQTT_CFG_MAX_QOS_LEVEL))
+    {
+        output_stream_t stream;
+
+        /* Packet type */
+        publish_template->packet_type = ((uint8_t)(MQTT_PKT_PUBLISH) << 4u) | (uint8_t)(qos << MQTT_PUBLISH_FLAG_QOS_POSITION);
+        if (retain)
+        {
+            publish_template->packet_type |= MQTT_PUBLISH_FLAG_RETAIN;
+        }
+        publish_template->qos = qos;
+        publish_template->has_properties = (properties != NULL);
+
+        /* Variable header, the fixed header is encoded in front of it at each publish */
+        ret = buffer_stream_output_from_buffer(&stream, &publish_template->buffer[MQTT_PUBLISH_TEMPLATE_FIXED_HEADER_SIZE], 
+                                               MQTT_PUBLISH_TEMPLATE_MAX_VARIABLE_HEADER_SIZE);
+        if (ret)
+        {
+            ret = mqtt_packet_serialize_string(&stream, topic);
+        }
+        publish_template->packet_id_offset = 0u;
+        if (ret && (qos > 0u))
+        {
+            const uint16_t packet_id_placeholder = 0u;
+            publish_template->packet_id_offset = MQTT_PUBLISH_TEMPLATE_FIXED_HEADER_SIZE + (uint32_t)stream.written;
+            ret = stream.writer(&stream, &packet_id_placeholder, sizeof(packet_id_placeholder));
+        }
+        if (ret && (properties != NULL))
+        {
+            ret = mqtt_packet_serialize_properties(&stream, properties);
+        }
+        if (ret)
+        {
+            publish_template->variable_header_size = (uint32_t)stream.written;
+        }
+        else
+        {
+            mqtt_errno_set(MQTT_ERR_BUFFER_TOO_SMALL);
+        }
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Serialize a PUBLISH packet from a pre-encoded template */
+bool mqtt_packet_serialize_publish_from_template(output_stream_t* const stream, mqtt_publish_template_t* const publish_template, 
+                                                 const void* data, const uint32_t length, const uint16_t packet_id)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((stream != NULL) &&
+        (publish_template != NULL) &&
+        (!((data == NULL) && (length != 0u))))
+    {
+        uint8_t* const buffer = publish_template->buffer;
+        uint8_t encoded_length[MQTT_MAXIMUM_VARIABLE_INTEGER_SIZE];
+        const uint32_t remaining_length = publish_template->variable_header_size + length;
+        const uint8_t length_size = mqtt_packet_variable_integer_encode(encoded_length, remaining_length);
+        if (length_size != 0u)
+        {
+            /* Patch the fixed header right in front of the variable header */
+            const uint32_t start = MQTT_PUBLISH_TEMPLATE_FIXED_HEADER_SIZE - 1u - length_size;
+            uint32_t size = 1u + length_size + publish_template->variable_header_size;
+            buffer[start] = publish_template->packet_type;
+            (void)memcpy(&buffer[start + 1u], encoded_length, length_size);
+
+            /* Patch the packet id */
+            if (publish_template->packet_id_offset != 0u)
+            {
+                buffer[publish_template->packet_id_offset] = (uint8_t)(packet_id >> 8u);
+                buffer[publish_template->packet_id_offset + 1u] = (uint8_t)(packet_id & 0xFFu);
+            }
+
+            /* Append small payloads in place to send the whole packet at once */
+            if (length <= MQTT_PUBLISH_TEMPLATE_MAX_INLINE_PAYLOAD)
+            {
+                if (length != 0u)
+                {
+                    (void)memcpy(&buffer[start + size], data, length);
+                    size += length;
+                }
+                ret = stream->writer(stream, &buffer[start], size);
+            }
+            else
+            {
+                ret = stream->writer(stream, &buffer[start], size);
+                if (ret)
+                {
+                    ret = stream->writer(stream, data, length);
+                }
+            }
+        }
+        else
+        {
+            mqtt_errno_set(MQTT_ERR_INVALID_PACKET_SIZE);
+        }
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Compute the size in bytes of a whole PUBLISH packet built from a template */
+uint32_t mqtt_packet_serialize_publish_template_size(const mqtt_publish_template_t* const publish_template, const uint32_t length)
+{
+    uint32_t size = 0u;
+
+    /* Check params */
+    if (publish_template != NULL)
+    {
+        const uint32_t remaining_length = publish_template->variable_header_size + length;
+        size = 1u + mqtt_packet_variable_integer_size(remaining_length) + remaining_length;
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return size;
+}
+
+/** \brief Compute the size in bytes of a whole PUBLISH packet */
+uint32_t mqtt_packet_serialize_publish_size(const mqtt_const_string_t* const topic, const uint32_t length, const uint8_t qos,
+                                            const mqtt_properties_t* const properties)
+{
+    uint32_t size = 0u;
+
+    /* Check params */
+    if (topic != NULL)
+    {
+        const uint32_t remaining_length = mqtt_packet_serialize_compute_publish_length(topic, length, qos, properties);
+        size = 1u + mqtt_packet_variable_integer_size(remaining_length) + remaining_length;
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return size;
+}
+
 
 /** \brief Compute the length of the CONNECT packet */
 static uint32_t mqtt_packet_serialize_compute_connect_length(const mqtt_const_string_t* const client_id,
-                                                             const mqtt_const_credentials_t* const credentials, const mqtt_const_will_t* const will)
+                                                             const mqtt_const_credentials_t* const credentials, const mqtt_const_will_t* const will,
+                                                             const mqtt_properties_t* const properties)
 {
     uint32_t length = MQTT_CONNECT_PACKET_MIN_SIZE;
 
@@ -468,8 +763,14 @@ static uint32_t mqtt_packet_serialize_compute_connect_length(const mqtt_const_st
     */
 
     length += MQTT_MIN_ENCODED_STRING_SIZE + client_id->size;
+    length += mqtt_packet_properties_compute_encoded_size(properties);
     if (will != NULL)
     {
+        if (properties != NULL)
+        {
+            /* Empty will properties */
+            length += 1u;
+        }
         length += MQTT_MIN_ENCODED_STRING_SIZE + will->topic.size;
         length += MQTT_MIN_ENCODED_STRING_SIZE + will->message.size;
     }
@@ -485,6 +786,26 @@ static uint32_t mqtt_packet_serialize_compute_connect_length(const mqtt_const_st
     return length;
 }
 
+/** \brief Compute the remaining length of a PUBLISH packet */
+static uint32_t mqtt_packet_serialize_compute_publish_length(const mqtt_const_string_t* const topic, const uint32_t length, const uint8_t qos,
+                                                             const mqtt_properties_t* const properties)
+{
+    uint32_t remaining_length = MQTT_MIN_ENCODED_STRING_SIZE + topic->size + length;
+
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    if (qos > 0u)
+    {
+        remaining_length += sizeof(uint16_t);
+    }
+    remaining_length += mqtt_packet_properties_compute_encoded_size(properties);
+
+    return remaining_length;
+}
+
 /** \brief Serialize a response packet with a packet id only */
 static bool mqtt_packet_serialize_packet_id_only(output_stream_t* const stream, const mqtt_control_packet_type_t type, const uint16_t packet_id)
 {
@@ -551,33 +872,22 @@ static bool mqtt_packet_serialize_lenght(output_stream_t* const stream, const ui
     parameters are already checked.
     */
 
-    /* Encode the length */
-    uint8_t index = 0u;
-    uint32_t len = length;
-    uint8_t current_byte;
-    uint8_t encoded_length[4u];
-    do
+    uint8_t encoded_length[MQTT_MAXIMUM_VARIABLE_INTEGER_SIZE];
+    const uint8_t size = mqtt_packet_variable_integer_encode(encoded_length, length);
+    if (size != 0u)
     {
-        current_byte = (len & 0xFFu);
-        if (current_byte > 0x7Fu)
-        {
-            encoded_length[index] = current_byte & 0x7F;
-        }
-        else
-        {
-            encoded_length[index] = current_byte;
-        }
-        index++;
-        len = len >> 7u;
+        /* Write to output stream */
+        ret = stream->writer(stream, encoded_length, size);
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PACKET_SIZE);
     }
-    while(len > 0u);
-
-    /* Write to output stream */
-    ret = stream->writer(stream, encoded_length, index);
 
     return ret;
 }
 
+
 /** \brief Serialize a string */
 static bool mqtt_packet_serialize_string(output_stream_t* const stream, const mqtt_const_string_t* const mqtt_string)
 {
@@ -600,3 +910,101 @@ static bool mqtt_packet_serialize_string(output_stream_t* const stream, const mq
 
     return ret;
 }
+
+/** \brief Serialize the MQTT 5.0 properties */
+static bool mqtt_packet_serialize_properties(output_stream_t* const stream, const mqtt_properties_t* const properties)
+{
+    bool ret = false;
+    uint32_t i;
+
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    /* Properties length */
+    ret = mqtt_packet_serialize_lenght(stream, mqtt_packet_properties_compute_length(properties));
+
+    /* Properties */
+    for (i = 0u; ret && (i < MQTT_PROPERTY_DESCRIPTOR_COUNT); i++)
+    {
+        const mqtt_property_descriptor_t* const descriptor = &mqtt_property_descriptors[i];
+        if ((properties->present & descriptor->flag) != 0u)
+        {
+            const uint8_t id = (uint8_t)descriptor->id;
+            const void* const value = (const void*)((const uint8_t*)properties + descriptor->offset);
+
+            /* Identifier */
+            ret = stream->writer(stream, &id, sizeof(id));
+
+            /* Value */
+            if (ret)
+            {
+                switch (descriptor->type)
+                {
+                    case MQTT_PROP_TYPE_BYTE:
+                    {
+                        ret = stream->writer(stream, value, sizeof(uint8_t));
+                        break;
+                    }
+                    case MQTT_PROP_TYPE_TWO_BYTE_INTEGER:
+                    {
+                        const uint16_t value_be = MQTT_BIG_ENDIAN_UINT16(*((const uint16_t*)value));
+                        ret = stream->writer(stream, &value_be, sizeof(value_be));
+                        break;
+                    }
+                    case MQTT_PROP_TYPE_FOUR_BYTE_INTEGER:
+                    {
+                        const uint32_t value_be = MQTT_BIG_ENDIAN_UINT32(*((const uint32_t*)value));
+                        ret = stream->writer(stream, &value_be, sizeof(value_be));
+                        break;
+                    }
+                    case MQTT_PROP_TYPE_VARIABLE_INTEGER:
+                    {
+                        ret = mqtt_packet_serialize_lenght(stream, *((const uint32_t*)value));
+                        break;
+                    }
+                    default:
+                    {
+                        /* Not stored */
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    return ret;
+}
+
+/** \brief Convert a MQTT 3.1.1 CONNACK return code into a MQTT 5.0 reason code */
+static uint8_t mqtt_packet_serialize_connack_reason_code(const mqtt_connack_retcode_t retcode)
+{
+    uint8_t reason_code;
+
+    switch (retcode)
+    {
+        case MQTT_CONNACK_RET_ACCEPTED:
+            reason_code = MQTT_REASON_SUCCESS;
+            break;
+        case MQTT_CONNACK_RET_REFUSED_PROTOCOL:
+            reason_code = MQTT_REASON_UNSUPPORTED_PROTOCOL_VERSION;
+            break;
+        case MQTT_CONNACK_RET_REFUSED_CLIENT_ID:
+            reason_code = MQTT_REASON_CLIENT_ID_NOT_VALID;
+            break;
+        case MQTT_CONNACK_RET_REFUSED_BAD_CREDENTIALS:
+            reason_code = MQTT_REASON_BAD_USERNAME_OR_PASSWORD;
+            break;
+        case MQTT_CONNACK_RET_REFUSED_NOT_AUTHORIZED:
+            reason_code = MQTT_REASON_NOT_AUTHORIZED;
+            break;
+        case MQTT_CONNACK_RET_REFUSED_SERVER_UNAVAILABLE:
+            /* Fall throught */
+        default:
+            reason_code = MQTT_REASON_SERVER_UNAVAILABLE;
+            break;
+    }
+
+    return reason_code;
+}
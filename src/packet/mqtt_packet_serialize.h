@@ -30,18 +30,45 @@ extern "C"
 #endif
 
 
+/** \brief Size in bytes reserved at the beginning of a PUBLISH template for the fixed header */
+#define MQTT_PUBLISH_TEMPLATE_FIXED_HEADER_SIZE     (1u + MQTT_MAXIMUM_VARIABLE_INTEGER_SIZE)
+
+/** \brief Maximum size in bytes of the variable header of a PUBLISH template :
+           => topic + packet id + properties length (properties are limited to the scalar ones)
+*/
+#define MQTT_PUBLISH_TEMPLATE_MAX_VARIABLE_HEADER_SIZE  (MQTT_MIN_ENCODED_STRING_SIZE + MQTT_PUBLISH_TEMPLATE_MAX_TOPIC_LENGTH + 2u + 64u)
+
+/** \brief Pre-encoded PUBLISH packet for a given topic, QoS and retain flag */
+typedef struct _mqtt_publish_template_t
+{
+    /** \brief Pre-encoded packet : room for the fixed header, then the variable header and the inline payload */
+    uint8_t buffer[MQTT_PUBLISH_TEMPLATE_FIXED_HEADER_SIZE + MQTT_PUBLISH_TEMPLATE_MAX_VARIABLE_HEADER_SIZE + MQTT_PUBLISH_TEMPLATE_MAX_INLINE_PAYLOAD];
+    /** \brief Size in bytes of the variable header */
+    uint32_t variable_header_size;
+    /** \brief Offset of the packet id in the buffer, 0 if QoS is 0 */
+    uint32_t packet_id_offset;
+    /** \brief Packet type and flags */
+    uint8_t packet_type;
+    /** \brief QoS */
+    uint8_t qos;
+    /** \brief Indicate if the template has been encoded with MQTT 5.0 properties */
+    bool has_properties;
+} mqtt_publish_template_t;
+
+
 /** \brief Serialize a CONNECT packet */
 bool mqtt_packet_serialize_connect(output_stream_t* const stream, const mqtt_const_string_t* const client_id,
                                    const mqtt_const_credentials_t* const credentials, const mqtt_const_will_t* const will,
-                                   const bool clean_session, const uint16_t keepalive);
+                                   const bool clean_session, const uint16_t keepalive, const mqtt_properties_t* const properties);
 
 /** \brief Serialize a CONNACK packet */
-bool mqtt_packet_serialize_connack(output_stream_t* const stream, const bool session_present, const mqtt_connack_retcode_t retcode);
+bool mqtt_packet_serialize_connack(output_stream_t* const stream, const bool session_present, const mqtt_connack_retcode_t retcode,
+                                   const mqtt_properties_t* const properties);
 
 /** \brief Serialize a PUBLISH packet */
 bool mqtt_packet_serialize_publish(output_stream_t* const stream, const mqtt_const_string_t* const topic, const void* data, 
                                    const uint32_t length, const uint8_t qos, const bool retain, const bool duplicate,
-                                   const uint16_t packet_id);
+                                   const uint16_t packet_id, const mqtt_properties_t* const properties);
 
 /** \brief Serialize a PUBACK packet */
 bool mqtt_packet_serialize_puback(output_stream_t* const stream, const uint16_t packet_id);
@@ -55,18 +82,20 @@ bool mqtt_packet_serialize_pubrel(output_stream_t* const stream, const uint16_t
 /** \brief Serialize a PUBCOMP packet */
 bool mqtt_packet_serialize_pubcomp(output_stream_t* const stream, const uint16_t packet_id);
 
-/** \brief Serialize a SUBSCRIBE packet */
+/** \brief Serialize a SUBSCRIBE packet, with MQTT 5.0 the QoS can be combined with the subscription options (MQTT_SUBSCRIBE_OPTION_*) */
 bool mqtt_packet_serialize_subscribe(output_stream_t* const stream, const mqtt_const_string_t* const topic, const uint8_t qos,
-                                     const uint16_t packet_id);
+                                     const uint16_t packet_id, const mqtt_properties_t* const properties);
 
 /** \brief Serialize a SUBACK packet */
-bool mqtt_packet_serialize_suback(output_stream_t* const stream, const uint8_t qos, const uint16_t packet_id);
+bool mqtt_packet_serialize_suback(output_stream_t* const stream, const uint8_t qos, const uint16_t packet_id, const mqtt_properties_t* const properties);
 
 /** \brief Serialize an UNSUBSCRIBE packet */
-bool mqtt_packet_serialize_unsubscribe(output_stream_t* const stream, const mqtt_const_string_t* const topic, const uint16_t packet_id);
+bool mqtt_packet_serialize_unsubscribe(output_stream_t* const stream, const mqtt_const_string_t* const topic, const uint16_t packet_id,
+                                       const mqtt_properties_t* const properties);
 
 /** \brief Serialize an UNSUBACK packet */
-bool mqtt_packet_serialize_unsuback(output_stream_t* const stream, const uint16_t packet_id);
+bool mqtt_packet_serialize_unsuback(output_stream_t* const stream, const uint16_t packet_id, const uint8_t reason_code, 
+                                    const mqtt_properties_t* const properties);
 
 /** \brief Serialize a PINGREQ packet */
 bool mqtt_packet_serialize_pingreq(output_stream_t* const stream);
@@ -77,6 +106,21 @@ bool mqtt_packet_serialize_pingresp(output_stream_t* const stream);
 /** \brief Serialize a DISCONNECT packet */
 bool mqtt_packet_serialize_disconnect(output_stream_t* const stream);
 
+/** \brief Pre-encode a PUBLISH template */
+bool mqtt_packet_serialize_publish_template(mqtt_publish_template_t* const publish_template, const mqtt_const_string_t* const topic, 
+                                            const uint8_t qos, const bool retain, const mqtt_properties_t* const properties);
+
+/** \brief Serialize a PUBLISH packet from a pre-encoded template */
+bool mqtt_packet_serialize_publish_from_template(output_stream_t* const stream, mqtt_publish_template_t* const publish_template, 
+                                                 const void* data, const uint32_t length, const uint16_t packet_id);
+
+/** \brief Compute the size in bytes of a whole PUBLISH packet built from a template */
+uint32_t mqtt_packet_serialize_publish_template_size(const mqtt_publish_template_t* const publish_template, const uint32_t length);
+
+/** \brief Compute the size in bytes of a whole PUBLISH packet */
+uint32_t mqtt_packet_serialize_publish_size(const mqtt_const_string_t* const topic, const uint32_t length, const uint8_t qos,
+                                            const mqtt_properties_t* const properties);
+
 
 
 #ifdef __cplusplus
@@ -0,0 +1,89 @@
+/*
+Copyright(c) 2016 Cedric Jimenez
+
+This file is part of lw-mqtt.
+
+lw-mqtt is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+lw-mqtt is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "mqtt_error.h"
+#include "mqtt_packet_varint.h"
+
+
+/* The continuation flags of the encoded bytes are turned into 0/1 values and combined
+   with arithmetic instead of looping on the bytes so that the cost of encoding and
+   decoding does not depend on the value */
+
+
+/** \brief Compute the size in bytes of an encoded variable byte integer */
+uint32_t mqtt_packet_variable_integer_size(const uint32_t value)
+{
+    return (1u + (uint32_t)(value >= 0x80u) + (uint32_t)(value >= 0x4000u) + (uint32_t)(value >= 0x200000u));
+}
+
+/** \brief Encode a variable byte integer into a fixed size scratch area
+           => returns the number of bytes used, 0 if the value is too big */
+uint8_t mqtt_packet_variable_integer_encode(uint8_t encoded[MQTT_MAXIMUM_VARIABLE_INTEGER_SIZE], const uint32_t value)
+{
+    uint8_t size = 0u;
+
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    if (value <= MQTT_MAXIMUM_VARIABLE_INTEGER)
+    {
+        /* 7 bits per byte, least significant group first */
+        size = (uint8_t)mqtt_packet_variable_integer_size(value);
+        encoded[0u] = (uint8_t)((value & 0x7Fu) | ((uint32_t)(size > 1u) << 7u));
+        encoded[1u] = (uint8_t)(((value >> 7u) & 0x7Fu) | ((uint32_t)(size > 2u) << 7u));
+        encoded[2u] = (uint8_t)(((value >> 14u) & 0x7Fu) | ((uint32_t)(size > 3u) << 7u));
+        encoded[3u] = (uint8_t)((value >> 21u) & 0x7Fu);
+    }
+
+    return size;
+}
+
+/** \brief Decode a variable byte integer from a fixed size window (unused bytes must be set to 0)
+           => returns the number of bytes used, 0 if the encoding is longer than 4 bytes */
+uint8_t mqtt_packet_variable_integer_decode(const uint8_t encoded[MQTT_MAXIMUM_VARIABLE_INTEGER_SIZE], uint32_t* const value)
+{
+    uint8_t size = 0u;
+
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    /* Byte n is part of the value only if all the previous bytes have the continuation flag */
+    const uint32_t next1 = ((uint32_t)encoded[0u] >> 7u);
+    const uint32_t next2 = next1 & ((uint32_t)encoded[1u] >> 7u);
+    const uint32_t next3 = next2 & ((uint32_t)encoded[2u] >> 7u);
+    const uint32_t next4 = next3 & ((uint32_t)encoded[3u] >> 7u);
+    if (next4 == 0u)
+    {
+        (*value) = ((uint32_t)encoded[0u] & 0x7Fu) |
+                   ((((uint32_t)encoded[1u] & 0x7Fu) << 7u) & (0u - next1)) |
+                   ((((uint32_t)encoded[2u] & 0x7Fu) << 14u) & (0u - next2)) |
+                   ((((uint32_t)encoded[3u] & 0x7Fu) << 21u) & (0u - next3));
+        size = (uint8_t)(1u + next1 + next2 + next3);
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PACKET_SIZE);
+    }
+
+    return size;
+}
@@ -0,0 +1,52 @@
+/*
+Copyright(c) 2016 Cedric Jimenez
+
+This file is part of lw-mqtt.
+
+lw-mqtt is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+lw-mqtt is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MQTT_PACKET_VARINT_H
+#define MQTT_PACKET_VARINT_H
+
+#include "mqtt.h"
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/** \brief Compute the size in bytes of an encoded variable byte integer */
+uint32_t mqtt_packet_variable_integer_size(const uint32_t value);
+
+/** \brief Encode a variable byte integer into a fixed size scratch area
+           => returns the number of bytes used, 0 if the value is too big */
+uint8_t mqtt_packet_variable_integer_encode(uint8_t encoded[MQTT_MAXIMUM_VARIABLE_INTEGER_SIZE], const uint32_t value);
+
+/** \brief Decode a variable byte integer from a fixed size window (unused bytes must be set to 0)
+           => returns the number of bytes used, 0 if the encoding is longer than 4 bytes */
+uint8_t mqtt_packet_variable_integer_decode(const uint8_t encoded[MQTT_MAXIMUM_VARIABLE_INTEGER_SIZE], uint32_t* const value);
+
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+
+
+
+#endif /* MQTT_PACKET_VARINT_H */
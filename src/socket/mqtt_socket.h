@@ -29,6 +29,47 @@ extern "C"
 #endif /* __cplusplus */
 
 
+/** \brief Prefix of an address designating a Unix domain socket instead of an IPv4 address (ex: unix:/run/mqtt.sock) */
+#define MQTT_SOCKET_UNIX_SCHEME     "unix:"
+
+
+/** \brief Socket tuning options, a zero value keeps the system default */
+typedef struct _mqtt_socket_options_t
+{
+    /** \brief Disable the Nagle algorithm (TCP_NODELAY) */
+    bool no_delay;
+    /** \brief Disable the delayed acknowledgements (TCP_QUICKACK, the kernel may enable them again later) */
+    bool quick_ack;
+    /** \brief Send buffer size in bytes (SO_SNDBUF) */
+    uint32_t send_buffer_size;
+    /** \brief Receive buffer size in bytes (SO_RCVBUF) */
+    uint32_t receive_buffer_size;
+    /** \brief Busy polling time in us when receiving (SO_BUSY_POLL) */
+    uint32_t busy_poll;
+    /** \brief Enable the TCP keepalive probes (SO_KEEPALIVE) */
+    bool keepalive;
+    /** \brief Idle time in s before the first keepalive probe (TCP_KEEPIDLE) */
+    uint32_t keepalive_idle;
+    /** \brief Time in s between two keepalive probes (TCP_KEEPINTVL) */
+    uint32_t keepalive_interval;
+    /** \brief Number of unanswered keepalive probes before the connection is dropped (TCP_KEEPCNT) */
+    uint32_t keepalive_count;
+    /** \brief Maximum time in ms for the sent data to be acknowledged before the connection is dropped (TCP_USER_TIMEOUT) */
+    uint32_t user_timeout;
+} mqtt_socket_options_t;
+
+/** \brief Readiness event reported by a socket poller */
+typedef struct _mqtt_socket_poller_event_t
+{
+    /** \brief Tag given when the socket has been added to the poller */
+    uint32_t tag;
+    /** \brief Data ready to receive, or incoming connection on a listen socket */
+    bool readable;
+    /** \brief Error or connection closed by the peer */
+    bool error;
+} mqtt_socket_poller_event_t;
+
+
 /** \brief Initialize the MQTT socket module */
 bool mqtt_socket_init(void);
 
@@ -41,13 +82,13 @@ bool mqtt_socket_open(mqtt_socket_t* const mqtt_socket, const bool non_blocking)
 /** \brief Close a MQTT socket */
 bool mqtt_socket_close(mqtt_socket_t* const mqtt_socket);
 
-/** \brief Connect a MQTT socket to a specific IP address and port */
+/** \brief Connect a MQTT socket to a specific IP address and port, or to a Unix domain socket (port is then ignored) */
 bool mqtt_socket_connect(mqtt_socket_t* const mqtt_socket, const char* const ip_address, const uint16_t port);
 
 /** \brief Check if a MQTT socket is connected */
 bool mqtt_socket_is_connected(mqtt_socket_t* const mqtt_socket);
 
-/** \brief Bind a MQTT socket to a specific IP address and port */
+/** \brief Bind a MQTT socket to a specific IP address and port, or to a Unix domain socket (port is then ignored) */
 bool mqtt_socket_bind(mqtt_socket_t* const mqtt_socket, const char* const ip_address, const uint16_t port);
 
 /** \brief Put a MQTT socket in listen state */
@@ -65,6 +106,39 @@ bool mqtt_socket_receive(mqtt_socket_t* const mqtt_socket, void* data, const siz
 /** \brief Wait for data ready to receive on the socket */
 bool mqtt_socket_select(mqtt_socket_t* const mqtt_socket, const uint32_t ms_timeout);
 
+/** \brief Initialize a socket poller */
+bool mqtt_socket_poller_init(mqtt_socket_poller_t* const poller);
+
+/** \brief Release a socket poller */
+bool mqtt_socket_poller_deinit(mqtt_socket_poller_t* const poller);
+
+/** \brief Add a socket to a socket poller, the tag identifies the socket in the reported events */
+bool mqtt_socket_poller_add(mqtt_socket_poller_t* const poller, mqtt_socket_t* const mqtt_socket, const uint32_t tag);
+
+/** \brief Remove a socket from a socket poller, must be called before closing the socket */
+bool mqtt_socket_poller_remove(mqtt_socket_poller_t* const poller, mqtt_socket_t* const mqtt_socket);
+
+/** \brief Wait for data ready to receive on the sockets of a socket poller
+           => only the ready sockets are reported in events, count is updated with the number of reported events */
+bool mqtt_socket_poller_wait(mqtt_socket_poller_t* const poller, mqtt_socket_poller_event_t* const events, 
+                             const uint32_t max_events, const uint32_t ms_timeout, uint32_t* const count);
+
+/** \brief Apply tuning options to a MQTT socket, the TCP options are ignored on the Unix domain sockets
+           and the unsupported options are ignored */
+bool mqtt_socket_set_options(mqtt_socket_t* const mqtt_socket, const mqtt_socket_options_t* const options);
+
+/** \brief Enable or disable the zero-copy transmit mode on a MQTT socket */
+bool mqtt_socket_set_zerocopy(mqtt_socket_t* const mqtt_socket, const bool enable);
+
+/** \brief Send data on a MQTT socket without copying it into the kernel
+           => the data must not be modified until the send has been reported as completed,
+              zerocopy_sent is incremented for each send which will be reported */
+bool mqtt_socket_send_zerocopy(mqtt_socket_t* const mqtt_socket, const void* data, const size_t size, size_t* const sent, uint32_t* const zerocopy_sent);
+
+/** \brief Read the zero-copy send completions from the socket error queue without blocking
+           => completed is updated with the number of completed sends */
+bool mqtt_socket_get_zerocopy_completions(mqtt_socket_t* const mqtt_socket, uint32_t* const completed);
+
 
 #ifdef __cplusplus
 }
@@ -20,15 +20,41 @@ along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <netinet/tcp.h>
+#include <poll.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif /* __linux__ */
 
 #include "mqtt_socket.h"
 #include "mqtt_error.h"
 
+#if defined(__linux__) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+#include <linux/errqueue.h>
+/** \brief Zero-copy transmit mode is supported by the kernel headers */
+#define MQTT_SOCKET_ZEROCOPY_SUPPORTED
+#endif /* defined(__linux__) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY) */
+
+
+/** \brief Check if an address designates a Unix domain socket */
+static bool mqtt_socket_is_unix_address(const char* const address);
+
+/** \brief Replace a socket by a Unix domain socket and build the corresponding address */
+static bool mqtt_socket_prepare_unix(mqtt_socket_t* const mqtt_socket, const char* const address, struct sockaddr_un* const addr);
+
+/** \brief Set an integer option on a socket */
+static bool mqtt_socket_set_int_option(mqtt_socket_t* const mqtt_socket, const int level, const int name, const uint32_t value);
+
+/** \brief Wait for an event on a single socket */
+static bool mqtt_socket_poll(mqtt_socket_t* const mqtt_socket, const short events, const uint32_t ms_timeout);
+
 
 
 /** \brief Initialize the MQTT socket module */
@@ -91,11 +117,10 @@ bool mqtt_socket_close(mqtt_socket_t* const mqtt_socket)
     /* Check params */
     if (mqtt_socket != NULL)
     {
-        ret = (shutdown((*mqtt_socket), SHUT_RDWR) == 0);
-        if (ret)
-        {      
-            ret = (close((*mqtt_socket)) == 0);
-        }
+        /* Shutdown may fail if the peer has already closed the connection
+           but the socket handle must always be released */
+        (void)shutdown((*mqtt_socket), SHUT_RDWR);
+        ret = (close((*mqtt_socket)) == 0);
         if (!ret)
         {
             mqtt_errno_set(MQTT_ERR_SOCKET_FAILED);
@@ -114,11 +139,24 @@ bool mqtt_socket_connect(mqtt_socket_t* const mqtt_socket, const char* const ip_
     if ((mqtt_socket != NULL) &&
         (ip_address != NULL))
     {
-        struct sockaddr_in addr = { 0 };
-        addr.sin_family = PF_INET;
-        addr.sin_port = htons(port);
-        addr.sin_addr.s_addr = inet_addr(ip_address);
-        ret = (connect((*mqtt_socket), (struct sockaddr *)&addr, sizeof(addr)) == 0);
+        if (mqtt_socket_is_unix_address(ip_address))
+        {
+            /* Local connection : skip the TCP/IP stack */
+            struct sockaddr_un addr;
+            ret = mqtt_socket_prepare_unix(mqtt_socket, ip_address, &addr);
+            if (ret)
+            {
+                ret = (connect((*mqtt_socket), (struct sockaddr *)&addr, sizeof(addr)) == 0);
+            }
+        }
+        else
+        {
+            struct sockaddr_in addr = { 0 };
+            addr.sin_family = PF_INET;
+            addr.sin_port = htons(port);
+            addr.sin_addr.s_addr = inet_addr(ip_address);
+            ret = (connect((*mqtt_socket), (struct sockaddr *)&addr, sizeof(addr)) == 0);
+        }
         if (!ret)
         {
             /* No connection, check error */
@@ -147,34 +185,8 @@ bool mqtt_socket_is_connected(mqtt_socket_t* const mqtt_socket)
     /* Check params */
     if (mqtt_socket != NULL)
     {
-        
         /* Check connection */
-        int32_t callret;
-        fd_set fd_write;
-        struct timeval timeout;
-
-        timeout.tv_sec = 0;
-        timeout.tv_usec = 0;
-
-        FD_ZERO(&fd_write);
-        FD_SET((*mqtt_socket), &fd_write);
-
-        callret = select((int)(*mqtt_socket) + 1, NULL, &fd_write, NULL, &timeout);
-        if (callret > 0)
-        {
-            /* Connected */
-            ret = true;
-        }
-        else if (callret == 0)
-        {
-            /* Connection pending */
-            mqtt_errno_set(MQTT_ERR_SOCKET_PENDING);
-        }
-        else
-        {
-            /* Connection rejected */
-            mqtt_errno_set(MQTT_ERR_SOCKET_FAILED);
-        }
+        ret = mqtt_socket_poll(mqtt_socket, POLLOUT, 0u);
     }
 
     return ret;
@@ -189,11 +201,29 @@ bool mqtt_socket_bind(mqtt_socket_t* const mqtt_socket, const char* const ip_add
     if ((mqtt_socket != NULL) &&
         (ip_address != NULL))
     {
-        struct sockaddr_in addr = { 0 };
-        addr.sin_family = PF_INET;
-        addr.sin_port = htons(port);
-        addr.sin_addr.s_addr = inet_addr(ip_address);
-        ret = (bind((*mqtt_socket), (struct sockaddr *)&addr, sizeof(addr)) == 0);
+        if (mqtt_socket_is_unix_address(ip_address))
+        {
+            struct sockaddr_un addr;
+            ret = mqtt_socket_prepare_unix(mqtt_socket, ip_address, &addr);
+            if (ret)
+            {
+                /* Remove the socket file left by a previous instance */
+                struct stat file_stat;
+                if ((stat(addr.sun_path, &file_stat) == 0) && S_ISSOCK(file_stat.st_mode))
+                {
+                    (void)unlink(addr.sun_path);
+                }
+                ret = (bind((*mqtt_socket), (struct sockaddr *)&addr, sizeof(addr)) == 0);
+            }
+        }
+        else
+        {
+            struct sockaddr_in addr = { 0 };
+            addr.sin_family = PF_INET;
+            addr.sin_port = htons(port);
+            addr.sin_addr.s_addr = inet_addr(ip_address);
+            ret = (bind((*mqtt_socket), (struct sockaddr *)&addr, sizeof(addr)) == 0);
+        }
         if (!ret)
         {
             mqtt_errno_set(MQTT_ERR_SOCKET_FAILED);
@@ -270,7 +300,7 @@ bool mqtt_socket_send(mqtt_socket_t* const mqtt_socket, const void* data, const
         (data != NULL) &&
         (sent != NULL))
     {
-        const int32_t callret = (int32_t)send((*mqtt_socket), (const char*)data, (int)size, 0);
+        const int32_t callret = (int32_t)send((*mqtt_socket), (const char*)data, (int)size, MSG_NOSIGNAL);
         if (callret >= 0)
         {
             /* Success */
@@ -308,7 +338,12 @@ bool mqtt_socket_receive(mqtt_socket_t* const mqtt_socket, void* data, const siz
         (received != NULL))
     {
         const int32_t callret = (int32_t)recv((*mqtt_socket), (char*)data, (int)size, 0);
-        if (callret >= 0)
+        if ((callret == 0) && (size != 0u))
+        {
+            /* Connection closed by the peer */
+            mqtt_errno_set(MQTT_ERR_SOCKET_FAILED);
+        }
+        else if (callret >= 0)
         {
             /* Success */
             (*received) = (size_t)(callret);
@@ -342,35 +377,548 @@ bool mqtt_socket_select(mqtt_socket_t* const mqtt_socket, const uint32_t ms_time
     /* Check params */
     if (mqtt_socket != NULL)
     {
+        /* Wait for data */
+        ret = mqtt_socket_poll(mqtt_socket, POLLIN, ms_timeout);
+    }
 
-        /* Check connection */
-        int32_t callret;
-        fd_set fd_read;
-        struct timeval timeout;
+    return ret;
+}
+
+/** \brief Apply tuning options to a MQTT socket */
+bool mqtt_socket_set_options(mqtt_socket_t* const mqtt_socket, const mqtt_socket_options_t* const options)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((mqtt_socket != NULL) &&
+        (options != NULL))
+    {
+        struct sockaddr_storage addr;
+        socklen_t addr_size = sizeof(addr);
+
+        /* Socket level options, every option is applied even if a previous one failed */
+        ret = true;
+        if (options->send_buffer_size != 0u)
+        {
+            ret = mqtt_socket_set_int_option(mqtt_socket, SOL_SOCKET, SO_SNDBUF, options->send_buffer_size) && ret;
+        }
+        if (options->receive_buffer_size != 0u)
+        {
+            ret = mqtt_socket_set_int_option(mqtt_socket, SOL_SOCKET, SO_RCVBUF, options->receive_buffer_size) && ret;
+        }
+        #ifdef SO_BUSY_POLL
+        if (options->busy_poll != 0u)
+        {
+            ret = mqtt_socket_set_int_option(mqtt_socket, SOL_SOCKET, SO_BUSY_POLL, options->busy_poll) && ret;
+        }
+        #endif /* SO_BUSY_POLL */
+
+        /* TCP options */
+        (void)memset(&addr, 0, sizeof(addr));
+        if ((getsockname((*mqtt_socket), (struct sockaddr*)&addr, &addr_size) == 0) &&
+            ((addr.ss_family == AF_INET) || (addr.ss_family == AF_INET6)))
+        {
+            if (options->no_delay)
+            {
+                ret = mqtt_socket_set_int_option(mqtt_socket, IPPROTO_TCP, TCP_NODELAY, 1u) && ret;
+            }
+            #ifdef TCP_QUICKACK
+            if (options->quick_ack)
+            {
+                ret = mqtt_socket_set_int_option(mqtt_socket, IPPROTO_TCP, TCP_QUICKACK, 1u) && ret;
+            }
+            #endif /* TCP_QUICKACK */
+            if (options->keepalive)
+            {
+                ret = mqtt_socket_set_int_option(mqtt_socket, SOL_SOCKET, SO_KEEPALIVE, 1u) && ret;
+                #ifdef TCP_KEEPIDLE
+                if (options->keepalive_idle != 0u)
+                {
+                    ret = mqtt_socket_set_int_option(mqtt_socket, IPPROTO_TCP, TCP_KEEPIDLE, options->keepalive_idle) && ret;
+                }
+                #endif /* TCP_KEEPIDLE */
+                if (options->keepalive_interval != 0u)
+                {
+                    ret = mqtt_socket_set_int_option(mqtt_socket, IPPROTO_TCP, TCP_KEEPINTVL, options->keepalive_interval) && ret;
+                }
+                if (options->keepalive_count != 0u)
+                {
+                    ret = mqtt_socket_set_int_option(mqtt_socket, IPPROTO_TCP, TCP_KEEPCNT, options->keepalive_count) && ret;
+                }
+            }
+            #ifdef TCP_USER_TIMEOUT
+            if (options->user_timeout != 0u)
+            {
+                ret = mqtt_socket_set_int_option(mqtt_socket, IPPROTO_TCP, TCP_USER_TIMEOUT, options->user_timeout) && ret;
+            }
+            #endif /* TCP_USER_TIMEOUT */
+        }
+
+        if (!ret)
+        {
+            mqtt_errno_set(MQTT_ERR_SOCKET_FAILED);
+        }
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Enable or disable the zero-copy transmit mode on a MQTT socket */
+bool mqtt_socket_set_zerocopy(mqtt_socket_t* const mqtt_socket, const bool enable)
+{
+    bool ret = false;
+
+    /* Check params */
+    if (mqtt_socket != NULL)
+    {
+        #ifdef MQTT_SOCKET_ZEROCOPY_SUPPORTED
+        const int option_value = (enable ? 1 : 0);
+        ret = (setsockopt((*mqtt_socket), SOL_SOCKET, SO_ZEROCOPY, &option_value, sizeof(option_value)) == 0);
+        #else
+        /* Not supported */
+        (void)enable;
+        #endif /* MQTT_SOCKET_ZEROCOPY_SUPPORTED */
+        if (!ret)
+        {
+            mqtt_errno_set(MQTT_ERR_SOCKET_FAILED);
+        }
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Send data on a MQTT socket without copying it into the kernel */
+bool mqtt_socket_send_zerocopy(mqtt_socket_t* const mqtt_socket, const void* data, const size_t size, size_t* const sent, uint32_t* const zerocopy_sent)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((mqtt_socket != NULL) &&
+        (data != NULL) &&
+        (sent != NULL) &&
+        (zerocopy_sent != NULL))
+    {
+        #ifdef MQTT_SOCKET_ZEROCOPY_SUPPORTED
+        const int32_t callret = (int32_t)send((*mqtt_socket), (const char*)data, (int)size, MSG_NOSIGNAL | MSG_ZEROCOPY);
+        if (callret >= 0)
+        {
+            /* Success, the kernel will report the completion of this send */
+            (*sent) = (size_t)(callret);
+            (*zerocopy_sent)++;
+            ret = true;
+        }
+        else if (errno == ENOBUFS)
+        {
+            /* Too many pending zero-copy sends on the socket : copy the data */
+            ret = mqtt_socket_send(mqtt_socket, data, size, sent);
+        }
+        else
+        {
+            const int32_t err = (int32_t)errno;
+            if ((err == EWOULDBLOCK) || (err == EINPROGRESS))
+            {
+                /* Send pending */
+                mqtt_errno_set(MQTT_ERR_SOCKET_PENDING);
+            }
+            else
+            {
+                /* Error */
+                mqtt_errno_set(MQTT_ERR_SOCKET_FAILED);
+            }
+        }
+        #else
+        /* Not supported : copy the data */
+        ret = mqtt_socket_send(mqtt_socket, data, size, sent);
+        #endif /* MQTT_SOCKET_ZEROCOPY_SUPPORTED */
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Read the zero-copy send completions from the socket error queue without blocking */
+bool mqtt_socket_get_zerocopy_completions(mqtt_socket_t* const mqtt_socket, uint32_t* const completed)
+{
+    bool ret = false;
 
-        timeout.tv_sec = (long)(ms_timeout / 1000u);
-        timeout.tv_usec = (((long)ms_timeout) - (timeout.tv_sec * 1000)) * 1000;
+    /* Check params */
+    if ((mqtt_socket != NULL) &&
+        (completed != NULL))
+    {
+        #ifdef MQTT_SOCKET_ZEROCOPY_SUPPORTED
+        bool empty = false;
+
+        ret = true;
+        while (ret && !empty)
+        {
+            struct msghdr msg;
+            struct cmsghdr* cmsg;
+            uint8_t control[128u];
+
+            (void)memset(&msg, 0, sizeof(msg));
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            if (recvmsg((*mqtt_socket), &msg, MSG_ERRQUEUE | MSG_DONTWAIT) >= 0)
+            {
+                /* Each notification covers a range of sends : [ee_info, ee_data] */
+                for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+                {
+                    if (((cmsg->cmsg_level == SOL_IP) && (cmsg->cmsg_type == IP_RECVERR)) ||
+                        ((cmsg->cmsg_level == SOL_IPV6) && (cmsg->cmsg_type == IPV6_RECVERR)))
+                    {
+                        struct sock_extended_err serr;
+                        (void)memcpy(&serr, CMSG_DATA(cmsg), sizeof(serr));
+                        if ((serr.ee_origin == SO_EE_ORIGIN_ZEROCOPY) && (serr.ee_errno == 0u))
+                        {
+                            const uint32_t end = serr.ee_data + 1u;
+                            if ((int32_t)(end - (*completed)) > 0)
+                            {
+                                (*completed) = end;
+                            }
+                        }
+                    }
+                }
+            }
+            else if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            {
+                /* No more notifications */
+                empty = true;
+            }
+            else
+            {
+                mqtt_errno_set(MQTT_ERR_SOCKET_FAILED);
+                ret = false;
+            }
+        }
+        #else
+        /* Nothing to do : the data is always copied */
+        ret = true;
+        #endif /* MQTT_SOCKET_ZEROCOPY_SUPPORTED */
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Initialize a socket poller */
+bool mqtt_socket_poller_init(mqtt_socket_poller_t* const poller)
+{
+    bool ret = false;
+
+    /* Check params */
+    if (poller != NULL)
+    {
+        #ifdef __linux__
+        poller->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (poller->epoll_fd >= 0)
+        {
+            ret = true;
+        }
+        else
+        {
+            mqtt_errno_set(MQTT_ERR_SOCKET_FAILED);
+        }
+        #else
+        poller->count = 0u;
+        ret = true;
+        #endif /* __linux__ */
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Release a socket poller */
+bool mqtt_socket_poller_deinit(mqtt_socket_poller_t* const poller)
+{
+    bool ret = false;
+
+    /* Check params */
+    if (poller != NULL)
+    {
+        #ifdef __linux__
+        ret = (close(poller->epoll_fd) == 0);
+        poller->epoll_fd = -1;
+        #else
+        poller->count = 0u;
+        ret = true;
+        #endif /* __linux__ */
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Add a socket to a socket poller */
+bool mqtt_socket_poller_add(mqtt_socket_poller_t* const poller, mqtt_socket_t* const mqtt_socket, const uint32_t tag)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((poller != NULL) &&
+        (mqtt_socket != NULL))
+    {
+        #ifdef __linux__
+        /* Level triggered : a socket stays ready as long as it has unread data */
+        struct epoll_event event;
+        (void)memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN | EPOLLRDHUP;
+        event.data.u32 = tag;
+        ret = (epoll_ctl(poller->epoll_fd, EPOLL_CTL_ADD, (*mqtt_socket), &event) == 0);
+        #else
+        if (poller->count < MQTT_SOCKET_POLLER_MAX_SOCKETS)
+        {
+            poller->sockets[poller->count] = (*mqtt_socket);
+            poller->tags[poller->count] = tag;
+            poller->count++;
+            ret = true;
+        }
+        #endif /* __linux__ */
+        if (!ret)
+        {
+            mqtt_errno_set(MQTT_ERR_SOCKET_FAILED);
+        }
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Remove a socket from a socket poller */
+bool mqtt_socket_poller_remove(mqtt_socket_poller_t* const poller, mqtt_socket_t* const mqtt_socket)
+{
+    bool ret = false;
 
-        FD_ZERO(&fd_read);
-        FD_SET((*mqtt_socket), &fd_read);
+    /* Check params */
+    if ((poller != NULL) &&
+        (mqtt_socket != NULL))
+    {
+        #ifdef __linux__
+        ret = (epoll_ctl(poller->epoll_fd, EPOLL_CTL_DEL, (*mqtt_socket), NULL) == 0);
+        #else
+        uint32_t i;
+        for (i = 0u; (i < poller->count) && !ret; i++)
+        {
+            if (poller->sockets[i] == (*mqtt_socket))
+            {
+                /* Replace by the last socket */
+                poller->count--;
+                poller->sockets[i] = poller->sockets[poller->count];
+                poller->tags[i] = poller->tags[poller->count];
+                ret = true;
+            }
+        }
+        #endif /* __linux__ */
+        if (!ret)
+        {
+            mqtt_errno_set(MQTT_ERR_SOCKET_FAILED);
+        }
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Wait for data ready to receive on the sockets of a socket poller */
+bool mqtt_socket_poller_wait(mqtt_socket_poller_t* const poller, mqtt_socket_poller_event_t* const events, 
+                             const uint32_t max_events, const uint32_t ms_timeout, uint32_t* const count)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((poller != NULL) &&
+        (events != NULL) &&
+        (max_events != 0u) &&
+        (count != NULL))
+    {
+        int32_t callret;
+        uint32_t i;
+        #ifdef __linux__
+        struct epoll_event ready[64u];
+        const uint32_t ready_count = ((max_events < 64u) ? max_events : 64u);
+        #else
+        struct pollfd fds[MQTT_SOCKET_POLLER_MAX_SOCKETS];
+        #endif /* __linux__ */
+
+        (*count) = 0u;
+
+        #ifdef __linux__
+        callret = epoll_wait(poller->epoll_fd, ready, (int)ready_count, (int)ms_timeout);
+        for (i = 0u; i < (uint32_t)callret; i++)
+        {
+            events[i].tag = ready[i].data.u32;
+            events[i].readable = ((ready[i].events & EPOLLIN) != 0u);
+            events[i].error = ((ready[i].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) != 0u);
+        }
+        #else
+        for (i = 0u; i < poller->count; i++)
+        {
+            fds[i].fd = poller->sockets[i];
+            fds[i].events = POLLIN;
+            fds[i].revents = 0;
+        }
+        callret = poll(fds, (nfds_t)poller->count, (int)ms_timeout);
+        for (i = 0u; (callret > 0) && (i < poller->count) && ((*count) < max_events); i++)
+        {
+            if (fds[i].revents != 0)
+            {
+                events[(*count)].tag = poller->tags[i];
+                events[(*count)].readable = ((fds[i].revents & POLLIN) != 0);
+                events[(*count)].error = ((fds[i].revents & (POLLERR | POLLHUP | POLLNVAL)) != 0);
+                (*count)++;
+            }
+        }
+        #endif /* __linux__ */
 
-        callret = select((int)(*mqtt_socket) + 1, &fd_read, NULL, NULL, &timeout);
         if (callret > 0)
         {
-            /* Data ready */
+            /* Sockets ready */
+            #ifdef __linux__
+            (*count) = (uint32_t)callret;
+            #endif /* __linux__ */
             ret = true;
         }
-        else if (callret == 0)
+        else if ((callret == 0) || (errno == EINTR))
         {
-            /* No data available */
+            /* Nothing ready */
             mqtt_errno_set(MQTT_ERR_SOCKET_PENDING);
         }
         else
         {
-            /* Connection closed */
             mqtt_errno_set(MQTT_ERR_SOCKET_FAILED);
         }
     }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+
+
+
+/** \brief Check if an address designates a Unix domain socket */
+static bool mqtt_socket_is_unix_address(const char* const address)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    return (strncmp(address, MQTT_SOCKET_UNIX_SCHEME, sizeof(MQTT_SOCKET_UNIX_SCHEME) - 1u) == 0);
+}
+
+/** \brief Replace a socket by a Unix domain socket and build the corresponding address */
+static bool mqtt_socket_prepare_unix(mqtt_socket_t* const mqtt_socket, const char* const address, struct sockaddr_un* const addr)
+{
+    bool ret = false;
+
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    const char* const path = &address[sizeof(MQTT_SOCKET_UNIX_SCHEME) - 1u];
+    const size_t path_length = strlen(path);
+
+    (void)memset(addr, 0, sizeof(struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+    if ((path_length != 0u) && (path_length < sizeof(addr->sun_path)))
+    {
+        /* The socket is opened before its address is known : replace it while keeping
+           its handle and its blocking mode so that the callers are not affected */
+        const int flags = fcntl((*mqtt_socket), F_GETFL);
+        const int unix_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+        (void)memcpy(addr->sun_path, path, path_length);
+        if (unix_socket >= 0)
+        {
+            ret = ((flags >= 0) &&
+                   (fcntl(unix_socket, F_SETFL, flags) == 0) &&
+                   (dup2(unix_socket, (*mqtt_socket)) >= 0));
+            (void)close(unix_socket);
+        }
+    }
+    else
+    {
+        errno = ENAMETOOLONG;
+    }
+
+    return ret;
+}
+
+/** \brief Set an integer option on a socket */
+static bool mqtt_socket_set_int_option(mqtt_socket_t* const mqtt_socket, const int level, const int name, const uint32_t value)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    const int option_value = (int)value;
+    return (setsockopt((*mqtt_socket), level, name, &option_value, sizeof(option_value)) == 0);
+}
+
+/** \brief Wait for an event on a single socket */
+static bool mqtt_socket_poll(mqtt_socket_t* const mqtt_socket, const short events, const uint32_t ms_timeout)
+{
+    bool ret = false;
+    int32_t callret;
+    struct pollfd fd;
+
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    /* poll() has no limit on the file descriptor value unlike select(),
+       errors and hang-ups are reported as ready like with select() */
+    fd.fd = (*mqtt_socket);
+    fd.events = events;
+    fd.revents = 0;
+    callret = poll(&fd, 1u, (int)ms_timeout);
+    if ((callret > 0) && ((fd.revents & POLLNVAL) == 0))
+    {
+        /* Socket ready */
+        ret = true;
+    }
+    else if ((callret == 0) || ((callret < 0) && (errno == EINTR)))
+    {
+        /* Nothing happened */
+        mqtt_errno_set(MQTT_ERR_SOCKET_PENDING);
+    }
+    else
+    {
+        /* Connection closed or rejected */
+        mqtt_errno_set(MQTT_ERR_SOCKET_FAILED);
+    }
 
     return ret;
 }
@@ -21,6 +21,7 @@ along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
 #define MQTT_SOCKET_T_H
 
 #include "stdheaders.h"
+#include "mqtt_config.h"
 
 #ifdef __cplusplus
 extern "C"
@@ -31,6 +32,30 @@ extern "C"
 /** \brief MQTT socket */
 typedef int mqtt_socket_t;
 
+#ifdef __linux__
+
+/** \brief Socket poller (epoll instance, unlimited number of sockets) */
+typedef struct _mqtt_socket_poller_t
+{
+    /** \brief epoll file descriptor */
+    int epoll_fd;
+} mqtt_socket_poller_t;
+
+#else
+
+/** \brief Socket poller (poll() based, limited number of sockets) */
+typedef struct _mqtt_socket_poller_t
+{
+    /** \brief Polled sockets */
+    mqtt_socket_t sockets[MQTT_SOCKET_POLLER_MAX_SOCKETS];
+    /** \brief Tags of the polled sockets */
+    uint32_t tags[MQTT_SOCKET_POLLER_MAX_SOCKETS];
+    /** \brief Number of polled sockets */
+    uint32_t count;
+} mqtt_socket_poller_t;
+
+#endif /* __linux__ */
+
 
 #ifdef __cplusplus
 }
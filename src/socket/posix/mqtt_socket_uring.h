@@ -0,0 +1,219 @@
+/*
+Copyright(c) 2016 Cedric Jimenez
+
+This file is part of lw-mqtt.
+
+lw-mqtt is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+lw-mqtt is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MQTT_SOCKET_URING_H
+#define MQTT_SOCKET_URING_H
+
+#include "stdheaders.h"
+#include "mqtt_config.h"
+
+#ifdef MQTT_SOCKET_IO_URING_ENABLED
+
+#include <linux/io_uring.h>
+#include "mqtt_socket_t.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+
+/** \brief Tag used for the operations on a listen socket */
+#define MQTT_SOCKET_URING_LISTEN_TAG    0xFFFFFFFFu
+
+
+/** \brief io_uring event types */
+typedef enum _mqtt_socket_uring_event_type_t
+{
+    /** \brief New connection accepted on a listen socket */
+    MQTT_SOCKET_URING_EVT_ACCEPT = 0u,
+    /** \brief Data received on a socket */
+    MQTT_SOCKET_URING_EVT_RECEIVE = 1u,
+    /** \brief Send failure on a socket */
+    MQTT_SOCKET_URING_EVT_SEND = 2u,
+    /** \brief Cancellation of the operations on a socket (internal use only) */
+    MQTT_SOCKET_URING_EVT_CANCEL = 3u
+} mqtt_socket_uring_event_type_t;
+
+/** \brief io_uring event */
+typedef struct _mqtt_socket_uring_event_t
+{
+    /** \brief Type */
+    mqtt_socket_uring_event_type_t type;
+    /** \brief Tag of the socket given when the operation has been queued */
+    uint32_t tag;
+    /** \brief Accepted socket (accept event only) */
+    mqtt_socket_t socket;
+    /** \brief Indicate if the operation succeeded, false if the connection is lost */
+    bool success;
+    /** \brief Indicate if the multishot operation is still armed, it must be armed again if not */
+    bool more;
+    /** \brief Received data (receive event only) */
+    const uint8_t* data;
+    /** \brief Size in bytes of the received data */
+    size_t size;
+    /** \brief Identifier of the receive buffer to give back to the kernel */
+    uint16_t buffer_id;
+    /** \brief Indicate if a receive buffer must be given back to the kernel */
+    bool has_buffer;
+} mqtt_socket_uring_event_t;
+
+/** \brief Pre-declaration of mqtt_socket_uring_t structure */
+typedef struct _mqtt_socket_uring_t mqtt_socket_uring_t;
+
+/** \brief Socket managed by an io_uring instance */
+typedef struct _mqtt_socket_uring_endpoint_t
+{
+    /** \brief io_uring instance */
+    mqtt_socket_uring_t* uring;
+    /** \brief Socket */
+    mqtt_socket_t socket;
+    /** \brief Tag to identify the socket in the events, must change each time the endpoint is reused */
+    uint32_t tag;
+    /** \brief First send buffer queued on the socket (-1 if none) */
+    int32_t first_buffer;
+    /** \brief Last send buffer queued on the socket (-1 if none) */
+    int32_t last_buffer;
+    /** \brief Indicate if the first send buffer has been submitted to the kernel */
+    bool sending;
+    /** \brief Indicate if the endpoint has send buffers waiting for the next submission */
+    bool pending;
+    /** \brief Next endpoint waiting for the next submission */
+    struct _mqtt_socket_uring_endpoint_t* next_pending;
+} mqtt_socket_uring_endpoint_t;
+
+/** \brief Send buffer */
+typedef struct _mqtt_socket_uring_send_buffer_t
+{
+    /** \brief Owner of the buffer, NULL if the owner has been cancelled */
+    mqtt_socket_uring_endpoint_t* endpoint;
+    /** \brief Data */
+    uint8_t* data;
+    /** \brief Size in bytes of the data */
+    uint32_t size;
+    /** \brief Next buffer in the list (-1 if none) */
+    int32_t next;
+} mqtt_socket_uring_send_buffer_t;
+
+/** \brief io_uring instance */
+struct _mqtt_socket_uring_t
+{
+    /** \brief io_uring file descriptor */
+    int ring_fd;
+
+    /** \brief Submission queue ring */
+    void* sq_ring;
+    /** \brief Size in bytes of the submission queue ring */
+    size_t sq_ring_size;
+    /** \brief Submission queue head */
+    uint32_t* sq_head;
+    /** \brief Submission queue tail */
+    uint32_t* sq_tail;
+    /** \brief Submission queue mask */
+    uint32_t sq_mask;
+    /** \brief Submission queue entries count */
+    uint32_t sq_entries;
+    /** \brief Submission queue index array */
+    uint32_t* sq_array;
+    /** \brief Submission queue entries */
+    struct io_uring_sqe* sqes;
+    /** \brief Size in bytes of the submission queue entries */
+    size_t sqes_size;
+    /** \brief Number of entries queued but not submitted yet */
+    uint32_t to_submit;
+
+    /** \brief Completion queue ring */
+    void* cq_ring;
+    /** \brief Size in bytes of the completion queue ring */
+    size_t cq_ring_size;
+    /** \brief Completion queue head */
+    uint32_t* cq_head;
+    /** \brief Completion queue tail */
+    uint32_t* cq_tail;
+    /** \brief Completion queue mask */
+    uint32_t cq_mask;
+    /** \brief Completion queue entries */
+    struct io_uring_cqe* cqes;
+
+    /** \brief Memory area for the receive buffer ring, the receive buffers and the send buffers */
+    uint8_t* buffers_area;
+    /** \brief Size in bytes of the memory area */
+    size_t buffers_area_size;
+    /** \brief Receive buffer ring registered to the kernel */
+    struct io_uring_buf_ring* recv_ring;
+    /** \brief Receive buffers */
+    uint8_t* recv_buffers;
+    /** \brief Receive buffer ring tail */
+    uint16_t recv_ring_tail;
+
+    /** \brief Send buffers */
+    mqtt_socket_uring_send_buffer_t send_buffers[MQTT_SOCKET_URING_SEND_BUFFER_COUNT];
+    /** \brief First free send buffer (-1 if none) */
+    int32_t first_free_send_buffer;
+    /** \brief First endpoint with send buffers waiting for the next submission */
+    mqtt_socket_uring_endpoint_t* first_pending;
+
+    /** \brief Events already retrieved from the completion queue */
+    mqtt_socket_uring_event_t backlog[MQTT_SOCKET_URING_ENTRIES];
+    /** \brief Index of the first event in the backlog */
+    uint32_t backlog_first;
+    /** \brief Number of events in the backlog */
+    uint32_t backlog_count;
+};
+
+
+/** \brief Initialize an io_uring instance */
+bool mqtt_socket_uring_init(mqtt_socket_uring_t* const uring);
+
+/** \brief Release an io_uring instance */
+bool mqtt_socket_uring_deinit(mqtt_socket_uring_t* const uring);
+
+/** \brief Initialize an endpoint to manage a socket with an io_uring instance */
+bool mqtt_socket_uring_endpoint_init(mqtt_socket_uring_t* const uring, mqtt_socket_uring_endpoint_t* const endpoint,
+                                     const mqtt_socket_t socket, const uint32_t tag);
+
+/** \brief Queue a multishot accept on a listen socket */
+bool mqtt_socket_uring_accept(mqtt_socket_uring_t* const uring, const mqtt_socket_t listen_socket);
+
+/** \brief Queue a multishot receive on a socket */
+bool mqtt_socket_uring_receive(mqtt_socket_uring_endpoint_t* const endpoint);
+
+/** \brief Queue data to send on a socket */
+bool mqtt_socket_uring_send(mqtt_socket_uring_endpoint_t* const endpoint, const void* data, const size_t size);
+
+/** \brief Cancel all the operations on a socket and release its pending send buffers, must be called before closing the socket */
+bool mqtt_socket_uring_cancel(mqtt_socket_uring_endpoint_t* const endpoint);
+
+/** \brief Submit all the queued operations in a single system call and wait for events */
+bool mqtt_socket_uring_submit(mqtt_socket_uring_t* const uring, const uint32_t ms_timeout);
+
+/** \brief Get the next event */
+bool mqtt_socket_uring_get_event(mqtt_socket_uring_t* const uring, mqtt_socket_uring_event_t* const event);
+
+/** \brief Give a receive buffer back to the kernel once the received data has been processed */
+bool mqtt_socket_uring_release_buffer(mqtt_socket_uring_t* const uring, const mqtt_socket_uring_event_t* const event);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* MQTT_SOCKET_IO_URING_ENABLED */
+
+#endif /* MQTT_SOCKET_URING_H */
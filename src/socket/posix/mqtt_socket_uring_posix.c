@@ -0,0 +1,921 @@
+/*
+Copyright(c) 2016 Cedric Jimenez
+
+This file is part of lw-mqtt.
+
+lw-mqtt is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+lw-mqtt is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "mqtt_socket_uring.h"
+
+#ifdef MQTT_SOCKET_IO_URING_ENABLED
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#include "mqtt_error.h"
+
+
+/** \brief Identifier of the receive buffer group */
+#define MQTT_SOCKET_URING_BUFFER_GROUP      0u
+
+/** \brief Maximum time in milliseconds to wait for a send buffer to be released */
+#define MQTT_SOCKET_URING_SEND_TIMEOUT      1000u
+
+/** \brief Tag of the test operations submitted when the io_uring instance is initialized */
+#define MQTT_SOCKET_URING_PROBE_TAG         0xFFFFFFFEu
+
+/** \brief Maximum time in milliseconds to wait for the completion of the test operations */
+#define MQTT_SOCKET_URING_PROBE_TIMEOUT     1000u
+
+/** \brief Build the user data of an operation from its event type and its tag */
+#define MQTT_SOCKET_URING_USER_DATA(type, tag)  ((((uint64_t)(type)) << 32u) | ((uint64_t)(tag)))
+
+/** \brief Read an index shared with the kernel */
+#define MQTT_SOCKET_URING_LOAD_ACQUIRE(ptr)         __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+
+/** \brief Write an index shared with the kernel */
+#define MQTT_SOCKET_URING_STORE_RELEASE(ptr, value) __atomic_store_n((ptr), (value), __ATOMIC_RELEASE)
+
+
+
+/** \brief Get a free submission queue entry */
+static struct io_uring_sqe* mqtt_socket_uring_get_sqe(mqtt_socket_uring_t* const uring);
+
+/** \brief Submit the queued entries and optionally wait for completions */
+static bool mqtt_socket_uring_enter(mqtt_socket_uring_t* const uring, const uint32_t min_complete, const uint32_t ms_timeout);
+
+/** \brief Queue the send operations of the endpoints waiting for the next submission */
+static bool mqtt_socket_uring_flush_pending(mqtt_socket_uring_t* const uring);
+
+/** \brief Add an endpoint to the list of the endpoints waiting for the next submission */
+static void mqtt_socket_uring_add_pending(mqtt_socket_uring_endpoint_t* const endpoint);
+
+/** \brief Release a list of send buffers */
+static void mqtt_socket_uring_release_send_buffers(mqtt_socket_uring_t* const uring, int32_t buffer_index);
+
+/** \brief Wait for a send buffer to be released */
+static bool mqtt_socket_uring_wait_send_buffer(mqtt_socket_uring_t* const uring);
+
+/** \brief Process a completion queue entry, returns true if an event must be reported */
+static bool mqtt_socket_uring_process_cqe(mqtt_socket_uring_t* const uring, const struct io_uring_cqe* const cqe, mqtt_socket_uring_event_t* const event);
+
+/** \brief Check with a test submission that the kernel supports the multishot receive (Linux 6.0 and later) */
+static bool mqtt_socket_uring_probe_receive(mqtt_socket_uring_t* const uring);
+
+
+
+/** \brief Initialize an io_uring instance */
+bool mqtt_socket_uring_init(mqtt_socket_uring_t* const uring)
+{
+    bool ret = false;
+
+    /* Check params */
+    if (uring != NULL)
+    {
+        struct io_uring_params params;
+        void* mapping;
+
+        /* Create the ring */
+        (void)memset(uring, 0, sizeof(mqtt_socket_uring_t));
+        (void)memset(&params, 0, sizeof(params));
+        params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN;
+        params.cq_entries = 4u * MQTT_SOCKET_URING_ENTRIES;
+        uring->ring_fd = (int)syscall(__NR_io_uring_setup, MQTT_SOCKET_URING_ENTRIES, &params);
+        ret = ((uring->ring_fd >= 0) &&
+               ((params.features & IORING_FEAT_SINGLE_MMAP) != 0u) &&
+               ((params.features & IORING_FEAT_EXT_ARG) != 0u));
+        if (ret)
+        {
+            /* Map the submission and completion queue rings in a single mapping */
+            uring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+            uring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+            if (uring->cq_ring_size > uring->sq_ring_size)
+            {
+                uring->sq_ring_size = uring->cq_ring_size;
+            }
+            mapping = mmap(NULL, uring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->ring_fd, IORING_OFF_SQ_RING);
+            if (mapping != MAP_FAILED)
+            {
+                uring->sq_ring = mapping;
+                uring->cq_ring = mapping;
+            }
+
+            /* Map the submission queue entries */
+            uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+            mapping = mmap(NULL, uring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->ring_fd, IORING_OFF_SQES);
+            if (mapping != MAP_FAILED)
+            {
+                uring->sqes = mapping;
+            }
+
+            /* Allocate the buffers, the receive buffer ring must be page aligned */
+            uring->buffers_area_size = MQTT_SOCKET_URING_RECV_BUFFER_COUNT * sizeof(struct io_uring_buf) +
+                                       MQTT_SOCKET_URING_RECV_BUFFER_COUNT * MQTT_SOCKET_URING_RECV_BUFFER_SIZE +
+                                       MQTT_SOCKET_URING_SEND_BUFFER_COUNT * MQTT_SOCKET_URING_SEND_BUFFER_SIZE;
+            mapping = mmap(NULL, uring->buffers_area_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (mapping != MAP_FAILED)
+            {
+                uring->buffers_area = mapping;
+            }
+
+            ret = ((uring->sq_ring != NULL) && (uring->sqes != NULL) && (uring->buffers_area != NULL));
+        }
+        if (ret)
+        {
+            uint8_t* const sq_ring = uring->sq_ring;
+            uint8_t* const cq_ring = uring->cq_ring;
+            struct io_uring_buf_reg buf_reg;
+            uint8_t* send_buffers;
+            uint32_t i;
+
+            /* Queues */
+            uring->sq_head = (uint32_t*)(sq_ring + params.sq_off.head);
+            uring->sq_tail = (uint32_t*)(sq_ring + params.sq_off.tail);
+            uring->sq_mask = *((uint32_t*)(sq_ring + params.sq_off.ring_mask));
+            uring->sq_entries = *((uint32_t*)(sq_ring + params.sq_off.ring_entries));
+            uring->sq_array = (uint32_t*)(sq_ring + params.sq_off.array);
+            uring->cq_head = (uint32_t*)(cq_ring + params.cq_off.head);
+            uring->cq_tail = (uint32_t*)(cq_ring + params.cq_off.tail);
+            uring->cq_mask = *((uint32_t*)(cq_ring + params.cq_off.ring_mask));
+            uring->cqes = (struct io_uring_cqe*)(cq_ring + params.cq_off.cqes);
+
+            /* Receive buffers */
+            uring->recv_ring = (struct io_uring_buf_ring*)uring->buffers_area;
+            uring->recv_buffers = uring->buffers_area + MQTT_SOCKET_URING_RECV_BUFFER_COUNT * sizeof(struct io_uring_buf);
+            for (i = 0u; i < MQTT_SOCKET_URING_RECV_BUFFER_COUNT; i++)
+            {
+                struct io_uring_buf* const buf = &uring->recv_ring->bufs[i];
+                buf->addr = (uint64_t)(uintptr_t)(uring->recv_buffers + i * MQTT_SOCKET_URING_RECV_BUFFER_SIZE);
+                buf->len = MQTT_SOCKET_URING_RECV_BUFFER_SIZE;
+                buf->bid = (uint16_t)i;
+            }
+            uring->recv_ring_tail = (uint16_t)MQTT_SOCKET_URING_RECV_BUFFER_COUNT;
+            MQTT_SOCKET_URING_STORE_RELEASE(&uring->recv_ring->tail, uring->recv_ring_tail);
+
+            /* Register the receive buffers to the kernel */
+            (void)memset(&buf_reg, 0, sizeof(buf_reg));
+            buf_reg.ring_addr = (uint64_t)(uintptr_t)uring->recv_ring;
+            buf_reg.ring_entries = MQTT_SOCKET_URING_RECV_BUFFER_COUNT;
+            buf_reg.bgid = MQTT_SOCKET_URING_BUFFER_GROUP;
+            ret = (syscall(__NR_io_uring_register, uring->ring_fd, IORING_REGISTER_PBUF_RING, &buf_reg, 1) == 0);
+
+            /* Send buffers */
+            send_buffers = uring->recv_buffers + MQTT_SOCKET_URING_RECV_BUFFER_COUNT * MQTT_SOCKET_URING_RECV_BUFFER_SIZE;
+            for (i = 0u; i < MQTT_SOCKET_URING_SEND_BUFFER_COUNT; i++)
+            {
+                mqtt_socket_uring_send_buffer_t* const send_buffer = &uring->send_buffers[i];
+                send_buffer->data = send_buffers + i * MQTT_SOCKET_URING_SEND_BUFFER_SIZE;
+                send_buffer->next = (int32_t)(i + 1u);
+            }
+            uring->send_buffers[MQTT_SOCKET_URING_SEND_BUFFER_COUNT - 1u].next = -1;
+            uring->first_free_send_buffer = 0;
+        }
+        if (ret)
+        {
+            /* The ring setup and the buffer ring registration succeed on kernels which can't receive on the sessions */
+            ret = mqtt_socket_uring_probe_receive(uring);
+        }
+        if (!ret)
+        {
+            (void)mqtt_socket_uring_deinit(uring);
+            mqtt_errno_set(MQTT_ERR_SOCKET_FAILED);
+        }
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Release an io_uring instance */
+bool mqtt_socket_uring_deinit(mqtt_socket_uring_t* const uring)
+{
+    bool ret = false;
+
+    /* Check params */
+    if (uring != NULL)
+    {
+        /* Closing the ring cancels all the pending operations */
+        if (uring->ring_fd >= 0)
+        {
+            (void)close(uring->ring_fd);
+        }
+        if (uring->sqes != NULL)
+        {
+            (void)munmap(uring->sqes, uring->sqes_size);
+        }
+        if (uring->sq_ring != NULL)
+        {
+            (void)munmap(uring->sq_ring, uring->sq_ring_size);
+        }
+        if (uring->buffers_area != NULL)
+        {
+            (void)munmap(uring->buffers_area, uring->buffers_area_size);
+        }
+        (void)memset(uring, 0, sizeof(mqtt_socket_uring_t));
+        uring->ring_fd = -1;
+
+        ret = true;
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Initialize an endpoint to manage a socket with an io_uring instance */
+bool mqtt_socket_uring_endpoint_init(mqtt_socket_uring_t* const uring, mqtt_socket_uring_endpoint_t* const endpoint,
+                                     const mqtt_socket_t socket, const uint32_t tag)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((uring != NULL) && (endpoint != NULL) && (tag != MQTT_SOCKET_URING_LISTEN_TAG))
+    {
+        endpoint->uring = uring;
+        endpoint->socket = socket;
+        endpoint->tag = tag;
+        endpoint->first_buffer = -1;
+        endpoint->last_buffer = -1;
+        endpoint->sending = false;
+        endpoint->pending = false;
+        endpoint->next_pending = NULL;
+
+        ret = true;
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Queue a multishot accept on a listen socket */
+bool mqtt_socket_uring_accept(mqtt_socket_uring_t* const uring, const mqtt_socket_t listen_socket)
+{
+    bool ret = false;
+
+    /* Check params */
+    if (uring != NULL)
+    {
+        struct io_uring_sqe* const sqe = mqtt_socket_uring_get_sqe(uring);
+        if (sqe != NULL)
+        {
+            sqe->opcode = IORING_OP_ACCEPT;
+            sqe->fd = listen_socket;
+            sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+            sqe->user_data = MQTT_SOCKET_URING_USER_DATA(MQTT_SOCKET_URING_EVT_ACCEPT, MQTT_SOCKET_URING_LISTEN_TAG);
+            ret = true;
+        }
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Queue a multishot receive on a socket */
+bool mqtt_socket_uring_receive(mqtt_socket_uring_endpoint_t* const endpoint)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((endpoint != NULL) && (endpoint->uring != NULL))
+    {
+        struct io_uring_sqe* const sqe = mqtt_socket_uring_get_sqe(endpoint->uring);
+        if (sqe != NULL)
+        {
+            /* The kernel picks a receive buffer only when data is available */
+            sqe->opcode = IORING_OP_RECV;
+            sqe->fd = endpoint->socket;
+            sqe->ioprio = IORING_RECV_MULTISHOT;
+            sqe->flags = IOSQE_BUFFER_SELECT;
+            sqe->buf_group = MQTT_SOCKET_URING_BUFFER_GROUP;
+            sqe->user_data = MQTT_SOCKET_URING_USER_DATA(MQTT_SOCKET_URING_EVT_RECEIVE, endpoint->tag);
+            ret = true;
+        }
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Queue data to send on a socket */
+bool mqtt_socket_uring_send(mqtt_socket_uring_endpoint_t* const endpoint, const void* data, const size_t size)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((endpoint != NULL) && (endpoint->uring != NULL) && ((data != NULL) || (size == 0u)))
+    {
+        mqtt_socket_uring_t* const uring = endpoint->uring;
+        const uint8_t* bytes = data;
+        size_t left = size;
+
+        /* Gather the data into the send buffers of the endpoint which have not been submitted yet */
+        ret = true;
+        while (ret && (left != 0u))
+        {
+            int32_t index = endpoint->last_buffer;
+            if ((index < 0) ||
+                (endpoint->sending && (index == endpoint->first_buffer)) ||
+                (uring->send_buffers[index].size == MQTT_SOCKET_URING_SEND_BUFFER_SIZE))
+            {
+                /* Allocate a new buffer */
+                if (uring->first_free_send_buffer < 0)
+                {
+                    ret = mqtt_socket_uring_wait_send_buffer(uring);
+                }
+                if (ret)
+                {
+                    index = uring->first_free_send_buffer;
+                    uring->first_free_send_buffer = uring->send_buffers[index].next;
+                    uring->send_buffers[index].endpoint = endpoint;
+                    uring->send_buffers[index].size = 0u;
+                    uring->send_buffers[index].next = -1;
+                    if (endpoint->last_buffer < 0)
+                    {
+                        endpoint->first_buffer = index;
+                    }
+                    else
+                    {
+                        uring->send_buffers[endpoint->last_buffer].next = index;
+                    }
+                    endpoint->last_buffer = index;
+                }
+            }
+            if (ret)
+            {
+                mqtt_socket_uring_send_buffer_t* const send_buffer = &uring->send_buffers[index];
+                size_t copy_size = MQTT_SOCKET_URING_SEND_BUFFER_SIZE - send_buffer->size;
+                if (copy_size > left)
+                {
+                    copy_size = left;
+                }
+                (void)memcpy(&send_buffer->data[send_buffer->size], bytes, copy_size);
+                send_buffer->size += (uint32_t)copy_size;
+                bytes += copy_size;
+                left -= copy_size;
+            }
+        }
+
+        /* The send operation will be queued at the next submission */
+        if (ret && !endpoint->sending && (endpoint->first_buffer >= 0))
+        {
+            mqtt_socket_uring_add_pending(endpoint);
+        }
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Cancel all the operations on a socket and release its pending send buffers, must be called before closing the socket */
+bool mqtt_socket_uring_cancel(mqtt_socket_uring_endpoint_t* const endpoint)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((endpoint != NULL) && (endpoint->uring != NULL))
+    {
+        mqtt_socket_uring_t* const uring = endpoint->uring;
+        struct io_uring_sqe* sqe;
+
+        /* Remove the endpoint from the pending list */
+        if (endpoint->pending)
+        {
+            mqtt_socket_uring_endpoint_t** pending = &uring->first_pending;
+            while ((*pending) != endpoint)
+            {
+                pending = &(*pending)->next_pending;
+            }
+            (*pending) = endpoint->next_pending;
+            endpoint->pending = false;
+            endpoint->next_pending = NULL;
+        }
+
+        /* Release the send buffers, the one owned by the kernel will be released on its completion */
+        if (endpoint->first_buffer >= 0)
+        {
+            int32_t first_buffer = endpoint->first_buffer;
+            if (endpoint->sending)
+            {
+                uring->send_buffers[first_buffer].endpoint = NULL;
+                first_buffer = uring->send_buffers[first_buffer].next;
+            }
+            mqtt_socket_uring_release_send_buffers(uring, first_buffer);
+        }
+        endpoint->first_buffer = -1;
+        endpoint->last_buffer = -1;
+        endpoint->sending = false;
+
+        /* Cancel the operations and submit immediately so that the socket can be closed */
+        sqe = mqtt_socket_uring_get_sqe(uring);
+        if (sqe != NULL)
+        {
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = endpoint->socket;
+            sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+            sqe->user_data = MQTT_SOCKET_URING_USER_DATA(MQTT_SOCKET_URING_EVT_CANCEL, endpoint->tag);
+            ret = mqtt_socket_uring_enter(uring, 0u, 0u);
+        }
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Submit all the queued operations in a single system call and wait for events */
+bool mqtt_socket_uring_submit(mqtt_socket_uring_t* const uring, const uint32_t ms_timeout)
+{
+    bool ret = false;
+
+    /* Check params */
+    if (uring != NULL)
+    {
+        ret = mqtt_socket_uring_flush_pending(uring);
+        if (ret)
+        {
+            /* Don't wait if some events are already available */
+            uint32_t min_complete = 1u;
+            if ((ms_timeout == 0u) ||
+                (uring->backlog_count != 0u) ||
+                (MQTT_SOCKET_URING_LOAD_ACQUIRE(uring->cq_tail) != (*uring->cq_head)))
+            {
+                min_complete = 0u;
+            }
+            ret = mqtt_socket_uring_enter(uring, min_complete, ms_timeout);
+        }
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Get the next event */
+bool mqtt_socket_uring_get_event(mqtt_socket_uring_t* const uring, mqtt_socket_uring_event_t* const event)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((uring != NULL) && (event != NULL))
+    {
+        if (uring->backlog_count != 0u)
+        {
+            /* Events retrieved while waiting for a send buffer */
+            (void)memcpy(event, &uring->backlog[uring->backlog_first], sizeof(mqtt_socket_uring_event_t));
+            uring->backlog_first = (uring->backlog_first + 1u) % MQTT_SOCKET_URING_ENTRIES;
+            uring->backlog_count--;
+            ret = true;
+        }
+        else
+        {
+            /* Completion queue, internal completions are not reported */
+            uint32_t head = (*uring->cq_head);
+            const uint32_t tail = MQTT_SOCKET_URING_LOAD_ACQUIRE(uring->cq_tail);
+            while (!ret && (head != tail))
+            {
+                ret = mqtt_socket_uring_process_cqe(uring, &uring->cqes[head & uring->cq_mask], event);
+                head++;
+                MQTT_SOCKET_URING_STORE_RELEASE(uring->cq_head, head);
+            }
+        }
+        if (!ret)
+        {
+            mqtt_errno_set(MQTT_ERR_SOCKET_PENDING);
+        }
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Give a receive buffer back to the kernel once the received data has been processed */
+bool mqtt_socket_uring_release_buffer(mqtt_socket_uring_t* const uring, const mqtt_socket_uring_event_t* const event)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((uring != NULL) && (event != NULL) && (event->buffer_id < MQTT_SOCKET_URING_RECV_BUFFER_COUNT))
+    {
+        if (event->has_buffer)
+        {
+            struct io_uring_buf* const buf = &uring->recv_ring->bufs[uring->recv_ring_tail & (MQTT_SOCKET_URING_RECV_BUFFER_COUNT - 1u)];
+            buf->addr = (uint64_t)(uintptr_t)(uring->recv_buffers + event->buffer_id * MQTT_SOCKET_URING_RECV_BUFFER_SIZE);
+            buf->len = MQTT_SOCKET_URING_RECV_BUFFER_SIZE;
+            buf->bid = event->buffer_id;
+            uring->recv_ring_tail++;
+            MQTT_SOCKET_URING_STORE_RELEASE(&uring->recv_ring->tail, uring->recv_ring_tail);
+        }
+        ret = true;
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+
+
+
+/** \brief Get a free submission queue entry */
+static struct io_uring_sqe* mqtt_socket_uring_get_sqe(mqtt_socket_uring_t* const uring)
+{
+    /* No null-pointer test for the parameters because this function is meant to be called
+       from the inside of the library where the parameters are already checked */
+
+    struct io_uring_sqe* sqe = NULL;
+    const uint32_t tail = (*uring->sq_tail);
+    uint32_t head = MQTT_SOCKET_URING_LOAD_ACQUIRE(uring->sq_head);
+
+    /* Submit the queued entries if the submission queue is full */
+    if ((tail - head) >= uring->sq_entries)
+    {
+        (void)mqtt_socket_uring_enter(uring, 0u, 0u);
+        head = MQTT_SOCKET_URING_LOAD_ACQUIRE(uring->sq_head);
+    }
+    if ((tail - head) < uring->sq_entries)
+    {
+        /* The kernel only reads the entries during the submission system call */
+        const uint32_t index = (tail & uring->sq_mask);
+        sqe = &uring->sqes[index];
+        (void)memset(sqe, 0, sizeof(struct io_uring_sqe));
+        uring->sq_array[index] = index;
+        MQTT_SOCKET_URING_STORE_RELEASE(uring->sq_tail, tail + 1u);
+        uring->to_submit++;
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_SOCKET_PENDING);
+    }
+
+    return sqe;
+}
+
+/** \brief Submit the queued entries and optionally wait for completions */
+static bool mqtt_socket_uring_enter(mqtt_socket_uring_t* const uring, const uint32_t min_complete, const uint32_t ms_timeout)
+{
+    /* No null-pointer test for the parameters because this function is meant to be called
+       from the inside of the library where the parameters are already checked */
+
+    bool ret = true;
+    struct __kernel_timespec timeout;
+    struct io_uring_getevents_arg arg;
+    long submitted;
+
+    /* Always ask for the completions to be flushed so that the deferred work gets done */
+    (void)memset(&arg, 0, sizeof(arg));
+    timeout.tv_sec = (long long)(ms_timeout / 1000u);
+    timeout.tv_nsec = (long long)((ms_timeout % 1000u) * 1000000u);
+    arg.ts = (uint64_t)(uintptr_t)&timeout;
+    submitted = syscall(__NR_io_uring_enter, uring->ring_fd, uring->to_submit, min_complete,
+                        IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    if (submitted >= 0)
+    {
+        if ((uint32_t)submitted >= uring->to_submit)
+        {
+            uring->to_submit = 0u;
+        }
+        else
+        {
+            uring->to_submit -= (uint32_t)submitted;
+        }
+    }
+    else if ((errno != ETIME) && (errno != EINTR) && (errno != EAGAIN) && (errno != EBUSY))
+    {
+        mqtt_errno_set(MQTT_ERR_SOCKET_FAILED);
+        ret = false;
+    }
+    else
+    {
+        /* Timeout or transient failure, nothing to do */
+    }
+
+    return ret;
+}
+
+/** \brief Queue the send operations of the endpoints waiting for the next submission */
+static bool mqtt_socket_uring_flush_pending(mqtt_socket_uring_t* const uring)
+{
+    /* No null-pointer test for the parameters because this function is meant to be called
+       from the inside of the library where the parameters are already checked */
+
+    bool ret = true;
+
+    while (ret && (uring->first_pending != NULL))
+    {
+        mqtt_socket_uring_endpoint_t* const endpoint = uring->first_pending;
+        struct io_uring_sqe* const sqe = mqtt_socket_uring_get_sqe(uring);
+        if (sqe != NULL)
+        {
+            const mqtt_socket_uring_send_buffer_t* const send_buffer = &uring->send_buffers[endpoint->first_buffer];
+
+            /* Only one send operation at a time per socket to keep the ordering of the data */
+            sqe->opcode = IORING_OP_SEND;
+            sqe->fd = endpoint->socket;
+            sqe->addr = (uint64_t)(uintptr_t)send_buffer->data;
+            sqe->len = send_buffer->size;
+            sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+            sqe->user_data = MQTT_SOCKET_URING_USER_DATA(MQTT_SOCKET_URING_EVT_SEND, (uint32_t)endpoint->first_buffer);
+            endpoint->sending = true;
+
+            uring->first_pending = endpoint->next_pending;
+            endpoint->pending = false;
+            endpoint->next_pending = NULL;
+        }
+        else
+        {
+            ret = false;
+        }
+    }
+
+    return ret;
+}
+
+/** \brief Add an endpoint to the list of the endpoints waiting for the next submission */
+static void mqtt_socket_uring_add_pending(mqtt_socket_uring_endpoint_t* const endpoint)
+{
+    /* No null-pointer test for the parameters because this function is meant to be called
+       from the inside of the library where the parameters are already checked */
+
+    if (!endpoint->pending)
+    {
+        endpoint->pending = true;
+        endpoint->next_pending = endpoint->uring->first_pending;
+        endpoint->uring->first_pending = endpoint;
+    }
+}
+
+/** \brief Release a list of send buffers */
+static void mqtt_socket_uring_release_send_buffers(mqtt_socket_uring_t* const uring, int32_t buffer_index)
+{
+    /* No null-pointer test for the parameters because this function is meant to be called
+       from the inside of the library where the parameters are already checked */
+
+    while (buffer_index >= 0)
+    {
+        mqtt_socket_uring_send_buffer_t* const send_buffer = &uring->send_buffers[buffer_index];
+        const int32_t next = send_buffer->next;
+        send_buffer->endpoint = NULL;
+        send_buffer->size = 0u;
+        send_buffer->next = uring->first_free_send_buffer;
+        uring->first_free_send_buffer = buffer_index;
+        buffer_index = next;
+    }
+}
+
+/** \brief Wait for a send buffer to be released */
+static bool mqtt_socket_uring_wait_send_buffer(mqtt_socket_uring_t* const uring)
+{
+    /* No null-pointer test for the parameters because this function is meant to be called
+       from the inside of the library where the parameters are already checked */
+
+    bool ret = true;
+    bool progress = true;
+
+    while (ret && progress && (uring->first_free_send_buffer < 0))
+    {
+        /* Submit the pending sends and wait for their completion */
+        ret = mqtt_socket_uring_flush_pending(uring);
+        if (ret)
+        {
+            ret = mqtt_socket_uring_enter(uring, 1u, MQTT_SOCKET_URING_SEND_TIMEOUT);
+        }
+        if (ret)
+        {
+            /* Move the completions into the backlog so that they are reported later */
+            uint32_t head = (*uring->cq_head);
+            const uint32_t tail = MQTT_SOCKET_URING_LOAD_ACQUIRE(uring->cq_tail);
+            progress = false;
+            while ((head != tail) && (uring->backlog_count < MQTT_SOCKET_URING_ENTRIES))
+            {
+                const uint32_t index = (uring->backlog_first + uring->backlog_count) % MQTT_SOCKET_URING_ENTRIES;
+                if (mqtt_socket_uring_process_cqe(uring, &uring->cqes[head & uring->cq_mask], &uring->backlog[index]))
+                {
+                    uring->backlog_count++;
+                }
+                head++;
+                MQTT_SOCKET_URING_STORE_RELEASE(uring->cq_head, head);
+                progress = true;
+            }
+        }
+    }
+    if (ret && (uring->first_free_send_buffer < 0))
+    {
+        mqtt_errno_set(MQTT_ERR_SOCKET_PENDING);
+        ret = false;
+    }
+
+    return ret;
+}
+
+/** \brief Check with a test submission that the kernel supports the multishot receive (Linux 6.0 and later) */
+static bool mqtt_socket_uring_probe_receive(mqtt_socket_uring_t* const uring)
+{
+    /* No null-pointer test for the parameters because this function is meant to be called
+       from the inside of the library where the parameters are already checked */
+
+    bool supported = false;
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0)
+    {
+        /* Multishot receive on an idle socket, cancelled right away : it completes with -ECANCELED if it has
+           been armed and with -EINVAL if the kernel doesn't know the multishot flag */
+        const uint64_t receive_user_data = MQTT_SOCKET_URING_USER_DATA(MQTT_SOCKET_URING_EVT_RECEIVE, MQTT_SOCKET_URING_PROBE_TAG);
+        uint32_t completed = 0u;
+        bool progress = true;
+        struct io_uring_sqe* sqe = mqtt_socket_uring_get_sqe(uring);
+        if (sqe != NULL)
+        {
+            sqe->opcode = IORING_OP_RECV;
+            sqe->fd = fds[0];
+            sqe->ioprio = IORING_RECV_MULTISHOT;
+            sqe->flags = IOSQE_BUFFER_SELECT;
+            sqe->buf_group = MQTT_SOCKET_URING_BUFFER_GROUP;
+            sqe->user_data = receive_user_data;
+            sqe = mqtt_socket_uring_get_sqe(uring);
+        }
+        if (sqe != NULL)
+        {
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = -1;
+            sqe->addr = receive_user_data;
+            sqe->user_data = MQTT_SOCKET_URING_USER_DATA(MQTT_SOCKET_URING_EVT_CANCEL, MQTT_SOCKET_URING_PROBE_TAG);
+        }
+        else
+        {
+            progress = false;
+        }
+
+        /* Wait for both completions, they are not reported as events */
+        while (progress && (completed < 2u))
+        {
+            progress = mqtt_socket_uring_enter(uring, 1u, MQTT_SOCKET_URING_PROBE_TIMEOUT);
+            if (progress)
+            {
+                uint32_t head = (*uring->cq_head);
+                const uint32_t tail = MQTT_SOCKET_URING_LOAD_ACQUIRE(uring->cq_tail);
+                progress = (head != tail);
+                while (head != tail)
+                {
+                    const struct io_uring_cqe* const cqe = &uring->cqes[head & uring->cq_mask];
+                    if (cqe->user_data == receive_user_data)
+                    {
+                        supported = (cqe->res == -ECANCELED);
+                    }
+                    completed++;
+                    head++;
+                    MQTT_SOCKET_URING_STORE_RELEASE(uring->cq_head, head);
+                }
+            }
+        }
+        if (completed < 2u)
+        {
+            /* The ring can't be used while an operation may still complete */
+            supported = false;
+        }
+        (void)close(fds[0]);
+        (void)close(fds[1]);
+    }
+
+    return supported;
+}
+
+/** \brief Process a completion queue entry, returns true if an event must be reported */
+static bool mqtt_socket_uring_process_cqe(mqtt_socket_uring_t* const uring, const struct io_uring_cqe* const cqe, mqtt_socket_uring_event_t* const event)
+{
+    /* No null-pointer test for the parameters because this function is meant to be called
+       from the inside of the library where the parameters are already checked */
+
+    bool ret = false;
+    const mqtt_socket_uring_event_type_t type = (mqtt_socket_uring_event_type_t)(cqe->user_data >> 32u);
+    const uint32_t tag = (uint32_t)(cqe->user_data & 0xFFFFFFFFu);
+
+    (void)memset(event, 0, sizeof(mqtt_socket_uring_event_t));
+    event->type = type;
+    event->tag = tag;
+    event->socket = -1;
+    event->more = ((cqe->flags & IORING_CQE_F_MORE) != 0u);
+    switch (type)
+    {
+        case MQTT_SOCKET_URING_EVT_ACCEPT:
+        {
+            event->success = (cqe->res >= 0);
+            if (event->success)
+            {
+                event->socket = cqe->res;
+            }
+            ret = true;
+            break;
+        }
+
+        case MQTT_SOCKET_URING_EVT_RECEIVE:
+        {
+            event->has_buffer = ((cqe->flags & IORING_CQE_F_BUFFER) != 0u);
+            if (event->has_buffer)
+            {
+                event->buffer_id = (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+            }
+            if (cqe->res > 0)
+            {
+                event->success = true;
+                event->data = uring->recv_buffers + event->buffer_id * MQTT_SOCKET_URING_RECV_BUFFER_SIZE;
+                event->size = (size_t)cqe->res;
+            }
+            else
+            {
+                /* No receive buffer available : the connection is still valid but the receive must be armed again,
+                   otherwise the connection has been closed by the peer or has failed */
+                event->success = (cqe->res == -ENOBUFS);
+                event->more = false;
+            }
+            ret = true;
+            break;
+        }
+
+        case MQTT_SOCKET_URING_EVT_SEND:
+        {
+            mqtt_socket_uring_send_buffer_t* const send_buffer = &uring->send_buffers[tag];
+            mqtt_socket_uring_endpoint_t* const endpoint = send_buffer->endpoint;
+            const int32_t next = send_buffer->next;
+            const bool success = ((cqe->res >= 0) && ((uint32_t)cqe->res == send_buffer->size));
+
+            /* Release the buffer, the endpoint may have been cancelled in the meantime */
+            send_buffer->next = -1;
+            mqtt_socket_uring_release_send_buffers(uring, (int32_t)tag);
+            if ((endpoint != NULL) && endpoint->sending && (endpoint->first_buffer == (int32_t)tag))
+            {
+                endpoint->sending = false;
+                endpoint->first_buffer = next;
+                if (!success)
+                {
+                    /* Drop the remaining data and report the failure */
+                    mqtt_socket_uring_release_send_buffers(uring, endpoint->first_buffer);
+                    endpoint->first_buffer = -1;
+                    endpoint->last_buffer = -1;
+                    event->tag = endpoint->tag;
+                    ret = true;
+                }
+                else if (endpoint->first_buffer < 0)
+                {
+                    endpoint->last_buffer = -1;
+                }
+                else
+                {
+                    mqtt_socket_uring_add_pending(endpoint);
+                }
+            }
+            break;
+        }
+
+        default:
+        {
+            /* Cancellation, nothing to report */
+            break;
+        }
+    }
+
+    return ret;
+}
+
+#endif /* MQTT_SOCKET_IO_URING_ENABLED */
@@ -21,6 +21,7 @@ along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
 #define MQTT_SOCKET_T_H
 
 #include "stdheaders.h"
+#include "mqtt_config.h"
 #include <windows.h>
 
 #ifdef __cplusplus
@@ -32,6 +33,17 @@ extern "C"
 /** \brief MQTT socket */
 typedef SOCKET mqtt_socket_t;
 
+/** \brief Socket poller (WSAPoll() based, limited number of sockets) */
+typedef struct _mqtt_socket_poller_t
+{
+    /** \brief Polled sockets */
+    mqtt_socket_t sockets[MQTT_SOCKET_POLLER_MAX_SOCKETS];
+    /** \brief Tags of the polled sockets */
+    uint32_t tags[MQTT_SOCKET_POLLER_MAX_SOCKETS];
+    /** \brief Number of polled sockets */
+    uint32_t count;
+} mqtt_socket_poller_t;
+
 
 #ifdef __cplusplus
 }
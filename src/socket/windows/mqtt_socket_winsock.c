@@ -88,11 +88,10 @@ bool mqtt_socket_close(mqtt_socket_t* const mqtt_socket)
     /* Check params */
     if (mqtt_socket != NULL)
     {
-        ret = (shutdown((*mqtt_socket), SD_BOTH) == 0);
-        if (ret)
-        {      
-            ret = (closesocket((*mqtt_socket)) == 0);
-        }
+        /* Shutdown may fail if the peer has already closed the connection
+           but the socket handle must always be released */
+        (void)shutdown((*mqtt_socket), SD_BOTH);
+        ret = (closesocket((*mqtt_socket)) == 0);
         if (!ret)
         {
             mqtt_errno_set(MQTT_ERR_SOCKET_FAILED);
@@ -305,7 +304,12 @@ bool mqtt_socket_receive(mqtt_socket_t* const mqtt_socket, void* data, const siz
         (received != NULL))
     {
         const int32_t callret = (int32_t)recv((*mqtt_socket), (char*)data, (int)size, 0);
-        if (callret >= 0)
+        if ((callret == 0) && (size != 0u))
+        {
+            /* Connection closed by the peer */
+            mqtt_errno_set(MQTT_ERR_SOCKET_FAILED);
+        }
+        else if (callret >= 0)
         {
             /* Success */
             (*received) = (size_t)(callret);
@@ -371,3 +375,265 @@ bool mqtt_socket_select(mqtt_socket_t* const mqtt_socket, const uint32_t ms_time
 
     return ret;
 }
+
+/** \brief Apply tuning options to a MQTT socket */
+bool mqtt_socket_set_options(mqtt_socket_t* const mqtt_socket, const mqtt_socket_options_t* const options)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((mqtt_socket != NULL) &&
+        (options != NULL))
+    {
+        /* Only the options supported by all the Windows versions are applied */
+        int option_value;
+        ret = true;
+        if (options->send_buffer_size != 0u)
+        {
+            option_value = (int)options->send_buffer_size;
+            ret = (setsockopt((*mqtt_socket), SOL_SOCKET, SO_SNDBUF, (const char*)&option_value, sizeof(option_value)) == 0) && ret;
+        }
+        if (options->receive_buffer_size != 0u)
+        {
+            option_value = (int)options->receive_buffer_size;
+            ret = (setsockopt((*mqtt_socket), SOL_SOCKET, SO_RCVBUF, (const char*)&option_value, sizeof(option_value)) == 0) && ret;
+        }
+        if (options->no_delay)
+        {
+            option_value = 1;
+            ret = (setsockopt((*mqtt_socket), IPPROTO_TCP, TCP_NODELAY, (const char*)&option_value, sizeof(option_value)) == 0) && ret;
+        }
+        if (options->keepalive)
+        {
+            option_value = 1;
+            ret = (setsockopt((*mqtt_socket), SOL_SOCKET, SO_KEEPALIVE, (const char*)&option_value, sizeof(option_value)) == 0) && ret;
+        }
+        if (!ret)
+        {
+            mqtt_errno_set(MQTT_ERR_SOCKET_FAILED);
+        }
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Enable or disable the zero-copy transmit mode on a MQTT socket */
+bool mqtt_socket_set_zerocopy(mqtt_socket_t* const mqtt_socket, const bool enable)
+{
+    bool ret = false;
+
+    /* Check params */
+    if (mqtt_socket != NULL)
+    {
+        /* Not supported */
+        (void)enable;
+        mqtt_errno_set(MQTT_ERR_SOCKET_FAILED);
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Send data on a MQTT socket without copying it into the kernel */
+bool mqtt_socket_send_zerocopy(mqtt_socket_t* const mqtt_socket, const void* data, const size_t size, size_t* const sent, uint32_t* const zerocopy_sent)
+{
+    bool ret = false;
+
+    /* Check params */
+    if (zerocopy_sent != NULL)
+    {
+        /* Not supported : copy the data */
+        ret = mqtt_socket_send(mqtt_socket, data, size, sent);
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Read the zero-copy send completions from the socket error queue without blocking */
+bool mqtt_socket_get_zerocopy_completions(mqtt_socket_t* const mqtt_socket, uint32_t* const completed)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((mqtt_socket != NULL) &&
+        (completed != NULL))
+    {
+        /* Nothing to do : the data is always copied */
+        ret = true;
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Initialize a socket poller */
+bool mqtt_socket_poller_init(mqtt_socket_poller_t* const poller)
+{
+    bool ret = false;
+
+    /* Check params */
+    if (poller != NULL)
+    {
+        poller->count = 0u;
+        ret = true;
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Release a socket poller */
+bool mqtt_socket_poller_deinit(mqtt_socket_poller_t* const poller)
+{
+    bool ret = false;
+
+    /* Check params */
+    if (poller != NULL)
+    {
+        poller->count = 0u;
+        ret = true;
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Add a socket to a socket poller */
+bool mqtt_socket_poller_add(mqtt_socket_poller_t* const poller, mqtt_socket_t* const mqtt_socket, const uint32_t tag)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((poller != NULL) &&
+        (mqtt_socket != NULL))
+    {
+        if (poller->count < MQTT_SOCKET_POLLER_MAX_SOCKETS)
+        {
+            poller->sockets[poller->count] = (*mqtt_socket);
+            poller->tags[poller->count] = tag;
+            poller->count++;
+            ret = true;
+        }
+        else
+        {
+            mqtt_errno_set(MQTT_ERR_SOCKET_FAILED);
+        }
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Remove a socket from a socket poller */
+bool mqtt_socket_poller_remove(mqtt_socket_poller_t* const poller, mqtt_socket_t* const mqtt_socket)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((poller != NULL) &&
+        (mqtt_socket != NULL))
+    {
+        uint32_t i;
+        for (i = 0u; (i < poller->count) && !ret; i++)
+        {
+            if (poller->sockets[i] == (*mqtt_socket))
+            {
+                /* Replace by the last socket */
+                poller->count--;
+                poller->sockets[i] = poller->sockets[poller->count];
+                poller->tags[i] = poller->tags[poller->count];
+                ret = true;
+            }
+        }
+        if (!ret)
+        {
+            mqtt_errno_set(MQTT_ERR_SOCKET_FAILED);
+        }
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Wait for data ready to receive on the sockets of a socket poller */
+bool mqtt_socket_poller_wait(mqtt_socket_poller_t* const poller, mqtt_socket_poller_event_t* const events, 
+                             const uint32_t max_events, const uint32_t ms_timeout, uint32_t* const count)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((poller != NULL) &&
+        (events != NULL) &&
+        (max_events != 0u) &&
+        (count != NULL))
+    {
+        int callret;
+        uint32_t i;
+        WSAPOLLFD fds[MQTT_SOCKET_POLLER_MAX_SOCKETS];
+
+        (*count) = 0u;
+        for (i = 0u; i < poller->count; i++)
+        {
+            fds[i].fd = poller->sockets[i];
+            fds[i].events = POLLRDNORM;
+            fds[i].revents = 0;
+        }
+        callret = WSAPoll(fds, (ULONG)poller->count, (INT)ms_timeout);
+        for (i = 0u; (callret > 0) && (i < poller->count) && ((*count) < max_events); i++)
+        {
+            if (fds[i].revents != 0)
+            {
+                events[(*count)].tag = poller->tags[i];
+                events[(*count)].readable = ((fds[i].revents & POLLRDNORM) != 0);
+                events[(*count)].error = ((fds[i].revents & (POLLERR | POLLHUP | POLLNVAL)) != 0);
+                (*count)++;
+            }
+        }
+        if (callret > 0)
+        {
+            /* Sockets ready */
+            ret = true;
+        }
+        else if (callret == 0)
+        {
+            /* Nothing ready */
+            mqtt_errno_set(MQTT_ERR_SOCKET_PENDING);
+        }
+        else
+        {
+            mqtt_errno_set(MQTT_ERR_SOCKET_FAILED);
+        }
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
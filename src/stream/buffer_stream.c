@@ -27,6 +27,9 @@ static bool buffer_stream_reset_input(input_stream_t* const stream, const size_t
 /** \brief Input stream reader function */
 static bool buffer_stream_reader(input_stream_t* const stream, void* data, const size_t size);
 
+/** \brief Input stream peek function */
+static size_t buffer_stream_peek(input_stream_t* const stream, const uint8_t** data);
+
 /** \brief Output stream reset function */
 static bool buffer_stream_reset_output(output_stream_t* const stream);
 
@@ -48,6 +51,7 @@ bool buffer_stream_input_from_buffer(input_stream_t* const stream, uint8_t buffe
         /* Init input stream */
         stream->reset = buffer_stream_reset_input;
         stream->reader = buffer_stream_reader;
+        stream->peek = buffer_stream_peek;
         stream->size = size;
         stream->read = 0u;
         stream->param = buffer;
@@ -144,6 +148,18 @@ static bool buffer_stream_reader(input_stream_t* const stream, void* data, const
     return ret;
 }
 
+/** \brief Input stream peek function */
+static size_t buffer_stream_peek(input_stream_t* const stream, const uint8_t** data)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    (*data) = (const uint8_t*)stream->param;
+    return (stream->size - stream->read);
+}
+
 /** \brief Output stream reset function */
 static bool buffer_stream_reset_output(output_stream_t* const stream)
 {
@@ -38,6 +38,10 @@ typedef bool(*fp_input_stream_reset_t)(input_stream_t* const, const size_t new_s
 /** \brief Output stream reader function */
 typedef bool(*fp_input_stream_reader_t)(input_stream_t* const, void*, const size_t);
 
+/** \brief Input stream peek function : gives access to the next bytes without consuming them
+           => returns the number of contiguous bytes available at the returned address */
+typedef size_t(*fp_input_stream_peek_t)(input_stream_t* const, const uint8_t** data);
+
 /** \brief Represents an output stream */
 struct _input_stream_t
 {
@@ -47,6 +51,9 @@ struct _input_stream_t
     /** \brief Writer function */
     fp_input_stream_reader_t reader;
 
+    /** \brief Peek function (NULL if the stream doesn't allow to look ahead) */
+    fp_input_stream_peek_t peek;
+
     /** \brief Number of bytes read */
     size_t read;
 
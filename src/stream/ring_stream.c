@@ -0,0 +1,751 @@
+/*
+Copyright(c) 2016 Cedric Jimenez
+
+This file is part of lw-mqtt.
+
+lw-mqtt is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+lw-mqtt is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "mqtt.h"
+#include "mqtt_error.h"
+#include "ring_stream.h"
+
+
+#if defined(__GNUC__) || defined(__clang__)
+
+/** \brief Load an index written by the other side */
+#define RING_STREAM_LOAD_ACQUIRE(ptr)           __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+
+/** \brief Store an index read by the other side */
+#define RING_STREAM_STORE_RELEASE(ptr, value)   __atomic_store_n((ptr), (value), __ATOMIC_RELEASE)
+
+/** \brief Change the state of a link if it has the expected value */
+#define RING_STREAM_COMPARE_EXCHANGE(ptr, expected, desired) \
+    __atomic_compare_exchange_n((ptr), &(expected), (desired), false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+
+#else
+
+#include <intrin.h>
+
+/** \brief Load an index written by the other side (volatile accesses have acquire semantics with MSVC) */
+#define RING_STREAM_LOAD_ACQUIRE(ptr)           (*(ptr))
+
+/** \brief Store an index read by the other side (volatile accesses have release semantics with MSVC) */
+#define RING_STREAM_STORE_RELEASE(ptr, value)   ((*(ptr)) = (value))
+
+/** \brief Change the state of a link if it has the expected value */
+#define RING_STREAM_COMPARE_EXCHANGE(ptr, expected, desired) \
+    ring_stream_compare_exchange((ptr), &(expected), (desired))
+
+/** \brief Change the state of a link if it has the expected value, updates expected with the current value */
+static bool ring_stream_compare_exchange(volatile uint32_t* const ptr, uint32_t* const expected, const uint32_t desired);
+
+#endif /* defined(__GNUC__) || defined(__clang__) */
+
+
+/** \brief Input stream reset function */
+static bool ring_stream_reset_input(input_stream_t* const stream, const size_t new_size);
+
+/** \brief Input stream reader function */
+static bool ring_stream_reader(input_stream_t* const stream, void* data, const size_t size);
+
+/** \brief Output stream reset function */
+static bool ring_stream_reset_output(output_stream_t* const stream);
+
+/** \brief Output stream writer function */
+static bool ring_stream_writer(output_stream_t* const stream, const void* data, const size_t size);
+
+/** \brief Check if the other side of a link is still connected */
+static bool ring_stream_peer_connected(const ring_stream_endpoint_t* const endpoint);
+
+/** \brief Copy as much data as possible into a ring buffer, returns the number of bytes copied */
+static uint32_t ring_stream_copy_to_ring(ring_stream_buffer_t* const tx, const uint8_t* const data, const uint32_t size);
+
+/** \brief Move as much data as possible from the backlog of one side of a link into its ring buffer,
+           returns true if the backlog is empty */
+static bool ring_stream_flush_backlog(ring_stream_endpoint_t* const endpoint);
+
+/** \brief Check if the available data of a ring buffer contains a whole packet */
+static bool ring_stream_has_packet(const ring_stream_buffer_t* const rx, const uint32_t tail, const uint32_t available);
+
+/** \brief Initialize a side of a link */
+static void ring_stream_endpoint_init(ring_stream_endpoint_t* const endpoint, ring_stream_link_t* const link,
+                                      ring_stream_buffer_t* const rx, ring_stream_buffer_t* const tx, const bool client);
+
+
+
+/** \brief Initialize a link */
+bool ring_stream_link_init(ring_stream_link_t* const link)
+{
+    bool ret = false;
+
+    /* Check params */
+    if (link != NULL)
+    {
+        (void)memset(link, 0, sizeof(ring_stream_link_t));
+        ring_stream_endpoint_init(&link->client_endpoint, link, &link->to_client, &link->to_broker, true);
+        ring_stream_endpoint_init(&link->broker_endpoint, link, &link->to_broker, &link->to_client, false);
+        link->state = RING_STREAM_LINK_IDLE;
+        ret = true;
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Connect the client side of an idle link */
+bool ring_stream_link_connect(ring_stream_link_t* const link)
+{
+    bool ret = false;
+
+    /* Check params */
+    if (link != NULL)
+    {
+        /* Nobody uses the ring buffers of an idle link */
+        uint32_t expected = RING_STREAM_LINK_IDLE;
+        if (RING_STREAM_LOAD_ACQUIRE(&link->state) == RING_STREAM_LINK_IDLE)
+        {
+            link->to_broker.head = 0u;
+            link->to_broker.tail = 0u;
+            link->to_client.head = 0u;
+            link->to_client.tail = 0u;
+            link->client_endpoint.backlog_start = 0u;
+            link->client_endpoint.backlog_end = 0u;
+            link->broker_endpoint.backlog_start = 0u;
+            link->broker_endpoint.backlog_end = 0u;
+            ret = RING_STREAM_COMPARE_EXCHANGE(&link->state, expected, (uint32_t)RING_STREAM_LINK_CONNECTING);
+        }
+        if (!ret)
+        {
+            mqtt_errno_set(MQTT_ERR_SOCKET_FAILED);
+        }
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Accept the connection of the client on the broker side of a link */
+bool ring_stream_link_accept(ring_stream_link_t* const link)
+{
+    bool ret = false;
+
+    /* Check params */
+    if (link != NULL)
+    {
+        uint32_t expected = RING_STREAM_LINK_CONNECTING;
+        ret = RING_STREAM_COMPARE_EXCHANGE(&link->state, expected, (uint32_t)RING_STREAM_LINK_CONNECTED);
+        if (!ret)
+        {
+            mqtt_errno_set(MQTT_ERR_SOCKET_PENDING);
+        }
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Close one side of a link */
+bool ring_stream_link_close(ring_stream_endpoint_t* const endpoint)
+{
+    bool ret = false;
+
+    /* Check params */
+    if (endpoint != NULL)
+    {
+        /* The link becomes idle once both sides are closed, the client side
+           can be closed directly if the broker has not accepted the connection yet */
+        uint32_t state = RING_STREAM_LOAD_ACQUIRE(&endpoint->link->state);
+        bool done = false;
+        while (!done)
+        {
+            uint32_t next_state;
+            switch (state)
+            {
+                case RING_STREAM_LINK_CONNECTING:
+                {
+                    next_state = (endpoint->client ? (uint32_t)RING_STREAM_LINK_IDLE : state);
+                    break;
+                }
+
+                case RING_STREAM_LINK_CONNECTED:
+                {
+                    next_state = (endpoint->client ? (uint32_t)RING_STREAM_LINK_CLIENT_CLOSED : (uint32_t)RING_STREAM_LINK_BROKER_CLOSED);
+                    break;
+                }
+
+                case RING_STREAM_LINK_CLIENT_CLOSED:
+                {
+                    next_state = (endpoint->client ? state : (uint32_t)RING_STREAM_LINK_IDLE);
+                    break;
+                }
+
+                case RING_STREAM_LINK_BROKER_CLOSED:
+                {
+                    next_state = (endpoint->client ? (uint32_t)RING_STREAM_LINK_IDLE : state);
+                    break;
+                }
+
+                default:
+                {
+                    /* Already closed */
+                    next_state = state;
+                    break;
+                }
+            }
+            if (next_state == state)
+            {
+                done = true;
+            }
+            else
+            {
+                done = RING_STREAM_COMPARE_EXCHANGE(&endpoint->link->state, state, next_state);
+            }
+        }
+
+        ret = true;
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Attach a buffer to one side of a link to keep the data written while the ring buffer is full */
+bool ring_stream_set_backlog(ring_stream_endpoint_t* const endpoint, uint8_t* const buffer, const size_t size)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((endpoint != NULL) &&
+        ((buffer != NULL) || (size == 0u)) &&
+        (size <= UINT32_MAX))
+    {
+        endpoint->backlog = buffer;
+        endpoint->backlog_size = (uint32_t)size;
+        endpoint->backlog_start = 0u;
+        endpoint->backlog_end = 0u;
+        ret = true;
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Move the data kept in the backlog of one side of a link into its ring buffer */
+bool ring_stream_flush(ring_stream_endpoint_t* const endpoint)
+{
+    bool ret = false;
+
+    /* Check params */
+    if (endpoint != NULL)
+    {
+        if (!ring_stream_peer_connected(endpoint))
+        {
+            /* The data is lost if the other side is closed */
+            endpoint->backlog_start = 0u;
+            endpoint->backlog_end = 0u;
+            mqtt_errno_set(MQTT_ERR_SOCKET_FAILED);
+        }
+        else if (ring_stream_flush_backlog(endpoint))
+        {
+            ret = true;
+        }
+        else
+        {
+            mqtt_errno_set(MQTT_ERR_SOCKET_PENDING);
+        }
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Check if a whole packet is ready to receive on one side of a link without waiting */
+bool ring_stream_is_readable(ring_stream_endpoint_t* const endpoint)
+{
+    bool ret = false;
+
+    /* Check params */
+    if (endpoint != NULL)
+    {
+        /* Check the state first : the data sent before the closing of the other side must still be received,
+           a packet is only processed once it has been fully written so that reading it never waits */
+        const bool connected = ring_stream_peer_connected(endpoint);
+        const uint32_t tail = endpoint->rx->tail;
+        const uint32_t available = RING_STREAM_LOAD_ACQUIRE(&endpoint->rx->head) - tail;
+        if ((available != 0u) && ring_stream_has_packet(endpoint->rx, tail, available))
+        {
+            ret = true;
+        }
+        else if (connected)
+        {
+            mqtt_errno_set(MQTT_ERR_SOCKET_PENDING);
+        }
+        else
+        {
+            mqtt_errno_set(MQTT_ERR_SOCKET_FAILED);
+        }
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Get the number of bytes which can be received on one side of a link without waiting */
+bool ring_stream_get_readable_size(ring_stream_endpoint_t* const endpoint, size_t* const size)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((endpoint != NULL) &&
+        (size != NULL))
+    {
+        (*size) = (size_t)(RING_STREAM_LOAD_ACQUIRE(&endpoint->rx->head) - endpoint->rx->tail);
+        ret = true;
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Get the number of bytes which can be sent on one side of a link without waiting */
+bool ring_stream_get_writable_size(ring_stream_endpoint_t* const endpoint, size_t* const size)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((endpoint != NULL) &&
+        (size != NULL))
+    {
+        /* The ring buffer is only written directly once the backlog is empty */
+        (*size) = (size_t)(endpoint->backlog_size - endpoint->backlog_end) + endpoint->backlog_start;
+        if (endpoint->backlog_start == endpoint->backlog_end)
+        {
+            (*size) += (size_t)(MQTT_RING_STREAM_SIZE - (endpoint->tx->head - RING_STREAM_LOAD_ACQUIRE(&endpoint->tx->tail)));
+        }
+        ret = true;
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Initialize an input stream from one side of a link */
+bool ring_stream_input_from_endpoint(input_stream_t* const stream, ring_stream_endpoint_t* const endpoint)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((stream != NULL) &&
+        (endpoint != NULL))
+    {
+        /* Init input stream : no peek function since the available bytes may wrap around the end of the buffer */
+        stream->reset = ring_stream_reset_input;
+        stream->reader = ring_stream_reader;
+        stream->peek = NULL;
+        stream->size = UINT32_MAX;
+        stream->read = 0u;
+        stream->param = endpoint;
+
+        ret = true;
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Initialize an output stream from one side of a link */
+bool ring_stream_output_from_endpoint(output_stream_t* const stream, ring_stream_endpoint_t* const endpoint)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((stream != NULL) &&
+        (endpoint != NULL))
+    {
+        /* Init output stream */
+        stream->reset = ring_stream_reset_output;
+        stream->writer = ring_stream_writer;
+        stream->size = UINT32_MAX;
+        stream->written = 0u;
+        stream->param = endpoint;
+
+        ret = true;
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+
+/** \brief Input stream reset function */
+static bool ring_stream_reset_input(input_stream_t* const stream, const size_t new_size)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((stream != NULL) &&
+        (stream->param != NULL))
+    {
+
+        /* Reset stream */
+        stream->read = 0u;
+        (void)new_size;
+
+        ret = true;
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Input stream reader function */
+static bool ring_stream_reader(input_stream_t* const stream, void* data, const size_t size)
+{
+    bool ret = true;
+
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    /* Never wait : the other side may run in the same thread, the whole packets
+       are announced by ring_stream_is_readable() */
+    size_t left = size;
+    uint8_t* data_ptr = (uint8_t*)data;
+    ring_stream_endpoint_t* const endpoint = (ring_stream_endpoint_t*)stream->param;
+    ring_stream_buffer_t* const rx = endpoint->rx;
+    const bool connected = ring_stream_peer_connected(endpoint);
+    while (ret && (left != 0u))
+    {
+        const uint32_t tail = rx->tail;
+        const uint32_t available = RING_STREAM_LOAD_ACQUIRE(&rx->head) - tail;
+        if (available != 0u)
+        {
+            const uint32_t offset = (tail & (MQTT_RING_STREAM_SIZE - 1u));
+            uint32_t count = ((left < available) ? (uint32_t)left : available);
+            if (count > (MQTT_RING_STREAM_SIZE - offset))
+            {
+                count = MQTT_RING_STREAM_SIZE - offset;
+            }
+            (void)memcpy(data_ptr, &rx->data[offset], count);
+            RING_STREAM_STORE_RELEASE(&rx->tail, tail + count);
+            left -= count;
+            data_ptr += count;
+            stream->read += count;
+        }
+        else if (connected)
+        {
+            /* Partial read */
+            mqtt_errno_set(MQTT_ERR_SOCKET_PENDING);
+            ret = false;
+        }
+        else
+        {
+            /* Connection closed */
+            mqtt_errno_set(MQTT_ERR_SOCKET_FAILED);
+            ret = false;
+        }
+    }
+
+    return ret;
+}
+
+/** \brief Output stream reset function */
+static bool ring_stream_reset_output(output_stream_t* const stream)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((stream != NULL) &&
+        (stream->param != NULL))
+    {
+
+        /* Reset stream */
+        stream->written = 0u;
+
+        ret = true;
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Output stream writer function */
+static bool ring_stream_writer(output_stream_t* const stream, const void* data, const size_t size)
+{
+    bool ret = true;
+
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    /* Never wait : the data which doesn't fit in the ring buffer is kept in the backlog until the next flush,
+       the data is lost if the other side is closed */
+    ring_stream_endpoint_t* const endpoint = (ring_stream_endpoint_t*)stream->param;
+    if (ring_stream_peer_connected(endpoint))
+    {
+        /* Keep the order of the data : the ring buffer is only written directly once the backlog is empty */
+        uint32_t count = 0u;
+        if (ring_stream_flush_backlog(endpoint))
+        {
+            count = ring_stream_copy_to_ring(endpoint->tx, (const uint8_t*)data, (uint32_t)size);
+        }
+        if (count != size)
+        {
+            uint32_t left = (uint32_t)size - count;
+            if (((endpoint->backlog_end + left) > endpoint->backlog_size) && (endpoint->backlog_start != 0u))
+            {
+                /* Reuse the flushed part of the backlog */
+                (void)memmove(endpoint->backlog, &endpoint->backlog[endpoint->backlog_start], endpoint->backlog_end - endpoint->backlog_start);
+                endpoint->backlog_end -= endpoint->backlog_start;
+                endpoint->backlog_start = 0u;
+            }
+            if ((endpoint->backlog_end + left) > endpoint->backlog_size)
+            {
+                /* Partial write */
+                left = endpoint->backlog_size - endpoint->backlog_end;
+                mqtt_errno_set(MQTT_ERR_SOCKET_PENDING);
+                ret = false;
+            }
+            if (left != 0u)
+            {
+                (void)memcpy(&endpoint->backlog[endpoint->backlog_end], &((const uint8_t*)data)[count], left);
+                endpoint->backlog_end += left;
+                count += left;
+            }
+        }
+        stream->written += count;
+    }
+    else
+    {
+        /* Connection closed */
+        mqtt_errno_set(MQTT_ERR_SOCKET_FAILED);
+        ret = false;
+    }
+
+    return ret;
+}
+
+/** \brief Check if the other side of a link is still connected */
+static bool ring_stream_peer_connected(const ring_stream_endpoint_t* const endpoint)
+{
+    bool ret;
+
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    /* The client can send data before the broker accepts the connection */
+    const uint32_t state = RING_STREAM_LOAD_ACQUIRE(&endpoint->link->state);
+    if (endpoint->client)
+    {
+        ret = ((state == RING_STREAM_LINK_CONNECTING) || (state == RING_STREAM_LINK_CONNECTED));
+    }
+    else
+    {
+        ret = (state == RING_STREAM_LINK_CONNECTED);
+    }
+
+    return ret;
+}
+
+/** \brief Copy as much data as possible into a ring buffer, returns the number of bytes copied */
+static uint32_t ring_stream_copy_to_ring(ring_stream_buffer_t* const tx, const uint8_t* const data, const uint32_t size)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    /* At most 2 copies when the free space wraps around the end of the buffer */
+    uint32_t copied = 0u;
+    uint32_t head = tx->head;
+    uint32_t space = MQTT_RING_STREAM_SIZE - (head - RING_STREAM_LOAD_ACQUIRE(&tx->tail));
+    while ((copied != size) && (space != 0u))
+    {
+        const uint32_t offset = (head & (MQTT_RING_STREAM_SIZE - 1u));
+        uint32_t count = (((size - copied) < space) ? (size - copied) : space);
+        if (count > (MQTT_RING_STREAM_SIZE - offset))
+        {
+            count = MQTT_RING_STREAM_SIZE - offset;
+        }
+        (void)memcpy(&tx->data[offset], &data[copied], count);
+        head += count;
+        space -= count;
+        copied += count;
+    }
+    RING_STREAM_STORE_RELEASE(&tx->head, head);
+
+    return copied;
+}
+
+/** \brief Move as much data as possible from the backlog of one side of a link into its ring buffer */
+static bool ring_stream_flush_backlog(ring_stream_endpoint_t* const endpoint)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    if (endpoint->backlog_start != endpoint->backlog_end)
+    {
+        endpoint->backlog_start += ring_stream_copy_to_ring(endpoint->tx, &endpoint->backlog[endpoint->backlog_start],
+                                                            endpoint->backlog_end - endpoint->backlog_start);
+        if (endpoint->backlog_start == endpoint->backlog_end)
+        {
+            endpoint->backlog_start = 0u;
+            endpoint->backlog_end = 0u;
+        }
+    }
+
+    return (endpoint->backlog_start == endpoint->backlog_end);
+}
+
+/** \brief Check if the available data of a ring buffer contains a whole packet */
+static bool ring_stream_has_packet(const ring_stream_buffer_t* const rx, const uint32_t tail, const uint32_t available)
+{
+    bool ret = false;
+
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    /* Decode the remaining length of the fixed header without consuming it, a full ring buffer
+       or an invalid remaining length are reported as readable to let the reader handle them */
+    if (available == MQTT_RING_STREAM_SIZE)
+    {
+        ret = true;
+    }
+    else
+    {
+        bool done = false;
+        uint32_t index = 1u;
+        uint32_t shift = 0u;
+        uint32_t length = 0u;
+        while (!done && (index < available))
+        {
+            const uint8_t byte = rx->data[(tail + index) & (MQTT_RING_STREAM_SIZE - 1u)];
+            length |= ((uint32_t)(byte & 0x7Fu)) << shift;
+            shift += 7u;
+            index++;
+            if ((byte & 0x80u) == 0u)
+            {
+                ret = ((available - index) >= length);
+                done = true;
+            }
+            else if (index > MQTT_MAXIMUM_VARIABLE_INTEGER_SIZE)
+            {
+                ret = true;
+                done = true;
+            }
+            else
+            {
+                /* Next byte */
+            }
+        }
+    }
+
+    return ret;
+}
+
+/** \brief Initialize a side of a link */
+static void ring_stream_endpoint_init(ring_stream_endpoint_t* const endpoint, ring_stream_link_t* const link,
+                                      ring_stream_buffer_t* const rx, ring_stream_buffer_t* const tx, const bool client)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    endpoint->link = link;
+    endpoint->rx = rx;
+    endpoint->tx = tx;
+    endpoint->client = client;
+}
+
+#if !defined(__GNUC__) && !defined(__clang__)
+
+/** \brief Change the state of a link if it has the expected value, updates expected with the current value */
+static bool ring_stream_compare_exchange(volatile uint32_t* const ptr, uint32_t* const expected, const uint32_t desired)
+{
+    const uint32_t previous = (uint32_t)_InterlockedCompareExchange((volatile long*)ptr, (long)desired, (long)(*expected));
+    const bool ret = (previous == (*expected));
+
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    (*expected) = previous;
+
+    return ret;
+}
+
+#endif /* !defined(__GNUC__) && !defined(__clang__) */
@@ -0,0 +1,158 @@
+/*
+Copyright(c) 2016 Cedric Jimenez
+
+This file is part of lw-mqtt.
+
+lw-mqtt is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+lw-mqtt is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef RING_STREAM_H
+#define RING_STREAM_H
+
+#include "input_stream.h"
+#include "output_stream.h"
+#include "mqtt_config.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+
+/** \brief Size in bytes reserved for each index of a ring buffer to keep them on different cache lines */
+#define RING_STREAM_CACHE_LINE_SIZE     64u
+
+/** \brief Size in bytes left free in a ring buffer by the PUBLISH packets so that the small control packets
+           (acknowledgements, ping) can always be written without waiting */
+#define RING_STREAM_CONTROL_ROOM        64u
+
+
+/** \brief Single producer / single consumer lock-free ring buffer */
+typedef struct _ring_stream_buffer_t
+{
+    /** \brief Write index, only modified by the producer */
+    volatile uint32_t head;
+    /** \brief Padding */
+    uint8_t head_padding[RING_STREAM_CACHE_LINE_SIZE - sizeof(uint32_t)];
+    /** \brief Read index, only modified by the consumer */
+    volatile uint32_t tail;
+    /** \brief Padding */
+    uint8_t tail_padding[RING_STREAM_CACHE_LINE_SIZE - sizeof(uint32_t)];
+    /** \brief Data */
+    uint8_t data[MQTT_RING_STREAM_SIZE];
+} ring_stream_buffer_t;
+
+/** \brief States of a link */
+typedef enum _ring_stream_link_state_t
+{
+    /** \brief No connection */
+    RING_STREAM_LINK_IDLE = 0u,
+    /** \brief Connected by the client, waiting to be accepted by the broker */
+    RING_STREAM_LINK_CONNECTING = 1u,
+    /** \brief Connected on both sides */
+    RING_STREAM_LINK_CONNECTED = 2u,
+    /** \brief Closed by the client, waiting to be closed by the broker */
+    RING_STREAM_LINK_CLIENT_CLOSED = 3u,
+    /** \brief Closed by the broker, waiting to be closed by the client */
+    RING_STREAM_LINK_BROKER_CLOSED = 4u
+} ring_stream_link_state_t;
+
+/** \brief Pre-declaration of ring_stream_link_t structure */
+typedef struct _ring_stream_link_t ring_stream_link_t;
+
+/** \brief Side of a link */
+typedef struct _ring_stream_endpoint_t
+{
+    /** \brief Link */
+    ring_stream_link_t* link;
+    /** \brief Ring buffer to receive from */
+    ring_stream_buffer_t* rx;
+    /** \brief Ring buffer to send to */
+    ring_stream_buffer_t* tx;
+    /** \brief Data written while the ring buffer to send to was full, waiting to be flushed (NULL if not used) */
+    uint8_t* backlog;
+    /** \brief Size in bytes of the backlog */
+    uint32_t backlog_size;
+    /** \brief Offset in bytes of the first byte of the backlog which has not been flushed yet */
+    uint32_t backlog_start;
+    /** \brief Number of bytes in the backlog, including the flushed ones */
+    uint32_t backlog_end;
+    /** \brief Indicate if this is the client side */
+    bool client;
+} ring_stream_endpoint_t;
+
+/** \brief In-process link between a client and a broker made of 2 ring buffers */
+struct _ring_stream_link_t
+{
+    /** \brief State (ring_stream_link_state_t) */
+    volatile uint32_t state;
+    /** \brief Data sent by the client to the broker */
+    ring_stream_buffer_t to_broker;
+    /** \brief Data sent by the broker to the client */
+    ring_stream_buffer_t to_client;
+    /** \brief Client side */
+    ring_stream_endpoint_t client_endpoint;
+    /** \brief Broker side */
+    ring_stream_endpoint_t broker_endpoint;
+    /** \brief Next link in the list of the broker */
+    struct _ring_stream_link_t* next;
+};
+
+
+/** \brief Initialize a link */
+bool ring_stream_link_init(ring_stream_link_t* const link);
+
+/** \brief Connect the client side of an idle link */
+bool ring_stream_link_connect(ring_stream_link_t* const link);
+
+/** \brief Accept the connection of the client on the broker side of a link,
+           returns false with MQTT_ERR_SOCKET_PENDING if the client is not connected */
+bool ring_stream_link_accept(ring_stream_link_t* const link);
+
+/** \brief Close one side of a link */
+bool ring_stream_link_close(ring_stream_endpoint_t* const endpoint);
+
+/** \brief Attach a buffer to one side of a link to keep the data written while the ring buffer is full (NULL to detach it) */
+bool ring_stream_set_backlog(ring_stream_endpoint_t* const endpoint, uint8_t* const buffer, const size_t size);
+
+/** \brief Move the data kept in the backlog of one side of a link into its ring buffer,
+           returns false with MQTT_ERR_SOCKET_PENDING if some data is left in the backlog */
+bool ring_stream_flush(ring_stream_endpoint_t* const endpoint);
+
+/** \brief Check if a whole packet is ready to receive on one side of a link without waiting (or if the ring buffer is full),
+           returns false with MQTT_ERR_SOCKET_FAILED if the other side is closed and all its data has been received */
+bool ring_stream_is_readable(ring_stream_endpoint_t* const endpoint);
+
+/** \brief Get the number of bytes which can be received on one side of a link without waiting */
+bool ring_stream_get_readable_size(ring_stream_endpoint_t* const endpoint, size_t* const size);
+
+/** \brief Get the number of bytes which can be sent on one side of a link without waiting, including the free space of its backlog */
+bool ring_stream_get_writable_size(ring_stream_endpoint_t* const endpoint, size_t* const size);
+
+/** \brief Initialize an input stream from one side of a link
+           => a read never waits : it returns false with MQTT_ERR_SOCKET_PENDING after a partial read if the data
+              is not available yet, see ring_stream_is_readable() */
+bool ring_stream_input_from_endpoint(input_stream_t* const stream, ring_stream_endpoint_t* const endpoint);
+
+/** \brief Initialize an output stream from one side of a link
+           => a write never waits : the data which doesn't fit in the ring buffer is kept in the backlog, if the backlog
+              is full too it returns false with MQTT_ERR_SOCKET_PENDING after a partial write, see ring_stream_get_writable_size() */
+bool ring_stream_output_from_endpoint(output_stream_t* const stream, ring_stream_endpoint_t* const endpoint);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* RING_STREAM_H */
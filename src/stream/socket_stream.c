@@ -33,6 +33,9 @@ static bool socket_stream_reset_output(output_stream_t* const stream);
 /** \brief Output stream writer function */
 static bool socket_stream_writer(output_stream_t* const stream, const void* data, const size_t size);
 
+/** \brief Output stream writer function with the zero-copy transmit mode enabled */
+static bool socket_stream_writer_zerocopy(output_stream_t* const stream, const void* data, const size_t size);
+
 
 
 /** \brief Initialize an input stream from a socket */
@@ -47,6 +50,7 @@ bool socket_stream_input_from_socket(input_stream_t* const stream, mqtt_socket_t
         /* Init input stream */
         stream->reset = socket_stream_reset_input;
         stream->reader = socket_stream_reader;
+        stream->peek = NULL;
         stream->size = UINT32_MAX;
         stream->read = 0u;
         stream->param = mqtt_socket;
@@ -89,6 +93,34 @@ bool socket_stream_output_from_socket(output_stream_t* const stream, mqtt_socket
     return ret;
 }
 
+/** \brief Initialize an output stream from a socket with the zero-copy transmit mode enabled */
+bool socket_stream_output_from_socket_zerocopy(output_stream_t* const stream, socket_stream_zerocopy_t* const zerocopy)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((stream != NULL) &&
+        (zerocopy != NULL) &&
+        (zerocopy->socket != NULL))
+    {
+        /* Init output stream */
+        stream->reset = socket_stream_reset_output;
+        stream->writer = socket_stream_writer_zerocopy;
+        stream->size = UINT32_MAX;
+        stream->written = 0u;
+        stream->param = zerocopy;
+
+        ret = true;
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
 
 /** \brief Input stream reset function */
 static bool socket_stream_reset_input(input_stream_t* const stream, const size_t new_size)
@@ -197,3 +229,39 @@ static bool socket_stream_writer(output_stream_t* const stream, const void* data
 
     return ret;
 }
+
+/** \brief Output stream writer function with the zero-copy transmit mode enabled */
+static bool socket_stream_writer_zerocopy(output_stream_t* const stream, const void* data, const size_t size)
+{
+    bool ret = false;
+
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    /* Small writes are copied : pinning the pages and notifying the completion cost more than the copy */
+    size_t sent = 0u;
+    size_t left = size;
+    const void* data_ptr = data;
+    socket_stream_zerocopy_t* const zerocopy = (socket_stream_zerocopy_t*)stream->param;
+    do
+    {
+        if (size >= zerocopy->threshold)
+        {
+            ret = mqtt_socket_send_zerocopy(zerocopy->socket, data_ptr, left, &sent, &zerocopy->sent);
+        }
+        else
+        {
+            ret = mqtt_socket_send(zerocopy->socket, data_ptr, left, &sent);
+        }
+        if (ret)
+        {
+            left -= sent;
+            stream->written += sent;
+            data_ptr = (void*)((intptr_t)data_ptr + (intptr_t)sent);
+        }
+    } while (ret && (left != 0u));
+
+    return ret;
+}
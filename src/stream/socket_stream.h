@@ -29,12 +29,28 @@ extern "C"
 {
 #endif /* __cplusplus */
 
+/** \brief State of an output stream sending the large writes without copy */
+typedef struct _socket_stream_zerocopy_t
+{
+    /** \brief Socket */
+    mqtt_socket_t* socket;
+    /** \brief Minimum size in bytes of a write to be sent without copy */
+    size_t threshold;
+    /** \brief Number of sends without copy which will be reported as completed by the socket */
+    uint32_t sent;
+} socket_stream_zerocopy_t;
+
+
 /** \brief Initialize an input stream from a socket */
 bool socket_stream_input_from_socket(input_stream_t* const stream, mqtt_socket_t* const mqtt_socket);
 
 /** \brief Initialize an output stream from a socket */
 bool socket_stream_output_from_socket(output_stream_t* const stream, mqtt_socket_t* const mqtt_socket);
 
+/** \brief Initialize an output stream from a socket with the zero-copy transmit mode enabled
+           => the written data must not be modified until its send has been reported as completed */
+bool socket_stream_output_from_socket_zerocopy(output_stream_t* const stream, socket_stream_zerocopy_t* const zerocopy);
+
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,575 @@
+/*
+Copyright(c) 2016 Cedric Jimenez
+
+This file is part of lw-mqtt.
+
+lw-mqtt is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+lw-mqtt is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "mqtt_error.h"
+#include "trace_stream.h"
+#include "mqtt_time.h"
+
+#ifdef MQTT_TRACE_ENABLED
+
+
+/** \brief Header of a trace file : magic string and format version */
+static const uint8_t s_trace_stream_file_header[TRACE_STREAM_FILE_HEADER_SIZE] = { 'L', 'W', 'M', 'Q', 'T', 'R', 'C', 1u };
+
+
+/** \brief Input stream reset function */
+static bool trace_stream_reset_input(input_stream_t* const stream, const size_t new_size);
+
+/** \brief Input stream reader function */
+static bool trace_stream_reader(input_stream_t* const stream, void* data, const size_t size);
+
+/** \brief Output stream reset function */
+static bool trace_stream_reset_output(output_stream_t* const stream);
+
+/** \brief Output stream writer function */
+static bool trace_stream_writer(output_stream_t* const stream, const void* data, const size_t size);
+
+/** \brief Write a record to a trace file */
+static bool trace_stream_write_record(trace_stream_recorder_t* const recorder, const uint32_t connection,
+                                      const trace_stream_record_type_t type, const void* const data, const size_t size);
+
+/** \brief Store a little endian uint32_t value */
+static void trace_stream_put_uint32(uint8_t* const buffer, const uint32_t value);
+
+/** \brief Load a little endian uint32_t value */
+static uint32_t trace_stream_get_uint32(const uint8_t* const buffer);
+
+
+
+/** \brief Create a trace file */
+bool trace_stream_recorder_open(trace_stream_recorder_t* const recorder, const char* const path)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((recorder != NULL) &&
+        (path != NULL))
+    {
+        /* Create the file and write its header */
+        recorder->file = fopen(path, "wb");
+        if (recorder->file != NULL)
+        {
+            ret = (fwrite(s_trace_stream_file_header, 1u, sizeof(s_trace_stream_file_header), recorder->file) == sizeof(s_trace_stream_file_header));
+            if (ret)
+            {
+                ret = mqtt_time_get_current_64(&recorder->start_time);
+            }
+            #ifdef MQTT_MULTITASKING_ENABLED
+            if (ret)
+            {
+                ret = mqtt_mutex_create(&recorder->mutex);
+            }
+            #endif /* MQTT_MULTITASKING_ENABLED */
+            if (ret)
+            {
+                recorder->connection_count = 0u;
+            }
+            else
+            {
+                (void)fclose(recorder->file);
+                recorder->file = NULL;
+                mqtt_errno_set(MQTT_ERR_FILE_FAILED);
+            }
+        }
+        else
+        {
+            mqtt_errno_set(MQTT_ERR_FILE_FAILED);
+        }
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Close a trace file */
+bool trace_stream_recorder_close(trace_stream_recorder_t* const recorder)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((recorder != NULL) &&
+        (recorder->file != NULL))
+    {
+        /* Write the buffered records */
+        ret = (fclose(recorder->file) == 0);
+        recorder->file = NULL;
+        if (!ret)
+        {
+            mqtt_errno_set(MQTT_ERR_FILE_FAILED);
+        }
+
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_delete(&recorder->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Start the trace of a new connection */
+bool trace_stream_open(trace_stream_t* const trace, trace_stream_recorder_t* const recorder)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((trace != NULL) &&
+        (recorder != NULL) &&
+        (recorder->file != NULL))
+    {
+        /* Allocate the connection identifier */
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_lock(&recorder->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+
+        trace->connection = recorder->connection_count;
+        recorder->connection_count++;
+
+        #ifdef MQTT_MULTITASKING_ENABLED
+        (void)mqtt_mutex_unlock(&recorder->mutex);
+        #endif /* MQTT_MULTITASKING_ENABLED */
+
+        trace->recorder = recorder;
+        trace->input = NULL;
+        trace->output = NULL;
+        ret = trace_stream_write_record(recorder, trace->connection, TRACE_STREAM_RECORD_OPEN, NULL, 0u);
+        if (!ret)
+        {
+            trace->recorder = NULL;
+        }
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief End the trace of a connection */
+bool trace_stream_close(trace_stream_t* const trace)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((trace != NULL) &&
+        (trace->recorder != NULL))
+    {
+        /* The data of the connection is written to the file so that a recording
+           interrupted without closing the file only misses the opened connections */
+        ret = trace_stream_write_record(trace->recorder, trace->connection, TRACE_STREAM_RECORD_CLOSE, NULL, 0u);
+        if (ret)
+        {
+            ret = (fflush(trace->recorder->file) == 0);
+            if (!ret)
+            {
+                mqtt_errno_set(MQTT_ERR_FILE_FAILED);
+            }
+        }
+        trace->recorder = NULL;
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Record the data of a connection whose transport doesn't go through a traced stream */
+bool trace_stream_record(trace_stream_t* const trace, const trace_stream_record_type_t type, const void* const data, const size_t size)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((trace != NULL) &&
+        (trace->recorder != NULL) &&
+        ((type == TRACE_STREAM_RECORD_INPUT) || (type == TRACE_STREAM_RECORD_OUTPUT)) &&
+        ((data != NULL) || (size == 0u)))
+    {
+        ret = trace_stream_write_record(trace->recorder, trace->connection, type, data, size);
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Initialize an input stream which records the data read from the input stream of a transport */
+bool trace_stream_input_from_stream(input_stream_t* const stream, trace_stream_t* const trace, input_stream_t* const input)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((stream != NULL) &&
+        (trace != NULL) &&
+        (trace->recorder != NULL) &&
+        (input != NULL))
+    {
+        /* Init input stream : no peek function since the data must go through the reader to be recorded */
+        trace->input = input;
+        stream->reset = trace_stream_reset_input;
+        stream->reader = trace_stream_reader;
+        stream->peek = NULL;
+        stream->size = input->size;
+        stream->read = input->read;
+        stream->param = trace;
+
+        ret = true;
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Initialize an output stream which records the data written to the output stream of a transport */
+bool trace_stream_output_from_stream(output_stream_t* const stream, trace_stream_t* const trace, output_stream_t* const output)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((stream != NULL) &&
+        (trace != NULL) &&
+        (trace->recorder != NULL) &&
+        (output != NULL))
+    {
+        /* Init output stream */
+        trace->output = output;
+        stream->reset = trace_stream_reset_output;
+        stream->writer = trace_stream_writer;
+        stream->size = output->size;
+        stream->written = output->written;
+        stream->param = trace;
+
+        ret = true;
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Open a trace file for reading */
+bool trace_stream_reader_open(trace_stream_reader_t* const reader, const char* const path)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((reader != NULL) &&
+        (path != NULL))
+    {
+        /* Open the file and check its header */
+        reader->file = fopen(path, "rb");
+        if (reader->file != NULL)
+        {
+            uint8_t header[TRACE_STREAM_FILE_HEADER_SIZE];
+            ret = ((fread(header, 1u, sizeof(header), reader->file) == sizeof(header)) &&
+                   (memcmp(header, s_trace_stream_file_header, sizeof(header)) == 0));
+            if (!ret)
+            {
+                (void)fclose(reader->file);
+                reader->file = NULL;
+                mqtt_errno_set(MQTT_ERR_FILE_FAILED);
+            }
+        }
+        else
+        {
+            mqtt_errno_set(MQTT_ERR_FILE_FAILED);
+        }
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Close a trace file opened for reading */
+bool trace_stream_reader_close(trace_stream_reader_t* const reader)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((reader != NULL) &&
+        (reader->file != NULL))
+    {
+        (void)fclose(reader->file);
+        reader->file = NULL;
+        ret = true;
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Read the next record of a trace file, the data is copied to the given buffer */
+bool trace_stream_reader_next(trace_stream_reader_t* const reader, trace_stream_record_t* const record, void* const data, const size_t size)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((reader != NULL) &&
+        (reader->file != NULL) &&
+        (record != NULL) &&
+        ((data != NULL) || (size == 0u)))
+    {
+        /* Read the header */
+        uint8_t header[TRACE_STREAM_RECORD_HEADER_SIZE];
+        const size_t header_size = fread(header, 1u, sizeof(header), reader->file);
+        if (header_size == sizeof(header))
+        {
+            record->timestamp = trace_stream_get_uint32(&header[0u]);
+            record->connection = trace_stream_get_uint32(&header[4u]);
+            record->type = (trace_stream_record_type_t)header[8u];
+            record->size = trace_stream_get_uint32(&header[9u]);
+
+            /* Read the data, the data of a record which doesn't fit is skipped */
+            if (record->size <= size)
+            {
+                ret = (fread(data, 1u, record->size, reader->file) == record->size);
+                if (!ret)
+                {
+                    mqtt_errno_set(MQTT_ERR_FILE_FAILED);
+                }
+            }
+            else
+            {
+                (void)fseek(reader->file, (long)record->size, SEEK_CUR);
+                mqtt_errno_set(MQTT_ERR_BUFFER_TOO_SMALL);
+            }
+        }
+        else if ((header_size == 0u) && (feof(reader->file) != 0))
+        {
+            /* End of file */
+            mqtt_errno_set(MQTT_ERR_INPUT_STREAM_EMPTY);
+        }
+        else
+        {
+            /* Truncated or unreadable file */
+            mqtt_errno_set(MQTT_ERR_FILE_FAILED);
+        }
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+
+
+
+/** \brief Input stream reset function */
+static bool trace_stream_reset_input(input_stream_t* const stream, const size_t new_size)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((stream != NULL) &&
+        (stream->param != NULL))
+    {
+        /* Reset the stream of the transport */
+        trace_stream_t* const trace = (trace_stream_t*)stream->param;
+        ret = trace->input->reset(trace->input, new_size);
+        stream->size = trace->input->size;
+        stream->read = trace->input->read;
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Input stream reader function */
+static bool trace_stream_reader(input_stream_t* const stream, void* data, const size_t size)
+{
+    bool ret;
+
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    /* Read data from the transport and record it */
+    trace_stream_t* const trace = (trace_stream_t*)stream->param;
+    ret = trace->input->reader(trace->input, data, size);
+    if (ret)
+    {
+        stream->read += size;
+        if (trace->recorder != NULL)
+        {
+            (void)trace_stream_write_record(trace->recorder, trace->connection, TRACE_STREAM_RECORD_INPUT, data, size);
+        }
+    }
+
+    return ret;
+}
+
+/** \brief Output stream reset function */
+static bool trace_stream_reset_output(output_stream_t* const stream)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((stream != NULL) &&
+        (stream->param != NULL))
+    {
+        /* Reset the stream of the transport */
+        trace_stream_t* const trace = (trace_stream_t*)stream->param;
+        ret = trace->output->reset(trace->output);
+        stream->written = trace->output->written;
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Output stream writer function */
+static bool trace_stream_writer(output_stream_t* const stream, const void* data, const size_t size)
+{
+    bool ret;
+
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    /* Record the data and write it to the transport */
+    trace_stream_t* const trace = (trace_stream_t*)stream->param;
+    if (trace->recorder != NULL)
+    {
+        (void)trace_stream_write_record(trace->recorder, trace->connection, TRACE_STREAM_RECORD_OUTPUT, data, size);
+    }
+    ret = trace->output->writer(trace->output, data, size);
+    if (ret)
+    {
+        stream->written += size;
+    }
+
+    return ret;
+}
+
+/** \brief Write a record to a trace file */
+static bool trace_stream_write_record(trace_stream_recorder_t* const recorder, const uint32_t connection,
+                                      const trace_stream_record_type_t type, const void* const data, const size_t size)
+{
+    bool ret;
+    uint64_t current_time = 0u;
+    uint8_t header[TRACE_STREAM_RECORD_HEADER_SIZE];
+
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    /* Build the header */
+    (void)mqtt_time_get_current_64(&current_time);
+    trace_stream_put_uint32(&header[0u], (uint32_t)(current_time - recorder->start_time));
+    trace_stream_put_uint32(&header[4u], connection);
+    header[8u] = (uint8_t)type;
+    trace_stream_put_uint32(&header[9u], (uint32_t)size);
+
+    /* Write the record in one go to keep the records of the different connections apart */
+    #ifdef MQTT_MULTITASKING_ENABLED
+    (void)mqtt_mutex_lock(&recorder->mutex);
+    #endif /* MQTT_MULTITASKING_ENABLED */
+
+    ret = (fwrite(header, 1u, sizeof(header), recorder->file) == sizeof(header));
+    if (ret && (size != 0u))
+    {
+        ret = (fwrite(data, 1u, size, recorder->file) == size);
+    }
+
+    #ifdef MQTT_MULTITASKING_ENABLED
+    (void)mqtt_mutex_unlock(&recorder->mutex);
+    #endif /* MQTT_MULTITASKING_ENABLED */
+
+    if (!ret)
+    {
+        mqtt_errno_set(MQTT_ERR_FILE_FAILED);
+    }
+
+    return ret;
+}
+
+/** \brief Store a little endian uint32_t value */
+static void trace_stream_put_uint32(uint8_t* const buffer, const uint32_t value)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    buffer[0u] = (uint8_t)(value);
+    buffer[1u] = (uint8_t)(value >> 8u);
+    buffer[2u] = (uint8_t)(value >> 16u);
+    buffer[3u] = (uint8_t)(value >> 24u);
+}
+
+/** \brief Load a little endian uint32_t value */
+static uint32_t trace_stream_get_uint32(const uint8_t* const buffer)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    return (((uint32_t)buffer[0u]) |
+            (((uint32_t)buffer[1u]) << 8u) |
+            (((uint32_t)buffer[2u]) << 16u) |
+            (((uint32_t)buffer[3u]) << 24u));
+}
+
+
+#endif /* MQTT_TRACE_ENABLED */
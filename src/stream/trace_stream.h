@@ -0,0 +1,150 @@
+/*
+Copyright(c) 2016 Cedric Jimenez
+
+This file is part of lw-mqtt.
+
+lw-mqtt is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+lw-mqtt is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TRACE_STREAM_H
+#define TRACE_STREAM_H
+
+#include "input_stream.h"
+#include "output_stream.h"
+#include "mqtt_config.h"
+
+#ifdef MQTT_TRACE_ENABLED
+
+#include <stdio.h>
+#include "mqtt_mutex.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+
+/** \brief Size in bytes of the header of a trace file */
+#define TRACE_STREAM_FILE_HEADER_SIZE       8u
+
+/** \brief Size in bytes of the header of a record in a trace file */
+#define TRACE_STREAM_RECORD_HEADER_SIZE     13u
+
+
+/** \brief Record types */
+typedef enum _trace_stream_record_type_t
+{
+    /** \brief New connection */
+    TRACE_STREAM_RECORD_OPEN = 0u,
+    /** \brief Data received on a connection */
+    TRACE_STREAM_RECORD_INPUT = 1u,
+    /** \brief Data sent on a connection */
+    TRACE_STREAM_RECORD_OUTPUT = 2u,
+    /** \brief End of a connection */
+    TRACE_STREAM_RECORD_CLOSE = 3u
+} trace_stream_record_type_t;
+
+/** \brief Record of a trace file
+           => stored as a little endian header followed by the data :
+              timestamp (4 bytes), connection (4 bytes), type (1 byte), size (4 bytes) */
+typedef struct _trace_stream_record_t
+{
+    /** \brief Time in ms since the start of the recording */
+    uint32_t timestamp;
+    /** \brief Connection identifier, unique in a trace file */
+    uint32_t connection;
+    /** \brief Type */
+    trace_stream_record_type_t type;
+    /** \brief Size in bytes of the data (input and output records only) */
+    uint32_t size;
+} trace_stream_record_t;
+
+/** \brief Trace file being recorded, shared by all the traced connections */
+typedef struct _trace_stream_recorder_t
+{
+    /** \brief File */
+    FILE* file;
+    /** \brief Start time of the recording in ms */
+    uint64_t start_time;
+    /** \brief Number of connections recorded */
+    uint32_t connection_count;
+
+    #ifdef MQTT_MULTITASKING_ENABLED
+    /** \brief Mutex to protect the file against concurrent writes */
+    mqtt_mutex_t mutex;
+    #endif /* MQTT_MULTITASKING_ENABLED */
+} trace_stream_recorder_t;
+
+/** \brief Traced connection */
+typedef struct _trace_stream_t
+{
+    /** \brief Recorder, NULL if the connection is not traced */
+    trace_stream_recorder_t* recorder;
+    /** \brief Connection identifier */
+    uint32_t connection;
+    /** \brief Input stream of the transport */
+    input_stream_t* input;
+    /** \brief Output stream of the transport */
+    output_stream_t* output;
+} trace_stream_t;
+
+/** \brief Trace file being read */
+typedef struct _trace_stream_reader_t
+{
+    /** \brief File */
+    FILE* file;
+} trace_stream_reader_t;
+
+
+/** \brief Create a trace file */
+bool trace_stream_recorder_open(trace_stream_recorder_t* const recorder, const char* const path);
+
+/** \brief Close a trace file */
+bool trace_stream_recorder_close(trace_stream_recorder_t* const recorder);
+
+/** \brief Start the trace of a new connection */
+bool trace_stream_open(trace_stream_t* const trace, trace_stream_recorder_t* const recorder);
+
+/** \brief End the trace of a connection */
+bool trace_stream_close(trace_stream_t* const trace);
+
+/** \brief Record the data of a connection whose transport doesn't go through a traced stream */
+bool trace_stream_record(trace_stream_t* const trace, const trace_stream_record_type_t type, const void* const data, const size_t size);
+
+/** \brief Initialize an input stream which records the data read from the input stream of a transport
+           => the input stream of the transport must stay valid as long as the traced stream is used */
+bool trace_stream_input_from_stream(input_stream_t* const stream, trace_stream_t* const trace, input_stream_t* const input);
+
+/** \brief Initialize an output stream which records the data written to the output stream of a transport
+           => the output stream of the transport must stay valid as long as the traced stream is used */
+bool trace_stream_output_from_stream(output_stream_t* const stream, trace_stream_t* const trace, output_stream_t* const output);
+
+/** \brief Open a trace file for reading */
+bool trace_stream_reader_open(trace_stream_reader_t* const reader, const char* const path);
+
+/** \brief Close a trace file opened for reading */
+bool trace_stream_reader_close(trace_stream_reader_t* const reader);
+
+/** \brief Read the next record of a trace file, the data is copied to the given buffer
+           => returns false with MQTT_ERR_INPUT_STREAM_EMPTY at the end of the file */
+bool trace_stream_reader_next(trace_stream_reader_t* const reader, trace_stream_record_t* const record, void* const data, const size_t size);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* MQTT_TRACE_ENABLED */
+
+#endif /* TRACE_STREAM_H */
@@ -0,0 +1,106 @@
+/*
+Copyright(c) 2016 Cedric Jimenez
+
+This file is part of lw-mqtt.
+
+lw-mqtt is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+lw-mqtt is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "mqtt_error.h"
+#include "uring_stream.h"
+
+#ifdef MQTT_SOCKET_IO_URING_ENABLED
+
+/** \brief Output stream reset function */
+static bool uring_stream_reset_output(output_stream_t* const stream);
+
+/** \brief Output stream writer function */
+static bool uring_stream_writer(output_stream_t* const stream, const void* data, const size_t size);
+
+
+
+/** \brief Initialize an output stream from a socket managed by an io_uring instance */
+bool uring_stream_output_from_endpoint(output_stream_t* const stream, mqtt_socket_uring_endpoint_t* const endpoint)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((stream != NULL) &&
+        (endpoint != NULL))
+    {
+        /* Init output stream */
+        stream->reset = uring_stream_reset_output;
+        stream->writer = uring_stream_writer;
+        stream->size = UINT32_MAX;
+        stream->written = 0u;
+        stream->param = endpoint;
+
+        ret = true;
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+
+/** \brief Output stream reset function */
+static bool uring_stream_reset_output(output_stream_t* const stream)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((stream != NULL) &&
+        (stream->param != NULL))
+    {
+
+        /* Reset stream */
+        stream->written = 0u;
+
+        ret = true;
+    }
+    else
+    {
+        /* Error */
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Output stream writer function */
+static bool uring_stream_writer(output_stream_t* const stream, const void* data, const size_t size)
+{
+    bool ret = false;
+
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    /* Queue data into the send buffers of the socket */
+    mqtt_socket_uring_endpoint_t* const endpoint = (mqtt_socket_uring_endpoint_t*)stream->param;
+    ret = mqtt_socket_uring_send(endpoint, data, size);
+    if (ret)
+    {
+        stream->written += size;
+    }
+
+    return ret;
+}
+
+#endif /* MQTT_SOCKET_IO_URING_ENABLED */
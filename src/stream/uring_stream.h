@@ -0,0 +1,46 @@
+/*
+Copyright(c) 2016 Cedric Jimenez
+
+This file is part of lw-mqtt.
+
+lw-mqtt is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+lw-mqtt is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef URING_STREAM_H
+#define URING_STREAM_H
+
+#include "output_stream.h"
+#include "mqtt_config.h"
+
+#ifdef MQTT_SOCKET_IO_URING_ENABLED
+
+#include "mqtt_socket_uring.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+/** \brief Initialize an output stream from a socket managed by an io_uring instance
+           => the written data is gathered into the send buffers and sent at the next submission */
+bool uring_stream_output_from_endpoint(output_stream_t* const stream, mqtt_socket_uring_endpoint_t* const endpoint);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* MQTT_SOCKET_IO_URING_ENABLED */
+
+#endif /* URING_STREAM_H */
@@ -36,9 +36,15 @@ bool mqtt_time_init(void);
 /** \brief De-initialize the MQTT time module */
 bool mqtt_time_deinit(void);
 
-/** \brief Get the current time in milliseconds */
+/** \brief Get the current time in milliseconds (wraps after 49.7 days) */
 bool mqtt_time_get_current(uint32_t* const current_time);
 
+/** \brief Get the current time in milliseconds on 64 bits */
+bool mqtt_time_get_current_64(uint64_t* const current_time);
+
+/** \brief Get the current time in microseconds from a precise monotonic clock (to measure durations) */
+bool mqtt_time_get_current_us(uint64_t* const current_time);
+
 
 #ifdef __cplusplus
 }
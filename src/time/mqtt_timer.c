@@ -30,7 +30,7 @@ bool mqtt_timer_start(mqtt_timer_t* const mqtt_timer, const uint32_t ms_timeout,
     /* Check params */
     if (mqtt_timer != NULL)
     {
-        ret = mqtt_time_get_current(&mqtt_timer->start_time);
+        ret = mqtt_time_get_current_64(&mqtt_timer->start_time);
         mqtt_timer->expiration_time = mqtt_timer->start_time + ms_timeout;
         mqtt_timer->auto_restart = auto_restart;
     }
@@ -46,8 +46,8 @@ bool mqtt_timer_reset(mqtt_timer_t* const mqtt_timer)
     /* Check params */
     if (mqtt_timer != NULL)
     {
-        uint32_t current_time;
-        ret = mqtt_time_get_current(&current_time);
+        uint64_t current_time;
+        ret = mqtt_time_get_current_64(&current_time);
         mqtt_timer->expiration_time = current_time + (mqtt_timer->expiration_time - mqtt_timer->start_time);
         mqtt_timer->start_time = current_time;
     }
@@ -64,8 +64,8 @@ bool mqtt_timer_has_expired(mqtt_timer_t* const mqtt_timer, bool* const has_expi
     if ((mqtt_timer != NULL) &&
         (has_expired != NULL))
     {
-        uint32_t current_time;
-        ret = mqtt_time_get_current(&current_time);
+        uint64_t current_time;
+        ret = mqtt_time_get_current_64(&current_time);
         if (current_time >= mqtt_timer->expiration_time)
         {
             (*has_expired) = true;
@@ -33,9 +33,9 @@ extern "C"
 typedef struct _mqtt_timer_t
 {
     /** \brief Start time in ms */
-    uint32_t start_time;
+    uint64_t start_time;
     /** \brief Expiration time in ms */
-    uint32_t expiration_time;
+    uint64_t expiration_time;
     /** \brief Auto restart */
     bool auto_restart;
 } mqtt_timer_t;
@@ -0,0 +1,400 @@
+/*
+Copyright(c) 2016 Cedric Jimenez
+
+This file is part of lw-mqtt.
+
+lw-mqtt is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+lw-mqtt is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "mqtt_error.h"
+#include "mqtt_time.h"
+#include "mqtt_timer_wheel.h"
+
+
+/** \brief Mask to select a slot in a level */
+#define MQTT_TIMER_WHEEL_SLOT_MASK      (MQTT_TIMER_WHEEL_SLOT_COUNT - 1u)
+
+
+/** \brief Add a timer to the slot corresponding to its expiration tick */
+static void mqtt_timer_wheel_insert(mqtt_timer_wheel_t* const wheel, mqtt_timer_wheel_timer_t* const timer);
+
+/** \brief Remove a timer from its slot */
+static void mqtt_timer_wheel_remove(mqtt_timer_wheel_t* const wheel, mqtt_timer_wheel_timer_t* const timer);
+
+/** \brief Move all the timers of a list to the list of an empty slot */
+static void mqtt_timer_wheel_move_list(mqtt_timer_wheel_link_t* const from, mqtt_timer_wheel_link_t* const to);
+
+/** \brief Move to the next tick : cascade the higher levels and expire the timers of the current slot */
+static void mqtt_timer_wheel_tick(mqtt_timer_wheel_t* const wheel);
+
+
+
+/** \brief Initialize a timer wheel */
+bool mqtt_timer_wheel_init(mqtt_timer_wheel_t* const wheel)
+{
+    bool ret = false;
+
+    /* Check params */
+    if (wheel != NULL)
+    {
+        uint32_t level;
+        uint32_t slot;
+
+        /* Empty slots */
+        for (level = 0u; level < MQTT_TIMER_WHEEL_LEVELS; level++)
+        {
+            for (slot = 0u; slot < MQTT_TIMER_WHEEL_SLOT_COUNT; slot++)
+            {
+                wheel->slots[level][slot].next = &wheel->slots[level][slot];
+                wheel->slots[level][slot].previous = &wheel->slots[level][slot];
+            }
+        }
+        wheel->current_tick = 0u;
+        wheel->timer_count = 0u;
+
+        /* Time reference */
+        ret = mqtt_time_get_current_64(&wheel->current_time);
+        wheel->last_time = wheel->current_time;
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Initialize a timer with its expiration function */
+bool mqtt_timer_wheel_timer_init(mqtt_timer_wheel_timer_t* const timer, const fp_mqtt_timer_wheel_callback_t callback, void* const param)
+{
+    bool ret = false;
+
+    /* Check params */
+    if (timer != NULL)
+    {
+        timer->link.next = NULL;
+        timer->link.previous = NULL;
+        timer->expiration_tick = 0u;
+        timer->tick_timeout = 0u;
+        timer->auto_restart = false;
+        timer->running = false;
+        timer->expired = false;
+        timer->callback = callback;
+        timer->param = param;
+        ret = true;
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Start a timer, the timeout is counted from the last advance of the wheel */
+bool mqtt_timer_wheel_start(mqtt_timer_wheel_t* const wheel, mqtt_timer_wheel_timer_t* const timer, const uint32_t ms_timeout, const bool auto_restart)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((wheel != NULL) &&
+        (timer != NULL))
+    {
+        /* Round up to the next tick, the timer can't expire in the current tick which has already been processed */
+        uint32_t tick_timeout = (ms_timeout / MQTT_TIMER_WHEEL_RESOLUTION);
+        if (((ms_timeout % MQTT_TIMER_WHEEL_RESOLUTION) != 0u) || (tick_timeout == 0u))
+        {
+            tick_timeout++;
+        }
+        if (tick_timeout > MQTT_TIMER_WHEEL_MAX_TICKS)
+        {
+            tick_timeout = MQTT_TIMER_WHEEL_MAX_TICKS;
+        }
+
+        /* Move the timer to its new slot */
+        if (timer->running)
+        {
+            mqtt_timer_wheel_remove(wheel, timer);
+        }
+        timer->tick_timeout = tick_timeout;
+        timer->auto_restart = auto_restart;
+        timer->expired = false;
+        timer->expiration_tick = wheel->current_tick + tick_timeout;
+        mqtt_timer_wheel_insert(wheel, timer);
+
+        ret = true;
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Restart a started timer with its timeout, has no effect on a cancelled timer */
+bool mqtt_timer_wheel_reset(mqtt_timer_wheel_t* const wheel, mqtt_timer_wheel_timer_t* const timer)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((wheel != NULL) &&
+        (timer != NULL))
+    {
+        if (timer->tick_timeout != 0u)
+        {
+            if (timer->running)
+            {
+                mqtt_timer_wheel_remove(wheel, timer);
+            }
+            timer->expired = false;
+            timer->expiration_tick = wheel->current_tick + timer->tick_timeout;
+            mqtt_timer_wheel_insert(wheel, timer);
+        }
+        ret = true;
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Cancel a timer */
+bool mqtt_timer_wheel_cancel(mqtt_timer_wheel_t* const wheel, mqtt_timer_wheel_timer_t* const timer)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((wheel != NULL) &&
+        (timer != NULL))
+    {
+        if (timer->running)
+        {
+            mqtt_timer_wheel_remove(wheel, timer);
+        }
+        timer->tick_timeout = 0u;
+        timer->expired = false;
+        ret = true;
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Check if a timer has expired, the expiration of an auto restart timer is only reported once */
+bool mqtt_timer_wheel_has_expired(mqtt_timer_wheel_timer_t* const timer, bool* const has_expired)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((timer != NULL) &&
+        (has_expired != NULL))
+    {
+        (*has_expired) = timer->expired;
+        if (timer->auto_restart)
+        {
+            timer->expired = false;
+        }
+        ret = true;
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Read the current time and expire the timers of all the elapsed ticks, must be called once per loop */
+bool mqtt_timer_wheel_advance(mqtt_timer_wheel_t* const wheel)
+{
+    bool ret = false;
+
+    /* Check params */
+    if (wheel != NULL)
+    {
+        ret = mqtt_time_get_current_64(&wheel->last_time);
+        if (ret)
+        {
+            uint64_t elapsed_ticks = ((wheel->last_time - wheel->current_time) / MQTT_TIMER_WHEEL_RESOLUTION);
+            if (wheel->timer_count == 0u)
+            {
+                /* Nothing to expire, jump directly to the current tick */
+                wheel->current_tick += (uint32_t)elapsed_ticks;
+                wheel->current_time += (elapsed_ticks * MQTT_TIMER_WHEEL_RESOLUTION);
+            }
+            else
+            {
+                while (elapsed_ticks != 0u)
+                {
+                    mqtt_timer_wheel_tick(wheel);
+                    elapsed_ticks--;
+                }
+            }
+        }
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+/** \brief Get the time in ms read by the last advance, avoids reading the clock again in the same loop */
+bool mqtt_timer_wheel_get_time(const mqtt_timer_wheel_t* const wheel, uint64_t* const ms_time)
+{
+    bool ret = false;
+
+    /* Check params */
+    if ((wheel != NULL) &&
+        (ms_time != NULL))
+    {
+        (*ms_time) = wheel->last_time;
+        ret = true;
+    }
+    else
+    {
+        mqtt_errno_set(MQTT_ERR_INVALID_PARAM);
+    }
+
+    return ret;
+}
+
+
+
+
+/** \brief Add a timer to the slot corresponding to its expiration tick */
+static void mqtt_timer_wheel_insert(mqtt_timer_wheel_t* const wheel, mqtt_timer_wheel_timer_t* const timer)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    /* The level is the first one which covers the remaining ticks, the slot is given by the bits of the expiration tick
+       for this level so that the timer is cascaded to the lower levels as the current tick reaches its expiration */
+    mqtt_timer_wheel_link_t* slot;
+    const uint32_t remaining_ticks = (timer->expiration_tick - wheel->current_tick);
+    uint32_t level = 0u;
+    while ((level < (MQTT_TIMER_WHEEL_LEVELS - 1u)) &&
+           (remaining_ticks >= (1u << (MQTT_TIMER_WHEEL_SLOT_BITS * (level + 1u)))))
+    {
+        level++;
+    }
+    slot = &wheel->slots[level][(timer->expiration_tick >> (MQTT_TIMER_WHEEL_SLOT_BITS * level)) & MQTT_TIMER_WHEEL_SLOT_MASK];
+
+    /* Add at the end of the slot list */
+    timer->link.next = slot;
+    timer->link.previous = slot->previous;
+    slot->previous->next = &timer->link;
+    slot->previous = &timer->link;
+    timer->running = true;
+    wheel->timer_count++;
+}
+
+/** \brief Remove a timer from its slot */
+static void mqtt_timer_wheel_remove(mqtt_timer_wheel_t* const wheel, mqtt_timer_wheel_timer_t* const timer)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    timer->link.previous->next = timer->link.next;
+    timer->link.next->previous = timer->link.previous;
+    timer->link.next = NULL;
+    timer->link.previous = NULL;
+    timer->running = false;
+    wheel->timer_count--;
+}
+
+/** \brief Move all the timers of a list to the list of an empty slot */
+static void mqtt_timer_wheel_move_list(mqtt_timer_wheel_link_t* const from, mqtt_timer_wheel_link_t* const to)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    if (from->next == from)
+    {
+        to->next = to;
+        to->previous = to;
+    }
+    else
+    {
+        to->next = from->next;
+        to->previous = from->previous;
+        to->next->previous = to;
+        to->previous->next = to;
+        from->next = from;
+        from->previous = from;
+    }
+}
+
+/** \brief Move to the next tick : cascade the higher levels and expire the timers of the current slot */
+static void mqtt_timer_wheel_tick(mqtt_timer_wheel_t* const wheel)
+{
+    /* No null-pointer test for the parameters because this function
+    is meant to be called from the inside of the library where the
+    parameters are already checked.
+    */
+
+    mqtt_timer_wheel_link_t pending;
+    uint32_t level = 1u;
+    uint32_t index;
+
+    wheel->current_tick++;
+    wheel->current_time += MQTT_TIMER_WHEEL_RESOLUTION;
+
+    /* Each time a level wraps around, the timers of the next slot of the upper level are spread in the lower levels */
+    index = (wheel->current_tick & MQTT_TIMER_WHEEL_SLOT_MASK);
+    while ((index == 0u) && (level < MQTT_TIMER_WHEEL_LEVELS))
+    {
+        index = ((wheel->current_tick >> (MQTT_TIMER_WHEEL_SLOT_BITS * level)) & MQTT_TIMER_WHEEL_SLOT_MASK);
+        mqtt_timer_wheel_move_list(&wheel->slots[level][index], &pending);
+        while (pending.next != &pending)
+        {
+            mqtt_timer_wheel_timer_t* const timer = (mqtt_timer_wheel_timer_t*)pending.next;
+            mqtt_timer_wheel_remove(wheel, timer);
+            mqtt_timer_wheel_insert(wheel, timer);
+        }
+        level++;
+    }
+
+    /* Expire the timers of the current slot, the list is detached first since the expiration
+       functions may start or cancel any timer, including the ones which are still pending */
+    mqtt_timer_wheel_move_list(&wheel->slots[0u][wheel->current_tick & MQTT_TIMER_WHEEL_SLOT_MASK], &pending);
+    while (pending.next != &pending)
+    {
+        mqtt_timer_wheel_timer_t* const timer = (mqtt_timer_wheel_timer_t*)pending.next;
+        mqtt_timer_wheel_remove(wheel, timer);
+        timer->expired = true;
+        if (timer->auto_restart)
+        {
+            timer->expiration_tick = wheel->current_tick + timer->tick_timeout;
+            mqtt_timer_wheel_insert(wheel, timer);
+        }
+        if (timer->callback != NULL)
+        {
+            timer->callback(timer, timer->param);
+        }
+    }
+}
@@ -0,0 +1,126 @@
+/*
+Copyright(c) 2016 Cedric Jimenez
+
+This file is part of lw-mqtt.
+
+lw-mqtt is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+lw-mqtt is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MQTT_TIMER_WHEEL_H
+#define MQTT_TIMER_WHEEL_H
+
+#include "stdheaders.h"
+#include "mqtt_config.h"
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+
+/** \brief Number of bits of a tick number used to select a slot in a level of a timer wheel */
+#define MQTT_TIMER_WHEEL_SLOT_BITS      6u
+
+/** \brief Number of slots in each level of a timer wheel */
+#define MQTT_TIMER_WHEEL_SLOT_COUNT     (1u << MQTT_TIMER_WHEEL_SLOT_BITS)
+
+/** \brief Maximum timeout in ticks of a timer, longer timeouts are truncated */
+#define MQTT_TIMER_WHEEL_MAX_TICKS      ((1u << (MQTT_TIMER_WHEEL_SLOT_BITS * MQTT_TIMER_WHEEL_LEVELS)) - 1u)
+
+
+/** \brief Link of a timer in the circular list of a slot */
+typedef struct _mqtt_timer_wheel_link_t
+{
+    /** \brief Next link */
+    struct _mqtt_timer_wheel_link_t* next;
+    /** \brief Previous link */
+    struct _mqtt_timer_wheel_link_t* previous;
+} mqtt_timer_wheel_link_t;
+
+/** \brief Pre-declaration of mqtt_timer_wheel_timer_t structure */
+typedef struct _mqtt_timer_wheel_timer_t mqtt_timer_wheel_timer_t;
+
+/** \brief Function called when a timer expires */
+typedef void (*fp_mqtt_timer_wheel_callback_t)(mqtt_timer_wheel_timer_t* const timer, void* const param);
+
+/** \brief Timer managed by a timer wheel */
+struct _mqtt_timer_wheel_timer_t
+{
+    /** \brief Link in the slot list, must stay the first field */
+    mqtt_timer_wheel_link_t link;
+    /** \brief Tick number of the expiration */
+    uint32_t expiration_tick;
+    /** \brief Timeout in ticks, 0 if the timer is not started */
+    uint32_t tick_timeout;
+    /** \brief Auto restart */
+    bool auto_restart;
+    /** \brief Indicate if the timer is in a slot of the wheel */
+    bool running;
+    /** \brief Indicate if the timer has expired since it has been started */
+    bool expired;
+    /** \brief Function called on expiration (can be NULL) */
+    fp_mqtt_timer_wheel_callback_t callback;
+    /** \brief Parameter of the expiration function */
+    void* param;
+};
+
+/** \brief Hierarchical timer wheel, must not be moved once initialized */
+typedef struct _mqtt_timer_wheel_t
+{
+    /** \brief Slot lists of each level */
+    mqtt_timer_wheel_link_t slots[MQTT_TIMER_WHEEL_LEVELS][MQTT_TIMER_WHEEL_SLOT_COUNT];
+    /** \brief Current tick number */
+    uint32_t current_tick;
+    /** \brief Time in ms of the current tick */
+    uint64_t current_time;
+    /** \brief Time in ms read by the last advance */
+    uint64_t last_time;
+    /** \brief Number of running timers */
+    uint32_t timer_count;
+} mqtt_timer_wheel_t;
+
+
+
+/** \brief Initialize a timer wheel */
+bool mqtt_timer_wheel_init(mqtt_timer_wheel_t* const wheel);
+
+/** \brief Initialize a timer with its expiration function */
+bool mqtt_timer_wheel_timer_init(mqtt_timer_wheel_timer_t* const timer, const fp_mqtt_timer_wheel_callback_t callback, void* const param);
+
+/** \brief Start a timer, the timeout is counted from the last advance of the wheel */
+bool mqtt_timer_wheel_start(mqtt_timer_wheel_t* const wheel, mqtt_timer_wheel_timer_t* const timer, const uint32_t ms_timeout, const bool auto_restart);
+
+/** \brief Restart a started timer with its timeout, has no effect on a cancelled timer */
+bool mqtt_timer_wheel_reset(mqtt_timer_wheel_t* const wheel, mqtt_timer_wheel_timer_t* const timer);
+
+/** \brief Cancel a timer */
+bool mqtt_timer_wheel_cancel(mqtt_timer_wheel_t* const wheel, mqtt_timer_wheel_timer_t* const timer);
+
+/** \brief Check if a timer has expired, the expiration of an auto restart timer is only reported once */
+bool mqtt_timer_wheel_has_expired(mqtt_timer_wheel_timer_t* const timer, bool* const has_expired);
+
+/** \brief Read the current time and expire the timers of all the elapsed ticks, must be called once per loop */
+bool mqtt_timer_wheel_advance(mqtt_timer_wheel_t* const wheel);
+
+/** \brief Get the time in ms read by the last advance, avoids reading the clock again in the same loop */
+bool mqtt_timer_wheel_get_time(const mqtt_timer_wheel_t* const wheel, uint64_t* const ms_time);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+
+#endif /* MQTT_TIMER_WHEEL_H */
@@ -20,6 +20,15 @@ along with lw-mqtt.  If not, see <http://www.gnu.org/licenses/>.
 #include <time.h>
 
 #include "mqtt_time.h"
+#include "mqtt_config.h"
+
+
+/** \brief Clock used to get the current time */
+#if defined(MQTT_TIME_COARSE_CLOCK_ENABLED) && defined(CLOCK_MONOTONIC_COARSE)
+#define MQTT_TIME_CLOCK     CLOCK_MONOTONIC_COARSE
+#else
+#define MQTT_TIME_CLOCK     CLOCK_MONOTONIC
+#endif
 
 
 /** \brief Initialize the MQTT time module */
@@ -36,18 +45,56 @@ bool mqtt_time_deinit(void)
     return true;
 }
 
-/** \brief Get the current time in milliseconds */
+/** \brief Get the current time in milliseconds (wraps after 49.7 days) */
 bool mqtt_time_get_current(uint32_t* const current_time)
 {
     bool ret = false;
 
     if (current_time != NULL)
     {
+        uint64_t current_time_64;
+        ret = mqtt_time_get_current_64(&current_time_64);
+        if (ret)
+        {
+            (*current_time) = (uint32_t)current_time_64;
+        }
+    }
+
+    return ret;
+}
+
+/** \brief Get the current time in milliseconds on 64 bits */
+bool mqtt_time_get_current_64(uint64_t* const current_time)
+{
+    bool ret = false;
+
+    if (current_time != NULL)
+    {
+        struct timespec ts;
+        const int callret = clock_gettime(MQTT_TIME_CLOCK, &ts);
+        if (callret == 0)
+        {
+            (*current_time) = (((uint64_t)ts.tv_sec) * 1000u) + (((uint64_t)ts.tv_nsec) / 1000000u);
+            ret = true;
+        }
+    }
+
+    return ret;
+}
+
+/** \brief Get the current time in microseconds from a precise monotonic clock (to measure durations) */
+bool mqtt_time_get_current_us(uint64_t* const current_time)
+{
+    bool ret = false;
+
+    if (current_time != NULL)
+    {
+        /* Never the coarse clock here, its resolution is too low */
         struct timespec ts;
         const int callret = clock_gettime(CLOCK_MONOTONIC, &ts);
         if (callret == 0)
         {
-            (*current_time) = (ts.tv_sec * 1000u) + (ts.tv_nsec/1000000u);
+            (*current_time) = (((uint64_t)ts.tv_sec) * 1000000u) + (((uint64_t)ts.tv_nsec) / 1000u);
             ret = true;
         }
     }
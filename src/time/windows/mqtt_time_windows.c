@@ -38,7 +38,7 @@ bool mqtt_time_deinit(void)
     return true;
 }
 
-/** \brief Get the current time in milliseconds */
+/** \brief Get the current time in milliseconds (wraps after 49.7 days) */
 bool mqtt_time_get_current(uint32_t* const current_time)
 {
     bool ret = false;
@@ -52,3 +52,39 @@ bool mqtt_time_get_current(uint32_t* const current_time)
     return ret;
 }
 
+/** \brief Get the current time in milliseconds on 64 bits */
+bool mqtt_time_get_current_64(uint64_t* const current_time)
+{
+    bool ret = false;
+
+    if (current_time != NULL)
+    {
+        (*current_time) = GetTickCount64();
+        ret = true;
+    }
+
+    return ret;
+}
+
+/** \brief Get the current time in microseconds from a precise monotonic clock (to measure durations) */
+bool mqtt_time_get_current_us(uint64_t* const current_time)
+{
+    bool ret = false;
+
+    if (current_time != NULL)
+    {
+        LARGE_INTEGER counter;
+        LARGE_INTEGER frequency;
+        if (QueryPerformanceCounter(&counter) && QueryPerformanceFrequency(&frequency))
+        {
+            /* Split the conversion to avoid overflowing the multiplication */
+            const uint64_t ticks = (uint64_t)counter.QuadPart;
+            const uint64_t ticks_per_second = (uint64_t)frequency.QuadPart;
+            (*current_time) = ((ticks / ticks_per_second) * 1000000u) + (((ticks % ticks_per_second) * 1000000u) / ticks_per_second);
+            ret = true;
+        }
+    }
+
+    return ret;
+}
+